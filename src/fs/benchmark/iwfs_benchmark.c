@@ -0,0 +1,850 @@
+#include "iowow.h"
+#include "log/iwlog.h"
+#include "fs/iwexfile.h"
+#include "fs/iwfsmfile.h"
+#include "utils/iwutils.h"
+#include "utils/iwarr.h"
+#include "utils/iwpool.h"
+#include "utils/khash.h"
+#include "utils/kbtree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+// Micro-benchmarks of fs layer and utility containers.
+// Results are written as JSON and optionally compared with a baseline
+// produced by previous run of this program.
+
+uint64_t iwfs_fsmdbg_find_next_set_bit(const uint64_t *addr,
+                                       uint64_t offset_bit,
+                                       uint64_t max_offset_bit,
+                                       int *found);
+uint64_t iwfs_fsmdbg_find_prev_set_bit(const uint64_t *addr,
+                                       uint64_t offset_bit,
+                                       uint64_t min_offset_bit,
+                                       int *found);
+const char *iwfs_fsmdbg_bmscan_select(int generic);
+
+#define BM_FILE "iwfs_bench.data"
+
+// Size of exfile record
+#define EXT_RECSZ 256
+
+// Number of bits in scanned bitmap
+#define BMSCAN_BITS (1024 * 1024)
+
+// Max length of benchmark name
+#define BM_NAME_MAX 63
+
+typedef struct BMCTX BMCTX;
+
+typedef bool (bench_method(BMCTX *ctx));
+
+struct BM {
+  char *program;
+  int param_num;
+  int param_repeat;
+  uint32_t param_seed;
+  double param_threshold;
+  const char *param_benchmarks;
+  const char *param_out;
+  const char *param_baseline;
+} bm;
+
+struct BMCTX {
+  const char *name;
+  int num;              /**< Scale of benchmark */
+  uint64_t ops;         /**< Number of measured operations */
+  uint64_t start_ns;
+  uint64_t end_ns;
+  uint64_t rnd_state;   /**< State of xorshift64* random generator */
+};
+
+/** Result of a single benchmark */
+typedef struct BMRES {
+  char name[BM_NAME_MAX + 1];
+  uint64_t ops;
+  double ns_per_op;
+} BMRES;
+
+// Accumulates results of measured operations so they are not optimized out
+static volatile uint64_t _bm_sink;
+
+static uint64_t _bm_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void _bm_start(BMCTX *ctx) {
+  ctx->start_ns = _bm_ns();
+}
+
+static void _bm_stop(BMCTX *ctx, uint64_t ops) {
+  ctx->end_ns = _bm_ns();
+  ctx->ops = ops;
+}
+
+static uint64_t _bm_rand(BMCTX *ctx) {
+  // xorshift64*
+  uint64_t x = ctx->rnd_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  ctx->rnd_state = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t _bm_rand_range(BMCTX *ctx, uint32_t range) {
+  return (_bm_rand(ctx) >> 32) % range;
+}
+
+static void _bm_shuffle(BMCTX *ctx, uint32_t *arr, int num) {
+  for (int i = num - 1; i > 0; --i) {
+    uint32_t j = _bm_rand_range(ctx, i + 1);
+    uint32_t t = arr[i];
+    arr[i] = arr[j];
+    arr[j] = t;
+  }
+}
+
+//--------------------------  IWFS_EXT
+
+static bool _ext_open(IWFS_EXT *f) {
+  IWFS_EXT_OPTS opts = {
+    .file = {
+      .path = BM_FILE,
+      .omode = IWFS_OTRUNC
+    },
+    .rspolicy = iw_exfile_szpolicy_fibo
+  };
+  iwrc rc = iwfs_exfile_open(f, &opts);
+  if (rc) {
+    iwlog_ecode_error2(rc, "Failed to open exfile");
+    return false;
+  }
+  return true;
+}
+
+static bool _ext_close(IWFS_EXT *f, iwrc rc) {
+  IWRC(f->close(f), rc);
+  unlink(BM_FILE);
+  if (rc) {
+    iwlog_ecode_error3(rc);
+    return false;
+  }
+  return true;
+}
+
+static iwrc _ext_fill(BMCTX *ctx, IWFS_EXT *f, const uint8_t *buf) {
+  size_t sp;
+  for (int i = 0; i < ctx->num; ++i) {
+    iwrc rc = f->write(f, (off_t) i * EXT_RECSZ, buf, EXT_RECSZ, &sp);
+    RCRET(rc);
+  }
+  return 0;
+}
+
+static bool _bm_exfile_write(BMCTX *ctx) {
+  IWFS_EXT f;
+  uint8_t buf[EXT_RECSZ];
+  memset(buf, 'w', sizeof(buf));
+  if (!_ext_open(&f)) {
+    return false;
+  }
+  _bm_start(ctx);
+  iwrc rc = _ext_fill(ctx, &f, buf);
+  _bm_stop(ctx, ctx->num);
+  return _ext_close(&f, rc);
+}
+
+static bool _bm_exfile_read(BMCTX *ctx) {
+  IWFS_EXT f;
+  size_t sp;
+  uint8_t buf[EXT_RECSZ];
+  memset(buf, 'r', sizeof(buf));
+  if (!_ext_open(&f)) {
+    return false;
+  }
+  iwrc rc = _ext_fill(ctx, &f, buf);
+  if (rc) {
+    return _ext_close(&f, rc);
+  }
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    off_t off = (off_t) _bm_rand_range(ctx, ctx->num) * EXT_RECSZ;
+    rc = f.read(&f, off, buf, EXT_RECSZ, &sp);
+    RCBREAK(rc);
+    _bm_sink += buf[0];
+  }
+  _bm_stop(ctx, ctx->num);
+  return _ext_close(&f, rc);
+}
+
+static bool _bm_exfile_mmap_write(BMCTX *ctx) {
+  IWFS_EXT f;
+  size_t sp;
+  uint8_t *mm, buf[EXT_RECSZ];
+  memset(buf, 'm', sizeof(buf));
+  if (!_ext_open(&f)) {
+    return false;
+  }
+  iwrc rc = f.add_mmap(&f, 0, SIZE_T_MAX);
+  RCGO(rc, finish);
+  rc = f.ensure_size(&f, (off_t) ctx->num * EXT_RECSZ);
+  RCGO(rc, finish);
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    off_t off = (off_t) _bm_rand_range(ctx, ctx->num) * EXT_RECSZ;
+    rc = f.acquire_mmap(&f, 0, &mm, &sp);
+    RCBREAK(rc);
+    memcpy(mm + off, buf, EXT_RECSZ);
+    f.dirty_mmap(&f, off, EXT_RECSZ);
+    f.release_mmap(&f);
+  }
+  _bm_stop(ctx, ctx->num);
+
+finish:
+  return _ext_close(&f, rc);
+}
+
+static bool _bm_exfile_mmap_read(BMCTX *ctx) {
+  IWFS_EXT f;
+  size_t sp;
+  uint8_t *mm, buf[EXT_RECSZ];
+  memset(buf, 'm', sizeof(buf));
+  if (!_ext_open(&f)) {
+    return false;
+  }
+  iwrc rc = _ext_fill(ctx, &f, buf);
+  RCGO(rc, finish);
+  rc = f.add_mmap(&f, 0, SIZE_T_MAX);
+  RCGO(rc, finish);
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    off_t off = (off_t) _bm_rand_range(ctx, ctx->num) * EXT_RECSZ;
+    rc = f.acquire_mmap(&f, 0, &mm, &sp);
+    RCBREAK(rc);
+    memcpy(buf, mm + off, EXT_RECSZ);
+    f.release_mmap(&f);
+    _bm_sink += buf[0];
+  }
+  _bm_stop(ctx, ctx->num);
+
+finish:
+  return _ext_close(&f, rc);
+}
+
+//--------------------------  IWFS_FSM
+
+typedef struct FSMREC {
+  off_t addr;
+  off_t len;
+} FSMREC;
+
+static bool _fsm_open(IWFS_FSM *f, iwfs_fsm_openflags oflags) {
+  IWFS_FSM_OPTS opts = {
+    .exfile = {
+      .file = {
+        .path = BM_FILE,
+        .omode = IWFS_OTRUNC
+      },
+      .rspolicy = iw_exfile_szpolicy_fibo
+    },
+    .bpow = 6,
+    .hdrlen = 64,
+    .oflags = oflags
+  };
+  iwrc rc = iwfs_fsmfile_open(f, &opts);
+  if (rc) {
+    iwlog_ecode_error2(rc, "Failed to open fsm file");
+    return false;
+  }
+  return true;
+}
+
+static bool _fsm_close(IWFS_FSM *f, FSMREC *recs, iwrc rc) {
+  IWRC(f->close(f), rc);
+  unlink(BM_FILE);
+  free(recs);
+  if (rc) {
+    iwlog_ecode_error3(rc);
+    return false;
+  }
+  return true;
+}
+
+// Random allocation size of 64..4096 bytes
+static off_t _fsm_rand_len(BMCTX *ctx) {
+  return 64 * (1 + _bm_rand_range(ctx, 64));
+}
+
+static iwrc _fsm_fill(BMCTX *ctx, IWFS_FSM *f, FSMREC *recs, int num) {
+  for (int i = 0; i < num; ++i) {
+    recs[i].addr = 0;
+    iwrc rc = f->allocate(f, _fsm_rand_len(ctx), &recs[i].addr, &recs[i].len, IWFSM_ALLOC_NO_OVERALLOCATE);
+    RCRET(rc);
+  }
+  return 0;
+}
+
+// Fill file and free every second record to fragment free space
+static iwrc _fsm_fragment(BMCTX *ctx, IWFS_FSM *f, FSMREC *recs) {
+  iwrc rc = _fsm_fill(ctx, f, recs, ctx->num);
+  RCRET(rc);
+  for (int i = 0; i < ctx->num; i += 2) {
+    rc = f->deallocate(f, recs[i].addr, recs[i].len);
+    RCRET(rc);
+    recs[i].addr = 0;
+    recs[i].len = 0;
+  }
+  return 0;
+}
+
+static bool _do_fsm_alloc(BMCTX *ctx, iwfs_fsm_openflags oflags) {
+  IWFS_FSM f;
+  FSMREC *recs = malloc(ctx->num * sizeof(*recs));
+  if (!recs || !_fsm_open(&f, oflags)) {
+    free(recs);
+    return false;
+  }
+  _bm_start(ctx);
+  iwrc rc = _fsm_fill(ctx, &f, recs, ctx->num);
+  _bm_stop(ctx, ctx->num);
+  return _fsm_close(&f, recs, rc);
+}
+
+static bool _bm_fsm_alloc(BMCTX *ctx) {
+  return _do_fsm_alloc(ctx, 0);
+}
+
+static bool _bm_fsm_alloc_mag(BMCTX *ctx) {
+  return _do_fsm_alloc(ctx, IWFSM_MAGAZINES);
+}
+
+static bool _bm_fsm_dealloc(BMCTX *ctx) {
+  IWFS_FSM f;
+  FSMREC *recs = malloc(ctx->num * sizeof(*recs));
+  uint32_t *idx = malloc(ctx->num * sizeof(*idx));
+  if (!recs || !idx || !_fsm_open(&f, 0)) {
+    free(recs);
+    free(idx);
+    return false;
+  }
+  iwrc rc = _fsm_fill(ctx, &f, recs, ctx->num);
+  RCGO(rc, finish);
+  for (int i = 0; i < ctx->num; ++i) {
+    idx[i] = i;
+  }
+  _bm_shuffle(ctx, idx, ctx->num);
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    rc = f.deallocate(&f, recs[idx[i]].addr, recs[idx[i]].len);
+    RCBREAK(rc);
+  }
+  _bm_stop(ctx, ctx->num);
+
+finish:
+  free(idx);
+  return _fsm_close(&f, recs, rc);
+}
+
+static bool _bm_fsm_alloc_frag(BMCTX *ctx) {
+  IWFS_FSM f;
+  FSMREC *recs = malloc(ctx->num * sizeof(*recs));
+  if (!recs || !_fsm_open(&f, 0)) {
+    free(recs);
+    return false;
+  }
+  iwrc rc = _fsm_fragment(ctx, &f, recs);
+  RCGO(rc, finish);
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; i += 2) {
+    rc = f.allocate(&f, _fsm_rand_len(ctx), &recs[i].addr, &recs[i].len, IWFSM_ALLOC_NO_OVERALLOCATE);
+    RCBREAK(rc);
+  }
+  _bm_stop(ctx, (ctx->num + 1) / 2);
+
+finish:
+  return _fsm_close(&f, recs, rc);
+}
+
+static bool _bm_fsm_realloc_frag(BMCTX *ctx) {
+  IWFS_FSM f;
+  FSMREC *recs = malloc(ctx->num * sizeof(*recs));
+  if (!recs || !_fsm_open(&f, 0)) {
+    free(recs);
+    return false;
+  }
+  iwrc rc = _fsm_fragment(ctx, &f, recs);
+  RCGO(rc, finish);
+  _bm_start(ctx);
+  for (int i = 1; i < ctx->num; i += 2) {
+    rc = f.reallocate(&f, _fsm_rand_len(ctx), &recs[i].addr, &recs[i].len, IWFSM_ALLOC_NO_OVERALLOCATE);
+    RCBREAK(rc);
+  }
+  _bm_stop(ctx, ctx->num / 2);
+
+finish:
+  return _fsm_close(&f, recs, rc);
+}
+
+//--------------------------  Bitmap scan
+
+static bool _do_bmscan(BMCTX *ctx, int generic, bool next) {
+  uint64_t *bmap = calloc(BMSCAN_BITS / 64, sizeof(*bmap));
+  if (!bmap) {
+    return false;
+  }
+  // Sparse bitmap, about one set bit per 4K bits
+  for (int i = 0; i < BMSCAN_BITS / 4096; ++i) {
+    uint32_t b = _bm_rand_range(ctx, BMSCAN_BITS);
+    bmap[b / 64] |= (uint64_t) 1 << (b & 63);
+  }
+  iwfs_fsmdbg_bmscan_select(generic);
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    int found;
+    uint64_t off = _bm_rand_range(ctx, BMSCAN_BITS);
+    if (next) {
+      _bm_sink += iwfs_fsmdbg_find_next_set_bit(bmap, off, BMSCAN_BITS, &found);
+    } else {
+      _bm_sink += iwfs_fsmdbg_find_prev_set_bit(bmap, off, 0, &found);
+    }
+  }
+  _bm_stop(ctx, ctx->num);
+  iwfs_fsmdbg_bmscan_select(0);
+  free(bmap);
+  return true;
+}
+
+static bool _bm_bmscan_next(BMCTX *ctx) {
+  return _do_bmscan(ctx, 0, true);
+}
+
+static bool _bm_bmscan_prev(BMCTX *ctx) {
+  return _do_bmscan(ctx, 0, false);
+}
+
+static bool _bm_bmscan_next_generic(BMCTX *ctx) {
+  return _do_bmscan(ctx, 1, true);
+}
+
+static bool _bm_bmscan_prev_generic(BMCTX *ctx) {
+  return _do_bmscan(ctx, 1, false);
+}
+
+//--------------------------  Sorted arrays
+
+static int _u64_cmp(const void *v1, const void *v2) {
+  uint64_t a = *(const uint64_t *) v1, b = *(const uint64_t *) v2;
+  return a > b ? 1 : a < b ? -1 : 0;
+}
+
+// Sorted array of `num` random values, memmove cost of inserts grows
+// quadratically so number of elements is limited by `num / 10`
+static uint64_t *_arr_fill(BMCTX *ctx, int num, int *onum) {
+  uint64_t *arr = malloc((num + 1) * sizeof(*arr));
+  int n = 0;
+  if (!arr) {
+    return 0;
+  }
+  for (int i = 0; i < num; ++i) {
+    uint64_t v = _bm_rand(ctx);
+    if (iwarr_sorted_insert(arr, n, sizeof(*arr), &v, _u64_cmp, true) >= 0) {
+      ++n;
+    }
+  }
+  *onum = n;
+  return arr;
+}
+
+static bool _bm_iwarr_insert(BMCTX *ctx) {
+  int n, num = ctx->num / 10 + 1;
+  _bm_start(ctx);
+  uint64_t *arr = _arr_fill(ctx, num, &n);
+  _bm_stop(ctx, num);
+  free(arr);
+  return arr != 0;
+}
+
+static bool _bm_iwarr_find(BMCTX *ctx) {
+  int n;
+  uint64_t *arr = _arr_fill(ctx, ctx->num / 10 + 1, &n);
+  if (!arr) {
+    return false;
+  }
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    // Every second lookup is a miss
+    uint64_t v = (i & 1) ? _bm_rand(ctx) : arr[_bm_rand_range(ctx, n)];
+    _bm_sink += iwarr_sorted_find(arr, n, sizeof(*arr), &v, _u64_cmp);
+  }
+  _bm_stop(ctx, ctx->num);
+  free(arr);
+  return true;
+}
+
+static bool _bm_iwarr_remove(BMCTX *ctx) {
+  int n;
+  uint64_t *arr = _arr_fill(ctx, ctx->num / 10 + 1, &n);
+  if (!arr) {
+    return false;
+  }
+  int num = n;
+  _bm_start(ctx);
+  while (n > 0) {
+    uint64_t v = arr[_bm_rand_range(ctx, n)];
+    if (!iwarr_sorted_remove(arr, n, sizeof(*arr), &v, _u64_cmp)) {
+      free(arr);
+      return false;
+    }
+    --n;
+  }
+  _bm_stop(ctx, num);
+  free(arr);
+  return true;
+}
+
+//--------------------------  khash / kbtree
+
+KHASH_MAP_INIT_INT64(BMH, uint64_t)
+
+#define _bmt_cmp(a, b) (((a) > (b)) - ((a) < (b)))
+
+KBTREE_INIT(BMT, uint64_t, _bmt_cmp)
+
+static bool _bm_khash_put(BMCTX *ctx) {
+  int ret = 0;
+  khash_t(BMH) *h = kh_init(BMH);
+  if (!h) {
+    return false;
+  }
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    khiter_t k = kh_put(BMH, h, _bm_rand(ctx), &ret);
+    if (ret < 0) {
+      break;
+    }
+    kh_value(h, k) = i;
+  }
+  _bm_stop(ctx, ctx->num);
+  kh_destroy(BMH, h);
+  return ret >= 0;
+}
+
+static bool _bm_khash_get(BMCTX *ctx) {
+  int ret;
+  uint64_t seed = ctx->rnd_state;
+  khash_t(BMH) *h = kh_init(BMH);
+  if (!h) {
+    return false;
+  }
+  for (int i = 0; i < ctx->num; ++i) {
+    khiter_t k = kh_put(BMH, h, _bm_rand(ctx), &ret);
+    if (ret < 0) {
+      kh_destroy(BMH, h);
+      return false;
+    }
+    kh_value(h, k) = i;
+  }
+  // Replay keys sequence, every second lookup is a miss
+  ctx->rnd_state = seed;
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    uint64_t key = _bm_rand(ctx) + (i & 1);
+    khiter_t k = kh_get(BMH, h, key);
+    if (k != kh_end(h)) {
+      _bm_sink += kh_value(h, k);
+    }
+  }
+  _bm_stop(ctx, ctx->num);
+  kh_destroy(BMH, h);
+  return true;
+}
+
+static bool _bm_kbtree_put(BMCTX *ctx) {
+  kbtree_t(BMT) *t = kb_init(BMT, KB_DEFAULT_SIZE);
+  if (!t) {
+    return false;
+  }
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    kb_put(BMT, t, _bm_rand(ctx));
+  }
+  _bm_stop(ctx, ctx->num);
+  kb_destroy(BMT, t);
+  return true;
+}
+
+static bool _bm_kbtree_get(BMCTX *ctx) {
+  uint64_t seed = ctx->rnd_state;
+  kbtree_t(BMT) *t = kb_init(BMT, KB_DEFAULT_SIZE);
+  if (!t) {
+    return false;
+  }
+  for (int i = 0; i < ctx->num; ++i) {
+    kb_put(BMT, t, _bm_rand(ctx));
+  }
+  ctx->rnd_state = seed;
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    uint64_t key = _bm_rand(ctx) + (i & 1);
+    _bm_sink += (kb_get(BMT, t, key) != 0);
+  }
+  _bm_stop(ctx, ctx->num);
+  kb_destroy(BMT, t);
+  return true;
+}
+
+//--------------------------  iwpool
+
+static bool _bm_iwpool_alloc(BMCTX *ctx) {
+  IWPOOL *pool = iwpool_create(0);
+  if (!pool) {
+    return false;
+  }
+  _bm_start(ctx);
+  for (int i = 0; i < ctx->num; ++i) {
+    size_t siz = 8 + _bm_rand_range(ctx, 249);
+    uint8_t *ptr = iwpool_alloc(siz, pool);
+    if (!ptr) {
+      iwpool_destroy(pool);
+      return false;
+    }
+    ptr[0] = (uint8_t) i;
+  }
+  iwpool_destroy(pool);
+  _bm_stop(ctx, ctx->num);
+  return true;
+}
+
+//--------------------------  Runner
+
+static const struct {
+  const char *name;
+  bench_method *method;
+  const char *help;
+} _bm_methods[] = {
+  { "exfile_write",         _bm_exfile_write,         "sequential writes of N 256 bytes records" },
+  { "exfile_read",          _bm_exfile_read,          "N random reads of 256 bytes records" },
+  { "exfile_mmap_write",    _bm_exfile_mmap_write,    "N random 256 bytes writes through mmaped region" },
+  { "exfile_mmap_read",     _bm_exfile_mmap_read,     "N random 256 bytes reads through mmaped region" },
+  { "fsm_alloc",            _bm_fsm_alloc,            "N allocations of 64..4096 bytes" },
+  { "fsm_alloc_mag",        _bm_fsm_alloc_mag,        "N allocations of 64..4096 bytes with size-class magazines" },
+  { "fsm_dealloc",          _bm_fsm_dealloc,          "N deallocations in random order" },
+  { "fsm_alloc_frag",       _bm_fsm_alloc_frag,       "N/2 allocations in fragmented free space" },
+  { "fsm_realloc_frag",     _bm_fsm_realloc_frag,     "N/2 reallocations in fragmented free space" },
+  { "bmscan_next",          _bm_bmscan_next,          "N forward scans of sparse bitmap" },
+  { "bmscan_prev",          _bm_bmscan_prev,          "N backward scans of sparse bitmap" },
+  { "bmscan_next_generic",  _bm_bmscan_next_generic,  "N forward scans of sparse bitmap by generic kernel" },
+  { "bmscan_prev_generic",  _bm_bmscan_prev_generic,  "N backward scans of sparse bitmap by generic kernel" },
+  { "iwarr_insert",         _bm_iwarr_insert,         "N/10 inserts into sorted array" },
+  { "iwarr_find",           _bm_iwarr_find,           "N lookups in sorted array of N/10 elements" },
+  { "iwarr_remove",         _bm_iwarr_remove,         "removal of all elements of sorted array of N/10 elements" },
+  { "khash_put",            _bm_khash_put,            "N inserts into khash map" },
+  { "khash_get",            _bm_khash_get,            "N lookups in khash map of N elements" },
+  { "kbtree_put",           _bm_kbtree_put,           "N inserts into kbtree" },
+  { "kbtree_get",           _bm_kbtree_get,           "N lookups in kbtree of N elements" },
+  { "iwpool_alloc",         _bm_iwpool_alloc,         "N allocations of 8..256 bytes from iwpool" },
+};
+
+#define BM_METHODS_NUM (sizeof(_bm_methods) / sizeof(_bm_methods[0]))
+
+static void _bm_help(void) {
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Usage %s [options]\n\n", bm.program);
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -h Show this help\n");
+  fprintf(stderr, "  -n <num> Scale of benchmarks, default: %d\n", bm.param_num);
+  fprintf(stderr, "  -r <num> Number of runs of every benchmark, the best one is reported, default: %d\n",
+          bm.param_repeat);
+  fprintf(stderr, "  -b <comma separated benchmarks to run>\n");
+  fprintf(stderr, "  -rs <random seed> Random seed of benchmark data, default: %u\n", bm.param_seed);
+  fprintf(stderr, "  -o <file> Write JSON results into file instead of stdout\n");
+  fprintf(stderr, "  -c <file> Compare results with baseline JSON file of previous run\n");
+  fprintf(stderr, "  -th <percent> Allowed slowdown against baseline, default: %.0f\n\n", bm.param_threshold);
+  fprintf(stderr, "Available benchmarks:\n");
+  for (size_t i = 0; i < BM_METHODS_NUM; ++i) {
+    fprintf(stderr, "  %-22s %s\n", _bm_methods[i].name, _bm_methods[i].help);
+  }
+  fprintf(stderr, "\n");
+}
+
+static bool _bm_init(int argc, char *argv[]) {
+  bm.program = argv[0];
+  bm.param_num = 100000;
+  bm.param_repeat = 3;
+  bm.param_seed = 1;
+  bm.param_threshold = 10;
+#ifndef NDEBUG
+  fprintf(stderr, "WARNING: Assertions are enabled, benchmarks can be slow\n");
+#endif
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-h")) {
+      _bm_help();
+      return false;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "'%s' option has no value\n", argv[i]);
+      return false;
+    }
+    if (!strcmp(argv[i], "-n")) {
+      bm.param_num = atoi(argv[++i]);
+      if (bm.param_num < 2) {
+        fprintf(stderr, "'-n <num>' invalid option value\n");
+        return false;
+      }
+    } else if (!strcmp(argv[i], "-r")) {
+      bm.param_repeat = atoi(argv[++i]);
+      if (bm.param_repeat < 1) {
+        fprintf(stderr, "'-r <num>' invalid option value\n");
+        return false;
+      }
+    } else if (!strcmp(argv[i], "-b")) {
+      bm.param_benchmarks = argv[++i];
+    } else if (!strcmp(argv[i], "-rs")) {
+      bm.param_seed = atoll(argv[++i]);
+    } else if (!strcmp(argv[i], "-o")) {
+      bm.param_out = argv[++i];
+    } else if (!strcmp(argv[i], "-c")) {
+      bm.param_baseline = argv[++i];
+    } else if (!strcmp(argv[i], "-th")) {
+      bm.param_threshold = atof(argv[++i]);
+      if (bm.param_threshold < 0) {
+        fprintf(stderr, "'-th <percent>' invalid option value\n");
+        return false;
+      }
+    } else {
+      fprintf(stderr, "Unknown option: '%s'\n", argv[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool _bm_selected(const char *name) {
+  const char *ptr = bm.param_benchmarks;
+  size_t len = strlen(name);
+  if (!ptr) {
+    return true;
+  }
+  while (*ptr) {
+    while (*ptr == ',' || isspace(*ptr)) ++ptr;
+    if (!strncmp(ptr, name, len) && (ptr[len] == ',' || ptr[len] == '\0' || isspace(ptr[len]))) {
+      return true;
+    }
+    while (*ptr && *ptr != ',') ++ptr;
+  }
+  return false;
+}
+
+// Best of `bm.param_repeat` runs, every run uses the same random data
+static bool _bm_run(int idx, BMRES *res) {
+  memset(res, 0, sizeof(*res));
+  strncpy(res->name, _bm_methods[idx].name, BM_NAME_MAX);
+  for (int i = 0; i < bm.param_repeat; ++i) {
+    BMCTX ctx = {
+      .name = _bm_methods[idx].name,
+      .num = bm.param_num,
+      .rnd_state = (((uint64_t) bm.param_seed << 32) ^ (0x9E3779B97F4A7C15ULL * (idx + 1))) | 1
+    };
+    if (!_bm_methods[idx].method(&ctx) || !ctx.ops) {
+      fprintf(stderr, "Failed to run benchmark: %s\n", ctx.name);
+      return false;
+    }
+    double ns = (double) (ctx.end_ns - ctx.start_ns) / ctx.ops;
+    if (!i || ns < res->ns_per_op) {
+      res->ns_per_op = ns;
+      res->ops = ctx.ops;
+    }
+  }
+  fprintf(stderr, " done: %-22s %10" PRIu64 " ops %12.2f ns/op\n", res->name, res->ops, res->ns_per_op);
+  return true;
+}
+
+static void _bm_write_json(FILE *out, const BMRES *res, int num) {
+  // One result per line, baseline reader depends on it
+  fprintf(out, "{\n  \"seed\": %u,\n  \"num\": %d,\n  \"repeat\": %d,\n  \"results\": [\n",
+          bm.param_seed, bm.param_num, bm.param_repeat);
+  for (int i = 0; i < num; ++i) {
+    fprintf(out, "    {\"name\": \"%s\", \"ops\": %" PRIu64 ", \"ns_per_op\": %.2f}%s\n",
+            res[i].name, res[i].ops, res[i].ns_per_op, i + 1 < num ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+// Returns number of benchmarks slower than baseline by more than `bm.param_threshold` percent
+static int _bm_compare(const BMRES *res, int num) {
+  char line[256];
+  int regressions = 0;
+  FILE *f = fopen(bm.param_baseline, "r");
+  if (!f) {
+    fprintf(stderr, "Failed to open baseline file: %s\n", bm.param_baseline);
+    return -1;
+  }
+  fprintf(stderr, "\n baseline: %s threshold: %.0f%%\n", bm.param_baseline, bm.param_threshold);
+  while (fgets(line, sizeof(line), f)) {
+    BMRES b;
+    if (sscanf(line, " {\"name\": \"%63[^\"]\", \"ops\": %" SCNu64 ", \"ns_per_op\": %lf}",
+               b.name, &b.ops, &b.ns_per_op) != 3) {
+      continue;
+    }
+    for (int i = 0; i < num; ++i) {
+      if (strcmp(res[i].name, b.name)) {
+        continue;
+      }
+      double diff = b.ns_per_op > 0 ? 100.0 * (res[i].ns_per_op - b.ns_per_op) / b.ns_per_op : 0;
+      bool regression = diff > bm.param_threshold;
+      if (regression) {
+        ++regressions;
+      }
+      fprintf(stderr, " %s %-22s %12.2f -> %12.2f ns/op %+7.1f%%\n",
+              regression ? "REGRESSION" : "ok        ", b.name, b.ns_per_op, res[i].ns_per_op, diff);
+      break;
+    }
+  }
+  fclose(f);
+  return regressions;
+}
+
+int main(int argc, char **argv) {
+  BMRES res[BM_METHODS_NUM];
+  int num = 0;
+  if (iw_init() || !_bm_init(argc, argv)) {
+    return 1;
+  }
+  fprintf(stderr, "\n random seed: %u\n scale: %d\n runs: %d\n\n", bm.param_seed, bm.param_num, bm.param_repeat);
+  for (size_t i = 0; i < BM_METHODS_NUM; ++i) {
+    if (!_bm_selected(_bm_methods[i].name)) {
+      continue;
+    }
+    if (!_bm_run(i, &res[num])) {
+      return 1;
+    }
+    ++num;
+  }
+  FILE *out = bm.param_out ? fopen(bm.param_out, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "Failed to open output file: %s\n", bm.param_out);
+    return 1;
+  }
+  _bm_write_json(out, res, num);
+  if (out != stdout) {
+    fclose(out);
+  }
+  if (bm.param_baseline) {
+    int regressions = _bm_compare(res, num);
+    if (regressions < 0) {
+      return 1;
+    } else if (regressions > 0) {
+      fprintf(stderr, "\n %d benchmark(s) regressed\n", regressions);
+      return 2;
+    }
+  }
+  return 0;
+}
@@ -28,8 +28,11 @@
 #include "iwutils.h"
 #include "iwlog.h"
 #include "iwexfile.h"
+#include "iwbits.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <sys/mman.h>
 
 struct MMAPSLOT;
@@ -45,6 +48,24 @@ typedef struct IWFS_EXT_IMPL {
   off_t maxoff;              /**< Maximum allowed file offset. Unlimited if zero.
                                   If maximum offset is reached `IWFS_ERROR_MAXOFF` will be reported. */
   iwfs_omode omode;          /**< File open mode */
+  iwfs_ext_mmap_opts mmap_opts; /**< Memory mapping options */
+  uint16_t numa_node;        /**< NUMA node of mmaped regions if `IWFS_MMAP_NUMA` is set */
+  int preallocate;           /**< Preallocate disk space of grown file */
+  uint8_t dirty_bpow;        /**< Size power of 2 of dirty ranges tracking unit, `0` if tracking is off */
+  atomic_uint_fast64_t *dirty_bm; /**< Bitmap of dirty tracking units */
+  size_t dirty_bmlen;        /**< Number of words in `dirty_bm` */
+  atomic_size_t dirty_num;   /**< Number of dirty units */
+  size_t dirty_threshold;    /**< Size of dirty data starting background writeback */
+  pthread_t flusher;         /**< Background writeback thread */
+  pthread_mutex_t fmtx;      /**< Flusher mutex */
+  pthread_cond_t fcond;      /**< Flusher wakeup cond */
+  bool fstarted;             /**< Flusher thread is started */
+  bool fstop;                /**< Flusher thread should be stopped */
+  const IWTRACE *trace;      /**< Tracing hooks, zero if not set */
+  off_t dsize;               /**< Size of file on disk, greater than `fsize` while shrinking
+                                  of `IWFS_MMAP_PRIVATE` file is deferred until writeback */
+  IW_EXT_WBHOOK wbhook;      /**< Writeback hook of `IWFS_MMAP_PRIVATE` file */
+  void *wbhook_opaq;         /**< Opaque data of `wbhook` */
   HANDLE fh;                 /**< File handle */
 } EXF;
 
@@ -52,6 +73,7 @@ typedef struct MMAPSLOT {
   off_t off;     /**< Offset to a memory mapped region */
   size_t len;    /**< Actual size of memory mapped region. */
   size_t maxlen; /**< Maximum length of memory mapped region */
+  size_t rlen;   /**< Length of reserved address space starting at `mmap`, `0` if not reserved */
 #ifdef _WIN32
   HANDLE mmapfh; /**< Win32 file mapping handle. */
 #endif
@@ -113,6 +135,107 @@ static iwrc _exfile_destroylocks(EXF *impl) {
   return rv ? iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rv) : 0;
 }
 
+// Max address space reserved for a single mmap slot
+#define MMAP_RESERVE_MAX ((uint64_t) 1 << 40)
+
+// Apply access pattern hints of `IWFS_EXT_OPTS::mmap_opts` to the mapped range.
+// Hints are advisory, so errors (eg: no transparent huge pages support) are ignored.
+static void _exfile_madvise_lw(EXF *impl, uint8_t *addr, size_t len) {
+  iwfs_ext_mmap_opts mo = impl->mmap_opts;
+#ifdef MADV_RANDOM
+  if (mo & IWFS_MMAP_RANDOM) {
+    madvise(addr, len, MADV_RANDOM);
+  } else if (mo & IWFS_MMAP_SEQUENTIAL) {
+    madvise(addr, len, MADV_SEQUENTIAL);
+  }
+#endif
+#ifdef MADV_HUGEPAGE
+  if (mo & IWFS_MMAP_HUGEPAGE) {
+    madvise(addr, len, MADV_HUGEPAGE);
+  }
+#endif
+  if (mo & IWFS_MMAP_NUMA) {
+    iwp_numa_bind(addr, len, impl->numa_node);
+  }
+}
+
+IW_INLINE bool _exfile_private(EXF *impl) {
+  return (impl->mmap_opts & IWFS_MMAP_PRIVATE) && (impl->omode & IWFS_OWRITE);
+}
+
+IW_INLINE int _exfile_mmap_flags(EXF *impl) {
+  int flags = _exfile_private(impl) ? MAP_PRIVATE : MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (impl->mmap_opts & IWFS_MMAP_POPULATE) {
+    flags |= MAP_POPULATE;
+  }
+#endif
+  return flags;
+}
+
+/**
+ * @brief Reserve address space for all possible length of slot.
+ * @details Reservation is limited by `IWFS_EXT_OPTS::maxoff`, so it is done only for
+ *          slots of bounded length on 64 bit platforms. If reservation is failed
+ *          slot is remapped as a whole on every file resize.
+ *          Reserved pages not backed by file are readable as zeros,
+ *          so lock-free readers of `IWFS_EXT::stable_mmap` never fault on them.
+ */
+static void _exfile_reserve_slot_lw(EXF *impl, MMAPSLOT *s) {
+#if defined(MAP_ANONYMOUS) && defined(MAP_NORESERVE) && defined(MAP_FIXED)
+  if (sizeof(size_t) < sizeof(uint64_t)) {
+    return;
+  }
+  uint64_t rlen = s->maxlen;
+  if (impl->maxoff) {
+    if (impl->maxoff <= s->off) {
+      return;
+    }
+    rlen = MIN(rlen, (uint64_t) (impl->maxoff - s->off));
+  }
+  if (rlen > MMAP_RESERVE_MAX) {
+    return;
+  }
+  void *p = mmap(0, rlen, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p != MAP_FAILED) {
+    s->mmap = p;
+    s->rlen = rlen;
+  }
+#endif
+}
+
+/**
+ * @brief Resize mapping within reserved address space of slot.
+ * @details Grown part of file is mapped in place over reserved space and truncated part
+ *          is returned back to reservation, so slot address is never changed.
+ */
+static iwrc _exfile_resize_reserved_slot_lw(EXF *impl, MMAPSLOT *s, size_t nlen) {
+#if defined(MAP_ANONYMOUS) && defined(MAP_NORESERVE) && defined(MAP_FIXED)
+  if (nlen > s->len) {
+    int prot = (impl->omode & IWFS_OWRITE) ? (PROT_WRITE | PROT_READ) : (PROT_READ);
+    uint8_t *addr = s->mmap + s->len;
+    void *p = mmap(addr, nlen - s->len, prot, _exfile_mmap_flags(impl) | MAP_FIXED, impl->fh, s->off + s->len);
+    if (p == MAP_FAILED) {
+      return iwrc_set_errno(IW_ERROR_ERRNO, errno);
+    }
+    assert(p == addr);
+    if (impl->mmap_opts) {
+      _exfile_madvise_lw(impl, addr, nlen - s->len);
+    }
+  } else {
+    uint8_t *addr = s->mmap + nlen;
+    void *p = mmap(addr, s->len - nlen, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    if (p == MAP_FAILED) {
+      return iwrc_set_errno(IW_ERROR_ERRNO, errno);
+    }
+  }
+  s->len = nlen;
+  return 0;
+#else
+  return IW_ERROR_NOT_IMPLEMENTED;
+#endif
+}
+
 static iwrc _exfile_initmmap_slot_lw(struct IWFS_EXT *f, MMAPSLOT *s) {
   assert(f && s);
   size_t nlen;
@@ -125,6 +248,43 @@ static iwrc _exfile_initmmap_slot_lw(struct IWFS_EXT *f, MMAPSLOT *s) {
   if (nlen == s->len) {
     return 0;
   }
+  if (!s->len && !s->rlen) {
+    _exfile_reserve_slot_lw(impl, s);
+  }
+  if (s->rlen) {
+    if (nlen <= s->rlen) {
+      return _exfile_resize_reserved_slot_lw(impl, s, nlen);
+    }
+    // File is greater than reserved space, fallback to the plain mapping
+    if (_exfile_private(impl) && s->len) {
+      // Keep mapped part with private changes, it is moved by `mremap` below
+      if (s->rlen > s->len && munmap(s->mmap + s->len, s->rlen - s->len) == -1) {
+        return iwrc_set_errno(IW_ERROR_ERRNO, errno);
+      }
+    } else {
+      if (munmap(s->mmap, s->rlen) == -1) {
+        return iwrc_set_errno(IW_ERROR_ERRNO, errno);
+      }
+      s->mmap = 0;
+      s->len = 0;
+    }
+    s->rlen = 0;
+  }
+#ifdef MREMAP_MAYMOVE
+  if (s->len && nlen && _exfile_private(impl)) {
+    // Private changes are lost by unmapping, so region is resized in place or moved as a whole
+    void *p = mremap(s->mmap, s->len, nlen, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED) {
+      return iwrc_set_errno(IW_ERROR_ERRNO, errno);
+    }
+    if (impl->mmap_opts && nlen > s->len) {
+      _exfile_madvise_lw(impl, (uint8_t *) p + s->len, nlen - s->len);
+    }
+    s->mmap = p;
+    s->len = nlen;
+    return 0;
+  }
+#endif
   if (s->len) {  // unmap me first
     assert(s->mmap);
     if (munmap(s->mmap, s->len) == -1) {
@@ -134,13 +294,15 @@ static iwrc _exfile_initmmap_slot_lw(struct IWFS_EXT *f, MMAPSLOT *s) {
     s->len = 0;
   }
   if (nlen > 0) {
-    int flags = MAP_SHARED;
     int prot = (impl->omode & IWFS_OWRITE) ? (PROT_WRITE | PROT_READ) : (PROT_READ);
     s->len = nlen;
-    s->mmap = mmap(0, s->len, prot, flags, impl->fh, s->off);
+    s->mmap = mmap(0, s->len, prot, _exfile_mmap_flags(impl), impl->fh, s->off);
     if (s->mmap == MAP_FAILED) {
       return iwrc_set_errno(IW_ERROR_ERRNO, errno);
     }
+    if (impl->mmap_opts) {
+      _exfile_madvise_lw(impl, s->mmap, s->len);
+    }
   }
   return 0;
 }
@@ -161,12 +323,333 @@ static iwrc _exfile_initmmap_lw(struct IWFS_EXT *f) {
   return rc;
 }
 
+//--------------------------  DIRTY RANGES
+
+// Interval of flusher thread checks of dirty data size
+#define FLUSHER_INTERVAL_MS 1000
+
+/**
+ * @brief Ensure dirty bitmap covers file of `size` bytes.
+ * @details Called under write lock. Bitmap covering `maxoff` is allocated once,
+ *          so it is never reallocated under active writers.
+ */
+static iwrc _exfile_dirty_ensure_lw(EXF *impl, off_t size) {
+  if (!impl->dirty_bpow) {
+    return 0;
+  }
+  size_t nlen = ((size >> impl->dirty_bpow) + 64) / 64;
+  if (nlen <= impl->dirty_bmlen) {
+    return 0;
+  }
+  atomic_uint_fast64_t *bm = realloc(impl->dirty_bm, nlen * sizeof(*bm));
+  if (!bm) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  for (size_t i = impl->dirty_bmlen; i < nlen; ++i) {
+    atomic_init(&bm[i], 0);
+  }
+  impl->dirty_bm = bm;
+  impl->dirty_bmlen = nlen;
+  return 0;
+}
+
+static void _exfile_dirty(EXF *impl, off_t off, off_t len) {
+  if (!impl->dirty_bm || len <= 0 || off < 0) {
+    return;
+  }
+  uint64_t u = (uint64_t) off >> impl->dirty_bpow;
+  uint64_t ue = (uint64_t) (off + len - 1) >> impl->dirty_bpow;
+  if (ue >= impl->dirty_bmlen * 64) {
+    ue = impl->dirty_bmlen * 64 - 1;
+  }
+  for ( ; u <= ue; ++u) {
+    atomic_uint_fast64_t *wp = &impl->dirty_bm[u / 64];
+    uint64_t m = (uint64_t) 1 << (u & 63);
+    if ((atomic_load_explicit(wp, memory_order_relaxed) & m)
+        || (atomic_fetch_or_explicit(wp, m, memory_order_relaxed) & m)) {
+      continue;
+    }
+    size_t n = atomic_fetch_add_explicit(&impl->dirty_num, 1, memory_order_relaxed) + 1;
+    if (impl->fstarted && (n << impl->dirty_bpow) >= impl->dirty_threshold
+        && ((n - 1) << impl->dirty_bpow) < impl->dirty_threshold) {
+      pthread_cond_signal(&impl->fcond);
+    }
+  }
+}
+
+/**
+ * @brief Flush mmaped part of file range `[off, end)`.
+ * @param mflags `msync` flags or `0` to start asynchronous writeback
+ */
+static iwrc _exfile_flush_range_lr(EXF *impl, off_t off, off_t end, int mflags) {
+  iwrc rc = 0;
+  if (end > impl->fsize) {
+    end = impl->fsize;
+  }
+  for (MMAPSLOT *s = impl->mmslots; s && off < end; s = s->next) {
+    off_t soff = MAX(off, s->off);
+    off_t send = MIN(end, s->off + (off_t) s->len);
+    if (soff >= send) {
+      continue;
+    }
+#ifdef SYNC_FILE_RANGE_WRITE
+    if (!mflags) {
+      if (sync_file_range(impl->fh, soff, send - soff, SYNC_FILE_RANGE_WRITE)) {
+        rc = iwrc_set_errno(IW_ERROR_IO_ERRNO, errno);
+      }
+      continue;
+    }
+#endif
+    if (msync(s->mmap + (soff - s->off), send - soff, mflags ? mflags : MS_ASYNC)) {
+      rc = iwrc_set_errno(IW_ERROR_IO_ERRNO, errno);
+    }
+  }
+  return rc;
+}
+
+/**
+ * @brief Flush all dirty ranges and reset dirty bitmap.
+ * @param mflags `msync` flags or `0` to start asynchronous writeback
+ */
+static iwrc _exfile_flush_dirty_lr(EXF *impl, int mflags) {
+  iwrc rc = 0;
+  off_t rstart = -1;
+  uint8_t bpow = impl->dirty_bpow;
+  for (size_t i = 0; i < impl->dirty_bmlen; ++i) {
+    uint64_t w = atomic_load_explicit(&impl->dirty_bm[i], memory_order_relaxed);
+    if (w) {
+      w = atomic_exchange_explicit(&impl->dirty_bm[i], 0, memory_order_acq_rel);
+      atomic_fetch_sub_explicit(&impl->dirty_num, (size_t) iwbits_count64(w), memory_order_relaxed);
+    }
+    if (w == UINT64_MAX) {
+      if (rstart < 0) {
+        rstart = (off_t) i * 64;
+      }
+      continue;
+    }
+    for (int b = 0; b < 64; ++b) {
+      off_t u = (off_t) i * 64 + b;
+      if (w & ((uint64_t) 1 << b)) {
+        if (rstart < 0) {
+          rstart = u;
+        }
+      } else if (rstart >= 0) {
+        IWRC(_exfile_flush_range_lr(impl, rstart << bpow, u << bpow, mflags), rc);
+        rstart = -1;
+      }
+      if (!(w >> b) && rstart < 0) {
+        break;
+      }
+    }
+  }
+  if (rstart >= 0) {
+    IWRC(_exfile_flush_range_lr(impl, rstart << bpow, (off_t) impl->dirty_bmlen * 64 << bpow, mflags), rc);
+  }
+  return rc;
+}
+
+// Add requests of mmaped parts of file range `[off, end)` to `*reqsp` array
+static iwrc _exfile_wb_add(EXF *impl, IWP_IOREQ **reqsp, int *nump, int *capp, off_t off, off_t end) {
+  for (MMAPSLOT *s = impl->mmslots; s && off < end; s = s->next) {
+    off_t soff = MAX(off, s->off);
+    off_t send = MIN(end, s->off + (off_t) s->len);
+    if (soff >= send) {
+      continue;
+    }
+    if (*nump == *capp) {
+      int ncap = *capp ? *capp * 2 : 64;
+      IWP_IOREQ *nreqs = realloc(*reqsp, ncap * sizeof(**reqsp));
+      if (!nreqs) {
+        return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      }
+      *reqsp = nreqs;
+      *capp = ncap;
+    }
+    (*reqsp)[(*nump)++] = (IWP_IOREQ) {
+      .off = soff,
+      .buf = s->mmap + (soff - s->off),
+      .len = send - soff
+    };
+  }
+  return 0;
+}
+
+/**
+ * @brief Write modified ranges of `IWFS_MMAP_PRIVATE` file in place and sync file.
+ * @details Ranges are passed to writeback hook before the file is changed, deferred
+ *          shrinking of file is applied after ranges are written. Written pages are
+ *          dropped from process memory, so mapping is backed by the file again.
+ */
+static iwrc _exfile_writeback_wl(EXF *impl, iwfs_sync_flags flags) {
+  iwrc rc = 0;
+  int num = 0, cap = 0;
+  off_t rstart = -1;
+  IWP_IOREQ *reqs = 0;
+  uint8_t bpow = impl->dirty_bpow;
+  uint64_t un = ((uint64_t) impl->fsize + ((uint64_t) 1 << bpow) - 1) >> bpow;
+  for (uint64_t u = 0; u < un; ++u) {
+    uint64_t w = atomic_load_explicit(&impl->dirty_bm[u / 64], memory_order_relaxed);
+    if (w & ((uint64_t) 1 << (u & 63))) {
+      if (rstart < 0) {
+        rstart = u;
+      }
+      continue;
+    }
+    if (rstart >= 0) {
+      rc = _exfile_wb_add(impl, &reqs, &num, &cap, rstart << bpow, (off_t) u << bpow);
+      RCGO(rc, finish);
+      rstart = -1;
+    }
+    if (!w) {
+      u |= 63; // Skip clean word
+    }
+  }
+  if (rstart >= 0) {
+    rc = _exfile_wb_add(impl, &reqs, &num, &cap, rstart << bpow, impl->fsize);
+    RCGO(rc, finish);
+  }
+  if (num || impl->dsize > impl->fsize) {
+    if (impl->wbhook) {
+      rc = impl->wbhook(reqs, num, impl->fsize, impl->wbhook_opaq);
+      RCGO(rc, finish);
+    }
+    if (num) {
+      rc = impl->file.writev(&impl->file, reqs, num);
+      RCGO(rc, finish);
+    }
+    if (impl->dsize > impl->fsize) {
+      rc = iwp_ftruncate(impl->fh, impl->fsize);
+      RCGO(rc, finish);
+      impl->dsize = impl->fsize;
+    }
+  }
+  rc = impl->file.sync(&impl->file, flags);
+  RCGO(rc, finish);
+  for (size_t i = 0; i < impl->dirty_bmlen; ++i) {
+    atomic_store_explicit(&impl->dirty_bm[i], 0, memory_order_relaxed);
+  }
+  atomic_store(&impl->dirty_num, 0);
+#ifdef MADV_DONTNEED
+  for (int i = 0; i < num; ++i) {
+    madvise(reqs[i].buf, reqs[i].len, MADV_DONTNEED);
+  }
+#endif
+
+finish:
+  free(reqs);
+  return rc;
+}
+
+/**
+ * @brief Zero file range `[off, end)` of `IWFS_MMAP_PRIVATE` file grown
+ *        over stale data kept on disk by deferred shrinking.
+ */
+static iwrc _exfile_zero_lw(EXF *impl, off_t off, off_t end) {
+  uint8_t zb[4096] = { 0 };
+  while (off < end) {
+    size_t sp;
+    MMAPSLOT *s = impl->mmslots;
+    while (s && s->off + (off_t) s->len <= off) {
+      s = s->next;
+    }
+    if (s && s->off <= off) {
+      off_t send = MIN(end, s->off + (off_t) s->len);
+      memset(s->mmap + (off - s->off), 0, send - off);
+      _exfile_dirty(impl, off, send - off);
+      off = send;
+      continue;
+    }
+    off_t gend = s ? MIN(end, s->off) : end;
+    iwrc rc = iwp_write(impl->fh, off, zb, MIN(gend - off, (off_t) sizeof(zb)), &sp);
+    RCRET(rc);
+    if (!sp) {
+      return iwrc_set_errno(IW_ERROR_IO_ERRNO, EIO);
+    }
+    off += sp;
+  }
+  return 0;
+}
+
+static void *_exfile_flusher(void *op) {
+  EXF *impl = op;
+  pthread_mutex_lock(&impl->fmtx);
+  while (!impl->fstop) {
+    if (atomic_load(&impl->dirty_num) << impl->dirty_bpow < impl->dirty_threshold) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += FLUSHER_INTERVAL_MS / 1000;
+      pthread_cond_timedwait(&impl->fcond, &impl->fmtx, &ts);
+      continue;
+    }
+    pthread_mutex_unlock(&impl->fmtx);
+    iwrc rc = 0;
+    int rv = pthread_rwlock_rdlock(impl->rwlock);
+    if (!rv) {
+      rc = _exfile_flush_dirty_lr(impl, 0);
+      pthread_rwlock_unlock(impl->rwlock);
+    } else {
+      rc = iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rv);
+    }
+    if (rc) {
+      iwlog_ecode_error2(rc, "Background writeback of dirty ranges failed");
+    }
+    pthread_mutex_lock(&impl->fmtx);
+  }
+  pthread_mutex_unlock(&impl->fmtx);
+  return 0;
+}
+
+static iwrc _exfile_flusher_start(EXF *impl) {
+  int rv = pthread_mutex_init(&impl->fmtx, 0);
+  if (rv) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rv);
+  }
+  rv = pthread_cond_init(&impl->fcond, 0);
+  if (rv) {
+    pthread_mutex_destroy(&impl->fmtx);
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rv);
+  }
+  impl->fstarted = true;
+  rv = pthread_create(&impl->flusher, 0, _exfile_flusher, impl);
+  if (rv) {
+    impl->fstarted = false;
+    pthread_cond_destroy(&impl->fcond);
+    pthread_mutex_destroy(&impl->fmtx);
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rv);
+  }
+  return 0;
+}
+
+static void _exfile_flusher_stop(EXF *impl) {
+  if (!impl->fstarted) {
+    return;
+  }
+  pthread_mutex_lock(&impl->fmtx);
+  impl->fstop = true;
+  pthread_cond_signal(&impl->fcond);
+  pthread_mutex_unlock(&impl->fmtx);
+  pthread_join(impl->flusher, 0);
+  pthread_cond_destroy(&impl->fcond);
+  pthread_mutex_destroy(&impl->fmtx);
+  impl->fstarted = false;
+}
+
+static iwrc _exfile_dirty_mmap(struct IWFS_EXT *f, off_t off, off_t len) {
+  if (!f || !f->impl) {
+    return IW_ERROR_INVALID_STATE;
+  }
+  _exfile_dirty(f->impl, off, len);
+  return 0;
+}
+
 static iwrc _exfile_truncate_lw(struct IWFS_EXT *f, off_t size) {
   assert(f && f->impl);
   iwrc rc = 0;
   EXF *impl = f->impl;
   iwfs_omode omode = impl->omode;
   off_t old_size = impl->fsize;
+  off_t old_dsize = impl->dsize;
+  bool priv = _exfile_private(impl);
 
   if (impl->fsize == size) {
     return 0;
@@ -180,9 +663,27 @@ static iwrc _exfile_truncate_lw(struct IWFS_EXT *f, off_t size) {
       return IWFS_ERROR_MAXOFF;
     }
     impl->fsize = size;
-    rc = iwp_ftruncate(impl->fh, size);
+    if (impl->preallocate) {
+      rc = iwp_fallocate(impl->fh, old_size, size - old_size);
+      if (rc == IW_ERROR_NOT_IMPLEMENTED) {
+        impl->preallocate = 0;
+        rc = 0;
+      }
+      RCGO(rc, truncfail);
+    }
+    if (!priv || size > old_dsize) {
+      rc = iwp_ftruncate(impl->fh, size);
+      RCGO(rc, truncfail);
+      impl->dsize = size;
+    }
+    rc = _exfile_dirty_ensure_lw(impl, size);
     RCGO(rc, truncfail);
     rc = _exfile_initmmap_lw(f);
+    RCGO(rc, truncfail);
+    if (priv && old_dsize > old_size) {
+      rc = _exfile_zero_lw(impl, old_size, MIN(size, old_dsize));
+      RCGO(rc, truncfail);
+    }
   } else if (old_size > size) {
     if (!(omode & IWFS_OWRITE)) {
       return IW_ERROR_READONLY;
@@ -190,14 +691,22 @@ static iwrc _exfile_truncate_lw(struct IWFS_EXT *f, off_t size) {
     impl->fsize = size;
     rc = _exfile_initmmap_lw(f);
     RCGO(rc, truncfail);
-    rc = iwp_ftruncate(impl->fh, size);
-    RCGO(rc, truncfail);
+    if (!priv) {
+      rc = iwp_ftruncate(impl->fh, size);
+      RCGO(rc, truncfail);
+      impl->dsize = size;
+    }
   }
   return rc;
 
 truncfail:
   // restore old size
   impl->fsize = old_size;
+  if (old_size < size && old_dsize < size) {
+    // release space of partially succeeded extension
+    IWRC(iwp_ftruncate(impl->fh, old_dsize), rc);
+    impl->dsize = old_dsize;
+  }
   // try to reinit mmap slots
   IWRC(_exfile_initmmap_lw(f), rc);
   return rc;
@@ -219,15 +728,38 @@ IW_INLINE iwrc _exfile_ensure_size_lw(struct IWFS_EXT *f, off_t sz) {
       return IWFS_ERROR_MAXOFF;
     }
   }
-  return _exfile_truncate_lw(f, nsz);
+  IWTRACE_BEGIN(impl->trace, ev, IWTRACE_EXFILE_RESIZE);
+  iwrc rc = _exfile_truncate_lw(f, nsz);
+  IWTRACE_END(impl->trace, ev, nsz, 0);
+  return rc;
 }
 
 static iwrc _exfile_sync(struct IWFS_EXT *f, iwfs_sync_flags flags) {
-  iwrc rc = _exfile_rlock(f);
+  iwrc rc;
+  if (f->impl && _exfile_private(f->impl)) {
+    // Private changes are not visible in file until writeback
+    if (flags & IWFS_WRITEBACK) {
+      rc = _exfile_wlock(f);
+      RCRET(rc);
+      rc = _exfile_writeback_wl(f->impl, flags);
+    } else {
+      rc = _exfile_rlock(f);
+      RCRET(rc);
+      rc = f->impl->file.sync(&f->impl->file, flags);
+    }
+    IWRC(_exfile_unlock(f), rc);
+    return rc;
+  }
+  rc = _exfile_rlock(f);
   RCRET(rc);
   EXF *impl = f->impl;
   int mflags = (flags & IWFS_NO_MMASYNC) ? MS_SYNC : MS_ASYNC;
   MMAPSLOT *s = impl->mmslots;
+  if (impl->dirty_bm) {
+    // Only modified ranges are synced
+    rc = _exfile_flush_dirty_lr(impl, mflags);
+    s = 0;
+  }
   while (s) {
     if (s->mmap && s->mmap != MAP_FAILED) {
       if (msync(s->mmap, s->len, mflags)) {
@@ -241,112 +773,160 @@ static iwrc _exfile_sync(struct IWFS_EXT *f, iwfs_sync_flags flags) {
   return rc;
 }
 
-static iwrc _exfile_write(struct IWFS_EXT *f, off_t off, const void *buf, size_t siz, size_t *sp) {
-  MMAPSLOT *s;
-  EXF *impl = f->impl;
-  off_t end = off + siz;
-  off_t wp = siz, len;
+// Max number of requests of file parts not covered by mmaped regions submitted at once
+#define EXFILE_IOV_BATCH 32
+
+// Batch of I/O requests of file parts not covered by mmaped regions
+typedef struct EXIOB {
+  IWP_IOREQ reqs[EXFILE_IOV_BATCH];
+  IWP_IOREQ *owner[EXFILE_IOV_BATCH]; /**< Caller requests parts belong to */
+  int num;
+} EXIOB;
 
-  *sp = 0;
-  if (off < 0 || end < 0) {
-    return IW_ERROR_OUT_OF_BOUNDS;
+static iwrc _exfile_iob_flush(EXF *impl, EXIOB *b, bool write) {
+  iwrc rc = 0;
+  if (!b->num) {
+    return 0;
   }
-  if (impl->maxoff && off + siz > impl->maxoff) {
-    return IWFS_ERROR_MAXOFF;
+  if (write) {
+    rc = impl->file.writev(&impl->file, b->reqs, b->num);
+  } else {
+    rc = impl->file.readv(&impl->file, b->reqs, b->num);
+  }
+  if (!rc) {
+    for (int i = 0; i < b->num; ++i) {
+      b->owner[i]->sp -= b->reqs[i].len - b->reqs[i].sp;
+    }
+  }
+  b->num = 0;
+  return rc;
+}
+
+IW_INLINE iwrc _exfile_iob_add(EXF *impl, EXIOB *b, bool write, IWP_IOREQ *owner, off_t off, size_t len) {
+  if (b->num == EXFILE_IOV_BATCH) {
+    iwrc rc = _exfile_iob_flush(impl, b, write);
+    RCRET(rc);
+  }
+  b->owner[b->num] = owner;
+  b->reqs[b->num++] = (IWP_IOREQ) {
+    .off = off,
+    .buf = (uint8_t *) owner->buf + (off - owner->off),
+    .len = len
+  };
+  return 0;
+}
+
+/**
+ * @brief Transfer batch of requests, lock must be held.
+ * @details Parts of requests covered by mmaped regions are copied directly,
+ *          the rest is collected and served by vectored file I/O.
+ *          Reads are bounded by the current file size.
+ */
+static iwrc _exfile_iov_lk(EXF *impl, IWP_IOREQ *reqs, int num, bool write) {
+  iwrc rc = 0;
+  EXIOB b;
+  b.num = 0;
+  for (int i = 0; i < num; ++i) {
+    IWP_IOREQ *r = &reqs[i];
+    off_t off = r->off, end = r->off + r->len;
+    if (!write && end > impl->fsize) {
+      end = MAX(off, impl->fsize);
+    }
+    r->sp = end - off;
+    MMAPSLOT *s = impl->mmslots;
+    while (off < end) {
+      while (s && s->len && s->off + s->len <= off) {
+        s = s->next;
+      }
+      if (s && !s->len) {
+        s = 0;
+      }
+      if (s && s->off <= off) {
+        size_t len = MIN(end, s->off + s->len) - off;
+        if (write) {
+          memcpy(s->mmap + (off - s->off), (uint8_t *) r->buf + (off - r->off), len);
+          _exfile_dirty(impl, off, len);
+        } else {
+          memcpy((uint8_t *) r->buf + (off - r->off), s->mmap + (off - s->off), len);
+        }
+        off += len;
+      } else {
+        size_t len = (s ? MIN(end, s->off) : end) - off;
+        rc = _exfile_iob_add(impl, &b, write, r, off, len);
+        RCRET(rc);
+        off += len;
+      }
+    }
+  }
+  return _exfile_iob_flush(impl, &b, write);
+}
+
+static iwrc _exfile_writev(struct IWFS_EXT *f, IWP_IOREQ *reqs, int num) {
+  EXF *impl = f->impl;
+  off_t end = 0;
+  for (int i = 0; i < num; ++i) {
+    reqs[i].sp = 0;
+    off_t rend = reqs[i].off + reqs[i].len;
+    if (reqs[i].off < 0 || rend < 0) {
+      return IW_ERROR_OUT_OF_BOUNDS;
+    }
+    if (impl->maxoff && rend > impl->maxoff) {
+      return IWFS_ERROR_MAXOFF;
+    }
+    end = MAX(end, rend);
   }
   iwrc rc = _exfile_rlock(f);
   RCRET(rc);
   if (end > impl->fsize) {
     rc = _exfile_unlock2(impl);
-    RCGO(rc, end);
+    RCRET(rc);
     rc = _exfile_wlock(f);
-    RCGO(rc, end);
+    RCRET(rc);
     if (end > impl->fsize) {
       rc = _exfile_ensure_size_lw(f, end);
       RCGO(rc, finish);
     }
   }
-  s = impl->mmslots;
-  while (s && wp > 0) {
-    if (!s->len || wp + off <= s->off) {
-      break;
-    }
-    if (s->off > off) {
-      len = MIN(wp, s->off - off);
-      rc = impl->file.write(&impl->file, off, (const char *) buf + (siz - wp), len, sp);
-      RCGO(rc, finish);
-      wp = wp - *sp;
-      off = off + *sp;
-    }
-    if (wp > 0 && s->off <= off && s->off + s->len > off) {
-      len = MIN(wp, s->off + s->len - off);
-      memcpy(s->mmap + (off - s->off), (const char *) buf + (siz - wp), len);
-      wp -= len;
-      off += len;
-    }
-    s = s->next;
-  }
-  if (wp > 0) {
-    rc = impl->file.write(&impl->file, off, (const char *) buf + (siz - wp), wp, sp);
-    RCGO(rc, finish);
-    wp = wp - *sp;
-  }
-  *sp = siz - wp;
+  rc = _exfile_iov_lk(impl, reqs, num, true);
+
 finish:
   IWRC(_exfile_unlock2(impl), rc);
-end:
-  if (rc) {
-    *sp = 0;
-  }
   return rc;
 }
 
-static iwrc _exfile_read(struct IWFS_EXT *f, off_t off, void *buf, size_t siz, size_t *sp) {
-  MMAPSLOT *s;
-  EXF *impl;
-  off_t end = off + siz;
-  off_t rp = siz, len;
-  *sp = 0;
-  if (off < 0 || end < 0) {
-    return IW_ERROR_OUT_OF_BOUNDS;
+static iwrc _exfile_readv(struct IWFS_EXT *f, IWP_IOREQ *reqs, int num) {
+  for (int i = 0; i < num; ++i) {
+    reqs[i].sp = 0;
+    if (reqs[i].off < 0 || reqs[i].off + (off_t) reqs[i].len < 0) {
+      return IW_ERROR_OUT_OF_BOUNDS;
+    }
   }
   iwrc rc = _exfile_rlock(f);
   RCRET(rc);
-  impl = f->impl;
-  s = impl->mmslots;
-  if (end > impl->fsize) {
-    rp = siz = impl->fsize - off;
-  }
-  while (s && rp > 0) {
-    if (!s->len || rp + off <= s->off) {
-      break;
-    }
-    if (s->off > off) {
-      len = MIN(rp, s->off - off);
-      rc = impl->file.read(&impl->file, off, (char *) buf + (siz - rp), len, sp);
-      RCGO(rc, finish);
-      rp = rp - *sp;
-      off = off + *sp;
-    }
-    if (rp > 0 && s->off <= off && s->off + s->len > off) {
-      len = MIN(rp, s->off + s->len - off);
-      memcpy((char *) buf + (siz - rp), s->mmap + (off - s->off), len);      
-      rp -= len;
-      off += len;
-    }
-    s = s->next;
-  }
-  if (rp > 0) {
-    rc = impl->file.read(&impl->file, off, (char *) buf + (siz - rp), rp, sp);
-    RCGO(rc, finish);
-    rp = rp - *sp;
-  }
-  *sp = siz - rp;
-finish:
-  if (rc) {
-    *sp = 0;
-  }
-  IWRC(_exfile_unlock2(impl), rc);
+  rc = _exfile_iov_lk(f->impl, reqs, num, false);
+  IWRC(_exfile_unlock2(f->impl), rc);
+  return rc;
+}
+
+static iwrc _exfile_write(struct IWFS_EXT *f, off_t off, const void *buf, size_t siz, size_t *sp) {
+  IWP_IOREQ req = {
+    .off = off,
+    .buf = (void *) buf,
+    .len = siz
+  };
+  iwrc rc = _exfile_writev(f, &req, 1);
+  *sp = rc ? 0 : req.sp;
+  return rc;
+}
+
+static iwrc _exfile_read(struct IWFS_EXT *f, off_t off, void *buf, size_t siz, size_t *sp) {
+  IWP_IOREQ req = {
+    .off = off,
+    .buf = buf,
+    .len = siz
+  };
+  iwrc rc = _exfile_readv(f, &req, 1);
+  *sp = rc ? 0 : req.sp;
   return rc;
 }
 
@@ -356,6 +936,7 @@ static iwrc _exfile_state(struct IWFS_EXT *f, IWFS_EXT_STATE *state) {
   EXF *xf = f->impl;
   IWRC(xf->file.state(&xf->file, &state->file), rc);
   state->fsize = f->impl->fsize;
+  state->dirty_size = (off_t) atomic_load(&xf->dirty_num) << xf->dirty_bpow;
   IWRC(_exfile_unlock(f), rc);
   return rc;
 }
@@ -367,8 +948,10 @@ static iwrc _exfile_copy(struct IWFS_EXT *f, off_t off, size_t siz, off_t noff)
   MMAPSLOT *s = xf->mmslots;
   if (s && s->mmap && s->off == 0 && s->len >= noff + siz) { // fully mmaped file
     rc = _exfile_ensure_size_lw(f, noff + siz);
-    RCRET(rc);
-    memmove(s->mmap + noff, s->mmap + off, siz);
+    if (!rc) {
+      memmove(s->mmap + noff, s->mmap + off, siz);
+      _exfile_dirty(xf, noff, siz);
+    }
   } else {
     IWRC(xf->file.copy(&xf->file, off, siz, noff), rc);
   }
@@ -402,8 +985,8 @@ static iwrc _exfile_remove_mmap_wl(struct IWFS_EXT *f, off_t off) {
     s->prev->next = s->next;
     s->next->prev = s->prev;
   }
-  if (s->len) {
-    if (munmap(s->mmap, s->len)) {
+  if (s->rlen || s->len) {
+    if (munmap(s->mmap, s->rlen ? s->rlen : s->len)) {
       rc = iwrc_set_errno(IW_ERROR_ERRNO, errno);
       goto finish;
     }
@@ -417,10 +1000,14 @@ static iwrc _exfile_close(struct IWFS_EXT *f) {
   if (!f || !f->impl) {
     return 0;
   }
+  _exfile_flusher_stop(f->impl);
   iwrc rc = _exfile_wlock(f);
   RCRET(rc);
   EXF *impl = f->impl;
   MMAPSLOT *s = impl->mmslots, *next;
+  if (_exfile_private(impl)) {
+    rc = _exfile_writeback_wl(impl, IWFS_FDATASYNC);
+  }
   while (s) {
     next = s->next;
     IWRC(_exfile_remove_mmap_wl(f, s->off), rc);
@@ -433,6 +1020,7 @@ static iwrc _exfile_close(struct IWFS_EXT *f) {
   }
   IWRC(_exfile_unlock2(impl), rc);
   IWRC(_exfile_destroylocks(impl), rc);
+  free(impl->dirty_bm);
   free(impl);
   return rc;
 }
@@ -452,6 +1040,27 @@ static iwrc _exfile_ensure_size(struct IWFS_EXT *f, off_t sz) {
   return rc;
 }
 
+static iwrc _exfile_refresh(struct IWFS_EXT *f) {
+  IWP_FILE_STAT fstat;
+  iwrc rc = _exfile_wlock(f);
+  RCRET(rc);
+  EXF *impl = f->impl;
+  if (impl->omode & IWFS_OWRITE) {
+    goto finish;
+  }
+  rc = iwp_fstath(impl->fh, &fstat);
+  RCGO(rc, finish);
+  // Writer keeps file size page aligned
+  off_t size = fstat.size & ~((off_t) impl->psize - 1);
+  if (size > impl->fsize) {
+    impl->fsize = size;
+    rc = _exfile_initmmap_lw(f);
+  }
+finish:
+  IWRC(_exfile_unlock(f), rc);
+  return rc;
+}
+
 static iwrc _exfile_truncate(struct IWFS_EXT *f, off_t sz) {
   iwrc rc = _exfile_wlock(f);
   RCRET(rc);
@@ -579,6 +1188,32 @@ iwrc _exfile_acquire_mmap(struct IWFS_EXT *f, off_t off, uint8_t **mm, size_t *s
   return IWFS_ERROR_NOT_MMAPED;
 }
 
+static iwrc _exfile_stable_mmap(struct IWFS_EXT *f, off_t off, uint8_t **mm, size_t *sp) {
+  assert(f && mm && off >= 0);
+  *mm = 0;
+  if (sp) {
+    *sp = 0;
+  }
+  iwrc rc = _exfile_rlock(f);
+  RCRET(rc);
+  rc = IWFS_ERROR_NOT_MMAPED;
+  for (MMAPSLOT *s = f->impl->mmslots; s; s = s->next) {
+    if (s->off == off) {
+      // Reservation covers all possible lengths of slot, so it is never moved
+      if (s->rlen) {
+        *mm = s->mmap;
+        if (sp) {
+          *sp = s->rlen;
+        }
+        rc = 0;
+      }
+      break;
+    }
+  }
+  IWRC(_exfile_unlock(f), rc);
+  return rc;
+}
+
 iwrc _exfile_probe_mmap(struct IWFS_EXT *f, off_t off, uint8_t **mm, size_t *sp) {
   // todo remove code duplication
   assert(f && mm && off >= 0);
@@ -654,6 +1289,50 @@ static iwrc _exfile_sync_mmap(struct IWFS_EXT *f, off_t off, iwfs_sync_flags fla
   return rc;
 }
 
+static iwrc _exfile_advise_mmap(struct IWFS_EXT *f, off_t off, off_t len, iwfs_madvise advice) {
+  assert(f && off >= 0);
+  int adv;
+  switch (advice) {
+#ifdef MADV_RANDOM
+    case IWFS_MADV_RANDOM:
+      adv = MADV_RANDOM;
+      break;
+    case IWFS_MADV_SEQUENTIAL:
+      adv = MADV_SEQUENTIAL;
+      break;
+    case IWFS_MADV_WILLNEED:
+      adv = MADV_WILLNEED;
+      break;
+    case IWFS_MADV_DONTNEED:
+      adv = MADV_DONTNEED;
+      break;
+    case IWFS_MADV_NORMAL:
+      adv = MADV_NORMAL;
+      break;
+#endif
+    default:
+      return 0;
+  }
+  iwrc rc = _exfile_rlock(f);
+  RCRET(rc);
+  EXF *impl = f->impl;
+  MMAPSLOT *s = impl->mmslots;
+  while (s && !(off >= s->off && off < s->off + s->len)) {
+    s = s->next;
+  }
+  if (s && s->mmap && s->mmap != MAP_FAILED) {
+    off_t start = IW_ROUNDOWN(off - s->off, impl->psize);
+    off_t end = MIN(off - s->off + len, s->len);
+    if (end > start && madvise(s->mmap + start, end - start, adv)) {
+      rc = iwrc_set_errno(IW_ERROR_ERRNO, errno);
+    }
+  } else {
+    rc = IWFS_ERROR_NOT_MMAPED;
+  }
+  IWRC(_exfile_unlock(f), rc);
+  return rc;
+}
+
 static off_t _exfile_default_szpolicy(off_t nsize, off_t csize, struct IWFS_EXT *f, void **ctx) {
   if (nsize == -1) {
     return 0;
@@ -709,6 +1388,24 @@ off_t iw_exfile_szpolicy_mul(off_t nsize, off_t csize, struct IWFS_EXT *f, void
   return ret;
 }
 
+off_t iw_exfile_szpolicy_extent(off_t nsize, off_t csize, struct IWFS_EXT *f, void **_ctx) {
+  if (nsize == -1) {
+    return 0;
+  }
+  off_t extent = *_ctx ? *(off_t *) *_ctx : IW_EXFILE_EXTENT_SIZE;
+  off_t psize = iwp_page_size();
+  extent = extent > psize ? IW_ROUNDUP(extent, psize) : psize;
+  uint64_t ret = csize + MIN(csize, 64 * extent);
+  if (ret < (uint64_t) nsize) {
+    ret = nsize;
+  }
+  ret = IW_ROUNDUP(ret, extent);
+  if (ret > OFF_T_MAX) {
+    ret = OFF_T_MAX;
+  }
+  return ret;
+}
+
 static iwrc _exfile_initlocks(IWFS_EXT *f) {
   assert(f && f->impl);
   assert(!f->impl->rwlock);
@@ -743,18 +1440,24 @@ iwrc iwfs_exfile_open(IWFS_EXT *f, const IWFS_EXT_OPTS *opts) {
   f->close = _exfile_close;
   f->read = _exfile_read;
   f->write = _exfile_write;
+  f->readv = _exfile_readv;
+  f->writev = _exfile_writev;
   f->sync = _exfile_sync;
   f->state = _exfile_state;
   f->copy =  _exfile_copy;
 
   f->ensure_size = _exfile_ensure_size;
   f->truncate = _exfile_truncate;
+  f->refresh = _exfile_refresh;
   f->add_mmap = _exfile_add_mmap;
   f->acquire_mmap = _exfile_acquire_mmap;
   f->probe_mmap = _exfile_probe_mmap;
+  f->stable_mmap = _exfile_stable_mmap;
   f->release_mmap = _exfile_release_mmap;
   f->remove_mmap = _exfile_remove_mmap;
   f->sync_mmap = _exfile_sync_mmap;
+  f->advise_mmap = _exfile_advise_mmap;
+  f->dirty_mmap = _exfile_dirty_mmap;
 
   if (!path) {
     return IW_ERROR_INVALID_ARGS;
@@ -769,9 +1472,18 @@ iwrc iwfs_exfile_open(IWFS_EXT *f, const IWFS_EXT_OPTS *opts) {
   impl->rspolicy = opts->rspolicy ? opts->rspolicy : _exfile_default_szpolicy;
   impl->rspolicy_ctx = opts->rspolicy_ctx;
   impl->use_locks = opts->use_locks;
+  impl->mmap_opts = opts->mmap_opts;
+  impl->numa_node = opts->numa_node;
+  impl->preallocate = opts->preallocate;
+  impl->trace = opts->trace;
   if (opts->maxoff >= impl->psize) {
     impl->maxoff = IW_ROUNDOWN(opts->maxoff, impl->psize);
   }
+  if ((impl->mmap_opts & IWFS_MMAP_PRIVATE) && !opts->dirty_bpow) {
+    // Modified ranges to write back are tracked by dirty bitmap
+    rc = IW_ERROR_INVALID_ARGS;
+    goto finish;
+  }
   rc = _exfile_initlocks(f);
   RCGO(rc, finish);
 
@@ -783,21 +1495,34 @@ iwrc iwfs_exfile_open(IWFS_EXT *f, const IWFS_EXT_OPTS *opts) {
   RCGO(rc, finish);
 
   impl->fsize = fstat.size;
+  impl->dsize = fstat.size;
 
   IWFS_FILE_STATE fstate;
   rc = impl->file.state(&impl->file, &fstate);
   impl->omode = fstate.opts.omode;
   impl->fh = fstate.fh;
+  impl->wbhook = opts->wbhook;
+  impl->wbhook_opaq = opts->wbhook_opaq;
 
+  if (opts->dirty_bpow) {
+    impl->dirty_bpow = MAX(opts->dirty_bpow, iwbits_find_first_sbit64(impl->psize));
+    rc = _exfile_dirty_ensure_lw(impl, MAX(impl->fsize, impl->maxoff));
+    RCGO(rc, finish);
+  }
   if (impl->fsize < opts->initial_size) {
     rc = _exfile_truncate_lw(f, opts->initial_size);
   } else if (impl->fsize & (impl->psize - 1)) {  // not a page aligned
     rc = _exfile_truncate_lw(f, impl->fsize);
   }
+  if (!rc && impl->dirty_bpow && opts->dirty_threshold && impl->use_locks && !_exfile_private(impl)) {
+    impl->dirty_threshold = opts->dirty_threshold;
+    rc = _exfile_flusher_start(impl);
+  }
 finish:
   if (rc) {
     if (f->impl) {
       _exfile_destroylocks(f->impl);
+      free(f->impl->dirty_bm);
       free(f->impl);
       f->impl = 0;
     }
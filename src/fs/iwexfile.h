@@ -63,6 +63,7 @@
  */
 
 #include "iwfile.h"
+#include "iwtrace.h"
 
 IW_EXTERN_C_START
 
@@ -104,6 +105,22 @@ typedef enum {
 typedef off_t (*IW_EXT_RSPOLICY)(off_t nsize, off_t csize, struct IWFS_EXT *f,
                                  void **ctx);
 
+/**
+ * @brief Writeback hook of `IWFS_MMAP_PRIVATE` file.
+ *
+ * Called with all modified ranges of mmaped regions before they are written in place,
+ * so implementation can make them durable elsewhere (eg: in log) and restore file
+ * torn by crash in the middle of writeback. After ranges are written file is truncated
+ * to @a fsize if it was shrunk.
+ *
+ * @param reqs Modified ranges, `buf` points to mmaped data
+ * @param num Number of ranges
+ * @param fsize File size
+ * @param opaq `IWFS_EXT_OPTS::wbhook_opaq`
+ * @return Writeback is cancelled if error code is returned.
+ */
+typedef iwrc (*IW_EXT_WBHOOK)(const IWP_IOREQ *reqs, int num, off_t fsize, void *opaq);
+
 /**
  * @brief Fibonacci resize file policy.
  *
@@ -120,6 +137,52 @@ IW_EXPORT off_t iw_exfile_szpolicy_fibo(off_t nsize, off_t csize,
 IW_EXPORT off_t iw_exfile_szpolicy_mul(off_t nsize, off_t csize,
                                        struct IWFS_EXT *f, void **ctx);
 
+/**
+ * @brief Extent aligned file resize policy intended for preallocated files.
+ *
+ * New `file_size = ROUNDUP(MAX(file_size + MIN(file_size, 64 * extent), nsize), extent)`
+ * so file is grown twice until its growth step reaches `64 * extent` bytes.
+ * The `extent` size is `off_t` value pointed by policy context if set,
+ * `IW_EXFILE_EXTENT_SIZE` otherwise.
+ *
+ * @see IWFS_EXT_OPTS::preallocate
+ */
+IW_EXPORT off_t iw_exfile_szpolicy_extent(off_t nsize, off_t csize,
+                                          struct IWFS_EXT *f, void **ctx);
+
+/** Default extent size of `iw_exfile_szpolicy_extent()` */
+#define IW_EXFILE_EXTENT_SIZE (4 * 1024 * 1024)
+
+/**
+ * @brief Memory mapping options of `IWFS_EXT` file.
+ * @details Options are applied to every mmaped region each time it is mapped.
+ *          Hints not supported by platform are ignored.
+ * @see IWFS_EXT_OPTS::mmap_opts
+ */
+typedef enum {
+  IWFS_MMAP_RANDOM     = 0x01U, /**< Random access expected, kernel readahead is disabled (`MADV_RANDOM`) */
+  IWFS_MMAP_SEQUENTIAL = 0x02U, /**< Sequential access expected, aggressive readahead (`MADV_SEQUENTIAL`) */
+  IWFS_MMAP_HUGEPAGE   = 0x04U, /**< Use transparent huge pages for mmaped regions (`MADV_HUGEPAGE`) */
+  IWFS_MMAP_POPULATE   = 0x08U, /**< Prefault mmaped regions for warm start (`MAP_POPULATE`) */
+  IWFS_MMAP_NUMA       = 0x10U, /**< Prefer `IWFS_EXT_OPTS::numa_node` for pages of mmaped regions (`mbind`) */
+  IWFS_MMAP_PRIVATE    = 0x20U  /**< Changes of mmaped regions are private to the process (`MAP_PRIVATE`)
+                                     and reach the file only by `IWFS_EXT::sync` with `IWFS_WRITEBACK`
+                                     or on close, shrinking of file is deferred until then too.
+                                     Requires `IWFS_EXT_OPTS::dirty_bpow`, all file data should be mmaped. */
+} iwfs_ext_mmap_opts;
+
+/**
+ * @brief Access pattern hint for a part of mmaped region.
+ * @see IWFS_EXT::advise_mmap
+ */
+typedef enum {
+  IWFS_MADV_NORMAL = 0,   /**< Reset region to default access pattern */
+  IWFS_MADV_RANDOM,       /**< Random access expected */
+  IWFS_MADV_SEQUENTIAL,   /**< Sequential access expected */
+  IWFS_MADV_WILLNEED,     /**< Region will be accessed soon, start reading it ahead */
+  IWFS_MADV_DONTNEED      /**< Region will not be accessed soon */
+} iwfs_madvise;
+
 /**
  * @brief `IWFS_EXT` file options.
  * @see iwrc iwfs_exfile_open(IWFS_EXT *f, const IWFS_EXT_OPTS *opts)
@@ -135,6 +198,25 @@ typedef struct IWFS_EXT_OPTS {
                                  Default: `0` */
   off_t maxoff;             /**< Maximum allowed file offset. Unlimited if zero.
                                  If maximum offset is reached `IWFS_ERROR_MAXOFF` will be reported. */
+  iwfs_ext_mmap_opts mmap_opts; /**< Memory mapping options. Default: `0` */
+  uint16_t numa_node;       /**< NUMA node of mmaped regions used with `IWFS_MMAP_NUMA`.
+                                 Resident pages are migrated to the node, new page cache pages are placed
+                                 according to memory policy of reading thread, see `iwp_numa_pin_thread()` */
+  int preallocate;          /**< If `1` disk space of grown file is preallocated by `fallocate`,
+                                 so writes to new pages do not allocate file system blocks.
+                                 Lack of disk space is reported by resize instead of failed write.
+                                 Ignored if not supported by file system. Default: `0` */
+  uint8_t dirty_bpow;       /**< If set modified ranges of mmaped regions are tracked in units of
+                                 `2^dirty_bpow` bytes (at least page size) and only these ranges
+                                 are synced. Data modified by mmaped pointers must be reported
+                                 by `IWFS_EXT::dirty_mmap`. Default: `0`, whole regions are synced */
+  size_t dirty_threshold;   /**< Size of modified mmaped data starting background writeback
+                                 by flusher thread. Requires `dirty_bpow` and `use_locks`.
+                                 Default: `0`, no flusher */
+  const IWTRACE *trace;     /**< Tracing hooks of file resize operations, must outlive the file.
+                                 Ignored if library is built without tracing. Default: `0` */
+  IW_EXT_WBHOOK wbhook;     /**< Writeback hook of `IWFS_MMAP_PRIVATE` file. Default: `0` */
+  void *wbhook_opaq;        /**< Opaque data passed to `wbhook`. Default: `0` */
 } IWFS_EXT_OPTS;
 
 /**
@@ -145,6 +227,7 @@ typedef struct IWFS_EXT_OPTS {
 typedef struct IWFS_EXT_STATE {
   IWFS_FILE_STATE file; /**< Simple file state */
   off_t fsize;          /**< Current file size */
+  off_t dirty_size;     /**< Size of tracked dirty ranges not yet flushed */
 } IWFS_EXT_STATE;
 
 /**
@@ -177,6 +260,14 @@ typedef struct IWFS_EXT {
    */
   iwrc(*truncate)(struct IWFS_EXT *f, off_t off);
 
+  /**
+   * @brief Pick up size of file extended by other process
+   *        and map its appended area into mmaped regions.
+   * @details Has no effect on file opened for writing
+   *          or if file is not grown.
+   */
+  iwrc(*refresh)(struct IWFS_EXT *f);
+
   /**
    * @brief Register an address space specified by @a off and @a len as memory
    * mmaped region
@@ -229,6 +320,24 @@ typedef struct IWFS_EXT {
    */
   iwrc(*probe_mmap)(struct IWFS_EXT *f, off_t off, uint8_t **mm, size_t *sp);
 
+  /**
+   * @brief Retrieve mmaped region by its offset @a off which can be read without lock.
+   *
+   * Address space of region is reserved for all its possible length,
+   * so region is never moved by file resize until it is removed.
+   * Reserved pages beyond the end of file are read as zeros.
+   * Data of region may be concurrently modified, so readers
+   * must validate what they read.
+   *
+   * `IWFS_ERROR_NOT_MMAPED` is returned if region address space is not reserved.
+   *
+   * @param f `IWFS_EXT`
+   * @param off Region start offset
+   * @param [out] mm Pointer assigned to start of mmaped region
+   * @param [out] sp Length of reserved address space of region
+   */
+  iwrc(*stable_mmap)(struct IWFS_EXT *f, off_t off, uint8_t **mm, size_t *sp);
+
   /**
    * @brief Release the lock acquired by successfull call of `acquire_mmap()`
    */
@@ -260,6 +369,34 @@ typedef struct IWFS_EXT {
    */
   iwrc(*sync_mmap)(struct IWFS_EXT *f, off_t off, iwfs_sync_flags flags);
 
+  /**
+   * @brief Give access pattern hint for a part of mmaped address space.
+   *
+   * Range is extended to page boundaries and clipped by mapped region containing @a off.
+   * The `IWFS_ERROR_NOT_MMAPED` will returned if @a off is not mmaped.
+   *
+   * @param f `IWFS_EXT`
+   * @param off File offset of range
+   * @param len Length of range
+   * @param advice Access pattern hint
+   * @return `0` on success or error code.
+   */
+  iwrc(*advise_mmap)(struct IWFS_EXT *f, off_t off, off_t len, iwfs_madvise advice);
+
+  /**
+   * @brief Mark range of file modified by mmaped pointer as dirty.
+   *
+   * Used only if IWFS_EXT_OPTS::dirty_bpow is set, caller must hold
+   * mmaped region acquired by `acquire_mmap()` or otherwise guarantee
+   * what file is not resized concurrently.
+   *
+   * @param f `IWFS_EXT`
+   * @param off File offset of modified range
+   * @param len Length of modified range
+   * @return `0` on success or error code.
+   */
+  iwrc(*dirty_mmap)(struct IWFS_EXT *f, off_t off, off_t len);
+
   /* See iwfile.h */
 
   /**  @see IWFS_FILE::write */
@@ -282,6 +419,21 @@ typedef struct IWFS_EXT {
   /**  @see IWFS_FILE::copy */
   iwrc(*copy)(struct IWFS_EXT *f, off_t off, size_t siz, off_t noff);
 
+  /**
+   * @brief Write batch of requests.
+   * @details Parts of requests covered by mmaped regions are copied into memory,
+   *          the rest is written by vectored I/O. File is extended to fit all requests.
+   * @see IWFS_FILE::writev
+   */
+  iwrc(*writev)(struct IWFS_EXT *f, IWP_IOREQ *reqs, int num);
+
+  /**
+   * @brief Read batch of requests.
+   * @details Reads are bounded by file size, `IWP_IOREQ::sp` is set for every request.
+   * @see IWFS_FILE::readv
+   */
+  iwrc(*readv)(struct IWFS_EXT *f, IWP_IOREQ *reqs, int num);
+
 } IWFS_EXT;
 
 /**
@@ -61,6 +61,27 @@ static iwrc _iwfs_read(struct IWFS_FILE *f, off_t off, void *buf, size_t siz, si
   return iwp_read(impl->fh, off, buf, siz, sp);
 }
 
+static iwrc _iwfs_writev(struct IWFS_FILE *f, IWP_IOREQ *reqs, int num) {
+  assert(f);
+  IWF *impl = f->impl;
+  if (!impl) {
+    return IW_ERROR_INVALID_STATE;
+  }
+  if (!(impl->opts.omode & IWFS_OWRITE)) {
+    return IW_ERROR_READONLY;
+  }
+  return iwp_writev(impl->fh, reqs, num);
+}
+
+static iwrc _iwfs_readv(struct IWFS_FILE *f, IWP_IOREQ *reqs, int num) {
+  assert(f);
+  IWF *impl = f->impl;
+  if (!impl) {
+    return IW_ERROR_INVALID_STATE;
+  }
+  return iwp_readv(impl->fh, reqs, num);
+}
+
 static iwrc _iwfs_close(struct IWFS_FILE *f) {
   if (!f || !f->impl) {
     return 0;
@@ -152,6 +173,8 @@ iwrc iwfs_file_open(IWFS_FILE *f, const IWFS_FILE_OPTS *_opts) {
   f->sync = _iwfs_sync;
   f->state = _iwfs_state;
   f->copy = _iwfs_copy;
+  f->writev = _iwfs_writev;
+  f->readv = _iwfs_readv;
 
   impl = f->impl = calloc(sizeof(IWF), 1);
   if (!impl) {
@@ -126,7 +126,8 @@ typedef struct {
  */
 typedef enum {
   IWFS_FDATASYNC = 0x01, /**< Use `fdatasync` mode */
-  IWFS_NO_MMASYNC = 0x02 /**< Do not use `MS_ASYNC` mmap sync mode */
+  IWFS_NO_MMASYNC = 0x02, /**< Do not use `MS_ASYNC` mmap sync mode */
+  IWFS_WRITEBACK = 0x04  /**< Write modified data of `IWFS_MMAP_PRIVATE` mmaped regions back to file */
 } iwfs_sync_flags;
 
 /**
@@ -194,6 +195,24 @@ typedef struct IWFS_FILE {
    */
   iwrc(*copy)(struct IWFS_FILE *f, off_t off, size_t siz, off_t noff);
 
+  /**
+   * @brief Write batch of requests.
+   * @param f `struct IWFS_FILE` pointer.
+   * @param reqs Array of requests
+   * @param num Number of requests
+   * @see iwp_writev()
+   */
+  iwrc(*writev)(struct IWFS_FILE *f, IWP_IOREQ *reqs, int num);
+
+  /**
+   * @brief Read batch of requests.
+   * @param f `struct IWFS_FILE` pointer.
+   * @param reqs Array of requests
+   * @param num Number of requests
+   * @see iwp_readv()
+   */
+  iwrc(*readv)(struct IWFS_FILE *f, IWP_IOREQ *reqs, int num);
+
 } IWFS_FILE;
 
 /**
@@ -30,9 +30,19 @@
 #include "iwfsmfile.h"
 #include "utils/iwutils.h"
 #include "utils/kbtree.h"
+#include "utils/khash.h"
 #include "utils/iwbits.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define FSM_BMSCAN_AVX2
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define FSM_BMSCAN_NEON
+#include <arm_neon.h>
+#endif
 
 typedef struct IWFS_FSM_IMPL FSM;
 
@@ -62,10 +72,35 @@ typedef enum {
 /* Maximum number of records used in allocation statistics */
 #define FSM_MAX_STATS_COUNT 0x0000ffff
 
+/* Maximum length of block in blocks served by size-class magazines */
+#define FSM_MAG_MAX_BLKS 64
+
+/* Capacity of size-class magazine */
+#define FSM_MAG_CAP 64
+
+/* Number of blocks reserved by single magazine refill */
+#define FSM_MAG_BATCH 16
+
+/* Number of lock stripes of registry of blocks cached by magazines */
+#define FSM_MAG_STRIPES 64
+
+/* Flag of magazine entry: deallocated segment is not checked against free-space bitmap yet */
+#define FSM_MAG_UNVERIFIED (1ULL << 63)
+
+/* Max number of distinct free blocks lengths examined by allocation with address hint */
+#define FSM_HINT_LENGTHS 8
+
+/* Minimal length of free-space bitmap in bytes to persist free-space tree snapshot */
+#define FSM_SNAPSHOT_MIN_BMLEN (256 * 1024)
+
+/* Maximum number of free-space extents in snapshot */
+#define FSM_SNAPSHOT_MAX_NUM (INT32_MAX / 8)
+
 #define FSM_CUSTOM_HDR_DATA_OFFSET                                                                          \
   (4 /*magic*/ + 1 /*block pow*/ + 8 /*fsm bitmap block offset */ + 8 /*fsm bitmap block length*/ +          \
    8 /*all allocated block length sum */ + 4 /*number of all allocated areas */ +                            \
-   8 /* allocated areas length standard variance (deviation^2 * N) */ + 32 /*reserved*/ +                    \
+   8 /* allocated areas length standard variance (deviation^2 * N) */ +                                      \
+   16 /*free-space snapshot offset, number of extents, checksum*/ + 16 /*reserved*/ +                       \
    4 /*custom hdr size*/)
 
 #define FSM_ENSURE_OPEN(FSM_impl_)                                                                          \
@@ -88,6 +123,29 @@ IW_INLINE int _fsm_cmp_ptr(const FSMBK *a, const FSMBK *b);
 #define _fsm_cmp(a_, b_) (_fsm_cmp_ptr(&(a_), &(b_)))
 KBTREE_INIT(fsm, FSMBK, _fsm_cmp)
 
+/**
+ * Size-class magazine: stack of reserved blocks of the same length.
+ * Blocks in magazine are marked as allocated in the free-space bitmap.
+ */
+typedef struct {
+  pthread_mutex_t mtx;
+  uint32_t num;                   /**< Number of cached blocks */
+  uint32_t unum;                  /**< Number of cached blocks flagged by `FSM_MAG_UNVERIFIED` */
+  uint64_t blks[FSM_MAG_CAP];     /**< Offsets of cached blocks in blocks */
+} FSMMAG;
+
+KHASH_MAP_INIT_INT64(FSMCB, uint64_t)
+
+/**
+ * Lock stripe of registry of blocks cached by magazines of all size-classes.
+ * Maps index of 64 blocks granule to bit mask of its cached blocks,
+ * so segment deallocated twice with any length is detected without FSM lock.
+ */
+typedef struct {
+  pthread_mutex_t mtx;
+  khash_t(FSMCB) *map;
+} FSMMAGREG;
+
 struct IWFS_FSM_IMPL {
   IWFS_EXT pool;             /**< Underlying rwl file. */
   uint64_t bmlen;            /**< Free-space bitmap block length in bytes. */
@@ -98,17 +156,29 @@ struct IWFS_FSM_IMPL {
                                   offset. */
   uint64_t crzsum;           /**< Cumulative sum all allocated blocks */
   uint64_t crzvar;           /**< Record sizes standard variance (deviation^2 * N) */
+  atomic_uint_fast64_t alloc_num;   /**< Number of successful `allocate` calls */
+  atomic_uint_fast64_t dealloc_num; /**< Number of successful `deallocate` calls */
   uint32_t hdrlen;           /**< Length of custom file header */
   uint32_t crznum;           /**< Number of all allocated continuous areas acquired by
                                   `allocated` */
+  uint64_t snapoff;          /**< Offset of free-space tree snapshot in bytes
+                                  or zero if file has no valid snapshot */
+  uint32_t snapnum;          /**< Number of free-space extents in snapshot */
+  uint32_t snapcrc;          /**< Snapshot checksum */
+  bool snaploaded;           /**< Free-space tree loaded from snapshot on open */
   IWFS_FSM *f;               /**< Self reference. */
   kbtree_t(fsm) *fsm;        /**< Free-space tree */
   pthread_rwlock_t *ctlrwlk; /**< Methods RW lock */
+  FSMMAG *mags;              /**< Size-class magazines indexed by block length
+                                  or zero if magazines are disabled */
+  FSMMAGREG *magreg;         /**< Registry of blocks cached by magazines, `FSM_MAG_STRIPES` stripes */
   size_t psize;              /**< System page size */
   iwfs_fsm_openflags oflags; /**< Operation mode flags. */
   iwfs_omode omode;          /**< Open mode. */
   uint8_t bpow;              /**< Block size power for 2 */
   bool mmap_all;             /**< Mmap all file data */
+  bool mmap_private;         /**< File data is changed by writeback only, see `IWFS_MMAP_PRIVATE` */
+  const IWTRACE *trace;      /**< Tracing hooks, zero if not set */
 };
 
 static iwrc _fsm_ensure_size_lw(FSM *impl, off_t size);
@@ -139,6 +209,157 @@ IW_INLINE iwrc _fsm_ctrl_unlock(FSM *impl) {
   return (err ? iwrc_set_errno(IW_ERROR_THREADING_ERRNO, err) : 0);
 }
 
+IW_INLINE iwrc _fsm_mag_lock(FSMMAG *mag) {
+  int err = pthread_mutex_lock(&mag->mtx);
+  return (err ? iwrc_set_errno(IW_ERROR_THREADING_ERRNO, err) : 0);
+}
+
+IW_INLINE iwrc _fsm_mag_unlock(FSMMAG *mag) {
+  int err = pthread_mutex_unlock(&mag->mtx);
+  return (err ? iwrc_set_errno(IW_ERROR_THREADING_ERRNO, err) : 0);
+}
+
+/*************************************************************************************************
+ *                                Bitmap scan kernels                                            *
+ *************************************************************************************************/
+
+/**
+ * @brief Bitmap words scan kernel.
+ * @return Number of leading (forward scan) or trailing (backward scan)
+ *         words of `p[0, n)` equal to @a skip.
+ */
+typedef size_t (*FSM_BMSCAN)(const uint64_t *p, size_t n, uint64_t skip);
+
+static size_t _fsm_bmscan_fwd_generic(const uint64_t *p, size_t n, uint64_t skip) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    if ((p[i] ^ skip) | (p[i + 1] ^ skip) | (p[i + 2] ^ skip) | (p[i + 3] ^ skip)) {
+      break;
+    }
+  }
+  while (i < n && p[i] == skip) {
+    ++i;
+  }
+  return i;
+}
+
+static size_t _fsm_bmscan_bwd_generic(const uint64_t *p, size_t n, uint64_t skip) {
+  size_t i = n;
+  for (; i >= 4; i -= 4) {
+    if ((p[i - 1] ^ skip) | (p[i - 2] ^ skip) | (p[i - 3] ^ skip) | (p[i - 4] ^ skip)) {
+      break;
+    }
+  }
+  while (i > 0 && p[i - 1] == skip) {
+    --i;
+  }
+  return n - i;
+}
+
+#if defined(FSM_BMSCAN_AVX2)
+
+__attribute__((target("avx2")))
+static size_t _fsm_bmscan_fwd_avx2(const uint64_t *p, size_t n, uint64_t skip) {
+  size_t i = 0;
+  const __m256i s = _mm256_set1_epi64x((long long) skip);
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_or_si256(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i)), s),
+                                _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i + 4)), s));
+    if (!_mm256_testz_si256(v, v)) {
+      break;
+    }
+  }
+  return i + _fsm_bmscan_fwd_generic(p + i, n - i, skip);
+}
+
+__attribute__((target("avx2")))
+static size_t _fsm_bmscan_bwd_avx2(const uint64_t *p, size_t n, uint64_t skip) {
+  size_t i = n;
+  const __m256i s = _mm256_set1_epi64x((long long) skip);
+  for (; i >= 8; i -= 8) {
+    __m256i v = _mm256_or_si256(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i - 8)), s),
+                                _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i - 4)), s));
+    if (!_mm256_testz_si256(v, v)) {
+      break;
+    }
+  }
+  return (n - i) + _fsm_bmscan_bwd_generic(p, i, skip);
+}
+
+#elif defined(FSM_BMSCAN_NEON)
+
+static size_t _fsm_bmscan_fwd_neon(const uint64_t *p, size_t n, uint64_t skip) {
+  size_t i = 0;
+  const uint64x2_t s = vdupq_n_u64(skip);
+  for (; i + 4 <= n; i += 4) {
+    uint64x2_t v = vorrq_u64(veorq_u64(vld1q_u64(p + i), s), veorq_u64(vld1q_u64(p + i + 2), s));
+    if (vgetq_lane_u64(v, 0) | vgetq_lane_u64(v, 1)) {
+      break;
+    }
+  }
+  return i + _fsm_bmscan_fwd_generic(p + i, n - i, skip);
+}
+
+static size_t _fsm_bmscan_bwd_neon(const uint64_t *p, size_t n, uint64_t skip) {
+  size_t i = n;
+  const uint64x2_t s = vdupq_n_u64(skip);
+  for (; i >= 4; i -= 4) {
+    uint64x2_t v = vorrq_u64(veorq_u64(vld1q_u64(p + i - 4), s), veorq_u64(vld1q_u64(p + i - 2), s));
+    if (vgetq_lane_u64(v, 0) | vgetq_lane_u64(v, 1)) {
+      break;
+    }
+  }
+  return (n - i) + _fsm_bmscan_bwd_generic(p, i, skip);
+}
+
+#endif
+
+// Kernels are selected by `_fsm_bmscan_select()` on `iwfs_fsmfile_init()`
+#if defined(FSM_BMSCAN_NEON)
+static FSM_BMSCAN _fsm_bmscan_fwd = _fsm_bmscan_fwd_neon;
+static FSM_BMSCAN _fsm_bmscan_bwd = _fsm_bmscan_bwd_neon;
+#else
+static FSM_BMSCAN _fsm_bmscan_fwd = _fsm_bmscan_fwd_generic;
+static FSM_BMSCAN _fsm_bmscan_bwd = _fsm_bmscan_bwd_generic;
+#endif
+
+/**
+ * @brief Select the best bitmap scan kernels supported by CPU.
+ * @param generic Use portable kernels.
+ * @return Name of selected kernels set.
+ */
+static const char *_fsm_bmscan_select(bool generic) {
+  if (!generic) {
+#if defined(FSM_BMSCAN_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      _fsm_bmscan_fwd = _fsm_bmscan_fwd_avx2;
+      _fsm_bmscan_bwd = _fsm_bmscan_bwd_avx2;
+      return "avx2";
+    }
+#elif defined(FSM_BMSCAN_NEON)
+    _fsm_bmscan_fwd = _fsm_bmscan_fwd_neon;
+    _fsm_bmscan_bwd = _fsm_bmscan_bwd_neon;
+    return "neon";
+#endif
+  }
+  _fsm_bmscan_fwd = _fsm_bmscan_fwd_generic;
+  _fsm_bmscan_bwd = _fsm_bmscan_bwd_generic;
+  return "generic";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Returns `true` if the specified blocks range overlaps
+ *        the file header or the free-space bitmap.
+ */
+IW_INLINE bool _fsm_is_protected_range_lw(FSM *impl, off_t offset_blk, off_t length_blk) {
+  return IW_RANGES_OVERLAP(offset_blk, offset_blk + length_blk, 0, (impl->hdrlen >> impl->bpow)) ||
+         IW_RANGES_OVERLAP(offset_blk, offset_blk + length_blk, (impl->bmoff >> impl->bpow),
+                           (impl->bmoff >> impl->bpow) + (impl->bmlen >> impl->bpow));
+}
+
 IW_INLINE iwrc _fsm_bmptr(FSM *impl, uint64_t **bmptr) {
   size_t sp;
   uint8_t *mm;
@@ -240,8 +461,83 @@ IW_INLINE iwrc _fsm_put_fbk(FSM *impl, uint64_t offset_blk, uint64_t length_blk)
   return 0;
 }
 
+IW_INLINE uint64_t _fsm_blk_distance(uint64_t a, uint64_t b) {
+  return a > b ? a - b : b - a;
+}
+
+/**
+ * @brief Find free-space block of at most `2 * length_blk` blocks nearest to @a offset_blk.
+ *
+ * Free-space tree is ordered by blocks length, so blocks of every length
+ * are looked up separately, at most `FSM_HINT_LENGTHS` lengths are examined.
+ *
+ * @return `0` if there is no such block.
+ */
+static FSMBK *_fsm_find_nearest_fblock_lw(FSM *impl, uint64_t offset_blk, uint64_t length_blk) {
+  FSMBK k, *uk, *lk, *ret = 0;
+  uint64_t dist = UINT64_MAX;
+  uint64_t len = length_blk;
+  for (int i = 0; i < FSM_HINT_LENGTHS && len <= 2 * length_blk; ++i) {
+    if (_fsm_init_fbk(&k, offset_blk, len)) {
+      break;
+    }
+    kb_intervalp(fsm, impl->fsm, &k, &lk, &uk);
+    if (lk && FSMBK_LENGTH(lk) == len && _fsm_blk_distance(FSMBK_OFFSET(lk), offset_blk) < dist) {
+      ret = lk;
+      dist = _fsm_blk_distance(FSMBK_OFFSET(lk), offset_blk);
+    }
+    if (uk && FSMBK_LENGTH(uk) == len && _fsm_blk_distance(FSMBK_OFFSET(uk), offset_blk) < dist) {
+      ret = uk;
+      dist = _fsm_blk_distance(FSMBK_OFFSET(uk), offset_blk);
+    }
+    // Move to the next length of free blocks
+    if (_fsm_init_fbk(&k, 0, len + 1)) {
+      break;
+    }
+    kb_intervalp(fsm, impl->fsm, &k, &lk, &uk);
+    if (!uk) {
+      break;
+    }
+    len = FSMBK_LENGTH(uk);
+  }
+  return ret;
+}
+
+/**
+ * @brief Find free-space block of at least @a length_blk blocks with the lowest offset.
+ *
+ * The lowest block of every length is looked up, so lookup cost depends
+ * on the number of distinct lengths of free blocks rather than on their number.
+ *
+ * @param max_offset_blk If not zero found block must start below it.
+ * @return `0` if there is no such block.
+ */
+static FSMBK *_fsm_find_lowest_fblock_lw(FSM *impl, uint64_t max_offset_blk, uint64_t length_blk) {
+  FSMBK k, *uk, *lk, *ret = 0;
+  uint64_t len = length_blk;
+  while (!_fsm_init_fbk(&k, 0, len)) {
+    kb_intervalp(fsm, impl->fsm, &k, &lk, &uk);
+    if (!uk) {
+      break;
+    }
+    if (!ret || FSMBK_OFFSET(uk) < FSMBK_OFFSET(ret)) {
+      ret = uk;
+    }
+    len = FSMBK_LENGTH(uk) + 1;
+  }
+  if (ret && max_offset_blk && FSMBK_OFFSET(ret) >= max_offset_blk) {
+    return 0;
+  }
+  return ret;
+}
+
 /**
  * @brief Get the nearest free-space block.
+ *
+ * If @a offset_blk hint is set blocks not much larger than requested
+ * are selected by distance to hint, so related data allocated with hints
+ * is kept close in file.
+ *
  * @param impl `FSM`
  * @param offset_blk Desired offset in number of blocks.
  * @param length_blk Desired free area size specified in blocks.
@@ -253,6 +549,12 @@ IW_INLINE FSMBK *_fsm_find_matching_fblock_lw(FSM *impl,
                                               uint64_t length_blk,
                                               iwfs_fsm_aflags opts) {
   FSMBK k, *uk, *lk;
+  if (offset_blk) {
+    FSMBK *nk = _fsm_find_nearest_fblock_lw(impl, offset_blk, length_blk);
+    if (nk) {
+      return nk;
+    }
+  }
   iwrc rc = _fsm_init_fbk(&k, offset_blk, length_blk);
   if (rc) {
     iwlog_ecode_error3(rc);
@@ -264,6 +566,38 @@ IW_INLINE FSMBK *_fsm_find_matching_fblock_lw(FSM *impl,
   return (lklength >= length_blk ? lk : (uklength >= length_blk) ? uk : 0);
 }
 
+/**
+ * @brief Set or clear bits of the single bitmap word selected by @a mask.
+ */
+IW_INLINE void _fsm_set_bit_mask(uint64_t *p, uint64_t mask, const int bit_status,
+                                 const fsm_bmopts_t opts, iwrc *rcp) {
+  if (bit_status) {
+    if ((opts & FSM_BM_STRICT) && (*p & mask)) {
+      *rcp = IWFS_ERROR_FSM_SEGMENTATION;
+    }
+    if ((opts & FSM_BM_DRY_RUN) == 0) {
+      *p |= mask;
+    }
+  } else {
+    if ((opts & FSM_BM_STRICT) && ((*p & mask) != mask)) {
+      *rcp = IWFS_ERROR_FSM_SEGMENTATION;
+    }
+    if ((opts & FSM_BM_DRY_RUN) == 0) {
+      *p &= ~mask;
+    }
+  }
+}
+
+/**
+ * @brief Report modified bitmap words `[offset_bits, bend)` to the pool dirty ranges tracker.
+ */
+IW_INLINE void _fsm_bm_dirty(FSM *impl, uint64_t offset_bits, uint64_t bend, const fsm_bmopts_t opts) {
+  if (!(opts & FSM_BM_DRY_RUN)) {
+    off_t off = impl->bmoff + (offset_bits / 64) * 8;
+    impl->pool.dirty_mmap(&impl->pool, off, impl->bmoff + IW_ROUNDUP(bend, 64) / 8 - off);
+  }
+}
+
 /**
  * @brief Set the allocation bits in the fsm bitmap.
  *
@@ -281,9 +615,8 @@ static iwrc _fsm_set_bit_status_lw(FSM *impl,
   iwrc rc;
   uint8_t *mm;
   size_t sp;
-  register uint64_t *p, set_mask;
+  uint64_t *p, *pe, set_mask, tail_mask;
   uint64_t bend = offset_bits + length_bits;
-  int set_bits;
 
   if (bend < offset_bits) { // overflow
     return IW_ERROR_OUT_OF_BOUNDS;
@@ -308,49 +641,34 @@ static iwrc _fsm_set_bit_status_lw(FSM *impl,
     }
   }
 
-  sp = impl->bmlen;
+  if (!length_bits) {
+    return 0;
+  }
   p = ((uint64_t *) mm) + offset_bits / 64;
-  set_bits = 64 - (offset_bits & (64 - 1));
+  pe = ((uint64_t *) mm) + bend / 64;
   set_mask = (~((uint64_t) 0) << (offset_bits & (64 - 1)));
-  while (length_bits - set_bits >= 0) {
-    if (bit_status) {
-      if ((opts & FSM_BM_STRICT) && (*p & set_mask)) {
-        rc = IWFS_ERROR_FSM_SEGMENTATION;
-      }
-      if ((opts & FSM_BM_DRY_RUN) == 0) {
-        *p |= set_mask;
-      }
-    } else {
-      if ((opts & FSM_BM_STRICT) && ((*p & set_mask) != set_mask)) {
-        rc = IWFS_ERROR_FSM_SEGMENTATION;
-      }
-      if ((opts & FSM_BM_DRY_RUN) == 0) {
-        *p &= ~set_mask;
-      }
-    }
-    length_bits -= set_bits;
-    set_bits = 64;
-    set_mask = ~((uint64_t) 0);
-    ++p;
+  tail_mask = (bend & (64 - 1)) ? ((((uint64_t) 1) << (bend & (64 - 1))) - 1) : 0;
+  if (p == pe) {
+    _fsm_set_bit_mask(p, set_mask & tail_mask, bit_status, opts, &rc);
+    _fsm_bm_dirty(impl, offset_bits, bend, opts);
+    return rc;
   }
-  if (length_bits) {
-    set_mask &= (bend & (64 - 1)) ? ((((uint64_t) 1) << (bend & (64 - 1))) - 1) : ~((uint64_t) 0);
-    if (bit_status) {
-      if ((opts & FSM_BM_STRICT) && (*p & set_mask)) {
-        rc = IWFS_ERROR_FSM_SEGMENTATION;
-      }
-      if ((opts & FSM_BM_DRY_RUN) == 0) {
-        *p |= set_mask;
-      }
-    } else {
-      if ((opts & FSM_BM_STRICT) && (*p & set_mask) != set_mask) {
-        rc = IWFS_ERROR_FSM_SEGMENTATION;
-      }
-      if ((opts & FSM_BM_DRY_RUN) == 0) {
-        *p &= ~set_mask;
-      }
+  if (set_mask != ~((uint64_t) 0)) {
+    _fsm_set_bit_mask(p++, set_mask, bit_status, opts, &rc);
+  }
+  if (pe > p) {
+    size_t n = pe - p;
+    if ((opts & FSM_BM_STRICT) && _fsm_bmscan_fwd(p, n, bit_status ? 0 : ~((uint64_t) 0)) != n) {
+      rc = IWFS_ERROR_FSM_SEGMENTATION;
     }
+    if ((opts & FSM_BM_DRY_RUN) == 0) {
+      memset(p, bit_status ? 0xff : 0, n * sizeof(*p));
+    }
+  }
+  if (tail_mask) {
+    _fsm_set_bit_mask(pe, tail_mask, bit_status, opts, &rc);
   }
+  _fsm_bm_dirty(impl, offset_bits, bend, opts);
   return rc;
 }
 
@@ -442,71 +760,22 @@ static iwrc _fsm_blk_allocate_aligned_lw(FSM *impl,
   return _fsm_set_bit_status_lw(impl, akoff, length_blk, 1, bopts);
 }
 
-/**
- * @brief Load existing bitmap area into free-space search tree.
- * @param impl  `FSM`
- * @param bm    Bitmap area start ptr
- * @param len   Bitmap area length in bytes.
- */
-static void _fsm_load_fsm_lw(FSM *impl, uint8_t *bm, uint64_t len) {
-  register uint64_t b;
-  uint64_t bnum = len << 3,
-           cbnum = 0,
-           fbklength = 0,
-           fbkoffset = 0;
-  int i;
-  if (impl->fsm) {
-    kb_destroy(fsm, impl->fsm);
-  }
-  impl->fsm = kb_init(fsm, KB_DEFAULT_SIZE);
-  for (b = 0; b < len; ++b) {
-    register uint8_t bb = bm[b];
-    if (bb == 0) {
-      fbklength += 8;
-      cbnum += 8;
-    } else if (bb == (uint8_t) 0xffU) {
-      if (fbklength > 0) {
-        fbkoffset = cbnum - fbklength;
-        _fsm_put_fbk(impl, fbkoffset, fbklength);
-        fbklength = 0;
-      }
-      cbnum += 8;
-    } else {
-      for (i = 0; i < 8; ++i, ++cbnum) {  // TODO: optimize?
-        if (bb & (1 << i)) {
-          if (fbklength > 0) {
-            fbkoffset = cbnum - fbklength;
-            _fsm_put_fbk(impl, fbkoffset, fbklength);
-            fbklength = 0;
-          }
-        } else {
-          ++fbklength;
-        }
-      }
-    }
-  }
-  if (fbklength > 0) {
-    fbkoffset = bnum - fbklength;
-    _fsm_put_fbk(impl, fbkoffset, fbklength);
-  }
-}
-
 /**
  * @brief Flush a current `iwfsmfile` metadata into the file header.
  * @param impl
- * @param is_sync If `1` perform mmap sync.
+ * @param data Optional data request written along with header by single vectored write.
  * @return
  */
-static iwrc _fsm_write_meta_lw(FSM *impl) {
+static iwrc _fsm_write_meta_lw(FSM *impl, IWP_IOREQ *data) {
   uint64_t llv;
-  size_t wlen;
   uint32_t sp = 0, lv;
   uint8_t hdr[FSM_CUSTOM_HDR_DATA_OFFSET] = {0};
 
   /*
       [FSM_CTL_MAGICK u32][block pow u8]
       [bmoffset u64][bmlength u64]
-      [u64 crzsum][u32 crznum][u64 crszvar][u256 reserved]
+      [u64 crzsum][u32 crznum][u64 crszvar]
+      [u64 snapoff][u32 snapnum][u32 snapcrc][u128 reserved]
       [custom header size u32][custom header data...]
       [fsm data...]
   */
@@ -558,8 +827,22 @@ static iwrc _fsm_write_meta_lw(FSM *impl) {
   memcpy(hdr + sp, &llv, sizeof(llv));
   sp += sizeof(llv);
 
+  /* Free-space tree snapshot */
+  llv = impl->snapoff;
+  llv = IW_HTOILL(llv);
+  memcpy(hdr + sp, &llv, sizeof(llv));
+  sp += sizeof(llv);
+  lv = impl->snapnum;
+  lv = IW_HTOIL(lv);
+  memcpy(hdr + sp, &lv, sizeof(lv));
+  sp += sizeof(lv);
+  lv = impl->snapcrc;
+  lv = IW_HTOIL(lv);
+  memcpy(hdr + sp, &lv, sizeof(lv));
+  sp += sizeof(lv);
+
   /* Reserved */
-  sp += 32;
+  sp += 16;
 
   /* Size of header */
   lv = impl->hdrlen;
@@ -569,17 +852,29 @@ static iwrc _fsm_write_meta_lw(FSM *impl) {
   sp += sizeof(lv);
 
   assert(sp == FSM_CUSTOM_HDR_DATA_OFFSET);
-  return impl->pool.write(&impl->pool, 0, hdr, FSM_CUSTOM_HDR_DATA_OFFSET, &wlen);
+  IWP_IOREQ reqs[2] = {
+    {
+      .off = 0,
+      .buf = hdr,
+      .len = FSM_CUSTOM_HDR_DATA_OFFSET
+    }
+  };
+  if (data) {
+    reqs[1] = *data;
+  }
+  return impl->pool.writev(&impl->pool, reqs, data ? 2 : 1);
 }
 
 /**
- * @brief Search for the first next set bit position
+ * @brief Search for the first next bit position which differs from
+ *        corresponding bit of @a skip pattern (`0` or `~0`)
  *        starting from the specified offset bit (INCLUDED).
  */
-static uint64_t _fsm_find_next_set_bit(const uint64_t *addr,
-                                       register uint64_t offset_bit,
-                                       const uint64_t max_offset_bit,
-                                       int *found) {
+static uint64_t _fsm_find_next_bit(const uint64_t *addr,
+                                   register uint64_t offset_bit,
+                                   const uint64_t max_offset_bit,
+                                   const uint64_t skip,
+                                   int *found) {
   *found = 0;
   register uint64_t tmp, bit, size;
   register const uint64_t *p = addr + offset_bit / 64;
@@ -590,7 +885,7 @@ static uint64_t _fsm_find_next_set_bit(const uint64_t *addr,
   offset_bit -= bit;
   size = max_offset_bit - offset_bit;
   if (bit) {
-    tmp = *p & (~((uint64_t) 0) << bit);
+    tmp = (*p ^ skip) & (~((uint64_t) 0) << bit);
     if (tmp) {
       tmp = iwbits_find_first_sbit64(tmp);
       if (tmp >= size) {
@@ -607,18 +902,21 @@ static uint64_t _fsm_find_next_set_bit(const uint64_t *addr,
     size -= 64;
     ++p;
   }
-  while (size & ~(64 - 1)) {
-    if ((tmp = *(p++))) {
+  if (size & ~(64 - 1)) {
+    size_t n = size / 64;
+    size_t k = _fsm_bmscan_fwd(p, n, skip);
+    p += k;
+    offset_bit += k * 64;
+    size -= k * 64;
+    if (k < n) {
       *found = 1;
-      return offset_bit + iwbits_find_first_sbit64(tmp);
+      return offset_bit + iwbits_find_first_sbit64(*p ^ skip);
     }
-    offset_bit += 64;
-    size -= 64;
   }
   if (!size) {
     return 0;
   }
-  tmp = (*p) & (~((uint64_t) 0) >> (64 - size));
+  tmp = (*p ^ skip) & (~((uint64_t) 0) >> (64 - size));
   if (tmp) {
     *found = 1;
     return offset_bit + iwbits_find_first_sbit64(tmp);
@@ -627,6 +925,47 @@ static uint64_t _fsm_find_next_set_bit(const uint64_t *addr,
   }
 }
 
+/**
+ * @brief Search for the first next set bit position
+ *        starting from the specified offset bit (INCLUDED).
+ */
+IW_INLINE uint64_t _fsm_find_next_set_bit(const uint64_t *addr,
+                                          uint64_t offset_bit,
+                                          const uint64_t max_offset_bit,
+                                          int *found) {
+  return _fsm_find_next_bit(addr, offset_bit, max_offset_bit, 0, found);
+}
+
+/**
+ * @brief Load existing bitmap area into free-space search tree.
+ * @param impl  `FSM`
+ * @param bm    Bitmap area start ptr
+ * @param len   Bitmap area length in bytes.
+ */
+static void _fsm_load_fsm_lw(FSM *impl, uint8_t *bm, uint64_t len) {
+  const uint64_t *p = (const uint64_t *) bm;
+  uint64_t bnum = len << 3, fbkoffset = 0, fbkend;
+  int found;
+  assert(!(len & (sizeof(*p) - 1)));
+  if (impl->fsm) {
+    kb_destroy(fsm, impl->fsm);
+  }
+  impl->fsm = kb_init(fsm, KB_DEFAULT_SIZE);
+  while (fbkoffset < bnum) {
+    // Start of the next free blocks run
+    fbkoffset = _fsm_find_next_bit(p, fbkoffset, bnum, ~((uint64_t) 0), &found);
+    if (!found) {
+      break;
+    }
+    fbkend = _fsm_find_next_set_bit(p, fbkoffset, bnum, &found);
+    if (!found) {
+      fbkend = bnum;
+    }
+    _fsm_put_fbk(impl, fbkoffset, fbkend - fbkoffset);
+    fbkoffset = fbkend;
+  }
+}
+
 /**
  * @brief Search for the first previous set bit position
  *        starting from the specified offset_bit (EXCLUDED).
@@ -656,18 +995,23 @@ static uint64_t _fsm_find_prev_set_bit(const uint64_t *addr,
         return offset_bit > tmp ? offset_bit - tmp - 1 : 0;
       }
     }
+    if (size <= bit) {
+      return 0;
+    }
     offset_bit -= bit;
     size -= bit;
   }
-  while (size & ~(64 - 1)) {
-    if ((tmp = *(--p))) {
+  if (size & ~(64 - 1)) {
+    size_t n = size / 64;
+    size_t k = _fsm_bmscan_bwd(p - n, n, 0);
+    p -= k;
+    offset_bit -= k * 64;
+    size -= k * 64;
+    if (k < n) {
       *found = 1;
-      tmp = iwbits_find_first_sbit64(iwbits_reverse_64(*p));
-      assert(offset_bit > tmp);
-      return offset_bit > tmp ? offset_bit - tmp - 1 : 0;
+      tmp = iwbits_find_last_sbit64(*(--p));
+      return offset_bit - 64 + tmp;
     }
-    offset_bit -= 64;
-    size -= 64;
   }
   if (size == 0) {
     return 0;
@@ -835,6 +1179,7 @@ static iwrc _fsm_init_lw(FSM *impl, uint64_t bmoff, uint64_t bmlen) {
   } else {
     memset(mm, 0, bmlen);
   }
+  pool->dirty_mmap(pool, bmoff, bmlen);
 
   /* Backup the previous bitmap range */
   old_bmlen = impl->bmlen;
@@ -854,7 +1199,7 @@ static iwrc _fsm_init_lw(FSM *impl, uint64_t bmoff, uint64_t bmlen) {
   _fsm_load_fsm_lw(impl, mm, bmlen);
 
   /* Flush new meta */
-  rc = _fsm_write_meta_lw(impl);
+  rc = _fsm_write_meta_lw(impl, 0);
   RCGO(rc, rollback);
 
   rc = pool->sync(pool, IWFS_NO_MMASYNC | IWFS_FDATASYNC);
@@ -904,6 +1249,7 @@ static iwrc _fsm_resize_fsm_bitmap_lw(FSM *impl, uint64_t size) {
     bmoffset = 8 * impl->bmlen * (1 << impl->bpow);
     bmoffset = IW_ROUNDUP(bmoffset, impl->psize);
   }
+  IWTRACE_BEGIN(impl->trace, ev, IWTRACE_FSM_BITMAP_RESIZE);
   if (!impl->mmap_all) {
     rc = pool->add_mmap(pool, bmoffset, bmlen);
     RCRET(rc);
@@ -912,6 +1258,7 @@ static iwrc _fsm_resize_fsm_bitmap_lw(FSM *impl, uint64_t size) {
   if (rc && !impl->mmap_all) {
     pool->remove_mmap(pool, bmoffset);
   }
+  IWTRACE_END(impl->trace, ev, bmlen, 0);
   return rc;
 }
 
@@ -959,7 +1306,11 @@ static iwrc _fsm_blk_allocate_lw(FSM *impl,
   *olength_blk = length_blk;
 
 start:
-  nk = _fsm_find_matching_fblock_lw(impl, *offset_blk, length_blk, opts);
+  if (opts & IWFSM_ALLOC_LOWEST) {
+    nk = _fsm_find_lowest_fblock_lw(impl, *offset_blk, length_blk);
+  } else {
+    nk = _fsm_find_matching_fblock_lw(impl, *offset_blk, length_blk, opts);
+  }
   if (nk) { /* using existing free space block */
     uint64_t nlength = FSMBK_LENGTH(nk);
     *offset_blk = FSMBK_OFFSET(nk);
@@ -989,7 +1340,7 @@ start:
       }
     }
   } else {
-    if (opts & IWFSM_ALLOC_NO_EXTEND) {
+    if ((opts & IWFSM_ALLOC_NO_EXTEND) || ((opts & IWFSM_ALLOC_LOWEST) && *offset_blk)) {
       return IWFS_ERROR_NO_FREE_SPACE;
     }
     rc = _fsm_resize_fsm_bitmap_lw(impl, impl->bmlen << 1);
@@ -1034,7 +1385,7 @@ static iwrc _fsm_trim_tail_lw(FSM *impl) {
   IWFS_EXT_STATE pstate;
   uint64_t offset = 0, lastblk;
 
-  if (!(impl->omode & IWFS_OWRITE) || !impl->lfbkoff) {
+  if (!(impl->omode & IWFS_OWRITE) || !impl->lfbkoff || (impl->oflags & IWFSM_NO_TRIM)) {
     return 0;
   }
   /* find free space for fsm with lesser offset than actual */
@@ -1077,45 +1428,217 @@ finish:
   return rc;
 }
 
-static iwrc _fsm_init_impl(FSM *impl, const IWFS_FSM_OPTS *opts) {
-  impl->oflags = opts->oflags;
-  impl->psize = iwp_page_size();
-  impl->bpow = opts->bpow;
-  impl->mmap_all = opts->mmap_all;
-  if (!impl->bpow) {
-    impl->bpow = 6;  // 64bit block
-  } else if (impl->bpow > FSM_MAX_BLOCK_POW) {
-    return IWFS_ERROR_INVALID_BLOCK_SIZE;
-  } else if ((1 << impl->bpow) > impl->psize) {
-    return IWFS_ERROR_PLATFORM_PAGE;
-  }
-  return 0;
+/**
+ * @brief Checksum of free-space tree snapshot bound to the current bitmap location.
+ */
+static uint32_t _fsm_snapshot_crc(FSM *impl, const uint8_t *buf, uint64_t len) {
+  uint64_t llv[2] = {IW_HTOILL(impl->bmoff), IW_HTOILL(impl->bmlen)};
+  return iwu_crc32(buf, len, iwu_crc32((const uint8_t *) llv, sizeof(llv), 0));
 }
 
-static iwrc _fsm_init_locks(FSM *impl, const IWFS_FSM_OPTS *opts) {
-  if (opts->oflags & IWFSM_NOLOCKS) {
-    impl->ctlrwlk = 0;
+/**
+ * @brief Persist a snapshot of free-space tree.
+ *
+ * Snapshot: [[off:u4,len:u4]...] is stored in a free-space extent
+ * located within the current file size if any, otherwise the file
+ * is expanded to place the snapshot at the start of the last free extent.
+ *
+ * @note Free-space bitmap must be synced before snapshot is written,
+ *       caller must sync it after this call.
+ */
+static iwrc _fsm_write_snapshot_lw(FSM *impl) {
+  iwrc rc;
+  uint8_t *buf, *wp;
+  IWFS_EXT_STATE pstate;
+  uint64_t num = kb_size(impl->fsm);
+  if (impl->bmlen < FSM_SNAPSHOT_MIN_BMLEN || !num || num > FSM_SNAPSHOT_MAX_NUM) {
     return 0;
   }
-  int err;
-  impl->ctlrwlk = calloc(1, sizeof(*impl->ctlrwlk));
-  if (!impl->ctlrwlk) {
+  rc = impl->pool.state(&impl->pool, &pstate);
+  RCRET(rc);
+  uint64_t len = num * 2 * sizeof(uint32_t);
+  uint64_t len_blk = IW_ROUNDUP(len, 1ULL << impl->bpow) >> impl->bpow;
+  uint64_t fsize_blk = pstate.fsize >> impl->bpow;
+  uint64_t snapoff_blk = 0;
+
+  buf = malloc(len);
+  if (!buf) {
     return iwrc_set_errno(IW_ERROR_ALLOC, errno);
   }
-  err = pthread_rwlock_init(impl->ctlrwlk, 0);
-  if (err) {
-    free(impl->ctlrwlk);
-    impl->ctlrwlk = 0;
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, err);
+  wp = buf;
+  // Keys are traversed in ascending length order, so the best fit extent is selected
+#define _fsm_traverse(k)                                                                                     \
+  {                                                                                                          \
+    uint32_t lv = IW_HTOIL(FSMBK_OFFSET(k));                                                                \
+    memcpy(wp, &lv, sizeof(lv));                                                                           \
+    lv = IW_HTOIL(FSMBK_LENGTH(k));                                                                         \
+    memcpy(wp + sizeof(lv), &lv, sizeof(lv));                                                              \
+    wp += 2 * sizeof(lv);                                                                                  \
+    if (!snapoff_blk && FSMBK_LENGTH(k) >= len_blk && FSMBK_OFFSET(k) + len_blk <= fsize_blk) {             \
+      snapoff_blk = FSMBK_OFFSET(k);                                                                        \
+    }                                                                                                        \
   }
-  return 0;
-}
+  __kb_traverse(FSMBK, impl->fsm, _fsm_traverse);
+#undef _fsm_traverse
+  assert(wp == buf + len);
 
-static iwrc _fsm_destroy_locks(FSM *impl) {
-  if (!impl->ctlrwlk) {
-    return 0;
+  if (!snapoff_blk && impl->lfbklen >= len_blk) {
+    snapoff_blk = impl->lfbkoff;
+    if (pstate.fsize < ((snapoff_blk + len_blk) << impl->bpow)) {
+      rc = impl->pool.truncate(&impl->pool, (snapoff_blk + len_blk) << impl->bpow);
+      RCGO(rc, finish);
+    }
   }
-  iwrc rc = 0;
+  if (snapoff_blk) {
+    // Snapshot is verified by checksum, so it is written along with the header
+    IWP_IOREQ req = {
+      .off = snapoff_blk << impl->bpow,
+      .buf = buf,
+      .len = len
+    };
+    impl->snapoff = req.off;
+    impl->snapnum = num;
+    impl->snapcrc = _fsm_snapshot_crc(impl, buf, len);
+    rc = _fsm_write_meta_lw(impl, &req);
+  }
+
+finish:
+  free(buf);
+  return rc;
+}
+
+/**
+ * @brief Load free-space tree from snapshot saved on the last clean close.
+ * @param [out] loaded Set to `true` if valid snapshot is found and loaded.
+ */
+static iwrc _fsm_load_snapshot_lw(FSM *impl, bool *loaded) {
+  iwrc rc;
+  size_t sp;
+  uint8_t *buf;
+  IWFS_EXT_STATE pstate;
+  uint64_t len = (uint64_t) impl->snapnum * 2 * sizeof(uint32_t);
+  uint64_t bnum = impl->bmlen << 3;
+
+  *loaded = false;
+  if (!impl->snapnum || impl->snapnum > FSM_SNAPSHOT_MAX_NUM || impl->snapoff < impl->hdrlen) {
+    return 0;
+  }
+  rc = impl->pool.state(&impl->pool, &pstate);
+  RCRET(rc);
+  if (impl->snapoff + len > pstate.fsize) {
+    return 0;
+  }
+  buf = malloc(len);
+  if (!buf) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  rc = impl->pool.read(&impl->pool, impl->snapoff, buf, len, &sp);
+  RCGO(rc, finish);
+  if (sp != len || _fsm_snapshot_crc(impl, buf, len) != impl->snapcrc) {
+    goto finish;
+  }
+  if (impl->fsm) {
+    kb_destroy(fsm, impl->fsm);
+  }
+  impl->fsm = kb_init(fsm, KB_DEFAULT_SIZE);
+  impl->lfbkoff = 0;
+  impl->lfbklen = 0;
+  for (uint64_t i = 0; i < len; i += 2 * sizeof(uint32_t)) {
+    uint32_t off, blen;
+    memcpy(&off, buf + i, sizeof(off));
+    memcpy(&blen, buf + i + sizeof(off), sizeof(blen));
+    off = IW_ITOHL(off);
+    blen = IW_ITOHL(blen);
+    if (!blen || (uint64_t) off + blen > bnum) {
+      iwlog_warn2("Invalid free-space tree snapshot, free-space bitmap will be scanned");
+      goto finish;
+    }
+    _fsm_put_fbk(impl, off, blen);
+  }
+  *loaded = true;
+
+finish:
+  free(buf);
+  return rc;
+}
+
+static iwrc _fsm_init_impl(FSM *impl, const IWFS_FSM_OPTS *opts) {
+  impl->oflags = opts->oflags;
+  impl->psize = iwp_page_size();
+  impl->bpow = opts->bpow;
+  impl->mmap_all = opts->mmap_all;
+  impl->mmap_private = (opts->exfile.mmap_opts & IWFS_MMAP_PRIVATE);
+  impl->trace = opts->exfile.trace;
+  if (!impl->bpow) {
+    impl->bpow = 6;  // 64bit block
+  } else if (impl->bpow > FSM_MAX_BLOCK_POW) {
+    return IWFS_ERROR_INVALID_BLOCK_SIZE;
+  } else if ((1 << impl->bpow) > impl->psize) {
+    return IWFS_ERROR_PLATFORM_PAGE;
+  }
+  return 0;
+}
+
+static iwrc _fsm_init_locks(FSM *impl, const IWFS_FSM_OPTS *opts) {
+  if (opts->oflags & IWFSM_NOLOCKS) {
+    impl->ctlrwlk = 0;
+    return 0;
+  }
+  int err;
+  impl->ctlrwlk = calloc(1, sizeof(*impl->ctlrwlk));
+  if (!impl->ctlrwlk) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  err = pthread_rwlock_init(impl->ctlrwlk, 0);
+  if (err) {
+    free(impl->ctlrwlk);
+    impl->ctlrwlk = 0;
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, err);
+  }
+  if (opts->oflags & IWFSM_MAGAZINES) {
+    impl->mags = calloc(FSM_MAG_MAX_BLKS + 1, sizeof(*impl->mags));
+    impl->magreg = calloc(FSM_MAG_STRIPES, sizeof(*impl->magreg));
+    if (!impl->mags || !impl->magreg) {
+      free(impl->mags);
+      free(impl->magreg);
+      impl->mags = 0;
+      impl->magreg = 0;
+      return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    }
+    for (int i = 0; i <= FSM_MAG_MAX_BLKS; ++i) {
+      pthread_mutex_init(&impl->mags[i].mtx, 0);
+    }
+    for (int i = 0; i < FSM_MAG_STRIPES; ++i) {
+      pthread_mutex_init(&impl->magreg[i].mtx, 0);
+      impl->magreg[i].map = kh_init(FSMCB);
+      if (!impl->magreg[i].map) {
+        return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      }
+    }
+  }
+  return 0;
+}
+
+static iwrc _fsm_destroy_locks(FSM *impl) {
+  if (impl->mags) {
+    for (int i = 0; i <= FSM_MAG_MAX_BLKS; ++i) {
+      pthread_mutex_destroy(&impl->mags[i].mtx);
+    }
+    for (int i = 0; i < FSM_MAG_STRIPES; ++i) {
+      pthread_mutex_destroy(&impl->magreg[i].mtx);
+      if (impl->magreg[i].map) {
+        kh_destroy(FSMCB, impl->magreg[i].map);
+      }
+    }
+    free(impl->mags);
+    free(impl->magreg);
+    impl->mags = 0;
+    impl->magreg = 0;
+  }
+  if (!impl->ctlrwlk) {
+    return 0;
+  }
+  iwrc rc = 0;
   int err = pthread_rwlock_destroy(impl->ctlrwlk);
   ;
   if (err) {
@@ -1136,7 +1659,8 @@ static iwrc _fsm_read_meta_lr(FSM *impl) {
   /*
       [FSM_CTL_MAGICK u32][block pow u8]
       [bmoffset u64][bmlength u64]
-      [u64 crzsum][u32 crznum][u64 crszvar][u256 reserved]
+      [u64 crzsum][u32 crznum][u64 crszvar]
+      [u64 snapoff][u32 snapnum][u32 snapcrc][u128 reserved]
       [custom header size u32][custom header data...]
       [fsm data...]
   */
@@ -1207,8 +1731,19 @@ static iwrc _fsm_read_meta_lr(FSM *impl) {
   impl->crzvar = llv;
   rp += sizeof(llv);
 
+  /* Free-space tree snapshot */
+  memcpy(&llv, hdr + rp, sizeof(llv));
+  impl->snapoff = IW_ITOHLL(llv);
+  rp += sizeof(llv);
+  memcpy(&lv, hdr + rp, sizeof(lv));
+  impl->snapnum = IW_ITOHL(lv);
+  rp += sizeof(lv);
+  memcpy(&lv, hdr + rp, sizeof(lv));
+  impl->snapcrc = IW_ITOHL(lv);
+  rp += sizeof(lv);
+
   /* Reserved */
-  rp += 32;
+  rp += 16;
 
   /* Header size */
   memcpy(&lv, hdr + rp, sizeof(lv));
@@ -1290,7 +1825,21 @@ static iwrc _fsm_init_existing_lw(FSM *impl) {
       goto finish;
     }
   }
-  _fsm_load_fsm_lw(impl, mm, impl->bmlen);
+  rc = _fsm_load_snapshot_lw(impl, &impl->snaploaded);
+  RCGO(rc, finish);
+  if (!impl->snaploaded) {
+    _fsm_load_fsm_lw(impl, mm, impl->bmlen);
+  }
+  if (impl->snapnum && (impl->omode & IWFS_OWRITE)) {
+    // Snapshot will be stale after the first bitmap modification,
+    // so it must be durably invalidated before file data is changed
+    impl->snapoff = 0;
+    impl->snapnum = 0;
+    impl->snapcrc = 0;
+    rc = _fsm_write_meta_lw(impl, 0);
+    RCGO(rc, finish);
+    rc = pool->sync(pool, IWFS_FDATASYNC);
+  }
 
 finish:
   return rc;
@@ -1372,11 +1921,348 @@ static iwrc _fsm_read(struct IWFS_FSM *f, off_t off, void *buf, size_t siz, size
   return rc;
 }
 
+// Bit mask of `num` blocks of granule starting from block `start` of granule
+IW_INLINE uint64_t _fsm_magreg_mask(uint64_t start, uint64_t num) {
+  return (num >= 64 ? UINT64_MAX : ((1ULL << num) - 1)) << start;
+}
+
+IW_INLINE void _fsm_magreg_clear(khash_t(FSMCB) *map, khiter_t k, uint64_t mask) {
+  kh_value(map, k) &= ~mask;
+  if (!kh_value(map, k)) {
+    kh_del(FSMCB, map, k);
+  }
+}
+
+/**
+ * @brief Add segment to or remove it from registry of blocks cached by magazines.
+ *
+ * Segment of at most `FSM_MAG_MAX_BLKS` blocks spans one or two granules,
+ * their stripes are locked in address order.
+ * Adding of segment overlapping already cached blocks fails with `IWFS_ERROR_FSM_SEGMENTATION`.
+ */
+static iwrc _fsm_magreg_update(FSM *impl, uint64_t offset_blk, uint64_t length_blk, bool add) {
+  iwrc rc = 0;
+  int n = 1;
+  uint64_t s = offset_blk & 63;
+  uint64_t g[2] = { offset_blk >> 6, (offset_blk >> 6) + 1 };
+  uint64_t m[2] = { _fsm_magreg_mask(s, MIN(length_blk, 64 - s)), 0 };
+  if (s + length_blk > 64) {
+    m[1] = _fsm_magreg_mask(0, s + length_blk - 64);
+    n = 2;
+  }
+  FSMMAGREG *r[2] = { &impl->magreg[g[0] % FSM_MAG_STRIPES], &impl->magreg[g[1] % FSM_MAG_STRIPES] };
+  FSMMAGREG *lr[2] = { r[0], r[1] };
+  if (n > 1 && r[1] < r[0]) {
+    lr[0] = r[1];
+    lr[1] = r[0];
+  }
+  for (int i = 0; i < n; ++i) {
+    pthread_mutex_lock(&lr[i]->mtx);
+  }
+  khiter_t k[2];
+  for (int i = 0; i < n; ++i) {
+    k[i] = kh_get(FSMCB, r[i]->map, g[i]);
+    if (add && k[i] != kh_end(r[i]->map) && (kh_value(r[i]->map, k[i]) & m[i])) {
+      rc = IWFS_ERROR_FSM_SEGMENTATION;
+      goto finish;
+    }
+  }
+  for (int i = 0; i < n; ++i) {
+    if (add) {
+      if (k[i] == kh_end(r[i]->map)) {
+        int rci;
+        k[i] = kh_put(FSMCB, r[i]->map, g[i], &rci);
+        if (rci == -1) {
+          rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+          if (i) {
+            _fsm_magreg_clear(r[0]->map, k[0], m[0]);
+          }
+          goto finish;
+        }
+        kh_value(r[i]->map, k[i]) = 0;
+      }
+      kh_value(r[i]->map, k[i]) |= m[i];
+    } else if (k[i] != kh_end(r[i]->map)) {
+      _fsm_magreg_clear(r[i]->map, k[i], m[i]);
+    }
+  }
+
+finish:
+  for (int i = n - 1; i >= 0; --i) {
+    pthread_mutex_unlock(&lr[i]->mtx);
+  }
+  return rc;
+}
+
+/**
+ * @brief Check deallocated segments cached in magazine against free-space bitmap.
+ *
+ * Segments not allocated in bitmap or overlapping header and bitmap areas
+ * are logged and dropped, so they are never reused.
+ *
+ * @note Caller must hold magazine lock and FSM read or write lock.
+ * @param length_blk Length of magazine blocks.
+ */
+static iwrc _fsm_mag_verify_lr(FSM *impl, FSMMAG *mag, uint64_t length_blk) {
+  iwrc rc = 0;
+  uint32_t j = 0, unum = 0;
+  for (uint32_t i = 0; i < mag->num; ++i) {
+    uint64_t blk = mag->blks[i];
+    if ((blk & FSM_MAG_UNVERIFIED) && !rc) {
+      int allocated = 0;
+      blk &= ~FSM_MAG_UNVERIFIED;
+      if (!_fsm_is_protected_range_lw(impl, blk, length_blk)) {
+        rc = _fsm_is_fully_allocated_lr(impl, blk, length_blk, &allocated);
+        if (rc) {
+          blk |= FSM_MAG_UNVERIFIED;
+          allocated = 1;
+        }
+      }
+      if (!allocated) {
+        iwlog_ecode_error(IWFS_ERROR_FSM_SEGMENTATION,
+                          "Deallocated segment is not allocated, offset: %" PRIu64 " length: %" PRIu64 " blocks",
+                          blk, length_blk);
+        _fsm_magreg_update(impl, blk, length_blk, false);
+        continue;
+      }
+    }
+    if (blk & FSM_MAG_UNVERIFIED) {
+      ++unum;
+    }
+    mag->blks[j++] = blk;
+  }
+  mag->num = j;
+  mag->unum = unum;
+  return rc;
+}
+
+/**
+ * @brief Return the oldest blocks cached in magazine back to the free-space tree
+ *        leaving at most @a keep most recently cached blocks.
+ *
+ * @note Caller must hold magazine lock and FSM write lock.
+ * @param length_blk Length of magazine blocks.
+ */
+static iwrc _fsm_mag_drain_lw(FSM *impl, FSMMAG *mag, uint64_t length_blk, uint32_t keep) {
+  iwrc rc = _fsm_mag_verify_lr(impl, mag, length_blk);
+  RCRET(rc);
+  if (mag->num <= keep) {
+    return 0;
+  }
+  uint32_t dnum = mag->num - keep;
+  for (uint32_t i = 0; i < dnum; ++i) {
+    uint64_t offset_blk = mag->blks[i];
+    _fsm_magreg_update(impl, offset_blk, length_blk, false);
+    if (_fsm_is_protected_range_lw(impl, offset_blk, length_blk)) {
+      rc = IWFS_ERROR_FSM_SEGMENTATION;
+      continue;
+    }
+    IWRC(_fsm_blk_deallocate_lw(impl, offset_blk, length_blk), rc);
+  }
+  memmove(mag->blks, mag->blks + dnum, keep * sizeof(mag->blks[0]));
+  mag->num = keep;
+  return rc;
+}
+
+/**
+ * @brief Return all blocks cached in size-class magazines back to the free-space tree.
+ */
+static iwrc _fsm_mag_drain(FSM *impl) {
+  iwrc rc = 0;
+  if (!impl->mags) {
+    return 0;
+  }
+  for (uint64_t i = 1; i <= FSM_MAG_MAX_BLKS; ++i) {
+    FSMMAG *mag = &impl->mags[i];
+    iwrc rc2 = _fsm_mag_lock(mag);
+    if (rc2) {
+      IWRC(rc2, rc);
+      continue;
+    }
+    if (mag->num) {
+      rc2 = _fsm_ctrl_wlock(impl);
+      if (!rc2) {
+        rc2 = _fsm_mag_drain_lw(impl, mag, i, 0);
+        IWRC(_fsm_ctrl_unlock(impl), rc2);
+      }
+      IWRC(rc2, rc);
+    }
+    IWRC(_fsm_mag_unlock(mag), rc);
+  }
+  return rc;
+}
+
+/**
+ * @brief Forget all blocks cached in size-class magazines.
+ */
+static iwrc _fsm_mag_reset(FSM *impl) {
+  iwrc rc = 0;
+  if (!impl->mags) {
+    return 0;
+  }
+  for (int i = 1; i <= FSM_MAG_MAX_BLKS; ++i) {
+    FSMMAG *mag = &impl->mags[i];
+    iwrc rc2 = _fsm_mag_lock(mag);
+    if (!rc2) {
+      mag->num = 0;
+      mag->unum = 0;
+      rc2 = _fsm_mag_unlock(mag);
+    }
+    IWRC(rc2, rc);
+  }
+  for (int i = 0; i < FSM_MAG_STRIPES; ++i) {
+    pthread_mutex_lock(&impl->magreg[i].mtx);
+    kh_clear(FSMCB, impl->magreg[i].map);
+    pthread_mutex_unlock(&impl->magreg[i].mtx);
+  }
+  return rc;
+}
+
+/**
+ * @brief Allocate a segment of @a length_blk blocks from size-class magazine.
+ *
+ * Empty magazine is refilled by `FSM_MAG_BATCH` blocks reserved
+ * within a single continuous area under FSM write lock.
+ * Deallocated segments are reused only after they are checked against bitmap.
+ *
+ * @param [in,out] offset_blk Allocated segment offset in blocks,
+ *                 on input it is used as allocation hint for magazine refill.
+ */
+static iwrc _fsm_mag_allocate(FSM *impl, uint64_t length_blk, uint64_t *offset_blk, iwfs_fsm_aflags opts) {
+  FSMMAG *mag = &impl->mags[length_blk];
+  iwrc rc = _fsm_mag_lock(mag);
+  RCRET(rc);
+  if (mag->num && mag->unum == mag->num) {
+    rc = _fsm_ctrl_rlock(impl);
+    RCGO(rc, finish);
+    rc = _fsm_mag_verify_lr(impl, mag, length_blk);
+    IWRC(_fsm_ctrl_unlock(impl), rc);
+    RCGO(rc, finish);
+  }
+  if (!mag->num) {
+    uint64_t sbnum = *offset_blk;
+    int64_t nlen;
+    rc = _fsm_ctrl_wlock(impl);
+    RCGO(rc, finish);
+    rc = _fsm_blk_allocate_lw(impl, length_blk * FSM_MAG_BATCH, &sbnum, &nlen,
+                              opts | IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_ALLOC_NO_STATS);
+    if (!rc) {
+      assert(nlen == length_blk * FSM_MAG_BATCH);
+      for (int i = FSM_MAG_BATCH - 1; i >= 0; --i) {
+        uint64_t blk = sbnum + i * length_blk;
+        if (!rc) {
+          rc = _fsm_magreg_update(impl, blk, length_blk, true);
+        }
+        if (rc) { // Blocks are not cached
+          IWRC(_fsm_blk_deallocate_lw(impl, blk, length_blk), rc);
+          continue;
+        }
+        mag->blks[mag->num++] = blk;
+      }
+    }
+    IWRC(_fsm_ctrl_unlock(impl), rc);
+    if (!mag->num) {
+      goto finish;
+    }
+    rc = 0;
+  }
+  // Take verified cached block nearest to hint or the most recently cached one
+  int idx = -1;
+  uint64_t dist = UINT64_MAX;
+  for (int i = mag->num - 1; i >= 0; --i) {
+    if (mag->blks[i] & FSM_MAG_UNVERIFIED) {
+      continue;
+    }
+    uint64_t d = *offset_blk ? _fsm_blk_distance(mag->blks[i], *offset_blk) : 0;
+    if (d < dist) {
+      idx = i;
+      dist = d;
+      if (!d) {
+        break;
+      }
+    }
+  }
+  assert(idx >= 0);
+  *offset_blk = mag->blks[idx];
+  memmove(mag->blks + idx, mag->blks + idx + 1, (mag->num - idx - 1) * sizeof(mag->blks[0]));
+  --mag->num;
+  _fsm_magreg_update(impl, *offset_blk, length_blk, false);
+
+finish:
+  IWRC(_fsm_mag_unlock(mag), rc);
+  return rc;
+}
+
+/**
+ * @brief Put segment of @a length_blk blocks into size-class magazine.
+ *
+ * Segment overlapping header or blocks cached by any magazine is rejected with
+ * `IWFS_ERROR_FSM_SEGMENTATION`. Other checks against free-space bitmap need
+ * FSM read lock: in `IWFSM_STRICT` mode they are done immediately, otherwise deallocated
+ * segments are checked in batches of `FSM_MAG_BATCH` and before reuse, invalid segments are dropped.
+ * If magazine is full its oldest half is returned to the free-space tree
+ * under FSM write lock.
+ */
+static iwrc _fsm_mag_deallocate(FSM *impl, uint64_t offset_blk, uint64_t length_blk) {
+  FSMMAG *mag = &impl->mags[length_blk];
+  bool strict = (impl->oflags & IWFSM_STRICT);
+  if (offset_blk < (impl->hdrlen >> impl->bpow)) { // Header area
+    return IWFS_ERROR_FSM_SEGMENTATION;
+  }
+  iwrc rc = _fsm_mag_lock(mag);
+  RCRET(rc);
+  if (strict) {
+    int allocated = 0;
+    rc = _fsm_ctrl_rlock(impl);
+    RCGO(rc, finish);
+    if (!_fsm_is_protected_range_lw(impl, offset_blk, length_blk)) {
+      rc = _fsm_is_fully_allocated_lr(impl, offset_blk, length_blk, &allocated);
+    }
+    IWRC(_fsm_ctrl_unlock(impl), rc);
+    RCGO(rc, finish);
+    if (!allocated) {
+      rc = IWFS_ERROR_FSM_SEGMENTATION;
+      goto finish;
+    }
+  }
+  rc = _fsm_magreg_update(impl, offset_blk, length_blk, true);
+  RCGO(rc, finish);
+  if (mag->num >= FSM_MAG_CAP) {
+    rc = _fsm_ctrl_wlock(impl);
+    if (!rc) {
+      rc = _fsm_mag_drain_lw(impl, mag, length_blk, FSM_MAG_CAP / 2);
+      IWRC(_fsm_ctrl_unlock(impl), rc);
+    }
+    if (mag->num >= FSM_MAG_CAP) {
+      _fsm_magreg_update(impl, offset_blk, length_blk, false);
+      goto finish;
+    }
+  }
+  if (strict) {
+    mag->blks[mag->num++] = offset_blk;
+  } else {
+    mag->blks[mag->num++] = offset_blk | FSM_MAG_UNVERIFIED;
+    if (++mag->unum >= FSM_MAG_BATCH) {
+      rc = _fsm_ctrl_rlock(impl);
+      if (!rc) {
+        rc = _fsm_mag_verify_lr(impl, mag, length_blk);
+        IWRC(_fsm_ctrl_unlock(impl), rc);
+      }
+    }
+  }
+
+finish:
+  IWRC(_fsm_mag_unlock(mag), rc);
+  return rc;
+}
+
 static iwrc _fsm_sync(struct IWFS_FSM *f, iwfs_sync_flags flags) {
   FSM_ENSURE_OPEN2(f);
-  iwrc rc = _fsm_ctrl_rlock(f->impl);
+  iwrc rc = _fsm_mag_drain(f->impl);
+  RCRET(rc);
+  rc = _fsm_ctrl_rlock(f->impl);
   RCRET(rc);
-  IWRC(_fsm_write_meta_lw(f->impl), rc);
+  IWRC(_fsm_write_meta_lw(f->impl, 0), rc);
   IWRC(f->impl->pool.sync(&f->impl->pool, flags), rc);
   IWRC(_fsm_ctrl_unlock(f->impl), rc);
   return rc;
@@ -1388,11 +2274,20 @@ static iwrc _fsm_close(struct IWFS_FSM *f) {
   }
   FSM *impl = f->impl;
   iwrc rc = 0;
+  if (impl->omode & IWFS_OWRITE) {
+    IWRC(_fsm_mag_drain(impl), rc);
+  }
   IWRC(_fsm_ctrl_wlock(impl), rc);
   if (impl->omode & IWFS_OWRITE) {
     IWRC(_fsm_trim_tail_lw(impl), rc);
-    IWRC(_fsm_write_meta_lw(impl), rc);
+    IWRC(_fsm_write_meta_lw(impl, 0), rc);
     IWRC(impl->pool.sync(&impl->pool, IWFS_NO_MMASYNC), rc);
+    if (!rc && impl->fsm) {
+      rc = _fsm_write_snapshot_lw(impl);
+      if (!rc && impl->snapnum) {
+        rc = impl->pool.sync(&impl->pool, IWFS_NO_MMASYNC);
+      }
+    }
   }
   IWRC(impl->pool.close(&impl->pool), rc);
   if (impl->fsm) {
@@ -1424,6 +2319,11 @@ finish:
   return rc;
 }
 
+static iwrc _fsm_refresh(struct IWFS_FSM *f) {
+  FSM_ENSURE_OPEN2(f);
+  return f->impl->pool.refresh(&f->impl->pool);
+}
+
 static iwrc _fsm_add_mmap(struct IWFS_FSM *f, off_t off, size_t maxlen) {
   FSM_ENSURE_OPEN2(f);
   return f->impl->pool.add_mmap(&f->impl->pool, off, maxlen);
@@ -1442,6 +2342,11 @@ static iwrc _fsm_probe_mmap(struct IWFS_FSM *f, off_t off, uint8_t **mm, size_t
   return f->impl->pool.probe_mmap(&f->impl->pool, off, mm, sp);
 }
 
+static iwrc _fsm_stable_mmap(struct IWFS_FSM *f, off_t off, uint8_t **mm, size_t *sp) {
+  FSM_ENSURE_OPEN2(f);
+  return f->impl->pool.stable_mmap(&f->impl->pool, off, mm, sp);
+}
+
 static iwrc _fsm_remove_mmap(struct IWFS_FSM *f, off_t off) {
   FSM_ENSURE_OPEN2(f);
   return f->impl->pool.remove_mmap(&f->impl->pool, off);
@@ -1452,6 +2357,16 @@ static iwrc _fsm_sync_mmap(struct IWFS_FSM *f, off_t off, int flags) {
   return f->impl->pool.sync_mmap(&f->impl->pool, off, flags);
 }
 
+static iwrc _fsm_advise_mmap(struct IWFS_FSM *f, off_t off, off_t len, iwfs_madvise advice) {
+  FSM_ENSURE_OPEN2(f);
+  return f->impl->pool.advise_mmap(&f->impl->pool, off, len, advice);
+}
+
+static iwrc _fsm_dirty_mmap(struct IWFS_FSM *f, off_t off, off_t len) {
+  FSM_ENSURE_OPEN2(f);
+  return f->impl->pool.dirty_mmap(&f->impl->pool, off, len);
+}
+
 static iwrc _fsm_allocate(struct IWFS_FSM *f, off_t len, off_t *oaddr, off_t *olen, iwfs_fsm_aflags opts) {
   FSM_ENSURE_OPEN2(f);
   iwrc rc;
@@ -1470,12 +2385,24 @@ static iwrc _fsm_allocate(struct IWFS_FSM *f, off_t len, off_t *oaddr, off_t *ol
   sbnum = *oaddr >> impl->bpow;
   len = IW_ROUNDUP(len, 1 << impl->bpow);
 
+  if (impl->mags && (len >> impl->bpow) <= FSM_MAG_MAX_BLKS
+      && !(opts & (IWFSM_ALLOC_PAGE_ALIGNED | IWFSM_ALLOC_NO_EXTEND | IWFSM_ALLOC_LOWEST))) {
+    rc = _fsm_mag_allocate(impl, (len >> impl->bpow), &sbnum, opts);
+    if (!rc) {
+      *olen = len;
+      *oaddr = (sbnum << impl->bpow);
+      atomic_fetch_add_explicit(&impl->alloc_num, 1, memory_order_relaxed);
+    }
+    return rc;
+  }
+
   rc = _fsm_ctrl_wlock(impl);
   RCRET(rc);
   rc = _fsm_blk_allocate_lw(f->impl, (len >> impl->bpow), &sbnum, &nlen, opts);
   if (!rc) {
     *olen = (nlen << impl->bpow);
     *oaddr = (sbnum << impl->bpow);
+    atomic_fetch_add_explicit(&impl->alloc_num, 1, memory_order_relaxed);
   }
   IWRC(_fsm_ctrl_unlock(impl), rc);
   return rc;
@@ -1542,16 +2469,78 @@ static iwrc _fsm_deallocate(struct IWFS_FSM *f, off_t addr, off_t len) {
   if (addr & ((1 << impl->bpow) - 1)) {
     return IWFS_ERROR_RANGE_NOT_ALIGNED;
   }
+  if (impl->mags && length_blk > 0 && length_blk <= FSM_MAG_MAX_BLKS
+      && !(len & ((1 << impl->bpow) - 1))) {
+    rc = _fsm_mag_deallocate(impl, offset_blk, length_blk);
+    if (!rc) {
+      atomic_fetch_add_explicit(&impl->dealloc_num, 1, memory_order_relaxed);
+    }
+    return rc;
+  }
   rc = _fsm_ctrl_wlock(impl);
   RCRET(rc);
-  if (IW_RANGES_OVERLAP(offset_blk, offset_blk + length_blk, 0, (impl->hdrlen >> impl->bpow)) ||
-      IW_RANGES_OVERLAP(offset_blk, offset_blk + length_blk, (impl->bmoff >> impl->bpow),
-                        (impl->bmoff >> impl->bpow) + (impl->bmlen >> impl->bpow))) {
+  if (_fsm_is_protected_range_lw(impl, offset_blk, length_blk)) {
     // Deny deallocations in header or free-space bitmap itself
     IWRC(_fsm_ctrl_unlock(impl), rc);
     return IWFS_ERROR_FSM_SEGMENTATION;
   }
   rc = _fsm_blk_deallocate_lw(impl, offset_blk, length_blk);
+  if (!rc) {
+    atomic_fetch_add_explicit(&impl->dealloc_num, 1, memory_order_relaxed);
+  }
+  IWRC(_fsm_ctrl_unlock(impl), rc);
+  return rc;
+}
+
+static int _fsm_range_cmp(const void *v1, const void *v2) {
+  const IWFS_FSM_RANGE *r1 = v1, *r2 = v2;
+  return r1->addr < r2->addr ? -1 : r1->addr > r2->addr;
+}
+
+static iwrc _fsm_deallocate_batch(struct IWFS_FSM *f, IWFS_FSM_RANGE *ranges, size_t num) {
+  FSM_ENSURE_OPEN2(f);
+  iwrc rc = 0;
+  FSM *impl = f->impl;
+  off_t bmask = (1 << impl->bpow) - 1;
+  if (!(impl->omode & IWFS_OWRITE)) {
+    return IW_ERROR_READONLY;
+  }
+  if (!num) {
+    return 0;
+  }
+  for (size_t i = 0; i < num; ++i) {
+    if ((ranges[i].addr & bmask) || (ranges[i].len & bmask)) {
+      return IWFS_ERROR_RANGE_NOT_ALIGNED;
+    }
+  }
+  qsort(ranges, num, sizeof(*ranges), _fsm_range_cmp);
+  rc = _fsm_ctrl_wlock(impl);
+  RCRET(rc);
+  for (size_t i = 0, j; i < num; i = j) {
+    off_t offset_blk = ranges[i].addr >> impl->bpow;
+    off_t length_blk = ranges[i].len >> impl->bpow;
+    for (j = i + 1; j < num && (ranges[j].addr >> impl->bpow) == offset_blk + length_blk; ++j) {
+      length_blk += ranges[j].len >> impl->bpow;
+    }
+    if (length_blk < 1) {
+      continue;
+    }
+    if (_fsm_is_protected_range_lw(impl, offset_blk, length_blk)) {
+      // Deny deallocations in header or free-space bitmap itself
+      if (!rc) {
+        rc = IWFS_ERROR_FSM_SEGMENTATION;
+      }
+      continue;
+    }
+    iwrc rc2 = _fsm_blk_deallocate_lw(impl, offset_blk, length_blk);
+    if (rc2) {
+      if (!rc) {
+        rc = rc2;
+      }
+    } else {
+      atomic_fetch_add_explicit(&impl->dealloc_num, j - i, memory_order_relaxed);
+    }
+  }
   IWRC(_fsm_ctrl_unlock(impl), rc);
   return rc;
 }
@@ -1565,9 +2554,7 @@ static iwrc _fsm_check_allocation_status(struct IWFS_FSM *f, off_t addr, off_t l
   RCRET(rc);
   off_t offset_blk = addr >> impl->bpow;
   off_t length_blk = len >> impl->bpow;
-  if (IW_RANGES_OVERLAP(offset_blk, offset_blk + length_blk, 0, (impl->hdrlen >> impl->bpow)) ||
-      IW_RANGES_OVERLAP(offset_blk, offset_blk + length_blk, (impl->bmoff >> impl->bpow),
-                        (impl->bmoff >> impl->bpow) + (impl->bmlen >> impl->bpow))) {
+  if (_fsm_is_protected_range_lw(impl, offset_blk, length_blk)) {
     IWRC(_fsm_ctrl_unlock(impl), rc);
     return IWFS_ERROR_FSM_SEGMENTATION;
   }
@@ -1578,8 +2565,6 @@ static iwrc _fsm_check_allocation_status(struct IWFS_FSM *f, off_t addr, off_t l
 
 static iwrc _fsm_writehdr(struct IWFS_FSM *f, off_t off, const void *buf, off_t siz) {
   FSM_ENSURE_OPEN2(f);
-  iwrc rc;
-  uint8_t *mm;
   FSM *impl = f->impl;
   uint64_t end = FSM_CUSTOM_HDR_DATA_OFFSET + off + siz;
   if (siz < 1) {
@@ -1588,12 +2573,12 @@ static iwrc _fsm_writehdr(struct IWFS_FSM *f, off_t off, const void *buf, off_t
   if (end > impl->hdrlen) {
     return IW_ERROR_OUT_OF_BOUNDS;
   }
-  rc = impl->pool.acquire_mmap(&impl->pool, 0, &mm, 0);
-  if (!rc) {
-    memmove(mm + FSM_CUSTOM_HDR_DATA_OFFSET + off, buf, siz);
-    rc = impl->pool.release_mmap(&impl->pool);
-  }
-  return rc;
+  IWP_IOREQ req = {
+    .off = FSM_CUSTOM_HDR_DATA_OFFSET + off,
+    .buf = (void *) buf,
+    .len = siz
+  };
+  return impl->pool.writev(&impl->pool, &req, 1);
 }
 
 static iwrc _fsm_readhdr(struct IWFS_FSM *f, off_t off, void *buf, off_t siz) {
@@ -1620,7 +2605,8 @@ static iwrc _fsm_clear(struct IWFS_FSM *f, iwfs_fsm_clrfalgs clrflags) {
   FSM_ENSURE_OPEN2(f);
   FSM *impl = f->impl;
   uint64_t bmoff, bmlen;
-  iwrc rc = _fsm_ctrl_wlock(impl);
+  iwrc rc = _fsm_mag_reset(impl);
+  IWRC(_fsm_ctrl_wlock(impl), rc);
   bmlen = impl->bmlen;
   if (!bmlen) {
     goto finish;
@@ -1644,6 +2630,95 @@ finish:
   return rc;
 }
 
+static iwrc _fsm_trim(struct IWFS_FSM *f) {
+  FSM_ENSURE_OPEN2(f);
+  FSM *impl = f->impl;
+  iwrc rc = _fsm_mag_drain(impl);
+  RCRET(rc);
+  rc = _fsm_ctrl_wlock(impl);
+  RCRET(rc);
+  rc = _fsm_trim_tail_lw(impl);
+  IWRC(_fsm_ctrl_unlock(impl), rc);
+  return rc;
+}
+
+static iwrc _fsm_backup(struct IWFS_FSM *f, const char *path) {
+  FSM_ENSURE_OPEN2(f);
+  if (!path) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  iwrc rc;
+  int found;
+  uint64_t *bmptr;
+  IWFS_FILE tf = {0};
+  IWFS_FILE_STATE tstate;
+  IWFS_EXT_STATE pstate;
+  IWP_FILE_STAT fstat;
+  FSM *impl = f->impl;
+  if (!iwp_fstat(path, &fstat)) {
+    // Target is never truncated in order to not damage this file opened by other path
+    return iwrc_set_errno(IW_ERROR_IO_ERRNO, EEXIST);
+  }
+  if (impl->omode & IWFS_OWRITE) {
+    // Blocks cached by magazines are returned to free-space bitmap so they are not copied
+    rc = _fsm_mag_drain(impl);
+    RCRET(rc);
+  }
+  rc = _fsm_ctrl_rlock(impl);
+  RCRET(rc);
+  if (impl->omode & IWFS_OWRITE) {
+    rc = _fsm_write_meta_lw(impl, 0);
+    RCGO(rc, finish);
+    if (impl->mmap_private) {
+      // Data is copied from file, so private changes must be written back first
+      rc = impl->pool.sync(&impl->pool, IWFS_FDATASYNC | IWFS_WRITEBACK);
+      RCGO(rc, finish);
+    }
+  }
+  rc = impl->pool.state(&impl->pool, &pstate);
+  RCGO(rc, finish);
+  rc = _fsm_bmptr(impl, &bmptr);
+  RCGO(rc, finish);
+  IWFS_FILE_OPTS topts = {
+    .path = path,
+    .omode = IWFS_OWRITE | IWFS_OCREATE,
+    .lock_mode = IWP_WLOCK
+  };
+  rc = iwfs_file_open(&tf, &topts);
+  RCGO(rc, finish);
+  rc = tf.state(&tf, &tstate);
+  RCGO(rc, finish);
+  rc = iwp_ftruncate(tstate.fh, pstate.fsize);
+  RCGO(rc, finish);
+  rc = iwp_copy_file_range(pstate.file.fh, 0,
+                           MIN(FSM_CUSTOM_HDR_DATA_OFFSET + impl->hdrlen, pstate.fsize),
+                           tstate.fh, 0);
+  RCGO(rc, finish);
+  // Runs of allocated blocks, bitmap itself is an allocated area
+  uint64_t nblk = MIN(impl->bmlen << 3, (uint64_t) pstate.fsize >> impl->bpow);
+  for (uint64_t sblk = 0, eblk; sblk < nblk; sblk = eblk) {
+    sblk = _fsm_find_next_set_bit(bmptr, sblk, nblk, &found);
+    if (!found) {
+      break;
+    }
+    eblk = _fsm_find_next_bit(bmptr, sblk, nblk, ~((uint64_t) 0), &found);
+    if (!found) {
+      eblk = nblk;
+    }
+    rc = iwp_copy_file_range(pstate.file.fh, sblk << impl->bpow, (eblk - sblk) << impl->bpow,
+                             tstate.fh, sblk << impl->bpow);
+    RCGO(rc, finish);
+  }
+  rc = tf.sync(&tf, IWFS_FDATASYNC);
+
+finish:
+  IWRC(_fsm_ctrl_unlock(impl), rc);
+  if (tf.impl) {
+    IWRC(tf.close(&tf), rc);
+  }
+  return rc;
+}
+
 static iwrc _fsm_state(struct IWFS_FSM *f, IWFS_FSM_STATE *state) {
   FSM_ENSURE_OPEN2(f);
   FSM *impl = f->impl;
@@ -1657,6 +2732,8 @@ static iwrc _fsm_state(struct IWFS_FSM *f, IWFS_FSM_STATE *state) {
   state->free_segments_num = kb_size(impl->fsm);
   state->avg_alloc_size = (double_t) impl->crzsum / (double_t) impl->crznum;
   state->alloc_dispersion = (double_t) impl->crzvar / (double_t) impl->crznum;
+  state->alloc_num = atomic_load_explicit(&impl->alloc_num, memory_order_relaxed);
+  state->dealloc_num = atomic_load_explicit(&impl->dealloc_num, memory_order_relaxed);
   IWRC(_fsm_ctrl_unlock(impl), rc);
   return rc;
 }
@@ -1678,20 +2755,27 @@ iwrc iwfs_fsmfile_open(IWFS_FSM *f, const IWFS_FSM_OPTS *opts) {
   f->state = _fsm_state;
 
   f->ensure_size = _fsm_ensure_size;
+  f->refresh = _fsm_refresh;
   f->add_mmap = _fsm_add_mmap;
   f->acquire_mmap = _fsm_acquire_mmap;
   f->probe_mmap = _fsm_probe_mmap;
+  f->stable_mmap = _fsm_stable_mmap;
   f->release_mmap = _fsm_release_mmap;
   f->remove_mmap = _fsm_remove_mmap;
   f->sync_mmap = _fsm_sync_mmap;
+  f->advise_mmap = _fsm_advise_mmap;
+  f->dirty_mmap = _fsm_dirty_mmap;
 
   f->allocate = _fsm_allocate;
   f->reallocate = _fsm_reallocate;
   f->deallocate = _fsm_deallocate;
+  f->deallocate_batch = _fsm_deallocate_batch;
   f->check_allocation_status = _fsm_check_allocation_status;
   f->writehdr = _fsm_writehdr;
   f->readhdr = _fsm_readhdr;
   f->clear = _fsm_clear;
+  f->trim = _fsm_trim;
+  f->backup = _fsm_backup;
 
   if (!path) {
     return IW_ERROR_INVALID_ARGS;
@@ -1768,6 +2852,7 @@ iwrc iwfs_fsmfile_init(void) {
   if (!__sync_bool_compare_and_swap(&_fsmfile_initialized, 0, 1)) {
     return 0;  // initialized already
   }
+  _fsm_bmscan_select(false);
   return iwlog_register_ecodefn(_fsmfile_ecodefn);
 }
 
@@ -1795,6 +2880,10 @@ uint64_t iwfs_fsmdbg_find_prev_set_bit(const uint64_t *addr, uint64_t offset_bit
   return _fsm_find_prev_set_bit(addr, offset_bit, min_offset_bit, found);
 }
 
+const char *iwfs_fsmdbg_bmscan_select(int generic) {
+  return _fsm_bmscan_select(generic);
+}
+
 void iwfs_fsmdbg_dump_fsm_tree(IWFS_FSM *f, const char *hdr) {
   assert(f);
   FSM *impl = f->impl;
@@ -1878,6 +2967,7 @@ iwrc iwfs_fsmdbg_state(IWFS_FSM *f, IWFS_FSMDBG_STATE *d) {
   d->bmlen = impl->bmlen;
   d->lfbkoff = impl->lfbkoff;
   d->lfbklen = impl->lfbklen;
+  d->snaploaded = impl->snaploaded;
   IWRC(_fsm_ctrl_unlock(impl), rc);
   return rc;
 }
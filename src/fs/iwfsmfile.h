@@ -107,7 +107,12 @@ typedef enum {
 
   /** Force all allocated address space backed by real file address space,
       useful when operating on mmaped allocated regions. */
-  IWFSM_SOLID_ALLOCATED_SPACE = 0x10U
+  IWFSM_SOLID_ALLOCATED_SPACE = 0x10U,
+
+  /** Allocate free space with the lowest offset. If a desired offset is passed
+      in `oaddr` allocated space must start below it, otherwise
+      `IWFS_ERROR_NO_FREE_SPACE` is returned. */
+  IWFSM_ALLOC_LOWEST = 0x20U
 
 } iwfs_fsm_aflags;
 
@@ -143,8 +148,24 @@ typedef enum {
 typedef enum {
   IWFSM_NOLOCKS = 0x01U, /**< Do not use threading locks */
   IWFSM_STRICT =
-    0x02U /**< Strict block checking for alloc/dealloc operations. 10-15%
+    0x02U, /**< Strict block checking for alloc/dealloc operations. 10-15%
                performance overhead. */
+  IWFSM_MAGAZINES =
+    0x04U, /**< Keep per size-class caches (magazines) of reserved blocks.
+               Small allocations and deallocations of the same size are served
+               from magazines without taking the global FSM write lock, which is
+               acquired only to refill or drain a magazine in batches.
+               Deallocations overlapping header or blocks cached by any
+               magazine are rejected immediately, other checks against
+               bitmap are done in batches under shared lock and invalid
+               segments are dropped (immediately with `IWFSM_STRICT`).
+               Cached blocks are marked as allocated in the free-space bitmap
+               until drained by `sync` or `close`, so they may be lost after
+               a crash. Ignored if `IWFSM_NOLOCKS` is set. */
+  IWFSM_NO_TRIM =
+    0x08U  /**< Never shrink file by trimming free blocks at its end.
+               Used when file is mmaped by other processes
+               which must not access pages beyond end of file. */
 } iwfs_fsm_openflags;
 
 /**
@@ -174,14 +195,26 @@ typedef struct IWFS_FSM_STATE {
                                  segments. */
   double_t avg_alloc_size;    /**< Average allocation number of blocks */
   double_t alloc_dispersion;  /**< Average allocation blocks dispersion */
+  uint64_t alloc_num;         /**< Number of allocations since file was opened */
+  uint64_t dealloc_num;       /**< Number of deallocations since file was opened */
 } IWFS_FSM_STATE;
 
+/**
+ * @brief Area of `IWFS_FSM` file.
+ * @see IWFS_FSM::deallocate_batch
+ */
+typedef struct IWFS_FSM_RANGE {
+  off_t addr;   /**< Area address, block size aligned */
+  off_t len;    /**< Area length, block size aligned */
+} IWFS_FSM_RANGE;
+
 typedef struct IWFS_FSMDBG_STATE {
   IWFS_FSM_STATE state;
   uint64_t bmoff;
   uint64_t bmlen;
   uint64_t lfbklen;
   uint64_t lfbkoff;
+  bool snaploaded;
 } IWFS_FSMDBG_STATE;
 
 /**
@@ -240,6 +273,19 @@ typedef struct IWFS_FSM {
    */
   iwrc(*deallocate)(struct IWFS_FSM *f, off_t addr, off_t len);
 
+  /**
+   * @brief Free a batch of previously allocated areas.
+   *
+   * Areas are sorted by address and adjacent areas are coalesced,
+   * so every run of adjacent areas is released by a single free-space
+   * bitmap update. All runs are released under a single lock acquisition.
+   *
+   * @param ranges Areas to release, array is reordered by this call.
+   * @param num Number of areas
+   * @return `0` on success or error code of the first failed run.
+   */
+  iwrc(*deallocate_batch)(struct IWFS_FSM *f, IWFS_FSM_RANGE *ranges, size_t num);
+
 
   /**
    * @brief Check allocation status of region specified by @a addr and @a len
@@ -281,11 +327,37 @@ typedef struct IWFS_FSM {
    */
   iwrc(*clear)(struct IWFS_FSM *f, iwfs_fsm_clrfalgs clrflags);
 
+  /**
+   * @brief Truncate free space at the end of file.
+   * @details Blocks cached by size-class magazines are returned to the
+   *          free-space map first, so the file is shrunk to the end of the last
+   *          allocated block. Free-space bitmap is moved closer to the file start
+   *          if possible.
+   *
+   * @return `0` on success or error code.
+   */
+  iwrc(*trim)(struct IWFS_FSM *f);
+
+  /**
+   * @brief Copy file into a new file at @a path skipping free space.
+   * @details File header, free-space bitmap and allocated areas are copied,
+   *          free areas are left as holes of a sparse file of the same size,
+   *          so copy takes time and disk space proportional to allocated data.
+   *          Caller must ensure file data is not modified during the copy.
+   *
+   * @param path Path of target file, file must not exist
+   * @return `0` on success or error code.
+   */
+  iwrc(*backup)(struct IWFS_FSM *f, const char *path);
+
   /* See iwexfile.h */
 
   /** @see IWFS_EXT::ensure_size */
   iwrc(*ensure_size)(struct IWFS_FSM *f, off_t size);
 
+  /** @see IWFS_EXT::refresh */
+  iwrc(*refresh)(struct IWFS_FSM *f);
+
   /** @see IWFS_EXT::add_mmap */
   iwrc(*add_mmap)(struct IWFS_FSM *f, off_t off, size_t maxlen);
 
@@ -306,6 +378,12 @@ typedef struct IWFS_FSM {
    */
   iwrc(*probe_mmap)(struct IWFS_FSM *f, off_t off, uint8_t **mm, size_t *sp);
 
+  /**
+   * @brief Retrieve mmaped region by its offset @a off which can be read without lock.
+   * @see IWFS_EXT::stable_mmap
+   */
+  iwrc(*stable_mmap)(struct IWFS_FSM *f, off_t off, uint8_t **mm, size_t *sp);
+
   /**
    * @brief Release the lock acquired by successfull call of `acquire_mmap()`
    */
@@ -317,6 +395,12 @@ typedef struct IWFS_FSM {
   /** @see IWFS_EXT::sync_mmap */
   iwrc(*sync_mmap)(struct IWFS_FSM *f, off_t off, int flags);
 
+  /** @see IWFS_EXT::advise_mmap */
+  iwrc(*advise_mmap)(struct IWFS_FSM *f, off_t off, off_t len, iwfs_madvise advice);
+
+  /** @see IWFS_EXT::dirty_mmap */
+  iwrc(*dirty_mmap)(struct IWFS_FSM *f, off_t off, off_t len);
+
   /* See iwfile.h */
 
   /** @see IWFS_FILE::write */
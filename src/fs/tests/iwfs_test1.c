@@ -34,11 +34,16 @@
 #include "iwcfg.h"
 #include <CUnit/Basic.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #define UNLINK() \
   unlink("iwfs_exfile_test1.dat"); \
   unlink("test_mmap1.dat"); \
-  unlink("test_fibo_inc.dat")
+  unlink("test_mmap_opts.dat"); \
+  unlink("test_mmap_reserve.dat"); \
+  unlink("test_fibo_inc.dat"); \
+  unlink("test_extent_prealloc.dat")
 
 
 int init_suite(void) {
@@ -175,6 +180,77 @@ void test_fibo_inc(void) {
   CU_ASSERT_EQUAL(rc, 0);
 }
 
+void test_extent_prealloc(void) {
+  const char *path = "test_extent_prealloc.dat";
+  off_t extent = 64 * 1024;
+  IWFS_EXT ef;
+  IWFS_EXT_OPTS opts = {
+    .file = {
+      .path = path,
+      .lock_mode = IWP_WLOCK,
+      .omode = IWFS_DEFAULT_OMODE | IWFS_OTRUNC
+    },
+    .use_locks = 0,
+    .rspolicy = iw_exfile_szpolicy_extent,
+    .rspolicy_ctx = &extent,
+    .preallocate = 1
+  };
+  iwrc rc = 0;
+  size_t sp;
+  uint64_t wd = (uint64_t)(-1);
+  IWP_FILE_STAT fstat;
+  struct stat st;
+
+  IWRC(iwfs_exfile_open(&ef, &opts), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  IWRC(ef.write(&ef, 0, &wd, 1, &sp), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWRC(iwp_fstat(path, &fstat), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL_FATAL(fstat.size, extent);
+
+  // Grown twice while step is lesser than 64 extents
+  IWRC(ef.write(&ef, fstat.size, &wd, 1, &sp), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWRC(iwp_fstat(path, &fstat), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL_FATAL(fstat.size, 2 * extent);
+
+  IWRC(ef.write(&ef, 3 * extent + 1, &wd, 1, &sp), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWRC(iwp_fstat(path, &fstat), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL_FATAL(fstat.size, 4 * extent);
+
+  IWRC(ef.write(&ef, 100 * extent, &wd, 1, &sp), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWRC(iwp_fstat(path, &fstat), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL_FATAL(fstat.size, 101 * extent);
+
+  IWRC(ef.write(&ef, fstat.size, &wd, 1, &sp), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWRC(iwp_fstat(path, &fstat), rc);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL_FATAL(fstat.size, 165 * extent);
+
+  // Whole file is backed by disk blocks if file system supports preallocation
+  int fd = open(path, O_RDWR);
+  CU_ASSERT_TRUE_FATAL(fd >= 0);
+  rc = iwp_fallocate(fd, 0, extent);
+  close(fd);
+  if (rc != IW_ERROR_NOT_IMPLEMENTED) {
+    CU_ASSERT_EQUAL(rc, 0);
+    CU_ASSERT_EQUAL(stat(path, &st), 0);
+    CU_ASSERT_TRUE((off_t) st.st_blocks * 512 >= 165 * extent);
+  }
+  rc = 0;
+
+  IWRC(ef.close(&ef), rc);
+  CU_ASSERT_EQUAL(rc, 0);
+}
+
 void test_mmap1(void) {
   iwrc rc = 0;
   size_t psize = iwp_page_size();
@@ -303,6 +379,326 @@ void test_mmap1(void) {
   free(cdata);
 }
 
+void test_mmap_opts(void) {
+  iwrc rc = 0;
+  size_t sp;
+  uint8_t *mm;
+  size_t psize = iwp_page_size();
+  const int dsize = psize * 4;
+  uint8_t *data = malloc(dsize);
+  uint8_t *cdata = malloc(dsize);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cdata);
+
+  const char *path = "test_mmap_opts.dat";
+  IWFS_EXT ef;
+  IWFS_EXT_OPTS opts = {
+    .file = {.path = path, .omode = IWFS_OTRUNC},
+    .use_locks = 1,
+    .mmap_opts = IWFS_MMAP_RANDOM | IWFS_MMAP_HUGEPAGE | IWFS_MMAP_POPULATE
+  };
+  for (int i = 0; i < dsize; ++i) {
+    data[i] = iwu_rand_range(256);
+  }
+  rc = iwfs_exfile_open(&ef, &opts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.add_mmap(&ef, psize, UINT64_MAX);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.advise_mmap(&ef, psize, psize, IWFS_MADV_WILLNEED);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_NOT_MMAPED);
+
+  // Region is remapped with the same options as file grows
+  for (int i = 0; i < 8; ++i) {
+    rc = ef.write(&ef, psize + i * dsize, data, dsize, &sp);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(sp, dsize);
+  }
+  rc = ef.advise_mmap(&ef, psize + 1, 1, IWFS_MADV_WILLNEED);
+  CU_ASSERT_EQUAL(rc, 0);
+  rc = ef.advise_mmap(&ef, 2 * psize, 64 * dsize, IWFS_MADV_SEQUENTIAL);
+  CU_ASSERT_EQUAL(rc, 0);
+  rc = ef.advise_mmap(&ef, 0, psize, IWFS_MADV_WILLNEED);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_NOT_MMAPED);
+  rc = ef.advise_mmap(&ef, psize, 8 * dsize, IWFS_MADV_NORMAL);
+  CU_ASSERT_EQUAL(rc, 0);
+
+  rc = ef.acquire_mmap(&ef, psize, &mm, &sp);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_TRUE(sp >= 8 * dsize);
+  for (int i = 0; i < 8; ++i) {
+    CU_ASSERT_EQUAL(memcmp(mm + i * dsize, data, dsize), 0);
+  }
+  ef.release_mmap(&ef);
+
+  rc = ef.read(&ef, psize + 7 * dsize, cdata, dsize, &sp);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(memcmp(data, cdata, dsize), 0);
+
+  IWRC(ef.close(&ef), rc);
+  CU_ASSERT_EQUAL(rc, 0);
+  free(data);
+  free(cdata);
+}
+
+void test_mmap_reserve(void) {
+  iwrc rc = 0;
+  size_t sp, sp2;
+  uint8_t *mm, *mm2;
+  size_t psize = iwp_page_size();
+  uint8_t *data = malloc(psize);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+  const char *path = "test_mmap_reserve.dat";
+  IWFS_EXT ef;
+  IWFS_EXT_OPTS opts = {
+    .file = {.path = path, .omode = IWFS_OTRUNC},
+    .use_locks = 1,
+    .maxoff = 64 * psize
+  };
+  for (int i = 0; i < psize; ++i) {
+    data[i] = iwu_rand_range(256);
+  }
+  rc = iwfs_exfile_open(&ef, &opts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.add_mmap(&ef, 0, UINT64_MAX);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.write(&ef, 0, data, psize, &sp);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.acquire_mmap(&ef, 0, &mm, &sp);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(sp, psize);
+  ef.release_mmap(&ef);
+
+  // Mapping is extended in place within reserved address space
+  for (int i = 1; i < 32; ++i) {
+    rc = ef.write(&ef, i * psize, data, psize, &sp);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = ef.acquire_mmap(&ef, 0, &mm2, &sp2);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_TRUE(mm2 == mm);
+    CU_ASSERT_EQUAL(sp2, (i + 1) * psize);
+    CU_ASSERT_EQUAL(memcmp(mm2 + i * psize, data, psize), 0);
+    CU_ASSERT_EQUAL(memcmp(mm2, data, psize), 0);
+    ef.release_mmap(&ef);
+  }
+  rc = ef.truncate(&ef, 2 * psize);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.acquire_mmap(&ef, 0, &mm2, &sp2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_TRUE(mm2 == mm);
+  CU_ASSERT_EQUAL(sp2, 2 * psize);
+  CU_ASSERT_EQUAL(memcmp(mm2 + psize, data, psize), 0);
+  ef.release_mmap(&ef);
+
+  rc = ef.truncate(&ef, 64 * psize);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.acquire_mmap(&ef, 0, &mm2, &sp2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_TRUE(mm2 == mm);
+  CU_ASSERT_EQUAL(sp2, 64 * psize);
+  CU_ASSERT_EQUAL(mm2[63 * psize], 0);
+  ef.release_mmap(&ef);
+  rc = ef.truncate(&ef, 65 * psize);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_MAXOFF);
+
+  rc = ef.close(&ef);
+  CU_ASSERT_EQUAL(rc, 0);
+  free(data);
+}
+
+void test_dirty_ranges(void) {
+  iwrc rc = 0;
+  size_t sp;
+  uint8_t *mm;
+  IWFS_EXT_STATE state;
+  size_t psize = iwp_page_size();
+  size_t unit = MAX(psize, 16 * 1024);
+  const char *path = "test_dirty_ranges.dat";
+  IWFS_EXT ef;
+  IWFS_EXT_OPTS opts = {
+    .file = {.path = path, .omode = IWFS_OTRUNC},
+    .use_locks = 1,
+    .initial_size = 64 * unit,
+    .dirty_bpow = 14,
+    .dirty_threshold = 8 * unit
+  };
+  rc = iwfs_exfile_open(&ef, &opts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.add_mmap(&ef, 0, UINT64_MAX);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Adjacent units are counted once
+  rc = ef.acquire_mmap(&ef, 0, &mm, &sp);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(mm + unit - 1, 0xff, 2);
+  rc = ef.dirty_mmap(&ef, unit - 1, 2);
+  CU_ASSERT_EQUAL(rc, 0);
+  rc = ef.dirty_mmap(&ef, unit, 1);
+  CU_ASSERT_EQUAL(rc, 0);
+  ef.release_mmap(&ef);
+  rc = ef.write(&ef, 10 * unit, "a", 1, &sp);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.state(&ef, &state);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(state.dirty_size, 3 * unit);
+
+  rc = ef.sync(&ef, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.state(&ef, &state);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(state.dirty_size, 0);
+
+  // Crossing of threshold wakes up flusher
+  rc = ef.acquire_mmap(&ef, 0, &mm, &sp);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(mm + 16 * unit, 0xaa, 16 * unit);
+  rc = ef.dirty_mmap(&ef, 16 * unit, 16 * unit);
+  CU_ASSERT_EQUAL(rc, 0);
+  ef.release_mmap(&ef);
+  for (int i = 0; i < 100; ++i) {
+    rc = ef.state(&ef, &state);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    if (!state.dirty_size) {
+      break;
+    }
+    iwp_sleep(50);
+  }
+  CU_ASSERT_EQUAL(state.dirty_size, 0);
+
+  // Destination of mmaped copy is dirty
+  rc = ef.copy(&ef, 0, unit, 40 * unit);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.state(&ef, &state);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(state.dirty_size, unit);
+
+  rc = ef.close(&ef);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  uint8_t buf[4];
+  opts.file.omode = IWFS_OREAD;
+  opts.dirty_threshold = 0;
+  rc = iwfs_exfile_open(&ef, &opts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = ef.read(&ef, unit - 1, buf, 2, &sp);
+  CU_ASSERT_EQUAL(rc, 0);
+  CU_ASSERT_TRUE(buf[0] == 0xff && buf[1] == 0xff);
+  rc = ef.read(&ef, 32 * unit - 1, buf, 1, &sp);
+  CU_ASSERT_EQUAL(rc, 0);
+  CU_ASSERT_EQUAL(buf[0], 0xaa);
+  rc = ef.read(&ef, 41 * unit - 1, buf, 1, &sp);
+  CU_ASSERT_EQUAL(rc, 0);
+  CU_ASSERT_EQUAL(buf[0], 0xff);
+  rc = ef.close(&ef);
+  CU_ASSERT_EQUAL(rc, 0);
+  unlink(path);
+}
+
+void test_iov(void) {
+  iwrc rc;
+  IWFS_FILE f;
+  uint8_t data[3][100], rdata[3][100];
+  IWFS_FILE_OPTS opts = {
+    .path = "test_iov.dat",
+    .omode = IWFS_OTRUNC
+  };
+  for (int i = 0; i < 3; ++i) {
+    memset(data[i], 'a' + i, sizeof(data[i]));
+  }
+  rc = iwfs_file_open(&f, &opts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  // Two adjacent ranges and a separate one
+  IWP_IOREQ wreqs[] = {
+    { .off = 0, .buf = data[0], .len = 100 },
+    { .off = 100, .buf = data[1], .len = 50 },
+    { .off = 1000, .buf = data[2], .len = 100 }
+  };
+  rc = f.writev(&f, wreqs, 3);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < 3; ++i) {
+    CU_ASSERT_EQUAL(wreqs[i].sp, wreqs[i].len);
+  }
+  IWP_IOREQ rreqs[] = {
+    { .off = 0, .buf = rdata[0], .len = 100 },
+    { .off = 100, .buf = rdata[1], .len = 100 },
+    { .off = 1000, .buf = rdata[2], .len = 100 }
+  };
+  rc = f.readv(&f, rreqs, 3);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(rreqs[0].sp, 100);
+  CU_ASSERT_EQUAL(rreqs[1].sp, 100);
+  CU_ASSERT_EQUAL(rreqs[2].sp, 100);
+  CU_ASSERT_FALSE(memcmp(rdata[0], data[0], 100));
+  CU_ASSERT_FALSE(memcmp(rdata[1], data[1], 50));
+  CU_ASSERT_FALSE(memcmp(rdata[2], data[2], 100));
+  // Read beyond end of file
+  rreqs[0].off = 1050;
+  rc = f.readv(&f, rreqs, 1);
+  CU_ASSERT_EQUAL(rc, 0);
+  CU_ASSERT_EQUAL(rreqs[0].sp, 50);
+  rc = f.close(&f);
+  CU_ASSERT_EQUAL(rc, 0);
+  unlink(opts.path);
+}
+
+void test_exfile_iov(void) {
+  iwrc rc;
+  IWFS_EXT ef;
+  size_t sp, psize = iwp_page_size();
+  uint8_t *data = malloc(4 * psize), *rdata = malloc(4 * psize);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(rdata);
+  IWFS_EXT_OPTS opts = {
+    .file = {
+      .path  = "test_exfile_iov.dat",
+      .omode = IWFS_OTRUNC
+    }
+  };
+  for (size_t i = 0; i < 4 * psize; ++i) {
+    data[i] = iwu_rand_range(256);
+  }
+  rc = iwfs_exfile_open(&ef, &opts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  // Only the second page is mmaped
+  rc = ef.add_mmap(&ef, psize, psize);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWP_IOREQ wreqs[] = {
+    { .off = psize / 2, .buf = data, .len = 2 * psize },          // Spans unmapped, mmaped, unmapped parts
+    { .off = 3 * psize, .buf = data + 2 * psize, .len = psize }, // Extends file
+  };
+  rc = ef.writev(&ef, wreqs, 2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(wreqs[0].sp, 2 * psize);
+  CU_ASSERT_EQUAL(wreqs[1].sp, psize);
+
+  IWP_IOREQ rreqs[] = {
+    { .off = psize / 2, .buf = rdata, .len = 2 * psize },
+    { .off = 3 * psize, .buf = rdata + 2 * psize, .len = 2 * psize } // Bounded by file size
+  };
+  rc = ef.readv(&ef, rreqs, 2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(rreqs[0].sp, 2 * psize);
+  CU_ASSERT_EQUAL(rreqs[1].sp, psize);
+  CU_ASSERT_FALSE(memcmp(data, rdata, 3 * psize));
+
+  // Mmaped part is visible through mmap, unmapped parts through the file
+  rc = ef.close(&ef);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  opts.file.omode = 0;
+  rc = iwfs_exfile_open(&ef, &opts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(rdata, 0, 4 * psize);
+  rc = ef.read(&ef, psize / 2, rdata, 2 * psize, &sp);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(sp, 2 * psize);
+  CU_ASSERT_FALSE(memcmp(data, rdata, 2 * psize));
+  rc = ef.close(&ef);
+  CU_ASSERT_EQUAL(rc, 0);
+  unlink(opts.file.path);
+  free(data);
+  free(rdata);
+}
+
 int main() {
   CU_pSuite pSuite = NULL;
 
@@ -320,7 +716,13 @@ int main() {
   /* Add the tests to the suite */
   if ((NULL == CU_add_test(pSuite, "iwfs_exfile_test1", iwfs_exfile_test1)) ||
       (NULL == CU_add_test(pSuite, "test_fibo_inc", test_fibo_inc)) ||
-      (NULL == CU_add_test(pSuite, "test_mmap1", test_mmap1))) {
+      (NULL == CU_add_test(pSuite, "test_extent_prealloc", test_extent_prealloc)) ||
+      (NULL == CU_add_test(pSuite, "test_mmap1", test_mmap1)) ||
+      (NULL == CU_add_test(pSuite, "test_mmap_opts", test_mmap_opts)) ||
+      (NULL == CU_add_test(pSuite, "test_mmap_reserve", test_mmap_reserve)) ||
+      (NULL == CU_add_test(pSuite, "test_dirty_ranges", test_dirty_ranges)) ||
+      (NULL == CU_add_test(pSuite, "test_iov", test_iov)) ||
+      (NULL == CU_add_test(pSuite, "test_exfile_iov", test_exfile_iov))) {
     CU_cleanup_registry();
     return CU_get_error();
   }
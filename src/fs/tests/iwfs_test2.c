@@ -37,6 +37,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <fcntl.h>
 
 static pthread_mutex_t records_mtx;
 
@@ -44,7 +45,9 @@ static pthread_mutex_t records_mtx;
   unlink("test_fsm_open_close.fsm");  \
   unlink("test_fsm_uniform_alloc.fsm"); \
   unlink("test_block_allocation1.fsm"); \
-  unlink("test_block_allocation2.fsm")
+  unlink("test_block_allocation2.fsm"); \
+  unlink("test_fsm_magazines.fsm"); \
+  unlink("test_fsm_snapshot.fsm")
 
 int init_suite(void) {
   pthread_mutex_init(&records_mtx, 0);
@@ -71,6 +74,7 @@ uint64_t iwfs_fsmdbg_find_prev_set_bit(const uint64_t *addr,
 void iwfs_fsmdbg_dump_fsm_tree(IWFS_FSM *f, const char *hdr);
 iwrc iwfs_fsmdbg_state(IWFS_FSM *f, IWFS_FSMDBG_STATE *d);
 iwrc iwfs_fsmdb_dump_fsm_bitmap(IWFS_FSM *f, int blimit);
+const char *iwfs_fsmdbg_bmscan_select(int generic);
 
 void test_fsm_bitmap(void) {
 #define BMSZ1 16
@@ -202,6 +206,59 @@ void test_fsm_bitmap(void) {
   CU_ASSERT_EQUAL(res, 64 + 2);
 }
 
+static uint64_t bm_next_set_bit(const uint64_t *bm, uint64_t off, uint64_t max, int *found) {
+  for (*found = 0; off < max; ++off) {
+    if (bm[off / 64] & ((uint64_t) 1 << (off & 63))) {
+      *found = 1;
+      return off;
+    }
+  }
+  return 0;
+}
+
+static uint64_t bm_prev_set_bit(const uint64_t *bm, uint64_t off, uint64_t min, int *found) {
+  for (*found = 0; off > min; --off) {
+    if (bm[(off - 1) / 64] & ((uint64_t) 1 << ((off - 1) & 63))) {
+      *found = 1;
+      return off - 1;
+    }
+  }
+  return 0;
+}
+
+void test_fsm_bitmap_scan(void) {
+#define BMSZ2 256
+  uint64_t bm[BMSZ2];
+  const uint64_t nbits = BMSZ2 * 64;
+  for (int generic = 0; generic < 2; ++generic) {
+    const char *kernel = iwfs_fsmdbg_bmscan_select(generic);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(kernel);
+    for (int i = 0; i < 200; ++i) {
+      memset(bm, 0, sizeof(bm));
+      // Sparse bitmap with long zero runs
+      for (int j = 0, n = iwu_rand_range(4); j < n; ++j) {
+        uint64_t b = iwu_rand_range(nbits);
+        bm[b / 64] |= (uint64_t) 1 << (b & 63);
+      }
+      for (int j = 0; j < 50; ++j) {
+        int f1, f2;
+        uint64_t off = iwu_rand_range(nbits);
+        uint64_t lim = iwu_rand_range(nbits + 1);
+        uint64_t r1 = iwfs_fsmdbg_find_next_set_bit(bm, off, lim, &f1);
+        uint64_t r2 = bm_next_set_bit(bm, off, lim, &f2);
+        CU_ASSERT_EQUAL_FATAL(f1, f2);
+        CU_ASSERT_EQUAL_FATAL(r1, r2);
+        r1 = iwfs_fsmdbg_find_prev_set_bit(bm, off, lim, &f1);
+        r2 = bm_prev_set_bit(bm, off, lim, &f2);
+        CU_ASSERT_EQUAL_FATAL(f1, f2);
+        CU_ASSERT_EQUAL_FATAL(r1, r2);
+      }
+    }
+  }
+  iwfs_fsmdbg_bmscan_select(0);
+#undef BMSZ2
+}
+
 void test_fsm_open_close(void) {
   iwrc rc;
   IWFS_FSM_OPTS opts = {
@@ -376,6 +433,275 @@ void test_fsm_uniform_alloc_impl(int mmap_all) {
   }
 }
 
+void test_fsm_magazines(void) {
+  iwrc rc;
+  IWFS_FSMDBG_STATE state1, state2;
+  IWFS_FSM_OPTS opts = {
+    .exfile = {
+      .file = {
+        .path = "test_fsm_magazines.fsm",
+        .lock_mode = IWP_WLOCK,
+        .omode = IWFS_OTRUNC
+      },
+      .rspolicy = iw_exfile_szpolicy_fibo
+    },
+    .bpow = 6,
+    .hdrlen = 64,
+    .oflags = IWFSM_STRICT | IWFSM_MAGAZINES
+  };
+  typedef struct {
+    off_t addr;
+    off_t len;
+  } ASLOT;
+#define mcnt 1000
+  ASLOT aslots[mcnt];
+  const int sizes[] = {256, 768, 1024, 64 * 64, 64 * 65};
+
+  IWFS_FSM fsm;
+  rc = iwfs_fsmfile_open(&fsm, &opts);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = iwfs_fsmdbg_state(&fsm, &state1);
+  CU_ASSERT_FALSE_FATAL(rc);
+
+  for (int i = 0; i < mcnt; ++i) {
+    int sz = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+    aslots[i].addr = 0;
+    rc = fsm.allocate(&fsm, sz, &aslots[i].addr, &aslots[i].len, IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+    CU_ASSERT_EQUAL_FATAL(aslots[i].len, sz);
+    rc = fsm.check_allocation_status(&fsm, aslots[i].addr, aslots[i].len, true);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  for (int i = 1; i < mcnt; ++i) {
+    for (int j = 0; j < i; ++j) {
+      CU_ASSERT_FALSE_FATAL(IW_RANGES_OVERLAP(aslots[i].addr, aslots[i].addr + aslots[i].len,
+                                              aslots[j].addr, aslots[j].addr + aslots[j].len));
+    }
+  }
+  // Freed blocks are reused by subsequent allocations of the same size
+  off_t addr = aslots[1].addr, len = aslots[1].len;
+  rc = fsm.deallocate(&fsm, addr, len);
+  CU_ASSERT_FALSE_FATAL(rc);
+  aslots[1].addr = 0;
+  rc = fsm.allocate(&fsm, len, &aslots[1].addr, &aslots[1].len, IWFSM_ALLOC_NO_OVERALLOCATE);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(aslots[1].addr, addr);
+  CU_ASSERT_EQUAL(aslots[1].len, len);
+
+  // Double free, header and unallocated areas are rejected before caching
+  rc = fsm.deallocate(&fsm, addr, len);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = fsm.deallocate(&fsm, addr, len);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_FSM_SEGMENTATION);
+  rc = fsm.deallocate(&fsm, 0, 64);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_FSM_SEGMENTATION);
+  rc = fsm.deallocate(&fsm, (off_t) 1 << 40, 64);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_FSM_SEGMENTATION);
+  aslots[1].addr = 0;
+  rc = fsm.allocate(&fsm, len, &aslots[1].addr, &aslots[1].len, IWFSM_ALLOC_NO_OVERALLOCATE);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(aslots[1].addr, addr);
+
+  for (int i = 0; i < mcnt; ++i) {
+    rc = fsm.deallocate(&fsm, aslots[i].addr, aslots[i].len);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  // All cached blocks are returned into free-space tree
+  rc = fsm.sync(&fsm, 0);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = iwfs_fsmdbg_state(&fsm, &state2);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(state2.state.free_segments_num, state1.state.free_segments_num);
+  for (int i = 0; i < mcnt; ++i) {
+    rc = fsm.check_allocation_status(&fsm, aslots[i].addr, aslots[i].len, false);
+    CU_ASSERT_FALSE(rc);
+  }
+  rc = fsm.close(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+  if (iwp_page_size() == 4096) {
+    struct stat st;
+    CU_ASSERT_EQUAL(lstat("test_fsm_magazines.fsm", &st), 0);
+    CU_ASSERT_EQUAL(st.st_size, iwp_page_size() * 3);
+  }
+#undef mcnt
+}
+
+void test_fsm_magazines_lazy(void) {
+  iwrc rc;
+  IWFS_FSMDBG_STATE state1, state2;
+  IWFS_FSM_OPTS opts = {
+    .exfile = {
+      .file = {
+        .path = "test_fsm_magazines_lazy.fsm",
+        .lock_mode = IWP_WLOCK,
+        .omode = IWFS_OTRUNC
+      },
+      .rspolicy = iw_exfile_szpolicy_fibo
+    },
+    .bpow = 6,
+    .hdrlen = 64,
+    .oflags = IWFSM_MAGAZINES
+  };
+  IWFS_FSM fsm;
+  off_t addr[64], len[64];
+  rc = iwfs_fsmfile_open(&fsm, &opts);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = iwfs_fsmdbg_state(&fsm, &state1);
+  CU_ASSERT_FALSE_FATAL(rc);
+  for (int i = 0; i < 64; ++i) {
+    addr[i] = 0;
+    rc = fsm.allocate(&fsm, 256, &addr[i], &len[i], IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  // Overlapping frees of any length are rejected while segment is cached
+  rc = fsm.deallocate(&fsm, addr[0], len[0]);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = fsm.deallocate(&fsm, addr[0], len[0]);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_FSM_SEGMENTATION);
+  rc = fsm.deallocate(&fsm, addr[0] + 64, 128);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_FSM_SEGMENTATION);
+  rc = fsm.deallocate(&fsm, addr[0] - 64, 1024);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_FSM_SEGMENTATION);
+  rc = fsm.deallocate(&fsm, 0, 64);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_FSM_SEGMENTATION);
+
+  // Unallocated segment is accepted but dropped by batch check, never handed out
+  off_t baddr = (off_t) 1 << 40;
+  rc = fsm.deallocate(&fsm, baddr, 256);
+  CU_ASSERT_FALSE_FATAL(rc);
+  for (int i = 1; i < 64; ++i) {
+    rc = fsm.deallocate(&fsm, addr[i], len[i]);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  for (int i = 0; i < 64; ++i) {
+    addr[i] = 0;
+    rc = fsm.allocate(&fsm, 256, &addr[i], &len[i], IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+    CU_ASSERT_TRUE(addr[i] != baddr);
+    rc = fsm.check_allocation_status(&fsm, addr[i], len[i], true);
+    CU_ASSERT_FALSE(rc);
+  }
+  for (int i = 0; i < 64; ++i) {
+    rc = fsm.deallocate(&fsm, addr[i], len[i]);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  rc = fsm.sync(&fsm, 0);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = iwfs_fsmdbg_state(&fsm, &state2);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(state2.state.free_segments_num, state1.state.free_segments_num);
+  rc = fsm.close(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+}
+
+// Offset of free-space snapshot descriptor in FSM file header
+#define FSM_SNAPOFF_OFFSET (4 + 1 + 8 + 8 + 8 + 4 + 8)
+
+static uint64_t fsm_snapoff(const char *path) {
+  uint64_t llv = UINT64_MAX;
+  int fd = open(path, O_RDONLY);
+  CU_ASSERT_TRUE_FATAL(fd >= 0);
+  CU_ASSERT_EQUAL(pread(fd, &llv, sizeof(llv), FSM_SNAPOFF_OFFSET), sizeof(llv));
+  close(fd);
+  return IW_ITOHLL(llv);
+}
+
+void test_fsm_snapshot(void) {
+  iwrc rc;
+  IWFS_FSM fsm;
+  IWFS_FSMDBG_STATE state1, state2;
+  const char *path = "test_fsm_snapshot.fsm";
+  IWFS_FSM_OPTS opts = {
+    .exfile = {
+      .file = {
+        .path = path,
+        .lock_mode = IWP_WLOCK,
+        .omode = IWFS_OTRUNC
+      },
+      .rspolicy = iw_exfile_szpolicy_fibo
+    },
+    .bpow = 6,
+    .bmlen = 1024 * 1024,
+    .hdrlen = 64,
+    .oflags = IWFSM_STRICT
+  };
+#define scnt 2000
+  off_t addrs[scnt], lens[scnt];
+
+  rc = iwfs_fsmfile_open(&fsm, &opts);
+  CU_ASSERT_FALSE_FATAL(rc);
+  for (int i = 0; i < scnt; ++i) {
+    addrs[i] = 0;
+    rc = fsm.allocate(&fsm, 64 * (1 + i % 13), &addrs[i], &lens[i], IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  for (int i = 0; i < scnt; i += 2) {
+    rc = fsm.deallocate(&fsm, addrs[i], lens[i]);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  rc = iwfs_fsmdbg_state(&fsm, &state1);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_FALSE(state1.snaploaded);
+  rc = fsm.close(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+  uint64_t snapoff = fsm_snapoff(path);
+  CU_ASSERT_TRUE_FATAL(snapoff > 0);
+
+  // Clean reopen: free-space tree is loaded from snapshot
+  opts.exfile.file.omode = IWFS_OWRITE;
+  rc = iwfs_fsmfile_open(&fsm, &opts);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = iwfs_fsmdbg_state(&fsm, &state2);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_TRUE(state2.snaploaded);
+  CU_ASSERT_EQUAL(state1.state.free_segments_num, state2.state.free_segments_num);
+  CU_ASSERT_EQUAL(state1.lfbkoff, state2.lfbkoff);
+  CU_ASSERT_EQUAL(state1.lfbklen, state2.lfbklen);
+  // Snapshot is invalidated while file is open
+  CU_ASSERT_EQUAL(fsm_snapoff(path), 0);
+  for (int i = 0; i < scnt; ++i) {
+    rc = fsm.check_allocation_status(&fsm, addrs[i], lens[i], (i & 1));
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  for (int i = 0; i < scnt; i += 2) {
+    rc = fsm.allocate(&fsm, lens[i], &addrs[i], &lens[i], IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  for (int i = 1; i < scnt; i += 2) {
+    rc = fsm.deallocate(&fsm, addrs[i], lens[i]);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  rc = iwfs_fsmdbg_state(&fsm, &state1);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = fsm.close(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+
+  // Damaged snapshot: fallback to the bitmap scan
+  snapoff = fsm_snapoff(path);
+  CU_ASSERT_TRUE_FATAL(snapoff > 0);
+  int fd = open(path, O_WRONLY);
+  CU_ASSERT_TRUE_FATAL(fd >= 0);
+  uint64_t garbage = 0xffffffffffffffffULL;
+  CU_ASSERT_EQUAL(pwrite(fd, &garbage, sizeof(garbage), snapoff), sizeof(garbage));
+  close(fd);
+
+  rc = iwfs_fsmfile_open(&fsm, &opts);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = iwfs_fsmdbg_state(&fsm, &state2);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_FALSE(state2.snaploaded);
+  CU_ASSERT_EQUAL(state1.state.free_segments_num, state2.state.free_segments_num);
+  CU_ASSERT_EQUAL(state1.lfbkoff, state2.lfbkoff);
+  CU_ASSERT_EQUAL(state1.lfbklen, state2.lfbklen);
+  for (int i = 0; i < scnt; ++i) {
+    rc = fsm.check_allocation_status(&fsm, addrs[i], lens[i], !(i & 1));
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  rc = fsm.close(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+#undef scnt
+}
+
 typedef struct FSMREC {
   int64_t offset;
   int64_t length;
@@ -519,6 +845,194 @@ static void *recordsthr(void *op) {
   return 0;
 }
 
+void test_fsm_deallocate_batch(void) {
+  iwrc rc;
+  IWFS_FSM fsm;
+  IWFS_FSM_STATE state;
+  IWFS_FSM_OPTS opts = {
+    .exfile = {
+      .file = {
+        .path = "test_fsm_deallocate_batch.fsm",
+        .lock_mode = IWP_WLOCK,
+        .omode = IWFS_OTRUNC
+      },
+      .rspolicy = iw_exfile_szpolicy_fibo
+    },
+    .bpow = 6,
+    .hdrlen = 64,
+    .oflags = IWFSM_STRICT
+  };
+#define rcnt 1000
+  IWFS_FSM_RANGE ranges[rcnt];
+
+  rc = iwfs_fsmfile_open(&fsm, &opts);
+  CU_ASSERT_FALSE_FATAL(rc);
+  for (int i = 0; i < rcnt; ++i) {
+    ranges[i].addr = 0;
+    rc = fsm.allocate(&fsm, 64 * (1 + i % 7), &ranges[i].addr, &ranges[i].len, IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  // Reverse order, batch sorts ranges itself
+  for (int i = 0; i < rcnt / 2; ++i) {
+    IWFS_FSM_RANGE r = ranges[i];
+    ranges[i] = ranges[rcnt - 1 - i];
+    ranges[rcnt - 1 - i] = r;
+  }
+  rc = fsm.state(&fsm, &state);
+  CU_ASSERT_FALSE_FATAL(rc);
+  uint64_t dealloc_num = state.dealloc_num;
+
+  ranges[0].addr += 1;
+  rc = fsm.deallocate_batch(&fsm, ranges, rcnt);
+  CU_ASSERT_EQUAL_FATAL(rc, IWFS_ERROR_RANGE_NOT_ALIGNED);
+  ranges[0].addr -= 1;
+
+  rc = fsm.deallocate_batch(&fsm, ranges, rcnt);
+  CU_ASSERT_FALSE_FATAL(rc);
+  for (int i = 0; i < rcnt; ++i) {
+    if (i) {
+      CU_ASSERT_TRUE_FATAL(ranges[i - 1].addr < ranges[i].addr);
+    }
+    rc = fsm.check_allocation_status(&fsm, ranges[i].addr, ranges[i].len, false);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  rc = fsm.state(&fsm, &state);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(state.dealloc_num, dealloc_num + rcnt);
+
+  // Released areas are merged with each other
+  off_t addr = 0, len;
+  rc = fsm.allocate(&fsm, ranges[1].addr + ranges[1].len - ranges[0].addr, &addr, &len, IWFSM_ALLOC_NO_OVERALLOCATE);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(addr, ranges[0].addr);
+  rc = fsm.close(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+#undef rcnt
+}
+
+void test_fsm_alloc_hint(void) {
+  iwrc rc;
+  IWFS_FSM fsm;
+  IWFS_FSM_OPTS opts = {
+    .exfile = {
+      .file = {
+        .path = "test_fsm_alloc_hint.fsm",
+        .lock_mode = IWP_WLOCK,
+        .omode = IWFS_OTRUNC
+      },
+      .rspolicy = iw_exfile_szpolicy_fibo
+    },
+    .bpow = 6,
+    .hdrlen = 64,
+    .oflags = IWFSM_STRICT
+  };
+#define hcnt 48
+  off_t addrs[hcnt], len, addr;
+
+  // Free-space tree: block of larger size nearest to hint is preferred
+  rc = iwfs_fsmfile_open(&fsm, &opts);
+  CU_ASSERT_FALSE_FATAL(rc);
+  for (int i = 0; i < hcnt; ++i) {
+    addrs[i] = 0;
+    rc = fsm.allocate(&fsm, 3 * 64, &addrs[i], &len, IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  rc = fsm.deallocate(&fsm, addrs[4], 3 * 64);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = fsm.deallocate(&fsm, addrs[30], 3 * 64);
+  CU_ASSERT_FALSE_FATAL(rc);
+  addr = addrs[32];
+  rc = fsm.allocate(&fsm, 2 * 64, &addr, &len, IWFSM_ALLOC_NO_OVERALLOCATE);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(addr, addrs[30]);
+  addr = addrs[2];
+  rc = fsm.allocate(&fsm, 3 * 64, &addr, &len, IWFSM_ALLOC_NO_OVERALLOCATE);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(addr, addrs[4]);
+  rc = fsm.close(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+
+  // Magazines: cached block nearest to hint is taken
+  opts.oflags |= IWFSM_MAGAZINES;
+  rc = iwfs_fsmfile_open(&fsm, &opts);
+  CU_ASSERT_FALSE_FATAL(rc);
+  for (int i = 0; i < hcnt; ++i) {
+    addrs[i] = 0;
+    rc = fsm.allocate(&fsm, 64, &addrs[i], &len, IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  rc = fsm.deallocate(&fsm, addrs[0], 64);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = fsm.deallocate(&fsm, addrs[24], 64);
+  CU_ASSERT_FALSE_FATAL(rc);
+  rc = fsm.deallocate(&fsm, addrs[hcnt - 1], 64);
+  CU_ASSERT_FALSE_FATAL(rc);
+  addr = addrs[25];
+  rc = fsm.allocate(&fsm, 64, &addr, &len, IWFSM_ALLOC_NO_OVERALLOCATE);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(addr, addrs[24]);
+  addr = addrs[1];
+  rc = fsm.allocate(&fsm, 64, &addr, &len, IWFSM_ALLOC_NO_OVERALLOCATE);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(addr, addrs[0]);
+  rc = fsm.close(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+#undef hcnt
+}
+
+void test_fsm_alloc_lowest(void) {
+  iwrc rc;
+  IWFS_FSM fsm;
+  IWFS_FSM_OPTS opts = {
+    .exfile = {
+      .file = {
+        .path = "test_fsm_alloc_lowest.fsm",
+        .lock_mode = IWP_WLOCK,
+        .omode = IWFS_OTRUNC
+      },
+      .rspolicy = iw_exfile_szpolicy_fibo
+    },
+    .bpow = 6,
+    .hdrlen = 64,
+    .oflags = IWFSM_STRICT | IWFSM_MAGAZINES
+  };
+#define hcnt 48
+  off_t addrs[hcnt], len, addr;
+  const iwfs_fsm_aflags aflags = IWFSM_ALLOC_LOWEST | IWFSM_ALLOC_NO_EXTEND | IWFSM_ALLOC_NO_OVERALLOCATE;
+
+  rc = iwfs_fsmfile_open(&fsm, &opts);
+  CU_ASSERT_FALSE_FATAL(rc);
+  for (int i = 0; i < hcnt; ++i) {
+    addrs[i] = 0;
+    rc = fsm.allocate(&fsm, 3 * 64, &addrs[i], &len, IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  const int freed[] = { 5, 10, 11, 30 };
+  for (int i = 0; i < sizeof(freed) / sizeof(freed[0]); ++i) {
+    rc = fsm.deallocate(&fsm, addrs[freed[i]], 3 * 64);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+  rc = fsm.trim(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+
+  addr = 0;
+  rc = fsm.allocate(&fsm, 2 * 64, &addr, &len, aflags);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(addr, addrs[5]);
+  // Exact fit at slot 30 is skipped in favour of lower area
+  addr = addrs[20];
+  rc = fsm.allocate(&fsm, 3 * 64, &addr, &len, aflags);
+  CU_ASSERT_FALSE_FATAL(rc);
+  CU_ASSERT_EQUAL(addr, addrs[10]);
+  // No suitable free area below slot 9
+  addr = addrs[9];
+  rc = fsm.allocate(&fsm, 3 * 64, &addr, &len, aflags);
+  CU_ASSERT_EQUAL(rc, IWFS_ERROR_NO_FREE_SPACE);
+  rc = fsm.close(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+#undef hcnt
+}
+
 void test_block_allocation_impl(int mmap_all, int nthreads, int numrec, int avgrecsz, int blkpow, const char *path) {
   iwrc rc;
   pthread_t *tlist = malloc(nthreads * sizeof(pthread_t));
@@ -740,9 +1254,16 @@ int main() {
 
   /* Add the tests to the suite */
   if ((NULL == CU_add_test(pSuite, "test_fsm_bitmap", test_fsm_bitmap)) ||
+      (NULL == CU_add_test(pSuite, "test_fsm_bitmap_scan", test_fsm_bitmap_scan)) ||
       (NULL == CU_add_test(pSuite, "test_fsm_open_close", test_fsm_open_close)) ||
       (NULL == CU_add_test(pSuite, "test_fsm_uniform_alloc", test_fsm_uniform_alloc)) ||
       (NULL == CU_add_test(pSuite, "test_fsm_uniform_alloc_mmap_all", test_fsm_uniform_alloc_mmap_all)) ||
+      (NULL == CU_add_test(pSuite, "test_fsm_magazines", test_fsm_magazines)) ||
+      (NULL == CU_add_test(pSuite, "test_fsm_magazines_lazy", test_fsm_magazines_lazy)) ||
+      (NULL == CU_add_test(pSuite, "test_fsm_snapshot", test_fsm_snapshot)) ||
+      (NULL == CU_add_test(pSuite, "test_fsm_deallocate_batch", test_fsm_deallocate_batch)) ||
+      (NULL == CU_add_test(pSuite, "test_fsm_alloc_hint", test_fsm_alloc_hint)) ||
+      (NULL == CU_add_test(pSuite, "test_fsm_alloc_lowest", test_fsm_alloc_lowest)) ||
       (NULL == CU_add_test(pSuite, "test_block_allocation1", test_block_allocation1)) ||
       (NULL == CU_add_test(pSuite, "test_block_allocation1_mmap_all", test_block_allocation1_mmap_all)) ||
       (NULL == CU_add_test(pSuite, "test_block_allocation2", test_block_allocation2)) ||
@@ -0,0 +1,185 @@
+#include "iowow.h"
+#include "log/iwlog.h"
+#include "fs/iwfsmfile.h"
+#include "utils/iwutils.h"
+#include "platform/iwp.h"
+
+#include "iwcfg.h"
+#include <CUnit/Basic.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <fcntl.h>
+
+/**
+ * Free-space bitmap scan kernels microbenchmark.
+ */
+
+// Bitmap size in 64 bit words: 4Mb bitmap (2Gb of data file with 64 bytes blocks)
+#define BMWORDS (512 * 1024)
+#define BMSCAN_ROUNDS 20
+
+// Offset of free-space snapshot descriptor in FSM file header
+#define FSM_SNAPOFF_OFFSET (4 + 1 + 8 + 8 + 8 + 4 + 8)
+
+#define UNLINK() \
+  unlink("iwfs_test4.fsm")
+
+uint64_t iwfs_fsmdbg_number_of_free_areas(IWFS_FSM *f);
+uint64_t iwfs_fsmdbg_find_next_set_bit(const uint64_t *addr,
+                                       uint64_t offset_bit,
+                                       uint64_t max_offset_bit,
+                                       int *found);
+uint64_t iwfs_fsmdbg_find_prev_set_bit(const uint64_t *addr,
+                                       uint64_t offset_bit,
+                                       uint64_t min_offset_bit,
+                                       int *found);
+const char *iwfs_fsmdbg_bmscan_select(int generic);
+iwrc iwfs_fsmdbg_state(IWFS_FSM *f, IWFS_FSMDBG_STATE *d);
+
+int init_suite(void) {
+  int rc = iw_init();
+  UNLINK();
+  return rc;
+}
+
+int clean_suite(void) {
+  UNLINK();
+  return 0;
+}
+
+static uint64_t bench_scan(const uint64_t *bm, uint64_t nbits, uint64_t *ofound) {
+  int found;
+  uint64_t ts1, ts2, res = 0;
+  iwp_current_time_ms(&ts1);
+  for (int i = 0; i < BMSCAN_ROUNDS; ++i) {
+    res += iwfs_fsmdbg_find_next_set_bit(bm, 1, nbits, &found);
+    res += iwfs_fsmdbg_find_prev_set_bit(bm, nbits - 1, 0, &found);
+  }
+  iwp_current_time_ms(&ts2);
+  *ofound = res;
+  return ts2 - ts1;
+}
+
+void iwfs_test4_bmscan(void) {
+  uint64_t *bm = calloc(BMWORDS, sizeof(*bm));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(bm);
+  const uint64_t nbits = (uint64_t) BMWORDS * 64;
+  // Only the first and the last blocks are allocated
+  bm[0] = 1;
+  bm[BMWORDS - 1] = (uint64_t) 1 << 63;
+
+  for (int generic = 1; generic >= 0; --generic) {
+    uint64_t res;
+    const char *kernel = iwfs_fsmdbg_bmscan_select(generic);
+    uint64_t ms = bench_scan(bm, nbits, &res);
+    CU_ASSERT_EQUAL(res, BMSCAN_ROUNDS * (nbits - 1));
+    double mbs = ms ? (2.0 * BMSCAN_ROUNDS * BMWORDS * 8) / (1024.0 * 1024.0) / (ms / 1000.0) : 0;
+    fprintf(stderr, "\n%-8s bitmap scan: %" PRIu64 " ms, %.0f Mb/s", kernel, ms, mbs);
+  }
+  fprintf(stderr, "\n");
+  iwfs_fsmdbg_bmscan_select(0);
+  free(bm);
+}
+
+void iwfs_test4_fsm_load(void) {
+  iwrc rc;
+  uint64_t ts1, ts2, ts3;
+  off_t addr, len;
+  IWFS_FSM fsm;
+  IWFS_FSM_OPTS opts = {
+    .exfile = {
+      .file = {
+        .path = "iwfs_test4.fsm",
+        .lock_mode = IWP_WLOCK,
+        .omode = IWFS_OTRUNC
+      },
+      .rspolicy = iw_exfile_szpolicy_fibo
+    },
+    .bpow = 6,
+    .bmlen = BMWORDS * 8,
+    .hdrlen = 64,
+    .mmap_all = true
+  };
+  rc = iwfs_fsmfile_open(&fsm, &opts);
+  CU_ASSERT_FALSE_FATAL(rc);
+
+  // Fragment the first part of the file and allocate a large area
+  for (int i = 0; i < 1024; ++i) {
+    addr = 0;
+    rc = fsm.allocate(&fsm, 64 * (1 + (i & 7)), &addr, &len, IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+    if (i & 1) {
+      rc = fsm.deallocate(&fsm, addr, len);
+      CU_ASSERT_FALSE_FATAL(rc);
+    }
+  }
+  off_t laddr = 0, llen;
+  rc = fsm.allocate(&fsm, 256 * 1024 * 1024, &laddr, &llen, IWFSM_ALLOC_NO_OVERALLOCATE);
+  CU_ASSERT_FALSE_FATAL(rc);
+  uint64_t nareas = iwfs_fsmdbg_number_of_free_areas(&fsm);
+  rc = fsm.close(&fsm);
+  CU_ASSERT_FALSE_FATAL(rc);
+
+  opts.exfile.file.omode = IWFS_OWRITE;
+  for (int i = 0; i < 2; ++i) {
+    IWFS_FSMDBG_STATE state;
+    if (i) {
+      // Drop free-space tree snapshot as after unclean shutdown
+      uint8_t zero[16] = {0};
+      int fd = open("iwfs_test4.fsm", O_WRONLY);
+      CU_ASSERT_TRUE_FATAL(fd >= 0);
+      CU_ASSERT_EQUAL(pwrite(fd, zero, sizeof(zero), FSM_SNAPOFF_OFFSET), sizeof(zero));
+      close(fd);
+    }
+    iwp_current_time_ms(&ts1);
+    rc = iwfs_fsmfile_open(&fsm, &opts);
+    CU_ASSERT_FALSE_FATAL(rc);
+    iwp_current_time_ms(&ts2);
+    CU_ASSERT_EQUAL(iwfs_fsmdbg_number_of_free_areas(&fsm), nareas);
+    rc = iwfs_fsmdbg_state(&fsm, &state);
+    CU_ASSERT_FALSE_FATAL(rc);
+    CU_ASSERT_EQUAL(state.snaploaded, !i);
+
+    // Bulk deallocation and allocation of the large area
+    rc = fsm.deallocate(&fsm, laddr, llen);
+    CU_ASSERT_FALSE_FATAL(rc);
+    rc = fsm.allocate(&fsm, llen, &laddr, &llen, IWFSM_ALLOC_NO_OVERALLOCATE);
+    CU_ASSERT_FALSE_FATAL(rc);
+    iwp_current_time_ms(&ts3);
+
+    fprintf(stderr, "\nfsm open (%s): %" PRIu64 " ms, large area reallocation: %" PRIu64 " ms\n",
+            state.snaploaded ? "snapshot" : "bitmap scan", ts2 - ts1, ts3 - ts2);
+    rc = fsm.close(&fsm);
+    CU_ASSERT_FALSE_FATAL(rc);
+  }
+}
+
+int main() {
+  CU_pSuite pSuite = NULL;
+
+  /* Initialize the CUnit test registry */
+  if (CUE_SUCCESS != CU_initialize_registry())
+    return CU_get_error();
+
+  /* Add a suite to the registry */
+  pSuite = CU_add_suite("iwfs_test4", init_suite, clean_suite);
+
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  /* Add the tests to the suite */
+  if ((NULL == CU_add_test(pSuite, "iwfs_test4_bmscan", iwfs_test4_bmscan)) ||
+      (NULL == CU_add_test(pSuite, "iwfs_test4_fsm_load", iwfs_test4_fsm_load))) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  /* Run all tests using the CUnit Basic interface */
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  int ret = CU_get_error() || CU_get_number_of_failures();
+  CU_cleanup_registry();
+  return ret;
+}
@@ -4,6 +4,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
 
 char *g_program;
 
@@ -16,6 +21,35 @@ typedef bool (bench_method(BMCTX *bmctx));
 #define RND_DATA_SZ (10*1048576)
 char RND_DATA[RND_DATA_SZ];
 
+// Latency histogram buckets: exact values below 8ns then 8 buckets per power of two
+#define LAT_SUBBITS 3
+#define LAT_BUCKETS ((64 - LAT_SUBBITS + 1) << LAT_SUBBITS)
+
+typedef enum {
+  LAT_PUT = 0,
+  LAT_GET,
+  LAT_DEL,
+  LAT_SEEK,
+  LAT_OPS
+} lat_op_t;
+
+static const char *lat_op_names[LAT_OPS] = { "put", "get", "del", "seek" };
+
+/** Per operation latency histograms in nanoseconds */
+typedef struct LATHIST {
+  uint64_t cnt[LAT_OPS][LAT_BUCKETS];
+  uint64_t total[LAT_OPS];
+} LATHIST;
+
+/** Zipfian distribution of YCSB key ranks (Gray et al. "Quickly generating billion-record synthetic databases") */
+typedef struct ZIPF {
+  uint64_t n;
+  double theta;
+  double alpha;
+  double zetan;
+  double eta;
+} ZIPF;
+
 struct BM {
   bool initiated;
   int argc;
@@ -25,7 +59,10 @@ struct BM {
   int param_num_reads;
   int param_value_size;
   uint32_t param_seed;
+  int param_threads;
   char *param_benchmarks;
+  ZIPF *zipf;                 /**< Key ranks distribution of YCSB workloads, created on demand */
+  atomic_int ycsb_keys;       /**< Number of keys including inserted by YCSB D,E workloads */
   void (*val_free)(void *ptr);
   void (*env_setup)(void);
   void *(*db_open)(BMCTX *ctx);
@@ -44,6 +81,8 @@ struct BMCTX {
   bool logdbsize;
   char *name;
   int num;
+  int num_reads;
+  int key_offset;       /**< First key of sequential writes */
   int value_size;
   uint64_t start_ms;
   uint64_t end_ms;
@@ -51,6 +90,8 @@ struct BMCTX {
   void *extra;
   bench_method *method;
   int rnd_data_pos;
+  uint64_t rnd_state;   /**< State of benchmark thread random generator, zero if global generator is used */
+  LATHIST *lat;
 };
 
 static void _val_dispose(IWKV_val *val) {
@@ -66,9 +107,161 @@ static void _val_dispose(IWKV_val *val) {
 
 static void _bmctx_dispose(BMCTX *ctx) {
   free(ctx->name);
+  free(ctx->lat);
   free(ctx);
 }
 
+static uint32_t _bm_rand_u32(BMCTX *ctx) {
+  if (!ctx->rnd_state) {
+    return iwu_rand_u32();
+  }
+  // xorshift64*
+  uint64_t x = ctx->rnd_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  ctx->rnd_state = x;
+  return (x * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static uint32_t _bm_rand_range(BMCTX *ctx, uint32_t range) {
+  return _bm_rand_u32(ctx) % range;
+}
+
+static double _bm_rand_double(BMCTX *ctx) {
+  return _bm_rand_u32(ctx) / 4294967296.0;
+}
+
+static void _zipf_init(ZIPF *z, uint64_t n, double theta) {
+  double zeta2 = 1 + 1 / pow(2, theta);
+  z->n = n;
+  z->theta = theta;
+  z->zetan = 0;
+  for (uint64_t i = 1; i <= n; ++i) {
+    z->zetan += 1 / pow(i, theta);
+  }
+  z->alpha = 1 / (1 - theta);
+  z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / z->zetan);
+}
+
+// Rank of the next key, zero is the most popular
+static uint64_t _zipf_next(const ZIPF *z, double u) {
+  double uz = u * z->zetan;
+  if (uz < 1) {
+    return 0;
+  }
+  if (uz < 1 + pow(0.5, z->theta)) {
+    return 1;
+  }
+  return (uint64_t) (z->n * pow(z->eta * u - z->eta + 1, z->alpha)) % z->n;
+}
+
+// Spread popular ranks over the keys space (FNV-1a hash)
+static uint64_t _zipf_scramble(uint64_t rank) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < 8; ++i) {
+    h ^= rank & 0xff;
+    h *= 0x100000001b3ULL;
+    rank >>= 8;
+  }
+  return h;
+}
+
+static uint64_t _bm_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int _lat_bucket(uint64_t ns) {
+  if (ns < (1 << LAT_SUBBITS)) {
+    return ns;
+  }
+  int e = 63 - __builtin_clzll(ns);
+  return ((e - LAT_SUBBITS + 1) << LAT_SUBBITS) + ((ns >> (e - LAT_SUBBITS)) & ((1 << LAT_SUBBITS) - 1));
+}
+
+// The lowest latency of bucket
+static uint64_t _lat_bucket_low(int b) {
+  if (b < (1 << LAT_SUBBITS)) {
+    return b;
+  }
+  int e = (b >> LAT_SUBBITS) + LAT_SUBBITS - 1;
+  return (uint64_t) ((1 << LAT_SUBBITS) + (b & ((1 << LAT_SUBBITS) - 1))) << (e - LAT_SUBBITS);
+}
+
+static void _lat_add(LATHIST *lat, lat_op_t op, uint64_t ns) {
+  if (lat) {
+    lat->cnt[op][_lat_bucket(ns)]++;
+    lat->total[op]++;
+  }
+}
+
+static void _lat_merge(LATHIST *dst, const LATHIST *src) {
+  for (int op = 0; op < LAT_OPS; ++op) {
+    for (int b = 0; b < LAT_BUCKETS; ++b) {
+      dst->cnt[op][b] += src->cnt[op][b];
+    }
+    dst->total[op] += src->total[op];
+  }
+}
+
+// Latency in microseconds below which `pct` of operations fall, upper bound of bucket
+static double _lat_percentile(const LATHIST *lat, lat_op_t op, double pct) {
+  uint64_t sum = 0, need = ceil(lat->total[op] * pct);
+  for (int b = 0; b < LAT_BUCKETS; ++b) {
+    sum += lat->cnt[op][b];
+    if (sum >= need && sum) {
+      uint64_t high = b + 1 < LAT_BUCKETS ? _lat_bucket_low(b + 1) - 1 : UINT64_MAX;
+      return high / 1000.0;
+    }
+  }
+  return 0;
+}
+
+static void _lat_report(BMCTX *ctx) {
+  if (!ctx->lat) {
+    return;
+  }
+  for (int op = 0; op < LAT_OPS; ++op) {
+    if (ctx->lat->total[op]) {
+      fprintf(stderr, " latency: %s %s ops: %" PRIu64 " p50: %.2f p99: %.2f p999: %.2f us\n",
+              ctx->name, lat_op_names[op], ctx->lat->total[op],
+              _lat_percentile(ctx->lat, op, 0.5),
+              _lat_percentile(ctx->lat, op, 0.99),
+              _lat_percentile(ctx->lat, op, 0.999));
+    }
+  }
+}
+
+static bool _bm_put(BMCTX *ctx, const IWKV_val *key, const IWKV_val *val, bool sync) {
+  uint64_t ts = _bm_ns();
+  bool ret = bm.db_put(ctx, key, val, sync);
+  _lat_add(ctx->lat, LAT_PUT, _bm_ns() - ts);
+  return ret;
+}
+
+static bool _bm_get(BMCTX *ctx, const IWKV_val *key, IWKV_val *val, bool *found) {
+  uint64_t ts = _bm_ns();
+  bool ret = bm.db_get(ctx, key, val, found);
+  _lat_add(ctx->lat, LAT_GET, _bm_ns() - ts);
+  return ret;
+}
+
+static bool _bm_del(BMCTX *ctx, const IWKV_val *key, bool sync) {
+  uint64_t ts = _bm_ns();
+  bool ret = bm.db_del(ctx, key, sync);
+  _lat_add(ctx->lat, LAT_DEL, _bm_ns() - ts);
+  return ret;
+}
+
+static bool _bm_cursor_to_key(BMCTX *ctx, const IWKV_val *key, IWKV_val *val, bool *found) {
+  uint64_t ts = _bm_ns();
+  bool ret = bm.db_cursor_to_key(ctx, key, val, found);
+  _lat_add(ctx->lat, LAT_SEEK, _bm_ns() - ts);
+  return ret;
+}
+
 static const char *_bmctx_rndbuf_nextptr(BMCTX *ctx, int len) {
   assert(len <= RND_DATA_SZ);
   if (ctx->rnd_data_pos + len > RND_DATA_SZ) {
@@ -127,6 +320,8 @@ static void _bm_help() {
   fprintf(stderr, "  -b <comma separated benchmarks to run>\n\n");
   fprintf(stderr, "  -db <file/dir> Database file/directory\n\n");
   fprintf(stderr, "  -rs <random seed> Random seed used for iwu random generator\n\n");
+  fprintf(stderr, "  -t <threads> Number of concurrent benchmark threads sharing N operations\n");
+  fprintf(stderr, "               (readseq, readreverse are run by every thread)\n\n");
   fprintf(stderr, "Available benchmarks:\n");
   fprintf(stderr, "  fillseq        write N fixed length values in sequential key order in async mode\n");
   fprintf(stderr, "  fillseq2       write N random length values in sequential key order in async mode\n");
@@ -143,6 +338,12 @@ static void _bm_help() {
   fprintf(stderr, "  readmissing    read N missing keys in random order\n");
   fprintf(stderr, "  readhot        read N times in random order from 1%% section of DB\n");
   fprintf(stderr, "  seekrandom     N random seeks\n");
+  fprintf(stderr, "  ycsba          R operations: 50%% reads, 50%% updates of zipfian keys\n");
+  fprintf(stderr, "  ycsbb          R operations: 95%% reads, 5%% updates of zipfian keys\n");
+  fprintf(stderr, "  ycsbc          R reads of zipfian keys\n");
+  fprintf(stderr, "  ycsbd          R operations: 95%% reads of latest keys, 5%% inserts\n");
+  fprintf(stderr, "  ycsbe          R operations: 95%% seeks to zipfian keys, 5%% inserts\n");
+  fprintf(stderr, "  ycsbf          R operations: 50%% reads, 50%% read-modify-writes of zipfian keys\n");
   fprintf(stderr, "\n");
 }
 
@@ -159,6 +360,7 @@ static bool _bm_init(int argc, char *argv[]) {
   bm.param_num = 2000000; // 2M records
   bm.param_num_reads = -1; // Same as param_num
   bm.param_value_size = 400;
+  bm.param_threads = 1;
   bm.param_benchmarks =  "fillrandom2,"
                          "readrandom,"
                          "deleterandom,"
@@ -226,11 +428,22 @@ static bool _bm_init(int argc, char *argv[]) {
         return false;
       }
       bm.param_seed = atoll(argv[i]);
+    } else if (!strcmp(argv[i], "-t")) {
+      if (++i >= argc) {
+        fprintf(stderr, "'-t <threads>' options has no value\n");
+        return false;
+      }
+      bm.param_threads = atoi(argv[i]);
+      if (bm.param_threads < 1) {
+        fprintf(stderr, "'-t <threads>' invalid option value\n");
+        return false;
+      }
     }
   }
   if (bm.param_num_reads < 0) {
     bm.param_num_reads = bm.param_num;
   }
+  atomic_init(&bm.ycsb_keys, bm.param_num);
   if (!_bm_check()) {
     fprintf(stderr, "Benchmark `bm` structure is not configured properly\n");
     return false;
@@ -247,9 +460,10 @@ static bool _bm_init(int argc, char *argv[]) {
   fprintf(stderr,
           "\n exec size: %u"
           "\n random seed: %u"
-          "\n num records: %d\n read num records: %d\n value size: %d\n benchmarks: %s\n\n",
+          "\n num records: %d\n read num records: %d\n value size: %d\n threads: %d\n benchmarks: %s\n\n",
           _execsize(),
-          bm.param_seed, bm.param_num, bm.param_num_reads, bm.param_value_size, bm.param_benchmarks);
+          bm.param_seed, bm.param_num, bm.param_num_reads, bm.param_value_size,
+          bm.param_threads, bm.param_benchmarks);
           
   // Fill up random data array
   for (int i = 0; i < RND_DATA_SZ; ++i) {
@@ -276,6 +490,50 @@ uint32_t _execsize() {
   return fst.size;
 }
 
+static void *_bm_thread(void *op) {
+  BMCTX *ctx = op;
+  ctx->success = ctx->method(ctx);
+  return 0;
+}
+
+// Split benchmark operations between `bm.param_threads` threads running on the same database
+static bool _bm_run_threads(BMCTX *ctx) {
+  bool ret = true;
+  int nt = bm.param_threads;
+  BMCTX *tctx = calloc(nt, sizeof(*tctx));
+  pthread_t *threads = calloc(nt, sizeof(*threads));
+  if (!tctx || !threads) {
+    free(tctx);
+    free(threads);
+    return false;
+  }
+  for (int i = 0; i < nt; ++i) {
+    BMCTX *t = &tctx[i];
+    *t = *ctx;
+    t->num = ctx->num / nt + (i < ctx->num % nt);
+    t->num_reads = ctx->num_reads / nt + (i < ctx->num_reads % nt);
+    t->key_offset = i * (ctx->num / nt) + MIN(i, ctx->num % nt);
+    t->rnd_state = ((uint64_t) iwu_rand_u32() << 32) | iwu_rand_u32() | 1;
+    t->rnd_data_pos = iwu_rand_range(RND_DATA_SZ);
+    t->lat = calloc(1, sizeof(*t->lat));
+    if (!t->lat || pthread_create(&threads[i], 0, _bm_thread, t)) {
+      free(t->lat);
+      nt = i;
+      ret = false;
+      break;
+    }
+  }
+  for (int i = 0; i < nt; ++i) {
+    pthread_join(threads[i], 0);
+    ret = ret && tctx[i].success;
+    _lat_merge(ctx->lat, tctx[i].lat);
+    free(tctx[i].lat);
+  }
+  free(threads);
+  free(tctx);
+  return ret;
+}
+
 static void _bm_run(BMCTX *ctx) {
   assert(ctx->method);
   uint64_t llv;
@@ -286,7 +544,11 @@ static void _bm_run(BMCTX *ctx) {
   }
   iwp_current_time_ms(&llv);
   ctx->start_ms = llv;
-  ctx->success = ctx->method(ctx);
+  if (bm.param_threads > 1) {
+    ctx->success = _bm_run_threads(ctx);
+  } else {
+    ctx->success = ctx->method(ctx);
+  }
   if (!bm.db_close(ctx)) {
     ctx->success = false;
   }
@@ -301,17 +563,17 @@ static bool _do_write(BMCTX *ctx, bool seq, bool sync, bool rvlen) {
   int value_size = ctx->value_size;
   for (int i = 0; i < ctx->num; ++i) {
     if (rvlen) {
-      value_size = iwu_rand_range(ctx->value_size + 1);
+      value_size = _bm_rand_range(ctx, ctx->value_size + 1);
       if (value_size == 0) {
         value_size = 1;
       }
     }
-    const int k = seq ? i : iwu_rand_range(bm.param_num);
+    const int k = seq ? ctx->key_offset + i : _bm_rand_range(ctx, bm.param_num);
     snprintf(key.data, sizeof(kbuf), "%016d", k);
     key.size = strlen(key.data);
     val.data = (void *) _bmctx_rndbuf_nextptr(ctx, value_size);
     val.size = value_size;
-    if (!bm.db_put(ctx, &key, &val, sync)) {
+    if (!_bm_put(ctx, &key, &val, sync)) {
       return false;
     }
   }
@@ -323,10 +585,10 @@ static bool _do_delete(BMCTX *ctx, bool sync, bool seq) {
   IWKV_val key;
   key.data = kbuf;
   for (int i = 0; i < ctx->num; ++i) {
-    const int k = seq ? i : iwu_rand_range(bm.param_num);
+    const int k = seq ? ctx->key_offset + i : _bm_rand_range(ctx, bm.param_num);
     snprintf(key.data, sizeof(kbuf), "%016d", k);
     key.size = strlen(key.data);
-    if (!bm.db_del(ctx, &key, sync)) {
+    if (!_bm_del(ctx, &key, sync)) {
       return false;
     }
   }
@@ -346,13 +608,13 @@ static bool _do_read_random(BMCTX *ctx) {
   IWKV_val key, val;
   bool found;
   key.data = kbuf;
-  for (int i = 0; i < bm.param_num_reads; ++i) {
-    const int k = iwu_rand_range(bm.param_num);
+  for (int i = 0; i < ctx->num_reads; ++i) {
+    const int k = _bm_rand_range(ctx, bm.param_num);
     snprintf(key.data, sizeof(kbuf), "%016d", k);
     key.size = strlen(key.data);
     val.data = 0;
     val.size = 0;
-    if (!bm.db_get(ctx, &key, &val, &found)) {
+    if (!_bm_get(ctx, &key, &val, &found)) {
       _val_dispose(&val);
       return false;
     }
@@ -366,13 +628,13 @@ static bool _do_read_missing(BMCTX *ctx) {
   IWKV_val key, val;
   bool found;
   key.data = kbuf;
-  for (int i = 0; i < bm.param_num_reads; ++i) {
-    const int k = iwu_rand_range(bm.param_num);
+  for (int i = 0; i < ctx->num_reads; ++i) {
+    const int k = _bm_rand_range(ctx, bm.param_num);
     snprintf(key.data, sizeof(kbuf), "%016d.", k);
     key.size = strlen(key.data);
     val.data = 0;
     val.size = 0;
-    if (!bm.db_get(ctx, &key, &val, &found)) {
+    if (!_bm_get(ctx, &key, &val, &found)) {
       _val_dispose(&val);
       return false;
     }
@@ -390,13 +652,13 @@ static bool _do_read_hot(BMCTX *ctx) {
   bool found;
   key.data = kbuf;
   const int range = (bm.param_num + 99) / 100;
-  for (int i = 0; i < bm.param_num_reads; ++i) {
-    const int k = iwu_rand_range(range);
+  for (int i = 0; i < ctx->num_reads; ++i) {
+    const int k = _bm_rand_range(ctx, range);
     snprintf(key.data, sizeof(kbuf), "%016d", k);
     key.size = strlen(key.data);
     val.data = 0;
     val.size = 0;
-    if (!bm.db_get(ctx, &key, &val, &found)) {
+    if (!_bm_get(ctx, &key, &val, &found)) {
       _val_dispose(&val);
       return false;
     }
@@ -410,13 +672,13 @@ static bool _do_seek_random(BMCTX *ctx) {
   IWKV_val key, val;
   bool found;
   key.data = kbuf;
-  for (int i = 0; i < bm.param_num_reads; ++i) {
-    const int k = iwu_rand_range(bm.param_num);
+  for (int i = 0; i < ctx->num_reads; ++i) {
+    const int k = _bm_rand_range(ctx, bm.param_num);
     snprintf(key.data, sizeof(kbuf), "%016d", k);
     key.size = strlen(key.data);
     val.data = 0;
     val.size = 0;
-    if (!bm.db_cursor_to_key(ctx, &key, &val, &found)) {
+    if (!_bm_cursor_to_key(ctx, &key, &val, &found)) {
       _val_dispose(&val);
       return false;
     }
@@ -425,6 +687,56 @@ static bool _do_seek_random(BMCTX *ctx) {
   return true;
 }
 
+typedef enum {
+  YCSB_UPDATE,
+  YCSB_INSERT,
+  YCSB_RMW,   /**< Read-modify-write */
+} ycsb_wop_t;
+
+/**
+ * @brief YCSB like workload of `ctx->num_reads` operations.
+ * @param read_pct Percent of read operations
+ * @param wop Kind of write operations
+ * @param latest Read recently inserted keys instead of zipfian distributed ones
+ * @param seek Reads are seeks of cursor to the key
+ */
+static bool _do_ycsb(BMCTX *ctx, int read_pct, ycsb_wop_t wop, bool latest, bool seek) {
+  char kbuf[100];
+  IWKV_val key, val;
+  bool found;
+  key.data = kbuf;
+  for (int i = 0; i < ctx->num_reads; ++i) {
+    bool read = _bm_rand_range(ctx, 100) < read_pct;
+    int k;
+    if (!read && wop == YCSB_INSERT) {
+      k = atomic_fetch_add(&bm.ycsb_keys, 1);
+    } else {
+      uint64_t rank = _zipf_next(bm.zipf, _bm_rand_double(ctx));
+      k = latest ? atomic_load(&bm.ycsb_keys) - 1 - rank : _zipf_scramble(rank) % bm.param_num;
+    }
+    snprintf(key.data, sizeof(kbuf), "%016d", k);
+    key.size = strlen(key.data);
+    val.data = 0;
+    val.size = 0;
+    if (read || wop == YCSB_RMW) {
+      bool ok = seek ? _bm_cursor_to_key(ctx, &key, &val, &found) : _bm_get(ctx, &key, &val, &found);
+      _val_dispose(&val);
+      if (!ok) {
+        return false;
+      }
+      if (read) {
+        continue;
+      }
+    }
+    val.data = (void *) _bmctx_rndbuf_nextptr(ctx, ctx->value_size);
+    val.size = ctx->value_size;
+    if (!_bm_put(ctx, &key, &val, false)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 static bool _bm_fillseq(BMCTX *ctx) {
   if (!ctx->freshdb) return false;
   return _do_write(ctx, true, false, false);
@@ -507,6 +819,36 @@ static bool _bm_seekrandom(BMCTX *ctx) {
   return _do_seek_random(ctx);
 }
 
+static bool _bm_ycsba(BMCTX *ctx) {
+  if (ctx->freshdb) return false;
+  return _do_ycsb(ctx, 50, YCSB_UPDATE, false, false);
+}
+
+static bool _bm_ycsbb(BMCTX *ctx) {
+  if (ctx->freshdb) return false;
+  return _do_ycsb(ctx, 95, YCSB_UPDATE, false, false);
+}
+
+static bool _bm_ycsbc(BMCTX *ctx) {
+  if (ctx->freshdb) return false;
+  return _do_ycsb(ctx, 100, YCSB_UPDATE, false, false);
+}
+
+static bool _bm_ycsbd(BMCTX *ctx) {
+  if (ctx->freshdb) return false;
+  return _do_ycsb(ctx, 95, YCSB_INSERT, true, false);
+}
+
+static bool _bm_ycsbe(BMCTX *ctx) {
+  if (ctx->freshdb) return false;
+  return _do_ycsb(ctx, 95, YCSB_INSERT, false, true);
+}
+
+static bool _bm_ycsbf(BMCTX *ctx) {
+  if (ctx->freshdb) return false;
+  return _do_ycsb(ctx, 50, YCSB_RMW, false, false);
+}
+
 static BMCTX *_bmctx_create(const char *name) {
   bench_method *method = 0;
   bool logdbsize = false;
@@ -556,6 +898,14 @@ static BMCTX *_bmctx_create(const char *name) {
     method = _bm_readhot;
   } else if (!strcmp(name, "seekrandom")) {
     method = _bm_seekrandom;
+  } else if (!strncmp(name, "ycsb", 4) && name[4] >= 'a' && name[4] <= 'f' && !name[5]) {
+    bench_method *ycsb[] = { _bm_ycsba, _bm_ycsbb, _bm_ycsbc, _bm_ycsbd, _bm_ycsbe, _bm_ycsbf };
+    method = ycsb[name[4] - 'a'];
+    logdbsize = (name[4] == 'd' || name[4] == 'e');
+    if (!bm.zipf) {
+      bm.zipf = malloc(sizeof(*bm.zipf));
+      _zipf_init(bm.zipf, bm.param_num, 0.99);
+    }
   } else {
     fprintf(stderr, "Unknown benchmark: '%s'\n", name);
     return 0;
@@ -564,7 +914,9 @@ static BMCTX *_bmctx_create(const char *name) {
   bmctx->name = strdup(name);
   bmctx->method = method;
   bmctx->num = bm.param_num;
+  bmctx->num_reads = bm.param_num_reads;
   bmctx->value_size = bm.param_value_size;
+  bmctx->lat = calloc(1, sizeof(*bmctx->lat));
   bmctx->freshdb = freshdb;
   bmctx->logdbsize = logdbsize;
   return bmctx;
@@ -593,6 +945,7 @@ static bool bm_bench_run(int argc, char *argv[]) {
           fprintf(stderr, "Failed to run benchmark: %s\n", bname);
         } else {
           fprintf(stderr, " done: %s in %ld\n", bname, (ctx->end_ms - ctx->start_ms));
+          _lat_report(ctx);
         }
         if (ctx->logdbsize) {
           _logdbsize(ctx);
@@ -55,6 +55,11 @@ runs += [{'b': 'fillrandom2', 'n': n, 'vz': vz, 'rs': 3434183568}
          for n in (int(10e3),)
          for vz in ((200 * 1024),)]
 
+runs += [{'b': 'fillrandom,ycsba,ycsbb,ycsbc,ycsbf,ycsbd,ycsbe', 'n': n, 'vz': vz, 't': t, 'rs': 1786225391}
+         for n in (int(1e6),)
+         for vz in (400,)
+         for t in (1, 4, 16)]
+
 tests = [
     'fillseq',
     'fillseq2',
@@ -70,11 +75,22 @@ tests = [
     'readrandom',
     'readmissing',
     'readhot',
-    'seekrandom'
+    'seekrandom',
+    'ycsba',
+    'ycsbb',
+    'ycsbc',
+    'ycsbd',
+    'ycsbe',
+    'ycsbf'
 ]
 
+percentiles = ('p50', 'p99', 'p999')
+
 results = OrderedDict()
 
+# Operation latencies: run key -> percentile -> engine -> 'benchmark op' -> microseconds
+latencies = OrderedDict()
+
 
 def fill_result(bm, run, sizestats, line):
     key = ' '.join(['-{} {}'.format(a, v) for a, v in run.items()])
@@ -84,6 +100,15 @@ def fill_result(bm, run, sizestats, line):
         results[key][bm] = OrderedDict()
     res = results[key][bm]
 
+    lval = parse('latency: {} {} ops: {} p50: {} p99: {} p999: {} us', line)
+    if lval:
+        print(line, flush=True)
+        for i, pct in enumerate(percentiles):
+            lres = latencies.setdefault(key, OrderedDict()).setdefault(
+                pct, OrderedDict()).setdefault(bm, OrderedDict())
+            lres['{} {}'.format(lval[0], lval[1])] = float(lval[3 + i])
+        return
+
     pval = parse('done: {} in {}', line)
     if sizestats:
         pval = parse('db size: {} ({})', line)
@@ -159,6 +184,23 @@ def main():
         save(p)
         # export_png(p, filename="{}.png".format(bn))
 
+    for bn, pmap in latencies.items():
+        for pct, rmap in pmap.items():
+            x = [(bm, bop) for bm in iter(rmap) for bop in iter(rmap[bm])]
+            pfactors = [f[1] for f in x]
+            counts = [rmap[bm][bop] for bm in iter(rmap) for bop in iter(rmap[bm])]
+            source = ColumnDataSource(data=dict(x=x, counts=counts))
+            p = figure(x_range=FactorRange(*x), plot_height=350, plot_width=1200,
+                       title='{} latency {}'.format(bn, pct), y_axis_type="log")
+            p.vbar(x='x', top='counts', bottom=0.01, width=0.9, source=source, line_color='white',
+                   fill_color=factor_cmap('x', palette=palette, factors=list(OrderedDict.fromkeys(pfactors)),
+                                          start=1, end=2))
+            p.yaxis.axis_label = 'Latency us'
+            p.x_range.range_padding = 0.1
+            p.xaxis.major_label_orientation = 1
+            p.xgrid.grid_line_color = None
+            plots.append(p)
+
     grid = gridplot(plots, ncols=1)
     # script, div = components(plots)
     output_file('runbench.html')
@@ -8,29 +8,29 @@ void iwkvd_trigger(bool val) {
 void iwkvd_kvblk(FILE *f, KVBLK *kb, int maxvlen) {
   assert(f && kb && kb->addr);
   uint8_t *mm, *vbuf;
-  const uint8_t *kbuf;
-  uint32_t klen, vlen;
-  IWFS_FSM *fsm = &kb->db->iwkv->fsm;
+  KVKEY k;
+  uint32_t vlen;
+  IWFS_FSM *fsm = &kb->db->file->fsm;
   blkn_t blkn = ADDR2BLK(kb->addr);
-  fprintf(f, "\n === KVBLK[%u] maxoff=%" PRIx64 ", zidx=%d, idxsz=%d, szpow=%u, flg=%x, db=%d\n",
-          blkn, kb->maxoff, kb->zidx, kb->idxsz, kb->szpow, kb->flags, kb->db->id);
+  fprintf(f, "\n === KVBLK[%u] maxoff=%" PRIx64 ", zidx=%d, idxsz=%d, szpow=%u, flg=%x, db=%d, pfx=%.*s\n",
+          blkn, kb->maxoff, kb->zidx, kb->idxsz, kb->szpow, kb->flags, kb->db->id, kb->pfxl, kb->pfx);
 
   iwrc rc = fsm->probe_mmap(fsm, 0, &mm, 0);
   if (rc) {
     iwlog_ecode_error3(rc);
     return;
   }
-  for (int i = 0; i < KVBLK_IDXNUM; ++i) {
+  for (int i = 0; i < kb->db->pnmax; ++i) {
     KVP *kvp = &kb->pidx[i];
-    rc = _kvblk_peek_key(kb, i, mm, &kbuf, &klen);
+    rc = _kvblk_peek_key(kb, i, mm, &k);
     if (rc) {
       iwlog_ecode_error3(rc);
       return;
     }
     _kvblk_peek_val(kb, i, mm, &vbuf, &vlen);
-    fprintf(f, "\n    %02d: [%04" PRIx64 ", %02u, %02d]: %.*s:%.*s",
+    fprintf(f, "\n    %02d: [%04" PRIx64 ", %02u, %02d]: %.*s%.*s:%.*s",
             i, kvp->off, kvp->len, kvp->ridx,
-            klen, kbuf, MIN(vlen, maxvlen), vbuf);
+            k.pfxl, k.pfx, k.len, k.buf, MIN(vlen, maxvlen), vbuf);
   }
   fprintf(f, "\n");
 }
@@ -42,9 +42,9 @@ iwrc iwkvd_sblk(FILE *f, IWLCTX *lx, SBLK *sb, int flags) {
   int lkl = 0;
   char lkbuf[SBLK_LKLEN + 1] = {0};
   uint8_t *mm, *vbuf;
-  const uint8_t *kbuf;
-  uint32_t klen, vlen;
-  IWFS_FSM *fsm = &sb->db->iwkv->fsm;
+  KVKEY k;
+  uint32_t vlen;
+  IWFS_FSM *fsm = &sb->db->file->fsm;
   blkn_t blkn = ADDR2BLK(sb->addr);
   iwrc rc = fsm->probe_mmap(fsm, 0, &mm, 0);
   if (rc) {
@@ -93,7 +93,7 @@ iwrc iwkvd_sblk(FILE *f, IWLCTX *lx, SBLK *sb, int flags) {
     if (j == 0) {
       fprintf(f, " === SBLK[%u]", blkn);
     }
-    rc = _kvblk_peek_key(sb->kvblk, sb->pi[i], mm, &kbuf, &klen);
+    rc = _kvblk_peek_key(sb->kvblk, sb->pi[i], mm, &k);
     if (rc) {
       iwlog_ecode_error3(rc);
       return rc;
@@ -101,31 +101,31 @@ iwrc iwkvd_sblk(FILE *f, IWLCTX *lx, SBLK *sb, int flags) {
     if (flags & IWKVD_PRINT_VALS) {
       _kvblk_peek_val(sb->kvblk, sb->pi[i], mm, &vbuf, &vlen);
       if (sb->db->dbflg & IWDB_UINT64_KEYS) {
-        uint64_t k;
-        memcpy(&k, kbuf, sizeof(k));
-        k = IW_ITOHLL(k);
-        fprintf(f, "    [%03d,%03d] %" PRIu64 ":%.*s", i, sb->pi[i], k, MIN(vlen, IWKVD_MAX_VALSZ), vbuf);
+        uint64_t llv;
+        memcpy(&llv, k.buf, sizeof(llv));
+        llv = IW_ITOHLL(llv);
+        fprintf(f, "    [%03d,%03d] %" PRIu64 ":%.*s", i, sb->pi[i], llv, MIN(vlen, IWKVD_MAX_VALSZ), vbuf);
       } else if (sb->db->dbflg & IWDB_UINT32_KEYS) {
-        uint32_t k;
-        memcpy(&k, kbuf, sizeof(k));
-        k = IW_ITOHL(k);
-        fprintf(f, "    [%03d,%03d] %u:%.*s", i, sb->pi[i], k, MIN(vlen, IWKVD_MAX_VALSZ), vbuf);
+        uint32_t lv;
+        memcpy(&lv, k.buf, sizeof(lv));
+        lv = IW_ITOHL(lv);
+        fprintf(f, "    [%03d,%03d] %u:%.*s", i, sb->pi[i], lv, MIN(vlen, IWKVD_MAX_VALSZ), vbuf);
       } else {
-        fprintf(f, "    [%03d,%03d] %.*s:%.*s", i, sb->pi[i], klen, kbuf, MIN(vlen, IWKVD_MAX_VALSZ), vbuf);
+        fprintf(f, "    [%03d,%03d] %.*s%.*s:%.*s", i, sb->pi[i], k.pfxl, k.pfx, k.len, k.buf, MIN(vlen, IWKVD_MAX_VALSZ), vbuf);
       }
     } else {
       if (sb->db->dbflg & IWDB_UINT64_KEYS) {
-        uint64_t k;
-        memcpy(&k, kbuf, sizeof(k));
-        k = IW_ITOHLL(k);
-        fprintf(f, "    [%03d,%03d] %" PRIu64, i, sb->pi[i], k);
+        uint64_t llv;
+        memcpy(&llv, k.buf, sizeof(llv));
+        llv = IW_ITOHLL(llv);
+        fprintf(f, "    [%03d,%03d] %" PRIu64, i, sb->pi[i], llv);
       } else if (sb->db->dbflg & IWDB_UINT32_KEYS) {
-        uint32_t k;
-        memcpy(&k, kbuf, sizeof(k));
-        k = IW_ITOHL(k);
-        fprintf(f, "    [%03d,%03d] %u", i, sb->pi[i], k);
+        uint32_t lv;
+        memcpy(&lv, k.buf, sizeof(lv));
+        lv = IW_ITOHL(lv);
+        fprintf(f, "    [%03d,%03d] %u", i, sb->pi[i], lv);
       } else {
-        fprintf(f, "    [%03d,%03d] %.*s", i, sb->pi[i], klen, kbuf);
+        fprintf(f, "    [%03d,%03d] %.*s%.*s", i, sb->pi[i], k.pfxl, k.pfx, k.len, k.buf);
       }
     }
   }
@@ -134,7 +134,7 @@ iwrc iwkvd_sblk(FILE *f, IWLCTX *lx, SBLK *sb, int flags) {
 }
 
 IWFS_FSM *iwkvd_fsm(IWKV kv) {
-  return &kv->fsm;
+  return &kv->files[0].fsm;
 }
 
 void iwkvd_db(FILE *f, IWDB db, int flags, int plvl) {
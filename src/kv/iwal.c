@@ -0,0 +1,653 @@
+//
+/**************************************************************************************************
+ * IOWOW library
+ *
+ * MIT License
+ *
+ * Copyright (c) 2012-2018 Softmotions Ltd <info@softmotions.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *************************************************************************************************/
+
+#include "iwal.h"
+#include "iwlog.h"
+#include "iwutils.h"
+#include "iwp.h"
+#include "iwcfg.h"
+#include <pthread.h>
+#include <time.h>
+
+// Size of record header: [crc:u4,len:u4]
+#define WAL_RHDR_SZ 8
+
+// Size of record fields after header: [op:u1,flags:u1,dbid:u4,klen:u4]
+#define WAL_RFIELDS_SZ 10
+
+// Default WAL size triggering checkpoint
+#define WAL_CHECKPOINT_BUFFER_SZ (64ULL * 1024 * 1024)
+
+// Default max time between checkpoints
+#define WAL_CHECKPOINT_TIMEOUT_SEC 300
+
+// Pending records buffer size triggering write to WAL file without sync
+#define WAL_MAX_BUFSZ (1024 * 1024)
+
+// Initial size of records buffer
+#define WAL_INI_BUFSZ (64 * 1024)
+
+// Size of page image record header: [crc:u4,len:u4,op:u1,flags:u1,dbid:u4,klen:u4,off:u8]
+#define WAL_PAGE_HDR_SZ (WAL_RHDR_SZ + WAL_RFIELDS_SZ + 8)
+
+// Max size of data of page image record
+#define WAL_PAGE_MAXSZ (1024 * 1024)
+
+// Number of page image records written at once
+#define WAL_PAGES_BATCH 32
+
+// Max storage file index of page image record
+#define WAL_PAGES_MAX_FIDX 0xffff
+
+struct IWAL {
+  IWFS_FILE file;             /**< WAL file */
+  pthread_mutex_t mtx;        /**< WAL state mutex */
+  pthread_cond_t cond;        /**< Signalled on completion of WAL file write */
+  pthread_cond_t cpt_cond;    /**< Checkpoint worker wakeup */
+  pthread_t cpt;              /**< Checkpoint worker thread */
+  IWAL_CHECKPOINT_FN cpfn;    /**< Checkpoint function */
+  void *opaq;                 /**< Opaque data of checkpoint function */
+  uint8_t *buf;               /**< Pending records buffer */
+  size_t bufsz;               /**< Size of records in `buf` */
+  size_t bufcap;              /**< Allocated size of `buf` */
+  uint8_t *wbuf;              /**< Buffer being written by flush leader */
+  size_t wbufcap;             /**< Allocated size of `wbuf` */
+  off_t fsize;                /**< WAL file size */
+  uint64_t lsn;               /**< End of the last added record (log sequence number) */
+  uint64_t slsn;              /**< Records up to this LSN are durable */
+  uint64_t cplsn;             /**< LSN of the last checkpoint */
+  uint64_t cpts;              /**< Time of the last checkpoint ms */
+  uint64_t checkpoint_buffer_sz;
+  uint64_t checkpoint_timeout_ms;
+  iwrc frc;                   /**< Sticky WAL file write error */
+  bool flushing;              /**< Flush leader is active */
+  bool cpt_started;           /**< Checkpoint worker started */
+  bool stop;                  /**< Checkpoint worker should stop */
+  bool replaying;             /**< Operation records are being replayed */
+  bool replayed;              /**< Storage reflects all records of log */
+};
+
+/** Visitor of valid WAL records, `roff` is offset of record in WAL file */
+typedef iwrc (*WAL_VISITOR)(off_t roff, iwal_op_t op, uint32_t dbid, uint8_t flags,
+                            const IWKV_val *key, const IWKV_val *val, void *ctx);
+
+/** Restore context of storage files */
+typedef struct WALRESTORE {
+  IWAL_REPLAY_FN pfn;
+  void *opaq;
+  off_t *ends;                /**< Offsets of the last `WOP_PAGES_END` records indexed by file */
+  uint32_t nends;             /**< Number of elements in `ends` */
+} WALRESTORE;
+
+/** Replay context of operation records */
+typedef struct WALREPLAY {
+  IWAL_REPLAY_FN rfn;
+  void *opaq;
+  uint64_t num;               /**< Number of replayed records */
+} WALREPLAY;
+
+static iwrc _wal_write(IWAL *wal, off_t off, const uint8_t *buf, size_t len) {
+  IWP_IOREQ req = {
+    .off = off,
+    .buf = (void *) buf,
+    .len = len
+  };
+  return wal->file.writev(&wal->file, &req, 1);
+}
+
+// Flush pending records to WAL file, `mtx` must be held.
+// Only one flush leader is active, other threads add records meanwhile.
+static iwrc _wal_flush_lk(IWAL *wal, bool sync) {
+  iwrc rc = 0;
+  uint8_t *tbuf;
+  size_t tcap, len = wal->bufsz;
+  uint64_t lsn = wal->lsn;
+  off_t off = wal->fsize;
+  assert(!wal->flushing);
+  wal->flushing = true;
+  tbuf = wal->wbuf;
+  tcap = wal->wbufcap;
+  wal->wbuf = wal->buf;
+  wal->wbufcap = wal->bufcap;
+  wal->buf = tbuf;
+  wal->bufcap = tcap;
+  wal->bufsz = 0;
+  wal->fsize += len;
+  pthread_mutex_unlock(&wal->mtx);
+
+  if (len) {
+    rc = _wal_write(wal, off, wal->wbuf, len);
+  }
+  if (!rc && sync) {
+    rc = wal->file.sync(&wal->file, IWFS_FDATASYNC);
+  }
+
+  pthread_mutex_lock(&wal->mtx);
+  wal->flushing = false;
+  if (rc) {
+    if (!wal->frc) {
+      wal->frc = rc;
+    }
+  } else if (sync) {
+    wal->slsn = lsn;
+  }
+  pthread_cond_broadcast(&wal->cond);
+  return rc;
+}
+
+static iwrc _wal_truncate_lk(IWAL *wal) {
+  IWFS_FILE_STATE fstate;
+  iwrc rc = wal->file.state(&wal->file, &fstate);
+  RCRET(rc);
+  rc = iwp_ftruncate(fstate.fh, 0);
+  RCRET(rc);
+  rc = wal->file.sync(&wal->file, 0);
+  RCRET(rc);
+  wal->fsize = 0;
+  return rc;
+}
+
+// Visit valid records of WAL file, `*oend` is set to the end of the last valid record
+static iwrc _wal_scan(IWAL *wal, WAL_VISITOR vfn, void *ctx, off_t *oend) {
+  iwrc rc = 0;
+  off_t off = 0;
+  size_t sp, bufsz = 0;
+  uint8_t *buf = 0, hdr[WAL_RHDR_SZ];
+  uint32_t crc, len, klen, dbid;
+  while (true) {
+    rc = wal->file.read(&wal->file, off, hdr, sizeof(hdr), &sp);
+    RCBREAK(rc);
+    if (sp < sizeof(hdr)) {
+      break;
+    }
+    memcpy(&crc, hdr, 4);
+    crc = IW_ITOHL(crc);
+    memcpy(&len, hdr + 4, 4);
+    len = IW_ITOHL(len);
+    if (len < WAL_RFIELDS_SZ || len > WAL_RFIELDS_SZ + IWAL_MAX_DATASZ) {
+      break;
+    }
+    if (bufsz < len) {
+      uint8_t *nbuf = realloc(buf, len);
+      if (!nbuf) {
+        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+        break;
+      }
+      buf = nbuf;
+      bufsz = len;
+    }
+    rc = wal->file.read(&wal->file, off + sizeof(hdr), buf, len, &sp);
+    RCBREAK(rc);
+    if (sp < len || iwu_crc32(buf, len, iwu_crc32(hdr + 4, 4, 0)) != crc) {
+      // Incomplete record at the end of log
+      break;
+    }
+    uint8_t *rp = buf;
+    iwal_op_t op = rp[0];
+    uint8_t flags = rp[1];
+    rp += 2;
+    memcpy(&dbid, rp, 4);
+    dbid = IW_ITOHL(dbid);
+    rp += 4;
+    memcpy(&klen, rp, 4);
+    klen = IW_ITOHL(klen);
+    rp += 4;
+    if (klen > len - WAL_RFIELDS_SZ) {
+      break;
+    }
+    IWKV_val key = {
+      .data = rp,
+      .size = klen
+    };
+    IWKV_val val = {
+      .data = rp + klen,
+      .size = len - WAL_RFIELDS_SZ - klen
+    };
+    rc = vfn(off, op, dbid, flags, &key, &val, ctx);
+    RCBREAK(rc);
+    off += sizeof(hdr) + len;
+  }
+  free(buf);
+  if (oend) {
+    *oend = off;
+  }
+  return rc;
+}
+
+static iwrc _wal_restore_ends_visitor(off_t roff, iwal_op_t op, uint32_t dbid, uint8_t flags,
+                                      const IWKV_val *key, const IWKV_val *val, void *ctx) {
+  WALRESTORE *r = ctx;
+  if (op != WOP_PAGES_END || dbid > WAL_PAGES_MAX_FIDX) {
+    return 0;
+  }
+  if (dbid >= r->nends) {
+    off_t *ends = realloc(r->ends, (dbid + 1) * sizeof(*ends));
+    if (!ends) {
+      return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    }
+    for (uint32_t i = r->nends; i <= dbid; ++i) {
+      ends[i] = -1;
+    }
+    r->ends = ends;
+    r->nends = dbid + 1;
+  }
+  r->ends[dbid] = roff;
+  return 0;
+}
+
+static iwrc _wal_restore_visitor(off_t roff, iwal_op_t op, uint32_t dbid, uint8_t flags,
+                                 const IWKV_val *key, const IWKV_val *val, void *ctx) {
+  WALRESTORE *r = ctx;
+  if ((op != WOP_PAGE && op != WOP_PAGES_END) || dbid >= r->nends) {
+    return 0;
+  }
+  // Images logged after the last complete set were never written in place
+  if (roff > r->ends[dbid] || (op == WOP_PAGES_END && roff != r->ends[dbid])) {
+    return 0;
+  }
+  if (key->size != sizeof(uint64_t)) {
+    iwrc rc = IWKV_ERROR_CORRUPTED;
+    iwlog_ecode_error3(rc);
+    return rc;
+  }
+  return r->pfn(op, dbid, flags, key, val, r->opaq);
+}
+
+static iwrc _wal_replay_visitor(off_t roff, iwal_op_t op, uint32_t dbid, uint8_t flags,
+                                const IWKV_val *key, const IWKV_val *val, void *ctx) {
+  WALREPLAY *r = ctx;
+  if (op == WOP_PAGE || op == WOP_PAGES_END) {
+    return 0;
+  }
+  ++r->num;
+  return r->rfn(op, dbid, flags, key, val, r->opaq);
+}
+
+static void *_wal_checkpoint_worker(void *op) {
+  IWAL *wal = op;
+  while (true) {
+    bool cpt = false;
+    uint64_t ts;
+    struct timespec tp;
+    pthread_mutex_lock(&wal->mtx);
+    if (wal->stop) {
+      pthread_mutex_unlock(&wal->mtx);
+      break;
+    }
+    iwp_current_time_ms(&ts);
+    if (wal->lsn > wal->cplsn) {
+      cpt = (wal->lsn - wal->cplsn >= wal->checkpoint_buffer_sz)
+            || (ts >= wal->cpts + wal->checkpoint_timeout_ms);
+    }
+    if (!cpt) {
+      uint64_t wts = wal->lsn > wal->cplsn ? wal->cpts + wal->checkpoint_timeout_ms : ts + wal->checkpoint_timeout_ms;
+      if (wts > ts + 1000) {
+        wts = ts + 1000;
+      }
+      clock_gettime(CLOCK_REALTIME, &tp);
+      uint64_t ns = tp.tv_nsec + (wts - ts) * 1000000ULL;
+      tp.tv_sec += ns / 1000000000ULL;
+      tp.tv_nsec = ns % 1000000000ULL;
+      pthread_cond_timedwait(&wal->cpt_cond, &wal->mtx, &tp);
+      pthread_mutex_unlock(&wal->mtx);
+      continue;
+    }
+    pthread_mutex_unlock(&wal->mtx);
+    iwrc rc = wal->cpfn(wal, wal->opaq);
+    if (rc) {
+      iwlog_ecode_error3(rc);
+      pthread_mutex_lock(&wal->mtx);
+      iwp_current_time_ms(&wal->cpts);
+      pthread_mutex_unlock(&wal->mtx);
+    }
+  }
+  return 0;
+}
+
+iwrc iwal_open(const char *path, const IWKV_WAL_OPTS *opts, bool trunc,
+               IWAL_REPLAY_FN pfn, void *opaq, IWAL **owal) {
+  iwrc rc = 0;
+  *owal = 0;
+  IWAL *wal = calloc(1, sizeof(*wal));
+  if (!wal) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  wal->checkpoint_buffer_sz = opts->checkpoint_buffer_sz ? opts->checkpoint_buffer_sz : WAL_CHECKPOINT_BUFFER_SZ;
+  wal->checkpoint_timeout_ms = 1000ULL * (opts->checkpoint_timeout_sec
+                                          ? opts->checkpoint_timeout_sec : WAL_CHECKPOINT_TIMEOUT_SEC);
+  pthread_mutex_init(&wal->mtx, 0);
+  pthread_cond_init(&wal->cond, 0);
+  pthread_cond_init(&wal->cpt_cond, 0);
+  wal->buf = malloc(WAL_INI_BUFSZ);
+  wal->wbuf = malloc(WAL_INI_BUFSZ);
+  if (!wal->buf || !wal->wbuf) {
+    rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    goto finish;
+  }
+  wal->bufcap = WAL_INI_BUFSZ;
+  wal->wbufcap = WAL_INI_BUFSZ;
+
+  IWFS_FILE_OPTS fopts = {
+    .path = path,
+    .omode = IWFS_OREAD | IWFS_OWRITE | IWFS_OCREATE | (trunc ? IWFS_OTRUNC : 0),
+    .lock_mode = IWP_WLOCK
+  };
+  rc = iwfs_file_open(&wal->file, &fopts);
+  RCGO(rc, finish);
+
+  if (!trunc) {
+    WALRESTORE r = {
+      .pfn = pfn,
+      .opaq = opaq
+    };
+    // New records are appended after valid ones
+    rc = _wal_scan(wal, _wal_restore_ends_visitor, &r, &wal->fsize);
+    if (!rc && r.nends && pfn) {
+      rc = _wal_scan(wal, _wal_restore_visitor, &r, 0);
+    }
+    free(r.ends);
+    RCGO(rc, finish);
+  }
+
+finish:
+  if (rc) {
+    iwal_close(&wal, false);
+  } else {
+    *owal = wal;
+  }
+  return rc;
+}
+
+iwrc iwal_start(IWAL *wal, IWAL_REPLAY_FN rfn, IWAL_CHECKPOINT_FN cpfn, void *opaq) {
+  iwrc rc = 0;
+  WALREPLAY r = {
+    .rfn = rfn,
+    .opaq = opaq
+  };
+  wal->cpfn = cpfn;
+  wal->opaq = opaq;
+  if (rfn && wal->fsize) {
+    wal->replaying = true;
+    rc = _wal_scan(wal, _wal_replay_visitor, &r, 0);
+    wal->replaying = false;
+    RCRET(rc);
+  }
+  iwp_current_time_ms(&wal->cpts);
+  if (r.num) {
+    // Database is synced by checkpoint function, then the log is truncated
+    rc = cpfn(wal, opaq);
+  } else {
+    pthread_mutex_lock(&wal->mtx);
+    rc = _wal_truncate_lk(wal);
+    pthread_mutex_unlock(&wal->mtx);
+  }
+  RCRET(rc);
+  wal->replayed = true;
+  int rci = pthread_create(&wal->cpt, 0, _wal_checkpoint_worker, wal);
+  if (rci) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  wal->cpt_started = true;
+  return 0;
+}
+
+iwrc iwal_add(IWAL *wal, iwal_op_t op, uint32_t dbid, uint8_t flags,
+              const IWKV_val *key, const IWKV_val *val, uint64_t *olsn) {
+  iwrc rc = 0;
+  uint32_t lv;
+  size_t klen = key ? key->size : 0;
+  size_t vlen = val ? val->size : 0;
+  size_t len = WAL_RFIELDS_SZ + klen + vlen;
+  if (len > WAL_RFIELDS_SZ + IWAL_MAX_DATASZ) {
+    return IWKV_ERROR_MAXKVSZ;
+  }
+  pthread_mutex_lock(&wal->mtx);
+  if (wal->replaying) {
+    *olsn = 0;
+    goto finish;
+  }
+  if (wal->frc) {
+    rc = wal->frc;
+    goto finish;
+  }
+  if (wal->bufsz + WAL_RHDR_SZ + len > wal->bufcap) {
+    size_t ncap = wal->bufcap;
+    while (ncap < wal->bufsz + WAL_RHDR_SZ + len) {
+      ncap *= 2;
+    }
+    uint8_t *nbuf = realloc(wal->buf, ncap);
+    if (!nbuf) {
+      rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      goto finish;
+    }
+    wal->buf = nbuf;
+    wal->bufcap = ncap;
+  }
+  uint8_t *sp = wal->buf + wal->bufsz;
+  uint8_t *wp = sp + 4;
+  lv = len;
+  lv = IW_HTOIL(lv);
+  memcpy(wp, &lv, 4);
+  wp += 4;
+  *wp++ = op;
+  *wp++ = flags;
+  lv = IW_HTOIL(dbid);
+  memcpy(wp, &lv, 4);
+  wp += 4;
+  lv = klen;
+  lv = IW_HTOIL(lv);
+  memcpy(wp, &lv, 4);
+  wp += 4;
+  if (klen) {
+    memcpy(wp, key->data, klen);
+    wp += klen;
+  }
+  if (vlen) {
+    memcpy(wp, val->data, vlen);
+    wp += vlen;
+  }
+  lv = iwu_crc32(sp + 4, len + 4, 0);
+  lv = IW_HTOIL(lv);
+  memcpy(sp, &lv, 4);
+  wal->bufsz += WAL_RHDR_SZ + len;
+  wal->lsn += WAL_RHDR_SZ + len;
+  *olsn = wal->lsn;
+  if (wal->lsn - wal->cplsn >= wal->checkpoint_buffer_sz) {
+    pthread_cond_signal(&wal->cpt_cond);
+  }
+  if (wal->bufsz >= WAL_MAX_BUFSZ && !wal->flushing) {
+    rc = _wal_flush_lk(wal, false);
+  }
+
+finish:
+  pthread_mutex_unlock(&wal->mtx);
+  return rc;
+}
+
+// Fill header of page image record with `op` and `off` key followed by `len` bytes of `data`
+static void _wal_page_hdr(uint8_t *hp, iwal_op_t op, uint32_t fidx, uint64_t off, const void *data, size_t len) {
+  uint32_t lv;
+  uint8_t *wp = hp + 4;
+  lv = WAL_PAGE_HDR_SZ - WAL_RHDR_SZ + len;
+  lv = IW_HTOIL(lv);
+  memcpy(wp, &lv, 4);
+  wp += 4;
+  *wp++ = op;
+  *wp++ = 0;
+  lv = IW_HTOIL(fidx);
+  memcpy(wp, &lv, 4);
+  wp += 4;
+  lv = sizeof(off);
+  lv = IW_HTOIL(lv);
+  memcpy(wp, &lv, 4);
+  wp += 4;
+  off = IW_HTOILL(off);
+  memcpy(wp, &off, sizeof(off));
+  lv = iwu_crc32(hp + 4, WAL_PAGE_HDR_SZ - 4, 0);
+  if (len) {
+    lv = iwu_crc32(data, len, lv);
+  }
+  lv = IW_HTOIL(lv);
+  memcpy(hp, &lv, 4);
+}
+
+iwrc iwal_add_pages(IWAL *wal, uint32_t fidx, const IWP_IOREQ *reqs, int num, off_t fsize) {
+  iwrc rc = 0;
+  int n = 0;
+  IWP_IOREQ iov[2 * WAL_PAGES_BATCH + 1];
+  uint8_t hdrs[WAL_PAGES_BATCH + 1][WAL_PAGE_HDR_SZ];
+  pthread_mutex_lock(&wal->mtx);
+  while (wal->flushing) {
+    pthread_cond_wait(&wal->cond, &wal->mtx);
+  }
+  // Images are written directly, pending records are flushed independently of them
+  off_t off = wal->fsize;
+  for (int i = 0; i < num; ++i) {
+    for (size_t pos = 0; pos < reqs[i].len; ) {
+      size_t len = MIN(reqs[i].len - pos, WAL_PAGE_MAXSZ);
+      uint8_t *data = (uint8_t *) reqs[i].buf + pos;
+      uint8_t *hp = hdrs[n / 2];
+      _wal_page_hdr(hp, WOP_PAGE, fidx, reqs[i].off + pos, data, len);
+      iov[n++] = (IWP_IOREQ) {
+        .off = off,
+        .buf = hp,
+        .len = WAL_PAGE_HDR_SZ
+      };
+      iov[n++] = (IWP_IOREQ) {
+        .off = off + WAL_PAGE_HDR_SZ,
+        .buf = data,
+        .len = len
+      };
+      off += WAL_PAGE_HDR_SZ + len;
+      pos += len;
+      if (n == 2 * WAL_PAGES_BATCH) {
+        rc = wal->file.writev(&wal->file, iov, n);
+        RCGO(rc, finish);
+        n = 0;
+      }
+    }
+  }
+  uint8_t *hp = hdrs[n / 2];
+  _wal_page_hdr(hp, WOP_PAGES_END, fidx, fsize, 0, 0);
+  iov[n++] = (IWP_IOREQ) {
+    .off = off,
+    .buf = hp,
+    .len = WAL_PAGE_HDR_SZ
+  };
+  off += WAL_PAGE_HDR_SZ;
+  rc = wal->file.writev(&wal->file, iov, n);
+  RCGO(rc, finish);
+  rc = wal->file.sync(&wal->file, IWFS_FDATASYNC);
+  RCGO(rc, finish);
+  wal->fsize = off;
+
+finish:
+  pthread_mutex_unlock(&wal->mtx);
+  return rc;
+}
+
+iwrc iwal_commit(IWAL *wal, uint64_t lsn) {
+  iwrc rc = 0;
+  pthread_mutex_lock(&wal->mtx);
+  while (wal->slsn < lsn) {
+    if (wal->frc) {
+      rc = wal->frc;
+      break;
+    }
+    if (wal->flushing) {
+      pthread_cond_wait(&wal->cond, &wal->mtx);
+      continue;
+    }
+    rc = _wal_flush_lk(wal, true);
+    RCBREAK(rc);
+  }
+  pthread_mutex_unlock(&wal->mtx);
+  return rc;
+}
+
+iwrc iwal_checkpoint(IWAL *wal) {
+  return wal->cpfn(wal, wal->opaq);
+}
+
+iwrc iwal_checkpoint_done(IWAL *wal) {
+  pthread_mutex_lock(&wal->mtx);
+  while (wal->flushing) {
+    pthread_cond_wait(&wal->cond, &wal->mtx);
+  }
+  // All records added so far are in the synced database file
+  wal->bufsz = 0;
+  wal->slsn = wal->lsn;
+  wal->cplsn = wal->lsn;
+  iwp_current_time_ms(&wal->cpts);
+  iwrc rc = _wal_truncate_lk(wal);
+  if (!rc) {
+    wal->frc = 0;
+  }
+  pthread_cond_broadcast(&wal->cond);
+  pthread_mutex_unlock(&wal->mtx);
+  return rc;
+}
+
+void iwal_shutdown(IWAL *wal) {
+  if (!wal->cpt_started) {
+    return;
+  }
+  pthread_mutex_lock(&wal->mtx);
+  wal->stop = true;
+  pthread_cond_broadcast(&wal->cpt_cond);
+  pthread_mutex_unlock(&wal->mtx);
+  pthread_join(wal->cpt, 0);
+  wal->cpt_started = false;
+}
+
+iwrc iwal_close(IWAL **walp, bool truncate) {
+  iwrc rc = 0;
+  IWAL *wal = *walp;
+  if (!wal) {
+    return 0;
+  }
+  iwal_shutdown(wal);
+  if (wal->file.impl) {
+    if (truncate && wal->replayed) {
+      pthread_mutex_lock(&wal->mtx);
+      while (wal->flushing) {
+        pthread_cond_wait(&wal->cond, &wal->mtx);
+      }
+      rc = _wal_truncate_lk(wal);
+      pthread_mutex_unlock(&wal->mtx);
+    }
+    IWRC(wal->file.close(&wal->file), rc);
+  }
+  pthread_cond_destroy(&wal->cpt_cond);
+  pthread_cond_destroy(&wal->cond);
+  pthread_mutex_destroy(&wal->mtx);
+  free(wal->buf);
+  free(wal->wbuf);
+  free(wal);
+  *walp = 0;
+  return rc;
+}
@@ -0,0 +1,162 @@
+#pragma once
+#ifndef IWAL_H
+#define IWAL_H
+
+/**************************************************************************************************
+ * IOWOW library
+ *
+ * MIT License
+ *
+ * Copyright (c) 2012-2018 Softmotions Ltd <info@softmotions.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *************************************************************************************************/
+
+/** @file
+ *  @brief Write ahead log of iwkv storage (internal API).
+ *
+ *  WAL record: [crc:u4,len:u4,op:u1,flags:u1,dbid:u4,klen:u4,key,value]
+ *  where `crc` is a checksum of all subsequent record bytes and `len`
+ *  is the size of record after `len` field.
+ *
+ *  Storage files are changed only by checkpoint (doublewrite): images of modified
+ *  file regions are appended to WAL and synced before they are written in place,
+ *  so file torn by crash during checkpoint is restored from them on open.
+ *  Operation records are replayed then on top of consistent storage.
+ */
+
+#include "iwkv.h"
+
+IW_EXTERN_C_START
+
+struct IWAL;
+typedef struct IWAL IWAL;
+
+/** WAL record operation */
+typedef enum {
+  WOP_PUT = 1,     /**< Put key/value: `flags` are `iwkv_opflags` */
+  WOP_DEL,         /**< Delete key */
+  WOP_DB_CREATE,   /**< Create database: `flags` are the first byte of `iwdb_flags_t`,
+                        optional one byte value holds the second byte */
+  WOP_DB_DESTROY,  /**< Destroy database */
+  WOP_BATCH,       /**< Batch of put/delete records applied at once: value is a sequence of
+                        [op:u1,flags:u1,dbid:u4,klen:u4,vlen:u4,key,value] records */
+  WOP_PAGE,        /**< Image of storage file region: `dbid` is file index,
+                        key is [off:u8] region offset, value is region data */
+  WOP_PAGES_END,   /**< Images of all modified regions of storage file `dbid` precede this record,
+                        key is [fsize:u8] file size. Images without it are not restored */
+} iwal_op_t;
+
+/** Max size of key+value data in WAL record */
+#define IWAL_MAX_DATASZ 0xfffffff
+
+/**
+ * @brief Replay visitor called for every valid record found in WAL file.
+ * @note `WOP_PAGE` and `WOP_PAGES_END` records are passed to restore visitor only.
+ */
+typedef iwrc(*IWAL_REPLAY_FN)(iwal_op_t op, uint32_t dbid, uint8_t flags,
+                              const IWKV_val *key, const IWKV_val *val, void *opaq);
+/**
+ * @brief Checkpoint function.
+ * @details Called when database file should be synced with disk.
+ *          Implementation must ensure no new records added to `wal`
+ *          until `iwal_checkpoint_done()` is called.
+ */
+typedef iwrc(*IWAL_CHECKPOINT_FN)(IWAL *wal, void *opaq);
+
+/**
+ * @brief Open WAL file and restore storage files from region images.
+ * @details Must be called before storage files are opened. Only images followed
+ *          by `WOP_PAGES_END` record of the same file are passed to `pfn`
+ *          in log order, the last `WOP_PAGES_END` record of every file is passed after them.
+ *
+ * @param path WAL file path
+ * @param opts WAL options
+ * @param trunc Truncate WAL file without restoring and replaying its records
+ * @param pfn Restore visitor of `WOP_PAGE` and `WOP_PAGES_END` records
+ * @param opaq Opaque data passed to `pfn`
+ * @param [out] owal WAL handler
+ */
+WUR iwrc iwal_open(const char *path, const IWKV_WAL_OPTS *opts, bool trunc,
+                   IWAL_REPLAY_FN pfn, void *opaq, IWAL **owal);
+
+/**
+ * @brief Replay operation records and start checkpoint worker.
+ * @details If any records replayed `cpfn` is called before return.
+ *          Records added while log is replayed are not logged again.
+ *
+ * @param rfn Replay visitor
+ * @param cpfn Checkpoint function
+ * @param opaq Opaque data passed to `rfn` and `cpfn`
+ */
+WUR iwrc iwal_start(IWAL *wal, IWAL_REPLAY_FN rfn, IWAL_CHECKPOINT_FN cpfn, void *opaq);
+
+/**
+ * @brief Append operation record to WAL buffer.
+ * @note Caller must hold a lock preventing concurrent modification of
+ *       the same key so records are ordered as applied.
+ *
+ * @param [out] olsn Log sequence number of added record, used by `iwal_commit()`
+ */
+WUR iwrc iwal_add(IWAL *wal, iwal_op_t op, uint32_t dbid, uint8_t flags,
+                  const IWKV_val *key, const IWKV_val *val, uint64_t *olsn);
+
+/**
+ * @brief Append images of storage file regions to WAL and sync it.
+ * @details Called before regions are written in place,
+ *          see `IWFS_EXT_OPTS::wbhook`.
+ *
+ * @param fidx Storage file index
+ * @param reqs Regions of storage file
+ * @param num Number of regions
+ * @param fsize Size of storage file after regions are written
+ */
+WUR iwrc iwal_add_pages(IWAL *wal, uint32_t fidx, const IWP_IOREQ *reqs, int num, off_t fsize);
+
+/**
+ * @brief Wait until records up to `lsn` are flushed to disk.
+ * @details Concurrent callers are served by a single `fdatasync` (group commit).
+ */
+WUR iwrc iwal_commit(IWAL *wal, uint64_t lsn);
+
+/**
+ * @brief Run checkpoint in the current thread.
+ */
+iwrc iwal_checkpoint(IWAL *wal);
+
+/**
+ * @brief Truncate WAL after database file is synced by checkpoint function.
+ */
+iwrc iwal_checkpoint_done(IWAL *wal);
+
+/**
+ * @brief Stop checkpoint worker.
+ * @details Must be called before acquiring of any lock used by checkpoint function.
+ */
+void iwal_shutdown(IWAL *wal);
+
+/**
+ * @brief Close WAL file and free resources.
+ * @param truncate Truncate WAL file, database file must be synced at this point.
+ *                 Log is never truncated if it was not replayed by `iwal_start()`
+ */
+iwrc iwal_close(IWAL **walp, bool truncate);
+
+IW_EXTERN_C_END
+#endif
@@ -1,13 +1,22 @@
 #include "iwkv.h"
+#include "iwal.h"
 #include "iwlog.h"
 #include "iwarr.h"
+#include "iwpool.h"
 #include "iwutils.h"
+#include "iwbits.h"
+#include "iwlz4.h"
 #include "iwfsmfile.h"
 #include "iwcfg.h"
 #include "khash.h"
 #include "ksort.h"
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
+#ifdef IW_TESTS
+#include <signal.h>
+#include <unistd.h>
+#endif
 
 // Hardcoded requirements (fixme)
 // CMakeLists.txt defines: -D_LARGEFILE_SOURCE=1 D_FILE_OFFSET_BITS=64
@@ -32,6 +41,9 @@ static_assert(sizeof(size_t) == 8, "sizeof(size_t) == 8 bytes");
 // Length of KV fsm header in bytes
 #define KVHDRSZ 255
 
+// Size of storage file dirty ranges tracking unit as power of 2
+#define IWKV_DIRTY_BPOW 16
+
 // [u1:flags,lvl:u1,lkl:u1,pnum:u1,p0:u4,kblk:u4,[pi0:u1,... pi32],n0-n23:u4,lk:u116]:u256 // SBLK
 
 // Number of skip list levels
@@ -54,6 +66,13 @@ static_assert(sizeof(size_t) == 8, "sizeof(size_t) == 8 bytes");
 // Number of `KV` blocks in KVBLK
 #define KVBLK_IDXNUM 32
 
+// Number of `KV` blocks in KVBLK of `IWDB_WIDE_NODES` database
+#define KVBLK_IDXNUM_MAX 64
+
+// Lower key length in SBLK of `IWDB_WIDE_NODES` database, the rest of lower key buffer
+// is used by slots `[KVBLK_IDXNUM, KVBLK_IDXNUM_MAX)` of `SBLK::pi`
+#define SBLK_WIDE_LKLEN (SBLK_LKLEN - (KVBLK_IDXNUM_MAX - KVBLK_IDXNUM))
+
 // Initial `KVBLK` size power of 2
 #define KVBLK_INISZPOW 9
 
@@ -66,10 +85,25 @@ static_assert(sizeof(size_t) == 8, "sizeof(size_t) == 8 bytes");
 // Max kvp len 0xfffffffULL bytes
 #define KVP_MAX_LEN_VLEN 5
 
-#define KVBLK_MAX_IDX_SZ ((KVP_MAX_OFF_VLEN + KVP_MAX_LEN_VLEN) * KVBLK_IDXNUM)
+#define KVBLK_MAX_IDX_SZ_N(pnmax_) ((KVP_MAX_OFF_VLEN + KVP_MAX_LEN_VLEN) * (pnmax_))
+
+// Max length of KVBLK keys prefix
+#define KVBLK_MAX_PFXLEN 64
+
+// Min length of KVBLK keys prefix worth to be stored
+#define KVBLK_MIN_PFXLEN 4
+
+// `idxsz` flag of KVBLK with keys prefix [pfxl:u1,pfx] stored before the index
+#define KVBLK_PFX_IDXSZ 0x8000U
 
-// Max non KV size [blen:u1,idxsz:u2,[ps1:vn,pl1:vn,...,ps63,pl63]
-#define KVBLK_MAX_NKV_SZ (KVBLK_HDRSZ + KVBLK_MAX_IDX_SZ)
+// Max non KV size [blen:u1,idxsz:u2,pfxl:u1,pfx,[ps1:vn,pl1:vn,...,ps63,pl63]
+#define KVBLK_MAX_NKV_SZ_N(pnmax_) (KVBLK_HDRSZ + 1 + KVBLK_MAX_PFXLEN + KVBLK_MAX_IDX_SZ_N(pnmax_))
+
+// Number of blocks in a single prefetch batch of sequentially scanning cursor
+#define CURSOR_PREFETCH_NUM 4
+
+// Number of block hops of cursor in one direction after which scan is treated as sequential
+#define CURSOR_PREFETCH_SEQ 2
 
 #define ADDR2BLK(addr_) ((addr_) >> IWKV_FSM_BPOW)
 
@@ -77,12 +111,19 @@ static_assert(sizeof(size_t) == 8, "sizeof(size_t) == 8 bytes");
 
 #ifdef IW_TESTS
 volatile int8_t iwkv_next_level = -1;
+// Process is killed when counter reaches zero: in the middle of SBLK split
+// after the new block and its upper neighbour are written and before lower blocks are
+volatile int32_t iwkv_kill_on_split = 0;
+// Process is killed when counter reaches zero: after images of modified regions
+// of storage file are logged and before they are written in place
+volatile int32_t iwkv_kill_on_writeback = 0;
 #endif
 
 atomic_bool g_trigger;
 
 struct IWKV;
 struct IWDB;
+struct IWSNAP;
 
 typedef uint32_t blkn_t;
 typedef uint32_t dbid_t;
@@ -111,18 +152,31 @@ typedef enum {
   RMKV_NO_RESIZE = 1 << 1
 } kvblk_rmkv_opts_t;
 
-/* KVBLK: [szpow:u1,idxsz:u2,[ps0:vn,pl0:vn,..., ps32,pl32]____[[KV],...]] */
+/* KVBLK: [szpow:u1,idxsz:u2,[pfxl:u1,pfx],[ps0:vn,pl0:vn,..., ps32,pl32]____[[KV],...]] */
 typedef struct KVBLK {
   IWDB db;
   off_t addr;                 /**< Block address */
   off_t maxoff;               /**< Max pair offset */
-  uint16_t idxsz;             /**< Size of KV pairs index in bytes */
+  uint16_t idxsz;             /**< Size of KV pairs index in bytes including keys prefix */
   int8_t zidx;                /**< Index of first empty pair slot (zero index), or -1 */
   uint8_t szpow;              /**< Block size as power of 2 */
+  uint8_t pfxl;               /**< Length of keys prefix, zero if block stores keys as is */
   kvblk_flags_t flags;        /**< Flags */
-  KVP pidx[KVBLK_IDXNUM];     /**< KV pairs index */
+  KVP pidx[KVBLK_IDXNUM_MAX]; /**< KV pairs index, `IWDB::pnmax` slots are used */
+  uint8_t pfx[KVBLK_MAX_PFXLEN]; /**< Keys prefix */
+  struct IWSNAP *snap;        /**< Snapshot the block is read from, zero if block is read from storage */
 } KVBLK;
 
+/* Key of KV pair: `pfx` prefix of KVBLK followed by `buf` stored in pair */
+typedef struct KVKEY {
+  const uint8_t *pfx;
+  const uint8_t *buf;
+  uint32_t pfxl;
+  uint32_t len;               /**< Length of `buf` */
+} KVKEY;
+
+#define KVKEY_SIZE(k_) ((k_).pfxl + (k_).len)
+
 typedef enum {
   SBLK_FULL_LKEY    = 1,       /**< The lowest `SBLK` key is fully contained in `SBLK`. Persistent flag. */
   SBLK_DB           = 1 << 3,  /**< This block is the start database block. */
@@ -139,46 +193,138 @@ typedef enum {
 
 #define IWDB_UINT_KEYS_FLAGS (IWDB_UINT32_KEYS | IWDB_UINT64_KEYS)
 
+// Keys of these databases are stored in `KVBLK` without prefix compression
+#define IWDB_NOPFX_KEYS_FLAGS (IWDB_UINT_KEYS_FLAGS | IWDB_CUSTOM_KEYS)
+
 // Number of top levels to cache (~ (1<<DBCACHE_LEVELS) cached elements)
 #define DBCACHE_LEVELS 10
 
 // Minimal cached level
 #define DBCACHE_MIN_LEVEL 5
 
+// Minimal cached level of adaptive cache
+#define DBCACHE_ADAPTIVE_MIN_LEVEL 1
+
+// Number of extra top levels kept in cache before dropping its lowest level
+#define DBCACHE_LVL_SLACK 1
+
 // Single allocation step - number of DBCNODEs
 #define DBCACHE_ALLOC_STEP 32
 
+// Length of lower key prefix stored in `DBCNODE`
+#define DBCNODE_PFXLEN 8
+
+// `DBCNODE::koff` of search node, key of node is `IWLCTX::key`
+#define DBCNODE_LXKEY UINT32_MAX
+
 /** Cached SBLK node */
 typedef struct DBCNODE {
   blkn_t sblkn;               /**< SBLK block number */
   blkn_t kblkn;               /**< KVBLK block number */
+  uint32_t koff;              /**< Offset of lower key in `DBCACHE::keys` if key is longer than prefix */
   uint8_t lkl;                /**< Lower key length */
   uint8_t fullkey;            /**< SBLK full key */
   uint8_t k0idx;              /**< KVBLK Zero KVP index */
-  uint8_t pad;                /**< 1 byte pad */
-  uint8_t lk[1];              /**< Lower key buffer */
+  uint8_t lvl;                /**< SBLK level */
+  uint8_t pfx[DBCNODE_PFXLEN]; /**< Lower key prefix, whole key of `IWDB_UINT_KEYS_FLAGS` databases */
 } DBCNODE;
 
-#define DBCNODE_NUM_SZ 20
-#define DBCNODE_STR_SZ 128
-
-static_assert(DBCNODE_NUM_SZ >= offsetof(DBCNODE, lk) + sizeof(uint64_t),
-              "DBCNODE_NUM_SZ >= offsetof(DBCNODE, lk) + sizeof(uint64_t)");
-static_assert(DBCNODE_STR_SZ >= offsetof(DBCNODE, lk) + SBLK_LKLEN,
-              "DBCNODE_STR_SZ >= offsetof(DBCNODE, lk) + SBLK_LKLEN");
+static_assert(sizeof(DBCNODE) == 24, "sizeof(DBCNODE) == 24");
 
 /** Tallest SBLK nodes cache */
 typedef struct DBCACHE {
   atomic_uint_least64_t atime;  /**< Cache access time */
-  size_t asize;                 /**< Size of allocated cache buffer */
+  size_t anum;                  /**< Number of allocated nodes */
   size_t num;                   /**< Actual number of nodes */
-  size_t nsize;                 /**< Cached node size */
+  size_t msize;                 /**< Cache memory size accounted in `IWKV::cache_msize` */
+  size_t ksize;                 /**< Size of allocated keys arena */
+  size_t kused;                 /**< Size of used part of keys arena */
+  size_t kfree;                 /**< Size of keys arena occupied by keys of removed or updated nodes */
   uint8_t lvl;                  /**< Lowes cached level */
-  bool open;                    /**< Is cache open */
+  atomic_bool open;             /**< Is cache open */
   DBCNODE *nodes;               /**< Sorted nodes array */
+  uint8_t *keys;                /**< Arena of lower keys longer than `DBCNODE_PFXLEN` */
+  uint64_t *ikeys;              /**< Dense array of nodes keys for `IWDB_UINT_KEYS_FLAGS` databases */
 } DBCACHE;
 
-/* Database: [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[24]:u4,c[24]:u4]:209 */
+// Number of `SBLK` latches of database is `2^DB_LATCH_POW`
+#define DB_LATCH_POW 6
+#define DB_LATCH_NUM (1U << DB_LATCH_POW)
+
+// Bits per key of negative lookups filter
+#define BLOOM_BPK 10
+
+// Number of bits set per key
+#define BLOOM_K 7
+
+// Log2 of min/max negative lookups filter size in bits
+#define BLOOM_MIN_BPOW 16
+#define BLOOM_MAX_BPOW 32
+
+// Log2 of filter block size in bits, all bits of key are set within single cache line
+#define BLOOM_BLK_BPOW 9
+
+// Persisted filter: [num:u8,crc:u4,pad,w:u8[]] where `w` starts at the next FSM block
+#define BLOOM_HDRSZ (1 << IWKV_FSM_BPOW)
+#define BLOOM_PSIZE(bpow_) (BLOOM_HDRSZ + (1ULL << (bpow_)) / 8)
+
+/** Block deallocation deferred until database snapshots are closed, see `SNAPSHOTS` section */
+typedef struct SFREE {
+  off_t addr;                 /**< Block address */
+  off_t len;                  /**< Block length, zero for chain of `SBLK` blocks started at `addr` */
+} SFREE;
+
+/** Negative lookups filter bits, see `BLOOM FILTER` section */
+typedef struct BLOOMBM {
+  struct BLOOMBM *prev;       /**< Replaced filter kept until database is released */
+  size_t cap;                 /**< Max number of keys before filter rebuild */
+  uint8_t bpow;               /**< Log2 of filter size in bits */
+  atomic_uint_fast64_t w[];   /**< Filter words */
+} BLOOMBM;
+
+// Number of stripes of database statistics counters
+#define DBSTATS_STRIPES 16
+
+/** Database statistics counter */
+typedef enum {
+  DBS_PUTS = 0,
+  DBS_GETS,
+  DBS_DELS,
+  DBS_CURSOR_STEPS,
+  DBS_LOOKUPS,
+  DBS_LOOKUP_HOPS,
+  DBS_CACHE_HITS,
+  DBS_CACHE_MISSES,
+  DBS_CACHE_REBUILDS,
+  DBS_SPLITS,
+  DBS_COMPACTIONS,
+  DBS_LOCK_WAITS,
+  DBS_LOCK_WAIT_NS,
+  DBS_RCACHE_HITS,
+  DBS_RCACHE_MISSES,
+  DBS_NUM
+} dbstat_t;
+
+/** Stripe of database statistics counters updated by a subset of threads, aggregated on read */
+typedef union DBSTATS {
+  struct {
+    atomic_uint_fast64_t c[DBS_NUM];  /**< Counters indexed by `dbstat_t` */
+    atomic_uint_fast32_t max_hops;    /**< Max number of `SBLK` hops of a single lookup */
+  };
+  uint8_t pad[128];                   /**< Keeps stripes on separate cache lines */
+} DBSTATS;
+
+// Number of stripes of optimistic readers counters
+#define OREADERS_STRIPES DBSTATS_STRIPES
+
+/** Stripe of number of running optimistic readers, see `_oreaders_enter()` */
+typedef union OREADERS {
+  atomic_uint num;
+  uint8_t pad[128];                   /**< Keeps stripes on separate cache lines */
+} OREADERS;
+
+/* Database: [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[24]:u4,c[24]:u4,bloom_blk:u4,bloom_bpow:u1,pnmax:u1,
+               keys:u1]:216 */
 struct IWDB {
   // SBH
   IWDB db;                    /**< Database ref */
@@ -186,6 +332,7 @@ struct IWDB {
   sblk_flags_t flags;         /**< Flags */
   // !SBH
   IWKV iwkv;
+  struct IWKV_FILE *file;     /**< Storage file of database blocks */
   DBCACHE cache;              /**< SBLK nodes cache */
   pthread_rwlock_t rwl;       /**< Database API RW lock */
   uint64_t next_db_addr;      /**< Next IWDB addr */
@@ -195,7 +342,29 @@ struct IWDB {
   volatile int32_t wk_count;  /**< Number of active database workers */
   iwdb_flags_t dbflg;         /**< Database specific flags */
   atomic_bool open;           /**< True if DB is in OPEN state */
+  atomic_uint_fast64_t wseq;  /**< Modification sequence [version:u32,writers:u32] used by optimistic readers */
+  IWDB_CACHE_OPTS cache_opts;           /**< Cache options */
+  atomic_uint_fast8_t cache_levels;     /**< Number of cached levels, changed by adaptive cache */
+  atomic_uint_fast64_t cache_hops;      /**< Adaptive cache: `SBLK` hops of lookups since last adjustment */
+  atomic_uint_fast32_t cache_lookups;   /**< Adaptive cache: lookups since last adjustment */
+  atomic_int leafw;           /**< Number of running leaf writers */
+  atomic_int pins;            /**< Number of readers which disabled leaf writers */
+  pthread_rwlock_t latches[DB_LATCH_NUM]; /**< `SBLK` latches of leaf writers, striped by block number */
+  _Atomic(BLOOMBM *) bloom;   /**< Negative lookups filter of `IWDB_BLOOM_FILTER` database, `0` if not open */
+  atomic_size_t bloom_num;    /**< Number of keys added to `bloom` */
   uint32_t lcnt[SLEVELS];     /**< SBLK count per level */
+  struct IWSNAP *snaps;       /**< Live snapshots, changed under database write lock */
+  SFREE *sfree;               /**< Deallocations deferred until all snapshots are closed */
+  size_t sfnum;               /**< Number of deferred deallocations */
+  size_t sfasz;               /**< Allocated number of `sfree` elements */
+  DBSTATS stats[DBSTATS_STRIPES]; /**< Runtime statistics, see `iwkv_db_stats()` */
+  bool numa;                  /**< Database memory is bound to `numa_node` */
+  uint16_t numa_node;         /**< NUMA node of database memory, see `iwkv_db_numa_bind()` */
+  atomic_uint ovl_threshold;  /**< Size threshold of out of line values of `IWDB_OVERFLOW_VALS` database */
+  uint8_t pnmax;              /**< Max number of kv pairs per `SBLK` node: `KVBLK_IDXNUM` or `KVBLK_IDXNUM_MAX` */
+  uint8_t lklen;              /**< Length of lower key stored in `SBLK` */
+  const struct KOPS *kops;    /**< Search routines specialized by key type, see `_db_kops_init()` */
+  const IWKV_KEY_CMP *kcmp;   /**< Comparator of `IWDB_CUSTOM_KEYS` database, zero if not registered */
 };
 
 /* Skiplist block: [u1:flags,lvl:u1,lkl:u1,pnum:u1,p0:u4,kblk:u4,[pi0:u1,... pi32],n0-n23:u4,lk:u116]:u256 // SBLK */
@@ -212,26 +381,76 @@ typedef struct SBLK {
   blkn_t kvblkn;              /**< Associated KVBLK block number */
   int8_t lkl;                 /**< Lower key length within a buffer */
   int8_t pnum;                /**< Number of active kv indexes in `SBLK::pi` */
-  int8_t pi[KVBLK_IDXNUM];    /**< Sorted KV slots, value is an index of kv slot in `KVBLK` */
+  int8_t pi[KVBLK_IDXNUM_MAX]; /**< Sorted KV slots, value is an index of kv slot in `KVBLK` */
   uint8_t lk[SBLK_LKLEN];     /**< Lower key buffer */
 } SBLK;
 
 KHASH_MAP_INIT_INT(DBS, IWDB)
 
-/** IWKV instance */
-struct IWKV {
+KHASH_MAP_INIT_INT64(SNAPM, uint8_t *)
+
+/** Database snapshot of snapshot cursor, see `SNAPSHOTS` section */
+typedef struct IWSNAP {
+  khash_t(SNAPM) *imgs;       /**< Images of blocks modified since snapshot creation by block address,
+                                   zero image marks a block allocated after snapshot creation */
+  iwrc rc;                    /**< Image capture error, snapshot is not usable if set */
+  struct IWSNAP *next;        /**< Next live snapshot of database */
+} IWSNAP;
+
+// Image of block at `addr` kept by snapshot, zero if block is not modified since snapshot creation
+IW_INLINE uint8_t *_snap_image(IWSNAP *snap, off_t addr) {
+  khiter_t k = kh_get(SNAPM, snap->imgs, addr);
+  return k != kh_end(snap->imgs) ? kh_value(snap->imgs, k) : 0;
+}
+
+/** Storage file, every file keeps its own chain of databases */
+typedef struct IWKV_FILE {
   IWFS_FSM fsm;               /**< FSM pool */
-  pthread_rwlock_t rwl;       /**< API RW lock */
   IWDB first_db;              /**< First database in chain */
   IWDB last_db;               /**< Last database in chain */
+  struct IWKV *iwkv;          /**< Storage of this file */
+  uint8_t *smm;               /**< Never moved mmaped area of file read by optimistic readers,
+                                   zero if not available, see `IWFS_FSM::stable_mmap` */
+  size_t smsize;              /**< Size of `smm` address space */
+} IWKV_FILE;
+
+/** State of `IWKV_SHARED` storage mmaped by writer and reader processes from `<path>-shm` file */
+typedef struct KVSHM {
+  atomic_uint_fast64_t wseq;  /**< Modification sequence [version:u32,writers:u32] of all databases */
+  atomic_uint_fast64_t gen;   /**< Generation of databases chains, odd while chains are modified */
+} KVSHM;
+
+/** IWKV instance */
+struct IWKV {
+  IWKV_FILE *files;           /**< Storage files: main file followed by `IWKV_OPTS::tspaces` */
+  uint16_t files_num;         /**< Number of storage files */
+  pthread_rwlock_t rwl;       /**< API RW lock */
   khash_t(DBS) *dbs;          /**< Database id -> IWDB mapping */
   iwkv_openflags oflags;      /**< Open flags */
   pthread_cond_t wk_cond;     /**< Workers cond variable */
   pthread_mutex_t wk_mtx;     /**< Workers cond mutext */
   volatile int32_t wk_count;  /**< Number of active workers */
   atomic_bool open;           /**< True if kvstore is in OPEN state */
+  IWAL *wal;                  /**< Write ahead log, `0` if WAL is not used */
+  IWDB_CACHE_OPTS dbcache_opts; /**< Default database cache options */
+  size_t cache_budget;        /**< Memory limit of adaptive database caches, `0` if unlimited */
+  atomic_size_t cache_msize;  /**< Memory used by all database caches */
+  const IWTRACE *trace;       /**< Tracing hooks, zero if not set */
+  IWKV_DISPOSE_OPTS dispose_opts; /**< Background disposal options of destroyed databases */
+  struct RCACHE *rcache;      /**< Hot records cache, zero if disabled */
+  KVSHM *shm;                 /**< Shared state of `IWKV_SHARED` storage, zero if not shared */
+  IWFS_EXT shm_file;          /**< File of shared state */
+  uint64_t shm_gen;           /**< Generation of databases chains loaded by reader process */
+  IWDB shm_stale;             /**< Databases destroyed by writer process, released on close */
+  const IWKV_KEY_CMP *key_cmps; /**< Comparators of `IWDB_CUSTOM_KEYS` databases */
+  uint16_t key_cmps_num;      /**< Number of `key_cmps` elements */
+  atomic_bool ostop;          /**< New optimistic readers are stopped, see `_oreaders_stop()` */
+  OREADERS oreaders[OREADERS_STRIPES]; /**< Running optimistic readers counted by thread stripes */
 };
 
+// Reader process of `IWKV_SHARED` storage
+#define SHM_READER(iwkv_) ((iwkv_)->shm && ((iwkv_)->oflags & IWKV_RDONLY))
+
 typedef enum {
   IWLCTX_PUT = 1,             /**< Put key value operation */
   IWLCTX_DEL = 1 << 1,        /**< Delete key operation */
@@ -243,10 +462,13 @@ typedef struct IWLCTX {
   uint64_t ts;                /**< Context creation timestamp ms */
   const IWKV_val *key;        /**< Search key */
   IWKV_val *val;              /**< Update value */
+  const IWKV_val *wval;       /**< Update value logged by WAL if it differs from encoded `val` */
   SBLK *lower;                /**< Next to upper bound block */
   SBLK *upper;                /**< Upper bound block */
   SBLK *nb;                   /**< New block */
   off_t upper_addr;           /**< Upper block address used in `_lx_del_lr()` */
+  off_t plower_addr;          /**< Lower block address of the last put, `0` if lower is a database block */
+  off_t pupper_addr;          /**< Upper block address of the last put, `0` if there is no upper block */
 #ifndef NDEBUG
   uint32_t num_cmps;
 #endif
@@ -256,20 +478,49 @@ typedef struct IWLCTX {
   uint8_t saan;               /**< Position of next free `SBLK` element in the `saa` area */
   uint8_t kaan;               /**< Position of next free `KVBLK` element in the `kaa` area */
   int8_t nlvl;                /**< Level of new inserted/deleted `SBLK` node. -1 if no new node inserted/deleted */
-  int8_t cache_reload;        /**< If true dbcache should be refreshed after operation */
   SBLK *plower[SLEVELS];      /**< Pinned lower nodes per level */
   SBLK *pupper[SLEVELS];      /**< Pinned upper nodes per level */
+  IWSNAP *snap;               /**< Snapshot blocks are read from, zero if context works with storage */
+  IWPOOL *pool;               /**< Pool of value copies returned to caller, zero to use heap */
   SBLK dblk;                  /**< First database block */
   SBLK saa[AANUM];            /**< `SBLK` allocation area */
   KVBLK kaa[AANUM];           /**< `KVBLK` allocation area */
 } IWLCTX;
 
+/** Key type of database */
+typedef enum {
+  KT_STR = 0,                 /**< Byte string keys */
+  KT_U32,                     /**< `IWDB_UINT32_KEYS` */
+  KT_U64,                     /**< `IWDB_UINT64_KEYS` */
+  KT_CUSTOM,                  /**< `IWDB_CUSTOM_KEYS` ordered by `IWDB::kcmp` */
+} ktype_t;
+
+/**
+ * @brief Skip list search routines of database.
+ * @details Every key type has its own copy of routines generated by `KOPS_IMPL()`
+ *          with comparator inlined, so search loops don't dispatch on database flags.
+ */
+typedef struct KOPS {
+  iwrc (*find_pi)(SBLK *sblk, const IWKV_val *key, const uint8_t *mm, bool *found, uint8_t *idxp);
+  iwrc (*insert_pi)(SBLK *sblk, uint8_t nidx, const IWKV_val *key, const uint8_t *mm, uint8_t *idxp);
+  iwrc (*roll_forward)(IWLCTX *lx, uint8_t lvl, uint32_t *hops);
+} KOPS;
+
+static void _db_kops_init(IWDB db);
+
 /** Cursor context */
 struct IWKV_cursor {
   SBLK *cn;                   /**< Current `SBLK` node */
   off_t dbaddr;               /**< Database address used as `cn` */
   uint8_t cnpos;              /**< Position in the current `SBLK` node */
+  uint8_t cnhi;               /**< The first position of `cn` with key less than `hi` */
+  uint8_t cnlo;               /**< The first position of `cn` with key less than `lo` */
   bool closed;                /**< Cursor closed */
+  bool bounded;               /**< Cursor is bounded by `[lo, hi)` keys range */
+  uint8_t pfop;               /**< Direction of the latest block hops: `IWKV_CURSOR_NEXT` or `IWKV_CURSOR_PREV` */
+  uint32_t pfhops;            /**< Number of block hops in `pfop` direction since positioning */
+  IWKV_val lo;                /**< The lowest key of cursor range, empty if not bounded below */
+  IWKV_val hi;                /**< Key next after cursor range, empty if not bounded above */
   IWLCTX lx;                  /**< Lookup context */
 };
 
@@ -279,11 +530,69 @@ static iwrc _dbcache_put_lw(IWLCTX *lx, SBLK *sblk);
 static void _dbcache_remove_lw(IWLCTX *lx, SBLK *sblk);
 static void _dbcache_update_lw(IWLCTX *lx, SBLK *sblk);
 static void _dbcache_destroy_lw(IWDB db);
+static void _dbcache_adapt(IWLCTX *lx, uint32_t hops);
+static void _bloom_destroy(IWDB db);
+static void _rcache_drop_db(IWKV iwkv, dbid_t dbid);
+static WUR iwrc _db_dispose_chain_bg(IWDB db, blkn_t sbn);
+static size_t _kvblk_ovl_ranges(const uint8_t *mm, size_t msize, blkn_t kblkn, uint8_t pnmax,
+                                IWFS_FSM_RANGE *ranges);
 
 void iwkvd_kvblk(FILE *f, KVBLK *kb, int maxvlen);
 iwrc iwkvd_sblk(FILE *f, IWLCTX *lx, SBLK *sb, int flags);
 void iwkvd_db(FILE *f, IWDB db, int flags, int plvl);
 
+static atomic_uint _dbstats_next;                 /**< Stripe assigned to the next new thread */
+static _Thread_local int _dbstats_stripe = -1;  /**< Stripe of striped counters used by current thread */
+
+IW_INLINE int _thread_stripe(void) {
+  if (_dbstats_stripe < 0) {
+    _dbstats_stripe = atomic_fetch_add_explicit(&_dbstats_next, 1, memory_order_relaxed) % DBSTATS_STRIPES;
+  }
+  return _dbstats_stripe;
+}
+
+IW_INLINE DBSTATS *_dbstats(IWDB db) {
+  return &db->stats[_thread_stripe()];
+}
+
+IW_INLINE void _dbstat_add(IWDB db, dbstat_t c, uint64_t v) {
+  atomic_fetch_add_explicit(&_dbstats(db)->c[c], v, memory_order_relaxed);
+}
+
+static void _dbstat_lookup(IWDB db, uint32_t hops, int cached) {
+  DBSTATS *s = _dbstats(db);
+  atomic_fetch_add_explicit(&s->c[DBS_LOOKUPS], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&s->c[DBS_LOOKUP_HOPS], hops, memory_order_relaxed);
+  if (cached > 0) {
+    atomic_fetch_add_explicit(&s->c[DBS_CACHE_HITS], 1, memory_order_relaxed);
+  } else if (cached == 0) {
+    atomic_fetch_add_explicit(&s->c[DBS_CACHE_MISSES], 1, memory_order_relaxed);
+  }
+  uint_fast32_t m = atomic_load_explicit(&s->max_hops, memory_order_relaxed);
+  while (hops > m
+         && !atomic_compare_exchange_weak_explicit(&s->max_hops, &m, hops,
+                                                   memory_order_relaxed, memory_order_relaxed));
+}
+
+// Acquire database RW lock accounting time spent waiting for it
+static int _db_rwl_lock(IWDB db, bool wr) {
+  uint64_t ts, te;
+  int rci = wr ? pthread_rwlock_trywrlock(&db->rwl) : pthread_rwlock_tryrdlock(&db->rwl);
+  if (rci != EBUSY) {
+    return rci;
+  }
+  iwp_monotonic_time_ns(&ts);
+  rci = wr ? pthread_rwlock_wrlock(&db->rwl) : pthread_rwlock_rdlock(&db->rwl);
+  if (!rci) {
+    iwp_monotonic_time_ns(&te);
+    DBSTATS *s = _dbstats(db);
+    atomic_fetch_add_explicit(&s->c[DBS_LOCK_WAITS], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->c[DBS_LOCK_WAIT_NS], te - ts, memory_order_relaxed);
+    IWTRACE_EMIT(db->iwkv->trace, IWTRACE_DB_LOCK_WAIT, ts, te, wr, db->id);
+  }
+  return rci;
+}
+
 #define ENSURE_OPEN(iwkv_) \
   if (!iwkv_ || !(iwkv_->open)) return IW_ERROR_INVALID_STATE
 
@@ -319,7 +628,7 @@ IW_INLINE iwrc _api_wlock(IWKV iwkv)  {
 #define API_DB_RLOCK(db_, rci_)                               \
   do {                                                        \
     API_RLOCK((db_)->iwkv, rci_);                             \
-    rci_ = pthread_rwlock_rdlock(&(db_)->rwl);                \
+    rci_ = _db_rwl_lock(db_, false);                          \
     if (rci_) {                                               \
       pthread_rwlock_unlock(&(db_)->iwkv->rwl);               \
       return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci_);  \
@@ -335,7 +644,7 @@ IW_INLINE iwrc _api_db_rlock(IWDB db)  {
 #define API_DB_WLOCK(db_, rci_)                               \
   do {                                                        \
     API_RLOCK((db_)->iwkv, rci_);                             \
-    rci_ = pthread_rwlock_wrlock(&(db_)->rwl);                \
+    rci_ = _db_rwl_lock(db_, true);                           \
     if (rci_) {                                               \
       pthread_rwlock_unlock(&(db_)->iwkv->rwl);               \
       return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci_);  \
@@ -355,6 +664,262 @@ IW_INLINE iwrc _api_db_wlock(IWDB db)  {
     API_UNLOCK((db_)->iwkv, rci_, rc_);                                   \
   } while(0)
 
+// Low 32 bits of `IWDB::wseq` is a number of writers modifying
+// database blocks in mmaped area, high bits is a modification version.
+#define WSEQ_WRITERS_MASK 0xffffffffULL
+
+// Modifications of `IWKV_SHARED` storage are also counted by `KVSHM::wseq`
+// checked by lookups of reader processes.
+
+IW_INLINE void _db_wseq_begin(IWDB db) {
+  atomic_fetch_add_explicit(&db->wseq, 1, memory_order_relaxed);
+  if (db->iwkv->shm) {
+    atomic_fetch_add_explicit(&db->iwkv->shm->wseq, 1, memory_order_relaxed);
+  }
+  atomic_thread_fence(memory_order_release);
+}
+
+IW_INLINE void _db_wseq_end(IWDB db) {
+  // Increment version and decrement number of writers
+  atomic_fetch_add_explicit(&db->wseq, WSEQ_WRITERS_MASK, memory_order_release);
+  if (db->iwkv->shm) {
+    atomic_fetch_add_explicit(&db->iwkv->shm->wseq, WSEQ_WRITERS_MASK, memory_order_release);
+  }
+}
+
+// Databases chain of `IWKV_SHARED` storage is modified,
+// reader processes reload chains when `KVSHM::gen` is changed
+IW_INLINE void _shm_chain_begin(IWKV iwkv) {
+  if (iwkv->shm) {
+    atomic_fetch_add_explicit(&iwkv->shm->gen, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&iwkv->shm->wseq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+  }
+}
+
+IW_INLINE void _shm_chain_end(IWKV iwkv) {
+  if (iwkv->shm) {
+    atomic_fetch_add_explicit(&iwkv->shm->wseq, WSEQ_WRITERS_MASK, memory_order_release);
+    atomic_fetch_add_explicit(&iwkv->shm->gen, 1, memory_order_release);
+  }
+}
+
+// Leaf writers modify a single `SBLK` and its `KVBLK` under database read lock
+// and exclusive `SBLK` latch. Readers of `KVBLK` data either take the latch of the block
+// in shared mode or pin database to disable leaf writers.
+
+IW_INLINE bool _db_leafw_enabled(IWDB db) {
+  // Out of line values are allocated and released under database write lock
+  return !(db->dbflg & (IWDB_DUP_FLAGS | IWDB_OVERFLOW_VALS));
+}
+
+// Set `SBLK` node fan-out and length of lower key according to `IWDB_WIDE_NODES` mode
+IW_INLINE void _db_pnmax_set(IWDB db) {
+  if (db->dbflg & IWDB_WIDE_NODES) {
+    db->pnmax = KVBLK_IDXNUM_MAX;
+    db->lklen = SBLK_WIDE_LKLEN;
+  } else {
+    db->pnmax = KVBLK_IDXNUM;
+    db->lklen = SBLK_LKLEN;
+  }
+}
+
+IW_INLINE pthread_rwlock_t *_db_latch(IWDB db, off_t addr) {
+  uint32_t h = ADDR2BLK(addr) * 2654435761U;
+  return &db->latches[h >> (32 - DB_LATCH_POW)];
+}
+
+// Disable leaf writers until `_db_unpin()` and wait for running ones
+static void _db_pin(IWDB db) {
+  atomic_fetch_add(&db->pins, 1);
+  while (atomic_load(&db->leafw)) {
+    sched_yield();
+  }
+}
+
+IW_INLINE void _db_unpin(IWDB db) {
+  atomic_fetch_sub(&db->pins, 1);
+}
+
+static WUR iwrc _db_latches_init(IWDB db) {
+  for (int i = 0; i < DB_LATCH_NUM; ++i) {
+    int rci = pthread_rwlock_init(&db->latches[i], 0);
+    if (rci) {
+      while (--i >= 0) {
+        pthread_rwlock_destroy(&db->latches[i]);
+      }
+      return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+    }
+  }
+  return 0;
+}
+
+static void _db_latches_destroy(IWDB db) {
+  for (int i = 0; i < DB_LATCH_NUM; ++i) {
+    pthread_rwlock_destroy(&db->latches[i]);
+  }
+}
+
+//--------------------------  SNAPSHOTS
+
+// Snapshot cursors read database as it was at the moment of their opening.
+// Writers keep images of database blocks before modifying them while snapshots are live
+// and defer deallocation of removed blocks, so a block is either the same as at snapshot
+// creation or has an image kept by snapshot. Snapshots are changed under database write lock
+// and read by their cursors under database read lock. Leaf writers are disabled by snapshot cursors.
+
+IW_INLINE void _snap_fail(IWDB db, iwrc rc) {
+  for (IWSNAP *s = db->snaps; s; s = s->next) {
+    if (!s->rc) {
+      s->rc = rc;
+    }
+  }
+}
+
+// Keep images of `[addr, addr + len)` block for live snapshots before block is modified
+static void _snap_keep(IWDB db, uint8_t *mm, off_t addr, off_t len) {
+  if (IW_LIKELY(!db->snaps)) {
+    return;
+  }
+  iwrc rc = 0;
+  uint8_t *amm = 0;
+  IWFS_FSM *fsm = &db->file->fsm;
+  for (IWSNAP *s = db->snaps; s; s = s->next) {
+    int ret;
+    if (s->rc) {
+      continue;
+    }
+    khiter_t k = kh_put(SNAPM, s->imgs, addr, &ret);
+    if (ret < 0) {
+      s->rc = IW_ERROR_ALLOC;
+      continue;
+    } else if (!ret) { // Block is already kept
+      continue;
+    }
+    if (!mm) {
+      rc = fsm->acquire_mmap(fsm, 0, &amm, 0);
+      if (rc) {
+        kh_del(SNAPM, s->imgs, k);
+        _snap_fail(db, rc);
+        break;
+      }
+      mm = amm;
+    }
+    uint8_t *img = malloc(len);
+    if (!img) {
+      kh_del(SNAPM, s->imgs, k);
+      s->rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      continue;
+    }
+    memcpy(img, mm + addr, len);
+    kh_value(s->imgs, k) = img;
+  }
+  if (amm) {
+    fsm->release_mmap(fsm);
+  }
+}
+
+// Mark block allocated while snapshots are live, its images are not needed
+static void _snap_fresh(IWDB db, off_t addr) {
+  for (IWSNAP *s = db->snaps; s; s = s->next) {
+    int ret;
+    khiter_t k = kh_put(SNAPM, s->imgs, addr, &ret);
+    if (ret > 0) {
+      kh_value(s->imgs, k) = 0;
+    }
+  }
+}
+
+// Deallocate database block or defer deallocation until live snapshots are closed.
+// If `len` is zero `addr` is the first block of detached `SBLK` chain.
+static WUR iwrc _db_deallocate(IWDB db, off_t addr, off_t len) {
+  IWFS_FSM *fsm = &db->file->fsm;
+  if (IW_UNLIKELY(db->snaps)) {
+    if (db->sfnum >= db->sfasz) {
+      size_t nsz = db->sfasz ? 2 * db->sfasz : 64;
+      SFREE *nsfree = realloc(db->sfree, nsz * sizeof(*nsfree));
+      if (nsfree) {
+        db->sfree = nsfree;
+        db->sfasz = nsz;
+      } else {
+        _snap_fail(db, iwrc_set_errno(IW_ERROR_ALLOC, errno));
+      }
+    }
+    if (db->sfnum < db->sfasz) {
+      db->sfree[db->sfnum].addr = addr;
+      db->sfree[db->sfnum].len = len;
+      db->sfnum++;
+      return 0;
+    }
+  }
+  if (!len) {
+    return _db_dispose_chain_bg(db, ADDR2BLK(addr));
+  }
+  return fsm->deallocate(fsm, addr, len);
+}
+
+// Open snapshot of `lx` database, called under database write lock
+static WUR iwrc _snap_open_lw(IWLCTX *lx) {
+  IWDB db = lx->db;
+  IWSNAP *snap = calloc(1, sizeof(*snap));
+  if (!snap) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  snap->imgs = kh_init(SNAPM);
+  if (!snap->imgs) {
+    free(snap);
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  snap->next = db->snaps;
+  db->snaps = snap;
+  lx->snap = snap;
+  return 0;
+}
+
+// Close snapshot of `lx` context, deferred deallocations are performed by the last snapshot closed
+static WUR iwrc _snap_close_lw(IWLCTX *lx) {
+  iwrc rc = 0;
+  IWDB db = lx->db;
+  IWSNAP *snap = lx->snap;
+  IWFS_FSM *fsm = &db->file->fsm;
+  for (IWSNAP **sp = &db->snaps; *sp; sp = &(*sp)->next) {
+    if (*sp == snap) {
+      *sp = snap->next;
+      break;
+    }
+  }
+  lx->snap = 0;
+  for (khiter_t k = kh_begin(snap->imgs); k != kh_end(snap->imgs); ++k) {
+    if (kh_exist(snap->imgs, k)) {
+      free(kh_value(snap->imgs, k));
+    }
+  }
+  kh_destroy(SNAPM, snap->imgs);
+  free(snap);
+  if (db->snaps) {
+    return 0;
+  }
+  for (size_t i = 0; i < db->sfnum; ++i) {
+    SFREE *f = &db->sfree[i];
+    if (f->len) {
+      IWRC(fsm->deallocate(fsm, f->addr, f->len), rc);
+    } else {
+      IWRC(_db_dispose_chain_bg(db, ADDR2BLK(f->addr)), rc);
+    }
+  }
+  db->sfnum = 0;
+  return rc;
+}
+
+// Block at `addr` as seen by `lx` context: snapshot image or storage
+IW_INLINE uint8_t *_lx_blk(IWLCTX *lx, uint8_t *mm, off_t addr) {
+  uint8_t *img;
+  if (IW_UNLIKELY(lx->snap) && (img = _snap_image(lx->snap, addr))) {
+    return img;
+  }
+  return mm + addr;
+}
+
 #define AAPOS_INC(aan_)         \
   do {                          \
     if ((aan_) < AANUM - 1) {   \
@@ -367,6 +932,8 @@ IW_INLINE iwrc _api_db_wlock(IWDB db)  {
 
 // SBLK
 // [u1:flags,lvl:u1,lkl:u1,pnum:u1,p0:u4,kblk:u4,[pi0:u1,... pi32],n0-n23:u4,lk:u116]:u256
+// SBLK of `IWDB_WIDE_NODES` database
+// [u1:flags,lvl:u1,lkl:u1,pnum:u1,p0:u4,kblk:u4,[pi0:u1,... pi32],n0-n23:u4,lk:u84,[pi32:u1,... pi64]]:u256
 
 #define SOFF_FLAGS_U1     0
 #define SOFF_LVL_U1       (SOFF_FLAGS_U1 + 1)
@@ -378,11 +945,18 @@ IW_INLINE iwrc _api_db_wlock(IWDB db)  {
 #define SOFF_N0_U4        (SOFF_PI0_U1 + 1 * KVBLK_IDXNUM)
 #define SOFF_LK           (SOFF_N0_U4 + 4 * SLEVELS + LKPAD)
 #define SOFF_END          (SOFF_LK + SBLK_LKLEN)
+#define SOFF_PI32_U1      (SOFF_LK + SBLK_WIDE_LKLEN)
 static_assert(SOFF_END == 256, "SOFF_END == 256");
+static_assert(SOFF_PI32_U1 + KVBLK_IDXNUM_MAX - KVBLK_IDXNUM == SOFF_END, "SBLK wide layout");
 static_assert(SBLK_SZ >= SOFF_END, "SBLK_SZ >= SOFF_END");
 
+// Offset of `idx` slot of `SBLK::pi` within `SBLK` block
+IW_INLINE off_t _sblk_pi_off(int idx) {
+  return idx < KVBLK_IDXNUM ? SOFF_PI0_U1 + idx : SOFF_PI32_U1 + idx - KVBLK_IDXNUM;
+}
+
 // DB
-// [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[24]:u4,c[24]:u4]:209
+// [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[24]:u4,c[24]:u4,bloom_blk:u4,bloom_bpow:u1,pnmax:u1]:215
 #define DOFF_MAGIC_U4     0
 #define DOFF_DBFLG_U1     (DOFF_MAGIC_U4 + 4)
 #define DOFF_DBID_U4      (DOFF_DBFLG_U1 + 1)
@@ -390,8 +964,12 @@ static_assert(SBLK_SZ >= SOFF_END, "SBLK_SZ >= SOFF_END");
 #define DOFF_P0_U4        (DOFF_NEXTDB_U4 + 4)
 #define DOFF_N0_U4        (DOFF_P0_U4 + 4)
 #define DOFF_C0_U4        (DOFF_N0_U4 + 4 * SLEVELS)
-#define DOFF_END          (DOFF_C0_U4 + 4 * SLEVELS)
-static_assert(DOFF_END == 209, "DOFF_END == 209");
+#define DOFF_BLOOM_U4     (DOFF_C0_U4 + 4 * SLEVELS)
+#define DOFF_BLOOMPOW_U1  (DOFF_BLOOM_U4 + 4)
+#define DOFF_PNMAX_U1     (DOFF_BLOOMPOW_U1 + 1)
+#define DOFF_KEYS_U1      (DOFF_PNMAX_U1 + 1)
+#define DOFF_END          (DOFF_KEYS_U1 + 1)
+static_assert(DOFF_END == 216, "DOFF_END == 216");
 static_assert(DB_SZ >= DOFF_END, "DB_SZ >= DOFF_END");
 
 
@@ -430,2942 +1008,8776 @@ IW_INLINE int _cmp_key(iwdb_flags_t dbflg, const void *v1, int v1len, const void
   }
 }
 
-IW_INLINE void _kv_val_dispose(IWKV_val *v) {
-  if (v) {
-    if (v->data) {
-      free(v->data);
-    }
-    v->size = 0;
-    v->data = 0;
+// Same as `_cmp_key()` for `k` key of KV pair.
+// KVBLK keys prefix has no zero bytes so it is compared separately from the rest of the key.
+IW_INLINE int _cmp_kvkey(iwdb_flags_t dbflg, const KVKEY *k, const void *v2, int v2len) {
+  if (!k->pfxl) {
+    return _cmp_key(dbflg, k->buf, k->len, v2, v2len);
   }
+  int kl = KVKEY_SIZE(*k);
+  int n = MIN(kl, v2len);
+  int rv = strncmp(v2, (const char *) k->pfx, MIN(k->pfxl, n));
+  if (!rv && n > k->pfxl) {
+    rv = strncmp((const char *) v2 + k->pfxl, (const char *) k->buf, n - k->pfxl);
+  }
+  return rv ? rv : v2len - kl;
 }
 
-IW_INLINE void _kv_dispose(IWKV_val *key, IWKV_val *val) {
-  _kv_val_dispose(key);
-  _kv_val_dispose(val);
+// Byte of `k` key at position `i`
+IW_INLINE uint8_t _kvkey_at(const KVKEY *k, uint32_t i) {
+  return i < k->pfxl ? k->pfx[i] : k->buf[i - k->pfxl];
 }
 
-void iwkv_val_dispose(IWKV_val *v) {
-  _kv_val_dispose(v);
+// Same as `_cmp_key()` for two keys of KV pairs
+static int _cmp_kvkeys(iwdb_flags_t dbflg, const KVKEY *k1, const KVKEY *k2) {
+  if (!k1->pfxl && !k2->pfxl) {
+    return _cmp_key(dbflg, k1->buf, k1->len, k2->buf, k2->len);
+  }
+  uint32_t kl1 = KVKEY_SIZE(*k1), kl2 = KVKEY_SIZE(*k2);
+  for (uint32_t i = 0, n = MIN(kl1, kl2); i < n; ++i) {
+    uint8_t c1 = _kvkey_at(k1, i);
+    uint8_t c2 = _kvkey_at(k2, i);
+    if (c1 != c2) {
+      return (int) c2 - (int) c1;
+    } else if (!c1) {
+      break;
+    }
+  }
+  return (int) kl2 - (int) kl1;
 }
 
-void iwkv_kv_dispose(IWKV_val *key, IWKV_val *val) {
-  _kv_dispose(key, val);
+// Copy at most `bufsz` first bytes of `k` key into `buf`
+IW_INLINE void _kvkey_copy(const KVKEY *k, uint8_t *buf, uint32_t bufsz) {
+  uint32_t l = MIN(bufsz, k->pfxl);
+  if (l) {
+    memcpy(buf, k->pfx, l);
+  }
+  if (bufsz > l) {
+    memcpy(buf + l, k->buf, MIN(bufsz - l, k->len));
+  }
 }
 
-IW_INLINE void _num2lebuf(uint8_t buf[static 8], void *numdata, int sz) {
-  assert(sz == 4 || sz == 8);
-  if (sz > 4) {
+// Integer key value of `IWDB_UINT_KEYS_FLAGS` database
+IW_INLINE uint64_t _uint_key(iwdb_flags_t dbflg, const void *k) {
+  if (dbflg & IWDB_UINT64_KEYS) {
     uint64_t llv;
-    memcpy(&llv, numdata, sizeof(llv));
-    llv = IW_HTOILL(llv);
-    memcpy(buf, &llv, sizeof(llv));
+    memcpy(&llv, k, sizeof(llv));
+    return IW_ITOHLL(llv);
   } else {
     uint32_t lv;
-    memcpy(&lv, numdata, sizeof(lv));
-    lv = IW_HTOIL(lv);
-    memcpy(buf, &lv, sizeof(lv));
+    memcpy(&lv, k, sizeof(lv));
+    return IW_ITOHL(lv);
   }
 }
 
-static int _u4cmp(const void *o1, const void *o2) {
-  uint32_t v1, v2;
-  memcpy(&v1, o1, sizeof(uint32_t));
-  memcpy(&v2, o2, sizeof(uint32_t));
-  v1 = IW_ITOHL(v1);
-  v2 = IW_ITOHL(v2);
-  if (v1 > v2) {
-    return 1;
-  } else if (v1 < v2) {
-    return -1;
-  } else {
-    return 0;
-  }
+// Size of integer key of `IWDB_UINT_KEYS_FLAGS` database
+IW_INLINE uint32_t _uint_key_size(iwdb_flags_t dbflg) {
+  return (dbflg & IWDB_UINT64_KEYS) ? sizeof(uint64_t) : sizeof(uint32_t);
 }
 
-static int _u8cmp(const void *o1, const void *o2) {
-  uint64_t v1, v2;
-  memcpy(&v1, o1, sizeof(uint64_t));
-  memcpy(&v2, o2, sizeof(uint64_t));
-  v1 = IW_ITOHLL(v1);
-  v2 = IW_ITOHLL(v2);
-  if (v1 > v2) {
-    return 1;
-  } else if (v1 < v2) {
-    return -1;
-  } else {
-    return 0;
-  }
+// Same as `_cmp_key()` for keys of `IWDB_CUSTOM_KEYS` database
+IW_INLINE int _cmp_ukey(IWDB db, const void *v1, int v1len, const void *v2, int v2len) {
+  return db->kcmp->cmp(v2, v2len, v1, v1len, db->kcmp->op);
 }
 
-//-------------------------- IWKV/IWDB WORKERS
+// Key type of `db` database
+IW_INLINE ktype_t _db_kt(IWDB db) {
+  iwdb_flags_t dbflg = db->dbflg;
+  return (dbflg & IWDB_CUSTOM_KEYS) ? KT_CUSTOM
+         : (dbflg & IWDB_UINT64_KEYS) ? KT_U64
+         : (dbflg & IWDB_UINT32_KEYS) ? KT_U32 : KT_STR;
+}
 
-static WUR iwrc _iwkv_worker_inc_nolk(IWKV iwkv) {
-  if (!iwkv || !iwkv->open) {
-    return IW_ERROR_INVALID_STATE;
-  }
-  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
-  if (rci) {
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
-  }
-  if (!iwkv->open) {
-    pthread_mutex_unlock(&iwkv->wk_mtx);
-    return IW_ERROR_INVALID_STATE;
-  }
-  ++iwkv->wk_count;
-  pthread_cond_broadcast(&iwkv->wk_cond);
-  pthread_mutex_unlock(&iwkv->wk_mtx);
-  return 0;
+// Flags of `_cmp_key()` for built-in key type `kt`
+IW_INLINE iwdb_flags_t _kt_dbflg(ktype_t kt) {
+  return kt == KT_U64 ? IWDB_UINT64_KEYS : kt == KT_U32 ? IWDB_UINT32_KEYS : 0;
 }
 
-static iwrc _iwkv_worker_dec_nolk(IWKV iwkv) {
-  if (!iwkv) {
-    return IW_ERROR_INVALID_STATE;
+// Same as `_cmp_key()` for keys of type `kt`, comparator is selected at compile time for constant `kt`
+IW_INLINE int _kt_cmp_key(IWDB db, ktype_t kt, const void *v1, int v1len, const void *v2, int v2len) {
+  if (kt == KT_CUSTOM) {
+    return _cmp_ukey(db, v1, v1len, v2, v2len);
   }
-  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
-  if (rci) {
-    // Last chanсe to be safe
-    --iwkv->wk_count;
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  return _cmp_key(_kt_dbflg(kt), v1, v1len, v2, v2len);
+}
+
+// Same as `_cmp_kvkey()` for keys of type `kt`
+IW_INLINE int _kt_cmp_kvkey(IWDB db, ktype_t kt, const KVKEY *k, const void *v2, int v2len) {
+  if (kt == KT_CUSTOM) {
+    assert(!k->pfxl);
+    return _cmp_ukey(db, k->buf, k->len, v2, v2len);
   }
-  --iwkv->wk_count;
-  pthread_cond_broadcast(&iwkv->wk_cond);
-  pthread_mutex_unlock(&iwkv->wk_mtx);
-  return 0;
+  return _cmp_kvkey(_kt_dbflg(kt), k, v2, v2len);
 }
 
-static WUR iwrc _db_worker_inc_nolk(IWDB db) {
-  if (!db || !db->iwkv || !db->iwkv->open || !db->open) {
-    return IW_ERROR_INVALID_STATE;
+// Same as `_cmp_key()` for keys of `db`
+IW_INLINE int _db_cmp_key(IWDB db, const void *v1, int v1len, const void *v2, int v2len) {
+  return _kt_cmp_key(db, _db_kt(db), v1, v1len, v2, v2len);
+}
+
+// Same as `_cmp_kvkey()` for keys of `db`
+IW_INLINE int _db_cmp_kvkey(IWDB db, const KVKEY *k, const void *v2, int v2len) {
+  return _kt_cmp_kvkey(db, _db_kt(db), k, v2, v2len);
+}
+
+// Same as `_cmp_kvkeys()` for keys of `db`
+static int _db_cmp_kvkeys(IWDB db, const KVKEY *k1, const KVKEY *k2) {
+  if (db->dbflg & IWDB_CUSTOM_KEYS) {
+    assert(!k1->pfxl && !k2->pfxl);
+    return _cmp_ukey(db, k1->buf, k1->len, k2->buf, k2->len);
   }
-  IWKV iwkv = db->iwkv;
-  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
-  if (rci) {
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
-  }
-  if (!iwkv->open || !db->open) {
-    pthread_mutex_unlock(&iwkv->wk_mtx);
-    return IW_ERROR_INVALID_STATE;
-  }
-  ++iwkv->wk_count;
-  ++db->wk_count;
-  pthread_cond_broadcast(&iwkv->wk_cond);
-  pthread_mutex_unlock(&iwkv->wk_mtx);
-  return 0;
+  return _cmp_kvkeys(db->dbflg, k1, k2);
 }
 
-static iwrc _db_worker_dec_nolk(IWDB db) {
-  if (!db || !db->iwkv) { // do not use ENSURE_OPEN_DB here
-    return IW_ERROR_INVALID_STATE;
-  }
-  IWKV iwkv = db->iwkv;
-  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
-  if (rci) {
-    // Last chanсe to be safe
-    --iwkv->wk_count;
-    --db->wk_count;
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+IW_INLINE void _kv_val_dispose(IWKV_val *v) {
+  if (v) {
+    if (v->data) {
+      free(v->data);
+    }
+    v->size = 0;
+    v->data = 0;
   }
-  --iwkv->wk_count;
-  --db->wk_count;
-  pthread_cond_broadcast(&iwkv->wk_cond);
-  pthread_mutex_unlock(&iwkv->wk_mtx);
-  return 0;
 }
 
-static WUR iwrc _wnw_iwkw_wl(IWKV iwkv) {
-  int rci = pthread_rwlock_wrlock(&iwkv->rwl);
-  if (rci) {
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
-  }
-  return 0;
+IW_INLINE void _kv_dispose(IWKV_val *key, IWKV_val *val) {
+  _kv_val_dispose(key);
+  _kv_val_dispose(val);
 }
 
-static WUR iwrc _wnw_db_wl(IWDB db) {
-  int rci = pthread_rwlock_wrlock(&db->rwl);
-  if (rci) {
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
-  }
-  return 0;
+// Allocate memory of key/value copy from `pool` or from heap if `pool` is zero
+IW_INLINE void *_kv_alloc(IWPOOL *pool, size_t size) {
+  return pool ? iwpool_alloc(size, pool) : malloc(size);
 }
 
-static WUR iwrc _wnw(IWKV iwkv, iwrc(*after)(IWKV iwkv)) {
-  iwrc rc = 0;
-  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
-  if (rci) {
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
-  }
-  while (iwkv->wk_count > 0) {
-    pthread_cond_wait(&iwkv->wk_cond, &iwkv->wk_mtx);
-  }
-  if (after) {
-    rc = after(iwkv);
-  }
-  rci = pthread_mutex_unlock(&iwkv->wk_mtx);
-  if (rci) {
-    IWRC(iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci), rc);
+// Dispose key/value copy allocated by `_kv_alloc()`
+IW_INLINE void _kv_val_release(IWPOOL *pool, IWKV_val *v) {
+  if (pool) {
+    v->data = 0;
+    v->size = 0;
+  } else {
+    _kv_val_dispose(v);
   }
-  return rc;
 }
 
-static WUR iwrc _wnw_db(IWDB db, iwrc(*after)(IWDB db)) {
-  iwrc rc = 0;
-  IWKV iwkv = db->iwkv;
-  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
-  if (rci) {
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+static pthread_key_t _scratch_key;
+static pthread_once_t _scratch_once = PTHREAD_ONCE_INIT;
+static _Thread_local IWPOOL *_scratch;
+
+static void _scratch_destroy(void *op) {
+  iwpool_destroy(op);
+}
+
+static void _scratch_key_create(void) {
+  pthread_key_create(&_scratch_key, _scratch_destroy);
+}
+
+// Thread local pool for transient key/value copies released before return to user,
+// zero if pool cannot be allocated
+static IWPOOL *_scratch_pool(void) {
+  if (!_scratch) {
+    pthread_once(&_scratch_once, _scratch_key_create);
+    _scratch = iwpool_create(4096);
+    if (_scratch) {
+      pthread_setspecific(_scratch_key, _scratch);
+    }
   }
-  while (db->wk_count > 0) {
-    pthread_cond_wait(&iwkv->wk_cond, &iwkv->wk_mtx);
+  return _scratch;
+}
+
+void iwkv_val_dispose(IWKV_val *v) {
+  _kv_val_dispose(v);
+}
+
+//--------------------------  VALUES COMPRESSION
+
+// Values of `IWDB_COMPRESSED` database: [usz:vn,data] where `usz` is size of LZ4 compressed
+// `data` after decompression or zero if `data` is stored as is.
+
+// Min size of compressed value
+#define COMPRESS_MINSZ 128
+
+/**
+ * @brief Encode value of `IWDB_COMPRESSED` database.
+ * @details Value is compressed only if it saves at least 1/16 of its size.
+ * @param [out] oval Encoded value, must be disposed by caller
+ */
+static WUR iwrc _db_val_pack(const IWKV_val *val, IWKV_val *oval) {
+  int sp;
+  size_t csz = 0;
+  size_t cap = val->size >= COMPRESS_MINSZ ? val->size - val->size / 16 : 0;
+  size_t hsz = IW_VNUMSIZE(val->size);
+  uint8_t *buf = malloc(hsz + val->size);
+  if (!buf) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
   }
-  if (after) {
-    rc = after(db);
+  if (cap > hsz) {
+    csz = iwlz4_compress(val->data, val->size, buf + hsz, cap - hsz);
   }
-  rci = pthread_mutex_unlock(&iwkv->wk_mtx);
-  if (rci) {
-    IWRC(iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci), rc);
+  if (csz) {
+    IW_SETVNUMBUF(sp, buf, val->size);
+    assert(sp == hsz);
+    oval->size = hsz + csz;
+  } else {
+    buf[0] = 0;
+    if (val->size) {
+      memcpy(buf + 1, val->data, val->size);
+    }
+    oval->size = 1 + val->size;
   }
-  return rc;
+  oval->data = buf;
+  return 0;
 }
 
-//--------------------------  DB
-
-static WUR iwrc _db_at(IWKV iwkv, IWDB *dbp, off_t addr, uint8_t *mm) {
-  iwrc rc = 0;
-  uint8_t *rp;
-  uint32_t lv;
-  int rci;
-  IWDB db = calloc(1, sizeof(struct IWDB));
-  *dbp = 0;
-  if (!db) {
-    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+/**
+ * @brief Decode stored value of `IWDB_COMPRESSED` database into allocated @a oval.
+ */
+static WUR iwrc _db_val_unpack(const uint8_t *rp, size_t len, IWKV_val *oval, IWPOOL *pool) {
+  int32_t usz;
+  int step;
+  oval->data = 0;
+  oval->size = 0;
+  if (!len) {
+    return 0;
   }
-  rci = pthread_rwlock_init(&db->rwl, 0);
-  if (rci) {
-    free(db);
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  IW_READVNUMBUF(rp, usz, step);
+  if (usz < 0 || step > len) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
   }
-  // [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[30]:u4,c[30]:u8]:u377
-  db->flags = SBLK_DB;
-  db->addr = addr;
-  db->db = db;
-  db->iwkv = iwkv;
-  rp = mm + addr;
-  IW_READLV(rp, lv, lv);
-  if (lv != IWDB_MAGIC) {
-    rc = IWKV_ERROR_CORRUPTED;
-    iwlog_ecode_error3(rc);
-    goto finish;
+  rp += step;
+  len -= step;
+  size_t sz = usz ? usz : len;
+  if (!sz) {
+    return 0;
   }
-  IW_READBV(rp, lv, db->dbflg);
-  IW_READLV(rp, lv, db->id);
-  IW_READLV(rp, lv, db->next_db_addr);
-  db->next_db_addr = BLK2ADDR(db->next_db_addr); // blknum -> addr
-  rp = mm + addr + DOFF_C0_U4;
-  for (int i = 0; i < SLEVELS; ++i) {
-    IW_READLV(rp, lv, db->lcnt[i]);
+  uint8_t *buf = _kv_alloc(pool, sz);
+  if (!buf) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
   }
-  db->open = true;
-  *dbp = db;
-finish:
-  if (rc)  {
-    pthread_rwlock_destroy(&db->rwl);
-    free(db);
+  if (usz) {
+    if (iwlz4_decompress(rp, len, buf, sz)) {
+      if (!pool) {
+        free(buf);
+      }
+      iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+      return IWKV_ERROR_CORRUPTED;
+    }
+  } else {
+    memcpy(buf, rp, sz);
   }
-  return rc;
+  oval->data = buf;
+  oval->size = sz;
+  return 0;
 }
 
-static void _db_save(IWDB db, uint8_t *mm) {
-  uint32_t lv;
-  uint8_t *wp = mm + db->addr;
-  db->next_db_addr = db->next ? db->next->addr : 0;
-  // [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n0-n29:u4]
-  IW_WRITELV(wp, lv, IWDB_MAGIC);
-  IW_WRITEBV(wp, lv, db->dbflg);
-  IW_WRITELV(wp, lv, db->id);
-  IW_WRITELV(wp, lv, ADDR2BLK(db->next_db_addr));
+// Decode value fetched from `IWDB_COMPRESSED` database in place
+static WUR iwrc _db_val_decode(IWDB db, IWKV_val *val, IWPOOL *pool) {
+  if (!(db->dbflg & IWDB_COMPRESSED) || !val->size) {
+    return 0;
+  }
+  IWKV_val uval;
+  iwrc rc = _db_val_unpack(val->data, val->size, &uval, pool);
+  RCRET(rc);
+  _kv_val_release(pool, val);
+  *val = uval;
+  return 0;
 }
 
-static WUR iwrc _db_load_chain(IWKV iwkv, off_t addr, uint8_t *mm) {
-  iwrc rc;
-  int rci;
-  IWDB db = 0, ndb;
-  if (!addr) return 0;
-  do {
-    rc = _db_at(iwkv, &ndb, addr, mm);
-    RCRET(rc);
-    if (db) {
-      db->next = ndb;
-      ndb->prev = db;
-    } else {
-      iwkv->first_db = ndb;
-    }
-    db = ndb;
-    addr = db->next_db_addr;
-    iwkv->last_db = db;
-    khiter_t k = kh_put(DBS, iwkv->dbs, db->id, &rci);
-    if (rci != -1) {
-      kh_value(iwkv->dbs, k) = db;
-    } else {
-      rc = IW_ERROR_FAIL;
-      return rc;
-    }
-  } while (db->next_db_addr);
-  return rc;
-}
+//--------------------------  OUT OF LINE VALUES
 
-static void _db_release_lw(IWDB *dbp) {
-  assert(dbp && *dbp);
-  _dbcache_destroy_lw(*dbp);
-  pthread_rwlock_destroy(&(*dbp)->rwl);
-  free(*dbp);
-  *dbp = 0;
+// Values of `IWDB_OVERFLOW_VALS` database: [OVL_INLINE:u1,data] stored in `KVBLK` as is
+// or [OVL_EXTENT:u1,blkn:u4,len:u4] stored out of line in extent of `len` bytes at `blkn` block.
+// Extents are never modified in place, updated value is written into a new extent.
+
+#define OVL_INLINE 0
+#define OVL_EXTENT 1
+#define OVL_STUB_SZ 9
+
+#define OVL_EXTENT_SZ(len_) IW_ROUNDUP((off_t) (len_), 1ULL << IWKV_FSM_BPOW)
+
+// Read extent reference of stored value `[vp, vp + vl)`, returns `false` if value is stored inline
+IW_INLINE bool _ovl_extent(const uint8_t *vp, uint32_t vl, off_t *oaddr, uint32_t *olen) {
+  uint32_t lv;
+  if (vl != OVL_STUB_SZ || vp[0] != OVL_EXTENT) {
+    return false;
+  }
+  memcpy(&lv, vp + 1, 4);
+  *oaddr = BLK2ADDR(IW_ITOHL(lv));
+  memcpy(&lv, vp + 5, 4);
+  *olen = IW_ITOHL(lv);
+  return true;
 }
 
-typedef struct DISPOSE_DB_CTX {
-  IWKV iwkv;
-  IWDB *dbp;
-  blkn_t sbn; // First `SBLK` block in DB
-  pthread_t thr;
-} DISPOSE_DB_CTX;
+// Point `*vp` and `*vl` to data of value stored at `*vp` within mmaped area `mm` of `msize` bytes.
+// Returns `false` if value is malformed.
+IW_INLINE bool _ovl_locate(const uint8_t *mm, size_t msize, const uint8_t **vp, uint32_t *vl) {
+  off_t addr;
+  uint32_t len;
+  if (!*vl) {
+    return true;
+  }
+  if ((*vp)[0] == OVL_INLINE) {
+    ++*vp;
+    --*vl;
+    return true;
+  }
+  if (!_ovl_extent(*vp, *vl, &addr, &len) || !addr || addr + len > msize) {
+    return false;
+  }
+  *vp = mm + addr;
+  *vl = len;
+  return true;
+}
 
-static void *_db_dispose_chain_thr(void *op) {
-  assert(op);
-  iwrc rc = 0;
-  DISPOSE_DB_CTX *dctx = op;
-  pthread_detach(dctx->thr);
-  uint8_t *mm, kvszpow;
-  IWFS_FSM *fsm = &dctx->iwkv->fsm;
-  blkn_t sbn = dctx->sbn, kvblkn;
-  while (sbn) {
-    off_t sba = BLK2ADDR(sbn);
-    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-    RCBREAK(rc);
-    memcpy(&kvblkn, mm + sba + SOFF_KBLK_U4, 4);
-    kvblkn = IW_ITOHL(kvblkn);
-    memcpy(&sbn, mm + sba + SOFF_N0_U4, 4);
-    sbn = IW_ITOHL(sbn);
-    if (kvblkn) {
-      memcpy(&kvszpow, mm +  BLK2ADDR(kvblkn) + KBLK_SZPOW_OFF, 1);
+/**
+ * @brief Encode value of `IWDB_OVERFLOW_VALS` database.
+ * @details Value larger than `IWDB::ovl_threshold` is written into a newly allocated extent,
+ *          value is always written into preallocated extent at `addr` if it is not zero.
+ * @param [out] oval Encoded value, must be disposed by caller
+ */
+static WUR iwrc _db_val_ovl_pack(IWDB db, const IWKV_val *val, off_t addr, IWKV_val *oval) {
+  iwrc rc;
+  uint8_t *mm;
+  uint32_t lv;
+  IWFS_FSM *fsm = &db->file->fsm;
+  if (!addr && val->size <= atomic_load_explicit(&db->ovl_threshold, memory_order_relaxed)) {
+    oval->data = malloc(1 + val->size);
+    if (!oval->data) {
+      return iwrc_set_errno(IW_ERROR_ALLOC, errno);
     }
-    rc = fsm->release_mmap(fsm);
-    RCBREAK(rc);
-    // Deallocate `SBLK`
-    rc = fsm->deallocate(fsm, sba, SBLK_SZ);
-    if (rc) {
-      iwlog_ecode_error3(rc);
-      rc = 0;
+    ((uint8_t *) oval->data)[0] = OVL_INLINE;
+    if (val->size) {
+      memcpy((uint8_t *) oval->data + 1, val->data, val->size);
     }
-    // Deallocate `KVBLK`
-    if (kvblkn) {
-      rc = fsm->deallocate(fsm, BLK2ADDR(kvblkn), 1 << kvszpow);
-      if (rc) {
-        iwlog_ecode_error3(rc);
-        rc = 0;
-      }
+    oval->size = 1 + val->size;
+    return 0;
+  }
+  if (val->size > UINT32_MAX) {
+    return IWKV_ERROR_MAXKVSZ;
+  }
+  uint8_t *buf = malloc(OVL_STUB_SZ);
+  if (!buf) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  if (!addr) {
+    off_t alen;
+    rc = fsm->allocate(fsm, OVL_EXTENT_SZ(val->size), &addr, &alen,
+                       IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
+    if (rc) {
+      free(buf);
+      return rc;
     }
   }
-  _db_release_lw(dctx->dbp);
-  rc = _iwkv_worker_dec_nolk(dctx->iwkv);
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   if (rc) {
-    iwlog_ecode_error3(rc);
+    free(buf);
+    return rc;
   }
-  free(dctx);
+  memcpy(mm + addr, val->data, val->size);
+  fsm->dirty_mmap(fsm, addr, val->size);
+  fsm->release_mmap(fsm);
+  buf[0] = OVL_EXTENT;
+  lv = IW_HTOIL(ADDR2BLK(addr));
+  memcpy(buf + 1, &lv, 4);
+  lv = IW_HTOIL((uint32_t) val->size);
+  memcpy(buf + 5, &lv, 4);
+  oval->data = buf;
+  oval->size = OVL_STUB_SZ;
   return 0;
 }
 
-static WUR iwrc _db_destroy_lw(IWDB *dbp) {
-  int rci;
-  iwrc rc;
-  uint8_t *mm;
-  IWDB db = *dbp;
-  IWKV iwkv = db->iwkv;
-  IWDB prev = db->prev;
-  IWDB next = db->next;
-  IWFS_FSM *fsm = &db->iwkv->fsm;
-  uint32_t first_sblkn;
-  bool dec_worker = true;
+// Release extent of encoded value `pval` which has not been stored
+static void _db_val_ovl_discard(IWDB db, const IWKV_val *pval) {
+  off_t addr;
+  uint32_t len;
+  if ((db->dbflg & IWDB_OVERFLOW_VALS) && pval->data && _ovl_extent(pval->data, pval->size, &addr, &len)) {
+    IWFS_FSM *fsm = &db->file->fsm;
+    iwrc rc = fsm->deallocate(fsm, addr, OVL_EXTENT_SZ(len));
+    if (rc) {
+      iwlog_ecode_error3(rc);
+    }
+  }
+}
 
-  kh_del(DBS, db->iwkv->dbs, db->id);
-  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCRET(rc);
-  if (prev) {
-    prev->next = next;
-    _db_save(prev, mm);
-  }
-  if (next) {
-    next->prev = prev;
-    _db_save(next, mm);
-  }
-  // [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[24]:u4,c[24]:u4]:209
-  memcpy(&first_sblkn, mm + db->addr + DOFF_N0_U4, 4);
-  first_sblkn = IW_ITOHL(first_sblkn);
-  fsm->release_mmap(fsm);
-  if (db->iwkv->first_db && db->iwkv->first_db->addr == db->addr) {
-    uint64_t llv;
-    db->iwkv->first_db = next;
-    llv = next ? next->addr : 0;
-    llv = IW_HTOILL(llv);
-    rc = fsm->writehdr(fsm, sizeof(uint32_t) /*skip magic*/, &llv, sizeof(llv));
-  }
-  if (db->iwkv->last_db && db->iwkv->last_db->addr == db->addr) {
-    db->iwkv->last_db = prev;
-  }
-  // Cleanup DB
-  off_t db_addr = db->addr;
-  if (first_sblkn) {
-    DISPOSE_DB_CTX *dctx = malloc(sizeof(*dctx));
-    if (dctx) {
-      db->open = false;
-      dctx->sbn = first_sblkn;
-      dctx->iwkv = db->iwkv;
-      dctx->dbp = dbp;
-      rci = pthread_create(&dctx->thr, 0, _db_dispose_chain_thr, dctx);
-      if (rci) {
-        free(dctx);
-        rc = iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
-      } else {
-        dec_worker = false;
-      }
-    } else {
-      rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
-    }
-  }
-  IWRC(fsm->deallocate(fsm, db_addr, DB_SZ), rc);
-  if (dec_worker) {
-    _db_release_lw(dbp);
-    _iwkv_worker_dec_nolk(iwkv);
-  }
-  return rc;
+void iwkv_kv_dispose(IWKV_val *key, IWKV_val *val) {
+  _kv_dispose(key, val);
 }
 
-static WUR iwrc _db_create_lw(IWKV iwkv, dbid_t dbid, iwdb_flags_t dbflg, IWDB *odb) {
-  iwrc rc;
-  int rci;
-  uint8_t *mm = 0;
-  off_t baddr = 0, blen;
-  IWFS_FSM *fsm = &iwkv->fsm;
-  *odb = 0;
-  IWDB db = calloc(1, sizeof(struct IWDB));
-  if (!db) {
-    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
-  }
-  rci = pthread_rwlock_init(&db->rwl, 0);
-  if (rci) {
-    free(db);
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
-  }
-  rc = fsm->allocate(fsm, DB_SZ, &baddr, &blen,
-                     IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
-  if (rc) {
-    _db_release_lw(&db);
-    return rc;
-  }
-  db->iwkv = iwkv;
-  db->dbflg = dbflg;
-  db->addr = baddr;
-  db->id = dbid;
-  db->prev = iwkv->last_db;
-  if (!iwkv->first_db) {
+IW_INLINE void _num2lebuf(uint8_t buf[static 8], void *numdata, int sz) {
+  assert(sz == 4 || sz == 8);
+  if (sz > 4) {
     uint64_t llv;
-    iwkv->first_db = db;
-    llv = db->addr;
+    memcpy(&llv, numdata, sizeof(llv));
     llv = IW_HTOILL(llv);
-    rc = fsm->writehdr(fsm, sizeof(uint32_t) /*skip magic*/, &llv, sizeof(llv));
-  } else if (iwkv->last_db) {
-    iwkv->last_db->next = db;
+    memcpy(buf, &llv, sizeof(llv));
+  } else {
+    uint32_t lv;
+    memcpy(&lv, numdata, sizeof(lv));
+    lv = IW_HTOIL(lv);
+    memcpy(buf, &lv, sizeof(lv));
   }
-  iwkv->last_db = db;
-  khiter_t k = kh_put(DBS, iwkv->dbs, db->id, &rci);
-  if (rci != -1) {
-    kh_value(iwkv->dbs, k) = db;
+}
+
+static int _u4cmp(const void *o1, const void *o2) {
+  uint32_t v1, v2;
+  memcpy(&v1, o1, sizeof(uint32_t));
+  memcpy(&v2, o2, sizeof(uint32_t));
+  v1 = IW_ITOHL(v1);
+  v2 = IW_ITOHL(v2);
+  if (v1 > v2) {
+    return 1;
+  } else if (v1 < v2) {
+    return -1;
   } else {
-    RCGO(IW_ERROR_FAIL, finish);
+    return 0;
   }
-  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCGO(rc, finish);
-  _db_save(db, mm);
-  if (db->prev) {
-    _db_save(db->prev, mm);
+}
+
+static int _u8cmp(const void *o1, const void *o2) {
+  uint64_t v1, v2;
+  memcpy(&v1, o1, sizeof(uint64_t));
+  memcpy(&v2, o2, sizeof(uint64_t));
+  v1 = IW_ITOHLL(v1);
+  v2 = IW_ITOHLL(v2);
+  if (v1 > v2) {
+    return 1;
+  } else if (v1 < v2) {
+    return -1;
+  } else {
+    return 0;
   }
-  db->open = true;
-  *odb = db;
-finish:
-  if (mm) {
-    fsm->release_mmap(fsm);
+}
+
+//--------------------------  PACKED DUP VALUES
+
+// Sorted values array of `IWDB_DUP_PACKED` database record:
+// [num:u4,nslots:u4,[slot0]...[slotN]] where every slot except the last one takes `PDUP_SLOTSZ` bytes:
+// [cnt:u1,len:u1,first:u8,[delta1:vn]...[deltaK:vn]], `len` is size of deltas and
+// every delta is a difference between adjacent values minus one.
+// Slots are ordered by values so update decodes and rewrites a single slot.
+// The last slot is shorter than `PDUP_SLOTSZ` until value buffer grows.
+
+#define PDUP_HDRSZ   8
+#define PDUP_SLOTSZ  128
+#define PDUP_SHDRSZ  10
+#define PDUP_SMAXNUM (1 + PDUP_SLOTSZ - PDUP_SHDRSZ)
+
+IW_INLINE int _pdup_vput(uint8_t *wp, uint64_t v) {
+  int i = 0;
+  while (v >= 0x80) {
+    wp[i++] = (v & 0x7f) | 0x80;
+    v >>= 7;
   }
-  if (rc) {
-    fsm->deallocate(fsm, baddr, blen);
-    _db_release_lw(&db);
+  wp[i++] = v;
+  return i;
+}
+
+IW_INLINE int _pdup_vget(const uint8_t *rp, const uint8_t *ep, uint64_t *ov) {
+  uint64_t v = 0;
+  for (int i = 0, sh = 0; rp + i < ep && sh < 64; ++i, sh += 7) {
+    v |= (uint64_t) (rp[i] & 0x7f) << sh;
+    if (!(rp[i] & 0x80)) {
+      *ov = v;
+      return i + 1;
+    }
   }
-  return rc;
+  return 0;
 }
 
-//--------------------------  KVBLK
+// Size of slot `si` area in `len` bytes value buffer
+IW_INLINE uint32_t _pdup_slot_area(uint32_t len, uint32_t si) {
+  uint32_t off = PDUP_HDRSZ + si * PDUP_SLOTSZ;
+  return off < len ? MIN(PDUP_SLOTSZ, len - off) : 0;
+}
 
-IW_INLINE void _kvblk_create(IWLCTX *lx, off_t baddr, off_t blen, uint8_t kvbpow, KVBLK **oblk) {
-  KVBLK *kblk = &lx->kaa[lx->kaan];
-  assert((1ULL << kvbpow) == blen);
-  kblk->db = lx->db;
-  kblk->addr = baddr;
-  kblk->maxoff = 0;
-  kblk->idxsz = 2 * IW_VNUMSIZE(0) * KVBLK_IDXNUM;
-  kblk->zidx = 0;
-  kblk->szpow = kvbpow;
-  kblk->flags = KVBLK_DURTY;
-  memset(kblk->pidx, 0, sizeof(kblk->pidx));
-  *oblk = kblk;
-  AAPOS_INC(lx->kaan);
+IW_INLINE uint64_t _pdup_slot_first(const uint8_t *sp) {
+  uint64_t llv;
+  memcpy(&llv, sp + 2, sizeof(llv));
+  return IW_ITOHLL(llv);
 }
 
-IW_INLINE WUR iwrc _kvblk_destroy(KVBLK **kbp) {
-  assert(kbp && *kbp && (*kbp)->db && (*kbp)->szpow && (*kbp)->addr);
-  KVBLK *blk = *kbp;
-  IWFS_FSM *fsm = &blk->db->iwkv->fsm;
-  return fsm->deallocate(fsm, blk->addr, 1ULL << blk->szpow);
+// Read header of packed values array, returns false if `vp` buffer is not a packed array
+static bool _pdup_hdr(const uint8_t *vp, uint32_t len, uint32_t *onum, uint32_t *onslots) {
+  uint32_t lv;
+  if (len < PDUP_HDRSZ) {
+    return false;
+  }
+  memcpy(&lv, vp, 4);
+  *onum = IW_ITOHL(lv);
+  memcpy(&lv, vp + 4, 4);
+  *onslots = IW_ITOHL(lv);
+  return *onslots <= *onum && (!*onslots || _pdup_slot_area(len, *onslots - 1) >= PDUP_SHDRSZ);
 }
 
-IW_INLINE WUR iwrc _kvblk_peek_key(const KVBLK *kb, uint8_t idx, const uint8_t *mm, const uint8_t **obuf,
-                                   uint32_t *olen) {
-  if (kb->pidx[idx].len) {
-    uint32_t klen, step;
-    const uint8_t *rp = mm + kb->addr + (1ULL << kb->szpow) - kb->pidx[idx].off;
-    IW_READVNUMBUF(rp, klen, step);
-    if (!klen) {
-      *obuf = 0;
-      *olen = 0;
-      iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
-      return IWKV_ERROR_CORRUPTED;
-    }
-    rp += step;
-    *obuf = (uint8_t *) rp;
-    *olen = klen;
+IW_INLINE void _pdup_hdr_set(uint8_t *vp, uint32_t num, uint32_t nslots) {
+  uint32_t lv = IW_HTOIL(num);
+  memcpy(vp, &lv, 4);
+  lv = IW_HTOIL(nslots);
+  memcpy(vp + 4, &lv, 4);
+}
+
+// Value of `IWDB_DUP_UINT32_VALS`|`IWDB_DUP_UINT64_VALS` record array
+IW_INLINE uint64_t _dup_val(const IWKV_val *val) {
+  if (val->size == 4) {
+    uint32_t lv;
+    memcpy(&lv, val->data, sizeof(lv));
+    return lv;
   } else {
-    *obuf = 0;
-    *olen = 0;
+    uint64_t llv;
+    memcpy(&llv, val->data, sizeof(llv));
+    return llv;
   }
-  return 0;
 }
 
-IW_INLINE void _kvblk_peek_val(const KVBLK *kb, uint8_t idx, const uint8_t *mm, uint8_t **obuf, uint32_t *olen) {
-  assert(idx < KVBLK_IDXNUM);
-  if (kb->pidx[idx].len) {
-    uint32_t klen, step;
-    const uint8_t *rp = mm + kb->addr + (1ULL << kb->szpow) - kb->pidx[idx].off;
-    IW_READVNUMBUF(rp, klen, step);
+// Decode values of slot with `area` size into `vals` array of `PDUP_SMAXNUM` elements,
+// returns number of values or -1 if slot is corrupted
+static int _pdup_slot_decode(const uint8_t *sp, uint32_t area, uint64_t *vals) {
+  int cnt = sp[0];
+  const uint8_t *rp = sp + PDUP_SHDRSZ, *ep = rp + sp[1];
+  if (!cnt || cnt > PDUP_SMAXNUM || PDUP_SHDRSZ + sp[1] > area) {
+    return -1;
+  }
+  vals[0] = _pdup_slot_first(sp);
+  for (int i = 1; i < cnt; ++i) {
+    uint64_t d;
+    int step = _pdup_vget(rp, ep, &d);
+    if (!step) {
+      return -1;
+    }
     rp += step;
-    rp += klen;
-    *obuf = (uint8_t *) rp;
-    *olen = kb->pidx[idx].len - klen - step;
-  } else {
-    *obuf = 0;
-    *olen = 0;
+    vals[i] = vals[i - 1] + d + 1;
   }
+  return rp == ep ? cnt : -1;
 }
 
-static WUR iwrc _kvblk_getkey(KVBLK *kb, uint8_t *mm, uint8_t idx, IWKV_val *key) {
-  assert(mm && idx < KVBLK_IDXNUM);
-  int32_t klen;
-  int step;
-  KVP *kvp = &kb->pidx[idx];
-  if (!kvp->len) {
-    key->data = 0;
-    key->size = 0;
-    return 0;
+// Encode `vals` into slot with `area` size, returns false if values don't fit slot
+static bool _pdup_slot_encode(uint8_t *sp, uint32_t area, const uint64_t *vals, int cnt) {
+  uint8_t buf[PDUP_SMAXNUM * IW_VNUMBUFSZ];
+  uint32_t len = 0;
+  if (cnt > PDUP_SMAXNUM) {
+    return false;
+  }
+  for (int i = 1; i < cnt && PDUP_SHDRSZ + len <= area; ++i) {
+    len += _pdup_vput(buf + len, vals[i] - vals[i - 1] - 1);
+  }
+  if (PDUP_SHDRSZ + len > area) {
+    return false;
+  }
+  uint64_t llv = IW_HTOILL(vals[0]);
+  sp[0] = cnt;
+  sp[1] = len;
+  memcpy(sp + 2, &llv, sizeof(llv));
+  memcpy(sp + PDUP_SHDRSZ, buf, len);
+  return true;
+}
+
+// Index of the last slot with the first value not greater than `dv`, zero if there is no such slot
+static uint32_t _pdup_slot_find(const uint8_t *vp, uint32_t nslots, uint64_t dv) {
+  uint32_t lo = 0, hi = nslots;
+  while (hi - lo > 1) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (_pdup_slot_first(vp + PDUP_HDRSZ + mid * PDUP_SLOTSZ) <= dv) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
   }
-  // [klen:vn,key,value]
-  uint8_t *rp = mm + kb->addr + (1ULL << kb->szpow) - kvp->off;
-  IW_READVNUMBUF(rp, klen, step);
-  rp += step;
-  if (klen < 1 || klen > kvp->len || klen > kvp->off) {
-    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
-    return IWKV_ERROR_CORRUPTED;
+  return lo;
+}
+
+// Index of `dv` in sorted `vals` or insertion position as `-(pos + 1)`
+static int _pdup_vals_find(const uint64_t *vals, int cnt, uint64_t dv) {
+  int lo = 0, hi = cnt - 1;
+  while (lo <= hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (vals[mid] < dv) {
+      lo = mid + 1;
+    } else if (vals[mid] > dv) {
+      hi = mid - 1;
+    } else {
+      return mid;
+    }
   }
-  key->size = klen;
-  key->data = malloc(key->size);
-  if (!key->data) {
-    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  return -(lo + 1);
+}
+
+// Minimal size of value buffer able to accept one more value into slot `si`
+IW_INLINE uint32_t _pdup_grow_len(uint32_t len, uint32_t nslots, uint32_t si) {
+  uint32_t nlen = MAX(2 * len, PDUP_HDRSZ + PDUP_SHDRSZ + IW_VNUMBUFSZ);
+  if (_pdup_slot_area(len, si) >= PDUP_SLOTSZ) { // slot is split
+    nlen = MAX(nlen, PDUP_HDRSZ + (nslots + 1) * PDUP_SLOTSZ);
   }
-  memcpy(key->data, rp, key->size);
-  rp += key->size;
-  return 0;
+  return nlen;
 }
 
-static WUR iwrc _kvblk_getvalue(KVBLK *kb, uint8_t *mm, uint8_t idx, IWKV_val *val) {
-  assert(mm && idx < KVBLK_IDXNUM);
-  int32_t klen;
-  int step;
-  KVP *kvp = &kb->pidx[idx];
-  if (!kvp->len) {
-    val->data = 0;
-    val->size = 0;
+/**
+ * @brief Add or remove `dv` value of packed array in `len` bytes `vp` buffer.
+ * @param [out] ogrow Set if value buffer must be grown up to `ogrow` bytes, array is not changed then
+ * @return `IWKV_ERROR_NOTFOUND` if removed value is not found
+ */
+static WUR iwrc _pdup_update(uint8_t *vp, uint32_t len, uint64_t dv, bool remove, uint32_t *ogrow) {
+  uint64_t vals[PDUP_SMAXNUM + 1];
+  uint32_t num, nslots;
+  *ogrow = 0;
+  if (!_pdup_hdr(vp, len, &num, &nslots)) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
+  }
+  if (!nslots) {
+    if (remove) {
+      return IWKV_ERROR_NOTFOUND;
+    }
+    if (!_pdup_slot_encode(vp + PDUP_HDRSZ, _pdup_slot_area(len, 0), &dv, 1)) {
+      *ogrow = _pdup_grow_len(len, nslots, 0);
+      return 0;
+    }
+    _pdup_hdr_set(vp, 1, 1);
     return 0;
   }
-  // [klen:vn,key,value]
-  uint8_t *rp = mm + kb->addr + (1ULL << kb->szpow) - kvp->off;
-  IW_READVNUMBUF(rp, klen, step);
-  rp += step;
-  if (klen < 1 || klen > kvp->len || klen > kvp->off) {
+  uint32_t si = _pdup_slot_find(vp, nslots, dv);
+  uint8_t *sp = vp + PDUP_HDRSZ + si * PDUP_SLOTSZ;
+  uint32_t area = _pdup_slot_area(len, si);
+  int cnt = _pdup_slot_decode(sp, area, vals);
+  if (cnt < 0) {
     iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
     return IWKV_ERROR_CORRUPTED;
   }
-  rp += klen;
-  if (kvp->len > klen + step) {
-    val->size = kvp->len - klen - step;
-    val->data = malloc(val->size);
-    if (!val->data) {
-      iwrc rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
-      val->data = 0;
-      val->size = 0;
-      return rc;
+  int pos = _pdup_vals_find(vals, cnt, dv);
+  if (remove) {
+    if (pos < 0) {
+      return IWKV_ERROR_NOTFOUND;
     }
-    memcpy(val->data, rp, val->size);
-  } else {
-    val->data = 0;
-    val->size = 0;
+    memmove(vals + pos, vals + pos + 1, (cnt - pos - 1) * sizeof(vals[0]));
+    if (--cnt) {
+      // Removal never enlarges encoded slot
+      _pdup_slot_encode(sp, area, vals, cnt);
+    } else if (--nslots > si) {
+      // Shift the next slots, the last one may be shorter than `PDUP_SLOTSZ`
+      uint32_t noff = PDUP_HDRSZ + (si + 1) * PDUP_SLOTSZ;
+      memmove(sp, vp + noff, MIN((nslots - si) * PDUP_SLOTSZ, len - noff));
+    }
+    _pdup_hdr_set(vp, num - 1, nslots);
+    return 0;
+  }
+  if (pos >= 0) { // Value exists
+    return 0;
   }
+  pos = -pos - 1;
+  memmove(vals + pos + 1, vals + pos, (cnt - pos) * sizeof(vals[0]));
+  vals[pos] = dv;
+  ++cnt;
+  if (!_pdup_slot_encode(sp, area, vals, cnt)) {
+    // Split slot into halves
+    int h = cnt / 2;
+    if (area < PDUP_SLOTSZ || _pdup_slot_area(len, nslots) < PDUP_SLOTSZ) {
+      *ogrow = _pdup_grow_len(len, nslots, si);
+      return 0;
+    }
+    memmove(sp + 2 * PDUP_SLOTSZ, sp + PDUP_SLOTSZ, (nslots - si - 1) * PDUP_SLOTSZ);
+    if (!_pdup_slot_encode(sp, PDUP_SLOTSZ, vals, h)
+        || !_pdup_slot_encode(sp + PDUP_SLOTSZ, PDUP_SLOTSZ, vals + h, cnt - h)) {
+      iwlog_ecode_error3(IW_ERROR_ASSERTION);
+      return IW_ERROR_ASSERTION;
+    }
+    ++nslots;
+  }
+  _pdup_hdr_set(vp, num + 1, nslots);
   return 0;
 }
 
-static WUR iwrc _kvblk_getkv(KVBLK *kb, uint8_t *mm, uint8_t idx, IWKV_val *key, IWKV_val *val) {
-  assert(mm && idx < KVBLK_IDXNUM);
-  int32_t klen;
-  int step;
-  KVP *kvp = &kb->pidx[idx];
-  if (!kvp->len) {
-    key->data = 0;
-    key->size = 0;
-    val->data = 0;
-    val->size = 0;
-    return 0;
-  }
-  // [klen:vn,key,value]
-  uint8_t *rp = mm + kb->addr + (1ULL << kb->szpow) - kvp->off;
-  IW_READVNUMBUF(rp, klen, step);
-  rp += step;
-  if (klen < 1 || klen > kvp->len || klen > kvp->off) {
+static WUR iwrc _pdup_contains(const uint8_t *vp, uint32_t len, uint64_t dv, bool *out) {
+  uint64_t vals[PDUP_SMAXNUM];
+  uint32_t num, nslots;
+  *out = false;
+  if (!_pdup_hdr(vp, len, &num, &nslots)) {
     iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
     return IWKV_ERROR_CORRUPTED;
   }
-  key->size = klen;
-  key->data = malloc(key->size);
-  if (!key->data) {
-    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  if (!nslots) {
+    return 0;
   }
-  memcpy(key->data, rp, key->size);
-  rp += klen;
-  if (kvp->len > klen + step) {
-    val->size = kvp->len - klen - step;
-    val->data = malloc(val->size);
-    if (!val->data) {
-      iwrc rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
-      free(key->data);
-      key->data = 0;
-      key->size = 0;
-      val->size = 0;
-      return rc;
-    }
-    memcpy(val->data, rp, val->size);
-  } else {
-    val->data = 0;
-    val->size = 0;
+  uint32_t si = _pdup_slot_find(vp, nslots, dv);
+  int cnt = _pdup_slot_decode(vp + PDUP_HDRSZ + si * PDUP_SLOTSZ, _pdup_slot_area(len, si), vals);
+  if (cnt < 0) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
   }
+  *out = _pdup_vals_find(vals, cnt, dv) >= 0;
   return 0;
 }
 
-static WUR iwrc _kvblk_at_mm(IWLCTX *lx, off_t addr, uint8_t *mm, KVBLK *kbp, KVBLK **blkp) {
-  uint8_t *rp;
-  uint16_t sv;
-  int step;
-  iwrc rc = 0;
-  KVBLK *kb = kbp ? kbp : &lx->kaa[lx->kaan];
-  kb->db = lx->db;
-  kb->addr = addr;
-  kb->maxoff = 0;
-  kb->idxsz = 0;
-  kb->zidx = -1;
-  kb->szpow = 0;
-  kb->flags = 0;
-  memset(kb->pidx, 0, sizeof(kb->pidx));
-
-  *blkp = 0;
-  rp = mm + addr;
-  memcpy(&kb->szpow, rp, 1);
-  rp += 1;
-  IW_READSV(rp, sv, kb->idxsz);
-  if (IW_UNLIKELY(kb->idxsz > KVBLK_MAX_IDX_SZ)) {
-    rc = IWKV_ERROR_CORRUPTED;
-    iwlog_ecode_error3(rc);
-    goto finish;
+static WUR iwrc _pdup_iter(const uint8_t *vp, uint32_t len,
+                           bool (*visitor)(uint64_t dv, void *opaq), void *opaq,
+                           const uint64_t *start, bool down) {
+  uint64_t vals[PDUP_SMAXNUM];
+  uint32_t num, nslots;
+  if (!_pdup_hdr(vp, len, &num, &nslots)) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
   }
-  for (int i = 0; i < KVBLK_IDXNUM; ++i) {
-    IW_READVNUMBUF64(rp, kb->pidx[i].off, step);
-    rp += step;
-    IW_READVNUMBUF(rp, kb->pidx[i].len, step);
-    rp += step;
-    if (kb->pidx[i].len) {
-      if (IW_UNLIKELY(!kb->pidx[i].off)) {
-        rc = IWKV_ERROR_CORRUPTED;
-        iwlog_ecode_error3(rc);
-        goto finish;
+  if (!nslots) {
+    return 0;
+  }
+  int64_t si = start ? _pdup_slot_find(vp, nslots, *start) : down ? nslots - 1 : 0;
+  for (bool first = true; si >= 0 && si < nslots; si += down ? -1 : 1, first = false) {
+    int pos, cnt = _pdup_slot_decode(vp + PDUP_HDRSZ + si * PDUP_SLOTSZ, _pdup_slot_area(len, si), vals);
+    if (cnt < 0) {
+      iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+      return IWKV_ERROR_CORRUPTED;
+    }
+    if (first && start) {
+      pos = _pdup_vals_find(vals, cnt, *start);
+      if (pos < 0) {
+        return IWKV_ERROR_NOTFOUND;
       }
-      if (kb->pidx[i].off > kb->maxoff) {
-        kb->maxoff = kb->pidx[i].off;
+    } else {
+      pos = down ? cnt - 1 : 0;
+    }
+    for (; pos >= 0 && pos < cnt; pos += down ? -1 : 1) {
+      if (visitor(vals[pos], opaq)) {
+        return 0;
       }
-    } else if (kb->zidx < 0) {
-      kb->zidx = i;
     }
-    kb->pidx[i].ridx = i;
-  }
-  *blkp = kb;
-  assert(rp - (mm + addr) <= (1ULL << kb->szpow));
-  if (!kbp) {
-    AAPOS_INC(lx->kaan);
   }
-finish:
-  return rc;
+  return 0;
 }
 
-IW_INLINE WUR iwrc _kvblk_at(IWLCTX *lx, SBLK *sblk, KVBLK **blkp) {
-  if (sblk->kvblk) {
-    *blkp = sblk->kvblk;
-    return 0;
+// Number of values taken by a slot built from the head of `vals`,
+// three quarters of slot space are used so the next updates don't split slots at once
+static int _pdup_slot_fill(const uint64_t *vals, uint32_t num) {
+  uint8_t buf[IW_VNUMBUFSZ];
+  uint32_t len = 0, cnt = 1;
+  for ( ; cnt < num && cnt < PDUP_SMAXNUM; ++cnt) {
+    uint32_t step = _pdup_vput(buf, vals[cnt] - vals[cnt - 1] - 1);
+    if (len + step > 3 * (PDUP_SLOTSZ - PDUP_SHDRSZ) / 4) {
+      break;
+    }
+    len += step;
   }
-  iwrc rc;
-  uint8_t *mm;
-  IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-  *blkp = 0;
-  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCRET(rc);
-  rc = _kvblk_at_mm(lx, BLK2ADDR(sblk->kvblkn), mm, 0, blkp);
-  IWRC(fsm->release_mmap(fsm), rc);
-  return rc;
+  return cnt;
 }
 
-IW_INLINE off_t _kvblk_compacted_offset(KVBLK *kb) {
-  off_t coff = 0;
-  for (int i = 0; i < KVBLK_IDXNUM; ++i) {
-    coff += kb->pidx[i].len;
+// Build packed array value from sorted unique `vals`
+static WUR iwrc _pdup_build(const uint64_t *vals, uint32_t num, IWKV_val *oval) {
+  uint32_t nslots = 0;
+  for (uint32_t i = 0; i < num; i += _pdup_slot_fill(vals + i, num - i)) {
+    ++nslots;
   }
-  return coff;
-}
-
-IW_INLINE off_t _kvblk_compacted_dsize(KVBLK *kb) {
-  off_t coff = KVBLK_HDRSZ;
-  for (int i = 0; i < KVBLK_IDXNUM; ++i) {
-    coff += kb->pidx[i].len;
-    coff += IW_VNUMSIZE32(kb->pidx[i].len);
-    coff += IW_VNUMSIZE(kb->pidx[i].off);
+  oval->size = PDUP_HDRSZ + nslots * PDUP_SLOTSZ;
+  oval->data = calloc(1, oval->size);
+  if (!oval->data) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
   }
-  return coff;
+  uint8_t *sp = (uint8_t *) oval->data + PDUP_HDRSZ;
+  for (uint32_t i = 0; i < num; sp += PDUP_SLOTSZ) {
+    int cnt = _pdup_slot_fill(vals + i, num - i);
+    if (!_pdup_slot_encode(sp, PDUP_SLOTSZ, vals + i, cnt)) {
+      _kv_val_dispose(oval);
+      iwlog_ecode_error3(IW_ERROR_ASSERTION);
+      return IW_ERROR_ASSERTION;
+    }
+    i += cnt;
+  }
+  _pdup_hdr_set(oval->data, num, nslots);
+  return 0;
 }
 
-static void _kvblk_sync_mm(KVBLK *kb, uint8_t *mm) {
-  if (!(kb->flags & KVBLK_DURTY)) {
-    return;
+// Decode packed array into `vals` of `num` elements reported by the array header
+static WUR iwrc _pdup_decode(const uint8_t *vp, uint32_t len, uint64_t *vals, uint32_t num) {
+  uint32_t n, nslots, i = 0;
+  if (!_pdup_hdr(vp, len, &n, &nslots) || n != num) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
   }
-  uint16_t sp;
-  uint8_t *szp;
-  uint8_t *wp = mm + kb->addr;
-  memcpy(wp, &kb->szpow, 1);
-  wp += 1;
-  szp = wp;
-  wp += sizeof(uint16_t);
-  for (int i = 0; i < KVBLK_IDXNUM; ++i) {
-    KVP *kvp = &kb->pidx[i];
-    IW_SETVNUMBUF64(sp, wp, kvp->off);
-    wp += sp;
-    IW_SETVNUMBUF(sp, wp, kvp->len);
-    wp += sp;
+  for (uint32_t si = 0; si < nslots; ++si) {
+    uint64_t svals[PDUP_SMAXNUM];
+    int cnt = _pdup_slot_decode(vp + PDUP_HDRSZ + si * PDUP_SLOTSZ, _pdup_slot_area(len, si), svals);
+    if (cnt < 0 || i + cnt > num) {
+      iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+      return IWKV_ERROR_CORRUPTED;
+    }
+    memcpy(vals + i, svals, cnt * sizeof(svals[0]));
+    i += cnt;
   }
-  sp = wp - szp - sizeof(uint16_t);
-  kb->idxsz = sp;
-  assert(kb->idxsz <= KVBLK_MAX_IDX_SZ);
-  sp = IW_HTOIS(sp);
-  memcpy(szp, &sp, sizeof(uint16_t));
-  assert(wp - (mm + kb->addr) <= (1ULL << kb->szpow));
-  kb->flags &= ~KVBLK_DURTY;
+  if (i != num) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
+  }
+  return 0;
 }
 
-#define _kvblk_sort_kv_lt(v1, v2) \
-  (((v1).off > 0 ? (v1).off : -1UL) < ((v2).off > 0 ? (v2).off : -1UL))
-
-KSORT_INIT(kvblk, KVP, _kvblk_sort_kv_lt)
-
-static void _kvblk_compact_mm(KVBLK *kb, uint8_t *mm) {
-  uint8_t i;
-  off_t coff = _kvblk_compacted_offset(kb);
-  if (coff == kb->maxoff) { // already compacted
-    return;
+// Decode values `[start, end)` of packed array into `out` buffer of `elsz` sized numbers,
+// slots before `start` are skipped by their values count without decoding
+static WUR iwrc _pdup_slice(const uint8_t *vp, uint32_t len, uint32_t start, uint32_t end, void *out, int elsz) {
+  uint64_t vals[PDUP_SMAXNUM];
+  uint32_t num, nslots, i = 0;
+  uint8_t *wp = out;
+  if (!_pdup_hdr(vp, len, &num, &nslots)) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
   }
-  KVP tidx[KVBLK_IDXNUM];
-  KVP tidx_tmp[KVBLK_IDXNUM];
-  uint16_t idxsiz = 0;
-  uint8_t *wp = mm + kb->addr + (1ULL << kb->szpow);
-  memcpy(tidx, kb->pidx, sizeof(tidx));
-  ks_mergesort_kvblk(KVBLK_IDXNUM, tidx, tidx_tmp);
-
-  coff = 0;
-  for (i = 0; i < KVBLK_IDXNUM && tidx[i].off; ++i) {
-#ifndef NDEBUG
-    if (i > 0) {
-      assert(tidx[i - 1].off < tidx[i].off);
+  for (uint32_t si = 0; si < nslots && i < end; ++si) {
+    const uint8_t *sp = vp + PDUP_HDRSZ + si * PDUP_SLOTSZ;
+    if (i + sp[0] <= start) {
+      i += sp[0];
+      continue;
     }
-#endif
-    KVP *kvp = &kb->pidx[tidx[i].ridx];
-    off_t noff = coff + kvp->len;
-    if (kvp->off > noff) {
-      assert(noff <= (1ULL << kb->szpow) && kvp->len <= noff);
-      memmove(wp - noff, wp - kvp->off, kvp->len);
-      kvp->off = noff;
+    int cnt = _pdup_slot_decode(sp, _pdup_slot_area(len, si), vals);
+    if (cnt < 0) {
+      iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+      return IWKV_ERROR_CORRUPTED;
     }
-    coff += kvp->len;
-    idxsiz += IW_VNUMSIZE(kvp->off);
-    idxsiz += IW_VNUMSIZE32(kvp->len);
-  }
-  idxsiz += (KVBLK_IDXNUM - i) * 2;
-  for (i = 0; i < KVBLK_IDXNUM; ++i) {
-    if (!kb->pidx[i].len)  {
-      kb->zidx = i;
-      break;
+    for (uint32_t k = start > i ? start - i : 0; k < cnt && i + k < end; ++k, wp += elsz) {
+      if (elsz < 8) {
+        uint32_t lv = vals[k];
+        memcpy(wp, &lv, sizeof(lv));
+      } else {
+        memcpy(wp, &vals[k], sizeof(vals[k]));
+      }
     }
+    i += cnt;
   }
-  assert(idxsiz <= kb->idxsz);
-  kb->idxsz = idxsiz;
-  kb->maxoff = coff;
-  if (i == KVBLK_IDXNUM) {
-    kb->zidx = -1;
+  if (wp - (uint8_t *) out != (end - start) * elsz) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
   }
-  kb->flags |= KVBLK_DURTY;
-  assert(_kvblk_compacted_offset(kb) == kb->maxoff);
+  return 0;
 }
 
-IW_INLINE off_t _kvblk_maxkvoff(KVBLK *kb) {
-  off_t off = 0;
-  for (int i = 0; i < KVBLK_IDXNUM; ++i) {
-    if (kb->pidx[i].off > off) {
-      off = kb->pidx[i].off;
-    }
+//-------------------------- IWKV/IWDB WORKERS
+
+static WUR iwrc _iwkv_worker_inc_nolk(IWKV iwkv) {
+  if (!iwkv || !iwkv->open) {
+    return IW_ERROR_INVALID_STATE;
   }
-  return off;
+  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
+  if (rci) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  if (!iwkv->open) {
+    pthread_mutex_unlock(&iwkv->wk_mtx);
+    return IW_ERROR_INVALID_STATE;
+  }
+  ++iwkv->wk_count;
+  pthread_cond_broadcast(&iwkv->wk_cond);
+  pthread_mutex_unlock(&iwkv->wk_mtx);
+  return 0;
 }
 
-static WUR iwrc _kvblk_rmkv(KVBLK *kb, uint8_t idx, kvblk_rmkv_opts_t opts) {
-  iwrc rc = 0;
-  uint8_t *mm = 0;
-  IWFS_FSM *fsm = &kb->db->iwkv->fsm;
-  if (kb->pidx[idx].off >= kb->maxoff) {
-    kb->maxoff = 0;
-    for (int i = 0; i < KVBLK_IDXNUM; ++i) {
-      if (i != idx && kb->pidx[i].off > kb->maxoff) {
-        kb->maxoff = kb->pidx[i].off;
-      }
-    }
+static iwrc _iwkv_worker_dec_nolk(IWKV iwkv) {
+  if (!iwkv) {
+    return IW_ERROR_INVALID_STATE;
   }
-  kb->pidx[idx].len = 0;
-  kb->pidx[idx].off = 0;
-  kb->flags |= KVBLK_DURTY;
-  if (kb->zidx < 0 || idx < kb->zidx) {
-    kb->zidx = idx;
+  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
+  if (rci) {
+    // Last chanсe to be safe
+    --iwkv->wk_count;
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
   }
-  if (!(RMKV_NO_RESIZE & opts) && kb->szpow > KVBLK_INISZPOW) {
-    off_t nlen = 1ULL << kb->szpow;
-    uint64_t dsz = _kvblk_compacted_dsize(kb);
-    if (nlen >= 2 * dsz) {
-      uint8_t npow = kb->szpow - 1;
-      while (npow > KVBLK_INISZPOW && (1ULL << (npow - 1)) >= dsz) {
-        --npow;
-      }
-      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-      RCGO(rc, finish);
-      _kvblk_compact_mm(kb, mm);
-      off_t maxoff = _kvblk_maxkvoff(kb);
-      memmove(mm + kb->addr + (1ULL << npow) - maxoff,
-              mm + kb->addr + nlen - maxoff,
-              maxoff);
-      fsm->release_mmap(fsm);
-      mm = 0;
-      rc = fsm->reallocate(fsm, (1ULL << npow), &kb->addr, &nlen,
-                           IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
-      RCGO(rc, finish);
-      kb->szpow = npow;
-      assert(nlen == (1ULL << kb->szpow));
-      opts |= RMKV_SYNC;
-    }
+  --iwkv->wk_count;
+  pthread_cond_broadcast(&iwkv->wk_cond);
+  pthread_mutex_unlock(&iwkv->wk_mtx);
+  return 0;
+}
+
+static WUR iwrc _db_worker_inc_nolk(IWDB db) {
+  if (!db || !db->iwkv || !db->iwkv->open || !db->open) {
+    return IW_ERROR_INVALID_STATE;
   }
-  if (RMKV_SYNC & opts) {
-    if (!mm) {
-      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-      RCGO(rc, finish);
-    }
-    _kvblk_sync_mm(kb, mm);
+  IWKV iwkv = db->iwkv;
+  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
+  if (rci) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
   }
-finish:
-  if (mm) {
-    fsm->release_mmap(fsm);
+  if (!iwkv->open || !db->open) {
+    pthread_mutex_unlock(&iwkv->wk_mtx);
+    return IW_ERROR_INVALID_STATE;
   }
-  return rc;
+  ++iwkv->wk_count;
+  ++db->wk_count;
+  pthread_cond_broadcast(&iwkv->wk_cond);
+  pthread_mutex_unlock(&iwkv->wk_mtx);
+  return 0;
 }
 
-static WUR iwrc _kvblk_addkv(KVBLK *kb,
-                             const IWKV_val *key,
-                             const IWKV_val *val,
-                             int8_t *oidx,
-                             iwkv_opflags opflags,
-                             bool internal) {
-  iwrc rc = 0;
-  off_t msz;    // max available free space
-  off_t rsz;    // required size to add new key/value pair
-  off_t noff;   // offset of new kvpair from end of block
-  uint8_t *mm, *wp;
-  size_t i, sp;
-  KVP *kvp;
-  IWDB db = kb->db;
-  IWFS_FSM *fsm = &db->iwkv->fsm;
-  *oidx = -1;
-  bool compacted = false;
-  IWKV_val *uval = (IWKV_val *) val, sval;
-  off_t psz = IW_VNUMSIZE(key->size) + key->size + uval->size; // required KVP size
-
-#ifndef NDEBUG
-  uint8_t *sptr;
-#endif
-
-  if (kb->zidx < 0) {
-    return _IWKV_ERROR_KVBLOCK_FULL;
+static iwrc _db_worker_dec_nolk(IWDB db) {
+  if (!db || !db->iwkv) { // do not use ENSURE_OPEN_DB here
+    return IW_ERROR_INVALID_STATE;
   }
-  // DUP
-  if (!internal && (db->dbflg & IWDB_DUP_FLAGS)) {
-    if (opflags & IWKV_DUP_REMOVE) {
-      return IWKV_ERROR_NOTFOUND;
-    }
-    if (((db->dbflg & IWDB_DUP_UINT32_VALS) && val->size != 4) ||
-        ((db->dbflg & IWDB_DUP_UINT64_VALS) && val->size != 8)) {
-      return IWKV_ERROR_DUP_VALUE_SIZE;
-    }
-    uint32_t lv = 1;
-    uint8_t vbuf[8];
-    _num2lebuf(vbuf, val->data, val->size);
-    uval = &sval;
-    uval->data = malloc(4 + val->size);
-    uval->size = 4 + val->size;
-    psz += 4;
-    lv = IW_HTOIL(lv);
-    wp = uval->data;
-    memcpy(wp, &lv, 4);
-    memcpy(wp + 4, vbuf, val->size);
+  IWKV iwkv = db->iwkv;
+  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
+  if (rci) {
+    // Last chanсe to be safe
+    --iwkv->wk_count;
+    --db->wk_count;
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
   }
-  // !DUP
-  if (psz > IWKV_MAX_KVSZ) {
-    if (uval != val) {
-      _kv_val_dispose(uval);
-    }
-    return IWKV_ERROR_MAXKVSZ;
+  --iwkv->wk_count;
+  --db->wk_count;
+  pthread_cond_broadcast(&iwkv->wk_cond);
+  pthread_mutex_unlock(&iwkv->wk_mtx);
+  return 0;
+}
+
+static WUR iwrc _wnw_iwkw_wl(IWKV iwkv) {
+  int rci = pthread_rwlock_wrlock(&iwkv->rwl);
+  if (rci) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
   }
+  return 0;
+}
 
-start:
-  // [szpow:u1,idxsz:u2,[ps0:vn,pl0:vn,..., ps32,pl32]____[[KV],...]] // KVBLK
-  msz = (1ULL << kb->szpow) - (KVBLK_HDRSZ + kb->idxsz + kb->maxoff);
-  assert(msz >= 0);
-  noff = kb->maxoff + psz;
-  rsz = psz + IW_VNUMSIZE(noff) + IW_VNUMSIZE(psz);
+static WUR iwrc _wnw_db_wl(IWDB db) {
+  int rci = pthread_rwlock_wrlock(&db->rwl);
+  if (rci) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  return 0;
+}
 
-  if (msz < rsz) { // not enough space
-    if (!compacted) {
-      compacted = true;
-      if (_kvblk_compacted_offset(kb) != kb->maxoff) {
-        rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-        RCGO(rc, finish);
-        _kvblk_compact_mm(kb, mm);
-        fsm->release_mmap(fsm);
-        goto start;
-      }
-    }
-    // resize the whole block
-    off_t nsz = (rsz - msz) + (1ULL << kb->szpow);
-    uint8_t npow = kb->szpow;
-    while ((1ULL << ++npow) < nsz);
-    off_t naddr = kb->addr;
-    off_t nlen = 1ULL << kb->szpow;
+static WUR iwrc _wnw(IWKV iwkv, iwrc(*after)(IWKV iwkv)) {
+  iwrc rc = 0;
+  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
+  if (rci) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  while (iwkv->wk_count > 0) {
+    pthread_cond_wait(&iwkv->wk_cond, &iwkv->wk_mtx);
+  }
+  if (after) {
+    rc = after(iwkv);
+  }
+  rci = pthread_mutex_unlock(&iwkv->wk_mtx);
+  if (rci) {
+    IWRC(iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci), rc);
+  }
+  return rc;
+}
 
-    assert(!fsm->check_allocation_status(fsm, naddr, nlen, true));
-    rc = fsm->reallocate(fsm, (1ULL << npow), &naddr, &nlen,
-                         IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
-    RCGO(rc, finish);
-    assert(nlen == (1ULL << npow));
-    // Move pairs area
-    // [hdr..[pairs]] =reallocate=> [hdr..[pairs]_____] =memove=> [hdr.._____[pairs]]
-    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-    RCGO(rc, finish);
-    kb->addr = naddr;
-    memmove(mm + naddr + nlen - kb->maxoff,
-            mm + naddr + (1ULL << kb->szpow) - kb->maxoff, kb->maxoff);
-    fsm->release_mmap(fsm);
-    kb->szpow = npow;
+static WUR iwrc _wnw_db(IWDB db, iwrc(*after)(IWDB db)) {
+  iwrc rc = 0;
+  IWKV iwkv = db->iwkv;
+  int rci = pthread_mutex_lock(&iwkv->wk_mtx);
+  if (rci) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
   }
-  *oidx = kb->zidx;
-  kvp = &kb->pidx[kb->zidx];
-  kvp->len = psz;
-  kvp->off = noff;
-  kvp->ridx = kb->zidx;
-  kb->maxoff = noff;
-  kb->flags |= KVBLK_DURTY;
-  for (i = 0; i < KVBLK_IDXNUM; ++i) {
-    if (!kb->pidx[i].len && i != kb->zidx) {
-      kb->zidx = i;
-      break;
-    }
+  while (db->wk_count > 0) {
+    pthread_cond_wait(&iwkv->wk_cond, &iwkv->wk_mtx);
   }
-  if (i >= KVBLK_IDXNUM) {
-    kb->zidx = -1;
+  if (after) {
+    rc = after(db);
   }
-  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCGO(rc, finish);
-  assert((1ULL << kb->szpow) >= KVBLK_HDRSZ + kb->idxsz + kb->maxoff);
-  assert(kvp->off < (1ULL << kb->szpow) && kvp->len <= kvp->off);
-  wp = mm + kb->addr + (1ULL << kb->szpow) - kvp->off;
-#ifndef NDEBUG
-  sptr = wp;
-#endif
-  // [klen:vn,key,value]
-  IW_SETVNUMBUF(sp, wp, key->size);
-  wp += sp;
-  memcpy(wp, key->data, key->size);
-  wp += key->size;
-  memcpy(wp, uval->data, uval->size);
-  wp += uval->size;
-#ifndef NDEBUG
-  assert(wp - sptr == kvp->len);
-#endif
-  fsm->release_mmap(fsm);
-finish:
-  if (uval != val) {
-    _kv_val_dispose(uval);
+  rci = pthread_mutex_unlock(&iwkv->wk_mtx);
+  if (rci) {
+    IWRC(iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci), rc);
   }
   return rc;
 }
 
-static WUR iwrc _kvblk_updatev(KVBLK *kb,
-                               int8_t *idxp,
-                               const IWKV_val *key, /* Nullable */
-                               const IWKV_val *val,
-                               iwkv_opflags opflags,
-                               bool internal) {
-  assert(*idxp < KVBLK_IDXNUM);
-  int32_t i;
-  uint32_t len, nlen, sz;
-  IWDB db = kb->db;
-  int8_t idx = *idxp;
-  uint8_t *mm = 0, *wp, *sp;
-  IWKV_val *uval = (IWKV_val *) val;
-  IWKV_val *ukey = (IWKV_val *) key;
-  IWKV_val sval, skey; // stack allocated key/val
-  KVP *kvp = &kb->pidx[idx];
-  size_t kbsz = 1ULL << kb->szpow; // kvblk size
-  off_t freesz = kbsz - KVBLK_HDRSZ - kb->idxsz - kb->maxoff; // free space available
-  IWFS_FSM *fsm = &db->iwkv->fsm;
-  iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCRET(rc);
-  assert(freesz >= 0);
+//--------------------------  DB
 
-  // DUP
-  if (!internal && (db->dbflg & IWDB_DUP_FLAGS)) {
-    if (((db->dbflg & IWDB_DUP_UINT32_VALS) && val->size != 4) ||
-        ((db->dbflg & IWDB_DUP_UINT64_VALS) && val->size != 8)) {
-      rc = IWKV_ERROR_DUP_VALUE_SIZE;
-      goto finish;
-    }
-    _kvblk_peek_val(kb, idx, mm, &wp, &len);
-    if (len < 4) {
+static void _db_cache_opts_set(IWDB db, const IWDB_CACHE_OPTS *opts) {
+  db->cache_opts = *opts;
+  if (!db->cache_opts.levels || db->cache_opts.levels > SLEVELS) {
+    db->cache_opts.levels = DBCACHE_LEVELS;
+  }
+  if (!db->cache_opts.min_level || db->cache_opts.min_level >= SLEVELS) {
+    db->cache_opts.min_level = db->cache_opts.adaptive ? DBCACHE_ADAPTIVE_MIN_LEVEL : DBCACHE_MIN_LEVEL;
+  }
+  db->cache_levels = db->cache_opts.levels;
+  db->cache_hops = 0;
+  db->cache_lookups = 0;
+}
+
+static WUR iwrc _db_at(IWKV iwkv, IWKV_FILE *file, IWDB *dbp, off_t addr, uint8_t *mm) {
+  iwrc rc = 0;
+  uint8_t *rp;
+  uint32_t lv;
+  int rci;
+  IWDB db = calloc(1, sizeof(struct IWDB));
+  *dbp = 0;
+  if (!db) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  rci = pthread_rwlock_init(&db->rwl, 0);
+  if (rci) {
+    free(db);
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  rc = _db_latches_init(db);
+  if (rc) {
+    pthread_rwlock_destroy(&db->rwl);
+    free(db);
+    return rc;
+  }
+  // [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[30]:u4,c[30]:u8]:u377
+  db->flags = SBLK_DB;
+  db->addr = addr;
+  db->db = db;
+  db->iwkv = iwkv;
+  db->file = file;
+  _db_cache_opts_set(db, &iwkv->dbcache_opts);
+  db->ovl_threshold = IWDB_OVERFLOW_THRESHOLD_DEFAULT;
+  rp = mm + addr;
+  IW_READLV(rp, lv, lv);
+  if (lv != IWDB_MAGIC) {
+    rc = IWKV_ERROR_CORRUPTED;
+    iwlog_ecode_error3(rc);
+    goto finish;
+  }
+  IW_READBV(rp, lv, db->dbflg);
+  IW_READLV(rp, lv, db->id);
+  IW_READLV(rp, lv, db->next_db_addr);
+  db->next_db_addr = BLK2ADDR(db->next_db_addr); // blknum -> addr
+  switch (mm[addr + DOFF_PNMAX_U1]) {
+    case 0:
+      break;
+    case KVBLK_IDXNUM_MAX:
+      db->dbflg |= IWDB_WIDE_NODES;
+      break;
+    default:
       rc = IWKV_ERROR_CORRUPTED;
       iwlog_ecode_error3(rc);
       goto finish;
-    }
-    sp = wp;
-    memcpy(&sz, wp, 4); // number of elements
-    sz = IW_ITOHL(sz);
-    wp += 4;
-    if (len < 4 + sz * val->size) {
-      // kv capacity is less than reported number of items (sz)
+  }
+  switch (mm[addr + DOFF_KEYS_U1]) {
+    case 0:
+      break;
+    case 1:
+      db->dbflg |= IWDB_CUSTOM_KEYS;
+      break;
+    default:
       rc = IWKV_ERROR_CORRUPTED;
       iwlog_ecode_error3(rc);
       goto finish;
-    }
-    uint8_t vbuf[8];
-    uint32_t avail = len - (4 /* num items */ + sz * val->size);
-    _num2lebuf(vbuf, val->data, val->size);
+  }
+  _db_pnmax_set(db);
+  _db_kops_init(db);
+  rp = mm + addr + DOFF_C0_U4;
+  for (int i = 0; i < SLEVELS; ++i) {
+    IW_READLV(rp, lv, db->lcnt[i]);
+  }
+  db->open = true;
+  *dbp = db;
+finish:
+  if (rc)  {
+    _db_latches_destroy(db);
+    pthread_rwlock_destroy(&db->rwl);
+    free(db);
+  }
+  return rc;
+}
 
-    if (opflags & IWKV_DUP_REMOVE) {
-      if (!sz || !iwarr_sorted_remove(wp, sz, val->size, vbuf,  val->size > 4 ? _u8cmp : _u4cmp)) {
-        rc = IWKV_ERROR_NOTFOUND;
-        goto finish;
-      }
-      sz -= 1;
-      sz = IW_HTOIL(sz);
-      memcpy(sp, &sz, 4);
-      if (len >= (4 + sz * val->size) * 2) {
-        // Reduce size of kv value buffer
-        kvp->len = kvp->len - len / 2;
-        kb->flags |= KVBLK_DURTY;
-      }
-      goto finish;
+static void _db_save(IWDB db, uint8_t *mm) {
+  uint32_t lv;
+  uint8_t *wp = mm + db->addr;
+  db->next_db_addr = db->next ? db->next->addr : 0;
+  // [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n0-n29:u4]
+  IW_WRITELV(wp, lv, IWDB_MAGIC);
+  IW_WRITEBV(wp, lv, db->dbflg & 0xff);
+  IW_WRITELV(wp, lv, db->id);
+  IW_WRITELV(wp, lv, ADDR2BLK(db->next_db_addr));
+  // Zero fan-out byte stands for `KVBLK_IDXNUM` nodes of databases created before it was introduced
+  mm[db->addr + DOFF_PNMAX_U1] = (db->pnmax == KVBLK_IDXNUM) ? 0 : db->pnmax;
+  mm[db->addr + DOFF_KEYS_U1] = (db->dbflg & IWDB_CUSTOM_KEYS) ? 1 : 0;
+  db->file->fsm.dirty_mmap(&db->file->fsm, db->addr, DB_SZ);
+}
 
-    } else if (avail >= val->size) { // we have enough room to store the given number
-      if (iwarr_sorted_insert(wp, sz, val->size, vbuf,
-                              val->size > 4 ? _u8cmp : _u4cmp, true) == -1) {
-        goto finish;
-      }
-      // Increment number of items
-      sz += 1;
-      sz = IW_HTOIL(sz);
-      memcpy(sp, &sz, 4);
-      goto finish;
+static WUR iwrc _db_load_chain(IWKV iwkv, IWKV_FILE *file, off_t addr, uint8_t *mm) {
+  iwrc rc;
+  int rci;
+  IWDB db = 0, ndb;
+  if (!addr) return 0;
+  do {
+    rc = _db_at(iwkv, file, &ndb, addr, mm);
+    RCRET(rc);
+    if (db) {
+      db->next = ndb;
+      ndb->prev = db;
     } else {
-      // reallocate value buf
-      uval = &sval;
-      nlen = len;
-      while (avail < val->size) {
-        nlen *= 2;
-        avail = nlen - (4 + sz * val->size);
-      }
-      uval->data = malloc(nlen);
-      if (!uval->data) {
-        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
-        goto finish;
-      }
-      // zero initialize extra bytes
-      memset((uint8_t *)uval->data + len, 0, nlen - len);
-      uval->size = nlen;
-      memcpy(uval->data, sp, len);
-      if (iwarr_sorted_insert((uint8_t *)uval->data + 4, sz, val->size, vbuf,
-                              val->size > 4 ? _u8cmp : _u4cmp, true) == -1) {
-        goto finish;
-      }
-      sz += 1;
-      sz = IW_HTOIL(sz);
-      memcpy(uval->data, &sz, 4);
+      file->first_db = ndb;
     }
-  }
-  // !DUP
-  wp = mm + kb->addr + kbsz - kvp->off;
-  sp = wp;
-  IW_READVNUMBUF(wp, len, sz);
-  wp += sz;
-  if (ukey && len != ukey->size) {
-    rc = IWKV_ERROR_CORRUPTED;
-    iwlog_ecode_error3(rc);
-    goto finish;
-  }
-  wp += len;
-  off_t rsize = sz + len + uval->size; // required size
-  if (rsize <= kvp->len) {
-    memcpy(wp, uval->data, uval->size);
-    wp += uval->size;
-    if ((wp - sp) != kvp->len) {
-      kvp->len = wp - sp;
-      kb->flags |= KVBLK_DURTY;
+    db = ndb;
+    addr = db->next_db_addr;
+    file->last_db = db;
+    khiter_t k = kh_put(DBS, iwkv->dbs, db->id, &rci);
+    if (rci != -1) {
+      kh_value(iwkv->dbs, k) = db;
+    } else {
+      rc = IW_ERROR_FAIL;
+      return rc;
     }
-  } else {
-    KVP tidx[KVBLK_IDXNUM];
-    KVP tidx_tmp[KVBLK_IDXNUM];
-    off_t koff = kb->pidx[idx].off;
-    memcpy(tidx, kb->pidx, KVBLK_IDXNUM * sizeof(kb->pidx[0]));
-    ks_mergesort_kvblk(KVBLK_IDXNUM, tidx, tidx_tmp);
-    kb->flags |= KVBLK_DURTY;
-    if (!ukey) { // we need a key
-      ukey = &skey;
-      rc = _kvblk_getkey(kb, mm, idx, ukey);
-      RCGO(rc, finish);
+  } while (db->next_db_addr);
+  return rc;
+}
+
+static void _db_release_lw(IWDB *dbp) {
+  assert(dbp && *dbp);
+  _dbcache_destroy_lw(*dbp);
+  _bloom_destroy(*dbp);
+  _db_latches_destroy(*dbp);
+  pthread_rwlock_destroy(&(*dbp)->rwl);
+  free((*dbp)->sfree);
+  free(*dbp);
+  *dbp = 0;
+}
+
+// Max number of threads disposing a single chain by default
+#define DISPOSE_THREADS_MAX 4
+
+// Number of `SBLK` blocks released by a single `IWFS_FSM::deallocate_batch()` call
+#define DISPOSE_BATCH 512
+
+// Capacity of ranges buffer of disposal batch including extents of out of line values
+#define DISPOSE_RANGES_NUM (2 * DISPOSE_BATCH + 2 + KVBLK_IDXNUM_MAX)
+
+// Target number of chain segments per disposal thread
+#define DISPOSE_SEGS_PER_THREAD 4
+
+typedef struct DISPOSE_DB_CTX {
+  IWKV iwkv;
+  IWFS_FSM *fsm;              // Storage file of disposed blocks
+  IWDB db;                    // Database released after disposal of blocks, zero if database is kept
+  blkn_t sbn;                 // First `SBLK` block in chain
+  blkn_t heads[SLEVELS];      // First blocks of chain per skip list level
+  dbid_t dbid;                // Database id reported to progress hook
+  bool ovl;                   // Values may be stored out of line, see `IWDB_OVERFLOW_VALS`
+  uint8_t pnmax;              // Number of kv slots in `KVBLK` index, see `IWDB::pnmax`
+  pthread_t thr;
+  blkn_t *segs;               // Chain segments, segment `i` ends before `segs[i + 1]`
+  size_t segnum;              // Number of chain segments
+  atomic_size_t segpos;       // Next segment to be disposed
+  atomic_uint_fast64_t num;   // Number of released `SBLK` blocks
+  uint64_t ts;                // Disposal start time ns
+} DISPOSE_DB_CTX;
+
+// Init disposal context of chain starting from `sbn`.
+// If `mm` is set level links of the whole chain are read from database block at `addr`,
+// otherwise upper levels of chain may lead out of it and chain is disposed sequentially.
+static void _db_dispose_ctx_init(DISPOSE_DB_CTX *dctx, IWDB db, blkn_t sbn, const uint8_t *mm, off_t addr) {
+  memset(dctx, 0, sizeof(*dctx));
+  dctx->iwkv = db->iwkv;
+  dctx->fsm = &db->file->fsm;
+  dctx->dbid = db->id;
+  dctx->ovl = (db->dbflg & IWDB_OVERFLOW_VALS);
+  dctx->pnmax = db->pnmax;
+  dctx->sbn = sbn;
+  for (int i = 0; mm && i < SLEVELS; ++i) {
+    memcpy(&dctx->heads[i], mm + addr + DOFF_N0_U4 + 4 * i, 4);
+    dctx->heads[i] = IW_ITOHL(dctx->heads[i]);
+  }
+}
+
+// Split chain into segments by nodes of the highest skip list level
+// having enough nodes to feed all disposal threads
+static iwrc _db_dispose_split(DISPOSE_DB_CTX *dctx, size_t target) {
+  uint8_t *mm;
+  size_t anum = 0;
+  IWFS_FSM *fsm = dctx->fsm;
+  iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  for (int l = SLEVELS - 1; l > 0; --l) {
+    blkn_t n = dctx->heads[l];
+    if (!n) {
+      continue;
     }
-    for (i = 0; i < KVBLK_IDXNUM; ++i) {
-      if (tidx[i].off == koff) {
-        if (koff - (i > 0 ? tidx[i - 1].off : 0) >= rsize) {
-          uint32_t nlen = wp + uval->size - sp;
-          if (!(nlen > kvp->len && freesz - IW_VNUMSIZE32(nlen) + IW_VNUMSIZE32(kvp->len) < 0)) { // enough space?
-            memcpy(wp, uval->data, uval->size);
-            wp += uval->size;
-            kvp->len = nlen;
-            break;;
+    dctx->segnum = 1;
+    while (n) {
+      if (n != dctx->sbn) {
+        if (dctx->segnum >= anum) {
+          anum = anum ? 2 * anum : 2 * target;
+          blkn_t *segs = realloc(dctx->segs, anum * sizeof(*segs));
+          if (!segs) {
+            rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+            goto finish;
           }
+          dctx->segs = segs;
         }
-        // todo: optimize?
-        mm = 0;
-        fsm->release_mmap(fsm);
-        rc = _kvblk_rmkv(kb, idx, RMKV_NO_RESIZE);
-        RCGO(rc, finish);
-        rc = _kvblk_addkv(kb, ukey, uval, idxp, opflags, true);
-        break;
+        dctx->segs[dctx->segnum++] = n;
       }
+      memcpy(&n, mm + BLK2ADDR(n) + SOFF_N0_U4 + 4 * l, 4);
+      n = IW_ITOHL(n);
+    }
+    if (dctx->segnum >= target) {
+      break;
     }
   }
 
 finish:
-  if (uval != val) {
-    _kv_val_dispose(uval);
-  }
-  if (ukey != key) {
-    _kv_val_dispose(ukey);
-  }
-  if (mm) {
-    IWRC(fsm->release_mmap(fsm), rc);
+  fsm->release_mmap(fsm);
+  if (rc || !dctx->segs) {
+    // Whole chain is disposed as a single segment
+    free(dctx->segs);
+    dctx->segs = &dctx->sbn;
+    dctx->segnum = 1;
+  } else {
+    dctx->segs[0] = dctx->sbn;
   }
   return rc;
 }
 
-//--------------------------  SBLK
-
-IW_INLINE void _sblk_release(IWLCTX *lx, SBLK **sblkp) {
-  assert(sblkp && *sblkp);
-  SBLK *sblk = *sblkp;
-  sblk->flags &= ~SBLK_CACHE_FLAGS; // clear cache flags
-  sblk->kvblk = 0;
-  *sblkp = 0;
-}
-
-IW_INLINE WUR iwrc _sblk_loadkvblk_mm(IWLCTX *lx, SBLK *sblk, uint8_t *mm) {
-  if (!sblk->kvblk && sblk->kvblkn) {
-    return _kvblk_at_mm(lx, BLK2ADDR(sblk->kvblkn), mm, 0, &sblk->kvblk);
-  } else {
-    return 0;
+// Hold disposal if it is faster than `IWKV_DISPOSE_OPTS::rate`, limit is ignored when storage is closing
+static void _db_dispose_throttle(DISPOSE_DB_CTX *dctx, uint64_t num) {
+  uint64_t ts;
+  uint32_t rate = dctx->iwkv->dispose_opts.rate;
+  if (!rate) {
+    return;
   }
-}
-
-IW_INLINE WUR iwrc _sblk_loadkvblk(IWLCTX *lx, SBLK *sblk) {
-  if (!sblk->kvblk && sblk->kvblkn) {
-    uint8_t *mm;
-    IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-    iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-    RCRET(rc);
-    rc = _sblk_loadkvblk_mm(lx, sblk, mm);
-    fsm->release_mmap(fsm);
-    return rc;
-  } else {
-    return 0;
+  uint64_t due = dctx->ts + num * 1000000000ULL / rate;
+  while (dctx->iwkv->open && !iwp_monotonic_time_ns(&ts) && ts < due) {
+    uint64_t ms = (due - ts) / 1000000ULL;
+    iwp_sleep(ms < 1 ? 1 : ms > 100 ? 100 : ms);
   }
 }
 
-
-IW_INLINE WUR iwrc _sblk_destroy(IWLCTX *lx, SBLK **sblkp) {
-  assert(sblkp && *sblkp && (*sblkp)->addr);
+// Release blocks of chain segment `[sbn, end)` in batches of `DISPOSE_BATCH` `SBLK` blocks
+static iwrc _db_dispose_segment(DISPOSE_DB_CTX *dctx, blkn_t sbn, blkn_t end, IWFS_FSM_RANGE *ranges) {
   iwrc rc = 0;
-  SBLK *sblk = *sblkp;
-  if (!(sblk->flags & SBLK_DB)) {
-    uint8_t kvb_szpow;
-    IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-    off_t kvb_addr = BLK2ADDR(sblk->kvblkn),
-          sblk_addr = sblk->addr;
-    if (!sblk->kvblk) {
-      // Read KVBLK size as power of two
-      uint8_t *mm;
-      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-      RCRET(rc);
-      memcpy(&kvb_szpow, mm + kvb_addr + KBLK_SZPOW_OFF, 1);
-      fsm->release_mmap(fsm);
-    } else {
-      kvb_szpow = sblk->kvblk->szpow;
+  uint8_t *mm, kvszpow;
+  size_t msize;
+  blkn_t kvblkn;
+  IWKV iwkv = dctx->iwkv;
+  IWFS_FSM *fsm = dctx->fsm;
+  const IWKV_DISPOSE_OPTS *opts = &iwkv->dispose_opts;
+  while (sbn && sbn != end) {
+    size_t rnum = 0, snum = 0;
+    rc = fsm->acquire_mmap(fsm, 0, &mm, &msize);
+    RCBREAK(rc);
+    for ( ; sbn && sbn != end && snum < DISPOSE_BATCH && rnum < 2 * DISPOSE_BATCH; ++snum) {
+      off_t sba = BLK2ADDR(sbn);
+      memcpy(&kvblkn, mm + sba + SOFF_KBLK_U4, 4);
+      kvblkn = IW_ITOHL(kvblkn);
+      memcpy(&sbn, mm + sba + SOFF_N0_U4, 4);
+      sbn = IW_ITOHL(sbn);
+      ranges[rnum].addr = sba;
+      ranges[rnum++].len = SBLK_SZ;
+      if (kvblkn) {
+        if (dctx->ovl) {
+          rnum += _kvblk_ovl_ranges(mm, msize, kvblkn, dctx->pnmax, ranges + rnum);
+        }
+        memcpy(&kvszpow, mm + BLK2ADDR(kvblkn) + KBLK_SZPOW_OFF, 1);
+        ranges[rnum].addr = BLK2ADDR(kvblkn);
+        ranges[rnum++].len = 1 << kvszpow;
+      }
     }
-    if (lx->db->lcnt[sblk->lvl]) {
-      lx->db->lcnt[sblk->lvl]--;
-      lx->db->flags |= SBLK_DURTY;
+    rc = fsm->release_mmap(fsm);
+    RCBREAK(rc);
+    rc = fsm->deallocate_batch(fsm, ranges, rnum);
+    if (rc) {
+      iwlog_ecode_error3(rc);
+      rc = 0;
     }
-    if (sblk->flags & SBLK_CACHE_REMOVE) {
-      _dbcache_remove_lw(lx, sblk);
+    uint64_t num = atomic_fetch_add_explicit(&dctx->num, snum, memory_order_relaxed) + snum;
+    if (opts->progress) {
+      opts->progress(dctx->dbid, num, false, opts->progress_ctx);
     }
-    _sblk_release(lx, sblkp);
-    rc = fsm->deallocate(fsm, sblk_addr, SBLK_SZ);
-    IWRC(fsm->deallocate(fsm, kvb_addr, 1ULL << kvb_szpow), rc);
-  } else {
-    _sblk_release(lx, sblkp);
+    _db_dispose_throttle(dctx, num);
   }
   return rc;
 }
 
-IW_INLINE uint8_t _sblk_genlevel(IWDB db) {
-  int8_t lvl;
-#ifdef IW_TESTS
-  if (iwkv_next_level >= 0) {
-    lvl = iwkv_next_level;
-    iwkv_next_level = -1;
-    assert(lvl >= 0 && lvl < SLEVELS);
-    return lvl;
-  } else if (iwkv_next_level == -2) {
-    uint32_t r = random(); // up to 0x7fffffff (not 0xffffffff)
-    for (lvl = 0; lvl < SLEVELS && !(r & 1); ++lvl) r >>= 1;
-    return IW_UNLIKELY(lvl >= SLEVELS) ? SLEVELS - 1 : lvl;
+static void *_db_dispose_worker(void *op) {
+  size_t i;
+  DISPOSE_DB_CTX *dctx = op;
+  IWFS_FSM_RANGE *ranges = malloc(DISPOSE_RANGES_NUM * sizeof(*ranges));
+  if (!ranges) {
+    iwlog_ecode_error3(iwrc_set_errno(IW_ERROR_ALLOC, errno));
+    return 0;
   }
-#endif
-  uint8_t ret;
-  uint32_t r = iwu_rand_u32();
-  for (lvl = 0; lvl < SLEVELS && !(r & 1); ++lvl) r >>= 1;
-  ret = IW_UNLIKELY(lvl >= SLEVELS) ? SLEVELS - 1 : lvl;
-  while (ret > 0 && db->lcnt[ret - 1] == 0) {
-    --ret;
+  while ((i = atomic_fetch_add(&dctx->segpos, 1)) < dctx->segnum) {
+    iwrc rc = _db_dispose_segment(dctx, dctx->segs[i], i + 1 < dctx->segnum ? dctx->segs[i + 1] : 0, ranges);
+    if (rc) {
+      iwlog_ecode_error3(rc);
+    }
   }
-  return ret;
+  free(ranges);
+  return 0;
 }
 
-static WUR iwrc _sblk_create(IWLCTX *lx, int8_t nlevel, int8_t kvbpow, off_t baddr, SBLK **oblk) {
-  iwrc rc;
-  SBLK *sblk;
-  KVBLK *kvblk;
-  off_t blen;
-  IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-  if (kvbpow < KVBLK_INISZPOW) {
-    kvbpow = KVBLK_INISZPOW;
+// Deallocate chain of `SBLK` blocks linked by `n[0]` along with their `KVBLK` blocks.
+// Chain is split into segments by upper skip list levels and segments are disposed in parallel.
+static void _db_dispose_chain(DISPOSE_DB_CTX *dctx) {
+  IWKV iwkv = dctx->iwkv;
+  const IWKV_DISPOSE_OPTS *opts = &iwkv->dispose_opts;
+  pthread_t thrs[DISPOSE_THREADS_MAX * 4];
+  size_t tnum = 0, nthreads = opts->threads;
+  if (!nthreads) {
+    nthreads = MIN(iwp_num_cpu_cores(), DISPOSE_THREADS_MAX);
+  }
+  nthreads = MIN(nthreads, sizeof(thrs) / sizeof(thrs[0]));
+  iwp_monotonic_time_ns(&dctx->ts);
+  iwrc rc = _db_dispose_split(dctx, nthreads > 1 ? nthreads * DISPOSE_SEGS_PER_THREAD : 1);
+  if (rc) {
+    iwlog_ecode_error3(rc);
   }
-  off_t kvblksz = 1ULL << kvbpow;
-  *oblk = 0;
-  rc = fsm->allocate(fsm, SBLK_SZ + kvblksz, &baddr, &blen,
-                     IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
+  for (size_t i = 1; i < nthreads && i < dctx->segnum; ++i) {
+    if (pthread_create(&thrs[tnum], 0, _db_dispose_worker, dctx)) {
+      break;
+    }
+    ++tnum;
+  }
+  _db_dispose_worker(dctx);
+  for (size_t i = 0; i < tnum; ++i) {
+    pthread_join(thrs[i], 0);
+  }
+  if (dctx->segs != &dctx->sbn) {
+    free(dctx->segs);
+  }
+  dctx->segs = 0;
+  if (opts->progress) {
+    opts->progress(dctx->dbid, atomic_load(&dctx->num), true, opts->progress_ctx);
+  }
+}
+
+static void *_db_dispose_chain_thr(void *op) {
+  assert(op);
+  DISPOSE_DB_CTX *dctx = op;
+  pthread_detach(dctx->thr);
+  _db_dispose_chain(dctx);
+  if (dctx->db) {
+    _db_release_lw(&dctx->db);
+  }
+  iwrc rc = _iwkv_worker_dec_nolk(dctx->iwkv);
+  if (rc) {
+    iwlog_ecode_error3(rc);
+  }
+  free(dctx);
+  return 0;
+}
+
+// Deallocate detached chain of blocks starting from `sbn` in background.
+// Chain is disposed by the calling thread if background thread cannot be started.
+static WUR iwrc _db_dispose_chain_bg(IWDB db, blkn_t sbn) {
+  IWKV iwkv = db->iwkv;
+  DISPOSE_DB_CTX sctx, *dctx = malloc(sizeof(*dctx));
+  if (!dctx) {
+    dctx = &sctx;
+  }
+  _db_dispose_ctx_init(dctx, db, sbn, 0, 0);
+  iwrc rc = _iwkv_worker_inc_nolk(iwkv);
+  if (rc) {
+    if (dctx != &sctx) {
+      free(dctx);
+    }
+    return rc;
+  }
+  if (dctx != &sctx && !pthread_create(&dctx->thr, 0, _db_dispose_chain_thr, dctx)) {
+    return 0;
+  }
+  _db_dispose_chain(dctx);
+  if (dctx != &sctx) {
+    free(dctx);
+  }
+  return _iwkv_worker_dec_nolk(iwkv);
+}
+
+static WUR iwrc _db_destroy_lw(IWDB *dbp) {
+  int rci;
+  iwrc rc;
+  uint8_t *mm;
+  IWDB db = *dbp;
+  IWKV iwkv = db->iwkv;
+  IWDB prev = db->prev;
+  IWDB next = db->next;
+  IWFS_FSM *fsm = &db->file->fsm;
+  DISPOSE_DB_CTX *dctx = 0;
+  uint32_t first_sblkn, bloomn;
+  uint8_t bloompow;
+  bool dec_worker = true;
+
+  kh_del(DBS, db->iwkv->dbs, db->id);
+  _rcache_drop_db(iwkv, db->id);
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   RCRET(rc);
+  _shm_chain_begin(iwkv);
+  if (prev) {
+    prev->next = next;
+    _db_save(prev, mm);
+  }
+  if (next) {
+    next->prev = prev;
+    _db_save(next, mm);
+  }
+  // [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[24]:u4,c[24]:u4]:209
+  memcpy(&first_sblkn, mm + db->addr + DOFF_N0_U4, 4);
+  first_sblkn = IW_ITOHL(first_sblkn);
+  memcpy(&bloomn, mm + db->addr + DOFF_BLOOM_U4, 4);
+  bloomn = IW_ITOHL(bloomn);
+  memcpy(&bloompow, mm + db->addr + DOFF_BLOOMPOW_U1, 1);
+  if (first_sblkn) {
+    dctx = malloc(sizeof(*dctx));
+    if (dctx) {
+      _db_dispose_ctx_init(dctx, db, first_sblkn, mm, db->addr);
+    } else {
+      rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    }
+  }
+  fsm->release_mmap(fsm);
+  if (db->file->first_db && db->file->first_db->addr == db->addr) {
+    uint64_t llv;
+    db->file->first_db = next;
+    llv = next ? next->addr : 0;
+    llv = IW_HTOILL(llv);
+    rc = fsm->writehdr(fsm, sizeof(uint32_t) /*skip magic*/, &llv, sizeof(llv));
+  }
+  _shm_chain_end(iwkv);
+  if (db->file->last_db && db->file->last_db->addr == db->addr) {
+    db->file->last_db = prev;
+  }
+  // Cleanup DB
+  off_t db_addr = db->addr;
+  if (dctx) {
+    db->open = false;
+    // Caller handle may be reused before disposal is finished
+    dctx->db = db;
+    *dbp = 0;
+    rci = pthread_create(&dctx->thr, 0, _db_dispose_chain_thr, dctx);
+    if (rci) {
+      *dbp = db;
+      free(dctx);
+      rc = iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+    } else {
+      dec_worker = false;
+    }
+  }
+  if (bloomn) {
+    IWRC(fsm->deallocate(fsm, BLK2ADDR(bloomn), BLOOM_PSIZE(bloompow)), rc);
+  }
+  IWRC(fsm->deallocate(fsm, db_addr, DB_SZ), rc);
+  if (dec_worker) {
+    _db_release_lw(dbp);
+    _iwkv_worker_dec_nolk(iwkv);
+  }
+  return rc;
+}
 
-  assert(blen - SBLK_SZ == kvblksz);
-  _kvblk_create(lx, baddr + SBLK_SZ, kvblksz, kvbpow, &kvblk);
+static WUR iwrc _db_create_lw(IWKV iwkv, dbid_t dbid, iwdb_flags_t dbflg, IWDB *odb) {
+  iwrc rc;
+  int rci;
+  uint8_t *mm = 0;
+  off_t baddr = 0, blen;
+  // Databases are spread across storage files by id
+  IWKV_FILE *file = &iwkv->files[dbid % iwkv->files_num];
+  IWFS_FSM *fsm = &file->fsm;
+  *odb = 0;
+  IWDB db = calloc(1, sizeof(struct IWDB));
+  if (!db) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  rci = pthread_rwlock_init(&db->rwl, 0);
+  if (rci) {
+    free(db);
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  rc = _db_latches_init(db);
+  if (rc) {
+    pthread_rwlock_destroy(&db->rwl);
+    free(db);
+    return rc;
+  }
+  rc = fsm->allocate(fsm, DB_SZ, &baddr, &blen,
+                     IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
+  if (rc) {
+    _db_release_lw(&db);
+    return rc;
+  }
+  db->iwkv = iwkv;
+  db->file = file;
+  db->dbflg = dbflg;
+  db->addr = baddr;
+  db->id = dbid;
+  _db_pnmax_set(db);
+  _db_kops_init(db);
+  _db_cache_opts_set(db, &iwkv->dbcache_opts);
+  db->ovl_threshold = IWDB_OVERFLOW_THRESHOLD_DEFAULT;
+  db->prev = file->last_db;
+  _shm_chain_begin(iwkv);
+  if (!file->first_db) {
+    uint64_t llv;
+    file->first_db = db;
+    llv = db->addr;
+    llv = IW_HTOILL(llv);
+    rc = fsm->writehdr(fsm, sizeof(uint32_t) /*skip magic*/, &llv, sizeof(llv));
+  } else if (file->last_db) {
+    file->last_db->next = db;
+  }
+  file->last_db = db;
+  khiter_t k = kh_put(DBS, iwkv->dbs, db->id, &rci);
+  if (rci != -1) {
+    kh_value(iwkv->dbs, k) = db;
+  } else {
+    RCGO(IW_ERROR_FAIL, finish);
+  }
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCGO(rc, finish);
+  // Allocated space may contain data of freed blocks
+  memset(mm + db->addr, 0, DB_SZ);
+  _db_save(db, mm);
+  if (db->prev) {
+    _db_save(db->prev, mm);
+  }
+  db->open = true;
+  *odb = db;
+finish:
+  _shm_chain_end(iwkv);
+  if (mm) {
+    fsm->release_mmap(fsm);
+  }
+  if (rc) {
+    fsm->deallocate(fsm, baddr, blen);
+    _db_release_lw(&db);
+  }
+  return rc;
+}
+
+//--------------------------  KVBLK
+
+IW_INLINE void _kvblk_create(IWLCTX *lx, off_t baddr, off_t blen, uint8_t kvbpow, KVBLK **oblk) {
+  KVBLK *kblk = &lx->kaa[lx->kaan];
+  assert((1ULL << kvbpow) == blen);
+  kblk->db = lx->db;
+  kblk->addr = baddr;
+  kblk->maxoff = 0;
+  kblk->idxsz = 2 * IW_VNUMSIZE(0) * lx->db->pnmax;
+  kblk->zidx = 0;
+  kblk->szpow = kvbpow;
+  kblk->pfxl = 0;
+  kblk->snap = 0;
+  kblk->flags = KVBLK_DURTY;
+  memset(kblk->pidx, 0, sizeof(kblk->pidx));
+  *oblk = kblk;
+  AAPOS_INC(lx->kaan);
+}
+
+// Set keys prefix of the empty `kb` block.
+// Prefix is immutable until block is destroyed, keys not started with prefix are stored as is.
+IW_INLINE void _kvblk_set_pfx(KVBLK *kb, const uint8_t *pfx, uint32_t pfxl) {
+  assert(!kb->maxoff && pfxl <= KVBLK_MAX_PFXLEN);
+  if (kb->pfxl) {
+    kb->idxsz -= 1 + kb->pfxl;
+  }
+  kb->pfxl = pfxl;
+  if (pfxl) {
+    memcpy(kb->pfx, pfx, pfxl);
+    kb->idxsz += 1 + pfxl;
+  }
+  kb->flags |= KVBLK_DURTY;
+}
+
+IW_INLINE WUR iwrc _kvblk_destroy(KVBLK **kbp) {
+  assert(kbp && *kbp && (*kbp)->db && (*kbp)->szpow && (*kbp)->addr);
+  KVBLK *blk = *kbp;
+  IWFS_FSM *fsm = &blk->db->file->fsm;
+  return fsm->deallocate(fsm, blk->addr, 1ULL << blk->szpow);
+}
+
+// Data of `kb` block: image kept by snapshot or storage
+IW_INLINE const uint8_t *_kvblk_data(const KVBLK *kb, const uint8_t *mm) {
+  const uint8_t *img;
+  if (IW_UNLIKELY(kb->snap) && (img = _snap_image(kb->snap, kb->addr))) {
+    return img;
+  }
+  return mm + kb->addr;
+}
+
+// Read key of `kvp` pair: [klen:vn,key,value]
+// Pairs of block with keys prefix: [(klen << 1 | has_prefix):vn,key,value]
+// where `klen` is the length of key part stored in pair.
+// Returns length of pair header and stored key or zero if pair is corrupted.
+IW_INLINE uint32_t _kvblk_kvkey(const KVBLK *kb, const KVP *kvp, const uint8_t *mm, KVKEY *k) {
+  uint32_t kh, step;
+  const uint8_t *rp = _kvblk_data(kb, mm) + (1ULL << kb->szpow) - kvp->off;
+  IW_READVNUMBUF(rp, kh, step);
+  if (kb->pfxl && (kh & 1)) {
+    k->pfx = kb->pfx;
+    k->pfxl = kb->pfxl;
+  } else {
+    k->pfx = 0;
+    k->pfxl = 0;
+  }
+  if (kb->pfxl) {
+    kh >>= 1;
+  }
+  k->buf = rp + step;
+  k->len = kh;
+  if (IW_UNLIKELY(!KVKEY_SIZE(*k) || kh > kvp->len || step + kh > kvp->len)) {
+    return 0;
+  }
+  return step + kh;
+}
+
+IW_INLINE WUR iwrc _kvblk_peek_key(const KVBLK *kb, uint8_t idx, const uint8_t *mm, KVKEY *okey) {
+  if (kb->pidx[idx].len) {
+    if (IW_UNLIKELY(!_kvblk_kvkey(kb, &kb->pidx[idx], mm, okey))) {
+      memset(okey, 0, sizeof(*okey));
+      iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+      return IWKV_ERROR_CORRUPTED;
+    }
+  } else {
+    memset(okey, 0, sizeof(*okey));
+  }
+  return 0;
+}
+
+IW_INLINE void _kvblk_peek_val(const KVBLK *kb, uint8_t idx, const uint8_t *mm, uint8_t **obuf, uint32_t *olen) {
+  assert(idx < kb->db->pnmax);
+  KVKEY k;
+  uint32_t ksz;
+  if (kb->pidx[idx].len && (ksz = _kvblk_kvkey(kb, &kb->pidx[idx], mm, &k))) {
+    *obuf = (uint8_t *) k.buf + k.len;
+    *olen = kb->pidx[idx].len - ksz;
+    if ((kb->db->dbflg & IWDB_OVERFLOW_VALS) && !_ovl_locate(mm, SIZE_MAX, (const uint8_t **) obuf, olen)) {
+      iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+      *obuf = 0;
+      *olen = 0;
+    }
+  } else {
+    *obuf = 0;
+    *olen = 0;
+  }
+}
+
+// Get extent of out of line value of `IWDB_OVERFLOW_VALS` database pair `idx`,
+// `*oaddr` is set to zero if value is stored inline
+static WUR iwrc _kvblk_ovl_extent(const KVBLK *kb, uint8_t idx, off_t *oaddr, uint32_t *olen) {
+  KVKEY k;
+  uint8_t *mm;
+  uint32_t ksz;
+  IWFS_FSM *fsm = &kb->db->file->fsm;
+  *oaddr = 0;
+  if (!(kb->db->dbflg & IWDB_OVERFLOW_VALS) || !kb->pidx[idx].len) {
+    return 0;
+  }
+  iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   RCRET(rc);
+  ksz = _kvblk_kvkey(kb, &kb->pidx[idx], mm, &k);
+  if (ksz) {
+    if (!_ovl_extent(k.buf + k.len, kb->pidx[idx].len - ksz, oaddr, olen)) {
+      *oaddr = 0;
+    }
+  } else {
+    rc = IWKV_ERROR_CORRUPTED;
+    iwlog_ecode_error3(rc);
+  }
+  fsm->release_mmap(fsm);
+  return rc;
+}
 
-  sblk = &lx->saa[lx->saan];
-  sblk->db = lx->db;
-  sblk->db->lcnt[nlevel]++;
-  sblk->db->flags |= SBLK_DURTY;
-  sblk->addr = baddr;
-  sblk->flags = (SBLK_DURTY | SBLK_CACHE_PUT);
-  sblk->lvl = nlevel;
-  sblk->p0 = 0;
-  memset(sblk->n, 0, sizeof(sblk->n));
-  sblk->kvblk = kvblk;
-  sblk->kvblkn = ADDR2BLK(kvblk->addr);
-  sblk->lkl = 0;
-  sblk->pnum = 0;
-  memset(sblk->pi, 0, sizeof(sblk->pi));
-  *oblk = sblk;
-  AAPOS_INC(lx->saan);
+static WUR iwrc _kvblk_getkey(KVBLK *kb, uint8_t *mm, uint8_t idx, IWKV_val *key, IWPOOL *pool) {
+  assert(mm && idx < kb->db->pnmax);
+  KVKEY k;
+  KVP *kvp = &kb->pidx[idx];
+  if (!kvp->len) {
+    key->data = 0;
+    key->size = 0;
+    return 0;
+  }
+  if (!_kvblk_kvkey(kb, kvp, mm, &k)) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
+  }
+  key->size = KVKEY_SIZE(k);
+  key->data = _kv_alloc(pool, key->size);
+  if (!key->data) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  _kvkey_copy(&k, key->data, key->size);
   return 0;
 }
 
-static WUR iwrc _sblk_at2(IWLCTX *lx, off_t addr, sblk_flags_t flgs, SBLK *sblk) {
-  iwrc rc;
+static WUR iwrc _kvblk_getvalue(KVBLK *kb, uint8_t *mm, uint8_t idx, IWKV_val *val, IWPOOL *pool) {
+  assert(mm && idx < kb->db->pnmax);
+  KVKEY k;
+  uint32_t ksz;
+  KVP *kvp = &kb->pidx[idx];
+  if (!kvp->len) {
+    val->data = 0;
+    val->size = 0;
+    return 0;
+  }
+  ksz = _kvblk_kvkey(kb, kvp, mm, &k);
+  if (!ksz) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
+  }
+  const uint8_t *vp = k.buf + k.len;
+  uint32_t vl = kvp->len - ksz;
+  if ((kb->db->dbflg & IWDB_OVERFLOW_VALS) && !_ovl_locate(mm, SIZE_MAX, &vp, &vl)) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
+  }
+  if (vl) {
+    val->size = vl;
+    val->data = _kv_alloc(pool, val->size);
+    if (!val->data) {
+      iwrc rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      val->data = 0;
+      val->size = 0;
+      return rc;
+    }
+    memcpy(val->data, vp, val->size);
+  } else {
+    val->data = 0;
+    val->size = 0;
+  }
+  return 0;
+}
+
+// Get key and value of pair `idx`, out of line values of `IWDB_OVERFLOW_VALS` database
+// are loaded unless `raw` is set
+static WUR iwrc _kvblk_getkv(KVBLK *kb, uint8_t *mm, uint8_t idx, IWKV_val *key, IWKV_val *val,
+                              bool raw, IWPOOL *pool) {
+  assert(mm && idx < kb->db->pnmax);
+  KVKEY k;
+  uint32_t ksz;
+  KVP *kvp = &kb->pidx[idx];
+  if (!kvp->len) {
+    key->data = 0;
+    key->size = 0;
+    val->data = 0;
+    val->size = 0;
+    return 0;
+  }
+  ksz = _kvblk_kvkey(kb, kvp, mm, &k);
+  if (!ksz) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
+  }
+  key->size = KVKEY_SIZE(k);
+  key->data = _kv_alloc(pool, key->size);
+  if (!key->data) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  _kvkey_copy(&k, key->data, key->size);
+  const uint8_t *vp = k.buf + k.len;
+  uint32_t vl = kvp->len - ksz;
+  if (!raw && (kb->db->dbflg & IWDB_OVERFLOW_VALS) && !_ovl_locate(mm, SIZE_MAX, &vp, &vl)) {
+    _kv_val_release(pool, key);
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
+  }
+  if (vl) {
+    val->size = vl;
+    val->data = _kv_alloc(pool, val->size);
+    if (!val->data) {
+      iwrc rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      _kv_val_release(pool, key);
+      val->size = 0;
+      return rc;
+    }
+    memcpy(val->data, vp, val->size);
+  } else {
+    val->data = 0;
+    val->size = 0;
+  }
+  return 0;
+}
+
+static WUR iwrc _kvblk_at_mm(IWLCTX *lx, off_t addr, uint8_t *mm, KVBLK *kbp, KVBLK **blkp) {
+  uint8_t *rp, *bp;
+  uint16_t sv;
+  int step;
+  iwrc rc = 0;
+  KVBLK *kb = kbp ? kbp : &lx->kaa[lx->kaan];
+  kb->db = lx->db;
+  kb->addr = addr;
+  kb->snap = lx->snap;
+  kb->maxoff = 0;
+  kb->idxsz = 0;
+  kb->zidx = -1;
+  kb->szpow = 0;
+  kb->pfxl = 0;
+  kb->flags = 0;
+  memset(kb->pidx, 0, sizeof(kb->pidx));
+
+  *blkp = 0;
+  if (IW_UNLIKELY(lx->snap && lx->snap->rc)) {
+    return lx->snap->rc;
+  }
+  rp = bp = _lx_blk(lx, mm, addr);
+  memcpy(&kb->szpow, rp, 1);
+  rp += 1;
+  IW_READSV(rp, sv, kb->idxsz);
+  if (kb->idxsz & KVBLK_PFX_IDXSZ) {
+    kb->idxsz &= ~KVBLK_PFX_IDXSZ;
+    kb->pfxl = *rp++;
+    if (IW_UNLIKELY(!kb->pfxl || kb->pfxl > KVBLK_MAX_PFXLEN || kb->idxsz < 1 + kb->pfxl)) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      goto finish;
+    }
+    memcpy(kb->pfx, rp, kb->pfxl);
+    rp += kb->pfxl;
+  }
+  if (IW_UNLIKELY(kb->idxsz > KVBLK_MAX_IDX_SZ_N(lx->db->pnmax) + (kb->pfxl ? 1 + kb->pfxl : 0))) {
+    rc = IWKV_ERROR_CORRUPTED;
+    iwlog_ecode_error3(rc);
+    goto finish;
+  }
+  for (int i = 0; i < kb->db->pnmax; ++i) {
+    IW_READVNUMBUF64(rp, kb->pidx[i].off, step);
+    rp += step;
+    IW_READVNUMBUF(rp, kb->pidx[i].len, step);
+    rp += step;
+    if (kb->pidx[i].len) {
+      if (IW_UNLIKELY(!kb->pidx[i].off)) {
+        rc = IWKV_ERROR_CORRUPTED;
+        iwlog_ecode_error3(rc);
+        goto finish;
+      }
+      if (kb->pidx[i].off > kb->maxoff) {
+        kb->maxoff = kb->pidx[i].off;
+      }
+    } else if (kb->zidx < 0) {
+      kb->zidx = i;
+    }
+    kb->pidx[i].ridx = i;
+  }
+  *blkp = kb;
+  assert(rp - bp <= (1ULL << kb->szpow));
+  if (!kbp) {
+    AAPOS_INC(lx->kaan);
+  }
+finish:
+  return rc;
+}
+
+IW_INLINE WUR iwrc _kvblk_at(IWLCTX *lx, SBLK *sblk, KVBLK **blkp) {
+  if (sblk->kvblk) {
+    *blkp = sblk->kvblk;
+    return 0;
+  }
+  iwrc rc;
+  uint8_t *mm;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  *blkp = 0;
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  rc = _kvblk_at_mm(lx, BLK2ADDR(sblk->kvblkn), mm, 0, blkp);
+  IWRC(fsm->release_mmap(fsm), rc);
+  return rc;
+}
+
+IW_INLINE off_t _kvblk_compacted_offset(KVBLK *kb) {
+  off_t coff = 0;
+  for (int i = 0; i < kb->db->pnmax; ++i) {
+    coff += kb->pidx[i].len;
+  }
+  return coff;
+}
+
+IW_INLINE off_t _kvblk_compacted_dsize(KVBLK *kb) {
+  off_t coff = KVBLK_HDRSZ + (kb->pfxl ? 1 + kb->pfxl : 0);
+  for (int i = 0; i < kb->db->pnmax; ++i) {
+    coff += kb->pidx[i].len;
+    coff += IW_VNUMSIZE32(kb->pidx[i].len);
+    coff += IW_VNUMSIZE(kb->pidx[i].off);
+  }
+  return coff;
+}
+
+static void _kvblk_sync_mm(KVBLK *kb, uint8_t *mm) {
+  if (!(kb->flags & KVBLK_DURTY)) {
+    return;
+  }
+  _snap_keep(kb->db, mm, kb->addr, 1ULL << kb->szpow);
+  uint16_t sp;
+  uint8_t *szp;
+  uint8_t *wp = mm + kb->addr;
+  memcpy(wp, &kb->szpow, 1);
+  wp += 1;
+  szp = wp;
+  wp += sizeof(uint16_t);
+  if (kb->pfxl) {
+    *wp++ = kb->pfxl;
+    memcpy(wp, kb->pfx, kb->pfxl);
+    wp += kb->pfxl;
+  }
+  for (int i = 0; i < kb->db->pnmax; ++i) {
+    KVP *kvp = &kb->pidx[i];
+    IW_SETVNUMBUF64(sp, wp, kvp->off);
+    wp += sp;
+    IW_SETVNUMBUF(sp, wp, kvp->len);
+    wp += sp;
+  }
+  sp = wp - szp - sizeof(uint16_t);
+  kb->idxsz = sp;
+  assert(kb->idxsz <= KVBLK_MAX_NKV_SZ_N(kb->db->pnmax) - KVBLK_HDRSZ);
+  if (kb->pfxl) {
+    sp |= KVBLK_PFX_IDXSZ;
+  }
+  sp = IW_HTOIS(sp);
+  memcpy(szp, &sp, sizeof(uint16_t));
+  assert(wp - (mm + kb->addr) <= (1ULL << kb->szpow));
+  kb->flags &= ~KVBLK_DURTY;
+  // Whole block is reported since sync follows pairs area changes
+  kb->db->file->fsm.dirty_mmap(&kb->db->file->fsm, kb->addr, 1ULL << kb->szpow);
+}
+
+#define _kvblk_sort_kv_lt(v1, v2) \
+  (((v1).off > 0 ? (v1).off : -1UL) < ((v2).off > 0 ? (v2).off : -1UL))
+
+KSORT_INIT(kvblk, KVP, _kvblk_sort_kv_lt)
+
+static void _kvblk_compact_mm(KVBLK *kb, uint8_t *mm) {
+  uint8_t i;
+  const uint8_t pnmax = kb->db->pnmax;
+  off_t coff = _kvblk_compacted_offset(kb);
+  if (coff == kb->maxoff) { // already compacted
+    return;
+  }
+  _dbstat_add(kb->db, DBS_COMPACTIONS, 1);
+  _snap_keep(kb->db, mm, kb->addr, 1ULL << kb->szpow);
+  KVP tidx[KVBLK_IDXNUM_MAX];
+  KVP tidx_tmp[KVBLK_IDXNUM_MAX];
+  uint16_t idxsiz = kb->pfxl ? 1 + kb->pfxl : 0;
+  uint8_t *wp = mm + kb->addr + (1ULL << kb->szpow);
+  memcpy(tidx, kb->pidx, sizeof(tidx));
+  ks_mergesort_kvblk(pnmax, tidx, tidx_tmp);
+
+  coff = 0;
+  for (i = 0; i < pnmax && tidx[i].off; ++i) {
+#ifndef NDEBUG
+    if (i > 0) {
+      assert(tidx[i - 1].off < tidx[i].off);
+    }
+#endif
+    KVP *kvp = &kb->pidx[tidx[i].ridx];
+    off_t noff = coff + kvp->len;
+    if (kvp->off > noff) {
+      assert(noff <= (1ULL << kb->szpow) && kvp->len <= noff);
+      memmove(wp - noff, wp - kvp->off, kvp->len);
+      kvp->off = noff;
+    }
+    coff += kvp->len;
+    idxsiz += IW_VNUMSIZE(kvp->off);
+    idxsiz += IW_VNUMSIZE32(kvp->len);
+  }
+  idxsiz += (pnmax - i) * 2;
+  for (i = 0; i < pnmax; ++i) {
+    if (!kb->pidx[i].len)  {
+      kb->zidx = i;
+      break;
+    }
+  }
+  assert(idxsiz <= kb->idxsz);
+  kb->idxsz = idxsiz;
+  kb->maxoff = coff;
+  if (i == pnmax) {
+    kb->zidx = -1;
+  }
+  kb->flags |= KVBLK_DURTY;
+  assert(_kvblk_compacted_offset(kb) == kb->maxoff);
+}
+
+IW_INLINE off_t _kvblk_maxkvoff(KVBLK *kb) {
+  off_t off = 0;
+  for (int i = 0; i < kb->db->pnmax; ++i) {
+    if (kb->pidx[i].off > off) {
+      off = kb->pidx[i].off;
+    }
+  }
+  return off;
+}
+
+static WUR iwrc _kvblk_rmkv(KVBLK *kb, uint8_t idx, kvblk_rmkv_opts_t opts) {
+  iwrc rc = 0;
+  uint8_t *mm = 0;
+  IWFS_FSM *fsm = &kb->db->file->fsm;
+  if (kb->pidx[idx].off >= kb->maxoff) {
+    kb->maxoff = 0;
+    for (int i = 0; i < kb->db->pnmax; ++i) {
+      if (i != idx && kb->pidx[i].off > kb->maxoff) {
+        kb->maxoff = kb->pidx[i].off;
+      }
+    }
+  }
+  kb->pidx[idx].len = 0;
+  kb->pidx[idx].off = 0;
+  kb->flags |= KVBLK_DURTY;
+  if (kb->zidx < 0 || idx < kb->zidx) {
+    kb->zidx = idx;
+  }
+  if (!(RMKV_NO_RESIZE & opts) && kb->szpow > KVBLK_INISZPOW) {
+    off_t nlen = 1ULL << kb->szpow;
+    uint64_t dsz = _kvblk_compacted_dsize(kb);
+    if (nlen >= 2 * dsz) {
+      uint8_t npow = kb->szpow - 1;
+      while (npow > KVBLK_INISZPOW && (1ULL << (npow - 1)) >= dsz) {
+        --npow;
+      }
+      off_t oaddr = kb->addr;
+      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+      RCGO(rc, finish);
+      _snap_keep(kb->db, mm, kb->addr, nlen);
+      _kvblk_compact_mm(kb, mm);
+      off_t maxoff = _kvblk_maxkvoff(kb);
+      memmove(mm + kb->addr + (1ULL << npow) - maxoff,
+              mm + kb->addr + nlen - maxoff,
+              maxoff);
+      fsm->release_mmap(fsm);
+      mm = 0;
+      rc = fsm->reallocate(fsm, (1ULL << npow), &kb->addr, &nlen,
+                           IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
+      RCGO(rc, finish);
+      if (IW_UNLIKELY(kb->db->snaps) && kb->addr != oaddr) {
+        _snap_fresh(kb->db, kb->addr);
+      }
+      kb->szpow = npow;
+      assert(nlen == (1ULL << kb->szpow));
+      opts |= RMKV_SYNC;
+    }
+  }
+  if (RMKV_SYNC & opts) {
+    if (!mm) {
+      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+      RCGO(rc, finish);
+    }
+    _kvblk_sync_mm(kb, mm);
+  }
+finish:
+  if (mm) {
+    fsm->release_mmap(fsm);
+  }
+  return rc;
+}
+
+// Select keys prefix of a new block as common prefix of `k1` and `k2` keys.
+// Prefix is cut at the first zero byte so it can be compared with `strncmp()` separately from the rest of key.
+// Returns prefix length or zero if common prefix is too short.
+static uint32_t _kvblk_pfx_select(const KVKEY *k1, const KVKEY *k2, uint8_t *pfx) {
+  uint32_t i = 0, n = MIN(KVKEY_SIZE(*k1), KVKEY_SIZE(*k2));
+  for (n = MIN(n, KVBLK_MAX_PFXLEN); i < n; ++i) {
+    uint8_t c = _kvkey_at(k1, i);
+    if (!c || c != _kvkey_at(k2, i)) {
+      break;
+    }
+    pfx[i] = c;
+  }
+  return i < KVBLK_MIN_PFXLEN ? 0 : i;
+}
+
+// Key header of `key` pair stored in `kb`, `okl` is set to the length of key part stored in pair
+IW_INLINE uint32_t _kvblk_kh(const KVBLK *kb, const IWKV_val *key, uint32_t *okl) {
+  if (!kb->pfxl) {
+    *okl = key->size;
+    return key->size;
+  } else if (key->size >= kb->pfxl && !memcmp(key->data, kb->pfx, kb->pfxl)) {
+    *okl = key->size - kb->pfxl;
+    return (*okl << 1) | 1;
+  } else {
+    *okl = key->size;
+    return key->size << 1;
+  }
+}
+
+static WUR iwrc _kvblk_addkv(KVBLK *kb,
+                             const IWKV_val *key,
+                             const IWKV_val *val,
+                             int8_t *oidx,
+                             iwkv_opflags opflags,
+                             bool internal) {
+  iwrc rc = 0;
+  off_t msz;    // max available free space
+  off_t rsz;    // required size to add new key/value pair
+  off_t noff;   // offset of new kvpair from end of block
+  uint8_t *mm, *wp;
+  size_t i, sp;
+  KVP *kvp;
+  IWDB db = kb->db;
+  IWFS_FSM *fsm = &db->file->fsm;
+  *oidx = -1;
+  bool compacted = false;
+  IWKV_val *uval = (IWKV_val *) val, sval;
+  uint32_t kl, kh = _kvblk_kh(kb, key, &kl);
+  off_t psz = IW_VNUMSIZE32(kh) + kl + uval->size; // required KVP size
+
+#ifndef NDEBUG
+  uint8_t *sptr;
+#endif
+
+  if (kb->zidx < 0) {
+    return _IWKV_ERROR_KVBLOCK_FULL;
+  }
+  _snap_keep(db, 0, kb->addr, 1ULL << kb->szpow);
+  // DUP
+  if (!internal && (db->dbflg & IWDB_DUP_FLAGS)) {
+    if (opflags & IWKV_DUP_REMOVE) {
+      return IWKV_ERROR_NOTFOUND;
+    }
+    if (((db->dbflg & IWDB_DUP_UINT32_VALS) && val->size != 4) ||
+        ((db->dbflg & IWDB_DUP_UINT64_VALS) && val->size != 8)) {
+      return IWKV_ERROR_DUP_VALUE_SIZE;
+    }
+    uint32_t lv = 1;
+    uint8_t vbuf[8];
+    uval = &sval;
+    if (db->dbflg & IWDB_DUP_PACKED) {
+      uint64_t dv = _dup_val(val);
+      uval->size = PDUP_HDRSZ + PDUP_SHDRSZ;
+      uval->data = malloc(uval->size);
+      if (!uval->data) {
+        return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      }
+      _pdup_hdr_set(uval->data, 1, 1);
+      _pdup_slot_encode((uint8_t *) uval->data + PDUP_HDRSZ, PDUP_SHDRSZ, &dv, 1);
+      psz += uval->size - val->size;
+    } else {
+      _num2lebuf(vbuf, val->data, val->size);
+      uval->data = malloc(4 + val->size);
+      if (!uval->data) {
+        return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      }
+      uval->size = 4 + val->size;
+      psz += 4;
+      lv = IW_HTOIL(lv);
+      wp = uval->data;
+      memcpy(wp, &lv, 4);
+      memcpy(wp + 4, vbuf, val->size);
+    }
+  }
+  // !DUP
+  if (IW_VNUMSIZE(key->size) + key->size + uval->size > IWKV_MAX_KVSZ) {
+    if (uval != val) {
+      _kv_val_dispose(uval);
+    }
+    return IWKV_ERROR_MAXKVSZ;
+  }
+
+start:
+  // [szpow:u1,idxsz:u2,[ps0:vn,pl0:vn,..., ps32,pl32]____[[KV],...]] // KVBLK
+  msz = (1ULL << kb->szpow) - (KVBLK_HDRSZ + kb->idxsz + kb->maxoff);
+  assert(msz >= 0);
+  noff = kb->maxoff + psz;
+  rsz = psz + IW_VNUMSIZE(noff) + IW_VNUMSIZE(psz);
+
+  if (msz < rsz) { // not enough space
+    if (!compacted) {
+      compacted = true;
+      if (_kvblk_compacted_offset(kb) != kb->maxoff) {
+        rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+        RCGO(rc, finish);
+        _kvblk_compact_mm(kb, mm);
+        fsm->release_mmap(fsm);
+        goto start;
+      }
+    }
+    // resize the whole block
+    off_t nsz = (rsz - msz) + (1ULL << kb->szpow);
+    uint8_t npow = kb->szpow;
+    while ((1ULL << ++npow) < nsz);
+    off_t naddr = kb->addr;
+    off_t nlen = 1ULL << kb->szpow;
+
+    assert(!fsm->check_allocation_status(fsm, naddr, nlen, true));
+    rc = fsm->reallocate(fsm, (1ULL << npow), &naddr, &nlen,
+                         IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
+    RCGO(rc, finish);
+    assert(nlen == (1ULL << npow));
+    if (IW_UNLIKELY(db->snaps) && naddr != kb->addr) {
+      _snap_fresh(db, naddr);
+    }
+    // Move pairs area
+    // [hdr..[pairs]] =reallocate=> [hdr..[pairs]_____] =memove=> [hdr.._____[pairs]]
+    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+    RCGO(rc, finish);
+    kb->addr = naddr;
+    memmove(mm + naddr + nlen - kb->maxoff,
+            mm + naddr + (1ULL << kb->szpow) - kb->maxoff, kb->maxoff);
+    fsm->release_mmap(fsm);
+    kb->szpow = npow;
+  }
+  *oidx = kb->zidx;
+  kvp = &kb->pidx[kb->zidx];
+  kvp->len = psz;
+  kvp->off = noff;
+  kvp->ridx = kb->zidx;
+  kb->maxoff = noff;
+  kb->flags |= KVBLK_DURTY;
+  for (i = 0; i < kb->db->pnmax; ++i) {
+    if (!kb->pidx[i].len && i != kb->zidx) {
+      kb->zidx = i;
+      break;
+    }
+  }
+  if (i >= kb->db->pnmax) {
+    kb->zidx = -1;
+  }
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCGO(rc, finish);
+  assert((1ULL << kb->szpow) >= KVBLK_HDRSZ + kb->idxsz + kb->maxoff);
+  assert(kvp->off < (1ULL << kb->szpow) && kvp->len <= kvp->off);
+  wp = mm + kb->addr + (1ULL << kb->szpow) - kvp->off;
+#ifndef NDEBUG
+  sptr = wp;
+#endif
+  // [klen:vn,key,value]
+  IW_SETVNUMBUF(sp, wp, kh);
+  wp += sp;
+  memcpy(wp, (uint8_t *) key->data + (key->size - kl), kl);
+  wp += kl;
+  memcpy(wp, uval->data, uval->size);
+  wp += uval->size;
+#ifndef NDEBUG
+  assert(wp - sptr == kvp->len);
+#endif
+  fsm->dirty_mmap(fsm, kb->addr + (1ULL << kb->szpow) - kvp->off, kvp->len);
+  fsm->release_mmap(fsm);
+finish:
+  if (uval != val) {
+    _kv_val_dispose(uval);
+  }
+  return rc;
+}
+
+static WUR iwrc _kvblk_updatev(KVBLK *kb,
+                               int8_t *idxp,
+                               const IWKV_val *key, /* Nullable */
+                               const IWKV_val *val,
+                               iwkv_opflags opflags,
+                               bool internal) {
+  assert(*idxp < kb->db->pnmax);
+  int32_t i;
+  uint32_t len, nlen, sz;
+  IWDB db = kb->db;
+  int8_t idx = *idxp;
+  uint8_t *mm = 0, *wp, *sp;
+  IWKV_val *uval = (IWKV_val *) val;
+  IWKV_val *ukey = (IWKV_val *) key;
+  IWKV_val sval, skey; // stack allocated key/val
+  KVKEY k;
+  KVP *kvp = &kb->pidx[idx];
+  size_t kbsz = 1ULL << kb->szpow; // kvblk size
+  off_t freesz = kbsz - KVBLK_HDRSZ - kb->idxsz - kb->maxoff; // free space available
+  IWFS_FSM *fsm = &db->file->fsm;
+  iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  assert(freesz >= 0);
+  _snap_keep(db, mm, kb->addr, kbsz);
+
+  // DUP
+  if (!internal && (db->dbflg & IWDB_DUP_FLAGS)
+      && (((db->dbflg & IWDB_DUP_UINT32_VALS) && val->size != 4) ||
+          ((db->dbflg & IWDB_DUP_UINT64_VALS) && val->size != 8))) {
+    rc = IWKV_ERROR_DUP_VALUE_SIZE;
+    goto finish;
+  }
+  if (!internal && (db->dbflg & IWDB_DUP_PACKED)) {
+    uint32_t num, nslots;
+    _kvblk_peek_val(kb, idx, mm, &wp, &len);
+    rc = _pdup_update(wp, len, _dup_val(val), (opflags & IWKV_DUP_REMOVE), &nlen);
+    RCGO(rc, finish);
+    if (!nlen) {
+      if ((opflags & IWKV_DUP_REMOVE) && _pdup_hdr(wp, len, &num, &nslots)
+          && len >= 2 * (PDUP_HDRSZ + nslots * PDUP_SLOTSZ)) {
+        // Reduce size of kv value buffer
+        kvp->len = kvp->len - len / 2;
+        kb->flags |= KVBLK_DURTY;
+      }
+      goto finish;
+    }
+    // Grow value buffer until the value fits
+    uval = &sval;
+    uval->data = 0;
+    uval->size = 0;
+    while (nlen) {
+      if (nlen > IWKV_MAX_KVSZ) {
+        rc = IWKV_ERROR_MAXKVSZ;
+        goto finish;
+      }
+      uint8_t *nbuf = realloc(uval->data, nlen);
+      if (!nbuf) {
+        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+        goto finish;
+      }
+      memcpy(nbuf, wp, len);
+      memset(nbuf + len, 0, nlen - len);
+      uval->data = nbuf;
+      uval->size = nlen;
+      rc = _pdup_update(nbuf, nlen, _dup_val(val), false, &nlen);
+      RCGO(rc, finish);
+    }
+  } else if (!internal && (db->dbflg & IWDB_DUP_FLAGS)) {
+    _kvblk_peek_val(kb, idx, mm, &wp, &len);
+    if (len < 4) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      goto finish;
+    }
+    sp = wp;
+    memcpy(&sz, wp, 4); // number of elements
+    sz = IW_ITOHL(sz);
+    wp += 4;
+    if (len < 4 + sz * val->size) {
+      // kv capacity is less than reported number of items (sz)
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      goto finish;
+    }
+    uint8_t vbuf[8];
+    uint32_t avail = len - (4 /* num items */ + sz * val->size);
+    _num2lebuf(vbuf, val->data, val->size);
+
+    if (opflags & IWKV_DUP_REMOVE) {
+      if (!sz || !iwarr_sorted_remove(wp, sz, val->size, vbuf,  val->size > 4 ? _u8cmp : _u4cmp)) {
+        rc = IWKV_ERROR_NOTFOUND;
+        goto finish;
+      }
+      sz -= 1;
+      sz = IW_HTOIL(sz);
+      memcpy(sp, &sz, 4);
+      if (len >= (4 + sz * val->size) * 2) {
+        // Reduce size of kv value buffer
+        kvp->len = kvp->len - len / 2;
+        kb->flags |= KVBLK_DURTY;
+      }
+      goto finish;
+
+    } else if (avail >= val->size) { // we have enough room to store the given number
+      if (iwarr_sorted_insert(wp, sz, val->size, vbuf,
+                              val->size > 4 ? _u8cmp : _u4cmp, true) == -1) {
+        goto finish;
+      }
+      // Increment number of items
+      sz += 1;
+      sz = IW_HTOIL(sz);
+      memcpy(sp, &sz, 4);
+      goto finish;
+    } else {
+      // reallocate value buf
+      uval = &sval;
+      nlen = len;
+      while (avail < val->size) {
+        nlen *= 2;
+        avail = nlen - (4 + sz * val->size);
+      }
+      uval->data = malloc(nlen);
+      if (!uval->data) {
+        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+        goto finish;
+      }
+      // zero initialize extra bytes
+      memset((uint8_t *)uval->data + len, 0, nlen - len);
+      uval->size = nlen;
+      memcpy(uval->data, sp, len);
+      if (iwarr_sorted_insert((uint8_t *)uval->data + 4, sz, val->size, vbuf,
+                              val->size > 4 ? _u8cmp : _u4cmp, true) == -1) {
+        goto finish;
+      }
+      sz += 1;
+      sz = IW_HTOIL(sz);
+      memcpy(uval->data, &sz, 4);
+    }
+  }
+  // !DUP
+  sp = mm + kb->addr + kbsz - kvp->off;
+  len = _kvblk_kvkey(kb, kvp, mm, &k);
+  if (!len || (ukey && KVKEY_SIZE(k) != ukey->size)) {
+    rc = IWKV_ERROR_CORRUPTED;
+    iwlog_ecode_error3(rc);
+    goto finish;
+  }
+  wp = sp + len;
+  off_t rsize = len + uval->size; // required size
+  if (rsize <= kvp->len) {
+    memcpy(wp, uval->data, uval->size);
+    wp += uval->size;
+    if ((wp - sp) != kvp->len) {
+      kvp->len = wp - sp;
+      kb->flags |= KVBLK_DURTY;
+    }
+  } else {
+    KVP tidx[KVBLK_IDXNUM_MAX];
+    KVP tidx_tmp[KVBLK_IDXNUM_MAX];
+    off_t koff = kb->pidx[idx].off;
+    memcpy(tidx, kb->pidx, kb->db->pnmax * sizeof(kb->pidx[0]));
+    ks_mergesort_kvblk(kb->db->pnmax, tidx, tidx_tmp);
+    kb->flags |= KVBLK_DURTY;
+    if (!ukey) { // we need a key
+      ukey = &skey;
+      rc = _kvblk_getkey(kb, mm, idx, ukey, 0);
+      RCGO(rc, finish);
+    }
+    for (i = 0; i < kb->db->pnmax; ++i) {
+      if (tidx[i].off == koff) {
+        if (koff - (i > 0 ? tidx[i - 1].off : 0) >= rsize) {
+          uint32_t nlen = wp + uval->size - sp;
+          if (!(nlen > kvp->len && freesz - IW_VNUMSIZE32(nlen) + IW_VNUMSIZE32(kvp->len) < 0)) { // enough space?
+            memcpy(wp, uval->data, uval->size);
+            wp += uval->size;
+            kvp->len = nlen;
+            break;;
+          }
+        }
+        // todo: optimize?
+        mm = 0;
+        fsm->release_mmap(fsm);
+        rc = _kvblk_rmkv(kb, idx, RMKV_NO_RESIZE);
+        RCGO(rc, finish);
+        rc = _kvblk_addkv(kb, ukey, uval, idxp, opflags, true);
+        break;
+      }
+    }
+  }
+
+finish:
+  if (uval != val) {
+    _kv_val_dispose(uval);
+  }
+  if (ukey != key) {
+    _kv_val_dispose(ukey);
+  }
+  if (!rc) { // Value may be updated in place
+    fsm->dirty_mmap(fsm, kb->addr, 1ULL << kb->szpow);
+  }
+  if (mm) {
+    IWRC(fsm->release_mmap(fsm), rc);
+  }
+  return rc;
+}
+
+// True if `_kvblk_addkv()` of not DUP key/value neither compacts nor reallocates `kb`
+IW_INLINE bool _kvblk_addkv_fits(KVBLK *kb, const IWKV_val *key, const IWKV_val *val) {
+  uint32_t kl, kh = _kvblk_kh(kb, key, &kl);
+  off_t psz = IW_VNUMSIZE32(kh) + kl + val->size;
+  if (kb->zidx < 0 || IW_VNUMSIZE(key->size) + key->size + val->size > IWKV_MAX_KVSZ) {
+    return false;
+  }
+  off_t msz = (1ULL << kb->szpow) - (KVBLK_HDRSZ + kb->idxsz + kb->maxoff);
+  off_t noff = kb->maxoff + psz;
+  return msz >= psz + IW_VNUMSIZE(noff) + IW_VNUMSIZE(psz);
+}
+
+// True if `_kvblk_updatev()` of not DUP value overwrites it in place
+IW_INLINE bool _kvblk_updatev_fits(KVBLK *kb, int8_t idx, const IWKV_val *key, const IWKV_val *val) {
+  uint32_t kl, kh = _kvblk_kh(kb, key, &kl);
+  return IW_VNUMSIZE32(kh) + kl + val->size <= kb->pidx[idx].len;
+}
+
+//--------------------------  SBLK
+
+IW_INLINE void _sblk_release(IWLCTX *lx, SBLK **sblkp) {
+  assert(sblkp && *sblkp);
+  SBLK *sblk = *sblkp;
+  sblk->flags &= ~SBLK_CACHE_FLAGS; // clear cache flags
+  sblk->kvblk = 0;
+  *sblkp = 0;
+}
+
+IW_INLINE WUR iwrc _sblk_loadkvblk_mm(IWLCTX *lx, SBLK *sblk, uint8_t *mm) {
+  if (!sblk->kvblk && sblk->kvblkn) {
+    return _kvblk_at_mm(lx, BLK2ADDR(sblk->kvblkn), mm, 0, &sblk->kvblk);
+  } else {
+    return 0;
+  }
+}
+
+IW_INLINE WUR iwrc _sblk_loadkvblk(IWLCTX *lx, SBLK *sblk) {
+  if (!sblk->kvblk && sblk->kvblkn) {
+    uint8_t *mm;
+    IWFS_FSM *fsm = &lx->db->file->fsm;
+    iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+    RCRET(rc);
+    rc = _sblk_loadkvblk_mm(lx, sblk, mm);
+    fsm->release_mmap(fsm);
+    return rc;
+  } else {
+    return 0;
+  }
+}
+
+
+IW_INLINE WUR iwrc _sblk_destroy(IWLCTX *lx, SBLK **sblkp) {
+  assert(sblkp && *sblkp && (*sblkp)->addr);
+  iwrc rc = 0;
+  SBLK *sblk = *sblkp;
+  if (!(sblk->flags & SBLK_DB)) {
+    uint8_t kvb_szpow;
+    IWFS_FSM *fsm = &lx->db->file->fsm;
+    off_t kvb_addr = BLK2ADDR(sblk->kvblkn),
+          sblk_addr = sblk->addr;
+    if (!sblk->kvblk) {
+      // Read KVBLK size as power of two
+      uint8_t *mm;
+      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+      RCRET(rc);
+      memcpy(&kvb_szpow, mm + kvb_addr + KBLK_SZPOW_OFF, 1);
+      fsm->release_mmap(fsm);
+    } else {
+      kvb_szpow = sblk->kvblk->szpow;
+    }
+    if (lx->db->lcnt[sblk->lvl]) {
+      lx->db->lcnt[sblk->lvl]--;
+      lx->db->flags |= SBLK_DURTY;
+    }
+    if (sblk->flags & SBLK_CACHE_REMOVE) {
+      _dbcache_remove_lw(lx, sblk);
+    }
+    _sblk_release(lx, sblkp);
+    rc = _db_deallocate(lx->db, sblk_addr, SBLK_SZ);
+    IWRC(_db_deallocate(lx->db, kvb_addr, 1ULL << kvb_szpow), rc);
+  } else {
+    _sblk_release(lx, sblkp);
+  }
+  return rc;
+}
+
+// Levels of new skip list nodes are drawn from per-thread xorshift64* generators,
+// so inserting threads don't contend on the lock of global `iwu_rand_u32()` generator.
+// Generators are seeded from `_lvl_seed` on the first use after it is set by `iwkv_open()`.
+static atomic_uint_fast64_t _lvl_seed;            /**< Seed of per-thread level generators */
+static atomic_uint_fast32_t _lvl_gen = 1;         /**< Incremented every time `_lvl_seed` is set */
+static atomic_uint_fast64_t _lvl_threads;         /**< Number of generators seeded since `_lvl_seed` is set */
+static _Thread_local uint64_t _lvl_rnd;           /**< Generator state of current thread */
+static _Thread_local uint32_t _lvl_rnd_gen;       /**< `_lvl_gen` of current thread generator, `0` if not seeded */
+
+static void _lvl_seed_set(uint64_t seed) {
+  atomic_store_explicit(&_lvl_seed, seed, memory_order_relaxed);
+  atomic_store_explicit(&_lvl_threads, 0, memory_order_relaxed);
+  atomic_fetch_add_explicit(&_lvl_gen, 1, memory_order_release);
+}
+
+IW_INLINE uint32_t _lvl_rand(void) {
+  uint32_t gen = atomic_load_explicit(&_lvl_gen, memory_order_acquire);
+  if (IW_UNLIKELY(_lvl_rnd_gen != gen)) {
+    // SplitMix64 of seed and thread sequence number, state is never zero
+    uint64_t z = atomic_load_explicit(&_lvl_seed, memory_order_relaxed) + 0x9e3779b97f4a7c15ULL
+                 * (1 + atomic_fetch_add_explicit(&_lvl_threads, 1, memory_order_relaxed));
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    _lvl_rnd = (z ^ (z >> 31)) | 1;
+    _lvl_rnd_gen = gen;
+  }
+  uint64_t x = _lvl_rnd;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  _lvl_rnd = x;
+  return (x * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+IW_INLINE uint8_t _sblk_genlevel(IWDB db) {
+  int8_t lvl;
+#ifdef IW_TESTS
+  if (iwkv_next_level >= 0) {
+    lvl = iwkv_next_level;
+    iwkv_next_level = -1;
+    assert(lvl >= 0 && lvl < SLEVELS);
+    return lvl;
+  } else if (iwkv_next_level == -2) {
+    uint32_t r = random(); // up to 0x7fffffff (not 0xffffffff)
+    for (lvl = 0; lvl < SLEVELS && !(r & 1); ++lvl) r >>= 1;
+    return IW_UNLIKELY(lvl >= SLEVELS) ? SLEVELS - 1 : lvl;
+  }
+#endif
+  uint8_t ret;
+  uint32_t r = _lvl_rand();
+  // Level is the number of trailing zero bits: probability of level `n` is `1/2^(n+1)`
+  lvl = r ? iwbits_find_first_sbit64(r) : SLEVELS;
+  ret = IW_UNLIKELY(lvl >= SLEVELS) ? SLEVELS - 1 : lvl;
+  while (ret > 0 && db->lcnt[ret - 1] == 0) {
+    --ret;
+  }
+  return ret;
+}
+
+static WUR iwrc _sblk_create(IWLCTX *lx, int8_t nlevel, int8_t kvbpow, off_t baddr, SBLK **oblk) {
+  iwrc rc;
+  SBLK *sblk;
+  KVBLK *kvblk;
+  off_t blen;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  if (kvbpow < KVBLK_INISZPOW) {
+    kvbpow = KVBLK_INISZPOW;
+  }
+  off_t kvblksz = 1ULL << kvbpow;
+  *oblk = 0;
+  rc = fsm->allocate(fsm, SBLK_SZ + kvblksz, &baddr, &blen,
+                     IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
+  RCRET(rc);
+
+  assert(blen - SBLK_SZ == kvblksz);
+  if (IW_UNLIKELY(lx->db->snaps)) {
+    _snap_fresh(lx->db, baddr);
+    _snap_fresh(lx->db, baddr + SBLK_SZ);
+  }
+  _kvblk_create(lx, baddr + SBLK_SZ, kvblksz, kvbpow, &kvblk);
+  RCRET(rc);
+
+  sblk = &lx->saa[lx->saan];
+  sblk->db = lx->db;
+  sblk->db->lcnt[nlevel]++;
+  sblk->db->flags |= SBLK_DURTY;
+  sblk->addr = baddr;
+  sblk->flags = (SBLK_DURTY | SBLK_CACHE_PUT);
+  sblk->lvl = nlevel;
+  sblk->p0 = 0;
+  memset(sblk->n, 0, sizeof(sblk->n));
+  sblk->kvblk = kvblk;
+  sblk->kvblkn = ADDR2BLK(kvblk->addr);
+  sblk->lkl = 0;
+  sblk->pnum = 0;
+  memset(sblk->pi, 0, sizeof(sblk->pi));
+  *oblk = sblk;
+  AAPOS_INC(lx->saan);
+  return 0;
+}
+
+static WUR iwrc _sblk_at2(IWLCTX *lx, off_t addr, sblk_flags_t flgs, SBLK *sblk) {
+  iwrc rc;
+  uint8_t *mm;
+  uint32_t lv;
+  sblk_flags_t flags = lx->sblk_flags | flgs;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  sblk->kvblk = 0;
+  sblk->db = lx->db;
+  if (IW_UNLIKELY(lx->snap && lx->snap->rc)) {
+    return lx->snap->rc;
+  }
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  if (IW_UNLIKELY(addr == lx->db->addr)) {
+    uint8_t *rp = _lx_blk(lx, mm, addr) + DOFF_N0_U4;
+    // [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[24]:u4,c[24]:u4]:209
+    sblk->addr = addr;
+    sblk->flags = SBLK_DB | flags;
+    sblk->lvl = 0;
+    sblk->p0 = 0;
+    sblk->kvblkn = 0;
+    sblk->lkl = 0;
+    sblk->pnum = lx->db->pnmax;
+    memset(sblk->pi, 0, sizeof(sblk->pi));
+    for (int i = 0; i < SLEVELS; ++i) {
+      IW_READLV(rp, lv, sblk->n[i]);
+      if (sblk->n[i]) {
+        ++sblk->lvl;
+      } else {
+        break;
+      }
+    }
+    if (sblk->lvl) --sblk->lvl;
+  } else if (addr) {
+    uint8_t *bp = _lx_blk(lx, mm, addr), *rp = bp;
+    sblk->addr = addr;
+    // [u1:flags,lvl:u1,lkl:u1,pnum:u1,p0:u4,kblk:u4,[pi0:u1,... pi32],n0-n23:u4,lk:u116]:u256
+    memcpy(&sblk->flags, rp++, 1);
+    if (sblk->flags & ~SBLK_PERSISTENT_FLAGS) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      goto finish;
+    }
+    sblk->flags |= flags;
+    memcpy(&sblk->lvl, rp++, 1);
+    if (sblk->lvl >= SLEVELS) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      goto finish;
+    }
+    memcpy(&sblk->lkl, rp++, 1);
+    if (sblk->lkl > lx->db->lklen) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      goto finish;
+    }
+    memcpy(&sblk->pnum, rp++, 1);
+    if (sblk->pnum < 0 || sblk->pnum > lx->db->pnmax) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      goto finish;
+    }
+    memcpy(&sblk->p0, rp, 4);
+    sblk->p0 = IW_ITOHL(sblk->p0);
+    rp += 4;
+    memcpy(&sblk->kvblkn, rp, 4);
+    sblk->kvblkn = IW_ITOHL(sblk->kvblkn);
+    rp += 4;
+    memcpy(sblk->pi, rp, KVBLK_IDXNUM);
+    rp += KVBLK_IDXNUM;
+    for (int i = 0; i <= sblk->lvl; ++i) {
+      memcpy(&sblk->n[i], rp, 4);
+      sblk->n[i] = IW_ITOHL(sblk->n[i]);
+      rp += 4;
+    }
+    rp = bp + SOFF_LK;
+    memcpy(sblk->lk, rp, sblk->lkl);
+    if (lx->db->pnmax > KVBLK_IDXNUM) {
+      memcpy(sblk->pi + KVBLK_IDXNUM, bp + SOFF_PI32_U1, KVBLK_IDXNUM_MAX - KVBLK_IDXNUM);
+    }
+  } else { // Database tail
+    uint8_t *rp = _lx_blk(lx, mm, lx->db->addr) + DOFF_P0_U4;
+    sblk->addr = 0;
+    sblk->flags = SBLK_DB | flags;
+    sblk->lvl = 0;
+    sblk->kvblkn = 0;
+    sblk->lkl = 0;
+    sblk->pnum = lx->db->pnmax;
+    memset(sblk->pi, 0, sizeof(sblk->pi));
+    IW_READLV(rp, lv, sblk->p0);
+    if (!sblk->p0) {
+      sblk->p0 = ADDR2BLK(lx->db->addr);
+    }
+  }
+finish:
+  fsm->release_mmap(fsm);
+  return rc;
+}
+
+IW_INLINE WUR iwrc _sblk_at(IWLCTX *lx, off_t addr, sblk_flags_t flgs, SBLK **sblkp) {
+  *sblkp = 0;
+  SBLK *sblk = &lx->saa[lx->saan];
+  iwrc rc = _sblk_at2(lx, addr, flgs, sblk);
+  AAPOS_INC(lx->saan);
+  *sblkp = sblk;
+  return rc;
+}
+
+static WUR iwrc _sblk_sync_mm(IWLCTX *lx, SBLK *sblk, uint8_t *mm) {
+  iwrc rc = 0;
+  if (sblk->flags & SBLK_DURTY) {
+    sblk->flags &= ~SBLK_DURTY;
+    uint32_t lv;
+    if (IW_UNLIKELY(sblk->flags & SBLK_DB)) {
+      uint8_t *wp = mm + sblk->db->addr;
+      _snap_keep(lx->db, mm, sblk->db->addr, DB_SZ);
+      if (sblk->addr) {
+        assert(sblk->addr == sblk->db->addr);
+        wp += DOFF_N0_U4;
+        // [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[24]:u4,c[24]:u4]:209
+        for (int i = 0; i < SLEVELS; ++i) {
+          IW_WRITELV(wp, lv, sblk->n[i]);
+        }
+        assert(wp - (mm + sblk->db->addr) <= SBLK_SZ);
+        for (int i = 0; i < SLEVELS; ++i) {
+          IW_WRITELV(wp, lv, lx->db->lcnt[i]);
+        }
+      } else { // Database tail
+        wp += DOFF_P0_U4;
+        IW_WRITELV(wp, lv, sblk->p0);
+        assert(wp - (mm + sblk->db->addr) <= SBLK_SZ);
+      }
+      lx->db->file->fsm.dirty_mmap(&lx->db->file->fsm, sblk->db->addr, DB_SZ);
+      return 0;
+    } else {
+      uint8_t *wp = mm + sblk->addr;
+      sblk_flags_t flags = (sblk->flags & SBLK_PERSISTENT_FLAGS);
+      _snap_keep(lx->db, mm, sblk->addr, SBLK_SZ);
+      assert(sblk->lkl <= lx->db->lklen);
+      // [u1:flags,lvl:u1,lkl:u1,pnum:u1,p0:u4,kblk:u4,[pi0:u1,... pi32],n0-n23:u4,lk:u116]:u256
+      wp += SOFF_FLAGS_U1;
+      memcpy(wp++, &flags, 1);
+      memcpy(wp++, &sblk->lvl, 1);
+      memcpy(wp++, &sblk->lkl, 1);
+      memcpy(wp++, &sblk->pnum, 1);
+      IW_WRITELV(wp, lv, sblk->p0);
+      IW_WRITELV(wp, lv, sblk->kvblkn);
+      memcpy(wp, sblk->pi, KVBLK_IDXNUM);
+      wp = mm + sblk->addr + SOFF_N0_U4;
+      for (int i = 0; i <= sblk->lvl; ++i) {
+        IW_WRITELV(wp, lv, sblk->n[i]);
+      }
+      wp = mm + sblk->addr + SOFF_LK;
+      memcpy(wp, sblk->lk, sblk->lkl);
+      if (lx->db->pnmax > KVBLK_IDXNUM) {
+        memcpy(mm + sblk->addr + SOFF_PI32_U1, sblk->pi + KVBLK_IDXNUM, KVBLK_IDXNUM_MAX - KVBLK_IDXNUM);
+      }
+      lx->db->file->fsm.dirty_mmap(&lx->db->file->fsm, sblk->addr, SBLK_SZ);
+    }
+  }
+  if (sblk->kvblk && (sblk->kvblk->flags & KVBLK_DURTY)) {
+    _kvblk_sync_mm(sblk->kvblk, mm);
+  }
+  if (sblk->flags & SBLK_CACHE_UPDATE) {
+    _dbcache_update_lw(lx, sblk);
+  }
+  return rc;
+}
+
+IW_INLINE WUR iwrc _sblk_sync_and_release_mm(IWLCTX *lx, SBLK **sblkp, uint8_t *mm) {
+  iwrc rc = 0;
+  if (mm) {
+    rc = _sblk_sync_mm(lx, *sblkp, mm);
+  }
+  _sblk_release(lx, sblkp);
+  return rc;
+}
+
+IW_INLINE WUR iwrc _sblk_sync_and_release(IWLCTX *lx, SBLK **sblkp) {
+  assert(sblkp && *sblkp);
+  SBLK *sblk = *sblkp;
+  if ((sblk->flags & SBLK_DURTY) || (sblk->kvblk && (sblk->kvblk->flags & KVBLK_DURTY))) {
+    uint8_t *mm;
+    IWFS_FSM *fsm = &lx->db->file->fsm;
+    iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+    RCRET(rc);
+    _db_wseq_begin(lx->db);
+    rc = _sblk_sync_mm(lx, *sblkp, mm);
+    _db_wseq_end(lx->db);
+    _sblk_release(lx, sblkp);
+    fsm->release_mmap(fsm);
+    return rc;
+  } else {
+    _sblk_release(lx, sblkp);
+    return 0;
+  }
+}
+
+// Binary search of `key` in `sblk` of `IWDB_UINT_KEYS_FLAGS` database,
+// search key is decoded once and compared as an integer on every probe
+IW_INLINE WUR iwrc _sblk_find_pi_uint_mm(SBLK *sblk, const IWKV_val *key, const uint8_t *mm,
+                                         bool *found, uint8_t *idxp, iwdb_flags_t dbflg) {
+  KVKEY k;
+  uint32_t ksz = _uint_key_size(dbflg);
+  uint64_t skey = _uint_key(dbflg, key->data);
+  int idx = 0,
+      lb = 0,
+      ub = sblk->pnum - 1;
+  while (lb <= ub) {
+    idx = (ub + lb) / 2;
+    iwrc rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[idx], mm, &k);
+    RCRET(rc);
+    if (IW_UNLIKELY(k.len != ksz || k.pfxl)) {
+      iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+      return IWKV_ERROR_CORRUPTED;
+    }
+    uint64_t pkey = _uint_key(dbflg, k.buf);
+    if (pkey == skey) {
+      *found = true;
+      *idxp = idx;
+      return 0;
+    } else if (pkey > skey) {
+      lb = idx + 1;
+    } else {
+      ub = idx - 1;
+    }
+  }
+  *idxp = lb;
+  return 0;
+}
+
+// Binary search of `key` in `sblk` with comparator of `kt` key type, see `KOPS_IMPL()`
+IW_INLINE WUR iwrc _sblk_find_pi_kt_mm(SBLK *sblk, const IWKV_val *key, const uint8_t *mm,
+                                       bool *found, uint8_t *idxp, ktype_t kt) {
+  KVKEY k;
+  if ((kt == KT_U32 || kt == KT_U64) && key->size == _uint_key_size(_kt_dbflg(kt))) {
+    return _sblk_find_pi_uint_mm(sblk, key, mm, found, idxp, _kt_dbflg(kt));
+  }
+  int idx = 0,
+      lb = 0,
+      ub = sblk->pnum - 1;
+  if (sblk->pnum < 1) {
+    *idxp = 0;
+    return 0;
+  }
+  while (1) {
+    idx = (ub + lb) / 2;
+    iwrc rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[idx], mm, &k);
+    RCRET(rc);
+    int cr = _kt_cmp_kvkey(sblk->db, kt, &k, key->data, key->size);
+    if (!cr) {
+      *found = true;
+      break;
+    } else if (cr < 0) {
+      lb = idx + 1;
+      if (lb > ub) {
+        idx = lb;
+        break;
+      }
+    } else {
+      ub = idx - 1;
+      if (lb > ub) {
+        break;
+      }
+    }
+  }
+  *idxp = idx;
+  return 0;
+}
+
+IW_INLINE WUR iwrc _sblk_find_pi_mm(SBLK *sblk, const IWKV_val *key, const uint8_t *mm, bool *found, uint8_t *idxp) {
+  *found = false;
+  if (sblk->flags & SBLK_DB) {
+    *idxp = sblk->db->pnmax;
+    return 0;
+  }
+  return sblk->db->kops->find_pi(sblk, key, mm, found, idxp);
+}
+
+// Position of the first key less than `key` in `sblk`
+static WUR iwrc _sblk_pos_lt_mm(IWLCTX *lx, SBLK *sblk, const IWKV_val *key, uint8_t *mm, uint8_t *opos) {
+  bool found;
+  uint8_t idx;
+  iwrc rc = _sblk_loadkvblk_mm(lx, sblk, mm);
+  RCRET(rc);
+  rc = _sblk_find_pi_mm(sblk, key, mm, &found, &idx);
+  RCRET(rc);
+  *opos = found ? idx + 1 : idx;
+  return 0;
+}
+
+// Insert `nidx` slot of `key` into sorted slots of `sblk` with comparator of `kt` key type
+IW_INLINE WUR iwrc _sblk_insert_pi_kt_mm(SBLK *sblk, uint8_t nidx, const IWKV_val *key,
+                                         const uint8_t *mm, uint8_t *idxp, ktype_t kt) {
+  assert(sblk->kvblk);
+  KVKEY k;
+  int idx = 0,
+      lb = 0,
+      ub = sblk->pnum - 1,
+      nels = sblk->pnum;
+  if (nels < 1) {
+    sblk->pi[0] = nidx;
+    ++sblk->pnum;
+    *idxp = 0;
+    return 0;
+  }
+  while (1) {
+    idx = (ub + lb) / 2;
+    iwrc rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[idx], mm, &k);
+    RCRET(rc);
+    int cr = _kt_cmp_kvkey(sblk->db, kt, &k, key->data, key->size);
+    if (!cr) {
+      break;
+    } else if (cr < 0) {
+      lb = idx + 1;
+      if (lb > ub) {
+        idx = lb;
+        ++sblk->pnum;
+        break;
+      }
+    } else {
+      ub = idx - 1;
+      if (lb > ub) {
+        ++sblk->pnum;
+        break;
+      }
+    }
+  }
+  if (nels - idx > 0) {
+    memmove(sblk->pi + idx + 1, sblk->pi + idx, nels - idx);
+  }
+  sblk->pi[idx] = nidx;
+  *idxp = idx;
+  return 0;
+}
+
+IW_INLINE WUR iwrc _sblk_insert_pi_mm(SBLK *sblk, uint8_t nidx, const IWKV_val *key,
+                                      const uint8_t *mm, uint8_t *idxp) {
+  return sblk->db->kops->insert_pi(sblk, nidx, key, mm, idxp);
+}
+
+IW_INLINE WUR iwrc _sblk_addkv2(SBLK *sblk, int8_t idx, const IWKV_val *key, const IWKV_val *val,
+                                iwkv_opflags opflags, bool internal) {
+  assert(sblk && key && key->size && key->data &&
+         val && idx >= 0 && sblk->kvblk);
+  int8_t kvidx;
+  KVBLK *kvblk = sblk->kvblk;
+  if (sblk->pnum >= sblk->db->pnmax) {
+    return _IWKV_ERROR_KVBLOCK_FULL;
+  }
+  if (!internal && (opflags & IWKV_DUP_REMOVE)) {
+    return IWKV_ERROR_NOTFOUND;
+  }
+  iwrc rc = _kvblk_addkv(kvblk, key, val, &kvidx, opflags, internal);
+  RCRET(rc);
+  if (sblk->pnum - idx > 0) {
+    memmove(sblk->pi + idx + 1, sblk->pi + idx, sblk->pnum - idx);
+  }
+  sblk->pi[idx] = kvidx;
+  if (sblk->kvblkn != ADDR2BLK(kvblk->addr)) {
+    sblk->kvblkn = ADDR2BLK(kvblk->addr);
+    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
+      sblk->flags |= SBLK_CACHE_UPDATE;
+    }
+  }
+  ++sblk->pnum;
+  sblk->flags |= SBLK_DURTY;
+  if (idx == 0) { // the lowest key inserted
+    sblk->lkl = MIN(sblk->db->lklen, key->size);
+    memcpy(sblk->lk, key->data, sblk->lkl);
+    if (key->size <= sblk->db->lklen) {
+      sblk->flags |= SBLK_FULL_LKEY;
+    } else {
+      sblk->flags &= ~SBLK_FULL_LKEY;
+    }
+    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
+      sblk->flags |= SBLK_CACHE_UPDATE;
+    }
+  }
+  return 0;
+}
+
+static WUR iwrc _sblk_addkv(SBLK *sblk, const IWKV_val *key, const IWKV_val *val,
+                            iwkv_opflags opflags, bool internal) {
+  assert(sblk && key && key->size && key->data && val && sblk->kvblk);
+  int8_t kvidx;
+  uint8_t *mm, idx;
+  KVBLK *kvblk = sblk->kvblk;
+  IWFS_FSM *fsm = &sblk->db->file->fsm;
+  if (sblk->pnum >= sblk->db->pnmax) {
+    return _IWKV_ERROR_KVBLOCK_FULL;
+  }
+  if (!internal && (opflags & IWKV_DUP_REMOVE)) {
+    return IWKV_ERROR_NOTFOUND;
+  }
+  iwrc rc = _kvblk_addkv(kvblk, key, val, &kvidx, opflags, internal);
+  RCRET(rc);
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  rc = _sblk_insert_pi_mm(sblk, kvidx, key, mm, &idx);
+  RCRET(rc);
+  if (idx == 0) { // the lowest key inserted
+    sblk->lkl = MIN(sblk->db->lklen, key->size);
+    memcpy(sblk->lk, key->data, sblk->lkl);
+    if (key->size <= sblk->db->lklen) {
+      sblk->flags |= SBLK_FULL_LKEY;
+    } else {
+      sblk->flags &= ~SBLK_FULL_LKEY;
+    }
+    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
+      sblk->flags |= SBLK_CACHE_UPDATE;
+    }
+  }
+  fsm->release_mmap(fsm);
+  if (sblk->kvblkn != ADDR2BLK(kvblk->addr)) {
+    sblk->kvblkn = ADDR2BLK(kvblk->addr);
+    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
+      sblk->flags |= SBLK_CACHE_UPDATE;
+    }
+  }
+  sblk->flags |= SBLK_DURTY;
+  return 0;
+}
+
+IW_INLINE WUR iwrc _sblk_updatekv(SBLK *sblk, int8_t idx,
+                                  const IWKV_val *key, const IWKV_val *val,
+                                  iwkv_opflags opflags, bool internal) {
+  assert(sblk && sblk->kvblk && idx >= 0 && idx < sblk->pnum);
+  off_t oaddr;
+  uint32_t olen;
+  KVBLK *kvblk = sblk->kvblk;
+  int8_t kvidx = sblk->pi[idx];
+  iwrc rc = _kvblk_ovl_extent(kvblk, kvidx, &oaddr, &olen);
+  RCRET(rc);
+  rc = _kvblk_updatev(kvblk, &kvidx, key, val, opflags, internal);
+  RCRET(rc);
+  if (oaddr) {
+    rc = _db_deallocate(sblk->db, oaddr, OVL_EXTENT_SZ(olen));
+    RCRET(rc);
+  }
+  if (sblk->kvblkn != ADDR2BLK(kvblk->addr)) {
+    sblk->kvblkn = ADDR2BLK(kvblk->addr);
+    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
+      sblk->flags |= SBLK_CACHE_UPDATE;
+    }
+  }
+  sblk->pi[idx] = kvidx;
+  sblk->flags |= SBLK_DURTY;
+  return 0;
+}
+
+IW_INLINE WUR iwrc _sblk_rmkv(SBLK *sblk, uint8_t idx, kvblk_rmkv_opts_t opts) {
+  assert(sblk && sblk->kvblk);
+  KVBLK *kvblk = sblk->kvblk;
+  IWFS_FSM *fsm = &sblk->db->file->fsm;
+  assert(kvblk && idx < sblk->pnum && sblk->pi[idx] < sblk->db->pnmax);
+  off_t oaddr;
+  uint32_t olen;
+  iwrc rc = _kvblk_ovl_extent(kvblk, sblk->pi[idx], &oaddr, &olen);
+  RCRET(rc);
+  rc = _kvblk_rmkv(kvblk, sblk->pi[idx], opts);
+  RCRET(rc);
+  if (oaddr) {
+    rc = _db_deallocate(sblk->db, oaddr, OVL_EXTENT_SZ(olen));
+    RCRET(rc);
+  }
+  if (sblk->kvblkn != ADDR2BLK(kvblk->addr)) {
+    sblk->kvblkn = ADDR2BLK(kvblk->addr);
+    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
+      sblk->flags |= SBLK_CACHE_UPDATE;
+    }
+  }
+  --sblk->pnum;
+  sblk->flags |= SBLK_DURTY;
+  if (idx < sblk->pnum && sblk->pnum > 0) {
+    memmove(sblk->pi + idx, sblk->pi + idx + 1, sblk->pnum - idx);
+  }
+  if (idx == 0) { // Lowest key removed
+    uint8_t *mm;
+    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+    RCRET(rc);
+    // Replace key with the next one or reset
+    if (sblk->pnum > 0) {
+      KVKEY k;
+      rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[idx], mm, &k);
+      RCRET(rc);
+      uint32_t klen = KVKEY_SIZE(k);
+      sblk->lkl = MIN(sblk->db->lklen, klen);
+      _kvkey_copy(&k, sblk->lk, sblk->lkl);
+      if (klen <= sblk->db->lklen) {
+        sblk->flags |= SBLK_FULL_LKEY;
+      } else {
+        sblk->flags &= ~SBLK_FULL_LKEY;
+      }
+      if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
+        sblk->flags |= SBLK_CACHE_UPDATE;
+      }
+    } else {
+      sblk->lkl = 0;
+      sblk->flags |= SBLK_CACHE_REMOVE;
+    }
+    fsm->release_mmap(fsm);
+  }
+  return rc;
+}
+
+//--------------------------  BLOOM FILTER
+
+// `IWDB_BLOOM_FILTER` databases keep in memory blocked bloom filter of all keys
+// in order to answer lookups of missing keys without skip list traversal.
+// Bits of removed keys are not cleared, filter is rebuilt by scan of database
+// keys when number of added keys exceeds filter capacity. Replaced filters are
+// kept until database is released since they may be used by lock free readers.
+// Filter is persisted on close and consumed (removed from file) on open,
+// so filter is rebuilt after unclean shutdown.
+
+static void _bloom_hash_kvkey(iwdb_flags_t dbflg, const KVKEY *k, uint64_t *h1, uint64_t *h2) {
+  // FNV-1a followed by two murmur3 finalizers.
+  // String keys are equal for `_cmp_key()` if they have the same size
+  // and the same bytes before the first zero byte.
+  bool str = !(dbflg & IWDB_NOPFX_KEYS_FLAGS);
+  uint64_t h = 0xcbf29ce484222325ULL ^ KVKEY_SIZE(*k);
+  for (uint32_t i = 0; i < k->pfxl; ++i) {
+    h = (h ^ k->pfx[i]) * 0x100000001b3ULL;
+  }
+  for (uint32_t i = 0; i < k->len && (k->buf[i] || !str); ++i) {
+    h = (h ^ k->buf[i]) * 0x100000001b3ULL;
+  }
+  for (int i = 0; i < 2; ++i) {
+    uint64_t v = h ^ (i ? 0x9e3779b97f4a7c15ULL : 0);
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+    *(i ? h2 : h1) = v;
+  }
+}
+
+IW_INLINE void _bloom_hash(iwdb_flags_t dbflg, const IWKV_val *key, uint64_t *h1, uint64_t *h2) {
+  KVKEY k = { .buf = key->data, .len = key->size };
+  _bloom_hash_kvkey(dbflg, &k, h1, h2);
+}
+
+// Set (`set` is true) or test bits of key hash in `bf`.
+// Returns true if some bit was changed (set mode) or all bits are set (test mode).
+IW_INLINE bool _bloom_probe(BLOOMBM *bf, uint64_t h1, uint64_t h2, bool set) {
+  uint64_t bmask = (1ULL << (bf->bpow - BLOOM_BLK_BPOW)) - 1;
+  atomic_uint_fast64_t *bw = bf->w + (h1 & bmask) * ((1U << BLOOM_BLK_BPOW) / 64);
+  bool ret = !set;
+  for (int i = 0; i < BLOOM_K; ++i, h2 >>= BLOOM_BLK_BPOW) {
+    uint32_t bit = h2 & ((1U << BLOOM_BLK_BPOW) - 1);
+    uint64_t m = 1ULL << (bit & 63);
+    if (set) {
+      if (!(atomic_load_explicit(&bw[bit >> 6], memory_order_relaxed) & m)) {
+        atomic_fetch_or(&bw[bit >> 6], m);
+        ret = true;
+      }
+    } else if (!(atomic_load_explicit(&bw[bit >> 6], memory_order_acquire) & m)) {
+      return false;
+    }
+  }
+  return ret;
+}
+
+static_assert(BLOOM_K * BLOOM_BLK_BPOW <= 64, "BLOOM_K * BLOOM_BLK_BPOW <= 64");
+
+// Returns true if `key` is definitely not in database
+IW_INLINE bool _bloom_absent(IWDB db, const IWKV_val *key) {
+  BLOOMBM *bf = atomic_load(&db->bloom);
+  if (!bf) {
+    return false;
+  }
+  uint64_t h1, h2;
+  _bloom_hash(db->dbflg, key, &h1, &h2);
+  return !_bloom_probe(bf, h1, h2, false);
+}
+
+// Add `key` to filter, must be called before key is visible to readers
+IW_INLINE void _bloom_add(IWDB db, const IWKV_val *key) {
+  BLOOMBM *bf = atomic_load(&db->bloom);
+  if (bf) {
+    uint64_t h1, h2;
+    _bloom_hash(db->dbflg, key, &h1, &h2);
+    if (_bloom_probe(bf, h1, h2, true)) {
+      atomic_fetch_add(&db->bloom_num, 1);
+    }
+  }
+}
+
+// Filter should be rebuilt since it is overfilled
+IW_INLINE bool _bloom_full(IWDB db) {
+  BLOOMBM *bf = atomic_load(&db->bloom);
+  return bf && atomic_load(&db->bloom_num) > bf->cap && bf->bpow < BLOOM_MAX_BPOW;
+}
+
+static BLOOMBM *_bloom_create(size_t num) {
+  uint8_t bpow = BLOOM_MIN_BPOW;
+  while (bpow < BLOOM_MAX_BPOW && (1ULL << bpow) < 2 * num * BLOOM_BPK) {
+    ++bpow;
+  }
+  BLOOMBM *bf = calloc(1, sizeof(*bf) + (1ULL << bpow) / 8);
+  if (bf) {
+    bf->bpow = bpow;
+    bf->cap = (1ULL << bpow) / BLOOM_BPK;
+  }
+  return bf;
+}
+
+static void _bloom_destroy(IWDB db) {
+  BLOOMBM *bf = atomic_exchange(&db->bloom, 0);
+  while (bf) {
+    BLOOMBM *prev = bf->prev;
+    free(bf);
+    bf = prev;
+  }
+  db->bloom_num = 0;
+}
+
+// Set filter of open database, previous filter is retired
+static void _bloom_set_lw(IWDB db, BLOOMBM *bf, size_t num) {
+  bf->prev = atomic_load(&db->bloom);
+  db->bloom_num = num;
+  atomic_store(&db->bloom, bf);
+}
+
+// Build filter by scan of all database keys
+static WUR iwrc _bloom_build_lw(IWLCTX *lx) {
+  iwrc rc;
+  uint8_t *mm;
+  size_t num = 0;
+  blkn_t sbn;
+  IWDB db = lx->db;
+  IWFS_FSM *fsm = &db->file->fsm;
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  // Number of keys is a sum of `SBLK` pnums
+  memcpy(&sbn, mm + db->addr + DOFF_N0_U4, 4);
+  sbn = IW_ITOHL(sbn);
+  while (sbn) {
+    uint8_t *sp = mm + BLK2ADDR(sbn);
+    num += sp[SOFF_PNUM_U1];
+    memcpy(&sbn, sp + SOFF_N0_U4, 4);
+    sbn = IW_ITOHL(sbn);
+  }
+  BLOOMBM *bf = _bloom_create(num);
+  if (!bf) {
+    rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    goto finish;
+  }
+  num = 0;
+  memcpy(&sbn, mm + db->addr + DOFF_N0_U4, 4);
+  sbn = IW_ITOHL(sbn);
+  while (sbn) {
+    KVBLK kb, *kbp;
+    blkn_t kvblkn;
+    uint8_t *sp = mm + BLK2ADDR(sbn);
+    int8_t pnum = sp[SOFF_PNUM_U1];
+    memcpy(&kvblkn, sp + SOFF_KBLK_U4, 4);
+    kvblkn = IW_ITOHL(kvblkn);
+    if (kvblkn && pnum > 0) {
+      rc = _kvblk_at_mm(lx, BLK2ADDR(kvblkn), mm, &kb, &kbp);
+      RCBREAK(rc);
+      for (int i = 0; i < pnum && i < db->pnmax; ++i) {
+        KVKEY k;
+        uint64_t h1, h2;
+        rc = _kvblk_peek_key(kbp, sp[_sblk_pi_off(i)], mm, &k);
+        RCBREAK(rc);
+        _bloom_hash_kvkey(db->dbflg, &k, &h1, &h2);
+        if (_bloom_probe(bf, h1, h2, true)) {
+          ++num;
+        }
+      }
+      RCBREAK(rc);
+    }
+    memcpy(&sbn, sp + SOFF_N0_U4, 4);
+    sbn = IW_ITOHL(sbn);
+  }
+  if (rc) {
+    free(bf);
+  } else {
+    _bloom_set_lw(db, bf, num);
+  }
+finish:
+  fsm->release_mmap(fsm);
+  return rc;
+}
+
+// Load filter persisted by `_bloom_save()`.
+// Persisted filter is removed from file and file is synced before database modification
+// in order to avoid use of outdated filter after unclean shutdown.
+static WUR iwrc _bloom_load_lw(IWDB db, bool *oloaded) {
+  iwrc rc;
+  uint8_t *mm, *rp, bpow;
+  size_t msize;
+  uint32_t lv, bloomn, crc;
+  uint64_t llv, num = 0;
+  off_t baddr = 0;
+  BLOOMBM *bf = 0;
+  IWFS_FSM *fsm = &db->file->fsm;
+  bool rdonly = (db->iwkv->oflags & IWKV_RDONLY);
+  *oloaded = false;
+  rc = fsm->acquire_mmap(fsm, 0, &mm, &msize);
+  RCRET(rc);
+  rp = mm + db->addr + DOFF_BLOOM_U4;
+  IW_READLV(rp, lv, bloomn);
+  IW_READBV(rp, lv, bpow);
+  if (!bloomn) {
+    fsm->release_mmap(fsm);
+    return 0;
+  }
+  baddr = BLK2ADDR(bloomn);
+  if (bpow < BLOOM_MIN_BPOW || bpow > BLOOM_MAX_BPOW || baddr + BLOOM_PSIZE(bpow) > msize) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    baddr = 0;
+  } else {
+    size_t bsz = (1ULL << bpow) / 8;
+    rp = mm + baddr;
+    IW_READLLV(rp, llv, num);
+    IW_READLV(rp, lv, crc);
+    rp = mm + baddr + BLOOM_HDRSZ;
+    if (iwu_crc32(rp, bsz, 0) == crc) {
+      bf = calloc(1, sizeof(*bf) + bsz);
+      if (!bf) {
+        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+        fsm->release_mmap(fsm);
+        return rc;
+      }
+      bf->bpow = bpow;
+      bf->cap = (1ULL << bpow) / BLOOM_BPK;
+      for (size_t i = 0; i < bsz / 8; ++i, rp += 8) {
+        memcpy(&llv, rp, sizeof(llv));
+        bf->w[i] = IW_ITOHLL(llv);
+      }
+    }
+  }
+  if (!rdonly) {
+    memset(mm + db->addr + DOFF_BLOOM_U4, 0, DOFF_END - DOFF_BLOOM_U4);
+    fsm->dirty_mmap(fsm, db->addr, DB_SZ);
+  }
+  fsm->release_mmap(fsm);
+  if (!rdonly) {
+    rc = fsm->sync(fsm, IWFS_FDATASYNC);
+    if (!rc && baddr) {
+      rc = fsm->deallocate(fsm, baddr, BLOOM_PSIZE(bpow));
+    }
+  }
+  if (bf) {
+    if (rc) {
+      free(bf);
+    } else {
+      _bloom_set_lw(db, bf, num);
+      *oloaded = true;
+    }
+  }
+  return rc;
+}
+
+// Persist filter of database, called on close
+static WUR iwrc _bloom_save(IWDB db) {
+  iwrc rc;
+  uint8_t *mm, *wp;
+  uint32_t lv;
+  uint64_t llv;
+  off_t baddr = 0, blen;
+  IWFS_FSM *fsm = &db->file->fsm;
+  BLOOMBM *bf = atomic_load(&db->bloom);
+  if (!bf || (db->iwkv->oflags & IWKV_RDONLY)) {
+    return 0;
+  }
+  size_t bsz = (1ULL << bf->bpow) / 8;
+  rc = fsm->allocate(fsm, BLOOM_PSIZE(bf->bpow), &baddr, &blen,
+                     IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
+  RCRET(rc);
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  if (rc) {
+    IWRC(fsm->deallocate(fsm, baddr, blen), rc);
+    return rc;
+  }
+  wp = mm + baddr + BLOOM_HDRSZ;
+  for (size_t i = 0; i < bsz / 8; ++i, wp += 8) {
+    llv = atomic_load_explicit(&bf->w[i], memory_order_relaxed);
+    llv = IW_HTOILL(llv);
+    memcpy(wp, &llv, sizeof(llv));
+  }
+  wp = mm + baddr;
+  IW_WRITELLV(wp, llv, db->bloom_num);
+  IW_WRITELV(wp, lv, iwu_crc32(mm + baddr + BLOOM_HDRSZ, bsz, 0));
+  wp = mm + db->addr + DOFF_BLOOM_U4;
+  IW_WRITELV(wp, lv, ADDR2BLK(baddr));
+  IW_WRITEBV(wp, lv, bf->bpow);
+  fsm->dirty_mmap(fsm, baddr, blen);
+  fsm->dirty_mmap(fsm, db->addr, DB_SZ);
+  fsm->release_mmap(fsm);
+  return 0;
+}
+
+// Open filter of `IWDB_BLOOM_FILTER` database: load persisted filter or build a new one
+static WUR iwrc _bloom_open_lw(IWLCTX *lx) {
+  bool loaded;
+  IWDB db = lx->db;
+  if (!(db->dbflg & IWDB_BLOOM_FILTER) || atomic_load(&db->bloom)) {
+    return 0;
+  }
+  iwrc rc = _bloom_load_lw(db, &loaded);
+  if (!rc && !loaded) {
+    rc = _bloom_build_lw(lx);
+  }
+  return rc;
+}
+
+//--------------------------  HOT RECORDS CACHE
+
+// Values of records read by `iwkv_get()` are kept in memory if `IWKV_OPTS::rcache_size` is set.
+// Cache is shared by all databases and split into shards by key hash, every shard
+// is a CLOCK ring of entries guarded by mutex. When shard is full a new record is admitted
+// only if its key was missed recently (doorkeeper bitmap of TinyLFU), so a single
+// read of cold record never evicts hot ones.
+// Modification of a record removes its entry and increments shard generation
+// after new data is visible to readers. Reader puts value into cache only if shard
+// generation is not changed since its cache lookup, so stale values are never cached.
+
+// Log2 of number of cache shards
+#define RCACHE_SHARDS_POW 4
+
+// Log2 of number of doorkeeper bits per shard
+#define RCACHE_DOOR_BPOW 14
+
+// Max size of cached record as a fraction of shard memory limit
+#define RCACHE_ENTRY_MAX_DIV 8
+
+/** Cached record */
+typedef struct RCENT {
+  uint64_t id;                /**< Record id, see `_rcache_id()` */
+  dbid_t dbid;                /**< Database id */
+  uint32_t klen;              /**< Key length */
+  uint32_t vlen;              /**< Value length */
+  bool ref;                   /**< CLOCK reference bit */
+  uint8_t data[];             /**< Key followed by value */
+} RCENT;
+
+KHASH_MAP_INIT_INT64(RCM, uint32_t)
+
+/** Cache shard */
+typedef struct RCSHARD {
+  pthread_mutex_t mtx;
+  khash_t(RCM) *map;          /**< Record id -> position in `ring` */
+  RCENT **ring;               /**< CLOCK ring of entries */
+  uint32_t num;               /**< Number of entries */
+  uint32_t cap;               /**< Allocated length of `ring` */
+  uint32_t hand;              /**< CLOCK hand */
+  uint32_t door_num;          /**< Number of bits set in `door` */
+  size_t msize;               /**< Memory used by entries */
+  uint64_t gen;               /**< Generation incremented by every invalidation */
+  uint64_t door[(1U << RCACHE_DOOR_BPOW) / 64]; /**< Doorkeeper bitmap of recently missed records */
+} RCSHARD;
+
+struct RCACHE {
+  size_t shard_size;          /**< Memory limit of a single shard */
+  atomic_size_t msize;        /**< Memory used by all entries */
+  RCSHARD shards[1U << RCACHE_SHARDS_POW];
+};
+
+IW_INLINE bool _rcache_enabled(IWDB db) {
+  return db->iwkv->rcache && !(db->dbflg & IWDB_DUP_FLAGS);
+}
+
+// Id of `k` record of `db`
+IW_INLINE uint64_t _rcache_id(IWDB db, const KVKEY *k) {
+  uint64_t h1, h2;
+  _bloom_hash_kvkey(db->dbflg, k, &h1, &h2);
+  return h1 ^ (db->id * 0x9e3779b97f4a7c15ULL);
+}
+
+IW_INLINE RCSHARD *_rcache_shard(struct RCACHE *rc, uint64_t id) {
+  return &rc->shards[id >> (64 - RCACHE_SHARDS_POW)];
+}
+
+IW_INLINE size_t _rcache_entry_size(uint32_t klen, uint32_t vlen) {
+  return sizeof(RCENT) + klen + vlen;
+}
+
+// Position of `id` record entry in `s` ring or `-1` if not found
+IW_INLINE int64_t _rcache_find(RCSHARD *s, uint64_t id) {
+  khiter_t k = kh_get(RCM, s->map, id);
+  return k != kh_end(s->map) ? (int64_t) kh_value(s->map, k) : -1;
+}
+
+// Remove entry at `pos` of `s` ring, the last entry is moved in its place
+static void _rcache_remove(struct RCACHE *rc, RCSHARD *s, uint32_t pos) {
+  RCENT *e = s->ring[pos];
+  khiter_t k = kh_get(RCM, s->map, e->id);
+  if (k != kh_end(s->map)) {
+    kh_del(RCM, s->map, k);
+  }
+  size_t esz = _rcache_entry_size(e->klen, e->vlen);
+  s->msize -= esz;
+  atomic_fetch_sub(&rc->msize, esz);
+  free(e);
+  if (pos != --s->num) {
+    s->ring[pos] = s->ring[s->num];
+    k = kh_get(RCM, s->map, s->ring[pos]->id);
+    kh_value(s->map, k) = pos;
+  }
+}
+
+// Evict entries of `s` until `esz` bytes can be added
+static void _rcache_evict(struct RCACHE *rc, RCSHARD *s, size_t esz) {
+  while (s->num && s->msize + esz > rc->shard_size) {
+    if (s->hand >= s->num) {
+      s->hand = 0;
+    }
+    RCENT *e = s->ring[s->hand];
+    if (e->ref) {
+      e->ref = false;
+      ++s->hand;
+    } else {
+      _rcache_remove(rc, s, s->hand);
+    }
+  }
+}
+
+// Returns true if `id` record was missed recently, otherwise it is remembered by doorkeeper
+static bool _rcache_door_admit(RCSHARD *s, uint64_t id) {
+  uint32_t bit = id & ((1U << RCACHE_DOOR_BPOW) - 1);
+  uint64_t m = 1ULL << (bit & 63);
+  if (s->door[bit >> 6] & m) {
+    return true;
+  }
+  s->door[bit >> 6] |= m;
+  if (++s->door_num > (1U << RCACHE_DOOR_BPOW) / 2) { // Too many bits set, start a new period
+    memset(s->door, 0, sizeof(s->door));
+    s->door_num = 0;
+  }
+  return false;
+}
+
+/**
+ * @brief Lookup `key` record value of `db` in cache.
+ * @param [out] ogen Shard generation to be passed to `_rcache_put()` on miss
+ * @param [out] ohit Set to true if value is found and copied into `oval`
+ */
+static WUR iwrc _rcache_get(IWDB db, const IWKV_val *key, IWKV_val *oval, IWPOOL *pool,
+                            uint64_t *ogen, bool *ohit) {
+  iwrc rc = 0;
+  KVKEY k = { .buf = key->data, .len = key->size };
+  uint64_t id = _rcache_id(db, &k);
+  RCSHARD *s = _rcache_shard(db->iwkv->rcache, id);
+  *ohit = false;
+  pthread_mutex_lock(&s->mtx);
+  *ogen = s->gen;
+  int64_t pos = _rcache_find(s, id);
+  if (pos >= 0) {
+    RCENT *e = s->ring[pos];
+    if (e->dbid == db->id && !_cmp_kvkey(db->dbflg, &k, e->data, e->klen)) {
+      e->ref = true;
+      *ohit = true;
+      if (e->vlen) {
+        oval->data = _kv_alloc(pool, e->vlen);
+        if (oval->data) {
+          memcpy(oval->data, e->data + e->klen, e->vlen);
+          oval->size = e->vlen;
+        } else {
+          rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+        }
+      } else {
+        oval->data = 0;
+        oval->size = 0;
+      }
+    }
+  }
+  pthread_mutex_unlock(&s->mtx);
+  _dbstat_add(db, *ohit ? DBS_RCACHE_HITS : DBS_RCACHE_MISSES, 1);
+  return rc;
+}
+
+// Put `key` record value read from database into cache
+// if no invalidations of shard were done since `gen` was obtained by `_rcache_get()`
+static void _rcache_put(IWDB db, const IWKV_val *key, const IWKV_val *val, uint64_t gen) {
+  struct RCACHE *rc = db->iwkv->rcache;
+  size_t esz = _rcache_entry_size(key->size, val->size);
+  if (esz > rc->shard_size / RCACHE_ENTRY_MAX_DIV) {
+    return;
+  }
+  KVKEY k = { .buf = key->data, .len = key->size };
+  uint64_t id = _rcache_id(db, &k);
+  RCSHARD *s = _rcache_shard(rc, id);
+  pthread_mutex_lock(&s->mtx);
+  if (s->gen != gen) {
+    goto finish;
+  }
+  int64_t pos = _rcache_find(s, id);
+  if (pos >= 0) { // Entry of other key with the same id
+    _rcache_remove(rc, s, pos);
+  }
+  if (s->msize + esz > rc->shard_size) {
+    if (!_rcache_door_admit(s, id)) {
+      goto finish;
+    }
+    _rcache_evict(rc, s, esz);
+  }
+  if (s->num == s->cap) {
+    uint32_t cap = s->cap ? s->cap * 2 : 64;
+    RCENT **ring = realloc(s->ring, cap * sizeof(*ring));
+    if (!ring) {
+      goto finish;
+    }
+    s->ring = ring;
+    s->cap = cap;
+  }
+  RCENT *e = malloc(esz);
+  if (!e) {
+    goto finish;
+  }
+  int ret;
+  khiter_t ki = kh_put(RCM, s->map, id, &ret);
+  if (ret < 0) {
+    free(e);
+    goto finish;
+  }
+  e->id = id;
+  e->dbid = db->id;
+  e->klen = key->size;
+  e->vlen = val->size;
+  e->ref = false;
+  memcpy(e->data, key->data, key->size);
+  if (val->size) {
+    memcpy(e->data + key->size, val->data, val->size);
+  }
+  kh_value(s->map, ki) = s->num;
+  s->ring[s->num++] = e;
+  s->msize += esz;
+  atomic_fetch_add(&rc->msize, esz);
+
+finish:
+  pthread_mutex_unlock(&s->mtx);
+}
+
+// Invalidate cached `k` record of `db`, must be called after record modification
+static void _rcache_invalidate_kvkey(IWDB db, const KVKEY *k) {
+  struct RCACHE *rc = db->iwkv->rcache;
+  uint64_t id = _rcache_id(db, k);
+  RCSHARD *s = _rcache_shard(rc, id);
+  pthread_mutex_lock(&s->mtx);
+  int64_t pos = _rcache_find(s, id);
+  if (pos >= 0) {
+    _rcache_remove(rc, s, pos);
+  }
+  ++s->gen;
+  pthread_mutex_unlock(&s->mtx);
+}
+
+IW_INLINE void _rcache_invalidate(IWDB db, const IWKV_val *key) {
+  if (_rcache_enabled(db)) {
+    KVKEY k = { .buf = key->data, .len = key->size };
+    _rcache_invalidate_kvkey(db, &k);
+  }
+}
+
+// Invalidate all cached records of `dbid` database
+static void _rcache_drop_db(IWKV iwkv, dbid_t dbid) {
+  struct RCACHE *rc = iwkv->rcache;
+  if (!rc) {
+    return;
+  }
+  for (int i = 0; i < (1U << RCACHE_SHARDS_POW); ++i) {
+    RCSHARD *s = &rc->shards[i];
+    pthread_mutex_lock(&s->mtx);
+    for (uint32_t pos = 0; pos < s->num;) {
+      if (s->ring[pos]->dbid == dbid) {
+        _rcache_remove(rc, s, pos);
+      } else {
+        ++pos;
+      }
+    }
+    ++s->gen;
+    pthread_mutex_unlock(&s->mtx);
+  }
+}
+
+static void _rcache_destroy(IWKV iwkv) {
+  struct RCACHE *rc = iwkv->rcache;
+  if (!rc) {
+    return;
+  }
+  for (int i = 0; i < (1U << RCACHE_SHARDS_POW); ++i) {
+    RCSHARD *s = &rc->shards[i];
+    for (uint32_t pos = 0; pos < s->num; ++pos) {
+      free(s->ring[pos]);
+    }
+    free(s->ring);
+    kh_destroy(RCM, s->map);
+    pthread_mutex_destroy(&s->mtx);
+  }
+  free(rc);
+  iwkv->rcache = 0;
+}
+
+static WUR iwrc _rcache_create(IWKV iwkv, size_t size) {
+  struct RCACHE *rc = calloc(1, sizeof(*rc));
+  if (!rc) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  rc->shard_size = size >> RCACHE_SHARDS_POW;
+  for (int i = 0; i < (1U << RCACHE_SHARDS_POW); ++i) {
+    pthread_mutex_init(&rc->shards[i].mtx, 0);
+  }
+  iwkv->rcache = rc;
+  for (int i = 0; i < (1U << RCACHE_SHARDS_POW); ++i) {
+    rc->shards[i].map = kh_init(RCM);
+    if (!rc->shards[i].map) {
+      _rcache_destroy(iwkv);
+      return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    }
+  }
+  return 0;
+}
+
+//--------------------------  IWLCTX
+
+// Compare the first key of `sblk` with the search key of `lx`, `kt` is key type of database.
+// Lower key prefix of `IWDB_CUSTOM_KEYS` database is not ordered by comparator, so the full key is used
+IW_INLINE WUR iwrc _lx_sblk_cmp_key_kt(IWLCTX *lx, SBLK *sblk, int *res, ktype_t kt) {
+  const IWKV_val *key = lx->key;
+  if (IW_UNLIKELY(sblk->pnum < 1 || (sblk->flags & SBLK_DB))) { // empty block
+    *res = 0;
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
+  } else if ((sblk->flags & SBLK_FULL_LKEY) || (kt != KT_CUSTOM && key->size < sblk->lkl)) {
+    *res = _kt_cmp_key(sblk->db, kt, sblk->lk, sblk->lkl, key->data, key->size);
+  } else {
+    *res = (kt == KT_CUSTOM) ? 0 : _cmp_key2(_kt_dbflg(kt), sblk->lk, sblk->lkl, key->data, key->size);
+    if (*res == 0) {
+      KVKEY k;
+      uint8_t *mm;
+      IWFS_FSM *fsm = &lx->db->file->fsm;
+      iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+      if (rc) {
+        *res = 0;
+        return rc;
+      }
+      if (!sblk->kvblk) {
+        rc = _sblk_loadkvblk_mm(lx, sblk, mm);
+        if (rc) {
+          *res = 0;
+          fsm->release_mmap(fsm);
+          return rc;
+        }
+      }
+      rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[0], mm, &k);
+      RCRET(rc);
+      *res = _kt_cmp_kvkey(sblk->db, kt, &k, key->data, key->size);
+      fsm->release_mmap(fsm);
+    }
+  }
+  return 0;
+}
+
+IW_INLINE WUR iwrc _lx_sblk_cmp_key(IWLCTX *lx, SBLK *sblk, int *res) {
+  return _lx_sblk_cmp_key_kt(lx, sblk, res, _db_kt(sblk->db));
+}
+
+// Move `lx->lower` forward on level `lvl` up to the first node greater than search key
+IW_INLINE WUR iwrc _lx_roll_forward_kt(IWLCTX *lx, uint8_t lvl, uint32_t *hops, ktype_t kt) {
+  iwrc rc = 0;
+  int cret;
+  SBLK *sblk;
+  blkn_t blkn;
+  assert(lx->lower);
+
+  while ((blkn = lx->lower->n[lvl])) {
+    off_t blkaddr = BLK2ADDR(blkn);
+    ++*hops;
+    if (lx->nlvl > -1 && lvl < lx->nlvl) {
+      int8_t ulvl = lvl + 1;
+      if (lx->pupper[ulvl] && lx->pupper[ulvl]->addr == blkaddr) {
+        sblk = lx->pupper[ulvl];
+      } else if (lx->plower[ulvl] && lx->plower[ulvl]->addr == blkaddr) {
+        sblk = lx->plower[ulvl];
+      } else {
+        rc = _sblk_at(lx, blkaddr, 0, &sblk);
+      }
+    } else {
+      rc = _sblk_at(lx, blkaddr, 0, &sblk);
+    }
+    RCRET(rc);
+#ifndef NDEBUG
+    ++lx->num_cmps;
+#endif
+    rc = _lx_sblk_cmp_key_kt(lx, sblk, &cret, kt);
+    RCRET(rc);
+    if (cret > 0 || lx->upper_addr == sblk->addr) { // upper > key
+      lx->upper = sblk;
+      break;
+    } else {
+      lx->lower = sblk;
+    }
+  }
+  return 0;
+}
+
+// Generates search routines of `kt_` key type
+#define KOPS_IMPL(name_, kt_)                                                                       \
+  static WUR iwrc _sblk_find_pi_##name_##_mm(SBLK *sblk, const IWKV_val *key, const uint8_t *mm,    \
+                                             bool *found, uint8_t *idxp) {                        \
+    return _sblk_find_pi_kt_mm(sblk, key, mm, found, idxp, kt_);                                    \
+  }                                                                                                 \
+  static WUR iwrc _sblk_insert_pi_##name_##_mm(SBLK *sblk, uint8_t nidx, const IWKV_val *key,       \
+                                               const uint8_t *mm, uint8_t *idxp) {                \
+    return _sblk_insert_pi_kt_mm(sblk, nidx, key, mm, idxp, kt_);                                   \
+  }                                                                                                 \
+  static WUR iwrc _lx_roll_forward_##name_(IWLCTX *lx, uint8_t lvl, uint32_t *hops) {               \
+    return _lx_roll_forward_kt(lx, lvl, hops, kt_);                                                 \
+  }                                                                                                 \
+  static const KOPS _kops_##name_ = {                                                               \
+    .find_pi = _sblk_find_pi_##name_##_mm,                                                          \
+    .insert_pi = _sblk_insert_pi_##name_##_mm,                                                      \
+    .roll_forward = _lx_roll_forward_##name_                                                        \
+  };
+
+KOPS_IMPL(str, KT_STR)
+KOPS_IMPL(u32, KT_U32)
+KOPS_IMPL(u64, KT_U64)
+KOPS_IMPL(custom, KT_CUSTOM)
+
+// Comparator registered for `IWDB_CUSTOM_KEYS` database `dbid`, zero if not found
+static const IWKV_KEY_CMP *_kcmp_find(IWKV iwkv, dbid_t dbid) {
+  for (uint16_t i = 0; i < iwkv->key_cmps_num; ++i) {
+    if (iwkv->key_cmps[i].dbid == dbid && iwkv->key_cmps[i].cmp) {
+      return &iwkv->key_cmps[i];
+    }
+  }
+  return 0;
+}
+
+// Select search routines and comparator of database once it is loaded or created
+static void _db_kops_init(IWDB db) {
+  db->kcmp = 0;
+  switch (_db_kt(db)) {
+    case KT_CUSTOM:
+      db->kcmp = _kcmp_find(db->iwkv, db->id);
+      db->kops = &_kops_custom;
+      break;
+    case KT_U64:
+      db->kops = &_kops_u64;
+      break;
+    case KT_U32:
+      db->kops = &_kops_u32;
+      break;
+    default:
+      db->kops = &_kops_str;
+      break;
+  }
+}
+
+IW_INLINE WUR iwrc _lx_roll_forward(IWLCTX *lx, uint8_t lvl, uint32_t *hops) {
+  return lx->db->kops->roll_forward(lx, lvl, hops);
+}
+
+static WUR iwrc _lx_find_bounds(IWLCTX *lx) {
+  iwrc rc = 0;
+  int lvl;
+  blkn_t blkn;
+  uint32_t hops = 0;
+  bool cached = false;
+  int chit = -1;
+  if (!lx->dblk.addr) {
+    SBLK *s;
+    rc = _sblk_at(lx, lx->db->addr, 0, &s);
+    RCRET(rc);
+    memcpy(&lx->dblk, s, sizeof(lx->dblk));
+  }
+  if (!lx->lower) {
+    rc = _dbcache_get(lx);
+    RCRET(rc);
+    cached = (lx->nlvl < 0);
+    if (cached && !lx->snap && lx->db->cache.num) {
+      chit = (lx->lower != &lx->dblk);
+    }
+  }
+  if (lx->nlvl > lx->dblk.lvl) {
+    // New level in DB
+    lx->dblk.lvl = lx->nlvl;
+    lx->dblk.flags |= SBLK_DURTY;
+  }
+  lvl = lx->lower->lvl;
+  while (lvl > -1) {
+    rc = _lx_roll_forward(lx, lvl, &hops);
+    RCRET(rc);
+    if (lx->upper) {
+      blkn = ADDR2BLK(lx->upper->addr);
+    } else {
+      blkn = 0;
+    }
+    do {
+      if (lx->nlvl >= lvl) {
+        lx->plower[lvl] = lx->lower;
+        lx->pupper[lvl] = lx->upper;
+      }
+    } while (lvl-- && lx->lower->n[lvl] == blkn);
+  }
+  if (cached && lx->db->cache_opts.adaptive) {
+    _dbcache_adapt(lx, hops);
+  }
+  _dbstat_lookup(lx->db, hops, chit);
+  return 0;
+}
+
+static iwrc _lx_release_mm(IWLCTX *lx, uint8_t *mm) {
+  iwrc rc = 0;
+  if (lx->nlvl > -1) {
+    SBLK *lsb = 0, *usb = 0;
+    if (lx->nb) {
+      rc = _sblk_sync_mm(lx, lx->nb, mm);
+      RCRET(rc);
+    }
+    if (lx->pupper[0] == lx->upper) {
+      lx->upper = 0;
+    }
+    if (lx->plower[0] == lx->lower) {
+      lx->lower = 0;
+    }
+    for (int i = 0; i <= lx->nlvl; ++i) {
+      if (lx->pupper[i]) {
+        if (lx->pupper[i] != usb) {
+          usb = lx->pupper[i];
+          rc = _sblk_sync_and_release_mm(lx, &lx->pupper[i], mm);
+          RCRET(rc);
+#ifdef IW_TESTS
+          if (!i && lx->nb && iwkv_kill_on_split > 0 && !--iwkv_kill_on_split) {
+            kill(getpid(), SIGKILL);
+          }
+#endif
+        }
+        lx->pupper[i] = 0;
+      }
+      if (lx->plower[i]) {
+        if (lx->plower[i] != lsb) {
+          lsb = lx->plower[i];
+          rc = _sblk_sync_and_release_mm(lx, &lx->plower[i], mm);
+          RCRET(rc);
+        }
+        lx->plower[i] = 0;
+      }
+    }
+  }
+  if (lx->upper) {
+    rc = _sblk_sync_and_release_mm(lx, &lx->upper, mm);
+    RCRET(rc);
+  }
+  if (lx->lower) {
+    rc = _sblk_sync_and_release_mm(lx, &lx->lower, mm);
+    RCRET(rc);
+  }
+  if (lx->dblk.flags & SBLK_DURTY) {
+    rc = _sblk_sync_mm(lx, &lx->dblk, mm);
+    RCRET(rc);
+  }
+  if (lx->nb) {
+    if (lx->nb->flags & SBLK_CACHE_PUT) {
+      rc = _dbcache_put_lw(lx, lx->nb);
+    }
+    _sblk_release(lx, &lx->nb);
+    RCRET(rc);
+  }
+  return rc;
+}
+
+iwrc _lx_release(IWLCTX *lx) {
+  uint8_t *mm;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  rc = _lx_release_mm(lx, mm);
+  IWRC(fsm->release_mmap(fsm), rc);
+  return rc;
+}
+
+static iwrc _lx_split_addkv(IWLCTX *lx, int idx, SBLK *sblk) {
+  iwrc rc;
+  SBLK *nb;
+  blkn_t nblk;
+  uint8_t kvbpow = 0;
+  uint8_t pfx[KVBLK_MAX_PFXLEN];
+  uint32_t pfxl = 0;
+  register int pivot = (lx->db->pnmax / 2) + 1;
+  if (!(lx->db->dbflg & IWDB_NOPFX_KEYS_FLAGS) && sblk->kvblk && sblk->pnum > 0) {
+    // Keys of the new block are expected to be in the same range as:
+    // upper side: the lowest key of `sblk` and the new key
+    // middle: the keys moved from `sblk`
+    uint8_t *mm;
+    KVKEY k1, k2 = { .buf = lx->key->data, .len = lx->key->size };
+    IWFS_FSM *fsm = &lx->db->file->fsm;
+    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+    RCRET(rc);
+    rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[idx < sblk->pnum ? pivot : 0], mm, &k1);
+    if (!rc && idx < sblk->pnum) {
+      rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[sblk->pnum - 1], mm, &k2);
+    }
+    if (!rc) {
+      pfxl = _kvblk_pfx_select(&k1, &k2, pfx);
+    }
+    fsm->release_mmap(fsm);
+    RCRET(rc);
+  }
+  if (idx < sblk->pnum) {
+    assert(sblk->kvblk);
+    // Partial split required
+    // Compute space required for the new sblk which stores kv pairs after pivot `idx`
+    size_t sz = 0;
+    for (int i = pivot; i < sblk->pnum; ++i) {
+      sz += sblk->kvblk->pidx[sblk->pi[i]].len;
+    }
+    if (idx > pivot) {
+      sz += IW_VNUMSIZE(lx->key->size) + lx->key->size + lx->val->size;
+    }
+    sz += KVBLK_MAX_NKV_SZ_N(lx->db->pnmax);
+    kvbpow = iwlog2_64(sz);
+    while ((1ULL << kvbpow) < sz) {
+      kvbpow++;
+    }
+  }
+  rc = _sblk_create(lx, lx->nlvl, kvbpow, sblk->addr, &nb);
+  RCRET(rc);
+  _dbstat_add(lx->db, DBS_SPLITS, 1);
+  if (pfxl) {
+    _kvblk_set_pfx(nb->kvblk, pfx, pfxl);
+  }
+  nblk = ADDR2BLK(nb->addr);
+  if (idx == sblk->pnum) { // Upper side
+    rc = _sblk_addkv(nb, lx->key, lx->val, lx->opflags, false);
+    RCGO(rc, finish);
+  } else { // New key is somewere in a middle of sblk->kvblk
+    assert(sblk->kvblk);
+    // We are in the middle
+    // Do the partial split
+    // Move kv pairs into new `nb`
+    IWKV_val key, val;
+    IWFS_FSM *fsm = &lx->db->file->fsm;
+    IWPOOL *pool = _scratch_pool();
+    for (int i = pivot, end = sblk->pnum; i < end; ++i) {
+      uint8_t *mm;
+      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+      RCBREAK(rc);
+      rc = _kvblk_getkv(sblk->kvblk, mm, sblk->pi[i], &key, &val, true, pool);
+      assert(key.size);
+      fsm->release_mmap(fsm);
+      RCBREAK(rc);
+      rc = _sblk_addkv2(nb, i - pivot, &key, &val, lx->opflags, true);
+      if (pool) {
+        iwpool_reset(pool);
+      } else {
+        _kv_dispose(&key, &val);
+      }
+      RCBREAK(rc);
+      sblk->kvblk->pidx[sblk->pi[i]].len = 0;
+      sblk->kvblk->pidx[sblk->pi[i]].off = 0;
+      --sblk->pnum;
+    }
+    sblk->kvblk->flags |= KVBLK_DURTY;
+    sblk->kvblk->zidx = sblk->pi[pivot];
+    sblk->kvblk->maxoff = 0;
+    for (int i = 0; i < lx->db->pnmax; ++i) {
+      if (sblk->kvblk->pidx[i].off > sblk->kvblk->maxoff) {
+        sblk->kvblk->maxoff = sblk->kvblk->pidx[i].off;
+      }
+    }
+    if (idx > pivot) {
+      rc = _sblk_addkv(nb, lx->key, lx->val, lx->opflags, false);
+    } else {
+      rc = _sblk_addkv(sblk, lx->key, lx->val, lx->opflags, false);
+    }
+    RCGO(rc, finish);
+  }
+  // fix levels
+  //  [ lb -> sblk -> ub ]
+  //  [ lb -> sblk -> nb -> ub ]
+  lx->pupper[0]->p0 = nblk;
+  lx->pupper[0]->flags |= SBLK_DURTY;
+  nb->p0 = ADDR2BLK(lx->plower[0]->addr);
+  for (int i = 0; i <= nb->lvl; ++i) {
+    lx->plower[i]->n[i] = nblk;
+    lx->plower[i]->flags |= SBLK_DURTY;
+    nb->n[i] = ADDR2BLK(lx->pupper[i]->addr);
+  }
+finish:
+  if (rc) {
+    lx->nb = 0;
+    IWRC(_sblk_destroy(lx, &nb), rc);
+  } else {
+    lx->nb = nb;
+  }
+  return rc;
+}
+
+IW_INLINE iwrc _lx_init_chute(IWLCTX *lx) {
+  assert(lx->nlvl >= 0);
+  iwrc rc = 0;
+  if (!lx->pupper[lx->nlvl]) { // fix zero upper by dbtail
+    SBLK *dbtail;
+    rc = _sblk_at(lx, 0, 0, &dbtail);
+    RCRET(rc);
+    for (int i = lx->nlvl; i >= 0 && !lx->pupper[i]; --i) {
+      lx->pupper[i] = dbtail;
+    }
+  }
+  return 0;
+}
+
+WUR iwrc _lx_addkv(IWLCTX *lx) {
+  iwrc rc;
+  bool found, uadd;
+  uint8_t *mm = 0, idx;
+  SBLK *sblk = lx->lower;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  if (lx->nlvl > -1) {
+    rc = _lx_init_chute(lx);
+    RCRET(rc);
+  }
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  rc = _sblk_loadkvblk_mm(lx, sblk, mm);
+  if (rc) {
+    fsm->release_mmap(fsm);
+    return rc;
+  }
+  rc = _sblk_find_pi_mm(sblk, lx->key, mm, &found, &idx);
+  RCRET(rc);
+  if (found && (lx->opflags & IWKV_NO_OVERWRITE)) {
+    fsm->release_mmap(fsm);
+    return IWKV_ERROR_KEY_EXISTS;
+  }
+  uadd = (!found &&
+          sblk->pnum > lx->db->pnmax - 1 && idx > lx->db->pnmax - 1 &&
+          lx->upper && lx->upper->pnum < lx->db->pnmax);
+  if (uadd) {
+    rc = _sblk_loadkvblk_mm(lx, lx->upper, mm);
+    if (rc) {
+      fsm->release_mmap(fsm);
+      return rc;
+    }
+  }
+  fsm->release_mmap(fsm);
+  if (!found && sblk->pnum > lx->db->pnmax - 1) {
+    if (uadd) {
+      return _sblk_addkv(lx->upper, lx->key, lx->val, lx->opflags, false);
+    }
+    if (lx->nlvl < 0) {
+      return _IWKV_ERROR_REQUIRE_NLEVEL;
+    }
+  }
+  if (!found && sblk->pnum >= lx->db->pnmax) {
+    return _lx_split_addkv(lx, idx, sblk);
+  } else {
+    if (!found) {
+      return _sblk_addkv2(sblk, idx, lx->key, lx->val, lx->opflags, false);
+    } else {
+      return _sblk_updatekv(sblk, idx, lx->key, lx->val, lx->opflags, false);
+    }
+  }
+}
+
+IW_INLINE WUR iwrc _lx_put_lw(IWLCTX *lx) {
+  iwrc rc;
+  _bloom_add(lx->db, lx->key);
+start:
+  rc = _lx_find_bounds(lx);
+  if (rc) {
+    _lx_release_mm(lx, 0);
+    return rc;
+  }
+  rc = _lx_addkv(lx);
+  if (rc == _IWKV_ERROR_REQUIRE_NLEVEL) {
+    SBLK *lower = lx->lower;
+    _lx_release_mm(lx, 0);
+    lx->nlvl = _sblk_genlevel(lx->db);
+    if (lower->lvl >= lx->nlvl) {
+      lx->lower = lower;
+    }
+    goto start;
+  }
+  if (rc) {
+    if (rc == _IWKV_ERROR_KVBLOCK_FULL) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+    }
+    _lx_release_mm(lx, 0);
+  } else {
+    lx->plower_addr = (lx->lower->flags & SBLK_DB) ? 0 : lx->lower->addr;
+    lx->pupper_addr = lx->upper ? lx->upper->addr : 0;
+    rc = _lx_release(lx);
+  }
+  _rcache_invalidate(lx->db, lx->key);
+  return rc;
+}
+
+IW_INLINE WUR iwrc _lx_get_lr(IWLCTX *lx) {
+  iwrc rc = _lx_find_bounds(lx);
+  RCRET(rc);
+  bool found;
+  uint8_t *mm, idx;
+  pthread_rwlock_t *latch = 0;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  lx->val->size = 0;
+  if (_db_leafw_enabled(lx->db) && !(lx->lower->flags & SBLK_DB)) {
+    // Reload block under shared latch, it may be modified by leaf writer
+    latch = _db_latch(lx->db, lx->lower->addr);
+    pthread_rwlock_rdlock(latch);
+    rc = _sblk_at2(lx, lx->lower->addr, 0, lx->lower);
+    if (rc) {
+      pthread_rwlock_unlock(latch);
+      _lx_release_mm(lx, 0);
+      return rc;
+    }
+  }
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  if (rc) {
+    if (latch) {
+      pthread_rwlock_unlock(latch);
+    }
+    return rc;
+  }
+  rc = _sblk_loadkvblk_mm(lx, lx->lower, mm);
+  RCGO(rc, finish);
+  rc = _sblk_find_pi_mm(lx->lower, lx->key, mm, &found, &idx);
+  RCGO(rc, finish);
+  if (found) {
+    idx = lx->lower->pi[idx];
+    rc = _kvblk_getvalue(lx->lower->kvblk, mm, idx, lx->val, lx->pool);
+  } else {
+    rc = IWKV_ERROR_NOTFOUND;
+  }
+finish:
+  IWRC(fsm->release_mmap(fsm), rc);
+  if (latch) {
+    pthread_rwlock_unlock(latch);
+  }
+  _lx_release_mm(lx, 0);
+  return rc;
+}
+
+// Same as `_lx_get_lr()` but value points into mmaped area,
+// on success mmap stays acquired until `iwkv_view_release()`
+IW_INLINE WUR iwrc _lx_get_view_lr(IWLCTX *lx) {
+  iwrc rc = _lx_find_bounds(lx);
+  RCRET(rc);
+  bool found;
+  uint8_t *mm, *vbuf, idx;
+  uint32_t vlen;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  lx->val->data = 0;
+  lx->val->size = 0;
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  rc = _sblk_loadkvblk_mm(lx, lx->lower, mm);
+  RCGO(rc, finish);
+  rc = _sblk_find_pi_mm(lx->lower, lx->key, mm, &found, &idx);
+  RCGO(rc, finish);
+  if (found) {
+    idx = lx->lower->pi[idx];
+    _kvblk_peek_val(lx->lower->kvblk, idx, mm, &vbuf, &vlen);
+    lx->val->data = vbuf;
+    lx->val->size = vlen;
+  } else {
+    rc = IWKV_ERROR_NOTFOUND;
+  }
+finish:
+  if (rc) {
+    IWRC(fsm->release_mmap(fsm), rc);
+  }
+  _lx_release_mm(lx, 0);
+  return rc;
+}
+
+IW_INLINE WUR iwrc _lx_del_lw(IWLCTX *lx) {
+  iwrc rc;
+  bool found;
+  uint8_t *mm = 0, idx;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  SBLK *sblk;
+  rc = _lx_find_bounds(lx);
+  RCRET(rc);
+  sblk = lx->lower;
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCGO(rc, finish);
+  rc = _sblk_loadkvblk_mm(lx, sblk, mm);
+  RCGO(rc, finish);
+  rc = _sblk_find_pi_mm(sblk, lx->key, mm, &found, &idx);
+  RCGO(rc, finish);
+  if (!found) {
+    rc = IWKV_ERROR_NOTFOUND;
+    goto finish;
+  }
+  fsm->release_mmap(fsm);
+  mm = 0;
+  if (sblk->pnum == 1) { // last kv in block
+    KVBLK *kvblk = sblk->kvblk;
+    _lx_release_mm(lx, 0);
+    lx->nlvl = sblk->lvl;
+    lx->upper_addr = sblk->addr;
+    rc = _lx_find_bounds(lx);
+    RCRET(rc);
+    assert(lx->upper->pnum == 1 && lx->upper->addr == lx->upper_addr);
+    lx->upper->kvblk = kvblk;
+    rc = _sblk_rmkv(lx->upper, idx, 0);
+    RCGO(rc, finish);
+    for (int i = 0; i <= lx->nlvl; ++i) {
+      lx->plower[i]->n[i] = lx->upper->n[i];
+      lx->plower[i]->flags |= SBLK_DURTY;
+      if (lx->plower[i]->flags & SBLK_DB) {
+        if (!lx->plower[i]->n[i]) {
+          --lx->plower[i]->lvl;
+        }
+      }
+      if (lx->pupper[i] == lx->upper) {
+        lx->pupper[i] = 0;
+      }
+    }
+    SBLK *nb;
+    assert(!lx->nb);
+    rc = _sblk_at(lx, BLK2ADDR(lx->upper->n[0]), 0, &nb);
+    RCGO(rc, finish);
+    lx->nb = nb;
+    lx->nb->p0 = lx->upper->p0;
+    lx->nb->flags |= SBLK_DURTY;
+    rc = _sblk_destroy(lx, &lx->upper);
+  } else {
+    rc = _sblk_rmkv(sblk, idx, 0);
+    RCGO(rc, finish);
+  }
+finish:
+  if (mm) {
+    fsm->release_mmap(fsm);
+  }
+  if (rc) {
+    _lx_release_mm(lx, 0);
+  } else {
+    rc = _lx_release(lx);
+  }
+  _rcache_invalidate(lx->db, lx->key);
+  return rc;
+}
+
+/**
+ * @brief Put or delete `lx->key` by leaf writer under database read lock.
+ * @details Only modifications confined to a single `SBLK` and its `KVBLK`
+ *          are done by leaf writers: block has full lower key which is not changed,
+ *          no new blocks created and `KVBLK` is modified in place without allocations.
+ *          Writers of different blocks run in parallel, block itself is guarded by latch.
+ * @param [out] olsn WAL record log sequence number
+ * @param [out] odone Set to `false` if operation should be done by regular writer
+ */
+static WUR iwrc _lx_leaf_lr(IWLCTX *lx, uint64_t *olsn, bool *odone) {
+  iwrc rc;
+  bool found, fits = false;
+  uint8_t *mm, idx;
+  IWDB db = lx->db;
+  IWFS_FSM *fsm = &db->file->fsm;
+  *odone = false;
+  rc = _lx_find_bounds(lx);
+  RCRET(rc);
+  off_t addr = (lx->lower->flags & SBLK_DB) ? 0 : lx->lower->addr;
+  _lx_release_mm(lx, 0);
+  if (!addr) {
+    return 0;
+  }
+  pthread_rwlock_t *latch = _db_latch(db, addr);
+  int rci = pthread_rwlock_wrlock(latch);
+  if (rci) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  atomic_fetch_add(&db->leafw, 1);
+  if (atomic_load(&db->pins)) {
+    goto finish;
+  }
+  // Block is reloaded since it may be changed by another leaf writer
+  rc = _sblk_at(lx, addr, 0, &lx->lower);
+  RCGO(rc, finish);
+  SBLK *sblk = lx->lower;
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCGO(rc, finish);
+  rc = _sblk_loadkvblk_mm(lx, sblk, mm);
+  if (!rc) {
+    rc = _sblk_find_pi_mm(sblk, lx->key, mm, &found, &idx);
+  }
+  fsm->release_mmap(fsm);
+  RCGO(rc, finish);
+  if (!(sblk->flags & SBLK_FULL_LKEY)) {
+    goto finish;
+  }
+  if (lx->op == IWLCTX_PUT) {
+    if (found && (lx->opflags & IWKV_NO_OVERWRITE)) {
+      rc = IWKV_ERROR_KEY_EXISTS;
+      *odone = true;
+      goto finish;
+    }
+    fits = found ? _kvblk_updatev_fits(sblk->kvblk, sblk->pi[idx], lx->key, lx->val)
+           : (idx > 0 && sblk->pnum < lx->db->pnmax && _kvblk_addkv_fits(sblk->kvblk, lx->key, lx->val));
+  } else if (!found) {
+    // Lower block of key is not changed by leaf writers
+    rc = IWKV_ERROR_NOTFOUND;
+    *odone = true;
+    goto finish;
+  } else {
+    fits = (idx > 0 && sblk->pnum > 1);
+  }
+  if (!fits) {
+    goto finish;
+  }
+  if (lx->op == IWLCTX_PUT && !found) {
+    _bloom_add(db, lx->key);
+  }
+  _db_wseq_begin(db);
+  if (lx->op == IWLCTX_PUT) {
+    rc = found ? _sblk_updatekv(sblk, idx, lx->key, lx->val, lx->opflags, false)
+         : _sblk_addkv2(sblk, idx, lx->key, lx->val, lx->opflags, false);
+  } else {
+    rc = _sblk_rmkv(sblk, idx, RMKV_NO_RESIZE);
+  }
+  if (!rc) {
+    assert(!(sblk->flags & SBLK_CACHE_FLAGS));
+    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+    if (!rc) {
+      rc = _sblk_sync_mm(lx, sblk, mm);
+      fsm->release_mmap(fsm);
+    }
+  }
+  _db_wseq_end(db);
+  if (!rc && db->iwkv->wal) {
+    // Record is added under latch to keep order of changes of the same key
+    rc = iwal_add(db->iwkv->wal, lx->op == IWLCTX_PUT ? WOP_PUT : WOP_DEL, db->id,
+                  lx->op == IWLCTX_PUT ? lx->opflags : 0, lx->key, lx->wval ? lx->wval : lx->val, olsn);
+  }
+  *odone = true;
+
+finish:
+  if (lx->lower) {
+    _sblk_release(lx, &lx->lower);
+  }
+  atomic_fetch_sub(&db->leafw, 1);
+  pthread_rwlock_unlock(latch);
+  return rc;
+}
+
+//-------------------------- CACHE
+
+// Update memory size of all database caches
+static void _dbcache_account_lw(IWDB db) {
+  DBCACHE *c = &db->cache;
+  size_t msize = 0;
+  if (c->nodes) {
+    msize = sizeof(*c->nodes) * c->anum + c->ksize;
+    if (c->ikeys) {
+      msize += sizeof(*c->ikeys) * c->anum;
+    }
+  }
+  if (msize > c->msize) {
+    atomic_fetch_add(&db->iwkv->cache_msize, msize - c->msize);
+  } else if (msize < c->msize) {
+    atomic_fetch_sub(&db->iwkv->cache_msize, c->msize - msize);
+  }
+  c->msize = msize;
+}
+
+static void _dbcache_destroy_lw(IWDB db) {
+  if (db->cache.nodes) {
+    free(db->cache.nodes);
+    db->cache.nodes = 0;
+  }
+  if (db->cache.keys) {
+    free(db->cache.keys);
+    db->cache.keys = 0;
+  }
+  if (db->cache.ikeys) {
+    free(db->cache.ikeys);
+    db->cache.ikeys = 0;
+  }
+  _dbcache_account_lw(db);
+  memset(&db->cache, 0, sizeof(db->cache));
+}
+
+// Lower key of cached node `n`
+IW_INLINE const uint8_t *_dbcache_node_key(IWLCTX *lx, const DBCNODE *n, uint32_t *okl) {
+  if (n->koff == DBCNODE_LXKEY) {
+    *okl = lx->key->size;
+    return lx->key->data;
+  }
+  *okl = n->lkl;
+  return (n->lkl > DBCNODE_PFXLEN) ? lx->db->cache.keys + n->koff : n->pfx;
+}
+
+// Rewrite keys arena of `c` cache leaving only keys of cached nodes.
+// Cache is kept as is if memory allocation failed.
+static void _dbcache_keys_compact_lw(DBCACHE *c) {
+  size_t ksize = c->kused - c->kfree;
+  uint8_t *keys = malloc(ksize ? ksize : 1);
+  if (!keys) {
+    return;
+  }
+  size_t koff = 0;
+  for (size_t i = 0; i < c->num; ++i) {
+    DBCNODE *n = &c->nodes[i];
+    if (n->lkl > DBCNODE_PFXLEN) {
+      memcpy(keys + koff, c->keys + n->koff, n->lkl);
+      n->koff = koff;
+      koff += n->lkl;
+    }
+  }
+  assert(koff == ksize);
+  free(c->keys);
+  c->keys = keys;
+  c->ksize = ksize ? ksize : 1;
+  c->kused = koff;
+  c->kfree = 0;
+}
+
+// Set lower key of cached node `n`.
+// Keys longer than `DBCNODE_PFXLEN` are appended to keys arena.
+static WUR iwrc _dbcache_node_setkey_lw(DBCACHE *c, DBCNODE *n, const uint8_t *lk, uint8_t lkl) {
+  memset(n->pfx, 0, sizeof(n->pfx));
+  memcpy(n->pfx, lk, MIN(lkl, DBCNODE_PFXLEN));
+  n->lkl = lkl;
+  n->koff = 0;
+  if (lkl <= DBCNODE_PFXLEN) {
+    return 0;
+  }
+  if (c->kused + lkl > c->ksize) {
+    size_t ksize = MAX(c->ksize * 2, c->kused + lkl);
+    uint8_t *keys = realloc(c->keys, ksize);
+    if (!keys) {
+      return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    }
+    c->keys = keys;
+    c->ksize = ksize;
+  }
+  memcpy(c->keys + c->kused, lk, lkl);
+  n->koff = c->kused;
+  c->kused += lkl;
+  return 0;
+}
+
+// Release arena space of lower key of cached node `n`
+IW_INLINE void _dbcache_node_rmkey_lw(DBCACHE *c, const DBCNODE *n) {
+  if (n->lkl > DBCNODE_PFXLEN) {
+    c->kfree += n->lkl;
+  }
+}
+
+// Compact keys arena if the most of it is occupied by released keys
+IW_INLINE void _dbcache_keys_gc_lw(DBCACHE *c) {
+  if (c->kfree > c->kused / 2 && c->kfree >= DBCACHE_ALLOC_STEP * SBLK_LKLEN) {
+    _dbcache_keys_compact_lw(c);
+  }
+}
+
+// Max number of integer keys scanned linearly by `_dbcache_ikeys_pos()`
+#define DBCACHE_IKEYS_SCAN 16
+
+/**
+ * @brief Returns number of cached integer keys greater than `key`.
+ * @details Database keys are in descending order. Branchless bisection narrows
+ *          the range, then the rest is counted by a loop vectorized by compiler.
+ */
+IW_INLINE size_t _dbcache_ikeys_pos(const uint64_t *keys, size_t num, uint64_t key) {
+  const uint64_t *base = keys;
+  size_t cnt = 0;
+  while (num > DBCACHE_IKEYS_SCAN) {
+    size_t half = num / 2;
+    base = (base[half] > key) ? base + half : base;
+    num -= half;
+  }
+  for (size_t i = 0; i < num; ++i) {
+    cnt += (base[i] > key);
+  }
+  return (base - keys) + cnt;
+}
+
+static WUR iwrc _dbcache_ikeys_fill_lw(IWDB db) {
+  DBCACHE *c = &db->cache;
+  uint64_t *ikeys = realloc(c->ikeys, sizeof(*ikeys) * c->anum);
+  if (!ikeys) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  c->ikeys = ikeys;
+  for (size_t i = 0; i < c->num; ++i) {
+    ikeys[i] = _uint_key(db->dbflg, c->nodes[i].pfx);
+  }
+  return 0;
+}
+
+IW_INLINE uint8_t _dbcache_lvl(IWDB db, uint8_t lvl) {
+  uint8_t levels = db->cache_levels;
+  uint8_t minlvl = db->cache_opts.min_level;
+  uint8_t clvl = (lvl >= levels) ? (lvl - levels + 1) : minlvl;
+  if (clvl < minlvl) {
+    clvl = minlvl;
+  }
+  return clvl;
+}
+
+// Number of lookups between adjustments of adaptive database cache
+#define DBCACHE_ADAPT_PERIOD 4096
+
+/**
+ * @brief Adjust number of cached levels of adaptive database cache.
+ * @details Called for every lookup started from database cache.
+ *          Number of cached levels is increased if lookups roll forward through
+ *          more `SBLK` nodes than from the lowest cacheable level and decreased
+ *          if memory budget of caches is exceeded.
+ *          Cache is closed then and rebuilt on next write locked access.
+ *
+ * @param hops Number of `SBLK` nodes visited by lookup
+ */
+static void _dbcache_adapt(IWLCTX *lx, uint32_t hops) {
+  IWDB db = lx->db;
+  IWKV iwkv = db->iwkv;
+  DBCACHE *c = &db->cache;
+  atomic_fetch_add_explicit(&db->cache_hops, hops, memory_order_relaxed);
+  if (atomic_fetch_add_explicit(&db->cache_lookups, 1, memory_order_relaxed) != DBCACHE_ADAPT_PERIOD - 1) {
+    return;
+  }
+  uint64_t avg = atomic_exchange_explicit(&db->cache_hops, 0, memory_order_relaxed) / DBCACHE_ADAPT_PERIOD;
+  atomic_store_explicit(&db->cache_lookups, 0, memory_order_relaxed);
+  uint8_t levels = db->cache_levels;
+  size_t msize = atomic_load_explicit(&iwkv->cache_msize, memory_order_relaxed);
+  if (iwkv->cache_budget && msize > iwkv->cache_budget) {
+    if (levels > 1) {
+      --levels;
+    }
+  } else if (c->lvl > db->cache_opts.min_level && levels < SLEVELS
+             && avg > 2 * db->cache_opts.min_level) {
+    // Every new level doubles cache size
+    if (!iwkv->cache_budget || msize + c->msize <= iwkv->cache_budget) {
+      ++levels;
+    }
+  }
+  if (levels != db->cache_levels) {
+    db->cache_levels = levels;
+    c->open = false;
+  }
+}
+
+static WUR iwrc _dbcache_cmp_nodes(const void *v1, const void *v2, void *op, int *res) {
+  KVBLK *kb;
+  IWLCTX *lx = op;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  const DBCNODE *c1 = v1, *c2 = v2;
+  KVKEY k1 = { 0 }, k2 = { 0 };
+  uint8_t *mm = 0;
+  iwrc rc = 0;
+
+  k1.buf = _dbcache_node_key(lx, c1, &k1.len);
+  k2.buf = _dbcache_node_key(lx, c2, &k2.len);
+  if (lx->db->dbflg & IWDB_UINT_KEYS_FLAGS) {
+    *res = _cmp_key2(lx->db->dbflg, k1.buf, k1.len, k2.buf, k2.len);
+  } else if (lx->db->dbflg & IWDB_CUSTOM_KEYS) {
+    // Custom comparator needs full keys
+    *res = (c1->fullkey && c2->fullkey) ? _cmp_ukey(lx->db, k1.buf, k1.len, k2.buf, k2.len) : 0;
+  } else {
+    // Inline prefixes are compared first, keys arena is touched only if prefixes are equal
+    uint32_t pl = MIN(DBCNODE_PFXLEN, MIN(k1.len, k2.len));
+    *res = strncmp((const char *) c2->pfx, (const char *) c1->pfx, pl);
+    if (*res == 0 && pl < MIN(k1.len, k2.len)) {
+      *res = _cmp_key2(lx->db->dbflg, k1.buf, k1.len, k2.buf, k2.len);
+    }
+  }
+  if (*res == 0 && (!c1->fullkey || !c2->fullkey)) {
+    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+    RCRET(rc);
+    if (!c1->fullkey) {
+      rc = _kvblk_at_mm(lx, BLK2ADDR(c1->kblkn), mm, 0, &kb);
+      RCGO(rc, finish);
+      rc = _kvblk_peek_key(kb, c1->k0idx, mm, &k1);
+      RCGO(rc, finish);
+    }
+    if (!c2->fullkey) {
+      rc = _kvblk_at_mm(lx, BLK2ADDR(c2->kblkn), mm, 0, &kb);
+      RCGO(rc, finish);
+      rc = _kvblk_peek_key(kb, c2->k0idx, mm, &k2);
+      RCGO(rc, finish);
+    }
+    *res = _db_cmp_kvkeys(lx->db, &k1, &k2);
+  }
+finish:
+  if (mm) {
+    fsm->release_mmap(fsm);
+  }
+  return rc;
+}
+
+static WUR iwrc _dbcache_build_lw(IWLCTX *lx) {
+  iwrc rc = 0;
+  IWDB db = lx->db;
+  if (!lx->dblk.addr) {
+    SBLK *s;
+    rc = _sblk_at(lx, lx->db->addr, 0, &s);
+    RCRET(rc);
+    memcpy(&lx->dblk, s, sizeof(lx->dblk));
+  }
+  SBLK *sdb = &lx->dblk;
+  SBLK *sblk = sdb;
+  DBCACHE *c = &db->cache;
+  assert(lx->db->addr == sdb->addr);
+  c->atime = lx->ts;
+  c->num = 0;
+  if (c->nodes) {
+    free(c->nodes);
+    c->nodes = 0;
+  }
+  if (c->keys) {
+    free(c->keys);
+    c->keys = 0;
+  }
+  if (c->ikeys) {
+    free(c->ikeys);
+    c->ikeys = 0;
+  }
+  c->ksize = 0;
+  c->kused = 0;
+  c->kfree = 0;
+  if (sdb->lvl < db->cache_opts.min_level) {
+    c->open = true;
+    return 0;
+  }
+  c->lvl = _dbcache_lvl(db, sdb->lvl);
+  size_t cnum = 0;
+  for (int i = c->lvl; i < SLEVELS; ++i) {
+    cnum += db->lcnt[i];
+  }
+  c->anum = cnum + DBCACHE_ALLOC_STEP;
+  c->nodes = malloc(sizeof(*c->nodes) * c->anum);
+  if (!c->nodes) {
+    c->open = false;
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  blkn_t n;
+  size_t num = 0;
+  while ((n = sblk->n[c->lvl])) {
+    rc = _sblk_at(lx, BLK2ADDR(n), 0, &sblk);
+    RCGO(rc, finish);
+    if (sblk->lkl > lx->db->lklen) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      goto finish;
+    }
+    if (c->anum < num + 1) {
+      DBCNODE *nodes = realloc(c->nodes, sizeof(*nodes) * (c->anum + DBCACHE_ALLOC_STEP));
+      if (!nodes) {
+        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+        goto finish;
+      }
+      c->anum += DBCACHE_ALLOC_STEP;
+      c->nodes = nodes;
+    }
+    DBCNODE *cn = &c->nodes[num];
+    cn->fullkey = (sblk->flags & SBLK_FULL_LKEY);
+    cn->k0idx = sblk->pi[0];
+    cn->lvl = sblk->lvl;
+    cn->sblkn = ADDR2BLK(sblk->addr);
+    cn->kblkn = sblk->kvblkn;
+    rc = _dbcache_node_setkey_lw(c, cn, sblk->lk, sblk->lkl);
+    RCGO(rc, finish);
+    ++num;
+  }
+  c->num = num;
+  if (db->dbflg & IWDB_UINT_KEYS_FLAGS) {
+    rc = _dbcache_ikeys_fill_lw(db);
+  }
+
+finish:
+  if (rc) {
+    _dbcache_destroy_lw(db);
+    return rc;
+  }
+  c->open = true;
+  return 0;
+}
+
+// Keep cache of database bound to NUMA node, placement is a hint so errors are ignored
+static void _dbcache_numa_bind_lw(IWDB db) {
+  DBCACHE *c = &db->cache;
+  if (!db->numa) {
+    return;
+  }
+  if (c->nodes) {
+    iwp_numa_bind(c->nodes, sizeof(*c->nodes) * c->anum, db->numa_node);
+  }
+  if (c->keys) {
+    iwp_numa_bind(c->keys, c->ksize, db->numa_node);
+  }
+  if (c->ikeys) {
+    iwp_numa_bind(c->ikeys, sizeof(*c->ikeys) * c->anum, db->numa_node);
+  }
+}
+
+static WUR iwrc _dbcache_fill_lw(IWLCTX *lx) {
+  _dbstat_add(lx->db, DBS_CACHE_REBUILDS, 1);
+  IWTRACE_BEGIN(lx->db->iwkv->trace, ev, IWTRACE_DBCACHE_FILL);
+  iwrc rc = _dbcache_build_lw(lx);
+  _dbcache_account_lw(lx->db);
+  _dbcache_numa_bind_lw(lx->db);
+  IWTRACE_END(lx->db->iwkv->trace, ev, lx->db->cache.num, lx->db->id);
+  if (!rc) {
+    rc = _bloom_open_lw(lx);
+  }
+  return rc;
+}
+
+// Find the nearest cached lower `SBLK` of `lx->key`
+// `oblkn` is set to zero if database block is lower
+static WUR iwrc _dbcache_find(IWLCTX *lx, blkn_t *oblkn) {
+  off_t idx;
+  bool found;
+  IWDB db = lx->db;
+  DBCACHE *cache = &db->cache;
+  *oblkn = 0;
+  assert(cache->nodes);
+  if (cache->ikeys && lx->key->size == _uint_key_size(db->dbflg)) {
+    idx = _dbcache_ikeys_pos(cache->ikeys, cache->num, _uint_key(db->dbflg, lx->key->data));
+  } else {
+    DBCNODE n = {
+      .koff = DBCNODE_LXKEY,
+      .fullkey = 1
+    };
+    memcpy(n.pfx, lx->key->data, MIN(lx->key->size, DBCNODE_PFXLEN));
+    idx = iwarr_sorted_find2(cache->nodes, cache->num, sizeof(n), &n, lx, &found, _dbcache_cmp_nodes);
+  }
+  if (idx > 0) {
+    DBCNODE *fn = &cache->nodes[idx - 1];
+    assert(idx - 1 < cache->num);
+    *oblkn = fn->sblkn;
+  }
+  return 0;
+}
+
+static WUR iwrc _dbcache_get(IWLCTX *lx) {
+  blkn_t blkn;
+  DBCACHE *cache = &lx->db->cache;
+  cache->atime = lx->ts;
+  if (lx->nlvl > -1 || lx->snap || cache->num < 1) { // Cache reflects the current database state
+    lx->lower = &lx->dblk;
+    return 0;
+  }
+  iwrc rc = _dbcache_find(lx, &blkn);
+  RCRET(rc);
+  if (blkn) {
+    return _sblk_at(lx, BLK2ADDR(blkn), 0, &lx->lower);
+  }
+  lx->lower = &lx->dblk;
+  return 0;
+}
+
+// Allocate buffers of empty cache
+static WUR iwrc _dbcache_init_lw(IWDB db, uint8_t lvl) {
+  DBCACHE *c = &db->cache;
+  c->lvl = lvl;
+  c->num = 0;
+  c->anum = DBCACHE_ALLOC_STEP;
+  c->nodes = malloc(sizeof(*c->nodes) * c->anum);
+  if (!c->nodes) {
+    iwrc rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    _dbcache_destroy_lw(db);
+    return rc;
+  }
+  if (db->dbflg & IWDB_UINT_KEYS_FLAGS) {
+    iwrc rc = _dbcache_ikeys_fill_lw(db);
+    if (rc) {
+      _dbcache_destroy_lw(db);
+      return rc;
+    }
+  }
+  return 0;
+}
+
+// Remove all cached nodes below new cache level `lvl`
+static void _dbcache_shift_up_lw(IWDB db, uint8_t lvl) {
+  DBCACHE *c = &db->cache;
+  size_t j = 0;
+  for (size_t i = 0; i < c->num; ++i) {
+    DBCNODE *n = &c->nodes[i];
+    if (n->lvl < lvl) {
+      _dbcache_node_rmkey_lw(c, n);
+      continue;
+    }
+    if (i != j) {
+      c->nodes[j] = *n;
+      if (c->ikeys) {
+        c->ikeys[j] = c->ikeys[i];
+      }
+    }
+    ++j;
+  }
+  c->num = j;
+  c->lvl = lvl;
+  _dbcache_keys_gc_lw(c);
+}
+
+static WUR iwrc _dbcache_put_lw(IWLCTX *lx, SBLK *sblk) {
+  off_t idx;
+  bool found;
+  DBCNODE n;
+  IWDB db = lx->db;
+  DBCACHE *cache = &db->cache;
+
+  sblk->flags &= ~SBLK_CACHE_PUT;
+  cache->atime = lx->ts;
+  if (!cache->open || sblk->pnum < 1 || sblk->lvl < db->cache_opts.min_level) {
+    return 0;
+  }
+  if (!cache->nodes) {
+    // Database reached the lowest cacheable level,
+    // so this node is the only one to be cached
+    iwrc rc = _dbcache_init_lw(db, _dbcache_lvl(db, MAX(lx->dblk.lvl, sblk->lvl)));
+    RCRET(rc);
+  } else if (sblk->lvl >= cache->lvl + db->cache_levels + DBCACHE_LVL_SLACK) {
+    // New top level in database
+    _dbcache_shift_up_lw(db, _dbcache_lvl(db, sblk->lvl));
+  }
+  if (sblk->lvl < cache->lvl) {
+    return 0;
+  }
+  if (!sblk->kvblk) {
+    assert(sblk->kvblk);
+    return IW_ERROR_INVALID_STATE;
+  }
+  n.fullkey = (sblk->flags & SBLK_FULL_LKEY);
+  n.k0idx = sblk->pi[0];
+  n.lvl = sblk->lvl;
+  n.sblkn = ADDR2BLK(sblk->addr);
+  n.kblkn = sblk->kvblkn;
+  iwrc rc = _dbcache_node_setkey_lw(cache, &n, sblk->lk, sblk->lkl);
+  if (rc) {
+    _dbcache_destroy_lw(db);
+    return rc;
+  }
+
+  if (cache->ikeys) {
+    uint64_t ikey = _uint_key(db->dbflg, n.pfx);
+    idx = _dbcache_ikeys_pos(cache->ikeys, cache->num, ikey);
+    assert(idx >= cache->num || cache->ikeys[idx] != ikey);
+  } else {
+    idx = iwarr_sorted_find2(cache->nodes, cache->num, sizeof(n), &n, lx, &found, _dbcache_cmp_nodes);
+    assert(!found);
+  }
+  if (cache->anum <= cache->num) {
+    size_t anum = cache->anum + DBCACHE_ALLOC_STEP;
+    DBCNODE *nodes = realloc(cache->nodes, sizeof(*nodes) * anum);
+    if (!nodes) {
+      rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      _dbcache_destroy_lw(db);
+      return rc;
+    }
+    cache->anum = anum;
+    cache->nodes = nodes;
+    if (cache->ikeys) {
+      uint64_t *ikeys = realloc(cache->ikeys, sizeof(*ikeys) * anum);
+      if (!ikeys) {
+        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+        _dbcache_destroy_lw(db);
+        return rc;
+      }
+      cache->ikeys = ikeys;
+    }
+    _dbcache_numa_bind_lw(db);
+  }
+  memmove(cache->nodes + idx + 1, cache->nodes + idx, (cache->num - idx) * sizeof(n));
+  cache->nodes[idx] = n;
+  if (cache->ikeys) {
+    memmove(cache->ikeys + idx + 1, cache->ikeys + idx, (cache->num - idx) * sizeof(*cache->ikeys));
+    cache->ikeys[idx] = _uint_key(db->dbflg, n.pfx);
+  }
+  ++cache->num;
+  _dbcache_account_lw(db);
+  return 0;
+}
+
+static void _dbcache_remove_lw(IWLCTX *lx, SBLK *sblk) {
+  IWDB db = lx->db;
+  DBCACHE *cache = &db->cache;
+  sblk->flags &= ~SBLK_CACHE_REMOVE;
+  cache->atime = lx->ts;
+  // Cache level is not shifted down if database level is reduced,
+  // cache just keeps less levels until database grows again
+  if (sblk->lvl < cache->lvl || cache->num < 1) {
+    return;
+  }
+  blkn_t sblkn = ADDR2BLK(sblk->addr);
+  size_t num = cache->num;
+  for (size_t i = 0; i < num; ++i) {
+    DBCNODE *n = &cache->nodes[i];
+    if (sblkn == n->sblkn) {
+      _dbcache_node_rmkey_lw(cache, n);
+      if (i < num - 1) {
+        memmove(cache->nodes + i, cache->nodes + i + 1, (num - i - 1) * sizeof(*n));
+        if (cache->ikeys) {
+          memmove(cache->ikeys + i, cache->ikeys + i + 1, (num - i - 1) * sizeof(*cache->ikeys));
+        }
+      }
+      --cache->num;
+      _dbcache_keys_gc_lw(cache);
+      break;
+    }
+  }
+}
+
+static void _dbcache_update_lw(IWLCTX *lx, SBLK *sblk) {
+  IWDB db = lx->db;
+  DBCACHE *cache = &db->cache;
+  assert(sblk->pnum > 0);
+  sblk->flags &= ~SBLK_CACHE_UPDATE;
+  cache->atime = lx->ts;
+  if (sblk->lvl < cache->lvl || cache->num < 1) {
+    return;
+  }
+  blkn_t sblkn = ADDR2BLK(sblk->addr);
+  size_t num = cache->num;
+  for (size_t i = 0; i < num; ++i) {
+    DBCNODE *n = &cache->nodes[i];
+    if (sblkn == n->sblkn) {
+      n->kblkn = sblk->kvblkn;
+      n->fullkey = (sblk->flags & SBLK_FULL_LKEY);
+      n->k0idx = sblk->pi[0];
+      if (sblk->lkl <= n->lkl && sblk->lkl > DBCNODE_PFXLEN) {
+        // Shorter key is stored in place of the old one
+        cache->kfree += n->lkl - sblk->lkl;
+        memcpy(cache->keys + n->koff, sblk->lk, sblk->lkl);
+        memset(n->pfx, 0, sizeof(n->pfx));
+        memcpy(n->pfx, sblk->lk, DBCNODE_PFXLEN);
+        n->lkl = sblk->lkl;
+      } else {
+        _dbcache_node_rmkey_lw(cache, n);
+        if (_dbcache_node_setkey_lw(cache, n, sblk->lk, sblk->lkl)) {
+          // Cache will be rebuilt on next access
+          _dbcache_destroy_lw(db);
+          return;
+        }
+      }
+      if (cache->ikeys) {
+        cache->ikeys[i] = _uint_key(db->dbflg, n->pfx);
+      }
+      _dbcache_keys_gc_lw(cache);
+      _dbcache_account_lw(db);
+      break;
+    }
+  }
+}
+
+//--------------------------  CURSOR
+
+IW_INLINE WUR iwrc _cursor_get_ge_idx(IWLCTX *lx, IWKV_cursor_op op, uint8_t *oidx) {
+  iwrc rc = _lx_find_bounds(lx);
+  RCRET(rc);
+  bool found;
+  uint8_t *mm, idx;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  rc = _sblk_loadkvblk_mm(lx, lx->lower, mm);
+  RCGO(rc, finish);
+  rc = _sblk_find_pi_mm(lx->lower, lx->key, mm, &found, &idx);
+  RCGO(rc, finish);
+  if (found) {
+    *oidx = idx;
+  } else {
+    if (op == IWKV_CURSOR_EQ || (lx->lower->flags & SBLK_DB) || lx->lower->pnum < 1) {
+      rc = IWKV_ERROR_NOTFOUND;
+    } else {
+      *oidx = idx ? idx - 1 : idx;
+    }
+  }
+finish:
+  IWRC(fsm->release_mmap(fsm), rc);
+  return rc;
+}
+
+/** Range of file requested by cursor prefetch */
+typedef struct PFRANGE {
+  off_t off;
+  off_t len;
+} PFRANGE;
+
+/**
+ * @brief Request data of blocks ahead of sequentially scanning cursor.
+ * @details Called on every hop of cursor to the next block, does nothing until cursor
+ *          made `CURSOR_PREFETCH_SEQ` hops in one direction.
+ *          For `IWKV_MMAP_RANDOM` storage readahead is disabled, so once per `CURSOR_PREFETCH_NUM`
+ *          hops `KVBLK` headers of the blocks following the current batch window are requested
+ *          along with entire `KVBLK`s of the window, which headers were requested by the previous batch.
+ *          Requested ranges are sorted and merged, so blocks placed close to each other
+ *          cost a single `madvise`.
+ */
+static void _cursor_prefetch(IWKV_cursor cur, IWKV_cursor_op op) {
+  IWDB db = cur->lx.db;
+  IWFS_FSM *fsm = &db->file->fsm;
+  if (cur->pfop != op) {
+    cur->pfop = op;
+    cur->pfhops = 0;
+  }
+  uint32_t hops = ++cur->pfhops;
+  if (hops < CURSOR_PREFETCH_SEQ) {
+    return;
+  }
+  if (cur->bounded && cur->cn->pnum > 0
+      && ((op == IWKV_CURSOR_NEXT) ? cur->cnlo < cur->cn->pnum : cur->cnhi > 0)) {
+    return; // Range ends in the current block
+  }
+  blkn_t dblk = ADDR2BLK(db->addr);
+  blkn_t n = (op == IWKV_CURSOR_NEXT) ? cur->cn->n[0] : cur->cn->p0;
+  if (!n || n == dblk) {
+    return;
+  }
+  if (!(db->iwkv->oflags & IWKV_MMAP_RANDOM) || (hops - CURSOR_PREFETCH_SEQ) % CURSOR_PREFETCH_NUM) {
+    // Kernel readahead is in charge unless `IWKV_MMAP_RANDOM` is set
+    return;
+  }
+  uint8_t *mm;
+  if (fsm->acquire_mmap(fsm, 0, &mm, 0)) {
+    return;
+  }
+  int rnum = 0;
+  PFRANGE r[2 * CURSOR_PREFETCH_NUM];
+  // The first batch has no requested headers so KVBLK sizes are read synchronously
+  for (int i = 1; n && n != dblk && i <= 2 * CURSOR_PREFETCH_NUM; ++i) {
+    blkn_t kbn;
+    const uint8_t *rp = mm + BLK2ADDR(n);
+    memcpy(&kbn, rp + SOFF_KBLK_U4, 4);
+    kbn = IW_ITOHL(kbn);
+    if (kbn) {
+      r[rnum].off = BLK2ADDR(kbn);
+      r[rnum].len = 1 << KVBLK_INISZPOW;
+      if (i <= CURSOR_PREFETCH_NUM) {
+        uint8_t szpow = *(mm + r[rnum].off);
+        if (szpow > KVBLK_INISZPOW && szpow < 32) {
+          r[rnum].len = 1ULL << szpow;
+        }
+      }
+      ++rnum;
+    }
+    memcpy(&n, rp + ((op == IWKV_CURSOR_NEXT) ? SOFF_N0_U4 : SOFF_P0_U4), 4);
+    n = IW_ITOHL(n);
+  }
+  fsm->release_mmap(fsm);
+  for (int i = 1; i < rnum; ++i) {
+    PFRANGE v = r[i];
+    int j = i - 1;
+    for ( ; j >= 0 && r[j].off > v.off; --j) {
+      r[j + 1] = r[j];
+    }
+    r[j + 1] = v;
+  }
+  off_t psize = iwp_page_size();
+  for (int i = 0, j; i < rnum; i = j) {
+    off_t end = r[i].off + r[i].len;
+    for (j = i + 1; j < rnum && r[j].off <= end + psize; ++j) {
+      end = MAX(end, r[j].off + r[j].len);
+    }
+    fsm->advise_mmap(fsm, r[i].off, end - r[i].off, IWFS_MADV_WILLNEED);
+  }
+}
+
+// Positions range `[ohi, olo)` of `sblk` records within cursor bounds
+static WUR iwrc _cursor_limits(IWKV_cursor cur, SBLK *sblk, uint8_t *ohi, uint8_t *olo) {
+  iwrc rc = 0;
+  uint8_t *mm;
+  IWFS_FSM *fsm = &cur->lx.db->file->fsm;
+  *ohi = 0;
+  *olo = sblk->pnum;
+  if (!cur->bounded || (sblk->flags & SBLK_DB) || sblk->pnum < 1) {
+    return 0;
+  }
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  if (cur->hi.size) {
+    rc = _sblk_pos_lt_mm(&cur->lx, sblk, &cur->hi, mm, ohi);
+  }
+  if (!rc && cur->lo.size) {
+    rc = _sblk_pos_lt_mm(&cur->lx, sblk, &cur->lo, mm, olo);
+  }
+  fsm->release_mmap(fsm);
+  return rc;
+}
+
+IW_INLINE WUR iwrc _cursor_set_cn(IWKV_cursor cur, SBLK *sblk, uint8_t pos) {
+  iwrc rc = _cursor_limits(cur, sblk, &cur->cnhi, &cur->cnlo);
+  cur->cn = sblk;
+  cur->cnpos = pos;
+  return rc;
+}
+
+// True if cursor points to a record within its range
+IW_INLINE bool _cursor_at_record(IWKV_cursor cur) {
+  return cur->cn && cur->lx.db && !(cur->cn->flags & SBLK_DB)
+         && cur->cnpos < cur->cn->pnum
+         && (!cur->bounded || (cur->cnpos >= cur->cnhi && cur->cnpos < cur->cnlo));
+}
+
+/**
+ * @brief Place bounded cursor before the first or after the last record of its range.
+ * @details Cursor is placed to the nearest record out of range,
+ *          `IWKV_CURSOR_BEFORE_FIRST` position is left as is if there are no records
+ *          greater than or equal to range `hi`. Empty database tail is used as
+ *          `IWKV_CURSOR_AFTER_LAST` position if there are no records lower than range `lo`.
+ */
+static WUR iwrc _cursor_to_bound_lr(IWKV_cursor cur, IWKV_cursor_op op) {
+  iwrc rc;
+  uint8_t pos = 0;
+  SBLK *sblk;
+  IWLCTX *lx = &cur->lx;
+  const IWKV_val *key = lx->key;
+  const IWKV_val *bkey = (op == IWKV_CURSOR_BEFORE_FIRST) ? &cur->hi : &cur->lo;
+  if (!bkey->size) {
+    return 0;
+  }
+  lx->key = bkey;
+  rc = _cursor_get_ge_idx(lx, IWKV_CURSOR_GE, &pos);
+  lx->key = key;
+  if (lx->upper) {
+    _sblk_release(lx, &lx->upper);
+  }
+  if (rc == IWKV_ERROR_NOTFOUND) { // All records are lower than `bkey`
+    if (lx->lower) {
+      _sblk_release(lx, &lx->lower);
+    }
+    if (op == IWKV_CURSOR_BEFORE_FIRST) {
+      return 0;
+    }
+    rc = _sblk_at(lx, lx->db->addr, 0, &sblk);
+    RCRET(rc);
+    if (!sblk->n[0]) {
+      _sblk_release(lx, &sblk);
+      return 0;
+    }
+    blkn_t n = sblk->n[0];
+    _sblk_release(lx, &sblk);
+    rc = _sblk_at(lx, BLK2ADDR(n), 0, &sblk);
+    RCRET(rc);
+    cur->dbaddr = 0;
+    return _cursor_set_cn(cur, sblk, 0);
+  }
+  RCRET(rc);
+  sblk = lx->lower;
+  lx->lower = 0;
+  cur->dbaddr = 0;
+  if (op == IWKV_CURSOR_AFTER_LAST) {
+    // Position next to the lowest record greater than or equal to `lo`
+    if (pos + 1 < sblk->pnum) {
+      ++pos;
+    } else {
+      blkn_t n = sblk->n[0];
+      _sblk_release(lx, &sblk);
+      if (!n) {
+        cur->dbaddr = -1;
+        cur->cnpos = 0;
+        return 0;
+      }
+      rc = _sblk_at(lx, BLK2ADDR(n), 0, &sblk);
+      RCRET(rc);
+      pos = 0;
+    }
+  }
+  return _cursor_set_cn(cur, sblk, pos);
+}
+
+IW_INLINE WUR iwrc _cursor_to_lr(IWKV_cursor cur, IWKV_cursor_op op) {
+  iwrc rc = 0;
+  IWDB db = cur->lx.db;
+  IWLCTX *lx = &cur->lx;
+  blkn_t dblk = ADDR2BLK(db->addr);
+  _dbstat_add(db, DBS_CURSOR_STEPS, 1);
+  if (op != IWKV_CURSOR_NEXT && op != IWKV_CURSOR_PREV) {
+    cur->pfhops = 0; // Cursor repositioned, scan is not sequential anymore
+  }
+  if (op < IWKV_CURSOR_NEXT) { // IWKV_CURSOR_BEFORE_FIRST | IWKV_CURSOR_AFTER_LAST
+    if (cur->cn) {
+      rc = _sblk_sync_and_release(lx, &cur->cn);
+      RCRET(rc);
+    }
+    if (op == IWKV_CURSOR_BEFORE_FIRST) {
+      cur->dbaddr = db->addr;
+      cur->cnpos = db->pnmax - 1;
+    } else {
+      cur->dbaddr = -1; // Negative as sign of dbtail
+      cur->cnpos = 0;
+    }
+    if (cur->bounded) {
+      rc = _cursor_to_bound_lr(cur, op);
+    }
+    return rc;
+  }
+start:
+  if (op < IWKV_CURSOR_EQ) { // IWKV_CURSOR_NEXT | IWKV_CURSOR_PREV
+    blkn_t n = 0;
+    uint8_t hi, lo;
+    SBLK *sblk;
+    if (!cur->cn) {
+      if (cur->dbaddr) {
+        rc = _sblk_at(lx, (cur->dbaddr < 0 ? 0 : cur->dbaddr), 0, &sblk);
+        cur->dbaddr = 0;
+        RCGO(rc, finish);
+        rc = _cursor_set_cn(cur, sblk, cur->cnpos);
+        RCGO(rc, finish);
+      } else {
+        rc = IW_ERROR_INVALID_STATE;
+        goto finish;
+      }
+    }
+    if (op == IWKV_CURSOR_NEXT) {
+      if (cur->cnpos + 1 >= cur->cn->pnum) {
+        n = cur->cn->n[0];
+        if (!n) {
+          rc = IWKV_ERROR_NOTFOUND;
+          goto finish;
+        }
+        rc = _sblk_at(lx, BLK2ADDR(n), 0, &sblk);
+        RCGO(rc, finish);
+        rc = _cursor_limits(cur, sblk, &hi, &lo);
+        if (!rc && sblk->pnum && !lo) { // Next record is out of range
+          rc = IWKV_ERROR_NOTFOUND;
+        }
+        if (rc) {
+          _sblk_release(lx, &sblk);
+          goto finish;
+        }
+        rc = _sblk_sync_and_release(lx, &cur->cn);
+        RCGO(rc, finish);
+        cur->cn = sblk;
+        cur->cnhi = hi;
+        cur->cnlo = lo;
+        _cursor_prefetch(cur, op);
+        cur->cnpos = 0;
+        if (IW_UNLIKELY(!cur->cn->pnum)) {
+          goto start;
+        }
+      } else {
+        if (cur->cn->flags & SBLK_DB) {
+          rc = IW_ERROR_INVALID_STATE;
+          goto finish;
+        }
+        if (cur->bounded && cur->cnpos + 1 >= cur->cnlo) {
+          rc = IWKV_ERROR_NOTFOUND;
+          goto finish;
+        }
+        ++cur->cnpos;
+      }
+    } else { // IWKV_CURSOR_PREV
+      if (cur->cnpos == 0) {
+        n = cur->cn->p0;
+        if (!n || n == dblk) {
+          rc = IWKV_ERROR_NOTFOUND;
+          goto finish;
+        }
+        rc = _sblk_at(lx, BLK2ADDR(n), 0, &sblk);
+        RCGO(rc, finish);
+        rc = _cursor_limits(cur, sblk, &hi, &lo);
+        if (!rc && sblk->pnum && sblk->pnum <= hi) { // Previous record is out of range
+          rc = IWKV_ERROR_NOTFOUND;
+        }
+        if (rc) {
+          _sblk_release(lx, &sblk);
+          goto finish;
+        }
+        rc = _sblk_sync_and_release(lx, &cur->cn);
+        RCGO(rc, finish);
+        cur->cn = sblk;
+        cur->cnhi = hi;
+        cur->cnlo = lo;
+        _cursor_prefetch(cur, op);
+        if (IW_LIKELY(cur->cn->pnum)) {
+          cur->cnpos = cur->cn->pnum - 1;
+        } else {
+          goto start;
+        }
+      } else {
+        if (cur->cn->flags & SBLK_DB) {
+          rc = IW_ERROR_INVALID_STATE;
+          goto finish;
+        }
+        if (cur->bounded && cur->cnpos <= cur->cnhi) {
+          rc = IWKV_ERROR_NOTFOUND;
+          goto finish;
+        }
+        --cur->cnpos;
+      }
+    }
+  } else { // IWKV_CURSOR_EQ | IWKV_CURSOR_GE
+    uint8_t pos;
+    if (!lx->key) {
+      rc = IW_ERROR_INVALID_STATE;
+      goto finish;
+    }
+    rc = _cursor_get_ge_idx(lx, op, &pos);
+    if (lx->upper) {
+      _sblk_release(lx, &lx->upper);
+    }
+    if (!rc) {
+      rc = _cursor_set_cn(cur, lx->lower, pos);
+      lx->lower = 0;
+      if (!rc && !_cursor_at_record(cur)) {
+        rc = IWKV_ERROR_NOTFOUND;
+      }
+    }
+  }
+finish:
+  if (rc && rc != IWKV_ERROR_NOTFOUND && cur->cn) {
+    _sblk_release(lx, &cur->cn);
+  }
+  return rc;
+}
+
+//--------------------------  OPTIMISTIC GET
+
+// Max number of `SBLK` hops of optimistic lookup
+#define OGET_MAX_STEPS 4096
+
+// Number of optimistic lookup attempts before fallback to locked `iwkv_get()`
+#define OGET_ATTEMPTS 3
+
+/** Bounds checked `KVBLK` index used by optimistic lookup */
+typedef struct OGKVBLK {
+  const uint8_t *end;             /**< End of `KVBLK` in mmaped area */
+  const uint8_t *pfx;             /**< Keys prefix */
+  uint32_t pfxl;                  /**< Keys prefix length */
+  uint8_t pnmax;                  /**< Number of KV pair slots, see `IWDB::pnmax` */
+  uint64_t off[KVBLK_IDXNUM_MAX]; /**< KV pair offsets relative to `end` */
+  uint32_t len[KVBLK_IDXNUM_MAX]; /**< KV pair lengths */
+} OGKVBLK;
+
+// Read varint number within `[rp, ep)`
+// Returns number of bytes read or zero if number is malformed.
+IW_INLINE int _oget_readvn(const uint8_t *rp, const uint8_t *ep, uint64_t *onum) {
+  uint64_t num = 0, base = 1;
+  for (int i = 0; i < KVP_MAX_OFF_VLEN && rp + i < ep; ++i) {
+    int8_t c = ((const int8_t *) rp)[i];
+    if (c >= 0) {
+      *onum = num + base * c;
+      return i + 1;
+    }
+    num += base * ~c;
+    base <<= 7;
+  }
+  return 0;
+}
+
+static bool _oget_kvblk(const uint8_t *mm, size_t msize, blkn_t kblkn, uint8_t pnmax, OGKVBLK *kb) {
+  off_t addr = BLK2ADDR(kblkn);
+  if (!kblkn || addr + KVBLK_HDRSZ > msize) {
+    return false;
+  }
+  const uint8_t *rp = mm + addr;
+  uint8_t szpow = *rp;
+  if (szpow < IWKV_FSM_BPOW || szpow > 31 || addr + (1ULL << szpow) > msize) {
+    return false;
+  }
+  uint16_t idxsz;
+  uint64_t bsz = 1ULL << szpow;
+  const uint8_t *ep = rp + MIN(bsz, KVBLK_MAX_NKV_SZ_N(pnmax));
+  kb->end = rp + bsz;
+  kb->pnmax = pnmax;
+  memcpy(&idxsz, rp + 1, sizeof(idxsz));
+  idxsz = IW_ITOHS(idxsz);
+  rp += KVBLK_HDRSZ;
+  kb->pfx = 0;
+  kb->pfxl = 0;
+  if (idxsz & KVBLK_PFX_IDXSZ) {
+    if (rp >= ep || !*rp || *rp > KVBLK_MAX_PFXLEN || rp + 1 + *rp > ep) {
+      return false;
+    }
+    kb->pfxl = *rp;
+    kb->pfx = rp + 1;
+    rp += 1 + kb->pfxl;
+  }
+  for (int i = 0; i < pnmax; ++i) {
+    uint64_t len;
+    int step = _oget_readvn(rp, ep, &kb->off[i]);
+    if (!step) {
+      return false;
+    }
+    rp += step;
+    step = _oget_readvn(rp, ep, &len);
+    if (!step || len > kb->off[i] || kb->off[i] > bsz) {
+      return false;
+    }
+    rp += step;
+    kb->len[i] = len;
+  }
+  return true;
+}
+
+static bool _oget_kvp(const OGKVBLK *kb, uint8_t idx, KVKEY *okey, const uint8_t **oval, uint32_t *ovl) {
+  if (idx >= kb->pnmax || !kb->len[idx]) {
+    return false;
+  }
+  // [klen:vn,key,value]
+  uint64_t klen;
+  const uint8_t *rp = kb->end - kb->off[idx];
+  int step = _oget_readvn(rp, rp + kb->len[idx], &klen);
+  if (!step) {
+    return false;
+  }
+  okey->pfx = 0;
+  okey->pfxl = 0;
+  if (kb->pfxl) {
+    if (klen & 1) {
+      okey->pfx = kb->pfx;
+      okey->pfxl = kb->pfxl;
+    }
+    klen >>= 1;
+  }
+  if (klen > kb->len[idx] - step || !(okey->pfxl + klen)) {
+    return false;
+  }
+  okey->buf = rp + step;
+  okey->len = klen;
+  *oval = rp + step + klen;
+  *ovl = kb->len[idx] - step - klen;
+  return true;
+}
+
+// Store extents of out of line values of `KVBLK` `kblkn` into `ranges`,
+// returns number of stored ranges
+static size_t _kvblk_ovl_ranges(const uint8_t *mm, size_t msize, blkn_t kblkn, uint8_t pnmax,
+                                IWFS_FSM_RANGE *ranges) {
+  KVKEY k;
+  OGKVBLK kb;
+  size_t num = 0;
+  if (!_oget_kvblk(mm, msize, kblkn, pnmax, &kb)) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return 0;
+  }
+  for (int i = 0; i < pnmax; ++i) {
+    off_t addr;
+    uint32_t len, vl;
+    const uint8_t *vp;
+    if (_oget_kvp(&kb, i, &k, &vp, &vl) && _ovl_extent(vp, vl, &addr, &len)) {
+      ranges[num].addr = addr;
+      ranges[num++].len = OVL_EXTENT_SZ(len);
+    }
+  }
+  return num;
+}
+
+// `skey` is a decoded `key` of `IWDB_UINT_KEYS_FLAGS` database
+IW_INLINE bool _oget_cmp(IWDB db, const KVKEY *k, const IWKV_val *key,
+                         uint64_t skey, bool full, int *res) {
+  iwdb_flags_t dbflg = db->dbflg;
+  if (dbflg & IWDB_UINT_KEYS_FLAGS) {
+    if (k->pfxl || k->len != key->size) {
+      return false;
+    }
+    uint64_t pkey = _uint_key(dbflg, k->buf);
+    *res = pkey > skey ? -1 : pkey < skey ? 1 : 0;
+  } else if (dbflg & IWDB_CUSTOM_KEYS) {
+    if (k->pfxl) {
+      return false;
+    }
+    // Lower key prefix is not ordered by custom comparator, full key will be compared
+    *res = full ? _cmp_ukey(db, k->buf, k->len, key->data, key->size) : 0;
+  } else if (full) {
+    *res = _cmp_kvkey(dbflg, k, key->data, key->size);
+  } else {
+    assert(!k->pfxl);
+    *res = _cmp_key2(dbflg, k->buf, k->len, key->data, key->size);
+  }
+  return true;
+}
+
+// Compare the first key of `SBLK` at block `blkn` on level `lvl` with `key`
+static bool _oget_sblk_cmp(IWDB db, const IWKV_val *key, uint64_t skey, const uint8_t *mm, size_t msize,
+                           blkn_t blkn, int lvl, const uint8_t **osp, int *res) {
+  OGKVBLK kb;
+  KVKEY k;
+  const uint8_t *v;
+  uint32_t vl;
+  off_t addr = BLK2ADDR(blkn);
+  if (addr + SBLK_SZ > msize) {
+    return false;
+  }
+  // [u1:flags,lvl:u1,lkl:u1,pnum:u1,p0:u4,kblk:u4,[pi0:u1,... pi32],n0-n23:u4,lk:u116]:u256
+  const uint8_t *sp = mm + addr;
+  uint8_t sflags = sp[SOFF_FLAGS_U1];
+  uint8_t slkl = sp[SOFF_LKL_U1];
+  if ((sflags & ~SBLK_PERSISTENT_FLAGS) || sp[SOFF_LVL_U1] >= SLEVELS || sp[SOFF_LVL_U1] < lvl
+      || slkl > db->lklen || sp[SOFF_PNUM_U1] < 1 || sp[SOFF_PNUM_U1] > db->pnmax) {
+    return false;
+  }
+  bool full = (sflags & SBLK_FULL_LKEY) || (key->size < slkl && !(db->dbflg & IWDB_CUSTOM_KEYS));
+  KVKEY lk = { .buf = sp + SOFF_LK, .len = slkl };
+  if (!_oget_cmp(db, &lk, key, skey, full, res)) {
+    return false;
+  }
+  if (!full && !*res) {
+    memcpy(&blkn, sp + SOFF_KBLK_U4, 4);
+    if (!_oget_kvblk(mm, msize, IW_ITOHL(blkn), db->pnmax, &kb)
+        || !_oget_kvp(&kb, sp[SOFF_PI0_U1], &k, &v, &vl)
+        || !_oget_cmp(db, &k, key, skey, true, res)) {
+      return false;
+    }
+  }
+  *osp = sp;
+  return true;
+}
+
+// Number of levels of database block
+IW_INLINE int _oget_db_levels(IWDB db, const uint8_t *mm) {
+  int lvl;
+  blkn_t blkn;
+  const uint8_t *np = mm + db->addr + DOFF_N0_U4;
+  for (lvl = 0; lvl < SLEVELS; ++lvl) {
+    memcpy(&blkn, np + 4 * lvl, 4);
+    if (!blkn) {
+      break;
+    }
+  }
+  return lvl;
+}
+
+/**
+ * @brief Find lower `SBLK` of `key` descending from level `lvl` of `lp` block.
+ * @param lp Lower block to start from, zero for database block
+ * @param [out] path Optional lower blocks found on every passed level
+ * @param [out] olp Lower `SBLK` of `key` or zero if database block is lower
+ */
+static bool _oget_descend(IWDB db, const IWKV_val *key, uint64_t skey, const uint8_t *mm, size_t msize,
+                          int lvl, const uint8_t *lp, const uint8_t **path, const uint8_t **olp) {
+  int steps = 0;
+  blkn_t blkn;
+  const uint8_t *np = lp ? lp + SOFF_N0_U4 : mm + db->addr + DOFF_N0_U4;
+  for (; lvl >= 0; --lvl) {
+    while (1) {
+      int cret;
+      const uint8_t *sp;
+      memcpy(&blkn, np + 4 * lvl, 4);
+      blkn = IW_ITOHL(blkn);
+      if (!blkn) {
+        break;
+      }
+      if (++steps > OGET_MAX_STEPS || !_oget_sblk_cmp(db, key, skey, mm, msize, blkn, lvl, &sp, &cret)) {
+        return false;
+      }
+      if (cret > 0) { // upper > key
+        break;
+      }
+      lp = sp;
+      np = sp + SOFF_N0_U4;
+    }
+    if (path) {
+      path[lvl] = lp;
+    }
+  }
+  *olp = lp;
+  return true;
+}
+
+// Find `key` in lower `SBLK` `lp` and copy its value
+static bool _oget_sblk_get(IWDB db, const IWKV_val *key, uint64_t skey, const uint8_t *mm, size_t msize,
+                           const uint8_t *lp, IWKV_val *oval, iwrc *orc, IWPOOL *pool) {
+  OGKVBLK kb;
+  KVKEY k;
+  blkn_t blkn;
+  const uint8_t *v;
+  uint32_t vl;
+  if (!lp) {
+    *orc = IWKV_ERROR_NOTFOUND;
+    return true;
+  }
+  int idx, lb = 0, ub = lp[SOFF_PNUM_U1] - 1;
+  memcpy(&blkn, lp + SOFF_KBLK_U4, 4);
+  if (ub >= db->pnmax || !_oget_kvblk(mm, msize, IW_ITOHL(blkn), db->pnmax, &kb)) {
+    return false;
+  }
+  while (lb <= ub) {
+    int cret;
+    idx = (ub + lb) / 2;
+    if (!_oget_kvp(&kb, lp[_sblk_pi_off(idx)], &k, &v, &vl)
+        || !_oget_cmp(db, &k, key, skey, true, &cret)) {
+      return false;
+    }
+    if (!cret) {
+      if ((db->dbflg & IWDB_OVERFLOW_VALS) && !_ovl_locate(mm, msize, &v, &vl)) {
+        return false;
+      }
+      if (vl) {
+        oval->data = _kv_alloc(pool, vl);
+        if (!oval->data) {
+          *orc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+          return true;
+        }
+        memcpy(oval->data, v, vl);
+      }
+      oval->size = vl;
+      return true;
+    } else if (cret < 0) {
+      lb = idx + 1;
+    } else {
+      ub = idx - 1;
+    }
+  }
+  *orc = IWKV_ERROR_NOTFOUND;
+  return true;
+}
+
+/**
+ * @brief Lookup `key` in mmaped area without database lock.
+ * @details Every read is bounds checked since database blocks may be
+ *          concurrently modified. The result is valid only if `IWDB::wseq`
+ *          is not changed after lookup.
+ * @return `false` if inconsistent data found
+ */
+static bool _oget_mm(IWDB db, const IWKV_val *key, const uint8_t *mm, size_t msize,
+                     IWKV_val *oval, iwrc *orc, IWPOOL *pool) {
+  const uint8_t *lp;
+  uint64_t skey = 0;
+  if (db->dbflg & IWDB_UINT_KEYS_FLAGS) {
+    if (key->size != _uint_key_size(db->dbflg)) {
+      return false;
+    }
+    skey = _uint_key(db->dbflg, key->data);
+  }
+  if (db->addr + DOFF_END > msize) {
+    return false;
+  }
+  return _oget_descend(db, key, skey, mm, msize, _oget_db_levels(db, mm) - 1, 0, 0, &lp)
+         && _oget_sblk_get(db, key, skey, mm, msize, lp, oval, orc, pool);
+}
+
+// Optimistic readers take neither storage nor database locks. Operations releasing databases
+// stop new optimistic readers and wait for running ones under storage write lock.
+
+IW_INLINE OREADERS *_oreaders_enter(IWKV iwkv) {
+  OREADERS *r = &iwkv->oreaders[_thread_stripe()];
+  atomic_fetch_add(&r->num, 1);
+  if (atomic_load(&iwkv->ostop)) {
+    atomic_fetch_sub(&r->num, 1);
+    return 0;
+  }
+  return r;
+}
+
+IW_INLINE void _oreaders_exit(OREADERS *r) {
+  atomic_fetch_sub_explicit(&r->num, 1, memory_order_release);
+}
+
+// Stop optimistic readers until `_oreaders_resume()` and wait for running ones
+static void _oreaders_stop(IWKV iwkv) {
+  atomic_store(&iwkv->ostop, true);
+  for (int i = 0; i < OREADERS_STRIPES; ++i) {
+    while (atomic_load(&iwkv->oreaders[i].num)) {
+      sched_yield();
+    }
+  }
+}
+
+IW_INLINE void _oreaders_resume(IWKV iwkv) {
+  atomic_store(&iwkv->ostop, false);
+}
+
+/**
+ * @brief Optimistic version of `iwkv_get()`.
+ * @details Neither storage nor database lock is acquired, lookup result is validated
+ *          against database modification sequence `IWDB::wseq`. Database is kept alive
+ *          by `_oreaders_enter()`. Mmaped area is read without lock if its address
+ *          is never changed (`IWKV_FILE::smm`), otherwise it is acquired as usual.
+ * @param [out] odone Set to `false` if lookup should be repeated by locked `_lx_get_lr()`
+ */
+static iwrc _oget(IWLCTX *lx, bool *odone) {
+  iwrc rc = 0;
+  uint8_t *mm;
+  size_t msize;
+  IWDB db = lx->db;
+  IWKV_FILE *file = db->file;
+  IWFS_FSM *fsm = &file->fsm;
+  *odone = false;
+  OREADERS *r = _oreaders_enter(db->iwkv);
+  if (!r) {
+    return 0;
+  }
+  if (!db->open || !db->iwkv->open) {
+    goto finish;
+  }
+  if (file->smm) {
+    mm = file->smm;
+    msize = file->smsize;
+  } else {
+    rc = fsm->acquire_mmap(fsm, 0, &mm, &msize);
+    RCGO(rc, finish);
+  }
+  for (int i = 0; i < OGET_ATTEMPTS; ++i) {
+    iwrc vrc = 0;
+    IWKV_val val = { 0 };
+    uint64_t seq = atomic_load_explicit(&db->wseq, memory_order_acquire);
+    if (seq & WSEQ_WRITERS_MASK) {
+      break;
+    }
+    if (_oget_mm(db, lx->key, mm, msize, &val, &vrc, lx->pool)) {
+      atomic_thread_fence(memory_order_acquire);
+      if (seq == atomic_load_explicit(&db->wseq, memory_order_relaxed)) {
+        *lx->val = val;
+        *odone = true;
+        rc = vrc;
+        break;
+      }
+    }
+    _kv_val_release(lx->pool, &val);
+  }
+  if (!file->smm) {
+    IWRC(fsm->release_mmap(fsm), rc);
+  }
+  if (*odone && atomic_load_explicit(&db->cache.atime, memory_order_relaxed) != lx->ts) {
+    atomic_store_explicit(&db->cache.atime, lx->ts, memory_order_relaxed);
+  }
+finish:
+  _oreaders_exit(r);
+  return rc;
+}
+
+//--------------------------  WAL
+
+static iwrc _wal_checkpoint(IWAL *wal, void *op) {
+  int rci;
+  iwrc rc = 0;
+  IWKV iwkv = op;
+  // No database modifications are possible under storage write lock
+  API_WLOCK(iwkv, rci);
+  for (int i = 0; i < iwkv->files_num && !rc; ++i) {
+    IWFS_FSM *fsm = &iwkv->files[i].fsm;
+    rc = fsm->sync(fsm, IWFS_FDATASYNC | IWFS_WRITEBACK);
+  }
+  if (!rc) {
+    rc = iwal_checkpoint_done(wal);
+  }
+  API_UNLOCK(iwkv, rci, rc);
+  return rc;
+}
+
+// Size of batch record header: [op:u1,flags:u1,dbid:u4,klen:u4,vlen:u4]
+#define BATCH_RHDR_SZ 14
+
+/** Batch record decoded from records buffer */
+typedef struct BATCHREC {
+  iwal_op_t op;
+  uint8_t flags;
+  uint32_t dbid;
+  IWKV_val key;
+  IWKV_val val;
+} BATCHREC;
+
+// Decode batch record at `*offp` position of `buf`, returns false if no valid record found
+static bool _batch_rec(const uint8_t *buf, size_t bufsz, size_t *offp, BATCHREC *r) {
+  uint32_t lv;
+  size_t off = *offp;
+  if (bufsz - off < BATCH_RHDR_SZ) {
+    return false;
+  }
+  const uint8_t *rp = buf + off;
+  r->op = rp[0];
+  r->flags = rp[1];
+  memcpy(&lv, rp + 2, 4);
+  r->dbid = IW_ITOHL(lv);
+  memcpy(&lv, rp + 6, 4);
+  r->key.size = IW_ITOHL(lv);
+  memcpy(&lv, rp + 10, 4);
+  r->val.size = IW_ITOHL(lv);
+  if (r->key.size > bufsz - off - BATCH_RHDR_SZ
+      || r->val.size > bufsz - off - BATCH_RHDR_SZ - r->key.size) {
+    return false;
+  }
+  r->key.data = (uint8_t *) rp + BATCH_RHDR_SZ;
+  r->val.data = (uint8_t *) rp + BATCH_RHDR_SZ + r->key.size;
+  *offp = off + BATCH_RHDR_SZ + r->key.size + r->val.size;
+  return true;
+}
+
+static iwrc _wal_replay_record(iwal_op_t op, uint32_t dbid, uint8_t flags,
+                               const IWKV_val *key, const IWKV_val *val, void *opaq) {
+  iwrc rc;
+  IWDB db = 0;
+  IWKV iwkv = opaq;
+  if (op == WOP_BATCH) {
+    BATCHREC r;
+    size_t off = 0;
+    while (_batch_rec(val->data, val->size, &off, &r)) {
+      if (r.op != WOP_PUT && r.op != WOP_DEL) {
+        break;
+      }
+      rc = _wal_replay_record(r.op, r.dbid, r.flags, &r.key, &r.val, opaq);
+      RCRET(rc);
+    }
+    if (off != val->size) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      return rc;
+    }
+    return 0;
+  }
+  khiter_t ki = kh_get(DBS, iwkv->dbs, dbid);
+  if (ki != kh_end(iwkv->dbs)) {
+    db = kh_value(iwkv->dbs, ki);
+  }
+  if (op == WOP_DB_CREATE) {
+    // Flags above the first byte are stored in record value
+    iwdb_flags_t dbflg = flags;
+    if (val && val->size) {
+      dbflg |= (iwdb_flags_t) (*(uint8_t *) val->data) << 8;
+    }
+    if (db && db->dbflg != dbflg) {
+      // Database was recreated with another flags after this record
+      rc = iwkv_db_destroy(&db);
+      RCRET(rc);
+    }
+    return iwkv_db(iwkv, dbid, dbflg, &db);
+  }
+  if (!db) {
+    if (op == WOP_DB_DESTROY) {
+      return 0;
+    }
+    rc = IWKV_ERROR_CORRUPTED;
+    iwlog_ecode_error2(rc, "WAL record refers to unknown database");
+    return rc;
+  }
+  switch (op) {
+    case WOP_PUT:
+      rc = iwkv_put(db, key, val, (iwkv_opflags) flags & ~IWKV_SYNC);
+      if (rc == IWKV_ERROR_KEY_EXISTS || rc == IWKV_ERROR_NOTFOUND) {
+        rc = 0;
+      }
+      break;
+    case WOP_DEL:
+      rc = iwkv_del(db, key);
+      if (rc == IWKV_ERROR_NOTFOUND) {
+        rc = 0;
+      }
+      break;
+    case WOP_DB_DESTROY:
+      rc = iwkv_db_destroy(&db);
+      break;
+    default:
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      break;
+  }
+  return rc;
+}
+
+// Writeback hook of storage file, images of modified regions are logged before they are written in place
+static iwrc _wal_writeback(const IWP_IOREQ *reqs, int num, off_t fsize, void *opaq) {
+  IWKV_FILE *file = opaq;
+  IWKV iwkv = file->iwkv;
+  iwrc rc = iwal_add_pages(iwkv->wal, file - iwkv->files, reqs, num, fsize);
+#ifdef IW_TESTS
+  if (!rc && iwkv_kill_on_writeback > 0 && !--iwkv_kill_on_writeback) {
+    kill(getpid(), SIGKILL);
+  }
+#endif
+  return rc;
+}
+
+/** Storage files restored from WAL before they are opened */
+typedef struct WALRESTORE_CTX {
+  const IWKV_OPTS *opts;
+  IWFS_FILE *files;           /**< Files indexed as `IWKV::files` opened on demand */
+} WALRESTORE_CTX;
+
+static iwrc _wal_restore_page(iwal_op_t op, uint32_t fidx, uint8_t flags,
+                              const IWKV_val *key, const IWKV_val *val, void *opaq) {
+  iwrc rc;
+  uint64_t off;
+  WALRESTORE_CTX *ctx = opaq;
+  if (fidx > ctx->opts->tspaces_num) {
+    rc = IWKV_ERROR_CORRUPTED;
+    iwlog_ecode_error2(rc, "WAL record refers to unknown storage file");
+    return rc;
+  }
+  IWFS_FILE *f = &ctx->files[fidx];
+  if (!f->impl) {
+    IWFS_FILE_OPTS fopts = {
+      .path = fidx ? ctx->opts->tspaces[fidx - 1] : ctx->opts->path,
+      .omode = IWFS_OREAD | IWFS_OWRITE | IWFS_OCREATE,
+      .lock_mode = IWP_WLOCK
+    };
+    rc = iwfs_file_open(f, &fopts);
+    RCRET(rc);
+  }
+  memcpy(&off, key->data, sizeof(off));
+  off = IW_ITOHLL(off);
+  if (op == WOP_PAGE) {
+    IWP_IOREQ req = {
+      .off = off,
+      .buf = val->data,
+      .len = val->size
+    };
+    return f->writev(f, &req, 1);
+  }
+  // Restored file gets size it had after checkpoint
+  IWFS_FILE_STATE fstate;
+  rc = f->state(f, &fstate);
+  RCRET(rc);
+  rc = iwp_ftruncate(fstate.fh, off);
+  RCRET(rc);
+  return f->sync(f, IWFS_FDATASYNC);
+}
+
+static iwrc _wal_open(IWKV iwkv, const IWKV_OPTS *opts) {
+  size_t len = strlen(opts->path);
+  WALRESTORE_CTX ctx = {
+    .opts = opts
+  };
+  char *path = malloc(len + sizeof("-wal"));
+  if (!path) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  memcpy(path, opts->path, len);
+  memcpy(path + len, "-wal", sizeof("-wal"));
+  ctx.files = calloc(1 + opts->tspaces_num, sizeof(ctx.files[0]));
+  if (!ctx.files) {
+    free(path);
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  iwrc rc = iwal_open(path, &opts->wal, (iwkv->oflags & IWKV_TRUNC), _wal_restore_page, &ctx, &iwkv->wal);
+  for (int i = 0; i <= opts->tspaces_num; ++i) {
+    if (ctx.files[i].impl) {
+      IWRC(ctx.files[i].close(&ctx.files[i]), rc);
+    }
+  }
+  free(ctx.files);
+  free(path);
+  return rc;
+}
+
+// Flush changes made by operation logged at WAL position `lsn`.
+// With WAL storage file is never changed between checkpoints and
+// the operation synced in WAL is replayed on top of it after crash.
+IW_INLINE iwrc _iwkv_sync_op(IWKV iwkv, uint64_t lsn) {
+  if (iwkv->wal) {
+    return iwal_commit(iwkv->wal, lsn);
+  }
+  return iwkv_sync(iwkv, IWFS_NO_MMASYNC);
+}
+
+//--------------------------  SHARED STORAGE
+
+// Number of immediate retries of reader process before it sleeps waiting for writer process
+#define SHM_SPINS 64
+
+IW_INLINE void _shm_backoff(int attempt) {
+  if (attempt >= SHM_SPINS) {
+    iwp_sleep(1);
+  }
+}
+
+static iwrc _shm_open(IWKV iwkv, const char *dbpath) {
+  size_t len = strlen(dbpath);
+  char *path = malloc(len + sizeof("-shm"));
+  if (!path) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  memcpy(path, dbpath, len);
+  memcpy(path + len, "-shm", sizeof("-shm"));
+  bool writer = !(iwkv->oflags & IWKV_RDONLY);
+  IWFS_EXT_OPTS opts = {
+    .file = {
+      .path       = path,
+      .omode      = IWFS_OREAD | IWFS_OWRITE | IWFS_OCREATE,
+      // Only one writer process is allowed
+      .lock_mode  = writer ? IWP_WLOCK : IWP_NOLOCK
+    },
+    .initial_size = sizeof(KVSHM)
+  };
+  uint8_t *mm;
+  iwrc rc = iwfs_exfile_open(&iwkv->shm_file, &opts);
+  free(path);
+  RCRET(rc);
+  rc = iwkv->shm_file.add_mmap(&iwkv->shm_file, 0, sizeof(KVSHM));
+  RCGO(rc, finish);
+  rc = iwkv->shm_file.probe_mmap(&iwkv->shm_file, 0, &mm, 0);
+  RCGO(rc, finish);
+  iwkv->shm = (KVSHM*) mm;
+  if (writer) {
+    // Counters may be left in the middle of modification by crashed writer
+    uint64_t seq = atomic_load(&iwkv->shm->wseq);
+    atomic_store(&iwkv->shm->wseq, (seq | WSEQ_WRITERS_MASK) + 1);
+    uint64_t gen = atomic_load(&iwkv->shm->gen);
+    atomic_store(&iwkv->shm->gen, (gen | 1) + 1);
+  }
+finish:
+  if (rc) {
+    iwkv->shm_file.close(&iwkv->shm_file);
+  }
+  return rc;
+}
+
+static iwrc _shm_close(IWKV iwkv) {
+  iwrc rc = 0;
+  if (iwkv->shm) {
+    iwkv->shm = 0;
+    rc = iwkv->shm_file.close(&iwkv->shm_file);
+  }
+  while (iwkv->shm_stale) {
+    IWDB db = iwkv->shm_stale;
+    iwkv->shm_stale = db->next;
+    _db_release_lw(&db);
+  }
+  return rc;
+}
+
+/**
+ * @brief Reload databases chain of `file` modified by writer process.
+ * @details Chain is read from mmaped area with bounds checks, handles of databases
+ *          kept in chain are preserved, handles of removed databases are closed.
+ *          Chain is consistent only if `KVSHM::gen` is not changed during reload.
+ * @param [out] ook Set to `false` if inconsistent chain found
+ */
+static iwrc _shm_chain_reload_lw(IWKV iwkv, IWKV_FILE *file, bool *ook) {
+  int rci;
   uint8_t *mm;
   uint32_t lv;
-  sblk_flags_t flags = lx->sblk_flags | flgs;
-  IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-  sblk->kvblk = 0;
-  sblk->db = lx->db;
-  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCRET(rc);
-  if (IW_UNLIKELY(addr == lx->db->addr)) {
-    uint8_t *rp = mm + addr + DOFF_N0_U4;
-    // [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[24]:u4,c[24]:u4]:209
-    sblk->addr = addr;
-    sblk->flags = SBLK_DB | flags;
-    sblk->lvl = 0;
-    sblk->p0 = 0;
-    sblk->kvblkn = 0;
-    sblk->lkl = 0;
-    sblk->pnum = KVBLK_IDXNUM;
-    memset(sblk->pi, 0, sizeof(sblk->pi));
-    for (int i = 0; i < SLEVELS; ++i) {
-      IW_READLV(rp, lv, sblk->n[i]);
-      if (sblk->n[i]) {
-        ++sblk->lvl;
+  uint64_t llv;
+  size_t msize, num = 0, anum = 0;
+  IWDB *dbs = 0;
+  IWFS_FSM *fsm = &file->fsm;
+  khash_t(DBS) *chain = kh_init(DBS);
+  *ook = false;
+  if (!chain) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  iwrc rc = fsm->readhdr(fsm, sizeof(uint32_t) /*skip magic*/, &llv, sizeof(llv));
+  RCGO(rc, finish);
+  off_t addr = IW_ITOHLL(llv);
+  rc = fsm->acquire_mmap(fsm, 0, &mm, &msize);
+  RCGO(rc, finish);
+  while (addr) {
+    IWDB db = 0;
+    if (addr + DB_SZ > msize || num >= msize / DB_SZ) {
+      break;
+    }
+    memcpy(&lv, mm + addr + DOFF_MAGIC_U4, 4);
+    if (IW_ITOHL(lv) != IWDB_MAGIC) {
+      break;
+    }
+    memcpy(&lv, mm + addr + DOFF_DBID_U4, 4);
+    dbid_t dbid = IW_ITOHL(lv);
+    khiter_t k = kh_get(DBS, iwkv->dbs, dbid);
+    if (k != kh_end(iwkv->dbs)
+        && kh_value(iwkv->dbs, k)->addr == addr
+        && (kh_value(iwkv->dbs, k)->dbflg & 0xff) == mm[addr + DOFF_DBFLG_U1]) {
+      db = kh_value(iwkv->dbs, k);
+    } else if (_db_at(iwkv, file, &db, addr, mm)) {
+      break;
+    }
+    if (num == anum) {
+      anum = anum ? 2 * anum : 16;
+      IWDB *ndbs = realloc(dbs, anum * sizeof(*dbs));
+      if (!ndbs) {
+        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
       } else {
-        break;
+        dbs = ndbs;
       }
     }
-    if (sblk->lvl) --sblk->lvl;
-  } else if (addr) {
-    uint8_t *rp = mm + addr;
-    sblk->addr = addr;
-    // [u1:flags,lvl:u1,lkl:u1,pnum:u1,p0:u4,kblk:u4,[pi0:u1,... pi32],n0-n23:u4,lk:u116]:u256
-    memcpy(&sblk->flags, rp++, 1);
-    if (sblk->flags & ~SBLK_PERSISTENT_FLAGS) {
-      rc = IWKV_ERROR_CORRUPTED;
-      iwlog_ecode_error3(rc);
-      goto finish;
+    if (!rc) {
+      k = kh_put(DBS, chain, dbid, &rci);
+      if (rci == -1) {
+        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      } else if (rci) {
+        kh_value(chain, k) = db;
+        dbs[num++] = db;
+        memcpy(&lv, mm + addr + DOFF_NEXTDB_U4, 4);
+        addr = BLK2ADDR(IW_ITOHL(lv));
+        continue;
+      }
     }
-    sblk->flags |= flags;
-    memcpy(&sblk->lvl, rp++, 1);
-    if (sblk->lvl >= SLEVELS) {
-      rc = IWKV_ERROR_CORRUPTED;
-      iwlog_ecode_error3(rc);
-      goto finish;
+    // Error or duplicated database in chain
+    k = kh_get(DBS, iwkv->dbs, dbid);
+    if (k == kh_end(iwkv->dbs) || kh_value(iwkv->dbs, k) != db) {
+      _db_release_lw(&db);
     }
-    memcpy(&sblk->lkl, rp++, 1);
-    if (sblk->lkl > SBLK_LKLEN) {
-      rc = IWKV_ERROR_CORRUPTED;
-      iwlog_ecode_error3(rc);
-      goto finish;
+    break;
+  }
+  fsm->release_mmap(fsm);
+  if (rc || addr) {
+    // Release databases loaded by this call
+    for (size_t i = 0; i < num; ++i) {
+      khiter_t k = kh_get(DBS, iwkv->dbs, dbs[i]->id);
+      if (k == kh_end(iwkv->dbs) || kh_value(iwkv->dbs, k) != dbs[i]) {
+        _db_release_lw(&dbs[i]);
+      }
     }
-    memcpy(&sblk->pnum, rp++, 1);
-    if (sblk->pnum < 0) {
-      rc = IWKV_ERROR_CORRUPTED;
-      iwlog_ecode_error3(rc);
-      goto finish;
+    goto finish;
+  }
+  for (IWDB db = file->first_db, ndb; db; db = ndb) {
+    ndb = db->next;
+    khiter_t k = kh_get(DBS, chain, db->id);
+    if (k == kh_end(chain) || kh_value(chain, k) != db) {
+      // Database is destroyed by writer, its handle is kept until storage is closed
+      k = kh_get(DBS, iwkv->dbs, db->id);
+      if (k != kh_end(iwkv->dbs) && kh_value(iwkv->dbs, k) == db) {
+        kh_del(DBS, iwkv->dbs, k);
+      }
+      db->open = false;
+      db->prev = 0;
+      db->next = iwkv->shm_stale;
+      iwkv->shm_stale = db;
     }
-    memcpy(&sblk->p0, rp, 4);
-    sblk->p0 = IW_ITOHL(sblk->p0);
-    rp += 4;
-    memcpy(&sblk->kvblkn, rp, 4);
-    sblk->kvblkn = IW_ITOHL(sblk->kvblkn);
-    rp += 4;
-    memcpy(sblk->pi, rp, KVBLK_IDXNUM);
-    rp += KVBLK_IDXNUM;
-    for (int i = 0; i <= sblk->lvl; ++i) {
-      memcpy(&sblk->n[i], rp, 4);
-      sblk->n[i] = IW_ITOHL(sblk->n[i]);
-      rp += 4;
+  }
+  file->first_db = num ? dbs[0] : 0;
+  file->last_db = num ? dbs[num - 1] : 0;
+  for (size_t i = 0; i < num; ++i) {
+    IWDB db = dbs[i];
+    db->prev = i ? dbs[i - 1] : 0;
+    db->next = (i + 1 < num) ? dbs[i + 1] : 0;
+    khiter_t k = kh_put(DBS, iwkv->dbs, db->id, &rci);
+    if (rci == -1) {
+      rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      break;
     }
-    rp = mm + addr + SOFF_LK;
-    memcpy(sblk->lk, rp, sblk->lkl);
-  } else { // Database tail
-    uint8_t *rp = mm + lx->db->addr + DOFF_P0_U4;
-    sblk->addr = 0;
-    sblk->flags = SBLK_DB | flags;
-    sblk->lvl = 0;
-    sblk->kvblkn = 0;
-    sblk->lkl = 0;
-    sblk->pnum = KVBLK_IDXNUM;
-    memset(sblk->pi, 0, sizeof(sblk->pi));
-    IW_READLV(rp, lv, sblk->p0);
-    if (!sblk->p0) {
-      sblk->p0 = ADDR2BLK(lx->db->addr);
+    kh_value(iwkv->dbs, k) = db;
+  }
+  *ook = !rc;
+
+finish:
+  free(dbs);
+  kh_destroy(DBS, chain);
+  return rc;
+}
+
+/**
+ * @brief Refresh state of storage modified by writer process.
+ * @details Mmaped areas are extended to the current size of files,
+ *          databases chains are reloaded if `KVSHM::gen` is changed or `reload` is set.
+ */
+static iwrc _shm_refresh_lw(IWKV iwkv, bool reload) {
+  iwrc rc = 0;
+  uint64_t pgen = 0;
+  int fails = 0;
+  for (int i = 0; ; ++i) {
+    bool ok = true;
+    uint64_t gen = atomic_load_explicit(&iwkv->shm->gen, memory_order_acquire);
+    if (!(gen & 1)) {
+      for (int j = 0; j < iwkv->files_num && ok; ++j) {
+        IWKV_FILE *file = &iwkv->files[j];
+        rc = file->fsm.refresh(&file->fsm);
+        RCRET(rc);
+        if (reload || gen != iwkv->shm_gen) {
+          rc = _shm_chain_reload_lw(iwkv, file, &ok);
+          RCRET(rc);
+        }
+      }
+      atomic_thread_fence(memory_order_acquire);
+      if (gen == atomic_load_explicit(&iwkv->shm->gen, memory_order_relaxed)) {
+        if (ok) {
+          iwkv->shm_gen = gen;
+          return 0;
+        }
+        // Chain is not changed by writer but still inconsistent
+        fails = (gen == pgen) ? fails + 1 : 1;
+        pgen = gen;
+        if (fails > SHM_SPINS) {
+          rc = IWKV_ERROR_CORRUPTED;
+          iwlog_ecode_error3(rc);
+          return rc;
+        }
+      }
+    }
+    _shm_backoff(i);
+  }
+}
+
+/**
+ * @brief Lookup `key` by reader process of `IWKV_SHARED` storage.
+ * @details Blocks are modified by writer process without locks shared with readers,
+ *          so `_oget_mm()` result is validated by `KVSHM::wseq`. Storage state is refreshed
+ *          if databases chains are changed or `key` is not reachable in mmaped area.
+ */
+static iwrc _shm_get(IWLCTX *lx) {
+  int rci;
+  iwrc rc = 0;
+  uint8_t *mm;
+  size_t msize;
+  IWDB db = lx->db;
+  IWKV iwkv = db->iwkv;
+  KVSHM *shm = iwkv->shm;
+  IWFS_FSM *fsm = &db->file->fsm;
+  uint64_t fseq = 0; // Sequence of storage state where key was not reachable
+  if ((db->dbflg & IWDB_UINT_KEYS_FLAGS) && lx->key->size != _uint_key_size(db->dbflg)) {
+    return IWKV_ERROR_KEY_NUM_VALUE_SIZE;
+  }
+  for (int i = 0; ; ++i) {
+    bool done = false, refresh = false;
+    API_RLOCK(iwkv, rci);
+    uint64_t seq = atomic_load_explicit(&shm->wseq, memory_order_acquire);
+    uint64_t gen = atomic_load_explicit(&shm->gen, memory_order_acquire);
+    if (!db->open) {
+      rc = IW_ERROR_INVALID_STATE;
+    } else if ((seq & WSEQ_WRITERS_MASK) || (gen & 1)) {
+      // Storage is being modified by writer
+    } else if (gen != iwkv->shm_gen) {
+      refresh = true;
+    } else {
+      iwrc vrc = 0;
+      IWKV_val val = { 0 };
+      rc = fsm->acquire_mmap(fsm, 0, &mm, &msize);
+      if (!rc) {
+        bool ok = _oget_mm(db, lx->key, mm, msize, &val, &vrc, lx->pool);
+        fsm->release_mmap(fsm);
+        atomic_thread_fence(memory_order_acquire);
+        if (seq == atomic_load_explicit(&shm->wseq, memory_order_relaxed)) {
+          if (ok) {
+            *lx->val = val;
+            rc = vrc;
+            done = true;
+          } else if (fseq == seq) {
+            rc = IWKV_ERROR_CORRUPTED;
+            iwlog_ecode_error3(rc);
+          } else {
+            // File may be extended by writer
+            fseq = seq;
+            refresh = true;
+          }
+        }
+        if (!done) {
+          _kv_val_release(lx->pool, &val);
+        }
+      }
+    }
+    API_UNLOCK(iwkv, rci, rc);
+    if (done || rc) {
+      return rc;
+    }
+    if (refresh) {
+      API_WLOCK(iwkv, rci);
+      rc = _shm_refresh_lw(iwkv, false);
+      API_UNLOCK(iwkv, rci, rc);
+      RCRET(rc);
+    } else {
+      _shm_backoff(i);
     }
   }
-finish:
-  fsm->release_mmap(fsm);
-  return rc;
-}
-
-IW_INLINE WUR iwrc _sblk_at(IWLCTX *lx, off_t addr, sblk_flags_t flgs, SBLK **sblkp) {
-  *sblkp = 0;
-  SBLK *sblk = &lx->saa[lx->saan];
-  iwrc rc = _sblk_at2(lx, addr, flgs, sblk);
-  AAPOS_INC(lx->saan);
-  *sblkp = sblk;
-  return rc;
-}
+}
+
+//--------------------------  PUBLIC API
+
+static const char *_kv_ecodefn(locale_t locale, uint32_t ecode) {
+  if (!(ecode > _IWKV_ERROR_START && ecode < _IWKV_ERROR_END)) {
+    return 0;
+  }
+  switch (ecode) {
+  case IWKV_ERROR_NOTFOUND:
+    return "Key not found. (IWKV_ERROR_NOTFOUND)";
+  case IWKV_ERROR_KEY_EXISTS:
+    return "Key exists. (IWKV_ERROR_KEY_EXISTS)";
+  case IWKV_ERROR_MAXKVSZ:
+    return "Size of Key+value must be not greater than 0xfffffff bytes (IWKV_ERROR_MAXKVSZ)";
+  case IWKV_ERROR_CORRUPTED:
+    return "Database file invalid or corrupted (IWKV_ERROR_CORRUPTED)";
+  case IWKV_ERROR_DUP_VALUE_SIZE:
+    return "Value size is not compatible for insertion into sorted values array (IWKV_ERROR_DUP_VALUE_SIZE)";
+  case IWKV_ERROR_KEY_NUM_VALUE_SIZE:
+    return "Given key is not compatible to store as number (IWKV_ERROR_KEY_NUM_VALUE_SIZE)";
+  case IWKV_ERROR_INCOMPATIBLE_DB_MODE:
+    return "Incompatible database open mode (IWKV_ERROR_INCOMPATIBLE_DB_MODE)";
+  case IWKV_ERROR_KEY_ORDER:
+    return "Bulk loaded keys are not in database order (IWKV_ERROR_KEY_ORDER)";
+  }
+  return 0;
+}
+
+iwrc iwkv_init(void) {
+  static int _kv_initialized = 0;
+  if (!__sync_bool_compare_and_swap(&_kv_initialized, 0, 1)) {
+    return 0;
+  }
+  return iwlog_register_ecodefn(_kv_ecodefn);
+}
+
+iwrc iwkv_open(const IWKV_OPTS *opts, IWKV *iwkvp) {
+  assert(iwkvp && opts);
+  int rci;
+  iwrc rc = 0;
+  uint32_t lv;
+  uint64_t llv;
+  uint8_t *rp, *mm;
+  rc = iw_init();
+  RCRET(rc);
+  if (opts->random_seed) {
+    iwu_rand_seed(opts->random_seed);
+    _lvl_seed_set((uint32_t) opts->random_seed);
+  } else {
+    _lvl_seed_set(((uint64_t) iwu_rand_u32() << 32) | iwu_rand_u32());
+  }
+  *iwkvp = calloc(1, sizeof(struct IWKV));
+  if (!*iwkvp) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  IWKV iwkv = *iwkvp;
+  rci = pthread_rwlock_init(&iwkv->rwl, 0);
+  if (rci) {
+    free(*iwkvp);
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  rci = pthread_mutex_init(&iwkv->wk_mtx, 0);
+  if (rci) {
+    pthread_rwlock_destroy(&iwkv->rwl);
+    free(*iwkvp);
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  rci = pthread_cond_init(&iwkv->wk_cond, 0);
+  if (rci) {
+    pthread_rwlock_destroy(&iwkv->rwl);
+    pthread_mutex_destroy(&iwkv->wk_mtx);
+    free(*iwkvp);
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  iwkv_openflags oflags = opts->oflags;
+  iwfs_omode omode = IWFS_OREAD;
+  if (oflags & IWKV_TRUNC) {
+    oflags &= ~IWKV_RDONLY;
+    omode |= IWFS_OTRUNC;
+  }
+  if (!(oflags & IWKV_RDONLY)) {
+    omode |= IWFS_OWRITE;
+  }
+  iwkv->oflags = oflags;
+  iwkv->dbcache_opts = opts->dbcache;
+  iwkv->cache_budget = opts->cache_budget;
+  iwkv->trace = opts->trace;
+  iwkv->key_cmps = opts->key_cmps;
+  iwkv->key_cmps_num = opts->key_cmps_num;
+  iwkv->dispose_opts = opts->dispose;
+  // Reader process of shared storage loads databases from shared state
+  bool shm_reader = (oflags & IWKV_SHARED) && (oflags & IWKV_RDONLY);
+  bool wal = opts->wal.enabled && !(oflags & IWKV_RDONLY);
+  if (wal && (oflags & IWKV_SHARED)) {
+    // Readers of shared storage map file changed in place
+    rc = IW_ERROR_INVALID_ARGS;
+    iwlog_ecode_error2(rc, "WAL cannot be used by writer of shared storage");
+    goto finish;
+  }
+  if (opts->rcache_size && !shm_reader) {
+    rc = _rcache_create(iwkv, opts->rcache_size);
+    RCGO(rc, finish);
+  }
+  if (opts->tspaces_num && !opts->tspaces) {
+    rc = IW_ERROR_INVALID_ARGS;
+    goto finish;
+  }
+  iwkv->files = calloc(1 + opts->tspaces_num, sizeof(iwkv->files[0]));
+  if (!iwkv->files) {
+    rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    goto finish;
+  }
+  iwkv->dbs = kh_init(DBS);
+  IWFS_FSM_STATE fsmstate;
+  IWFS_FSM_OPTS fsmopts = {
+    .exfile = {
+      .file = {
+        .omode      = omode,
+        // Exclusive writer of shared storage is guarded by lock of `<path>-shm` file
+        .lock_mode  = (oflags & (IWKV_RDONLY | IWKV_SHARED)) ? IWP_RLOCK : IWP_WLOCK
+      },
+      .rspolicy     = iw_exfile_szpolicy_fibo,
+      .maxoff       = IWKV_MAX_DBSZ,
+      .mmap_opts    = ((oflags & IWKV_MMAP_RANDOM) ? IWFS_MMAP_RANDOM : 0)
+                      | ((oflags & IWKV_MMAP_HUGEPAGE) ? IWFS_MMAP_HUGEPAGE : 0)
+                      | ((oflags & IWKV_MMAP_POPULATE) ? IWFS_MMAP_POPULATE : 0)
+                      | ((oflags & IWKV_MMAP_NUMA) ? IWFS_MMAP_NUMA : 0),
+      .numa_node    = opts->numa_node,
+      .dirty_bpow   = IWKV_DIRTY_BPOW,
+      .dirty_threshold = opts->dirty_threshold,
+      .trace        = opts->trace
+    },
+    .bpow = IWKV_FSM_BPOW,      // 64 bytes block size
+    .hdrlen = KVHDRSZ,          // Size of custom file header
+    .oflags = ((oflags & (IWKV_NOLOCKS | IWKV_RDONLY)) ? IWFSM_NOLOCKS
+               : (oflags & IWKV_FSM_MAGAZINES) ? IWFSM_MAGAZINES : 0),
+    .mmap_all = true
+  };
+#if defined(IW_TESTS) && !defined(IW_RELEASE)
+  fsmopts.oflags |= IWFSM_STRICT;
+#endif
+  if (oflags & IWKV_SHARED) {
+    // Pages beyond end of file may be accessed by other processes
+    fsmopts.oflags |= IWFSM_NO_TRIM;
+  }
+  if (wal) {
+    // Storage file is changed by checkpoint only, file torn by crash is restored from WAL
+    rc = _wal_open(iwkv, opts);
+    RCGO(rc, finish);
+    fsmopts.exfile.mmap_opts |= IWFS_MMAP_PRIVATE;
+    fsmopts.exfile.wbhook = _wal_writeback;
+  }
 
-static WUR iwrc _sblk_sync_mm(IWLCTX *lx, SBLK *sblk, uint8_t *mm) {
-  iwrc rc = 0;
-  if (sblk->flags & SBLK_DURTY) {
-    sblk->flags &= ~SBLK_DURTY;
-    uint32_t lv;
-    if (IW_UNLIKELY(sblk->flags & SBLK_DB)) {
-      uint8_t *wp = mm + sblk->db->addr;
-      if (sblk->addr) {
-        assert(sblk->addr == sblk->db->addr);
-        wp += DOFF_N0_U4;
-        // [magic:u4,dbflg:u1,dbid:u4,next_db_blk:u4,p0:u4,n[24]:u4,c[24]:u4]:209
-        for (int i = 0; i < SLEVELS; ++i) {
-          IW_WRITELV(wp, lv, sblk->n[i]);
-        }
-        assert(wp - (mm + sblk->db->addr) <= SBLK_SZ);
-        for (int i = 0; i < SLEVELS; ++i) {
-          IW_WRITELV(wp, lv, lx->db->lcnt[i]);
-        }
-      } else { // Database tail
-        wp += DOFF_P0_U4;
-        IW_WRITELV(wp, lv, sblk->p0);
-        assert(wp - (mm + sblk->db->addr) <= SBLK_SZ);
-      }
-      return 0;
+  for (int i = 0; i <= opts->tspaces_num; ++i) {
+    IWKV_FILE *file = &iwkv->files[i];
+    IWFS_FSM *fsm = &file->fsm;
+    file->iwkv = iwkv;
+    fsmopts.exfile.file.path = i ? opts->tspaces[i - 1] : opts->path;
+    fsmopts.exfile.wbhook_opaq = file;
+    rc = iwfs_fsmfile_open(fsm, &fsmopts);
+    RCBREAK(rc);
+    iwkv->files_num = i + 1;
+    rc = fsm->state(fsm, &fsmstate);
+    RCBREAK(rc);
+    if (fsmstate.exfile.file.ostatus & IWFS_OPEN_NEW) {
+      // Write magic number
+      lv = IWKV_MAGIC;
+      lv = IW_HTOIL(lv);
+      rc = fsm->writehdr(fsm, 0, &lv, sizeof(lv));
+      RCBREAK(rc);
+      fsm->sync(fsm, wal ? (IWFS_FDATASYNC | IWFS_WRITEBACK) : 0);
     } else {
-      uint8_t *wp = mm + sblk->addr;
-      sblk_flags_t flags = (sblk->flags & SBLK_PERSISTENT_FLAGS);
-      assert(sblk->lkl <= SBLK_LKLEN);
-      // [u1:flags,lvl:u1,lkl:u1,pnum:u1,p0:u4,kblk:u4,[pi0:u1,... pi32],n0-n23:u4,lk:u116]:u256
-      wp += SOFF_FLAGS_U1;
-      memcpy(wp++, &flags, 1);
-      memcpy(wp++, &sblk->lvl, 1);
-      memcpy(wp++, &sblk->lkl, 1);
-      memcpy(wp++, &sblk->pnum, 1);
-      IW_WRITELV(wp, lv, sblk->p0);
-      IW_WRITELV(wp, lv, sblk->kvblkn);
-      memcpy(wp, sblk->pi, KVBLK_IDXNUM);
-      wp = mm + sblk->addr + SOFF_N0_U4;
-      for (int i = 0; i <= sblk->lvl; ++i) {
-        IW_WRITELV(wp, lv, sblk->n[i]);
+      uint8_t hdr[KVHDRSZ];
+      rc = fsm->readhdr(fsm, 0, hdr, KVHDRSZ);
+      RCBREAK(rc);
+      rp = hdr;
+      memcpy(&lv, rp, sizeof(lv));
+      rp += sizeof(lv);
+      lv = IW_ITOHL(lv);
+      if (lv != IWKV_MAGIC) {
+        rc = IWKV_ERROR_CORRUPTED;
+        iwlog_ecode_error3(rc);
+        break;
       }
-      wp = mm + sblk->addr + SOFF_LK;
-      memcpy(wp, sblk->lk, sblk->lkl);
+      if (shm_reader) {
+        continue;
+      }
+      memcpy(&llv, rp, sizeof(llv));
+      llv = IW_ITOHLL(llv);
+      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+      RCBREAK(rc);
+      rc = _db_load_chain(iwkv, file, llv, mm);
+      fsm->release_mmap(fsm);
+      RCBREAK(rc);
     }
   }
-  if (sblk->kvblk && (sblk->kvblk->flags & KVBLK_DURTY)) {
-    _kvblk_sync_mm(sblk->kvblk, mm);
+  RCGO(rc, finish);
+  for (int i = 0; i < iwkv->files_num && !shm_reader; ++i) {
+    IWKV_FILE *file = &iwkv->files[i];
+    rc = file->fsm.stable_mmap(&file->fsm, 0, &file->smm, &file->smsize);
+    if (rc == IWFS_ERROR_NOT_MMAPED) {
+      rc = 0;
+    }
+    RCGO(rc, finish);
   }
-  if (sblk->flags & SBLK_CACHE_UPDATE) {
-    _dbcache_update_lw(lx, sblk);
+  if (oflags & IWKV_SHARED) {
+    rc = _shm_open(iwkv, opts->path);
+    RCGO(rc, finish);
+    if (shm_reader) {
+      rc = _shm_refresh_lw(iwkv, true);
+      RCGO(rc, finish);
+    }
   }
-  return rc;
-}
-
-IW_INLINE WUR iwrc _sblk_sync_and_release_mm(IWLCTX *lx, SBLK **sblkp, uint8_t *mm) {
-  iwrc rc = 0;
-  if (mm) {
-    rc = _sblk_sync_mm(lx, *sblkp, mm);
+  (*iwkvp)->open = true;
+  if (wal) {
+    rc = iwal_start(iwkv->wal, _wal_replay_record, _wal_checkpoint, iwkv);
+  }
+finish:
+  if (rc) {
+    (*iwkvp)->open = true; // will be closed in iwkv_close
+    IWRC(iwkv_close(iwkvp), rc);
   }
-  _sblk_release(lx, sblkp);
   return rc;
 }
 
-IW_INLINE WUR iwrc _sblk_sync_and_release(IWLCTX *lx, SBLK **sblkp) {
-  assert(sblkp && *sblkp);
-  SBLK *sblk = *sblkp;
-  if ((sblk->flags & SBLK_DURTY) || (sblk->kvblk && (sblk->kvblk->flags & KVBLK_DURTY))) {
-    uint8_t *mm;
-    IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-    iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-    RCRET(rc);
-    rc = _sblk_sync_mm(lx, *sblkp, mm);
-    _sblk_release(lx, sblkp);
-    fsm->release_mmap(fsm);
-    return rc;
-  } else {
-    _sblk_release(lx, sblkp);
-    return 0;
+iwrc iwkv_close(IWKV *iwkvp) {
+  ENSURE_OPEN((*iwkvp));
+  int rci;
+  IWKV iwkv = *iwkvp;
+  iwkv->open = false;
+  if (iwkv->wal) {
+    iwal_shutdown(iwkv->wal);
   }
-}
-
-static WUR iwrc _sblk_find_pi_mm(SBLK *sblk, const IWKV_val *key, const uint8_t *mm, bool *found, uint8_t *idxp) {
-  *found = false;
-  if (sblk->flags & SBLK_DB) {
-    *idxp = KVBLK_IDXNUM;
-    return 0;
+  iwrc rc = _wnw(iwkv, _wnw_iwkw_wl);
+  RCRET(rc);
+  _oreaders_stop(iwkv);
+  for (int i = 0; i < iwkv->files_num; ++i) {
+    IWKV_FILE *file = &iwkv->files[i];
+    IWDB db = file->first_db;
+    while (db) {
+      IWDB ndb = db->next;
+      IWRC(_bloom_save(db), rc);
+      _db_release_lw(&db);
+      db = ndb;
+    }
+    IWRC(file->fsm.close(&file->fsm), rc);
   }
-  const uint8_t *k;
-  uint32_t kl;
-  iwdb_flags_t dbflg = sblk->db->dbflg;
-  int idx = 0,
-      lb = 0,
-      ub = sblk->pnum - 1;
-  if (sblk->pnum < 1) {
-    *idxp = 0;
-    return 0;
+  free(iwkv->files);
+  iwkv->files = 0;
+  IWRC(_shm_close(iwkv), rc);
+  if (iwkv->wal) {
+    // Log is not needed if database file is closed cleanly
+    IWRC(iwal_close(&iwkv->wal, !rc), rc);
   }
-  while (1) {
-    idx = (ub + lb) / 2;
-    iwrc rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[idx], mm, &k, &kl);
-    RCRET(rc);
-    int cr = _cmp_key(dbflg, k, kl, key->data, key->size);
-    if (!cr) {
-      *found = true;
-      break;
-    } else if (cr < 0) {
-      lb = idx + 1;
-      if (lb > ub) {
-        idx = lb;
-        break;
-      }
-    } else {
-      ub = idx - 1;
-      if (lb > ub) {
-        break;
-      }
-    }
+  if (iwkv->dbs) {
+    kh_destroy(DBS, iwkv->dbs);
+    iwkv->dbs = 0;
   }
-  *idxp = idx;
-  return 0;
+  _rcache_destroy(iwkv);
+  API_UNLOCK(iwkv, rci, rc);
+  pthread_rwlock_destroy(&iwkv->rwl);
+  pthread_mutex_destroy(&iwkv->wk_mtx);
+  pthread_cond_destroy(&iwkv->wk_cond);
+  free(iwkv);
+  *iwkvp = 0;
+  return rc;
 }
 
-static WUR iwrc _sblk_insert_pi_mm(SBLK *sblk, uint8_t nidx, const IWKV_val *key,
-                                   const uint8_t *mm, uint8_t *idxp) {
-  assert(sblk->kvblk);
-  const uint8_t *k;
-  uint32_t kl;
-  iwdb_flags_t dbflg = sblk->db->dbflg;
-  int idx = 0,
-      lb = 0,
-      ub = sblk->pnum - 1,
-      nels = sblk->pnum;
-  if (nels < 1) {
-    sblk->pi[0] = nidx;
-    ++sblk->pnum;
-    *idxp = 0;
-    return 0;
+iwrc iwkv_sync(IWKV iwkv, iwfs_sync_flags _flags) {
+  ENSURE_OPEN(iwkv);
+  if (iwkv->oflags & IWKV_RDONLY) {
+    return IW_ERROR_READONLY;
   }
-  while (1) {
-    idx = (ub + lb) / 2;
-    iwrc rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[idx], mm, &k, &kl);
-    RCRET(rc);
-    int cr = _cmp_key(dbflg, k, kl, key->data, key->size);
-    if (!cr) {
-      break;
-    } else if (cr < 0) {
-      lb = idx + 1;
-      if (lb > ub) {
-        idx = lb;
-        ++sblk->pnum;
-        break;
-      }
-    } else {
-      ub = idx - 1;
-      if (lb > ub) {
-        ++sblk->pnum;
-        break;
-      }
-    }
+  if (iwkv->wal) {
+    return iwal_checkpoint(iwkv->wal);
   }
-  if (nels - idx > 0) {
-    memmove(sblk->pi + idx + 1, sblk->pi + idx, nels - idx);
+  iwrc rc = 0;
+  pthread_rwlock_rdlock(&iwkv->rwl);
+  iwfs_sync_flags flags = IWFS_FDATASYNC | _flags;
+  for (int i = 0; i < iwkv->files_num; ++i) {
+    IWFS_FSM *fsm = &iwkv->files[i].fsm;
+    IWRC(fsm->sync(fsm, flags), rc);
   }
-  sblk->pi[idx] = nidx;
-  *idxp = idx;
-  return 0;
+  pthread_rwlock_unlock(&iwkv->rwl);
+  return rc;
 }
 
-IW_INLINE WUR iwrc _sblk_addkv2(SBLK *sblk, int8_t idx, const IWKV_val *key, const IWKV_val *val,
-                                iwkv_opflags opflags, bool internal) {
-  assert(sblk && key && key->size && key->data &&
-         val && idx >= 0 && sblk->kvblk);
-  int8_t kvidx;
-  KVBLK *kvblk = sblk->kvblk;
-  if (sblk->pnum >= KVBLK_IDXNUM) {
-    return _IWKV_ERROR_KVBLOCK_FULL;
-  }
-  if (!internal && (opflags & IWKV_DUP_REMOVE)) {
-    return IWKV_ERROR_NOTFOUND;
+iwrc iwkv_online_backup(IWKV iwkv, const char *target) {
+  if (!target) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  iwrc rc = _kvblk_addkv(kvblk, key, val, &kvidx, opflags, internal);
+  ENSURE_OPEN(iwkv);
+  int rci;
+  iwrc rc = _wnw(iwkv, _wnw_iwkw_wl);
   RCRET(rc);
-  if (sblk->pnum - idx > 0) {
-    memmove(sblk->pi + idx + 1, sblk->pi + idx, sblk->pnum - idx);
-  }
-  sblk->pi[idx] = kvidx;
-  if (sblk->kvblkn != ADDR2BLK(kvblk->addr)) {
-    sblk->kvblkn = ADDR2BLK(kvblk->addr);
-    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
-      sblk->flags |= SBLK_CACHE_UPDATE;
-    }
-  }
-  ++sblk->pnum;
-  sblk->flags |= SBLK_DURTY;
-  if (idx == 0) { // the lowest key inserted
-    sblk->lkl = MIN(SBLK_LKLEN, key->size);
-    memcpy(sblk->lk, key->data, sblk->lkl);
-    if (key->size <= SBLK_LKLEN) {
-      sblk->flags |= SBLK_FULL_LKEY;
+  for (int i = 0; i < iwkv->files_num; ++i) {
+    IWFS_FSM *fsm = &iwkv->files[i].fsm;
+    if (!i) {
+      rc = fsm->backup(fsm, target);
     } else {
-      sblk->flags &= ~SBLK_FULL_LKEY;
-    }
-    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
-      sblk->flags |= SBLK_CACHE_UPDATE;
+      // Additional storage files are copied to `<target>.<i>`
+      size_t len = strlen(target);
+      char *path = malloc(len + sizeof(".65535"));
+      if (!path) {
+        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+        break;
+      }
+      snprintf(path, len + sizeof(".65535"), "%s.%d", target, i);
+      rc = fsm->backup(fsm, path);
+      free(path);
     }
+    RCBREAK(rc);
   }
-  return 0;
+  API_UNLOCK(iwkv, rci, rc);
+  return rc;
 }
 
-static WUR iwrc _sblk_addkv(SBLK *sblk, const IWKV_val *key, const IWKV_val *val,
-                            iwkv_opflags opflags, bool internal) {
-  assert(sblk && key && key->size && key->data && val && sblk->kvblk);
-  int8_t kvidx;
-  uint8_t *mm, idx;
-  KVBLK *kvblk = sblk->kvblk;
-  IWFS_FSM *fsm = &sblk->db->iwkv->fsm;
-  if (sblk->pnum >= KVBLK_IDXNUM) {
-    return _IWKV_ERROR_KVBLOCK_FULL;
+iwrc iwkv_db(IWKV iwkv, uint32_t dbid, iwdb_flags_t dbflg, IWDB *dbp) {
+  int rci;
+  iwrc rc = 0;
+  IWDB db = 0;
+  *dbp = 0;
+  if (((dbflg & IWDB_COMPRESSED) && (dbflg & IWDB_DUP_FLAGS))
+      || ((dbflg & IWDB_DUP_PACKED) && !(dbflg & IWDB_DUP_FLAGS))
+      || ((dbflg & IWDB_OVERFLOW_VALS) && (dbflg & (IWDB_COMPRESSED | IWDB_DUP_FLAGS)))
+      || ((dbflg & IWDB_CUSTOM_KEYS) && (dbflg & IWDB_UINT_KEYS_FLAGS))) {
+    return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
   }
-  if (!internal && (opflags & IWKV_DUP_REMOVE)) {
-    return IWKV_ERROR_NOTFOUND;
+  if ((dbflg & IWDB_CUSTOM_KEYS) && !_kcmp_find(iwkv, dbid)) {
+    iwlog_ecode_error2(IWKV_ERROR_INCOMPATIBLE_DB_MODE, "Comparator of database keys is not registered");
+    return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
+  }
+  API_RLOCK(iwkv, rci);
+  khiter_t ki = kh_get(DBS, iwkv->dbs, dbid);
+  if (ki != kh_end(iwkv->dbs)) {
+    db = kh_value(iwkv->dbs, ki);
   }
-  iwrc rc = _kvblk_addkv(kvblk, key, val, &kvidx, opflags, internal);
-  RCRET(rc);
-  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCRET(rc);
-  rc = _sblk_insert_pi_mm(sblk, kvidx, key, mm, &idx);
+  API_UNLOCK(iwkv, rci, rc);
   RCRET(rc);
-  if (idx == 0) { // the lowest key inserted
-    sblk->lkl = MIN(SBLK_LKLEN, key->size);
-    memcpy(sblk->lk, key->data, sblk->lkl);
-    if (key->size <= SBLK_LKLEN) {
-      sblk->flags |= SBLK_FULL_LKEY;
-    } else {
-      sblk->flags &= ~SBLK_FULL_LKEY;
+  if (!db && SHM_READER(iwkv)) {
+    // Database may be created by writer process
+    API_WLOCK(iwkv, rci);
+    rc = _shm_refresh_lw(iwkv, false);
+    ki = kh_get(DBS, iwkv->dbs, dbid);
+    if (!rc && ki != kh_end(iwkv->dbs)) {
+      db = kh_value(iwkv->dbs, ki);
     }
-    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
-      sblk->flags |= SBLK_CACHE_UPDATE;
+    API_UNLOCK(iwkv, rci, rc);
+    RCRET(rc);
+  }
+  if (db) {
+    if (db->dbflg != dbflg) {
+      return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
     }
+    *dbp = db;
+    return 0;
   }
-  fsm->release_mmap(fsm);
-  if (sblk->kvblkn != ADDR2BLK(kvblk->addr)) {
-    sblk->kvblkn = ADDR2BLK(kvblk->addr);
-    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
-      sblk->flags |= SBLK_CACHE_UPDATE;
+  if (iwkv->oflags & IWKV_RDONLY) {
+    return IW_ERROR_READONLY;
+  }
+  API_WLOCK(iwkv, rci);
+  ki = kh_get(DBS, iwkv->dbs, dbid);
+  if (ki != kh_end(iwkv->dbs)) {
+    db = kh_value(iwkv->dbs, ki);
+  }
+  if (db) {
+    if (db->dbflg != dbflg) {
+      return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
+    }
+    *dbp = db;
+  } else {
+    rc = _db_create_lw(iwkv, dbid, dbflg, dbp);
+    if (!rc && iwkv->wal) {
+      uint64_t lsn;
+      uint8_t xflg = dbflg >> 8;
+      IWKV_val xval = { .data = &xflg, .size = xflg ? 1 : 0 };
+      rc = iwal_add(iwkv->wal, WOP_DB_CREATE, dbid, dbflg & 0xff, 0, &xval, &lsn);
     }
   }
-  sblk->flags |= SBLK_DURTY;
-  return 0;
+  API_UNLOCK(iwkv, rci, rc);
+  return rc;
 }
 
-IW_INLINE WUR iwrc _sblk_updatekv(SBLK *sblk, int8_t idx,
-                                  const IWKV_val *key, const IWKV_val *val,
-                                  iwkv_opflags opflags) {
-  assert(sblk && sblk->kvblk && idx >= 0 && idx < sblk->pnum);
-  KVBLK *kvblk = sblk->kvblk;
-  int8_t kvidx = sblk->pi[idx];
-  iwrc rc = _kvblk_updatev(kvblk, &kvidx, key, val, opflags, false);
-  RCRET(rc);
-  if (sblk->kvblkn != ADDR2BLK(kvblk->addr)) {
-    sblk->kvblkn = ADDR2BLK(kvblk->addr);
-    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
-      sblk->flags |= SBLK_CACHE_UPDATE;
-    }
+iwrc iwkv_db_cache_release(IWDB db) {
+  if (!db || !db->iwkv) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  sblk->pi[idx] = kvidx;
-  sblk->flags |= SBLK_DURTY;
-  return 0;
+  int rci;
+  iwrc rc = 0;
+  API_DB_WLOCK(db, rci);
+  _dbcache_destroy_lw(db);
+  API_DB_UNLOCK(db, rci, rc);
+  return rc;
 }
 
-IW_INLINE WUR iwrc _sblk_rmkv(SBLK *sblk, uint8_t idx) {
-  assert(sblk && sblk->kvblk);
-  KVBLK *kvblk = sblk->kvblk;
-  IWFS_FSM *fsm = &sblk->db->iwkv->fsm;
-  assert(kvblk && idx < sblk->pnum && sblk->pi[idx] < KVBLK_IDXNUM);
-  iwrc rc = _kvblk_rmkv(kvblk, sblk->pi[idx], 0);
-  RCRET(rc);
-  if (sblk->kvblkn != ADDR2BLK(kvblk->addr)) {
-    sblk->kvblkn = ADDR2BLK(kvblk->addr);
-    if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
-      sblk->flags |= SBLK_CACHE_UPDATE;
-    }
+iwrc iwkv_db_cache_configure(IWDB db, const IWDB_CACHE_OPTS *opts) {
+  if (!db || !db->iwkv || !opts) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  --sblk->pnum;
-  sblk->flags |= SBLK_DURTY;
-  if (idx < sblk->pnum && sblk->pnum > 0) {
-    memmove(sblk->pi + idx, sblk->pi + idx + 1, sblk->pnum - idx);
+  int rci;
+  iwrc rc = 0;
+  API_DB_WLOCK(db, rci);
+  _db_cache_opts_set(db, opts);
+  _dbcache_destroy_lw(db);
+  API_DB_UNLOCK(db, rci, rc);
+  return rc;
+}
+
+iwrc iwkv_db_numa_bind(IWDB db, uint16_t node) {
+  if (!db || !db->iwkv || node >= iwp_num_numa_nodes()) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  if (idx == 0) { // Lowest key removed
-    uint8_t *mm;
-    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-    RCRET(rc);
-    // Replace key with the next one or reset
-    if (sblk->pnum > 0) {
-      const uint8_t *kbuf;
-      uint32_t klen;
-      rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[idx], mm, &kbuf, &klen);
-      RCRET(rc);
-      sblk->lkl = MIN(SBLK_LKLEN, klen);
-      memcpy(sblk->lk, kbuf, sblk->lkl);
-      if (klen <= SBLK_LKLEN) {
-        sblk->flags |= SBLK_FULL_LKEY;
-      } else {
-        sblk->flags &= ~SBLK_FULL_LKEY;
-      }
-      if (!(sblk->flags & SBLK_CACHE_FLAGS)) {
-        sblk->flags |= SBLK_CACHE_UPDATE;
-      }
-    } else {
-      sblk->lkl = 0;
-      sblk->flags |= SBLK_CACHE_REMOVE;
-    }
-    fsm->release_mmap(fsm);
+  int rci;
+  API_DB_WLOCK(db, rci);
+  iwrc rc = iwp_numa_bind(db, sizeof(*db), node);
+  if (!rc) {
+    db->numa = true;
+    db->numa_node = node;
+    _dbcache_numa_bind_lw(db);
   }
+  API_DB_UNLOCK(db, rci, rc);
   return rc;
 }
 
-//--------------------------  IWLCTX
-
-IW_INLINE WUR iwrc _lx_sblk_cmp_key(IWLCTX *lx, SBLK *sblk, int *res) {
-  iwdb_flags_t dbflg = sblk->db->dbflg;
-  const IWKV_val *key = lx->key;
-  if (IW_UNLIKELY(sblk->pnum < 1 || (sblk->flags & SBLK_DB))) { // empty block
-    *res = 0;
-    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
-    return IWKV_ERROR_CORRUPTED;
-  } else if ((sblk->flags & SBLK_FULL_LKEY) || key->size < sblk->lkl) {
-    *res = _cmp_key(dbflg, sblk->lk, sblk->lkl, key->data, key->size);
-  } else {
-    *res = _cmp_key2(dbflg, sblk->lk, sblk->lkl, key->data, key->size);
-    if (*res == 0) {
-      uint32_t kl;
-      const uint8_t *k;
-      uint8_t *mm;
-      IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-      iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-      if (rc) {
-        *res = 0;
-        return rc;
-      }
-      if (!sblk->kvblk) {
-        rc = _sblk_loadkvblk_mm(lx, sblk, mm);
-        if (rc) {
-          *res = 0;
-          fsm->release_mmap(fsm);
-          return rc;
-        }
-      }
-      rc = _kvblk_peek_key(sblk->kvblk, sblk->pi[0], mm, &k, &kl);
-      RCRET(rc);
-      *res = _cmp_key(dbflg, k, kl, key->data, key->size);
-      fsm->release_mmap(fsm);
-    }
+iwrc iwkv_db_overflow_threshold(IWDB db, uint32_t threshold) {
+  if (!db || !db->iwkv || threshold < IWDB_OVERFLOW_THRESHOLD_MIN) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  if (!(db->dbflg & IWDB_OVERFLOW_VALS)) {
+    return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
   }
+  atomic_store_explicit(&db->ovl_threshold, threshold, memory_order_relaxed);
   return 0;
 }
 
-static WUR iwrc _lx_roll_forward(IWLCTX *lx, uint8_t lvl) {
+iwrc iwkv_db_last_access_time(const IWDB db, uint64_t *ts) {
+  if (!db || !db->iwkv || !ts) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  int rci;
   iwrc rc = 0;
-  int cret;
-  SBLK *sblk;
-  blkn_t blkn;
-  assert(lx->lower);
+  API_DB_RLOCK(db, rci);
+  if (db->cache.open)   {
+    *ts = db->cache.atime;
+  } else {
+    *ts = 0;
+  }
+  API_DB_UNLOCK(db, rci, rc);
+  return rc;
+}
 
-  while ((blkn = lx->lower->n[lvl])) {
-    off_t blkaddr = BLK2ADDR(blkn);
-    if (lx->nlvl > -1 && lvl < lx->nlvl) {
-      int8_t ulvl = lvl + 1;
-      if (lx->pupper[ulvl] && lx->pupper[ulvl]->addr == blkaddr) {
-        sblk = lx->pupper[ulvl];
-      } else if (lx->plower[ulvl] && lx->plower[ulvl]->addr == blkaddr) {
-        sblk = lx->plower[ulvl];
-      } else {
-        rc = _sblk_at(lx, blkaddr, 0, &sblk);
-      }
-    } else {
-      rc = _sblk_at(lx, blkaddr, 0, &sblk);
+static void _db_stats_sum(IWDB db, IWKV_DB_STATS *st) {
+  uint64_t c[DBS_NUM] = { 0 };
+  for (int i = 0; i < DBSTATS_STRIPES; ++i) {
+    DBSTATS *s = &db->stats[i];
+    for (int j = 0; j < DBS_NUM; ++j) {
+      c[j] += atomic_load_explicit(&s->c[j], memory_order_relaxed);
     }
-    RCRET(rc);
-#ifndef NDEBUG
-    ++lx->num_cmps;
-#endif
-    rc = _lx_sblk_cmp_key(lx, sblk, &cret);
-    RCRET(rc);
-    if (cret > 0 || lx->upper_addr == sblk->addr) { // upper > key
-      lx->upper = sblk;
-      break;
-    } else {
-      lx->lower = sblk;
+    uint64_t mh = atomic_load_explicit(&s->max_hops, memory_order_relaxed);
+    if (mh > st->lookup_max_hops) {
+      st->lookup_max_hops = mh;
     }
   }
-  return 0;
+  st->puts += c[DBS_PUTS];
+  st->gets += c[DBS_GETS];
+  st->dels += c[DBS_DELS];
+  st->cursor_steps += c[DBS_CURSOR_STEPS];
+  st->lookups += c[DBS_LOOKUPS];
+  st->lookup_hops += c[DBS_LOOKUP_HOPS];
+  st->cache_hits += c[DBS_CACHE_HITS];
+  st->cache_misses += c[DBS_CACHE_MISSES];
+  st->cache_rebuilds += c[DBS_CACHE_REBUILDS];
+  st->splits += c[DBS_SPLITS];
+  st->compactions += c[DBS_COMPACTIONS];
+  st->lock_waits += c[DBS_LOCK_WAITS];
+  st->lock_wait_ns += c[DBS_LOCK_WAIT_NS];
+  st->rcache_hits += c[DBS_RCACHE_HITS];
+  st->rcache_misses += c[DBS_RCACHE_MISSES];
 }
 
-static WUR iwrc _lx_find_bounds(IWLCTX *lx) {
-  iwrc rc = 0;
-  int lvl;
-  blkn_t blkn;
-  if (!lx->dblk.addr) {
-    SBLK *s;
-    rc = _sblk_at(lx, lx->db->addr, 0, &s);
-    RCRET(rc);
-    memcpy(&lx->dblk, s, sizeof(lx->dblk));
-  }
-  if (!lx->lower) {
-    rc = _dbcache_get(lx);
-    RCRET(rc);
-  }
-  if (lx->nlvl > lx->dblk.lvl) {
-    // New level in DB
-    lx->dblk.lvl = lx->nlvl;
-    lx->dblk.flags |= SBLK_DURTY;
-  }
-  lvl = lx->lower->lvl;
-  while (lvl > -1) {
-    rc = _lx_roll_forward(lx, lvl);
-    RCRET(rc);
-    if (lx->upper) {
-      blkn = ADDR2BLK(lx->upper->addr);
-    } else {
-      blkn = 0;
-    }
-    do {
-      if (lx->nlvl >= lvl) {
-        lx->plower[lvl] = lx->lower;
-        lx->pupper[lvl] = lx->upper;
-      }
-    } while (lvl-- && lx->lower->n[lvl] == blkn);
+iwrc iwkv_db_stats(IWDB db, IWKV_DB_STATS *stats) {
+  if (!stats) {
+    return IW_ERROR_INVALID_ARGS;
   }
+  ENSURE_OPEN_DB(db);
+  memset(stats, 0, sizeof(*stats));
+  _db_stats_sum(db, stats);
   return 0;
 }
 
-static iwrc _lx_release_mm(IWLCTX *lx, uint8_t *mm) {
+iwrc iwkv_state(IWKV iwkv, IWKV_STATE *state) {
+  if (!state) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  int rci;
   iwrc rc = 0;
-  if (lx->nlvl > -1) {
-    SBLK *lsb = 0, *usb = 0;
-    if (lx->nb) {
-      rc = _sblk_sync_mm(lx, lx->nb, mm);
-      RCRET(rc);
-    }
-    if (lx->pupper[0] == lx->upper) {
-      lx->upper = 0;
-    }
-    if (lx->plower[0] == lx->lower) {
-      lx->lower = 0;
-    }
-    for (int i = 0; i <= lx->nlvl; ++i) {
-      if (lx->pupper[i]) {
-        if (lx->pupper[i] != usb) {
-          usb = lx->pupper[i];
-          rc = _sblk_sync_and_release_mm(lx, &lx->pupper[i], mm);
-          RCRET(rc);
-        }
-        lx->pupper[i] = 0;
-      }
-      if (lx->plower[i]) {
-        if (lx->plower[i] != lsb) {
-          lsb = lx->plower[i];
-          rc = _sblk_sync_and_release_mm(lx, &lx->plower[i], mm);
-          RCRET(rc);
-        }
-        lx->plower[i] = 0;
-      }
+  memset(state, 0, sizeof(*state));
+  API_RLOCK(iwkv, rci);
+  for (int i = 0; i < iwkv->files_num; ++i) {
+    for (IWDB db = iwkv->files[i].first_db; db; db = db->next) {
+      _db_stats_sum(db, &state->dbs);
+      ++state->dbnum;
     }
   }
-  if (lx->upper) {
-    rc = _sblk_sync_and_release_mm(lx, &lx->upper, mm);
-    RCRET(rc);
+  state->cache_msize = atomic_load(&iwkv->cache_msize);
+  if (iwkv->rcache) {
+    state->rcache_msize = atomic_load(&iwkv->rcache->msize);
   }
-  if (lx->lower) {
-    rc = _sblk_sync_and_release_mm(lx, &lx->lower, mm);
-    RCRET(rc);
+  rc = iwkv->files[0].fsm.state(&iwkv->files[0].fsm, &state->fsm);
+  API_UNLOCK(iwkv, rci, rc);
+  return rc;
+}
+
+iwrc iwkv_db_destroy(IWDB *dbp) {
+  if (!dbp || !*dbp) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  if (lx->dblk.flags & SBLK_DURTY) {
-    rc = _sblk_sync_mm(lx, &lx->dblk, mm);
-    RCRET(rc);
+  int rci;
+  IWDB db = *dbp;
+  IWKV iwkv = db->iwkv;
+  dbid_t dbid = db->id;
+  if (iwkv->oflags & IWKV_RDONLY) {
+    return IW_ERROR_READONLY;
   }
-  if (lx->nb) {
-    if (lx->nb->flags & SBLK_CACHE_PUT) {
-      rc = _dbcache_put_lw(lx, lx->nb);
-    }
-    _sblk_release(lx, &lx->nb);
-    RCRET(rc);
+  iwrc rc = _wnw(iwkv, _wnw_iwkw_wl);
+  RCGO(rc, finish);
+  rc = _iwkv_worker_inc_nolk(iwkv);
+  if (!rc) {
+    _oreaders_stop(iwkv);
+    rc = _db_destroy_lw(dbp);
+    _oreaders_resume(iwkv);
   }
-  if (lx->cache_reload) {
-    rc = _dbcache_fill_lw(lx);
+  if (!rc && iwkv->wal) {
+    uint64_t lsn;
+    rc = iwal_add(iwkv->wal, WOP_DB_DESTROY, dbid, 0, 0, 0, &lsn);
   }
+  API_UNLOCK(iwkv, rci, rc);
+finish:
   return rc;
 }
 
-iwrc _lx_release(IWLCTX *lx) {
-  uint8_t *mm;
-  IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-  iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCRET(rc);
-  rc = _lx_release_mm(lx, mm);
-  IWRC(fsm->release_mmap(fsm), rc);
+// Try to do `lx` operation by leaf writer, see `_lx_leaf_lr()`
+static WUR iwrc _iwkv_leaf_op(IWLCTX *lx, uint64_t *olsn, bool *odone) {
+  int rci;
+  iwrc rc = 0;
+  IWDB db = lx->db;
+  *odone = false;
+  if (!_db_leafw_enabled(db) || atomic_load(&db->pins) || !db->cache.open || _bloom_full(db)) {
+    return 0;
+  }
+  API_DB_RLOCK(db, rci);
+  if (db->cache.open) {
+    rc = _lx_leaf_lr(lx, olsn, odone);
+    if (*odone) {
+      _rcache_invalidate(db, lx->key);
+    }
+  }
+  API_DB_UNLOCK(db, rci, rc);
+  if (!*odone) {
+    lx->lower = 0;
+    lx->upper = 0;
+    lx->dblk.addr = 0; // Database block may be changed before write lock
+  }
   return rc;
 }
 
-static iwrc _lx_split_addkv(IWLCTX *lx, int idx, SBLK *sblk) {
-  iwrc rc;
-  SBLK *nb;
-  blkn_t nblk;
-  uint8_t kvbpow = 0;
-  register int pivot = (KVBLK_IDXNUM / 2) + 1; // 32
-  if (idx < sblk->pnum) {
-    assert(sblk->kvblk);
-    // Partial split required
-    // Compute space required for the new sblk which stores kv pairs after pivot `idx`
-    size_t sz = 0;
-    for (int i = pivot; i < sblk->pnum; ++i) {
-      sz += sblk->kvblk->pidx[sblk->pi[i]].len;
-    }
-    if (idx > pivot) {
-      sz += IW_VNUMSIZE(lx->key->size) + lx->key->size + lx->val->size;
-    }
-    sz += KVBLK_MAX_NKV_SZ;
-    kvbpow = iwlog2_64(sz);
-    while ((1ULL << kvbpow) < sz) {
-      kvbpow++;
-    }
+iwrc iwkv_put(IWDB db, const IWKV_val *key, const IWKV_val *val, iwkv_opflags opflags) {
+  if (!db || !db->iwkv || !key || !key->size || !val) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  rc = _sblk_create(lx, lx->nlvl, kvbpow, sblk->addr, &nb);
-  RCRET(rc);
-  nblk = ADDR2BLK(nb->addr);
-  if (idx == sblk->pnum) { // Upper side
-    rc = _sblk_addkv(nb, lx->key, lx->val, lx->opflags, false);
+  if (db->iwkv->oflags & IWKV_RDONLY) {
+    return IW_ERROR_READONLY;
+  }
+  if (((db->dbflg & IWDB_UINT32_KEYS) && key->size != 4) ||
+      ((db->dbflg & IWDB_UINT64_KEYS) && key->size != 8)) {
+    return IWKV_ERROR_KEY_NUM_VALUE_SIZE;
+  }
+  int rci;
+  bool done, stored = false;
+  iwrc rc = 0;
+  uint64_t lsn = 0;
+  IWKV_val pval = { 0 };
+  _dbstat_add(db, DBS_PUTS, 1);
+  IWLCTX lx = {
+    .db = db,
+    .key = key,
+    .val = (IWKV_val *) val,
+    .nlvl = -1,
+    .op = IWLCTX_PUT,
+    .opflags = opflags
+  };
+  if (db->dbflg & IWDB_COMPRESSED) {
+    rc = _db_val_pack(val, &pval);
+    RCRET(rc);
+    lx.val = &pval;
+    lx.wval = val;
+  } else if (db->dbflg & IWDB_OVERFLOW_VALS) {
+    rc = _db_val_ovl_pack(db, val, 0, &pval);
+    RCRET(rc);
+    lx.val = &pval;
+    lx.wval = val;
+  }
+  iwp_current_time_ms(&lx.ts);
+  rc = _iwkv_leaf_op(&lx, &lsn, &done);
+  if (done || rc) {
+    goto sync;
+  }
+  API_DB_WLOCK(db, rci);
+  if (!db->cache.open) {
+    rc = _dbcache_fill_lw(&lx);
     RCGO(rc, finish);
-  } else { // New key is somewere in a middle of sblk->kvblk
-    assert(sblk->kvblk);
-    // We are in the middle
-    // Do the partial split
-    // Move kv pairs into new `nb`
-    IWKV_val key, val;
-    IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-    for (int i = pivot, end = sblk->pnum; i < end; ++i) {
-      uint8_t *mm;
-      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-      RCBREAK(rc);
-      rc = _kvblk_getkv(sblk->kvblk, mm, sblk->pi[i], &key, &val);
-      assert(key.size);
-      fsm->release_mmap(fsm);
-      RCBREAK(rc);
-      rc = _sblk_addkv2(nb, i - pivot, &key, &val, lx->opflags, true);
-      _kv_dispose(&key, &val);
-      RCBREAK(rc);
-      sblk->kvblk->pidx[sblk->pi[i]].len = 0;
-      sblk->kvblk->pidx[sblk->pi[i]].off = 0;
-      --sblk->pnum;
-    }
-    sblk->kvblk->flags |= KVBLK_DURTY;
-    sblk->kvblk->zidx = sblk->pi[pivot];
-    sblk->kvblk->maxoff = 0;
-    for (int i = 0; i < KVBLK_IDXNUM; ++i) {
-      if (sblk->kvblk->pidx[i].off > sblk->kvblk->maxoff) {
-        sblk->kvblk->maxoff = sblk->kvblk->pidx[i].off;
-      }
-    }
-    if (idx > pivot) {
-      rc = _sblk_addkv(nb, lx->key, lx->val, lx->opflags, false);
-    } else {
-      rc = _sblk_addkv(sblk, lx->key, lx->val, lx->opflags, false);
-    }
+  }
+  if (_bloom_full(db)) {
+    rc = _bloom_build_lw(&lx);
     RCGO(rc, finish);
   }
-  // fix levels
-  //  [ lb -> sblk -> ub ]
-  //  [ lb -> sblk -> nb -> ub ]
-  lx->pupper[0]->p0 = nblk;
-  lx->pupper[0]->flags |= SBLK_DURTY;
-  nb->p0 = ADDR2BLK(lx->plower[0]->addr);
-  for (int i = 0; i <= nb->lvl; ++i) {
-    lx->plower[i]->n[i] = nblk;
-    lx->plower[i]->flags |= SBLK_DURTY;
-    nb->n[i] = ADDR2BLK(lx->pupper[i]->addr);
+  _db_wseq_begin(db);
+  rc = _lx_put_lw(&lx);
+  _db_wseq_end(db);
+  stored = !rc;
+  if (!rc && db->iwkv->wal) {
+    rc = iwal_add(db->iwkv->wal, WOP_PUT, db->id, opflags, key, val, &lsn);
   }
 finish:
-  if (rc) {
-    lx->nb = 0;
-    IWRC(_sblk_destroy(lx, &nb), rc);
-  } else {
-    lx->nb = nb;
+  API_DB_UNLOCK(db, rci, rc);
+sync:
+  if (!stored) {
+    _db_val_ovl_discard(db, &pval);
+  }
+  _kv_val_dispose(&pval);
+  if (!rc && (lx.opflags & IWKV_SYNC)) {
+    rc = _iwkv_sync_op(lx.db->iwkv, lsn);
   }
   return rc;
 }
 
-IW_INLINE iwrc _lx_init_chute(IWLCTX *lx) {
-  assert(lx->nlvl >= 0);
-  iwrc rc = 0;
-  if (!lx->pupper[lx->nlvl]) { // fix zero upper by dbtail
-    SBLK *dbtail;
-    rc = _sblk_at(lx, 0, 0, &dbtail);
+/** Batch record */
+typedef struct KVPTR {
+  const IWKV_val *key;
+  const IWKV_val *val;
+  IWDB db;
+} KVPTR;
+
+// Sort batch records in the order of database traversal
+#define _kvptr_sort_lt(v1, v2) \
+  (_db_cmp_key((v1).db, (v1).key->data, (v1).key->size, (v2).key->data, (v2).key->size) < 0)
+
+KSORT_INIT(kvptr, KVPTR, _kvptr_sort_lt)
+
+/**
+ * @brief Set lower bound of the next batch key search.
+ * @details Search starts from the lower block of the previous key
+ *          if the next key is still below the previous upper block,
+ *          otherwise regular `_dbcache_get()` lookup will be used.
+ */
+static WUR iwrc _lx_batch_lower(IWLCTX *lx) {
+  iwrc rc;
+  int cret = 1;
+  lx->lower = 0;
+  if (!lx->plower_addr) {
+    return 0;
+  }
+  if (lx->pupper_addr) {
+    SBLK *ub;
+    rc = _sblk_at(lx, lx->pupper_addr, 0, &ub);
     RCRET(rc);
-    for (int i = lx->nlvl; i >= 0 && !lx->pupper[i]; --i) {
-      lx->pupper[i] = dbtail;
+    rc = _lx_sblk_cmp_key(lx, ub, &cret);
+    _sblk_release(lx, &ub);
+    RCRET(rc);
+  }
+  if (cret > 0) { // upper > key
+    rc = _sblk_at(lx, lx->plower_addr, 0, &lx->lower);
+    if (rc) {
+      lx->lower = 0;
     }
+    return rc;
   }
   return 0;
 }
 
-WUR iwrc _lx_addkv(IWLCTX *lx) {
-  iwrc rc;
-  bool found, uadd;
-  uint8_t *mm = 0, idx;
-  SBLK *sblk = lx->lower;
-  IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-  if (lx->nlvl > -1) {
-    rc = _lx_init_chute(lx);
-    RCRET(rc);
+iwrc iwkv_put_batch(IWDB db, const IWKV_val *keys, const IWKV_val *vals, size_t n, iwkv_opflags opflags) {
+  if (!db || !db->iwkv || (n && (!keys || !vals))) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCRET(rc);
-  rc = _sblk_loadkvblk_mm(lx, sblk, mm);
+  if (db->iwkv->oflags & IWKV_RDONLY) {
+    return IW_ERROR_READONLY;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    const IWKV_val *key = &keys[i];
+    if (!key->size) {
+      return IW_ERROR_INVALID_ARGS;
+    }
+    if (((db->dbflg & IWDB_UINT32_KEYS) && key->size != 4) ||
+        ((db->dbflg & IWDB_UINT64_KEYS) && key->size != 8)) {
+      return IWKV_ERROR_KEY_NUM_VALUE_SIZE;
+    }
+  }
+  if (!n) {
+    return 0;
+  }
+  int rci;
+  iwrc rc = 0;
+  uint64_t lsn = 0;
+  KVPTR *kvs = malloc(2 * n * sizeof(*kvs));
+  if (!kvs) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    kvs[i].key = &keys[i];
+    kvs[i].val = &vals[i];
+    kvs[i].db = db;
+  }
+  ks_mergesort_kvptr(n, kvs, kvs + n);
+  _dbstat_add(db, DBS_PUTS, n);
+
+  IWLCTX lx = {
+    .db = db,
+    .nlvl = -1,
+    .op = IWLCTX_PUT,
+    .opflags = opflags
+  };
+  iwp_current_time_ms(&lx.ts);
+  rc = _api_db_wlock(db);
   if (rc) {
-    fsm->release_mmap(fsm);
+    free(kvs);
     return rc;
   }
-  rc = _sblk_find_pi_mm(sblk, lx->key, mm, &found, &idx);
-  RCRET(rc);
-  if (found && (lx->opflags & IWKV_NO_OVERWRITE)) {
-    fsm->release_mmap(fsm);
-    return IWKV_ERROR_KEY_EXISTS;
+  if (!db->cache.open) {
+    rc = _dbcache_fill_lw(&lx);
+    RCGO(rc, finish);
   }
-  uadd = (!found &&
-          sblk->pnum > KVBLK_IDXNUM - 1 && idx > KVBLK_IDXNUM - 1 &&
-          lx->upper && lx->upper->pnum < KVBLK_IDXNUM);
-  if (uadd) {
-    rc = _sblk_loadkvblk_mm(lx, lx->upper, mm);
-    if (rc) {
-      fsm->release_mmap(fsm);
-      return rc;
+  for (size_t i = 0; i < n; ++i) {
+    IWKV_val pval = { 0 };
+    if (_bloom_full(db)) {
+      rc = _bloom_build_lw(&lx);
+      RCBREAK(rc);
     }
-  }
-  fsm->release_mmap(fsm);
-  if (!found && sblk->pnum > KVBLK_IDXNUM - 1) {
-    if (uadd) {
-      return _sblk_addkv(lx->upper, lx->key, lx->val, lx->opflags, false);
+    lx.key = kvs[i].key;
+    lx.val = (IWKV_val *) kvs[i].val;
+    lx.upper = 0;
+    lx.nb = 0;
+    lx.nlvl = -1;
+    if (db->dbflg & IWDB_COMPRESSED) {
+      rc = _db_val_pack(kvs[i].val, &pval);
+      RCBREAK(rc);
+      lx.val = &pval;
+    } else if (db->dbflg & IWDB_OVERFLOW_VALS) {
+      rc = _db_val_ovl_pack(db, kvs[i].val, 0, &pval);
+      RCBREAK(rc);
+      lx.val = &pval;
     }
-    if (lx->nlvl < 0) {
-      return _IWKV_ERROR_REQUIRE_NLEVEL;
+    rc = _lx_batch_lower(&lx);
+    if (!rc) {
+      lx.plower_addr = 0;
+      lx.pupper_addr = 0;
+      _db_wseq_begin(db);
+      rc = _lx_put_lw(&lx);
+      _db_wseq_end(db);
     }
-  }
-  if (!found && sblk->pnum >= KVBLK_IDXNUM) {
-    return _lx_split_addkv(lx, idx, sblk);
-  } else {
-    if (!found) {
-      return _sblk_addkv2(sblk, idx, lx->key, lx->val, lx->opflags, false);
-    } else {
-      return _sblk_updatekv(sblk, idx, lx->key, lx->val, lx->opflags);
+    if (rc) {
+      _db_val_ovl_discard(db, &pval);
+    }
+    _kv_val_dispose(&pval);
+    RCBREAK(rc);
+    if (db->iwkv->wal) {
+      rc = iwal_add(db->iwkv->wal, WOP_PUT, db->id, opflags, lx.key, kvs[i].val, &lsn);
+      RCBREAK(rc);
     }
   }
+finish:
+  API_DB_UNLOCK(db, rci, rc);
+  free(kvs);
+  if (!rc && (opflags & IWKV_SYNC)) {
+    rc = _iwkv_sync_op(db->iwkv, lsn);
+  }
+  return rc;
 }
 
-IW_INLINE WUR iwrc _lx_put_lw(IWLCTX *lx) {
-  iwrc rc;
-start:
-  rc = _lx_find_bounds(lx);
-  if (rc) {
-    _lx_release_mm(lx, 0);
-    return rc;
+//--------------------------  WRITE BATCH
+
+/** Changes of several databases applied at once, see `iwkv_batch_commit()` */
+struct IWKV_batch {
+  IWKV iwkv;
+  uint8_t *buf;               /**< Records: [op:u1,flags:u1,dbid:u4,klen:u4,vlen:u4,key,value], same as `WOP_BATCH` */
+  size_t bufsz;               /**< Size of records in `buf` */
+  size_t bufcap;              /**< Allocated size of `buf` */
+  uint32_t *dbids;            /**< Sorted identifiers of batch databases, the order of locks acquisition */
+  uint32_t dbnum;             /**< Number of `dbids` */
+  uint32_t dbcap;             /**< Allocated number of `dbids` */
+};
+
+static WUR iwrc _batch_add(IWKV_batch b, iwal_op_t op, uint8_t flags, IWDB db, const IWKV_val *key, const IWKV_val *val) {
+  uint32_t lv;
+  size_t vlen = val ? val->size : 0;
+  size_t len = BATCH_RHDR_SZ + key->size + vlen;
+  if (key->size > UINT32_MAX || vlen > UINT32_MAX
+      || (b->iwkv->wal && b->bufsz + len > IWAL_MAX_DATASZ)) {
+    return IWKV_ERROR_MAXKVSZ;
   }
-  rc = _lx_addkv(lx);
-  if (rc == _IWKV_ERROR_REQUIRE_NLEVEL) {
-    SBLK *lower = lx->lower;
-    _lx_release_mm(lx, 0);
-    lx->nlvl = _sblk_genlevel(lx->db);
-    if (lower->lvl >= lx->nlvl) {
-      lx->lower = lower;
+  if (b->bufsz + len > b->bufcap) {
+    size_t ncap = b->bufcap ? b->bufcap : 1024;
+    while (ncap < b->bufsz + len) {
+      ncap *= 2;
     }
-    goto start;
+    uint8_t *nbuf = realloc(b->buf, ncap);
+    if (!nbuf) {
+      return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    }
+    b->buf = nbuf;
+    b->bufcap = ncap;
   }
-  if (rc) {
-    if (rc == _IWKV_ERROR_KVBLOCK_FULL) {
-      rc = IWKV_ERROR_CORRUPTED;
-      iwlog_ecode_error3(rc);
+  if (b->dbnum >= b->dbcap) {
+    uint32_t ncap = b->dbcap ? 2 * b->dbcap : 8;
+    uint32_t *ndbids = realloc(b->dbids, ncap * sizeof(*ndbids));
+    if (!ndbids) {
+      return iwrc_set_errno(IW_ERROR_ALLOC, errno);
     }
-    _lx_release_mm(lx, 0);
-  } else {
-    rc = _lx_release(lx);
+    b->dbids = ndbids;
+    b->dbcap = ncap;
+  }
+  if (iwarr_sorted_insert(b->dbids, b->dbnum, sizeof(*b->dbids), &db->id, _u4cmp, true) != -1) {
+    b->dbnum++;
+  }
+  uint8_t *wp = b->buf + b->bufsz;
+  *wp++ = op;
+  *wp++ = flags;
+  lv = IW_HTOIL(db->id);
+  memcpy(wp, &lv, 4);
+  wp += 4;
+  lv = key->size;
+  lv = IW_HTOIL(lv);
+  memcpy(wp, &lv, 4);
+  wp += 4;
+  lv = vlen;
+  lv = IW_HTOIL(lv);
+  memcpy(wp, &lv, 4);
+  wp += 4;
+  memcpy(wp, key->data, key->size);
+  wp += key->size;
+  if (vlen) {
+    memcpy(wp, val->data, vlen);
   }
-  return rc;
+  b->bufsz += len;
+  return 0;
 }
 
-IW_INLINE WUR iwrc _lx_get_lr(IWLCTX *lx) {
-  iwrc rc = _lx_find_bounds(lx);
-  RCRET(rc);
-  bool found;
-  uint8_t *mm, idx;
-  IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-  lx->val->size = 0;
-  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCRET(rc);
-  rc = _sblk_loadkvblk_mm(lx, lx->lower, mm);
-  RCGO(rc, finish);
-  rc = _sblk_find_pi_mm(lx->lower, lx->key, mm, &found, &idx);
-  RCGO(rc, finish);
-  if (found) {
-    idx = lx->lower->pi[idx];
-    rc = _kvblk_getvalue(lx->lower->kvblk, mm, idx, lx->val);
-  } else {
-    rc = IWKV_ERROR_NOTFOUND;
+static WUR iwrc _batch_check(IWKV_batch b, IWDB db, const IWKV_val *key) {
+  if (!b || !db || db->iwkv != b->iwkv || !key || !key->size) {
+    return IW_ERROR_INVALID_ARGS;
   }
-finish:
-  IWRC(fsm->release_mmap(fsm), rc);
-  _lx_release_mm(lx, 0);
-  return rc;
+  if (db->iwkv->oflags & IWKV_RDONLY) {
+    return IW_ERROR_READONLY;
+  }
+  if ((db->dbflg & IWDB_UINT_KEYS_FLAGS) && key->size != _uint_key_size(db->dbflg)) {
+    return IWKV_ERROR_KEY_NUM_VALUE_SIZE;
+  }
+  return 0;
 }
 
-IW_INLINE WUR iwrc _lx_del_lw(IWLCTX *lx) {
-  iwrc rc;
-  bool found;
-  uint8_t *mm = 0, idx;
-  IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-  SBLK *sblk;
-  rc = _lx_find_bounds(lx);
-  RCRET(rc);
-  sblk = lx->lower;
-  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-  RCGO(rc, finish);
-  rc = _sblk_loadkvblk_mm(lx, sblk, mm);
-  RCGO(rc, finish);
-  rc = _sblk_find_pi_mm(sblk, lx->key, mm, &found, &idx);
-  RCGO(rc, finish);
-  if (!found) {
-    rc = IWKV_ERROR_NOTFOUND;
-    goto finish;
+// Apply batch record to its write locked database
+static WUR iwrc _batch_apply_lw(IWDB db, const BATCHREC *r, uint64_t ts) {
+  iwrc rc = 0;
+  IWKV_val pval = { 0 };
+  IWLCTX lx = {
+    .db = db,
+    .key = &r->key,
+    .val = (IWKV_val *) &r->val,
+    .nlvl = -1,
+    .ts = ts,
+    .op = r->op == WOP_PUT ? IWLCTX_PUT : IWLCTX_DEL,
+    .opflags = r->flags
+  };
+  _dbstat_add(db, r->op == WOP_PUT ? DBS_PUTS : DBS_DELS, 1);
+  if (r->op == WOP_DEL && _bloom_absent(db, &r->key)) {
+    return 0;
   }
-  fsm->release_mmap(fsm);
-  mm = 0;
-  if (sblk->pnum == 1) { // last kv in block
-    KVBLK *kvblk = sblk->kvblk;
-    _lx_release_mm(lx, 0);
-    lx->nlvl = sblk->lvl;
-    lx->upper_addr = sblk->addr;
-    rc = _lx_find_bounds(lx);
+  if (!db->cache.open) {
+    rc = _dbcache_fill_lw(&lx);
     RCRET(rc);
-    assert(lx->upper->pnum == 1 && lx->upper->addr == lx->upper_addr);
-    lx->upper->kvblk = kvblk;
-    rc = _sblk_rmkv(lx->upper, idx);
-    RCGO(rc, finish);
-    for (int i = 0; i <= lx->nlvl; ++i) {
-      lx->plower[i]->n[i] = lx->upper->n[i];
-      lx->plower[i]->flags |= SBLK_DURTY;
-      if (lx->plower[i]->flags & SBLK_DB) {
-        if (!lx->plower[i]->n[i]) {
-          --lx->plower[i]->lvl;
-        }
-      }
-      if (lx->pupper[i] == lx->upper) {
-        lx->pupper[i] = 0;
-      }
-    }
-    SBLK *nb;
-    assert(!lx->nb);
-    rc = _sblk_at(lx, BLK2ADDR(lx->upper->n[0]), 0, &nb);
-    RCGO(rc, finish);
-    lx->nb = nb;
-    lx->nb->p0 = lx->upper->p0;
-    lx->nb->flags |= SBLK_DURTY;
-    rc = _sblk_destroy(lx, &lx->upper);
-  } else {
-    rc = _sblk_rmkv(sblk, idx);
-    RCGO(rc, finish);
-  }
-finish:
-  if (mm) {
-    fsm->release_mmap(fsm);
   }
-  if (rc) {
-    _lx_release_mm(lx, 0);
+  if (r->op == WOP_PUT) {
+    if (_bloom_full(db)) {
+      rc = _bloom_build_lw(&lx);
+      RCRET(rc);
+    }
+    if (db->dbflg & IWDB_COMPRESSED) {
+      rc = _db_val_pack(&r->val, &pval);
+      RCRET(rc);
+      lx.val = &pval;
+      lx.wval = &r->val;
+    } else if (db->dbflg & IWDB_OVERFLOW_VALS) {
+      rc = _db_val_ovl_pack(db, &r->val, 0, &pval);
+      RCRET(rc);
+      lx.val = &pval;
+      lx.wval = &r->val;
+    }
+    rc = _lx_put_lw(&lx);
+    if (rc) {
+      _db_val_ovl_discard(db, &pval);
+    }
+    _kv_val_dispose(&pval);
+    if (rc == IWKV_ERROR_NOTFOUND && (r->flags & IWKV_DUP_REMOVE)) {
+      rc = 0;
+    }
   } else {
-    rc = _lx_release(lx);
+    rc = _lx_del_lw(&lx);
+    if (rc == IWKV_ERROR_NOTFOUND) {
+      rc = 0;
+    }
   }
   return rc;
 }
 
-//-------------------------- CACHE
+// Batch records of the same key: hash of database id and key to ordinal of the latest record
+KHASH_MAP_INIT_INT64(BKEYS, uint32_t)
 
-static void _dbcache_destroy_lw(IWDB db) {
-  if (db->cache.nodes) {
-    free(db->cache.nodes);
+// Keys equal for `_db_cmp_key()` have the same hash.
+// String keys are hashed up to the first zero byte, keys of custom comparator by database only.
+IW_INLINE uint64_t _batch_key_hash(IWDB db, const BATCHREC *r) {
+  uint64_t h = 0xcbf29ce484222325ULL ^ r->dbid;
+  if (db->dbflg & IWDB_CUSTOM_KEYS) {
+    return h;
   }
-  memset(&db->cache, 0, sizeof(db->cache));
+  bool str = !(db->dbflg & IWDB_NOPFX_KEYS_FLAGS);
+  h = (h ^ r->key.size) * 0x100000001b3ULL;
+  for (size_t i = 0; i < r->key.size && (((uint8_t *) r->key.data)[i] || !str); ++i) {
+    h = (h ^ ((uint8_t *) r->key.data)[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+IW_INLINE bool _batch_same_key(IWDB db, const BATCHREC *r1, const BATCHREC *r2) {
+  return r1->dbid == r2->dbid && !_db_cmp_key(db, r1->key.data, r1->key.size, r2->key.data, r2->key.size);
 }
 
-IW_INLINE uint8_t _dbcache_lvl(uint8_t lvl) {
-  uint8_t clvl = (lvl >= DBCACHE_LEVELS) ? (lvl - DBCACHE_LEVELS + 1) : DBCACHE_MIN_LEVEL;
-  if (clvl < DBCACHE_MIN_LEVEL) {
-    clvl = DBCACHE_MIN_LEVEL;
+// Check if `key` is stored in write locked database
+static WUR iwrc _batch_key_stored_lw(IWDB db, const IWKV_val *key, uint64_t ts, bool *ostored) {
+  IWKV_val val = { 0 };
+  IWLCTX lx = {
+    .db = db,
+    .key = key,
+    .val = &val,
+    .nlvl = -1,
+    .ts = ts
+  };
+  *ostored = false;
+  if (_bloom_absent(db, key)) {
+    return 0;
   }
-  return clvl;
+  if (!db->cache.open) {
+    iwrc rc = _dbcache_fill_lw(&lx);
+    RCRET(rc);
+  }
+  iwrc rc = _lx_get_lr(&lx);
+  if (rc == IWKV_ERROR_NOTFOUND) {
+    return 0;
+  }
+  RCRET(rc);
+  _kv_val_dispose(&val);
+  *ostored = true;
+  return 0;
 }
 
-static WUR iwrc _dbcache_cmp_nodes(const void *v1, const void *v2, void *op, int *res) {
-  KVBLK *kb;
-  IWLCTX *lx = op;
-  IWFS_FSM *fsm = &lx->db->iwkv->fsm;
-  const DBCNODE *c1 = v1, *c2 = v2;
-  const uint8_t *k1 = c1->lk, *k2 = c2->lk;
-  uint32_t kl1 = c1->lkl, kl2 = c2->lkl;
-  uint8_t *mm = 0;
+/**
+ * @brief Check `IWKV_NO_OVERWRITE` records of batch before any of its changes are made.
+ * @details Presence of a key is resolved by the latest previous batch record of the key
+ *          or by lookup in database if batch has no such records.
+ *          `IWKV_DUP_REMOVE` records do not change presence of a key.
+ */
+static WUR iwrc _batch_precheck_lw(IWKV_batch b, IWDB *dbs, uint64_t ts) {
   iwrc rc = 0;
-
-  *res = _cmp_key2(lx->db->dbflg, k1, kl1, k2, kl2);
-  if (*res == 0 && (!c1->fullkey || !c2->fullkey)) {
-    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-    RCRET(rc);
-    if (!c1->fullkey) {
-      rc = _kvblk_at_mm(lx, BLK2ADDR(c1->kblkn), mm, 0, &kb);
-      RCGO(rc, finish);
-      rc = _kvblk_peek_key(kb, c1->k0idx, mm, &k1, &kl1);
-      RCGO(rc, finish);
+  BATCHREC r, pr = { 0 };
+  size_t off = 0;
+  uint32_t num = 0;
+  bool check = false;
+  while (_batch_rec(b->buf, b->bufsz, &off, &r)) {
+    ++num;
+    check |= (r.op == WOP_PUT && (r.flags & IWKV_NO_OVERWRITE));
+  }
+  if (!check) {
+    return 0;
+  }
+  size_t *offs = malloc(num * sizeof(*offs));       // Offsets of records
+  uint32_t *prev = malloc(num * sizeof(*prev));     // Ordinal + 1 of the previous record of the same key hash
+  khash_t(BKEYS) *keys = kh_init(BKEYS);
+  if (!offs || !prev || !keys) {
+    rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    goto finish;
+  }
+  off = 0;
+  for (uint32_t i = 0; i < num; ++i) {
+    int rci, stored = -1;
+    offs[i] = off;
+    if (!_batch_rec(b->buf, b->bufsz, &off, &r)) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      break;
     }
-    if (!c2->fullkey) {
-      rc = _kvblk_at_mm(lx, BLK2ADDR(c2->kblkn), mm, 0, &kb);
-      RCGO(rc, finish);
-      rc = _kvblk_peek_key(kb, c2->k0idx, mm, &k2, &kl2);
-      RCGO(rc, finish);
+    uint32_t *dp = bsearch(&r.dbid, b->dbids, b->dbnum, sizeof(*b->dbids), _u4cmp);
+    assert(dp);
+    IWDB db = dbs[dp - b->dbids];
+    khiter_t k = kh_put(BKEYS, keys, _batch_key_hash(db, &r), &rci);
+    if (rci == -1) {
+      rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      break;
+    }
+    prev[i] = rci ? 0 : kh_value(keys, k);
+    kh_value(keys, k) = i + 1;
+    if (r.op != WOP_PUT || !(r.flags & IWKV_NO_OVERWRITE)) {
+      continue;
+    }
+    for (uint32_t p = prev[i]; p && stored < 0; p = prev[p - 1]) {
+      size_t poff = offs[p - 1];
+      if (!_batch_rec(b->buf, b->bufsz, &poff, &pr) || !_batch_same_key(db, &r, &pr)) {
+        continue;
+      }
+      if (pr.op == WOP_DEL) {
+        stored = 0;
+      } else if (!(pr.flags & IWKV_DUP_REMOVE)) {
+        stored = 1;
+      }
+    }
+    if (stored < 0) {
+      bool found;
+      rc = _batch_key_stored_lw(db, &r.key, ts, &found);
+      RCBREAK(rc);
+      stored = found;
+    }
+    if (stored) {
+      rc = IWKV_ERROR_KEY_EXISTS;
+      break;
     }
-    *res = _cmp_key(lx->db->dbflg, k1, kl1, k2, kl2);
   }
+
 finish:
-  if (mm) {
-    fsm->release_mmap(fsm);
+  free(offs);
+  free(prev);
+  if (keys) {
+    kh_destroy(BKEYS, keys);
   }
   return rc;
 }
 
-static WUR iwrc _dbcache_fill_lw(IWLCTX *lx) {
-  iwrc rc = 0;
-  IWDB db = lx->db;
-  lx->cache_reload = 0;
-  if (!lx->dblk.addr) {
-    SBLK *s;
-    rc = _sblk_at(lx, lx->db->addr, 0, &s);
-    RCRET(rc);
-    memcpy(&lx->dblk, s, sizeof(lx->dblk));
+iwrc iwkv_batch_create(IWKV iwkv, IWKV_batch *bp) {
+  if (!iwkv || !bp) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  SBLK *sdb = &lx->dblk;
-  SBLK *sblk = sdb;
-  DBCACHE *c = &db->cache;
-  assert(lx->db->addr == sdb->addr);
-  c->atime = lx->ts;
-  c->num = 0;
-  if (c->nodes) {
-    free(c->nodes);
-    c->nodes = 0;
+  *bp = calloc(1, sizeof(**bp));
+  if (!*bp) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
   }
-  if (sdb->lvl < DBCACHE_MIN_LEVEL) {
-    c->open = true;
+  (*bp)->iwkv = iwkv;
+  return 0;
+}
+
+iwrc iwkv_batch_put(IWKV_batch b, IWDB db, const IWKV_val *key, const IWKV_val *val, iwkv_opflags opflags) {
+  iwrc rc = _batch_check(b, db, key);
+  RCRET(rc);
+  if (!val) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  if (((db->dbflg & IWDB_DUP_UINT32_VALS) && val->size != 4) ||
+      ((db->dbflg & IWDB_DUP_UINT64_VALS) && val->size != 8)) {
+    return IWKV_ERROR_DUP_VALUE_SIZE;
+  }
+  // Upper bound of stored value size, so oversized record does not fail batch commit
+  uint64_t vsz = val->size;
+  if (db->dbflg & IWDB_OVERFLOW_VALS) {
+    vsz = vsz > atomic_load_explicit(&db->ovl_threshold, memory_order_relaxed) ? OVL_STUB_SZ : 1 + vsz;
+  } else if (db->dbflg & IWDB_COMPRESSED) {
+    vsz += 1;
+  }
+  if (IW_VNUMSIZE(key->size) + key->size + vsz > IWKV_MAX_KVSZ) {
+    return IWKV_ERROR_MAXKVSZ;
+  }
+  return _batch_add(b, WOP_PUT, opflags & ~IWKV_SYNC, db, key, val);
+}
+
+iwrc iwkv_batch_del(IWKV_batch b, IWDB db, const IWKV_val *key) {
+  iwrc rc = _batch_check(b, db, key);
+  RCRET(rc);
+  return _batch_add(b, WOP_DEL, 0, db, key, 0);
+}
+
+iwrc iwkv_batch_commit(IWKV_batch b, iwkv_opflags opflags) {
+  if (!b) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  if (!b->bufsz) {
     return 0;
   }
-  c->lvl = _dbcache_lvl(sdb->lvl);
-  c->nsize = (lx->db->dbflg & IWDB_UINT_KEYS_FLAGS) ? DBCNODE_NUM_SZ : DBCNODE_STR_SZ;
-  c->asize = c->nsize * ((1 << DBCACHE_LEVELS) + DBCACHE_ALLOC_STEP);
-  size_t nsize = c->nsize;
-  c->nodes = malloc(c->asize);
-  if (!c->nodes) {
-    c->open = false;
+  int rci;
+  iwrc rc;
+  uint32_t nlocked = 0;
+  uint64_t ts, lsn = 0;
+  size_t off = 0;
+  bool applied = false;
+  IWKV iwkv = b->iwkv;
+  IWDB *dbs = malloc(b->dbnum * sizeof(*dbs));
+  if (!dbs) {
     return iwrc_set_errno(IW_ERROR_ALLOC, errno);
   }
-  blkn_t n;
-  uint8_t *wp;
-  size_t num = 0;
-  while ((n = sblk->n[c->lvl])) {
-    rc = _sblk_at(lx, BLK2ADDR(n), 0, &sblk);
-    RCRET(rc);
-    if (offsetof(DBCNODE, lk) + sblk->lkl > nsize) {
-      free(c->nodes);
-      c->nodes = 0;
-      rc = IWKV_ERROR_CORRUPTED;
-      iwlog_ecode_error3(rc);
-      return rc;
+  iwp_current_time_ms(&ts);
+  rc = _api_rlock(iwkv);
+  if (rc) {
+    free(dbs);
+    return rc;
+  }
+  // Databases are locked in order of identifiers so concurrent batches don't deadlock
+  for (; nlocked < b->dbnum; ++nlocked) {
+    khiter_t ki = kh_get(DBS, iwkv->dbs, b->dbids[nlocked]);
+    if (ki == kh_end(iwkv->dbs)) {
+      rc = IW_ERROR_INVALID_STATE; // Database is destroyed
+      break;
     }
-    DBCNODE cn = {
-      .lkl = sblk->lkl,
-      .fullkey = (sblk->flags & SBLK_FULL_LKEY),
-      .k0idx = sblk->pi[0],
-      .sblkn = ADDR2BLK(sblk->addr),
-      .kblkn = sblk->kvblkn
-    };
-    if (c->asize < nsize * (num + 1)) {
-      c->asize += (nsize * DBCACHE_ALLOC_STEP);
-      wp = (uint8_t *) c->nodes;
-      c->nodes = realloc(c->nodes, c->asize);
-      if (!c->nodes) {
-        rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
-        free(wp);
-        return rc;
+    dbs[nlocked] = kh_value(iwkv->dbs, ki);
+    rci = _db_rwl_lock(dbs[nlocked], true);
+    if (rci) {
+      rc = iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+      break;
+    }
+  }
+  if (!rc) {
+    rc = _batch_precheck_lw(b, dbs, ts);
+  }
+  if (!rc) {
+    BATCHREC r;
+    // Lock free readers of batch databases fall back to locked lookups until the whole batch is applied
+    for (uint32_t i = 0; i < nlocked; ++i) {
+      _db_wseq_begin(dbs[i]);
+    }
+    while (_batch_rec(b->buf, b->bufsz, &off, &r)) {
+      uint32_t *dp = bsearch(&r.dbid, b->dbids, b->dbnum, sizeof(*b->dbids), _u4cmp);
+      assert(dp);
+      rc = _batch_apply_lw(dbs[dp - b->dbids], &r, ts);
+      RCBREAK(rc);
+    }
+    for (uint32_t i = 0; i < nlocked; ++i) {
+      _db_wseq_end(dbs[i]);
+    }
+    if (!rc) {
+      applied = true;
+      if (iwkv->wal) {
+        IWKV_val bval = { .data = b->buf, .size = b->bufsz };
+        rc = iwal_add(iwkv->wal, WOP_BATCH, 0, 0, 0, &bval, &lsn);
       }
     }
-    wp = (uint8_t *) c->nodes + nsize * num;
-    memcpy(wp, &cn, offsetof(DBCNODE, lk));
-    wp += offsetof(DBCNODE, lk);
-    memcpy(wp, sblk->lk, sblk->lkl);
-    ++num;
-  }
-  c->num = num;
-  c->open = true;
-  return 0;
-}
-
-static WUR iwrc _dbcache_get(IWLCTX *lx) {
-  iwrc rc = 0;
-  off_t idx;
-  bool found;
-  DBCNODE *n;
-  uint8_t dbcbuf[1024];
-  IWDB db = lx->db;
-  DBCACHE *cache = &db->cache;
-  cache->atime = lx->ts;
-  if (lx->nlvl > -1 || cache->num < 1) {
-    lx->lower = &lx->dblk;
-    return 0;
   }
-  assert(cache->nodes);
-  if (sizeof(DBCNODE) + lx->key->size <= sizeof(dbcbuf)) {
-    n = (DBCNODE *) dbcbuf;
-  } else {
-    n = malloc(sizeof(DBCNODE) + lx->key->size);
-    if (!n) {
-      return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  while (nlocked > 0) {
+    rci = pthread_rwlock_unlock(&dbs[--nlocked]->rwl);
+    if (rci) {
+      IWRC(iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci), rc);
     }
   }
-  n->lkl = lx->key->size;
-  n->fullkey = 1;
-  n->k0idx = 0;
-  n->sblkn = 0;
-  n->kblkn = 0;
-  memcpy((uint8_t *)n + offsetof(DBCNODE, lk), lx->key->data, lx->key->size);
-  idx = iwarr_sorted_find2(cache->nodes, cache->num, cache->nsize, n, lx, &found, _dbcache_cmp_nodes);
-  if (idx > 0) {
-    DBCNODE *fn = (DBCNODE *)((uint8_t *)cache->nodes + (idx - 1) * cache->nsize);
-    assert(fn && idx - 1 < cache->num);
-    rc = _sblk_at(lx, BLK2ADDR(fn->sblkn), 0, &lx->lower);
-  } else {
-    lx->lower = &lx->dblk;
-  }
-  if ((uint8_t *)n != dbcbuf) {
-    free(n);
+  API_UNLOCK(iwkv, rci, rc);
+  free(dbs);
+  b->bufsz = 0;
+  b->dbnum = 0;
+  if (applied && (opflags & IWKV_SYNC)) {
+    IWRC(_iwkv_sync_op(iwkv, lsn), rc);
   }
   return rc;
 }
 
-static WUR iwrc _dbcache_put_lw(IWLCTX *lx, SBLK *sblk) {
-  off_t idx;
-  bool found;
-  IWDB db = lx->db;
-  uint8_t dbcbuf[1024];
-  DBCNODE *n = (DBCNODE *) dbcbuf;
-  DBCACHE *cache = &db->cache;
-  register size_t nsize = cache->nsize;
+void iwkv_batch_destroy(IWKV_batch *bp) {
+  if (bp && *bp) {
+    free((*bp)->buf);
+    free((*bp)->dbids);
+    free(*bp);
+    *bp = 0;
+  }
+}
 
-  sblk->flags &= ~SBLK_CACHE_PUT;
-  cache->atime = lx->ts;
-  assert(sizeof(*cache) + sblk->lkl <= sizeof(dbcbuf));
-  if (sblk->pnum < 1 || sblk->lvl < cache->lvl) {
+//--------------------------  BULK LOAD
+
+// Size of the first storage area allocated by bulk loader, next areas are twice bigger
+#define LOAD_AREA_INISZ (1ULL << 16)
+
+// Max size of storage area allocated by bulk loader at once
+#define LOAD_AREA_MAXSZ (1ULL << 23)
+
+// Size of buffered kv pairs after which `SBLK` is stored even if it is not full
+#define LOAD_KVBLK_MAXSZ (1ULL << 20)
+
+/** Storage area allocated by bulk loader */
+typedef struct LOADAREA {
+  off_t addr;
+  off_t len;
+} LOADAREA;
+
+/** Bulk loader context */
+typedef struct IWLOAD {
+  IWLCTX *lx;
+  uint8_t *buf;               /**< Kv pairs of the current block [klen:vn,key,value] */
+  size_t bufsz;               /**< Size of kv pairs data in `buf` */
+  size_t bufasz;              /**< Allocated size of `buf` */
+  uint8_t *pk;                /**< The last loaded key */
+  size_t pksz;                /**< Size of the last loaded key */
+  size_t pkasz;               /**< Allocated size of `pk` */
+  LOADAREA *areas;            /**< Allocated storage areas, the last one is the current */
+  size_t anum;                /**< Number of allocated areas */
+  size_t aasz;                /**< Capacity of `areas` array */
+  off_t aoff;                 /**< Used size of the current area */
+  uint64_t bnum;              /**< Number of stored blocks */
+  off_t paddr;                /**< Address of the last stored block, `0` if there are no blocks */
+  off_t laddr[SLEVELS];       /**< Address of the last stored block on every level, `0` for database block */
+  uint32_t lcnt[SLEVELS];     /**< Number of stored blocks per level */
+  uint32_t poff[KVBLK_IDXNUM_MAX]; /**< Offsets of kv pairs in `buf` */
+  uint32_t plen[KVBLK_IDXNUM_MAX]; /**< Lengths of kv pairs in `buf` */
+  uint8_t pnum;               /**< Number of kv pairs in `buf` */
+} IWLOAD;
+
+IW_INLINE WUR iwrc _load_buf_ensure(uint8_t **bufp, size_t *asizep, size_t size) {
+  if (*asizep >= size) {
     return 0;
   }
-  if (sblk->lvl >= cache->lvl + DBCACHE_LEVELS || !cache->nodes) { // need to reload full cache
-    lx->cache_reload = 1;
-    return 0;
+  size_t nsize = *asizep ? *asizep : 256;
+  while (nsize < size) {
+    nsize *= 2;
   }
-  if (!sblk->kvblk) {
-    assert(sblk->kvblk);
-    return IW_ERROR_INVALID_STATE;
+  uint8_t *nbuf = realloc(*bufp, nsize);
+  if (!nbuf) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
   }
-  n->lkl = sblk->lkl;
-  n->fullkey = (sblk->flags & SBLK_FULL_LKEY);
-  n->k0idx = sblk->pi[0];
-  n->sblkn = ADDR2BLK(sblk->addr);
-  n->kblkn = sblk->kvblkn;
-  memcpy((uint8_t *)n + offsetof(DBCNODE, lk), sblk->lk, sblk->lkl);
-
-  idx = iwarr_sorted_find2(cache->nodes, cache->num, nsize, n, lx, &found, _dbcache_cmp_nodes);
-  assert(!found);
-  if (cache->asize <= cache->num * nsize) {
-    size_t nsz = cache->asize + (nsize * DBCACHE_ALLOC_STEP);
-    DBCNODE *nodes = realloc(cache->nodes, nsz);
-    if (!nodes) {
-      iwrc rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
-      free(cache->nodes);
-      cache->nodes = 0;
-      return rc;
+  *bufp = nbuf;
+  *asizep = nsize;
+  return 0;
+}
+
+// Allocate `len` bytes of the next block from current storage area.
+// Must be called without acquired mmap since file may be resized.
+static WUR iwrc _load_alloc(IWLOAD *ld, off_t len, off_t *oaddr) {
+  IWFS_FSM *fsm = &ld->lx->db->file->fsm;
+  LOADAREA *area = ld->anum ? &ld->areas[ld->anum - 1] : 0;
+  if (!area || area->len - ld->aoff < len) {
+    iwrc rc;
+    off_t asz = area ? MIN(2 * area->len, LOAD_AREA_MAXSZ) : LOAD_AREA_INISZ;
+    off_t addr = area ? area->addr + area->len : 0, alen;
+    if (asz < len) {
+      asz = len;
     }
-    cache->asize = nsz;
-    cache->nodes = nodes;
+    if (ld->anum == ld->aasz) {
+      size_t nasz = ld->aasz ? 2 * ld->aasz : 16;
+      LOADAREA *nareas = realloc(ld->areas, nasz * sizeof(*nareas));
+      if (!nareas) {
+        return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+      }
+      ld->areas = nareas;
+      ld->aasz = nasz;
+      area = ld->anum ? &ld->areas[ld->anum - 1] : 0;
+    }
+    if (area && area->len > ld->aoff) { // Return unused tail of the current area
+      rc = fsm->deallocate(fsm, area->addr + ld->aoff, area->len - ld->aoff);
+      RCRET(rc);
+      area->len = ld->aoff;
+    }
+    rc = fsm->allocate(fsm, asz, &addr, &alen,
+                       IWFSM_ALLOC_NO_OVERALLOCATE | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
+    RCRET(rc);
+    area = &ld->areas[ld->anum++];
+    area->addr = addr;
+    area->len = alen;
+    ld->aoff = 0;
   }
-  uint8_t *cptr = (uint8_t *) cache->nodes;
-  memmove(cptr + (idx + 1) * nsize, cptr + idx * nsize, (cache->num - idx) * nsize);
-  memcpy(cptr + idx * nsize, n, nsize);
-  ++cache->num;
+  *oaddr = area->addr + ld->aoff;
+  ld->aoff += len;
   return 0;
 }
 
-static void _dbcache_remove_lw(IWLCTX *lx, SBLK *sblk) {
-  IWDB db = lx->db;
-  DBCACHE *cache = &db->cache;
-  sblk->flags &= ~SBLK_CACHE_REMOVE;
-  cache->atime = lx->ts;
-  if (sblk->lvl < cache->lvl || cache->num < 1) {
-    return;
+// Store buffered kv pairs as a new `SBLK` linked after the last stored block
+static WUR iwrc _load_flush(IWLOAD *ld) {
+  if (!ld->pnum) {
+    return 0;
   }
-  if (cache->lvl > DBCACHE_MIN_LEVEL && lx->dblk.lvl < sblk->lvl) {
-    // Database level reduced so we need to shift cache down
-    lx->cache_reload = 1;
-    return;
+  iwrc rc;
+  uint8_t *mm;
+  uint32_t lv;
+  off_t addr, off = 0;
+  IWLCTX *lx = ld->lx;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+  KVKEY pk[KVBLK_IDXNUM_MAX];     // Keys of buffered pairs
+  uint32_t plen[KVBLK_IDXNUM_MAX]; // Lengths of pairs stored in block
+  KVBLK kb = {
+    .db = lx->db,
+    .zidx = (ld->pnum < lx->db->pnmax) ? ld->pnum : -1,
+    .flags = KVBLK_DURTY
+  };
+  for (int i = 0; i < ld->pnum; ++i) {
+    uint32_t step;
+    const uint8_t *rp = ld->buf + ld->poff[i];
+    IW_READVNUMBUF(rp, pk[i].len, step);
+    pk[i].buf = rp + step;
+    pk[i].pfx = 0;
+    pk[i].pfxl = 0;
+  }
+  if (!(lx->db->dbflg & IWDB_NOPFX_KEYS_FLAGS)) {
+    kb.pfxl = _kvblk_pfx_select(&pk[0], &pk[ld->pnum - 1], kb.pfx);
+  }
+  size_t idxsz = kb.pfxl ? 1 + kb.pfxl : 0, bufsz = 0;
+  for (int i = 0; i < lx->db->pnmax; ++i) {
+    if (i < ld->pnum) {
+      uint32_t kl;
+      IWKV_val key = { .data = (void *) pk[i].buf, .size = pk[i].len };
+      uint32_t kh = _kvblk_kh(&kb, &key, &kl);
+      plen[i] = IW_VNUMSIZE32(kh) + kl + ld->plen[i] - (pk[i].buf - (ld->buf + ld->poff[i])) - pk[i].len;
+      bufsz += plen[i];
+      off += plen[i];
+      idxsz += IW_VNUMSIZE(off) + IW_VNUMSIZE32(plen[i]);
+    } else {
+      idxsz += 2 * IW_VNUMSIZE(0);
+    }
   }
-  blkn_t sblkn = ADDR2BLK(sblk->addr);
-  size_t num = cache->num;
-  size_t nsize = cache->nsize;
-  uint8_t *rp = (uint8_t *) cache->nodes;
-  for (size_t i = 0; i < num; ++i) {
-    DBCNODE *n = (DBCNODE *)(rp + i * nsize);
-    if (sblkn == n->sblkn) {
-      if (i < num - 1) {
-        memmove(rp + i * nsize, rp + (i + 1) * nsize, (num - i - 1) * nsize);
+  size_t sz = KVBLK_HDRSZ + idxsz + bufsz;
+  uint8_t kvbpow = KVBLK_INISZPOW;
+  while ((1ULL << kvbpow) < sz) {
+    ++kvbpow;
+  }
+  rc = _load_alloc(ld, SBLK_SZ + (1ULL << kvbpow), &addr);
+  RCRET(rc);
+
+  // Levels are assigned deterministically: every 2^n-th block is of level n
+  int lvl = iwbits_find_first_sbit64(++ld->bnum);
+  if (lvl >= SLEVELS) {
+    lvl = SLEVELS - 1;
+  }
+  kb.addr = addr + SBLK_SZ;
+  kb.maxoff = off;
+  kb.szpow = kvbpow;
+  SBLK sb = {
+    .db = lx->db,
+    .addr = addr,
+    .flags = SBLK_DURTY,
+    .lvl = lvl,
+    .p0 = ADDR2BLK(ld->paddr ? ld->paddr : lx->db->addr),
+    .kvblk = &kb,
+    .kvblkn = ADDR2BLK(kb.addr),
+    .pnum = ld->pnum
+  };
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  uint8_t *wp = mm + kb.addr + (1ULL << kvbpow);
+  off = 0;
+  for (int i = 0; i < ld->pnum; ++i) {
+    size_t sp;
+    uint32_t kl, kh;
+    IWKV_val key = { .data = (void *) pk[i].buf, .size = pk[i].len };
+    const uint8_t *vp = pk[i].buf + pk[i].len;
+    off += plen[i];
+    kb.pidx[i].off = off;
+    kb.pidx[i].len = plen[i];
+    kb.pidx[i].ridx = i;
+    sb.pi[i] = i;
+    wp -= plen[i];
+    // [klen:vn,key,value]
+    uint8_t *pp = wp;
+    kh = _kvblk_kh(&kb, &key, &kl);
+    IW_SETVNUMBUF(sp, pp, kh);
+    pp += sp;
+    memcpy(pp, pk[i].buf + (pk[i].len - kl), kl);
+    pp += kl;
+    memcpy(pp, vp, ld->buf + ld->poff[i] + ld->plen[i] - vp);
+  }
+  for (int i = ld->pnum; i < lx->db->pnmax; ++i) {
+    kb.pidx[i].ridx = i;
+  }
+  // Lower key is the first pair key
+  int32_t klen;
+  int step;
+  IW_READVNUMBUF(ld->buf, klen, step);
+  sb.lkl = MIN(lx->db->lklen, klen);
+  memcpy(sb.lk, ld->buf + step, sb.lkl);
+  if (klen <= lx->db->lklen) {
+    sb.flags |= SBLK_FULL_LKEY;
+  }
+  rc = _sblk_sync_mm(lx, &sb, mm);
+  if (!rc) {
+    blkn_t blkn = ADDR2BLK(addr);
+    for (int i = 0; i <= lvl; ++i) {
+      if (ld->laddr[i]) {
+        wp = mm + ld->laddr[i] + SOFF_N0_U4 + 4 * i;
+        IW_WRITELV(wp, lv, blkn);
+        fsm->dirty_mmap(fsm, ld->laddr[i] + SOFF_N0_U4 + 4 * i, 4);
+      } else {
+        lx->dblk.n[i] = blkn;
       }
-      --cache->num;
-      break;
+      ld->laddr[i] = addr;
     }
   }
+  fsm->release_mmap(fsm);
+  RCRET(rc);
+  if (lvl > lx->dblk.lvl) {
+    lx->dblk.lvl = lvl;
+  }
+  ld->lcnt[lvl]++;
+  ld->paddr = addr;
+  ld->pnum = 0;
+  ld->bufsz = 0;
+  return 0;
 }
 
-static void _dbcache_update_lw(IWLCTX *lx, SBLK *sblk) {
-  IWDB db = lx->db;
-  DBCACHE *cache = &db->cache;
-  assert(sblk->pnum > 0);
-  sblk->flags &= ~SBLK_CACHE_UPDATE;
-  cache->atime = lx->ts;
-  if (sblk->lvl < cache->lvl || cache->num < 1) {
-    return;
+static WUR iwrc _load_add(IWLOAD *ld, const IWKV_val *key, const IWKV_val *val) {
+  iwrc rc;
+  IWDB db = ld->lx->db;
+  if (!key->size) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  blkn_t sblkn = ADDR2BLK(sblk->addr);
-  size_t num = cache->num;
-  size_t nsize = cache->nsize;
-  uint8_t *rp = (uint8_t *) cache->nodes;
-  for (size_t i = 0; i < num; ++i) {
-    DBCNODE *n = (DBCNODE *)(rp + i * nsize);
-    if (sblkn == n->sblkn) {
-      n->kblkn = sblk->kvblkn;
-      n->lkl = sblk->lkl;
-      n->fullkey = (sblk->flags & SBLK_FULL_LKEY);
-      n->k0idx = sblk->pi[0];
-      memcpy((uint8_t *)n + offsetof(DBCNODE, lk), sblk->lk, sblk->lkl);
-      break;
+  if (((db->dbflg & IWDB_UINT32_KEYS) && key->size != 4) ||
+      ((db->dbflg & IWDB_UINT64_KEYS) && key->size != 8)) {
+    return IWKV_ERROR_KEY_NUM_VALUE_SIZE;
+  }
+  if (ld->bnum || ld->pnum) {
+    if (_db_cmp_key(db, ld->pk, ld->pksz, key->data, key->size) >= 0) {
+      return IWKV_ERROR_KEY_ORDER;
+    }
+  }
+  IWKV_val pval = { 0 };
+  if (db->dbflg & IWDB_COMPRESSED) {
+    rc = _db_val_pack(val, &pval);
+    RCRET(rc);
+    val = &pval;
+  } else if (db->dbflg & IWDB_OVERFLOW_VALS) {
+    // Extent is placed next to loaded blocks and released with them on failure
+    off_t addr = 0;
+    if (val->size > atomic_load_explicit(&db->ovl_threshold, memory_order_relaxed) && val->size <= UINT32_MAX) {
+      rc = _load_alloc(ld, OVL_EXTENT_SZ(val->size), &addr);
+      RCRET(rc);
     }
+    rc = _db_val_ovl_pack(db, val, addr, &pval);
+    RCRET(rc);
+    val = &pval;
+  }
+  size_t psz = IW_VNUMSIZE(key->size) + key->size + val->size;
+  if (psz > IWKV_MAX_KVSZ) {
+    _kv_val_dispose(&pval);
+    return IWKV_ERROR_MAXKVSZ;
+  }
+  if (ld->pnum >= db->pnmax || (ld->pnum && ld->bufsz + psz > LOAD_KVBLK_MAXSZ)) {
+    rc = _load_flush(ld);
+    RCGO(rc, finish);
   }
+  rc = _load_buf_ensure(&ld->buf, &ld->bufasz, ld->bufsz + psz);
+  RCGO(rc, finish);
+  rc = _load_buf_ensure(&ld->pk, &ld->pkasz, key->size);
+  RCGO(rc, finish);
+  memcpy(ld->pk, key->data, key->size);
+  ld->pksz = key->size;
+  // [klen:vn,key,value]
+  size_t sp;
+  uint8_t *wp = ld->buf + ld->bufsz;
+  IW_SETVNUMBUF(sp, wp, key->size);
+  wp += sp;
+  memcpy(wp, key->data, key->size);
+  wp += key->size;
+  memcpy(wp, val->data, val->size);
+  ld->poff[ld->pnum] = ld->bufsz;
+  ld->plen[ld->pnum] = psz;
+  ld->bufsz += psz;
+  ld->pnum++;
+finish:
+  _kv_val_dispose(&pval);
+  return rc;
 }
 
-//--------------------------  CURSOR
-
-IW_INLINE WUR iwrc _cursor_get_ge_idx(IWLCTX *lx, IWKV_cursor_op op, uint8_t *oidx) {
-  iwrc rc = _lx_find_bounds(lx);
-  RCRET(rc);
-  bool found;
-  uint8_t *mm, idx;
-  IWFS_FSM *fsm = &lx->db->iwkv->fsm;
+// Link loaded blocks into database block
+static WUR iwrc _load_finish_lw(IWLOAD *ld) {
+  iwrc rc;
+  uint8_t *mm;
+  IWLCTX *lx = ld->lx;
+  IWDB db = lx->db;
+  IWFS_FSM *fsm = &db->file->fsm;
+  LOADAREA *area = ld->anum ? &ld->areas[ld->anum - 1] : 0;
+  if (area && area->len > ld->aoff) {
+    rc = fsm->deallocate(fsm, area->addr + ld->aoff, area->len - ld->aoff);
+    RCRET(rc);
+    area->len = ld->aoff;
+  }
+  SBLK dbtail = {
+    .db = db,
+    .flags = SBLK_DB | SBLK_DURTY,
+    .p0 = ld->paddr ? ADDR2BLK(ld->paddr) : 0
+  };
   rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   RCRET(rc);
-  rc = _sblk_loadkvblk_mm(lx, lx->lower, mm);
-  RCGO(rc, finish);
-  rc = _sblk_find_pi_mm(lx->lower, lx->key, mm, &found, &idx);
-  RCGO(rc, finish);
-  if (found) {
-    *oidx = idx;
-  } else {
-    if (op == IWKV_CURSOR_EQ || (lx->lower->flags & SBLK_DB) || lx->lower->pnum < 1) {
-      rc = IWKV_ERROR_NOTFOUND;
-    } else {
-      *oidx = idx ? idx - 1 : idx;
-    }
+  memcpy(db->lcnt, ld->lcnt, sizeof(db->lcnt));
+  db->flags |= SBLK_DURTY;
+  lx->dblk.flags |= SBLK_DURTY;
+  _db_wseq_begin(db);
+  rc = _sblk_sync_mm(lx, &lx->dblk, mm);
+  if (!rc) {
+    rc = _sblk_sync_mm(lx, &dbtail, mm);
   }
-finish:
-  IWRC(fsm->release_mmap(fsm), rc);
+  _db_wseq_end(db);
+  fsm->release_mmap(fsm);
   return rc;
 }
 
-IW_INLINE WUR iwrc _cursor_to_lr(IWKV_cursor cur, IWKV_cursor_op op) {
+iwrc iwkv_bulk_load(IWDB db,
+                    iwrc(*next)(IWKV_val *key, IWKV_val *val, void *opaq),
+                    void *opaq,
+                    iwkv_opflags opflags) {
+  if (!db || !db->iwkv || !next) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  if (db->iwkv->oflags & IWKV_RDONLY) {
+    return IW_ERROR_READONLY;
+  }
+  if (db->dbflg & IWDB_DUP_FLAGS) {
+    return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
+  }
+  int rci;
   iwrc rc = 0;
-  IWDB db = cur->lx.db;
-  IWLCTX *lx = &cur->lx;
-  blkn_t dblk = ADDR2BLK(db->addr);
-  if (op < IWKV_CURSOR_NEXT) { // IWKV_CURSOR_BEFORE_FIRST | IWKV_CURSOR_AFTER_LAST
-    if (cur->cn) {
-      rc = _sblk_sync_and_release(lx, &cur->cn);
-      RCRET(rc);
-    }
-    if (op == IWKV_CURSOR_BEFORE_FIRST) {
-      cur->dbaddr = db->addr;
-      cur->cnpos = KVBLK_IDXNUM - 1;
-    } else {
-      cur->dbaddr = -1; // Negative as sign of dbtail
-      cur->cnpos = 0;
-    }
-    return 0;
+  SBLK *s;
+  IWLCTX lx = {
+    .db = db,
+    .nlvl = -1,
+    .op = IWLCTX_PUT,
+    .opflags = opflags
+  };
+  IWLOAD ld = { .lx = &lx };
+  IWFS_FSM *fsm = &db->file->fsm;
+  iwp_current_time_ms(&lx.ts);
+  API_DB_WLOCK(db, rci);
+  rc = _sblk_at(&lx, db->addr, 0, &s);
+  RCGO(rc, finish);
+  memcpy(&lx.dblk, s, sizeof(lx.dblk));
+  if (lx.dblk.n[0]) {
+    rc = IW_ERROR_INVALID_STATE;
+    goto finish;
   }
-start:
-  if (op < IWKV_CURSOR_EQ) { // IWKV_CURSOR_NEXT | IWKV_CURSOR_PREV
-    blkn_t n = 0;
-    if (!cur->cn) {
-      if (cur->dbaddr) {
-        rc = _sblk_at(lx, (cur->dbaddr < 0 ? 0 : cur->dbaddr), 0, &cur->cn);
-        cur->dbaddr = 0;
-        RCGO(rc, finish);
-      } else {
-        rc = IW_ERROR_INVALID_STATE;
-        goto finish;
-      }
-    }
-    if (op == IWKV_CURSOR_NEXT) {
-      if (cur->cnpos + 1 >= cur->cn->pnum) {
-        n = cur->cn->n[0];
-        if (!n) {
-          rc = IWKV_ERROR_NOTFOUND;
-          goto finish;
-        }
-        rc = _sblk_sync_and_release(lx, &cur->cn);
-        RCGO(rc, finish);
-        rc = _sblk_at(lx, BLK2ADDR(n), 0, &cur->cn);
-        RCGO(rc, finish);
-        cur->cnpos = 0;
-        if (IW_UNLIKELY(!cur->cn->pnum)) {
-          goto start;
-        }
-      } else {
-        if (cur->cn->flags & SBLK_DB) {
-          rc = IW_ERROR_INVALID_STATE;
-          goto finish;
-        }
-        ++cur->cnpos;
-      }
-    } else { // IWKV_CURSOR_PREV
-      if (cur->cnpos == 0) {
-        n = cur->cn->p0;
-        if (!n || n == dblk) {
-          rc = IWKV_ERROR_NOTFOUND;
-          goto finish;
-        }
-        rc = _sblk_sync_and_release(lx, &cur->cn);
-        RCGO(rc, finish);
-        rc = _sblk_at(lx, BLK2ADDR(n), 0, &cur->cn);
-        RCGO(rc, finish);
-        if (IW_LIKELY(cur->cn->pnum)) {
-          cur->cnpos = cur->cn->pnum - 1;
-        } else {
-          goto start;
-        }
-      } else {
-        if (cur->cn->flags & SBLK_DB) {
-          rc = IW_ERROR_INVALID_STATE;
-          goto finish;
-        }
-        --cur->cnpos;
-      }
-    }
-  } else { // IWKV_CURSOR_EQ | IWKV_CURSOR_GE
-    if (!lx->key) {
-      rc = IW_ERROR_INVALID_STATE;
-      goto finish;
+  while (1) {
+    IWKV_val key = { 0 }, val = { 0 };
+    rc = next(&key, &val, opaq);
+    if (rc == IWKV_ERROR_NOTFOUND) {
+      rc = 0;
+      break;
     }
-    rc = _cursor_get_ge_idx(lx, op, &cur->cnpos);
-    if (lx->upper) {
-      _sblk_release(lx, &lx->upper);
+    RCBREAK(rc);
+    rc = _load_add(&ld, &key, &val);
+    RCBREAK(rc);
+  }
+  if (!rc) {
+    rc = _load_flush(&ld);
+  }
+  if (!rc) {
+    rc = _load_finish_lw(&ld);
+  }
+  if (rc) { // Database block is not changed, release all loaded blocks
+    for (size_t i = 0; i < ld.anum; ++i) {
+      IWRC(fsm->deallocate(fsm, ld.areas[i].addr, ld.areas[i].len), rc);
+    }
+  } else {
+    if (atomic_load(&db->bloom)) {
+      rc = _bloom_build_lw(&lx);
     }
     if (!rc) {
-      cur->cn = lx->lower;
-      lx->lower = 0;
+      rc = _dbcache_fill_lw(&lx);
     }
   }
+
 finish:
-  if (rc && rc != IWKV_ERROR_NOTFOUND && cur->cn) {
-    _sblk_release(lx, &cur->cn);
+  API_DB_UNLOCK(db, rci, rc);
+  free(ld.buf);
+  free(ld.pk);
+  free(ld.areas);
+  if (!rc && (db->iwkv->wal || (opflags & IWKV_SYNC))) {
+    // Loaded records are not in WAL so checkpoint is required
+    rc = iwkv_sync(db->iwkv, IWFS_NO_MMASYNC);
   }
   return rc;
 }
 
-//--------------------------  PUBLIC API
+//--------------------------  COMPACTION
 
-static const char *_kv_ecodefn(locale_t locale, uint32_t ecode) {
-  if (!(ecode > _IWKV_ERROR_START && ecode < _IWKV_ERROR_END)) {
+/**
+ * @brief Copy block at `addr` into a free area located below it.
+ * @details Only free space available in file is used, its size is not changed.
+ * @param [out] naddr New block address or zero if there is no suitable free area
+ */
+static WUR iwrc _compact_copy(IWFS_FSM *fsm, off_t addr, off_t len, off_t *naddr) {
+  uint8_t *mm;
+  off_t oaddr = addr, olen = 0;
+  *naddr = 0;
+  // The lowest free area starting below `addr`
+  iwrc rc = fsm->allocate(fsm, len, &oaddr, &olen,
+                          IWFSM_ALLOC_LOWEST | IWFSM_ALLOC_NO_EXTEND | IWFSM_ALLOC_NO_OVERALLOCATE
+                          | IWFSM_SOLID_ALLOCATED_SPACE | IWFSM_ALLOC_NO_STATS);
+  if (rc == IWFS_ERROR_NO_FREE_SPACE) {
     return 0;
   }
-  switch (ecode) {
-  case IWKV_ERROR_NOTFOUND:
-    return "Key not found. (IWKV_ERROR_NOTFOUND)";
-  case IWKV_ERROR_KEY_EXISTS:
-    return "Key exists. (IWKV_ERROR_KEY_EXISTS)";
-  case IWKV_ERROR_MAXKVSZ:
-    return "Size of Key+value must be not greater than 0xfffffff bytes (IWKV_ERROR_MAXKVSZ)";
-  case IWKV_ERROR_CORRUPTED:
-    return "Database file invalid or corrupted (IWKV_ERROR_CORRUPTED)";
-  case IWKV_ERROR_DUP_VALUE_SIZE:
-    return "Value size is not compatible for insertion into sorted values array (IWKV_ERROR_DUP_VALUE_SIZE)";
-  case IWKV_ERROR_KEY_NUM_VALUE_SIZE:
-    return "Given key is not compatible to store as number (IWKV_ERROR_KEY_NUM_VALUE_SIZE)";
-  case IWKV_ERROR_INCOMPATIBLE_DB_MODE:
-    return "Incompatible database open mode (IWKV_ERROR_INCOMPATIBLE_DB_MODE)";
+  RCRET(rc);
+  assert(oaddr < addr);
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  if (rc) {
+    IWRC(fsm->deallocate(fsm, oaddr, olen), rc);
+    return rc;
   }
+  memcpy(mm + oaddr, mm + addr, len);
+  fsm->dirty_mmap(fsm, oaddr, len);
+  fsm->release_mmap(fsm);
+  *naddr = oaddr;
   return 0;
 }
 
-iwrc iwkv_init(void) {
-  static int _kv_initialized = 0;
-  if (!__sync_bool_compare_and_swap(&_kv_initialized, 0, 1)) {
-    return 0;
+/**
+ * @brief Relocate out of line value extents of `IWDB_OVERFLOW_VALS` database
+ *        referenced by `KVBLK` `kblkn` into free areas with lower addresses.
+ * @details Extent references stored in `KVBLK` pairs are patched in place,
+ *          so it must be called before `KVBLK` itself is relocated.
+ *
+ * @param [in,out] budget Remaining number of bytes allowed to be relocated
+ * @param [out] omoved Number of relocated extents
+ */
+static WUR iwrc _compact_kvblk_ovl_lw(IWDB db, blkn_t kblkn, uint64_t *budget, uint64_t *omoved) {
+  KVKEY k;
+  OGKVBLK kb;
+  uint8_t *mm;
+  size_t msize;
+  uint32_t lv;
+  int num = 0;
+  struct {
+    off_t soff;   // Offset of extent reference in stub
+    off_t addr;
+    off_t len;
+  } exts[KVBLK_IDXNUM_MAX];
+  IWFS_FSM *fsm = &db->file->fsm;
+
+  iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, &msize);
+  RCRET(rc);
+  if (!_oget_kvblk(mm, msize, kblkn, db->pnmax, &kb)) {
+    fsm->release_mmap(fsm);
+    rc = IWKV_ERROR_CORRUPTED;
+    iwlog_ecode_error3(rc);
+    return rc;
   }
-  return iwlog_register_ecodefn(_kv_ecodefn);
+  for (int i = 0; i < db->pnmax; ++i) {
+    off_t addr;
+    uint32_t len, vl;
+    const uint8_t *vp;
+    if (_oget_kvp(&kb, i, &k, &vp, &vl) && _ovl_extent(vp, vl, &addr, &len)) {
+      exts[num].soff = vp + 1 - mm;
+      exts[num].addr = addr;
+      exts[num++].len = OVL_EXTENT_SZ(len);
+    }
+  }
+  fsm->release_mmap(fsm);
+
+  for (int i = 0; i < num && *budget; ++i) {
+    off_t naddr;
+    rc = _compact_copy(fsm, exts[i].addr, exts[i].len, &naddr);
+    RCRET(rc);
+    if (!naddr) {
+      continue;
+    }
+    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+    RCRET(rc);
+    uint8_t *wp = mm + exts[i].soff;
+    IW_WRITELV(wp, lv, ADDR2BLK(naddr));
+    fsm->dirty_mmap(fsm, exts[i].soff, 4);
+    fsm->release_mmap(fsm);
+    rc = fsm->deallocate(fsm, exts[i].addr, exts[i].len);
+    RCRET(rc);
+    *budget = *budget > exts[i].len ? *budget - exts[i].len : 0;
+    ++(*omoved);
+  }
+  return rc;
 }
 
-iwrc iwkv_open(const IWKV_OPTS *opts, IWKV *iwkvp) {
-  assert(iwkvp && opts);
-  int rci;
-  iwrc rc = 0;
+/**
+ * @brief Relocate blocks of database into free areas with lower addresses.
+ * @details Level zero chain is traversed keeping the latest block of every level,
+ *          so references to relocated `SBLK` are patched in place:
+ *          `n[]` of previous blocks (or database block) and `p0` of the next block
+ *          (or database tail). Database block itself is never moved.
+ *          Out of line values of `IWDB_OVERFLOW_VALS` database are relocated
+ *          along with their `KVBLK`.
+ *
+ * @param [in,out] budget Remaining number of bytes allowed to be relocated
+ * @param [out] omoved Number of relocated blocks
+ */
+static WUR iwrc _compact_db_lw(IWLCTX *lx, uint64_t *budget, uint64_t *omoved) {
+  iwrc rc;
   uint32_t lv;
-  uint64_t llv;
-  uint8_t *rp, *mm;
-  rc = iw_init();
+  uint8_t *mm, *rp, *wp;
+  uint8_t lvl, kszpow = 0;
+  blkn_t n[SLEVELS] = { 0 }, kblkn, nblk;
+  off_t addr, naddr, len;
+  off_t prev[SLEVELS] = { 0 }; // Latest block on every level, zero for database block
+  IWDB db = lx->db;
+  IWFS_FSM *fsm = &db->file->fsm;
+
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   RCRET(rc);
-  if (opts->random_seed) {
-    iwu_rand_seed(opts->random_seed);
+  rp = mm + db->addr + DOFF_N0_U4;
+  IW_READLV(rp, lv, nblk);
+  fsm->release_mmap(fsm);
+
+  while (nblk && *budget) {
+    addr = BLK2ADDR(nblk);
+    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+    RCRET(rc);
+    memcpy(&lvl, mm + addr + SOFF_LVL_U1, 1);
+    if (lvl >= SLEVELS) {
+      fsm->release_mmap(fsm);
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      return rc;
+    }
+    rp = mm + addr + SOFF_KBLK_U4;
+    IW_READLV(rp, lv, kblkn);
+    if (kblkn) {
+      memcpy(&kszpow, mm + BLK2ADDR(kblkn) + KBLK_SZPOW_OFF, 1);
+    }
+    rp = mm + addr + SOFF_N0_U4;
+    for (int i = 0; i <= lvl; ++i) {
+      IW_READLV(rp, lv, n[i]);
+    }
+    fsm->release_mmap(fsm);
+
+    if (kblkn && (db->dbflg & IWDB_OVERFLOW_VALS)) {
+      rc = _compact_kvblk_ovl_lw(db, kblkn, budget, omoved);
+      RCRET(rc);
+    }
+    if (kblkn) {
+      len = 1ULL << kszpow;
+      rc = _compact_copy(fsm, BLK2ADDR(kblkn), len, &naddr);
+      RCRET(rc);
+      if (naddr) {
+        rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+        RCRET(rc);
+        wp = mm + addr + SOFF_KBLK_U4;
+        IW_WRITELV(wp, lv, ADDR2BLK(naddr));
+        fsm->dirty_mmap(fsm, addr + SOFF_KBLK_U4, 4);
+        fsm->release_mmap(fsm);
+        rc = fsm->deallocate(fsm, BLK2ADDR(kblkn), len);
+        RCRET(rc);
+        *budget = *budget > len ? *budget - len : 0;
+        ++(*omoved);
+      }
+    }
+
+    rc = _compact_copy(fsm, addr, SBLK_SZ, &naddr);
+    RCRET(rc);
+    if (naddr) {
+      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+      RCRET(rc);
+      for (int i = 0; i <= lvl; ++i) {
+        off_t woff = prev[i] ? prev[i] + SOFF_N0_U4 + 4 * i : db->addr + DOFF_N0_U4 + 4 * i;
+        wp = mm + woff;
+        IW_WRITELV(wp, lv, ADDR2BLK(naddr));
+        fsm->dirty_mmap(fsm, woff, 4);
+      }
+      off_t woff = n[0] ? BLK2ADDR(n[0]) + SOFF_P0_U4 : db->addr + DOFF_P0_U4;
+      wp = mm + woff;
+      IW_WRITELV(wp, lv, ADDR2BLK(naddr));
+      fsm->dirty_mmap(fsm, woff, 4);
+      fsm->release_mmap(fsm);
+      rc = fsm->deallocate(fsm, addr, SBLK_SZ);
+      RCRET(rc);
+      *budget = *budget > SBLK_SZ ? *budget - SBLK_SZ : 0;
+      ++(*omoved);
+      addr = naddr;
+    }
+    for (int i = 0; i <= lvl; ++i) {
+      prev[i] = addr;
+    }
+    nblk = n[0];
   }
-  *iwkvp = calloc(1, sizeof(struct IWKV));
-  if (!*iwkvp) {
-    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  return rc;
+}
+
+iwrc iwkv_compact(IWKV iwkv, uint64_t budget, bool *odone) {
+  if (!iwkv) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  IWKV iwkv = *iwkvp;
-  rci = pthread_rwlock_init(&iwkv->rwl, 0);
-  if (rci) {
-    free(*iwkvp);
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  if (iwkv->oflags & IWKV_RDONLY) {
+    return IW_ERROR_READONLY;
   }
-  rci = pthread_mutex_init(&iwkv->wk_mtx, 0);
-  if (rci) {
-    pthread_rwlock_destroy(&iwkv->rwl);
-    free(*iwkvp);
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  int rci;
+  iwrc rc = 0;
+  bool done = true;
+  uint64_t moved = 0;
+  if (!budget) {
+    budget = UINT64_MAX;
   }
-  rci = pthread_cond_init(&iwkv->wk_cond, 0);
-  if (rci) {
-    pthread_rwlock_destroy(&iwkv->rwl);
-    pthread_mutex_destroy(&iwkv->wk_mtx);
-    free(*iwkvp);
-    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  if (odone) {
+    *odone = false;
   }
-  iwkv_openflags oflags = opts->oflags;
-  iwfs_omode omode = IWFS_OREAD;
-  if (oflags & IWKV_TRUNC) {
-    oflags &= ~IWKV_RDONLY;
-    omode |= IWFS_OTRUNC;
+  API_RLOCK(iwkv, rci);
+  for (int i = 0; i < iwkv->files_num && budget && !rc; ++i) {
+    IWKV_FILE *file = &iwkv->files[i];
+    IWFS_FSM *fsm = &file->fsm;
+    // Return blocks cached by FSM to free-space map before looking for holes
+    rc = fsm->trim(fsm);
+    RCBREAK(rc);
+    for (IWDB db = file->first_db; db && budget; db = db->next) {
+      uint64_t dbmoved = 0;
+      IWLCTX lx = {
+        .db = db,
+        .nlvl = -1
+      };
+      iwp_current_time_ms(&lx.ts);
+      rci = pthread_rwlock_wrlock(&db->rwl);
+      if (rci) {
+        rc = iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+        break;
+      }
+      if (atomic_load(&db->pins)) {
+        // Open cursors and views keep addresses of database blocks
+        done = false;
+        pthread_rwlock_unlock(&db->rwl);
+        continue;
+      }
+      _db_wseq_begin(db);
+      rc = _compact_db_lw(&lx, &budget, &dbmoved);
+      if (dbmoved && db->cache.open) {
+        IWRC(_dbcache_fill_lw(&lx), rc);
+      }
+      _db_wseq_end(db);
+      pthread_rwlock_unlock(&db->rwl);
+      moved += dbmoved;
+      RCBREAK(rc);
+    }
+    if (!rc) {
+      rc = fsm->trim(fsm);
+    }
   }
-  if (!(oflags & IWKV_RDONLY)) {
-    omode |= IWFS_OWRITE;
+  if (!rc && odone) {
+    *odone = done && !moved;
   }
-  iwkv->oflags = oflags;
-  IWFS_FSM_STATE fsmstate;
-  IWFS_FSM_OPTS fsmopts = {
-    .exfile = {
-      .file = {
-        .path       = opts->path,
-        .omode      = omode,
-        .lock_mode  = (oflags & IWKV_RDONLY) ? IWP_RLOCK : IWP_WLOCK
-      },
-      .rspolicy     = iw_exfile_szpolicy_fibo,
-      .maxoff       = IWKV_MAX_DBSZ
-    },
-    .bpow = IWKV_FSM_BPOW,      // 64 bytes block size
-    .hdrlen = KVHDRSZ,          // Size of custom file header
-    .oflags = ((oflags & (IWKV_NOLOCKS | IWKV_RDONLY)) ? IWFSM_NOLOCKS : 0),
-    .mmap_all = true
+  API_UNLOCK(iwkv, rci, rc);
+  if (!rc && moved && iwkv->wal) {
+    // Relocations are not in WAL so checkpoint is required
+    rc = iwkv_sync(iwkv, IWFS_NO_MMASYNC);
+  }
+  return rc;
+}
+
+static iwrc _get(IWDB db, const IWKV_val *key, IWKV_val *oval, IWPOOL *pool) {
+  if (!db || !db->iwkv || !key || !oval) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  int rci;
+  iwrc rc = 0;
+  _dbstat_add(db, DBS_GETS, 1);
+  IWLCTX lx = {
+    .db = db,
+    .key = key,
+    .val = oval,
+    .pool = pool,
+    .nlvl = -1
   };
-#if defined(IW_TESTS) && !defined(IW_RELEASE)
-  fsmopts.oflags |= IWFSM_STRICT;
-#endif
+  iwp_current_time_ms(&lx.ts);
+  oval->size = 0;
+  bool shm_reader = SHM_READER(db->iwkv);
+  if (!shm_reader && _bloom_absent(db, key)) {
+    oval->data = 0;
+    return IWKV_ERROR_NOTFOUND;
+  }
+  bool rcache = _rcache_enabled(db);
+  uint64_t rgen = 0;
+  if (rcache) {
+    bool hit;
+    rc = _rcache_get(db, key, oval, pool, &rgen, &hit);
+    if (hit || rc) {
+      return rc;
+    }
+  }
+  if (shm_reader) {
+    rc = _shm_get(&lx);
+    goto decode;
+  }
+  if (IW_LIKELY(db->cache.open)) {
+    bool done;
+    rc = _oget(&lx, &done);
+    if (done || rc) {
+      goto decode;
+    }
+    API_DB_RLOCK(db, rci);
+  } else {
+    API_DB_WLOCK(db, rci);
+    if (!db->cache.open) {
+      rc = _dbcache_fill_lw(&lx);
+      RCGO(rc, finish);
+    }
+  }
+  rc = _lx_get_lr(&lx);
+finish:
+  API_DB_UNLOCK(db, rci, rc);
+decode:
+  if (!rc) {
+    rc = _db_val_decode(db, oval, pool);
+    if (!rc && rcache) {
+      _rcache_put(db, key, oval, rgen);
+    }
+  }
+  return rc;
+}
 
-  rc = iwfs_fsmfile_open(&iwkv->fsm, &fsmopts);
-  RCGO(rc, finish);
-  IWFS_FSM *fsm  = &iwkv->fsm;
-  iwkv->dbs = kh_init(DBS);
-  rc = fsm->state(fsm, &fsmstate);
-  RCGO(rc, finish);
+iwrc iwkv_get(IWDB db, const IWKV_val *key, IWKV_val *oval) {
+  return _get(db, key, oval, 0);
+}
 
-  if (fsmstate.exfile.file.ostatus & IWFS_OPEN_NEW) {
-    // Write magic number
-    lv = IWKV_MAGIC;
-    lv = IW_HTOIL(lv);
-    rc = fsm->writehdr(fsm, 0, &lv, sizeof(lv));
-    RCGO(rc, finish);
-    fsm->sync(fsm, 0);
-  } else {
-    uint8_t hdr[KVHDRSZ];
-    rc = fsm->readhdr(fsm, 0, hdr, KVHDRSZ);
-    RCGO(rc, finish);
-    rp = hdr;
-    memcpy(&lv, rp, sizeof(lv));
-    rp += sizeof(lv);
-    lv = IW_ITOHL(lv);
-    if (lv != IWKV_MAGIC) {
+iwrc iwkv_get_pooled(IWDB db, const IWKV_val *key, IWKV_val *oval, IWPOOL *pool) {
+  if (!pool) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  return _get(db, key, oval, pool);
+}
+
+/**
+ * @brief Lookup of sorted `iwkv_get_many()` keys.
+ * @details Lower blocks of the previous key are kept for every level.
+ *          The next key search climbs from the lowest level until a level
+ *          where the next key is still below the upper block of the previous key,
+ *          then descends from the lower block of that level. If key is far enough
+ *          to pass all not cached levels database cache is used instead.
+ *          Database lock must be held by caller, mmaped area is acquired once.
+ */
+static WUR iwrc _lx_get_many_lr(IWLCTX *lx, const KVPTR *kvs, size_t n, IWKV_val *ovals, iwrc *orcs) {
+  iwrc rc;
+  uint8_t *mm;
+  size_t msize;
+  IWDB db = lx->db;
+  DBCACHE *cache = &db->cache;
+  IWFS_FSM *fsm = &db->file->fsm;
+  const uint8_t *path[SLEVELS] = { 0 }; // Lower blocks of the previous key, zero for database block
+  cache->atime = lx->ts;
+  rc = fsm->acquire_mmap(fsm, 0, &mm, &msize);
+  RCRET(rc);
+  if (db->addr + DOFF_END > msize) {
+    rc = IWKV_ERROR_CORRUPTED;
+    goto finish;
+  }
+  int top = _oget_db_levels(db, mm);
+  for (size_t i = 0; i < n; ++i) {
+    int lvl, start, cret;
+    blkn_t blkn;
+    iwrc vrc = 0;
+    uint64_t skey = 0;
+    const uint8_t *lp, *sp;
+    const IWKV_val *key = kvs[i].key;
+    size_t vi = kvs[i].val - ovals;
+    if (db->dbflg & IWDB_UINT_KEYS_FLAGS) {
+      skey = _uint_key(db->dbflg, key->data);
+    }
+    // Climb up from the previous key position
+    bool found = false;
+    for (lvl = 0; i && lvl < top; ++lvl) {
+      if (lvl && cache->num && lvl >= cache->lvl) {
+        break;
+      }
+      const uint8_t *np = path[lvl] ? path[lvl] + SOFF_N0_U4 : mm + db->addr + DOFF_N0_U4;
+      memcpy(&blkn, np + 4 * lvl, 4);
+      blkn = IW_ITOHL(blkn);
+      if (blkn) {
+        if (!_oget_sblk_cmp(db, key, skey, mm, msize, blkn, lvl, &sp, &cret)) {
+          rc = IWKV_ERROR_CORRUPTED;
+          goto finish;
+        }
+      }
+      if (!blkn || cret > 0) { // upper > key
+        found = true;
+        break;
+      }
+    }
+    if (found) {
+      // Previous lower block of `lvl` is the lower block of key
+      start = lvl - 1;
+      lp = path[lvl];
+    } else if (cache->num) {
+      lx->key = key;
+      rc = _dbcache_find(lx, &blkn);
+      RCGO(rc, finish);
+      if (blkn) {
+        if (BLK2ADDR(blkn) + SBLK_SZ > msize) {
+          rc = IWKV_ERROR_CORRUPTED;
+          goto finish;
+        }
+        lp = mm + BLK2ADDR(blkn);
+        start = MIN(lp[SOFF_LVL_U1], top - 1);
+      } else {
+        lp = 0;
+        start = top - 1;
+      }
+    } else {
+      start = top - 1;
+      lp = (top > 0) ? path[start] : 0;
+    }
+    if (!_oget_descend(db, key, skey, mm, msize, start, lp, path, &lp)
+        || !_oget_sblk_get(db, key, skey, mm, msize, lp, &ovals[vi], &vrc, 0)) {
       rc = IWKV_ERROR_CORRUPTED;
-      iwlog_ecode_error3(rc);
       goto finish;
     }
-    memcpy(&llv, rp, sizeof(llv));
-    llv = IW_ITOHLL(llv);
-    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
-    RCGO(rc, finish);
-    rc = _db_load_chain(iwkv, llv, mm);
-    fsm->release_mmap(fsm);
+    if (vrc && vrc != IWKV_ERROR_NOTFOUND) {
+      rc = vrc;
+      goto finish;
+    }
+    orcs[vi] = vrc;
   }
-  (*iwkvp)->open = true;
+
 finish:
-  if (rc) {
-    (*iwkvp)->open = true; // will be closed in iwkv_close
-    IWRC(iwkv_close(iwkvp), rc);
+  if (rc == IWKV_ERROR_CORRUPTED) {
+    iwlog_ecode_error3(rc);
   }
+  IWRC(fsm->release_mmap(fsm), rc);
   return rc;
 }
 
-iwrc iwkv_close(IWKV *iwkvp) {
-  ENSURE_OPEN((*iwkvp));
-  int rci;
-  IWKV iwkv = *iwkvp;
-  iwkv->open = false;
-  iwrc rc = _wnw(iwkv, _wnw_iwkw_wl);
-  RCRET(rc);
-  IWDB db = iwkv->first_db;
-  while (db) {
-    IWDB ndb = db->next;
-    _db_release_lw(&db);
-    db = ndb;
+iwrc iwkv_get_many(IWDB db, const IWKV_val *keys, size_t n, IWKV_val *ovals, iwrc *orcs) {
+  if (!db || !db->iwkv || (n && (!keys || !ovals || !orcs))) {
+    return IW_ERROR_INVALID_ARGS;
   }
-  IWRC(iwkv->fsm.close(&iwkv->fsm), rc);
-  if (iwkv->dbs) {
-    kh_destroy(DBS, iwkv->dbs);
-    iwkv->dbs = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const IWKV_val *key = &keys[i];
+    if (!key->size) {
+      return IW_ERROR_INVALID_ARGS;
+    }
+    if (((db->dbflg & IWDB_UINT32_KEYS) && key->size != 4) ||
+        ((db->dbflg & IWDB_UINT64_KEYS) && key->size != 8)) {
+      return IWKV_ERROR_KEY_NUM_VALUE_SIZE;
+    }
+    ovals[i].data = 0;
+    ovals[i].size = 0;
+    orcs[i] = 0;
   }
-  API_UNLOCK(iwkv, rci, rc);
-  pthread_rwlock_destroy(&iwkv->rwl);
-  pthread_mutex_destroy(&iwkv->wk_mtx);
-  pthread_cond_destroy(&iwkv->wk_cond);
-  free(iwkv);
-  *iwkvp = 0;
-  return rc;
-}
-
-iwrc iwkv_sync(IWKV iwkv, iwfs_sync_flags _flags) {
-  ENSURE_OPEN(iwkv);
-  if (iwkv->oflags & IWKV_RDONLY) {
-    return IW_ERROR_READONLY;
+  if (!n) {
+    return 0;
   }
-  iwrc rc = 0;
-  IWFS_FSM *fsm  = &iwkv->fsm;
-  pthread_rwlock_rdlock(&iwkv->rwl);
-  iwfs_sync_flags flags = IWFS_FDATASYNC | _flags;
-  IWRC(fsm->sync(fsm, flags), rc);
-  pthread_rwlock_unlock(&iwkv->rwl);
-  return rc;
-}
-
-iwrc iwkv_db(IWKV iwkv, uint32_t dbid, iwdb_flags_t dbflg, IWDB *dbp) {
   int rci;
   iwrc rc = 0;
-  IWDB db = 0;
-  *dbp = 0;
-  API_RLOCK(iwkv, rci);
-  khiter_t ki = kh_get(DBS, iwkv->dbs, dbid);
-  if (ki != kh_end(iwkv->dbs)) {
-    db = kh_value(iwkv->dbs, ki);
+  if (SHM_READER(db->iwkv)) {
+    // Every lookup of reader process is validated separately
+    for (size_t i = 0; !rc && i < n; ++i) {
+      orcs[i] = _get(db, &keys[i], &ovals[i], 0);
+      if (orcs[i] != IWKV_ERROR_NOTFOUND) {
+        rc = orcs[i];
+      }
+    }
+    if (rc) {
+      for (size_t i = 0; i < n; ++i) {
+        _kv_val_dispose(&ovals[i]);
+      }
+    }
+    return rc;
   }
-  API_UNLOCK(iwkv, rci, rc);
-  RCRET(rc);
-  if (db) {
-    if (db->dbflg != dbflg) {
-      return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
+  _dbstat_add(db, DBS_GETS, n);
+  KVPTR *kvs = malloc(2 * n * sizeof(*kvs));
+  if (!kvs) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  size_t m = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (_bloom_absent(db, &keys[i])) {
+      orcs[i] = IWKV_ERROR_NOTFOUND;
+      continue;
     }
-    *dbp = db;
+    kvs[m].key = &keys[i];
+    kvs[m].val = &ovals[i];
+    kvs[m].db = db;
+    ++m;
+  }
+  if (!m) {
+    free(kvs);
     return 0;
   }
-  if (iwkv->oflags & IWKV_RDONLY) {
-    return IW_ERROR_READONLY;
+  ks_mergesort_kvptr(m, kvs, kvs + m);
+
+  IWLCTX lx = {
+    .db = db,
+    .nlvl = -1
+  };
+  iwp_current_time_ms(&lx.ts);
+  _db_pin(db);
+  if (IW_LIKELY(db->cache.open)) {
+    rc = _api_db_rlock(db);
+  } else {
+    rc = _api_db_wlock(db);
+    if (!rc && !db->cache.open) {
+      rc = _dbcache_fill_lw(&lx);
+      if (rc) {
+        API_DB_UNLOCK(db, rci, rc);
+      }
+    }
   }
-  API_WLOCK(iwkv, rci);
-  ki = kh_get(DBS, iwkv->dbs, dbid);
-  if (ki != kh_end(iwkv->dbs)) {
-    db = kh_value(iwkv->dbs, ki);
+  if (rc) {
+    _db_unpin(db);
+    free(kvs);
+    return rc;
   }
-  if (db) {
-    if (db->dbflg != dbflg) {
-      return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
+  rc = _lx_get_many_lr(&lx, kvs, m, ovals, orcs);
+  API_DB_UNLOCK(db, rci, rc);
+  _db_unpin(db);
+  free(kvs);
+  for (size_t i = 0; !rc && i < n; ++i) {
+    if (!orcs[i]) {
+      rc = _db_val_decode(db, &ovals[i], 0);
     }
-    *dbp = db;
-  } else {
-    rc = _db_create_lw(iwkv, dbid, dbflg, dbp);
   }
-  API_UNLOCK(iwkv, rci, rc);
-  return rc;
-}
-
-iwrc iwkv_db_cache_release(IWDB db) {
-  if (!db || !db->iwkv) {
-    return IW_ERROR_INVALID_ARGS;
+  if (rc) {
+    for (size_t i = 0; i < n; ++i) {
+      _kv_val_dispose(&ovals[i]);
+    }
   }
-  int rci;
-  iwrc rc = 0;
-  API_DB_WLOCK(db, rci);
-  _dbcache_destroy_lw(db);
-  API_DB_UNLOCK(db, rci, rc);
   return rc;
 }
 
-iwrc iwkv_db_last_access_time(const IWDB db, uint64_t *ts) {
-  if (!db || !db->iwkv || !ts) {
+iwrc iwkv_get_view(IWDB db, const IWKV_val *key, IWKV_val *oval) {
+  if (!db || !db->iwkv || !key || !oval) {
     return IW_ERROR_INVALID_ARGS;
   }
+  if (db->dbflg & IWDB_COMPRESSED) {
+    return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
+  }
+  if (SHM_READER(db->iwkv)) {
+    // Mmaped data may be modified by writer process at any time
+    return IW_ERROR_NOT_IMPLEMENTED;
+  }
   int rci;
   iwrc rc = 0;
-  API_DB_RLOCK(db, rci);
-  if (db->cache.open)   {
-    *ts = db->cache.atime;
-  } else {
-    *ts = 0;
+  _dbstat_add(db, DBS_GETS, 1);
+  IWLCTX lx = {
+    .db = db,
+    .key = key,
+    .val = oval,
+    .nlvl = -1
+  };
+  iwp_current_time_ms(&lx.ts);
+  oval->data = 0;
+  oval->size = 0;
+  if (IW_UNLIKELY(!db->cache.open)) {
+    // Fill cache under write lock then reacquire read lock for the view
+    API_DB_WLOCK(db, rci);
+    if (!db->cache.open) {
+      rc = _dbcache_fill_lw(&lx);
+    }
+    API_DB_UNLOCK(db, rci, rc);
+    RCRET(rc);
+  }
+  // Leaf writers are disabled until view is released
+  _db_pin(db);
+  rc = _api_db_rlock(db);
+  if (rc) {
+    _db_unpin(db);
+    return rc;
+  }
+  rc = _lx_get_view_lr(&lx);
+  if (rc) {
+    API_DB_UNLOCK(db, rci, rc);
+    _db_unpin(db);
   }
-  API_DB_UNLOCK(db, rci, rc);
   return rc;
 }
 
-iwrc iwkv_db_destroy(IWDB *dbp) {
-  if (!dbp || !*dbp) {
+iwrc iwkv_view_release(IWDB db, IWKV_val *view) {
+  if (!db || !db->iwkv || !view) {
     return IW_ERROR_INVALID_ARGS;
   }
   int rci;
-  IWDB db = *dbp;
-  IWKV iwkv = db->iwkv;
-  if (iwkv->oflags & IWKV_RDONLY) {
-    return IW_ERROR_READONLY;
-  }
-  iwrc rc = _wnw(iwkv, _wnw_iwkw_wl);
-  RCGO(rc, finish);
-  rc = _iwkv_worker_inc_nolk(iwkv);
-  if (!rc) {
-    rc = _db_destroy_lw(dbp);
-  }
-  API_UNLOCK(iwkv, rci, rc);
-finish:
+  IWFS_FSM *fsm = &db->file->fsm;
+  iwrc rc = fsm->release_mmap(fsm);
+  API_DB_UNLOCK(db, rci, rc);
+  _db_unpin(db);
+  view->data = 0;
+  view->size = 0;
   return rc;
 }
 
-iwrc iwkv_put(IWDB db, const IWKV_val *key, const IWKV_val *val, iwkv_opflags opflags) {
-  if (!db || !db->iwkv || !key || !key->size || !val) {
+iwrc iwkv_del(IWDB db, const IWKV_val *key) {
+  if (!db || !db->iwkv || !key) {
     return IW_ERROR_INVALID_ARGS;
   }
-  if (db->iwkv->oflags & IWKV_RDONLY) {
-    return IW_ERROR_READONLY;
-  }
-  if (((db->dbflg & IWDB_UINT32_KEYS) && key->size != 4) ||
-      ((db->dbflg & IWDB_UINT64_KEYS) && key->size != 8)) {
-    return IWKV_ERROR_KEY_NUM_VALUE_SIZE;
-  }
   int rci;
+  bool done;
   iwrc rc = 0;
+  uint64_t lsn = 0;
+  _dbstat_add(db, DBS_DELS, 1);
   IWLCTX lx = {
     .db = db,
     .key = key,
-    .val = (IWKV_val *) val,
     .nlvl = -1,
-    .op = IWLCTX_PUT,
-    .opflags = opflags
+    .op = IWLCTX_DEL
   };
+  if (_bloom_absent(db, key)) {
+    return IWKV_ERROR_NOTFOUND;
+  }
   iwp_current_time_ms(&lx.ts);
+  rc = _iwkv_leaf_op(&lx, &lsn, &done);
+  if (done || rc) {
+    goto sync;
+  }
   API_DB_WLOCK(db, rci);
   if (!db->cache.open) {
     rc = _dbcache_fill_lw(&lx);
     RCGO(rc, finish);
   }
-  rc = _lx_put_lw(&lx);
+  _db_wseq_begin(db);
+  rc = _lx_del_lw(&lx);
+  _db_wseq_end(db);
+  if (!rc && db->iwkv->wal) {
+    rc = iwal_add(db->iwkv->wal, WOP_DEL, db->id, 0, key, 0, &lsn);
+  }
 finish:
   API_DB_UNLOCK(db, rci, rc);
+sync:
   if (!rc && (lx.opflags & IWKV_SYNC)) {
-    rc = iwkv_sync(lx.db->iwkv, IWFS_NO_MMASYNC);
+    rc = _iwkv_sync_op(lx.db->iwkv, lsn);
   }
   return rc;
 }
 
-iwrc iwkv_get(IWDB db, const IWKV_val *key, IWKV_val *oval) {
-  if (!db || !db->iwkv || !key || !oval) {
-    return IW_ERROR_INVALID_ARGS;
-  }
-  int rci;
-  iwrc rc = 0;
-  IWLCTX lx = {
-    .db = db,
-    .key = key,
-    .val = oval,
-    .nlvl = -1
-  };
-  iwp_current_time_ms(&lx.ts);
-  oval->size = 0;
-  if (IW_LIKELY(db->cache.open)) {
-    API_DB_RLOCK(db, rci);
+//--------------------------  RANGE DELETE
+
+/** Blocks of keys range removed by `iwkv_del_range()` */
+typedef struct DELRANGE {
+  struct {
+    off_t addr;               /**< Block with some keys out of range */
+    uint8_t s;                /**< First removed `pi` position */
+    uint8_t e;                /**< Next after the last removed `pi` position */
+  } parts[2];
+  int np;                     /**< Number of partially removed blocks */
+  off_t faddr;                /**< First block of run of blocks with all keys in range */
+  off_t laddr;                /**< Last block of run */
+  blkn_t fp0;                 /**< Previous block of run at level 0 */
+  int8_t mlvl;                /**< Highest level of run blocks, `-1` if run is empty */
+  blkn_t nn[SLEVELS];         /**< Next block after run per level */
+  uint32_t lcnt[SLEVELS];     /**< Number of run blocks per level */
+} DELRANGE;
+
+// Collect blocks holding keys in range `[from, to)`
+static WUR iwrc _delrange_scan(IWLCTX *lx, const IWKV_val *from, const IWKV_val *to, DELRANGE *dr) {
+  iwrc rc;
+  uint8_t *mm, s = 0;
+  off_t addr;
+  SBLK sb;
+  IWFS_FSM *fsm = &lx->db->file->fsm;
+
+  memset(&sb, 0, sizeof(sb));
+  memset(dr, 0, sizeof(*dr));
+  dr->mlvl = -1;
+  if (to) {
+    lx->key = to;
+    rc = _lx_find_bounds(lx);
+    RCRET(rc);
+    SBLK *lower = lx->lower;
+    if (lower->flags & SBLK_DB) {
+      addr = BLK2ADDR(lower->n[0]);
+    } else {
+      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+      if (!rc) {
+        rc = _sblk_pos_lt_mm(lx, lower, to, mm, &s);
+        fsm->release_mmap(fsm);
+      }
+      if (s < lower->pnum) {
+        addr = lower->addr;
+      } else {
+        addr = BLK2ADDR(lower->n[0]);
+        s = 0;
+      }
+    }
+    _lx_release_mm(lx, 0);
+    RCRET(rc);
   } else {
-    API_DB_WLOCK(db, rci);
-    if (!db->cache.open) {
-      rc = _dbcache_fill_lw(&lx);
-      RCGO(rc, finish);
+    rc = _sblk_at2(lx, lx->db->addr, 0, &sb);
+    RCRET(rc);
+    addr = BLK2ADDR(sb.n[0]);
+  }
+  while (addr) {
+    KVKEY k;
+    uint8_t e;
+    rc = _sblk_at2(lx, addr, 0, &sb);
+    RCRET(rc);
+    if (IW_UNLIKELY(sb.pnum < 1)) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      return rc;
+    }
+    e = sb.pnum;
+    if (from) {
+      rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+      RCRET(rc);
+      rc = _sblk_loadkvblk_mm(lx, &sb, mm);
+      if (!rc) {
+        rc = _kvblk_peek_key(sb.kvblk, sb.pi[sb.pnum - 1], mm, &k);
+      }
+      if (!rc && _db_cmp_kvkey(lx->db, &k, from->data, from->size) > 0) {
+        // Range ends in this block
+        rc = _sblk_pos_lt_mm(lx, &sb, from, mm, &e);
+      }
+      fsm->release_mmap(fsm);
+      RCRET(rc);
+    }
+    if (s == 0 && e == sb.pnum) {
+      if (dr->mlvl < 0) {
+        dr->faddr = addr;
+        dr->fp0 = sb.p0;
+      }
+      dr->laddr = addr;
+      for (int i = 0; i <= sb.lvl; ++i) {
+        dr->nn[i] = sb.n[i];
+      }
+      dr->lcnt[sb.lvl]++;
+      dr->mlvl = MAX(dr->mlvl, sb.lvl);
+    } else if (s < e) {
+      assert(dr->np < 2);
+      dr->parts[dr->np].addr = addr;
+      dr->parts[dr->np].s = s;
+      dr->parts[dr->np].e = e;
+      ++dr->np;
+    }
+    if (e < sb.pnum) {
+      break;
+    }
+    addr = BLK2ADDR(sb.n[0]);
+    s = 0;
+  }
+  return 0;
+}
+
+// Remove keys of partially covered block
+static WUR iwrc _delrange_part_lw(IWLCTX *lx, off_t addr, uint8_t s, uint8_t e) {
+  SBLK *sblk;
+  iwrc rc = _sblk_at(lx, addr, 0, &sblk);
+  RCRET(rc);
+  rc = _sblk_loadkvblk(lx, sblk);
+  RCRET(rc);
+  for (int i = e - 1; i >= s; --i) {
+    // Block is shrunk only once by the last removal
+    rc = _sblk_rmkv(sblk, i, i > s ? RMKV_NO_RESIZE : 0);
+    RCRET(rc);
+  }
+  return _sblk_sync_and_release(lx, &sblk);
+}
+
+// Unlink run of blocks from skip list and dispose them
+static WUR iwrc _delrange_run_lw(IWLCTX *lx, DELRANGE *dr) {
+  iwrc rc;
+  uint8_t *mm;
+  SBLK *sblk;
+  IWKV_val fkey = { 0 };
+  IWDB db = lx->db;
+  IWFS_FSM *fsm = &db->file->fsm;
+
+  // Full lower key of the first run block is required to find its predecessors
+  rc = _sblk_at(lx, dr->faddr, 0, &sblk);
+  RCRET(rc);
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  rc = _sblk_loadkvblk_mm(lx, sblk, mm);
+  if (!rc) {
+    rc = _kvblk_getkey(sblk->kvblk, mm, sblk->pi[0], &fkey, 0);
+  }
+  fsm->release_mmap(fsm);
+  _sblk_release(lx, &sblk);
+  RCRET(rc);
+
+  lx->key = &fkey;
+  lx->nlvl = dr->mlvl;
+  lx->upper_addr = dr->faddr;
+  rc = _lx_find_bounds(lx);
+  RCGO(rc, finish);
+  for (int i = 0; i <= lx->nlvl; ++i) {
+    lx->plower[i]->n[i] = dr->nn[i];
+    lx->plower[i]->flags |= SBLK_DURTY;
+    if (lx->plower[i]->flags & SBLK_DB) {
+      if (!lx->plower[i]->n[i]) {
+        --lx->plower[i]->lvl;
+      }
     }
   }
-  rc = _lx_get_lr(&lx);
+  rc = _sblk_at(lx, BLK2ADDR(dr->nn[0]), 0, &lx->nb);
+  RCGO(rc, finish);
+  lx->nb->p0 = dr->fp0;
+  lx->nb->flags |= SBLK_DURTY;
+  for (int i = 0; i < SLEVELS; ++i) {
+    db->lcnt[i] -= dr->lcnt[i];
+  }
+  lx->dblk.flags |= SBLK_DURTY;
+
 finish:
-  API_DB_UNLOCK(db, rci, rc);
-  return rc;
+  if (rc) {
+    _lx_release_mm(lx, 0);
+  } else {
+    rc = _lx_release(lx);
+  }
+  lx->key = 0;
+  free(fkey.data);
+  RCRET(rc);
+
+  // Detach run from the rest of chain then dispose it
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  _snap_keep(db, mm, dr->laddr, SBLK_SZ);
+  memset(mm + dr->laddr + SOFF_N0_U4, 0, sizeof(blkn_t));
+  fsm->dirty_mmap(fsm, dr->laddr, SBLK_SZ);
+  fsm->release_mmap(fsm);
+  return _db_deallocate(db, dr->faddr, 0);
 }
 
-iwrc iwkv_del(IWDB db, const IWKV_val *key) {
-  if (!db || !db->iwkv || !key) {
+iwrc iwkv_del_range(IWDB db, const IWKV_val *from, const IWKV_val *to) {
+  if (!db || !db->iwkv || (from && !from->size) || (to && !to->size)) {
     return IW_ERROR_INVALID_ARGS;
   }
+  if (db->iwkv->oflags & IWKV_RDONLY) {
+    return IW_ERROR_READONLY;
+  }
+  if (db->dbflg & IWDB_UINT_KEYS_FLAGS) {
+    uint32_t ksz = _uint_key_size(db->dbflg);
+    if ((from && from->size != ksz) || (to && to->size != ksz)) {
+      return IWKV_ERROR_KEY_NUM_VALUE_SIZE;
+    }
+  }
+  if (from && to && _db_cmp_key(db, to->data, to->size, from->data, from->size) >= 0) {
+    return 0; // Empty range
+  }
   int rci;
   iwrc rc = 0;
+  DELRANGE dr;
   IWLCTX lx = {
     .db = db,
-    .key = key,
     .nlvl = -1,
     .op = IWLCTX_DEL
   };
@@ -3375,26 +9787,95 @@ iwrc iwkv_del(IWDB db, const IWKV_val *key) {
     rc = _dbcache_fill_lw(&lx);
     RCGO(rc, finish);
   }
-  rc = _lx_del_lw(&lx);
+  rc = _delrange_scan(&lx, from, to, &dr);
+  RCGO(rc, finish);
+  if (!dr.np && dr.mlvl < 0) {
+    goto finish;
+  }
+  // Cache is rebuilt once all blocks are removed
+  _dbcache_destroy_lw(db);
+  _db_wseq_begin(db);
+  for (int i = 0; i < dr.np && !rc; ++i) {
+    rc = _delrange_part_lw(&lx, dr.parts[i].addr, dr.parts[i].s, dr.parts[i].e);
+  }
+  if (!rc && dr.mlvl > -1) {
+    rc = _delrange_run_lw(&lx, &dr);
+  }
+  _db_wseq_end(db);
+  _rcache_drop_db(db->iwkv, db->id);
+  memset(&lx.dblk, 0, sizeof(lx.dblk));
+  IWRC(_dbcache_fill_lw(&lx), rc);
+
 finish:
   API_DB_UNLOCK(db, rci, rc);
-  if (!rc && (lx.opflags & IWKV_SYNC)) {
-    rc = iwkv_sync(lx.db->iwkv, IWFS_NO_MMASYNC);
+  if (!rc && db->iwkv->wal) {
+    // Removed records are not in WAL so checkpoint is required
+    rc = iwkv_sync(db->iwkv, IWFS_NO_MMASYNC);
+  }
+  return rc;
+}
+
+// Upper bound of keys started with `prefix`: the prefix with the last non 0xff byte incremented.
+// Bound is empty if there are no keys greater than all keys with the given prefix.
+static WUR iwrc _prefix_upper(const IWKV_val *prefix, IWKV_val *oup) {
+  size_t len = prefix->size;
+  const uint8_t *pp = prefix->data;
+  oup->data = 0;
+  oup->size = 0;
+  while (len && pp[len - 1] == 0xff) --len;
+  if (!len) {
+    return 0;
+  }
+  oup->data = malloc(len);
+  if (!oup->data) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  memcpy(oup->data, pp, len);
+  ((uint8_t *) oup->data)[len - 1]++;
+  oup->size = len;
+  return 0;
+}
+
+iwrc iwkv_del_prefix(IWDB db, const IWKV_val *prefix) {
+  if (!db || !prefix) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  if (db->dbflg & IWDB_UINT_KEYS_FLAGS) {
+    return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
+  }
+  if (!prefix->size) {
+    return iwkv_del_range(db, 0, 0);
   }
+  IWKV_val to;
+  iwrc rc = _prefix_upper(prefix, &to);
+  RCRET(rc);
+  rc = iwkv_del_range(db, prefix, to.size ? &to : 0);
+  _kv_val_dispose(&to);
   return rc;
 }
 
 IW_INLINE iwrc _cursor_close_lw(IWKV_cursor cur) {
   iwrc rc = 0;
   cur->closed = true;
+  _kv_val_dispose(&cur->lo);
+  _kv_val_dispose(&cur->hi);
+  if (cur->lx.snap) {
+    // Snapshot cursor nodes are never modified
+    if (cur->cn) {
+      _sblk_release(&cur->lx, &cur->cn);
+    }
+    return _snap_close_lw(&cur->lx);
+  }
   if (cur->cn) {
     if (IW_UNLIKELY((cur->cn->flags & SBLK_DURTY) || (cur->cn->kvblk && (cur->cn->kvblk->flags & KVBLK_DURTY)))) {
       // Flush current node
-      IWFS_FSM *fsm = &cur->lx.db->iwkv->fsm;
+      IWFS_FSM *fsm = &cur->lx.db->file->fsm;
       uint8_t *mm;
       rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
       RCRET(rc);
+      _db_wseq_begin(cur->lx.db);
       rc = _sblk_sync_and_release_mm(&cur->lx, &cur->cn, mm);
+      _db_wseq_end(cur->lx.db);
       fsm->release_mmap(fsm);
     } else {
       _sblk_release(&cur->lx, &cur->cn);
@@ -3403,37 +9884,67 @@ IW_INLINE iwrc _cursor_close_lw(IWKV_cursor cur) {
   return rc;
 }
 
-iwrc iwkv_cursor_open(IWDB db,
-                      IWKV_cursor *curptr,
-                      IWKV_cursor_op op,
-                      const IWKV_val *key) {
-  if (!db || !db->iwkv || !curptr ||
-      (key && op < IWKV_CURSOR_EQ) || op < IWKV_CURSOR_BEFORE_FIRST) {
-    return IW_ERROR_INVALID_ARGS;
+IW_INLINE iwrc _cursor_bound_set(IWKV_val *bound, const IWKV_val *key) {
+  if (!key) {
+    return 0;
+  }
+  bound->data = malloc(key->size);
+  if (!bound->data) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
   }
+  memcpy(bound->data, key->data, key->size);
+  bound->size = key->size;
+  return 0;
+}
+
+static iwrc _cursor_open(IWDB db,
+                         IWKV_cursor *curptr,
+                         IWKV_cursor_op op,
+                         const IWKV_val *key,
+                         const IWKV_val *lo,
+                         const IWKV_val *hi,
+                         bool snapshot) {
   int rci;
+  IWKV_cursor cur = 0;
+  if (SHM_READER(db->iwkv)) {
+    // Cursor positions can not be validated against modifications of writer process
+    return IW_ERROR_NOT_IMPLEMENTED;
+  }
   iwrc rc = _db_worker_inc_nolk(db);
   RCRET(rc);
-  if (IW_LIKELY(db->cache.open)) {
+  // Leaf writers are disabled while cursor is open
+  _db_pin(db);
+  if (IW_LIKELY(db->cache.open && !snapshot)) {
     rc = _api_db_rlock(db);
   } else {
     rc = _api_db_wlock(db);
   }
   if (rc) {
+    _db_unpin(db);
     _db_worker_dec_nolk(db);
     return rc;
   }
   *curptr = calloc(1, sizeof(**curptr));
-  if (!curptr) {
+  if (!*curptr) {
     rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
     goto finish;
   }
-  IWKV_cursor cur = *curptr;
+  cur = *curptr;
   cur->lx.db = db;
   cur->lx.key = key;
   cur->lx.nlvl = -1;
   iwp_current_time_ms(&cur->lx.ts);
-  if (!db->cache.open) {
+  if (lo || hi) {
+    cur->bounded = true;
+    rc = _cursor_bound_set(&cur->lo, lo);
+    RCGO(rc, finish);
+    rc = _cursor_bound_set(&cur->hi, hi);
+    RCGO(rc, finish);
+  }
+  if (snapshot) {
+    rc = _snap_open_lw(&cur->lx);
+    RCGO(rc, finish);
+  } else if (!db->cache.open) {
     rc = _dbcache_fill_lw(&cur->lx);
     RCGO(rc, finish);
   }
@@ -3444,11 +9955,208 @@ finish:
   }
   API_DB_UNLOCK(db, rci, rc);
   if (rc) {
+    _db_unpin(db);
     _db_worker_dec_nolk(db);
   }
   return rc;
 }
 
+iwrc iwkv_cursor_open(IWDB db,
+                      IWKV_cursor *curptr,
+                      IWKV_cursor_op op,
+                      const IWKV_val *key) {
+  if (!db || !db->iwkv || !curptr ||
+      (key && op < IWKV_CURSOR_EQ) || op < IWKV_CURSOR_BEFORE_FIRST) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  return _cursor_open(db, curptr, op, key, 0, 0, false);
+}
+
+iwrc iwkv_cursor_open_range(IWDB db,
+                            IWKV_cursor *curptr,
+                            IWKV_cursor_op op,
+                            const IWKV_val *lo,
+                            const IWKV_val *hi) {
+  if (!db || !db->iwkv || !curptr || (lo && !lo->size) || (hi && !hi->size)
+      || (op != IWKV_CURSOR_BEFORE_FIRST && op != IWKV_CURSOR_AFTER_LAST)) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  if (db->dbflg & IWDB_UINT_KEYS_FLAGS) {
+    uint32_t ksz = _uint_key_size(db->dbflg);
+    if ((lo && lo->size != ksz) || (hi && hi->size != ksz)) {
+      return IWKV_ERROR_KEY_NUM_VALUE_SIZE;
+    }
+  }
+  return _cursor_open(db, curptr, op, 0, lo, hi, false);
+}
+
+iwrc iwkv_cursor_open_prefix(IWDB db,
+                             IWKV_cursor *curptr,
+                             IWKV_cursor_op op,
+                             const IWKV_val *prefix) {
+  if (!db || !db->iwkv || !curptr || !prefix
+      || (op != IWKV_CURSOR_BEFORE_FIRST && op != IWKV_CURSOR_AFTER_LAST)) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  if (db->dbflg & IWDB_UINT_KEYS_FLAGS) {
+    return IWKV_ERROR_INCOMPATIBLE_DB_MODE;
+  }
+  if (!prefix->size) {
+    return _cursor_open(db, curptr, op, 0, 0, 0, false);
+  }
+  IWKV_val hi;
+  iwrc rc = _prefix_upper(prefix, &hi);
+  RCRET(rc);
+  rc = _cursor_open(db, curptr, op, 0, prefix, hi.size ? &hi : 0, false);
+  _kv_val_dispose(&hi);
+  return rc;
+}
+
+iwrc iwkv_cursor_open_snapshot(IWDB db,
+                               IWKV_cursor *curptr,
+                               IWKV_cursor_op op,
+                               const IWKV_val *key) {
+  if (!db || !db->iwkv || !curptr ||
+      (key && op < IWKV_CURSOR_EQ) || op < IWKV_CURSOR_BEFORE_FIRST) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  return _cursor_open(db, curptr, op, key, 0, 0, true);
+}
+
+/**
+ * @brief Select up to `num - 1` keys splitting database into ranges of similar size.
+ * @details Keys are the lower keys of evenly spaced blocks either cached in `DBCACHE`
+ *          or linked by the highest skip list level having enough blocks.
+ *          Keys are returned in cursor traversal order.
+ */
+static WUR iwrc _db_split_keys_lr(IWLCTX *lx, uint32_t num, IWKV_val *okeys, uint32_t *onum) {
+  iwrc rc = 0;
+  uint8_t *mm;
+  SBLK *sblk;
+  blkn_t n, *blks = 0;
+  size_t cnum = 0, anum = 0;
+  IWDB db = lx->db;
+  DBCACHE *cache = &db->cache;
+  IWFS_FSM *fsm = &db->file->fsm;
+  *onum = 0;
+  if (num < 2) {
+    return 0;
+  }
+  if (cache->num >= num) {
+    blks = malloc(cache->num * sizeof(*blks));
+    if (!blks) {
+      return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    }
+    for (cnum = 0; cnum < cache->num; ++cnum) {
+      blks[cnum] = cache->nodes[cnum].sblkn;
+    }
+  } else {
+    int lvl;
+    size_t lnum = 0;
+    for (lvl = SLEVELS - 1; lvl > 0; --lvl) {
+      lnum += db->lcnt[lvl];
+      if (lnum >= num) {
+        break;
+      }
+    }
+    rc = _sblk_at(lx, db->addr, 0, &sblk);
+    RCRET(rc);
+    n = sblk->n[lvl];
+    _sblk_release(lx, &sblk);
+    while (n) {
+      if (cnum >= anum) {
+        anum = anum ? 2 * anum : num;
+        blkn_t *nblks = realloc(blks, anum * sizeof(*blks));
+        if (!nblks) {
+          rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+          goto finish;
+        }
+        blks = nblks;
+      }
+      blks[cnum++] = n;
+      rc = _sblk_at(lx, BLK2ADDR(n), 0, &sblk);
+      RCGO(rc, finish);
+      n = sblk->n[lvl];
+      _sblk_release(lx, &sblk);
+    }
+  }
+  if (cnum < 2) {
+    goto finish;
+  }
+  // The first block is not used since there may be no records before it
+  uint32_t m = MIN(num - 1, cnum - 1);
+  for (uint32_t i = 0; i < m; ++i) {
+    rc = _sblk_at(lx, BLK2ADDR(blks[(i + 1) * cnum / (m + 1)]), 0, &sblk);
+    RCGO(rc, finish);
+    rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+    if (!rc) {
+      rc = _sblk_loadkvblk_mm(lx, sblk, mm);
+      if (!rc) {
+        rc = _kvblk_getkey(sblk->kvblk, mm, sblk->pi[0], &okeys[i], 0);
+      }
+      fsm->release_mmap(fsm);
+    }
+    _sblk_release(lx, &sblk);
+    RCGO(rc, finish);
+    ++*onum;
+  }
+
+finish:
+  if (rc) {
+    for (uint32_t i = 0; i < *onum; ++i) {
+      _kv_val_dispose(&okeys[i]);
+    }
+    *onum = 0;
+  }
+  free(blks);
+  return rc;
+}
+
+iwrc iwkv_cursor_open_parts(IWDB db, IWKV_cursor *curs, uint32_t num, uint32_t *onum) {
+  if (!db || !db->iwkv || !curs || !num || !onum) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  int rci;
+  iwrc rc;
+  uint32_t knum = 0;
+  IWLCTX lx = {
+    .db = db,
+    .nlvl = -1
+  };
+  *onum = 0;
+  IWKV_val *keys = calloc(num, sizeof(*keys));
+  if (!keys) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  API_DB_RLOCK(db, rci);
+  rc = _db_split_keys_lr(&lx, num, keys, &knum);
+  API_DB_UNLOCK(db, rci, rc);
+  RCGO(rc, finish);
+  for (uint32_t i = 0; i <= knum; ++i) {
+    const IWKV_val *lo = (i < knum) ? &keys[i] : 0;
+    const IWKV_val *hi = i ? &keys[i - 1] : 0;
+    curs[i] = 0;
+    rc = _cursor_open(db, &curs[i], IWKV_CURSOR_BEFORE_FIRST, 0, lo, hi, false);
+    if (rc) {
+      for (uint32_t j = 0; j <= i; ++j) {
+        if (!curs[j]) {
+          break;
+        }
+        IWRC(iwkv_cursor_close(&curs[j]), rc);
+      }
+      goto finish;
+    }
+  }
+  *onum = knum + 1;
+
+finish:
+  for (uint32_t i = 0; i < knum; ++i) {
+    _kv_val_dispose(&keys[i]);
+  }
+  free(keys);
+  return rc;
+}
+
 iwrc iwkv_cursor_close(IWKV_cursor *curp) {
   iwrc rc = 0;
   int rci;
@@ -3466,6 +10174,7 @@ iwrc iwkv_cursor_close(IWKV_cursor *curp) {
   API_DB_WLOCK(cur->lx.db, rci);
   rc = _cursor_close_lw(cur);
   API_DB_UNLOCK(cur->lx.db, rci, rc);
+  _db_unpin(cur->lx.db);
   IWRC(_db_worker_dec_nolk(cur->lx.db), rc);
   free(cur);
   *curp = 0;
@@ -3501,20 +10210,21 @@ iwrc iwkv_cursor_to_key(IWKV_cursor cur, IWKV_cursor_op op, const IWKV_val *key)
   return rc;
 }
 
-iwrc iwkv_cursor_get(IWKV_cursor cur,
-                     IWKV_val *okey,   /* Nullable */
-                     IWKV_val *oval) { /* Nullable */
+static iwrc _cursor_get(IWKV_cursor cur,
+                        IWKV_val *okey,  /* Nullable */
+                        IWKV_val *oval,  /* Nullable */
+                        IWPOOL *pool) {  /* Nullable */
   int rci;
   iwrc rc = 0;
   if (!cur) {
     return IW_ERROR_INVALID_ARGS;
   }
-  if (!cur->cn || !cur->lx.db || cur->cnpos >= cur->cn->pnum) {
+  if (!_cursor_at_record(cur)) {
     return IW_ERROR_INVALID_STATE;
   }
   API_DB_RLOCK(cur->lx.db, rci);
   uint8_t *mm = 0;
-  IWFS_FSM *fsm = &cur->lx.db->iwkv->fsm;
+  IWFS_FSM *fsm = &cur->lx.db->file->fsm;
   rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   RCGO(rc, finish);
   if (!cur->cn->kvblk) {
@@ -3523,11 +10233,11 @@ iwrc iwkv_cursor_get(IWKV_cursor cur,
   }
   int8_t idx = cur->cn->pi[cur->cnpos];
   if (okey && oval) {
-    rc = _kvblk_getkv(cur->cn->kvblk, mm, idx, okey, oval);
+    rc = _kvblk_getkv(cur->cn->kvblk, mm, idx, okey, oval, false, pool);
   } else if (oval) {
-    rc = _kvblk_getvalue(cur->cn->kvblk, mm, idx, oval);
+    rc = _kvblk_getvalue(cur->cn->kvblk, mm, idx, oval, pool);
   } else if (okey) {
-    rc = _kvblk_getkey(cur->cn->kvblk, mm, idx, okey);
+    rc = _kvblk_getkey(cur->cn->kvblk, mm, idx, okey, pool);
   } else {
     rc = IW_ERROR_INVALID_ARGS;
   }
@@ -3536,6 +10246,123 @@ finish:
     fsm->release_mmap(fsm);
   }
   API_DB_UNLOCK(cur->lx.db, rci, rc);
+  if (!rc && oval) {
+    rc = _db_val_decode(cur->lx.db, oval, pool);
+    if (rc && okey) {
+      _kv_val_release(pool, okey);
+    }
+  }
+  return rc;
+}
+
+iwrc iwkv_cursor_get(IWKV_cursor cur,
+                     IWKV_val *okey,   /* Nullable */
+                     IWKV_val *oval) { /* Nullable */
+  return _cursor_get(cur, okey, oval, 0);
+}
+
+iwrc iwkv_cursor_get_pooled(IWKV_cursor cur,
+                            IWKV_val *okey,   /* Nullable */
+                            IWKV_val *oval,   /* Nullable */
+                            IWPOOL *pool) {
+  if (!pool) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  return _cursor_get(cur, okey, oval, pool);
+}
+
+iwrc iwkv_cursor_next_batch(IWKV_cursor cur,
+                            IWKV_val *okeys,  /* Nullable */
+                            IWKV_val *ovals,  /* Nullable */
+                            size_t n,
+                            uint8_t *buf,
+                            size_t bufsz,
+                            size_t *onum) {
+  int rci;
+  iwrc rc = 0;
+  if (!cur || !n || (!okeys && !ovals) || (!buf && bufsz) || !onum) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  *onum = 0;
+  if (!cur->lx.db) {
+    return IW_ERROR_INVALID_STATE;
+  }
+  IWDB db = cur->lx.db;
+  IWFS_FSM *fsm = &db->file->fsm;
+  bool atrec = _cursor_at_record(cur);
+  uint8_t *mm = 0;
+  SBLK *cn = 0;
+  size_t off = 0;
+
+  API_DB_RLOCK(db, rci);
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCGO(rc, finish);
+  while (*onum < n) {
+    KVKEY k = { 0 };
+    IWKV_val uval = { 0 };
+    uint8_t *vp = 0;
+    uint32_t vsz = 0;
+    rc = _cursor_to_lr(cur, IWKV_CURSOR_NEXT);
+    if (rc) {
+      if (rc == IWKV_ERROR_NOTFOUND && *onum) {
+        rc = 0;
+      }
+      break;
+    }
+    cn = cur->cn;
+    if (!cn->kvblk) {
+      rc = _sblk_loadkvblk_mm(&cur->lx, cn, mm);
+      RCBREAK(rc);
+    }
+    uint8_t idx = cn->pi[cur->cnpos];
+    if (okeys) {
+      rc = _kvblk_peek_key(cn->kvblk, idx, mm, &k);
+      RCBREAK(rc);
+    }
+    if (ovals) {
+      _kvblk_peek_val(cn->kvblk, idx, mm, &vp, &vsz);
+      if (db->dbflg & IWDB_COMPRESSED) {
+        rc = _db_val_unpack(vp, vsz, &uval, 0);
+        RCBREAK(rc);
+        vp = uval.data;
+        vsz = uval.size;
+      }
+    }
+    size_t ksz = KVKEY_SIZE(k);
+    if (bufsz - off < ksz + vsz) {
+      _kv_val_dispose(&uval);
+      // Step back to the last returned record
+      rc = _cursor_to_lr(cur, (*onum || atrec) ? IWKV_CURSOR_PREV : IWKV_CURSOR_BEFORE_FIRST);
+      if (!rc && !*onum) {
+        rc = IW_ERROR_OVERFLOW;
+      }
+      break;
+    }
+    if (okeys) {
+      IWKV_val *key = &okeys[*onum];
+      key->data = buf + off;
+      key->size = ksz;
+      _kvkey_copy(&k, key->data, ksz);
+      off += ksz;
+    }
+    if (ovals) {
+      IWKV_val *val = &ovals[*onum];
+      val->data = buf + off;
+      val->size = vsz;
+      if (vsz) {
+        memcpy(val->data, vp, vsz);
+      }
+      off += vsz;
+    }
+    _kv_val_dispose(&uval);
+    ++*onum;
+  }
+
+finish:
+  if (mm) {
+    fsm->release_mmap(fsm);
+  }
+  API_DB_UNLOCK(db, rci, rc);
   return rc;
 }
 
@@ -3545,14 +10372,14 @@ iwrc iwkv_cursor_copy_val(IWKV_cursor cur, uint8_t *vbuf, size_t vbufsz, size_t
   if (!cur || !vbuf) {
     return IW_ERROR_INVALID_ARGS;
   }
-  if (!cur->cn || !cur->lx.db || cur->cnpos >= cur->cn->pnum) {
+  if (!_cursor_at_record(cur)) {
     return IW_ERROR_INVALID_STATE;
   }
   *vsz = 0;
   API_DB_RLOCK(cur->lx.db, rci);
   uint8_t *mm = 0, *oval;
   uint32_t ovalsz;
-  IWFS_FSM *fsm = &cur->lx.db->iwkv->fsm;
+  IWFS_FSM *fsm = &cur->lx.db->file->fsm;
   rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   RCGO(rc, finish);
   if (!cur->cn->kvblk) {
@@ -3561,6 +10388,17 @@ iwrc iwkv_cursor_copy_val(IWKV_cursor cur, uint8_t *vbuf, size_t vbufsz, size_t
   }
   int8_t idx = cur->cn->pi[cur->cnpos];
   _kvblk_peek_val(cur->cn->kvblk, idx, mm, &oval, &ovalsz);
+  if (cur->lx.db->dbflg & IWDB_COMPRESSED) {
+    IWKV_val uval;
+    rc = _db_val_unpack(oval, ovalsz, &uval, 0);
+    RCGO(rc, finish);
+    *vsz = uval.size;
+    if (uval.size) {
+      memcpy(vbuf, uval.data, MIN(vbufsz, uval.size));
+    }
+    _kv_val_dispose(&uval);
+    goto finish;
+  }
   *vsz = ovalsz;
   memcpy(vbuf, oval, MIN(vbufsz, ovalsz));
 finish:
@@ -3577,31 +10415,81 @@ iwrc iwkv_cursor_copy_key(IWKV_cursor cur, uint8_t *kbuf, size_t kbufsz, size_t
   if (!cur || !kbuf) {
     return IW_ERROR_INVALID_ARGS;
   }
-  if (!cur->cn || !cur->lx.db || cur->cnpos >= cur->cn->pnum) {
+  if (!_cursor_at_record(cur)) {
     return IW_ERROR_INVALID_STATE;
   }
   *ksz = 0;
   API_DB_RLOCK(cur->lx.db, rci);
   uint8_t *mm = 0;
-  const uint8_t *okey;
-  uint32_t okeysz;
-  IWFS_FSM *fsm = &cur->lx.db->iwkv->fsm;
+  KVKEY okey;
+  IWFS_FSM *fsm = &cur->lx.db->file->fsm;
   rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   RCGO(rc, finish);
-  if (!cur->cn->kvblk) {
-    rc = _sblk_loadkvblk_mm(&cur->lx, cur->cn, mm);
+  if (!cur->cn->kvblk) {
+    rc = _sblk_loadkvblk_mm(&cur->lx, cur->cn, mm);
+    RCGO(rc, finish);
+  }
+  int8_t idx = cur->cn->pi[cur->cnpos];
+  rc = _kvblk_peek_key(cur->cn->kvblk, idx, mm, &okey);
+  RCGO(rc, finish);
+  *ksz = KVKEY_SIZE(okey);
+  _kvkey_copy(&okey, kbuf, MIN(kbufsz, *ksz));
+finish:
+  if (mm) {
+    fsm->release_mmap(fsm);
+  }
+  API_DB_UNLOCK(cur->lx.db, rci, rc);
+  return rc;
+}
+
+// Sync updated cursor node and invalidate cached record at the current cursor position
+static WUR iwrc _cursor_rcache_invalidate(IWKV_cursor cur) {
+  uint8_t *mm;
+  KVKEY k;
+  IWFS_FSM *fsm = &cur->lx.db->file->fsm;
+  iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  rc = _sblk_sync_mm(&cur->lx, cur->cn, mm);
+  if (!rc) {
+    rc = _kvblk_peek_key(cur->cn->kvblk, cur->cn->pi[cur->cnpos], mm, &k);
+  }
+  if (!rc) {
+    _rcache_invalidate_kvkey(cur->lx.db, &k);
+  }
+  fsm->release_mmap(fsm);
+  return rc;
+}
+
+// Log value update at the current cursor position
+static iwrc _cursor_wal_add(IWKV_cursor cur, const IWKV_val *val, iwkv_opflags opflags, uint64_t *olsn) {
+  uint8_t *mm;
+  KVKEY k;
+  IWKV_val key = { 0 };
+  IWDB db = cur->lx.db;
+  IWFS_FSM *fsm = &db->file->fsm;
+  iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  rc = _sblk_loadkvblk_mm(&cur->lx, cur->cn, mm);
+  RCGO(rc, finish);
+  rc = _kvblk_peek_key(cur->cn->kvblk, cur->cn->pi[cur->cnpos], mm, &k);
+  RCGO(rc, finish);
+  if (k.pfxl) { // Key is not stored continuously
+    IWPOOL *pool = _scratch_pool();
+    rc = _kvblk_getkey(cur->cn->kvblk, mm, cur->cn->pi[cur->cnpos], &key, pool);
     RCGO(rc, finish);
+    rc = iwal_add(db->iwkv->wal, WOP_PUT, db->id, opflags, &key, val, olsn);
+    if (pool) {
+      iwpool_reset(pool);
+    } else {
+      _kv_val_dispose(&key);
+    }
+  } else {
+    key.data = (void *) k.buf;
+    key.size = k.len;
+    rc = iwal_add(db->iwkv->wal, WOP_PUT, db->id, opflags, &key, val, olsn);
   }
-  int8_t idx = cur->cn->pi[cur->cnpos];
-  rc = _kvblk_peek_key(cur->cn->kvblk, idx, mm, &okey, &okeysz);
-  RCGO(rc, finish);
-  *ksz = okeysz;
-  memcpy(kbuf, okey, MIN(kbufsz, okeysz));
 finish:
-  if (mm) {
-    fsm->release_mmap(fsm);
-  }
-  API_DB_UNLOCK(cur->lx.db, rci, rc);
+  IWRC(fsm->release_mmap(fsm), rc);
   return rc;
 }
 
@@ -3614,10 +10502,39 @@ iwrc iwkv_cursor_set(IWKV_cursor cur, IWKV_val *val, iwkv_opflags opflags) {
   if (!cur->cn || !cur->lx.db || (cur->cn->flags & SBLK_DB)) {
     return IW_ERROR_INVALID_STATE;
   }
+  if (cur->lx.snap) {
+    return IW_ERROR_READONLY;
+  }
   IWDB db = cur->lx.db;
+  uint64_t lsn = 0;
+  IWKV_val pval = { 0 };
   API_DB_WLOCK(db, rci);
-  rc = _sblk_updatekv(cur->cn, cur->cnpos, 0, val, opflags);
+  _dbstat_add(db, DBS_PUTS, 1);
+  if (db->dbflg & IWDB_COMPRESSED) {
+    rc = _db_val_pack(val, &pval);
+    RCGO(rc, finish);
+  } else if (db->dbflg & IWDB_OVERFLOW_VALS) {
+    rc = _db_val_ovl_pack(db, val, 0, &pval);
+    RCGO(rc, finish);
+  }
+  _db_wseq_begin(db);
+  rc = _sblk_updatekv(cur->cn, cur->cnpos, 0, pval.data ? &pval : val, opflags, false);
+  if (!rc && _rcache_enabled(db)) {
+    rc = _cursor_rcache_invalidate(cur);
+  }
+  _db_wseq_end(db);
+  if (rc) {
+    _db_val_ovl_discard(db, &pval);
+  }
+  if (!rc && db->iwkv->wal) {
+    rc = _cursor_wal_add(cur, val, opflags, &lsn);
+  }
+finish:
   API_DB_UNLOCK(cur->lx.db, rci, rc);
+  _kv_val_dispose(&pval);
+  if (!rc && (opflags & IWKV_SYNC)) {
+    rc = _iwkv_sync_op(db->iwkv, lsn);
+  }
   return rc;
 }
 
@@ -3672,7 +10589,7 @@ iwrc iwkv_cursor_dup_num(const IWKV_cursor cur, uint32_t *onum) {
   uint8_t *vbuf;
   uint8_t *mm = 0;
   int8_t idx = cur->cn->pi[cur->cnpos];
-  IWFS_FSM *fsm = &cur->lx.db->iwkv->fsm;
+  IWFS_FSM *fsm = &cur->lx.db->file->fsm;
   rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   RCGO(rc, finish);
   if (!cur->cn->kvblk) {
@@ -3711,7 +10628,7 @@ iwrc iwkv_cursor_dup_contains(const IWKV_cursor cur, uint64_t dv, bool *out) {
   uint8_t *rp, *mm = 0;
   int8_t idx = cur->cn->pi[cur->cnpos];
   const int elsz = (cur->lx.db->dbflg & IWDB_DUP_UINT32_VALS) ? 4 : 8;
-  IWFS_FSM *fsm = &cur->lx.db->iwkv->fsm;
+  IWFS_FSM *fsm = &cur->lx.db->file->fsm;
   rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   RCGO(rc, finish);
   if (!cur->cn->kvblk) {
@@ -3724,6 +10641,10 @@ iwrc iwkv_cursor_dup_contains(const IWKV_cursor cur, uint64_t dv, bool *out) {
     iwlog_ecode_error3(rc);
     goto finish;
   }
+  if (cur->lx.db->dbflg & IWDB_DUP_PACKED) {
+    rc = _pdup_contains(rp, len, elsz < 8 ? (uint32_t) dv : dv, out);
+    goto finish;
+  }
   memcpy(&num, rp, sizeof(num));
   num = IW_ITOHL(num); // Number of items
   if (!num) {
@@ -3765,7 +10686,7 @@ iwrc iwkv_cursor_dup_iter(const IWKV_cursor cur,
   uint8_t *rp, *mm = 0;
   int8_t idx = cur->cn->pi[cur->cnpos];
   const int elsz = (cur->lx.db->dbflg & IWDB_DUP_UINT32_VALS) ? 4 : 8;
-  IWFS_FSM *fsm = &cur->lx.db->iwkv->fsm;
+  IWFS_FSM *fsm = &cur->lx.db->file->fsm;
   rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
   RCGO(rc, finish);
   if (!cur->cn->kvblk) {
@@ -3778,6 +10699,11 @@ iwrc iwkv_cursor_dup_iter(const IWKV_cursor cur,
     iwlog_ecode_error3(rc);
     goto finish;
   }
+  if (cur->lx.db->dbflg & IWDB_DUP_PACKED) {
+    uint64_t sv = start && elsz < 8 ? (uint32_t) *start : start ? *start : 0;
+    rc = _pdup_iter(rp, num, visitor, opaq, start ? &sv : 0, down);
+    goto finish;
+  }
   memcpy(&num, rp, sizeof(num));
   num = IW_ITOHL(num); // Number of items
   if (!num) {
@@ -3832,4 +10758,468 @@ finish:
   return rc;
 }
 
+iwrc iwkv_cursor_dup_slice(const IWKV_cursor cur, uint32_t start, uint32_t end, void *out, uint32_t *onum) {
+  if (!cur || !onum || (start < end && !out)) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  *onum = 0;
+  if (!cur->cn || !cur->lx.db || (cur->cn->flags & SBLK_DB) || !(cur->lx.db->dbflg & IWDB_DUP_FLAGS)) {
+    return IW_ERROR_INVALID_STATE;
+  }
+  if (start >= end) {
+    return 0;
+  }
+  int rci;
+  iwrc rc;
+  API_DB_RLOCK(cur->lx.db, rci);
+  uint32_t len, num;
+  uint8_t *rp, *mm = 0;
+  int8_t idx = cur->cn->pi[cur->cnpos];
+  const int elsz = (cur->lx.db->dbflg & IWDB_DUP_UINT32_VALS) ? 4 : 8;
+  IWFS_FSM *fsm = &cur->lx.db->file->fsm;
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCGO(rc, finish);
+  if (!cur->cn->kvblk) {
+    rc = _sblk_loadkvblk_mm(&cur->lx, cur->cn, mm);
+    RCGO(rc, finish);
+  }
+  _kvblk_peek_val(cur->cn->kvblk, idx, mm, &rp, &len);
+  if (len < 4) {
+    rc = IWKV_ERROR_CORRUPTED;
+    iwlog_ecode_error3(rc);
+    goto finish;
+  }
+  memcpy(&num, rp, sizeof(num));
+  num = IW_ITOHL(num); // Number of items
+  end = MIN(end, num);
+  if (start >= end) {
+    goto finish;
+  }
+  if (cur->lx.db->dbflg & IWDB_DUP_PACKED) {
+    rc = _pdup_slice(rp, len, start, end, out, elsz);
+    RCGO(rc, finish);
+  } else {
+    if (len < 4 + (uint64_t) num * elsz) {
+      rc = IWKV_ERROR_CORRUPTED;
+      iwlog_ecode_error3(rc);
+      goto finish;
+    }
+    // Stored little endian array is copied at once
+    memcpy(out, rp + 4 + (size_t) start * elsz, (size_t) (end - start) * elsz);
+#if IW_BIGENDIAN == 1
+    for (uint32_t i = 0; i < end - start; ++i) {
+      if (elsz < 8) {
+        ((uint32_t *) out)[i] = IW_ITOHL(((uint32_t *) out)[i]);
+      } else {
+        ((uint64_t *) out)[i] = IW_ITOHLL(((uint64_t *) out)[i]);
+      }
+    }
+#endif
+  }
+  *onum = end - start;
+finish:
+  if (mm) {
+    fsm->release_mmap(fsm);
+  }
+  API_DB_UNLOCK(cur->lx.db, rci, rc);
+  return rc;
+}
+
+//-------------------------- DUP VALUES SETS
+
+KSORT_INIT(dupv, uint64_t, ks_lt_generic)
+
+/** Sorted values array of record at cursor position */
+typedef struct DUPSEQ {
+  const uint8_t *rp;  /**< Little endian values of not packed array, points to mmaped area */
+  uint64_t *vals;     /**< Decoded values of `IWDB_DUP_PACKED` array */
+  uint32_t num;       /**< Number of values */
+  uint32_t pos;       /**< Current position */
+  int elsz;           /**< Size of `rp` element */
+} DUPSEQ;
+
+IW_INLINE uint64_t _dupseq_at(const DUPSEQ *s, uint32_t i) {
+  if (s->vals) {
+    return s->vals[i];
+  } else if (s->elsz < 8) {
+    uint32_t lv;
+    memcpy(&lv, s->rp + i * sizeof(lv), sizeof(lv));
+    return IW_ITOHL(lv);
+  } else {
+    uint64_t llv;
+    memcpy(&llv, s->rp + i * sizeof(llv), sizeof(llv));
+    return IW_ITOHLL(llv);
+  }
+}
+
+// Open values array at the cursor position, database lock and `mm` are held by caller
+static WUR iwrc _dupseq_open_lr(IWKV_cursor cur, uint8_t *mm, DUPSEQ *s) {
+  iwrc rc;
+  uint32_t len;
+  uint8_t *rp;
+  IWDB db = cur->lx.db;
+  memset(s, 0, sizeof(*s));
+  if (!cur->cn || (cur->cn->flags & SBLK_DB)) {
+    return IW_ERROR_INVALID_STATE;
+  }
+  if (!cur->cn->kvblk) {
+    rc = _sblk_loadkvblk_mm(&cur->lx, cur->cn, mm);
+    RCRET(rc);
+  }
+  _kvblk_peek_val(cur->cn->kvblk, cur->cn->pi[cur->cnpos], mm, &rp, &len);
+  if (len < 4) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
+  }
+  memcpy(&s->num, rp, sizeof(s->num));
+  s->num = IW_ITOHL(s->num);
+  s->elsz = (db->dbflg & IWDB_DUP_UINT32_VALS) ? 4 : 8;
+  if (db->dbflg & IWDB_DUP_PACKED) {
+    if (!s->num) {
+      return 0;
+    }
+    if (s->num > len) { // Every packed value takes at least one byte
+      iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+      return IWKV_ERROR_CORRUPTED;
+    }
+    s->vals = malloc(s->num * sizeof(*s->vals));
+    if (!s->vals) {
+      return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    }
+    rc = _pdup_decode(rp, len, s->vals, s->num);
+    if (rc) {
+      free(s->vals);
+      s->vals = 0;
+    }
+    return rc;
+  }
+  if (len < 4 + (uint64_t) s->num * s->elsz) {
+    iwlog_ecode_error3(IWKV_ERROR_CORRUPTED);
+    return IWKV_ERROR_CORRUPTED;
+  }
+  s->rp = rp + 4;
+  return 0;
+}
+
+/**
+ * @brief Move position to the first value not less than `dv`.
+ * @details Exponential (galloping) search from the current position
+ *          followed by binary search within the last step.
+ * @return `false` if all remaining values are less than `dv`
+ */
+static bool _dupseq_seek(DUPSEQ *s, uint64_t dv) {
+  uint32_t lo = s->pos, hi, step = 1;
+  if (lo >= s->num) {
+    return false;
+  }
+  if (_dupseq_at(s, lo) >= dv) {
+    return true;
+  }
+  while (lo + step < s->num && _dupseq_at(s, lo + step) < dv) {
+    lo += step;
+    step <<= 1;
+  }
+  hi = MIN(lo + step, s->num);
+  while (hi - lo > 1) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (_dupseq_at(s, mid) < dv) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  s->pos = hi;
+  return hi < s->num;
+}
+
+// Encode sorted unique values as record value of `db`
+static WUR iwrc _dup_vals_encode(IWDB db, const uint64_t *vals, uint32_t num, IWKV_val *oval) {
+  if (db->dbflg & IWDB_DUP_PACKED) {
+    return _pdup_build(vals, num, oval);
+  }
+  const int elsz = (db->dbflg & IWDB_DUP_UINT32_VALS) ? 4 : 8;
+  uint32_t lv = IW_HTOIL(num);
+  oval->size = 4 + (size_t) num * elsz;
+  if (oval->size > IWKV_MAX_KVSZ) {
+    return IWKV_ERROR_MAXKVSZ;
+  }
+  oval->data = malloc(oval->size);
+  if (!oval->data) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  uint8_t *wp = oval->data;
+  memcpy(wp, &lv, sizeof(lv));
+  wp += sizeof(lv);
+  for (uint32_t i = 0; i < num; ++i, wp += elsz) {
+    if (elsz < 8) {
+      lv = vals[i];
+      lv = IW_HTOIL(lv);
+      memcpy(wp, &lv, sizeof(lv));
+    } else {
+      uint64_t llv = IW_HTOILL(vals[i]);
+      memcpy(wp, &llv, sizeof(llv));
+    }
+  }
+  return 0;
+}
+
+// Log changed values of array at the cursor position as batch of single value updates
+static WUR iwrc _cursor_wal_dups(IWKV_cursor cur, const uint64_t *dvs, uint32_t num,
+                                 iwkv_opflags opflags, uint64_t *olsn) {
+  uint8_t *mm;
+  IWKV_val key = { 0 };
+  IWDB db = cur->lx.db;
+  IWPOOL *pool = _scratch_pool();
+  struct IWKV_batch b = { .iwkv = db->iwkv };
+  IWFS_FSM *fsm = &db->file->fsm;
+  iwrc rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCRET(rc);
+  rc = _sblk_loadkvblk_mm(&cur->lx, cur->cn, mm);
+  if (!rc) {
+    rc = _kvblk_getkey(cur->cn->kvblk, mm, cur->cn->pi[cur->cnpos], &key, pool);
+  }
+  IWRC(fsm->release_mmap(fsm), rc);
+  RCGO(rc, finish);
+  for (uint32_t i = 0; i < num; ++i) {
+    uint32_t lv = dvs[i];
+    IWKV_val val = { .data = (void *) &dvs[i], .size = sizeof(dvs[i]) };
+    if (db->dbflg & IWDB_DUP_UINT32_VALS) {
+      val.data = &lv;
+      val.size = sizeof(lv);
+    }
+    rc = _batch_add(&b, WOP_PUT, opflags, db, &key, &val);
+    RCGO(rc, finish);
+  }
+  IWKV_val bval = { .data = b.buf, .size = b.bufsz };
+  rc = iwal_add(db->iwkv->wal, WOP_BATCH, 0, 0, 0, &bval, olsn);
+finish:
+  if (pool) {
+    iwpool_reset(pool);
+  } else {
+    _kv_val_dispose(&key);
+  }
+  free(b.buf);
+  free(b.dbids);
+  return rc;
+}
+
+static iwrc _cursor_dup_merge(IWKV_cursor cur, const uint64_t *dvs, uint32_t num, iwkv_opflags opflags) {
+  if (!cur || (num && !dvs)) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  if (!cur->cn || !cur->lx.db || (cur->cn->flags & SBLK_DB) || !(cur->lx.db->dbflg & IWDB_DUP_FLAGS)) {
+    return IW_ERROR_INVALID_STATE;
+  }
+  if (cur->lx.snap) {
+    return IW_ERROR_READONLY;
+  }
+  if (!num) {
+    return 0;
+  }
+  int rci;
+  iwrc rc;
+  DUPSEQ s = { 0 };
+  IWKV_val nval = { 0 };
+  uint64_t lsn = 0, *mv = 0;
+  uint8_t *mm = 0;
+  uint32_t bn = 0, mn = 0, nc = 0, i = 0, j = 0;
+  const bool remove = (opflags & IWKV_DUP_REMOVE);
+  IWDB db = cur->lx.db;
+  IWFS_FSM *fsm = &db->file->fsm;
+  uint64_t *bv = malloc(num * sizeof(*bv));
+  if (!bv) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  for (uint32_t k = 0; k < num; ++k) {
+    bv[k] = (db->dbflg & IWDB_DUP_UINT32_VALS) ? (uint32_t) dvs[k] : dvs[k];
+  }
+  ks_introsort_dupv(num, bv);
+  for (uint32_t k = 0; k < num; ++k) {
+    if (!bn || bv[bn - 1] != bv[k]) {
+      bv[bn++] = bv[k];
+    }
+  }
+  API_DB_WLOCK(db, rci);
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCGO(rc, finish);
+  rc = _dupseq_open_lr(cur, mm, &s);
+  RCGO(rc, finish);
+  mv = malloc(((size_t) s.num + (remove ? 0 : bn) + 1) * sizeof(*mv));
+  if (!mv) {
+    rc = iwrc_set_errno(IW_ERROR_ALLOC, errno);
+    goto finish;
+  }
+  // Single pass merge, values actually added or removed are kept at the head of `bv`
+  while (i < s.num || j < bn) {
+    uint64_t v = i < s.num ? _dupseq_at(&s, i) : 0;
+    if (i < s.num && (j == bn || v < bv[j])) {
+      mv[mn++] = v;
+      ++i;
+    } else if (i < s.num && v == bv[j]) {
+      if (remove) {
+        bv[nc++] = v;
+      } else {
+        mv[mn++] = v;
+      }
+      ++i, ++j;
+    } else {
+      if (!remove) {
+        mv[mn++] = bv[j];
+        bv[nc++] = bv[j];
+      }
+      ++j;
+    }
+  }
+  fsm->release_mmap(fsm);
+  mm = 0;
+  if (!nc) {
+    goto finish;
+  }
+  rc = _dup_vals_encode(db, mv, mn, &nval);
+  RCGO(rc, finish);
+  _db_wseq_begin(db);
+  rc = _sblk_updatekv(cur->cn, cur->cnpos, 0, &nval, 0, true);
+  _db_wseq_end(db);
+  if (!rc && db->iwkv->wal) {
+    rc = _cursor_wal_dups(cur, bv, nc, opflags & ~IWKV_SYNC, &lsn);
+  }
+finish:
+  if (mm) {
+    fsm->release_mmap(fsm);
+  }
+  API_DB_UNLOCK(db, rci, rc);
+  if (!rc && nc && (opflags & IWKV_SYNC)) {
+    rc = _iwkv_sync_op(db->iwkv, lsn);
+  }
+  _kv_val_dispose(&nval);
+  free(s.vals);
+  free(mv);
+  free(bv);
+  return rc;
+}
+
+iwrc iwkv_cursor_dup_add_many(IWKV_cursor cur, const uint64_t *dvs, uint32_t num) {
+  return _cursor_dup_merge(cur, dvs, num, 0);
+}
+
+iwrc iwkv_cursor_dup_rm_many(IWKV_cursor cur, const uint64_t *dvs, uint32_t num) {
+  return _cursor_dup_merge(cur, dvs, num, IWKV_DUP_REMOVE);
+}
+
+static iwrc _cursor_dup_combine(IWKV_cursor *curs, uint32_t ncurs, bool intersect,
+                                uint64_t *out, uint32_t cap, uint32_t *onum) {
+  if (!curs || !ncurs || !onum || (cap && !out)) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  *onum = 0;
+  IWDB db = curs[0] ? curs[0]->lx.db : 0;
+  for (uint32_t k = 0; k < ncurs; ++k) {
+    if (!curs[k] || curs[k]->lx.db != db) {
+      return IW_ERROR_INVALID_ARGS;
+    }
+    if (!curs[k]->cn || !db || (curs[k]->cn->flags & SBLK_DB) || !(db->dbflg & IWDB_DUP_FLAGS)) {
+      return IW_ERROR_INVALID_STATE;
+    }
+  }
+  int rci;
+  iwrc rc;
+  uint8_t *mm = 0;
+  uint32_t cnt = 0;
+  IWFS_FSM *fsm = &db->file->fsm;
+  DUPSEQ *seqs = calloc(ncurs, sizeof(*seqs));
+  if (!seqs) {
+    return iwrc_set_errno(IW_ERROR_ALLOC, errno);
+  }
+  API_DB_RLOCK(db, rci);
+  rc = fsm->acquire_mmap(fsm, 0, &mm, 0);
+  RCGO(rc, finish);
+  for (uint32_t k = 0; k < ncurs; ++k) {
+    rc = _dupseq_open_lr(curs[k], mm, &seqs[k]);
+    RCGO(rc, finish);
+  }
+#define _EMIT(v_) do {     \
+    if (cnt < cap) {       \
+      out[cnt] = (v_);     \
+    }                      \
+    ++cnt;                 \
+} while (0)
+
+  if (intersect) {
+    // Values of the shortest array are looked up in the others
+    for (uint32_t k = 1; k < ncurs; ++k) {
+      for (uint32_t l = k; l > 0 && seqs[l].num < seqs[l - 1].num; --l) {
+        DUPSEQ t = seqs[l];
+        seqs[l] = seqs[l - 1];
+        seqs[l - 1] = t;
+      }
+    }
+    while (seqs[0].pos < seqs[0].num) {
+      uint32_t k = 1;
+      uint64_t v = _dupseq_at(&seqs[0], seqs[0].pos);
+      for ( ; k < ncurs; ++k) {
+        if (!_dupseq_seek(&seqs[k], v)) {
+          goto finish;
+        }
+        uint64_t w = _dupseq_at(&seqs[k], seqs[k].pos);
+        if (w != v) {
+          if (!_dupseq_seek(&seqs[0], w)) {
+            goto finish;
+          }
+          break;
+        }
+      }
+      if (k == ncurs) {
+        _EMIT(v);
+        ++seqs[0].pos;
+      }
+    }
+  } else {
+    while (1) {
+      bool any = false;
+      uint64_t m = 0;
+      for (uint32_t k = 0; k < ncurs; ++k) {
+        if (seqs[k].pos < seqs[k].num) {
+          uint64_t w = _dupseq_at(&seqs[k], seqs[k].pos);
+          if (!any || w < m) {
+            m = w;
+            any = true;
+          }
+        }
+      }
+      if (!any) {
+        break;
+      }
+      _EMIT(m);
+      for (uint32_t k = 0; k < ncurs; ++k) {
+        if (seqs[k].pos < seqs[k].num && _dupseq_at(&seqs[k], seqs[k].pos) == m) {
+          ++seqs[k].pos;
+        }
+      }
+    }
+  }
+#undef _EMIT
+
+finish:
+  if (mm) {
+    fsm->release_mmap(fsm);
+  }
+  API_DB_UNLOCK(db, rci, rc);
+  for (uint32_t k = 0; k < ncurs; ++k) {
+    free(seqs[k].vals);
+  }
+  free(seqs);
+  if (!rc) {
+    *onum = cnt;
+  }
+  return rc;
+}
+
+iwrc iwkv_cursor_dup_intersect(IWKV_cursor *curs, uint32_t ncurs, uint64_t *out, uint32_t cap, uint32_t *onum) {
+  return _cursor_dup_combine(curs, ncurs, true, out, cap, onum);
+}
+
+iwrc iwkv_cursor_dup_union(IWKV_cursor *curs, uint32_t ncurs, uint64_t *out, uint32_t cap, uint32_t *onum) {
+  return _cursor_dup_combine(curs, ncurs, false, out, cap, onum);
+}
+
 #include "./dbg/iwkvdbg.c"
@@ -44,11 +44,14 @@
  * <strong>Limitations:<strong>
  * - Maximum iwkv storage file size: 255 GB (0x3fffffffc0)
  * - Total size of a single key+value record must be not greater than 255Mb (0xfffffff)
- * - In-memory cache for every opened database takes ~130Kb, cache can be disposed by `iwkv_db_cache_release()`
+ * - In-memory cache for every opened database takes ~25Kb plus lower keys longer than 8 bytes,
+ *   cache can be disposed by `iwkv_db_cache_release()`
  */
 
 #include "iowow.h"
 #include "iwfile.h"
+#include "iwfsmfile.h"
+#include "iwpool.h"
 #include <stddef.h>
 #include <stdbool.h>
 
@@ -66,6 +69,7 @@ typedef enum {
   IWKV_ERROR_DUP_VALUE_SIZE,       /**< Value size is not compatible for insertion into sorted values array (IWKV_ERROR_DUP_VALUE_SIZE) */
   IWKV_ERROR_KEY_NUM_VALUE_SIZE,   /**< Given key is not compatible to storage as number (IWKV_ERROR_KEY_NUM_VALUE_SIZE)  */
   IWKV_ERROR_INCOMPATIBLE_DB_MODE, /**< Incorpatible database open mode (IWKV_ERROR_INCOMPATIBLE_DB_MODE) */
+  IWKV_ERROR_KEY_ORDER,            /**< Bulk loaded keys are not in database order (IWKV_ERROR_KEY_ORDER) */
   _IWKV_ERROR_END,
   /* Internal error codes */
   _IWKV_ERROR_KVBLOCK_FULL,
@@ -78,7 +82,25 @@ typedef enum {
 typedef enum {
   IWKV_NOLOCKS  = 0x1,      /**< Do not use any locking on storage file (assumed single threaded app) */
   IWKV_RDONLY   = 0x2,      /**< Open storage file in read-only mode */
-  IWKV_TRUNC    = 0x4       /**< Truncate storage file on open */
+  IWKV_TRUNC    = 0x4,      /**< Truncate storage file on open */
+  IWKV_MMAP_RANDOM   = 0x8,   /**< Point lookups workload: kernel readahead of storage file is disabled,
+                                   cursors prefetch the next block explicitly */
+  IWKV_MMAP_HUGEPAGE = 0x10,  /**< Map storage file using transparent huge pages if supported by platform */
+  IWKV_MMAP_POPULATE = 0x20,  /**< Prefault storage file pages on open for warm start */
+  IWKV_MMAP_NUMA     = 0x40,  /**< Prefer `IWKV_OPTS::numa_node` for pages of storage file */
+  IWKV_SHARED        = 0x80,  /**< Storage is shared by one writer process and many reader processes
+                                   opened with `IWKV_SHARED | IWKV_RDONLY`. Readers map storage files
+                                   and see updates of writer without reopening: modification counters
+                                   are kept in shared `<path>-shm` file, databases created or destroyed
+                                   by writer are reloaded by readers incrementally. Storage file is never
+                                   shrunk by writer. Readers support `iwkv_get()`, `iwkv_get_pooled()`
+                                   and `iwkv_get_many()` only, cursors and views are not implemented.
+                                   Hot records cache and bloom filters are not used by readers. */
+  IWKV_FSM_MAGAZINES = 0x100  /**< Serve SBLK and KVBLK allocations from size-class caches of
+                                   reserved blocks (`IWFSM_MAGAZINES`), so concurrent writers take
+                                   the global free-space lock once per batch of allocations.
+                                   Blocks are placed differently from storage opened without this flag.
+                                   Ignored in `IWKV_NOLOCKS` and `IWKV_RDONLY` modes. */
 } iwkv_openflags;
 
 /**
@@ -88,9 +110,35 @@ typedef enum {
   IWDB_UINT32_KEYS = 0x1,     /**< Database keys are 32bit unsigned integers */
   IWDB_UINT64_KEYS = 0x2,     /**< Database keys are 64bit unsigned integers */
   IWDB_DUP_UINT32_VALS = 0x4, /**< Record key value is an array of sorted uint32 values */
-  IWDB_DUP_UINT64_VALS = 0x8  /**< Record key value is an array of sorted uint64 values */
+  IWDB_DUP_UINT64_VALS = 0x8, /**< Record key value is an array of sorted uint64 values */
+  IWDB_COMPRESSED = 0x10,     /**< Record values are transparently compressed with LZ4 block format.
+                                   Not compatible with `IWDB_DUP_UINT32_VALS`|`IWDB_DUP_UINT64_VALS` */
+  IWDB_BLOOM_FILTER = 0x20,   /**< Keep in memory bloom filter of database keys (~10 bits per key)
+                                   so lookups and deletions of missing keys are answered
+                                   without skip list traversal. Filter is saved on close */
+  IWDB_DUP_PACKED = 0x40,     /**< Sorted values arrays of `IWDB_DUP_UINT32_VALS`|`IWDB_DUP_UINT64_VALS`
+                                   database are stored as chunks of delta encoded values,
+                                   so adding or removing of a value rewrites a single chunk.
+                                   Arrays are accessible only by `iwkv_cursor_dup_*` functions */
+  IWDB_OVERFLOW_VALS = 0x80,  /**< Values larger than overflow threshold are stored out of line
+                                   in their own file extents, see `iwkv_db_overflow_threshold()`.
+                                   Not compatible with `IWDB_COMPRESSED` and `IWDB_DUP_XXX` modes */
+  IWDB_WIDE_NODES = 0x100,    /**< Skip list nodes hold up to 64 key/value pairs instead of 32.
+                                   Halves number of nodes and levels visited by lookups and scans
+                                   of large databases at the cost of shorter in-node lower keys.
+                                   Node fan-out is recorded in database header
+                                   and cannot be changed after database is created */
+  IWDB_CUSTOM_KEYS = 0x200,   /**< Keys are ordered by comparator registered for database id
+                                   in `IWKV_OPTS::key_cmps`. Database is not accessible if comparator
+                                   is not registered. Not compatible with `IWDB_UINT32_KEYS`|`IWDB_UINT64_KEYS` */
 } iwdb_flags_t;
 
+/** Default size threshold of values stored out of line, see `iwkv_db_overflow_threshold()` */
+#define IWDB_OVERFLOW_THRESHOLD_DEFAULT 4096
+
+/** Min size threshold of values stored out of line */
+#define IWDB_OVERFLOW_THRESHOLD_MIN 64
+
 /**
  * @brief Record store modes used in `iwkv_put()` and `iwkv_cursor_set()` functions.
  */
@@ -108,15 +156,140 @@ typedef struct IWKV *IWKV;
 struct IWDB;
 typedef struct IWDB *IWDB;
 
+/**
+ * @brief Write ahead log (WAL) options.
+ * @details WAL is stored beside the database file as `<path>-wal`.
+ *          If enabled every put/delete operation is appended to WAL and
+ *          `IWKV_SYNC` only waits for WAL records to be flushed by `fdatasync`,
+ *          concurrent writers share a single flush (group commit).
+ *          Database file itself is modified only by checkpoint: changed pages are kept
+ *          in process memory and their images are logged into WAL before they are written in place,
+ *          WAL is truncated after that. Checkpoints run in background and by `iwkv_sync()`.
+ *          After unclean shutdown `iwkv_open()` restores database file from logged page images
+ *          and then replays records from WAL.
+ *          WAL cannot be used by `IWKV_SHARED` writer.
+ */
+typedef struct IWKV_WAL_OPTS {
+  bool enabled;                    /**< WAL is enabled. Default: false */
+  size_t checkpoint_buffer_sz;     /**< WAL size triggering checkpoint of database file. Default: 64Mb */
+  uint32_t checkpoint_timeout_sec; /**< Max time between checkpoints of database file. Default: 300 sec */
+} IWKV_WAL_OPTS;
+
+/**
+ * @brief Database cache options.
+ * @details Database cache keeps the top skip list levels in memory
+ *          in order to start key lookups from the nearest cached node.
+ *          Every lower cached level doubles cache size.
+ */
+typedef struct IWDB_CACHE_OPTS {
+  uint8_t levels;          /**< Number of cached top levels. Default: 10 (~1024 nodes) */
+  uint8_t min_level;       /**< Lowest level which can be cached. Default: 5, 1 for adaptive cache */
+  bool adaptive;           /**< Grow or shrink number of cached levels according
+                                to lookup depth and `IWKV_OPTS::cache_budget`. Default: false */
+} IWDB_CACHE_OPTS;
+
+/**
+ * @brief Background disposal options of destroyed databases.
+ * @details Blocks of database removed by `iwkv_db_destroy()` are released in background.
+ *          Chain of database blocks is split into segments by upper skip list levels,
+ *          segments are released by parallel threads in batches, every batch
+ *          is a single free-space map update.
+ */
+typedef struct IWKV_DISPOSE_OPTS {
+  uint32_t threads;        /**< Max number of threads disposing a single database.
+                                Default: number of CPU cores, up to 4 */
+  uint32_t rate;           /**< Max number of skip list blocks (up to 32 records each) released per second.
+                                Limit is not applied while storage is closing. Default: `0`, unlimited */
+  void (*progress)(uint32_t dbid, uint64_t blocks, bool done, void *ctx);
+                           /**< Optional hook called by disposal threads after every batch
+                                and once with `done` set when database disposal is completed.
+                                `blocks` is number of skip list blocks released so far.
+                                Hook must not call iwkv API. */
+  void *progress_ctx;      /**< Opaque data passed to `progress` hook */
+} IWKV_DISPOSE_OPTS;
+
 /**
  * @brief IWKV storage open options.
  */
+/**
+ * @brief Keys comparator of `IWDB_CUSTOM_KEYS` database.
+ * @details Comparator returns negative value if `k1 < k2`, zero if keys are equal
+ *          and positive value if `k1 > k2`. Keys are equal only if they have the same bytes
+ *          since bloom filter and hot records cache match keys by their bytes.
+ *          Ordering of database keys must not be changed after database is created.
+ * @see IWKV_OPTS::key_cmps
+ */
+typedef struct IWKV_KEY_CMP {
+  uint32_t dbid;           /**< Database id */
+  int (*cmp)(const void *k1, uint32_t k1len, const void *k2, uint32_t k2len, void *op); /**< Comparator */
+  void *op;                /**< Opaque data passed to `cmp` */
+} IWKV_KEY_CMP;
+
 typedef struct IWKV_OPTS {
   char *path;              /**< Path to database file */
-  int32_t random_seed;     /**< Random seed used for iwu random generator */
+  int32_t random_seed;     /**< Random seed used for iwu random generator and per-thread generators
+                                of skip list node levels */
   iwkv_openflags oflags;   /**< Bitmask of database file open modes */
+  IWKV_WAL_OPTS wal;       /**< Write ahead log options. WAL is not used in `IWKV_RDONLY` mode */
+  IWDB_CACHE_OPTS dbcache; /**< Default cache options of every database */
+  size_t cache_budget;     /**< Memory limit in bytes for all adaptive database caches. Default: unlimited */
+  size_t dirty_threshold;  /**< Size in bytes of modified data starting background writeback of storage
+                                file pages. Default: `0`, data is written back only by `iwkv_sync()` */
+  const IWTRACE *trace;    /**< Tracing hooks of file resizes, database cache rebuilds and lock waits.
+                                Must outlive storage. Ignored if library is built without tracing */
+  uint16_t numa_node;      /**< NUMA node of storage file pages used with `IWKV_MMAP_NUMA` */
+  IWKV_DISPOSE_OPTS dispose; /**< Background disposal options of destroyed databases */
+  size_t rcache_size;      /**< Memory limit in bytes of hot records cache. Values of frequently read records
+                                are kept by `iwkv_get()` in memory shared by all databases except
+                                `IWDB_DUP_FLAGS` ones. Default: `0`, cache is disabled */
+  const char **tspaces;    /**< Paths of additional storage files (tablespaces), e.g. on other devices.
+                                Every database is placed entirely in file `dbid % (tspaces_num + 1)`
+                                where file `0` is `path`. The same list must be given on every open */
+  uint16_t tspaces_num;    /**< Number of `tspaces` elements */
+  const IWKV_KEY_CMP *key_cmps; /**< Comparators of `IWDB_CUSTOM_KEYS` databases. Must outlive storage */
+  uint16_t key_cmps_num;   /**< Number of `key_cmps` elements */
 } IWKV_OPTS;
 
+/**
+ * @brief Database runtime statistics.
+ * @details Counters are accumulated since database was opened.
+ *          Average skip list descent depth is `lookup_hops / lookups`,
+ *          database cache hit rate is `cache_hits / (cache_hits + cache_misses)`.
+ * @see iwkv_db_stats()
+ */
+typedef struct IWKV_DB_STATS {
+  uint64_t puts;            /**< Number of put operations */
+  uint64_t gets;            /**< Number of get operations */
+  uint64_t dels;            /**< Number of delete operations */
+  uint64_t cursor_steps;    /**< Number of cursor movements */
+  uint64_t lookups;         /**< Number of skip list descents */
+  uint64_t lookup_hops;     /**< Number of skip list nodes visited by all descents */
+  uint64_t lookup_max_hops; /**< Max number of skip list nodes visited by a single descent */
+  uint64_t cache_hits;      /**< Descents started from a node found in database cache */
+  uint64_t cache_misses;    /**< Descents started from the database head despite of cache */
+  uint64_t cache_rebuilds;  /**< Number of database cache rebuilds */
+  uint64_t splits;          /**< Number of key/value block splits */
+  uint64_t compactions;     /**< Number of key/value block compactions */
+  uint64_t lock_waits;      /**< Number of database lock acquisitions blocked by other threads */
+  uint64_t lock_wait_ns;    /**< Time in nanoseconds spent waiting for database lock */
+  uint64_t rcache_hits;     /**< Gets answered by hot records cache, see `IWKV_OPTS::rcache_size` */
+  uint64_t rcache_misses;   /**< Gets of records not found in hot records cache */
+} IWKV_DB_STATS;
+
+/**
+ * @brief IWKV storage runtime state.
+ * @see iwkv_state()
+ */
+typedef struct IWKV_STATE {
+  IWKV_DB_STATS dbs;       /**< Statistics summed over all open databases,
+                                `lookup_max_hops` is the maximum of them */
+  IWFS_FSM_STATE fsm;      /**< Main storage file state: allocation counters and fragmentation.
+                                Files of `IWKV_OPTS::tspaces` are not included */
+  uint32_t dbnum;          /**< Number of databases */
+  size_t cache_msize;      /**< Memory used by all database caches */
+  size_t rcache_msize;     /**< Memory used by hot records cache */
+} IWKV_STATE;
+
 /**
  * @brief Data container for key/value.
  */
@@ -131,6 +304,12 @@ typedef struct IWKV_val {
 struct IWKV_cursor;
 typedef struct IWKV_cursor *IWKV_cursor;
 
+/**
+ * @brief Write batch opaque handler.
+ */
+struct IWKV_batch;
+typedef struct IWKV_batch *IWKV_batch;
+
 /**
  * @brief Database cursor operations and position flags.
  */
@@ -193,6 +372,41 @@ IW_EXPORT WUR iwrc iwkv_db(IWKV iwkv, uint32_t dbid, iwdb_flags_t flags, IWDB *d
  */
 IW_EXPORT iwrc iwkv_db_cache_release(IWDB db);
 
+/**
+ * @brief Set cache options of database.
+ * @details Database cache is rebuilt on next database access operation.
+ *          Zero fields of `opts` are set to their defaults.
+ *
+ * @param db Database handler
+ * @param opts Cache options
+ */
+IW_EXPORT iwrc iwkv_db_cache_configure(IWDB db, const IWDB_CACHE_OPTS *opts);
+
+/**
+ * @brief Place in-memory structures of database on NUMA @a node.
+ * @details Database handle with its locks and database cache are bound to @a node,
+ *          cache is kept on the node when rebuilt. Storage file pages are shared by all
+ *          databases of storage and placed by `IWKV_MMAP_NUMA` or by readers pinned
+ *          with `iwp_numa_pin_thread()`. Returns `IW_ERROR_NOT_IMPLEMENTED`
+ *          if NUMA policies are not supported by platform.
+ *
+ * @param db Database handler
+ * @param node NUMA node, see `iwp_num_numa_nodes()`
+ */
+IW_EXPORT iwrc iwkv_db_numa_bind(IWDB db, uint16_t node);
+
+/**
+ * @brief Set size threshold of values stored out of line by `IWDB_OVERFLOW_VALS` database.
+ * @details Values larger than @a threshold bytes are written into their own file extents
+ *          and `KVBLK` keeps only a reference to the extent, so updates of large values
+ *          don't relocate neighbouring pairs. Threshold is not persisted and applies
+ *          to values stored after call, default is `IWDB_OVERFLOW_THRESHOLD_DEFAULT`.
+ *
+ * @param db Database handler
+ * @param threshold Values size threshold in bytes, at least `IWDB_OVERFLOW_THRESHOLD_MIN`
+ */
+IW_EXPORT iwrc iwkv_db_overflow_threshold(IWDB db, uint32_t threshold);
+
 /**
  * @brief Get last access time (ms since epoch) of database get/put/cursor operation.
  * @details Returns `0` if database was not used before: no get/put/cursor operations used.
@@ -202,8 +416,29 @@ IW_EXPORT iwrc iwkv_db_cache_release(IWDB db);
  */
 IW_EXPORT iwrc iwkv_db_last_access_time(const IWDB db, uint64_t *ts);
 
+/**
+ * @brief Get runtime statistics of database.
+ * @details Counters are maintained per thread group and aggregated by this call
+ *          without locking so they may be slightly behind of concurrent operations.
+ *
+ * @param db Database handler
+ * @param [out] stats Statistics placeholder
+ */
+IW_EXPORT iwrc iwkv_db_stats(IWDB db, IWKV_DB_STATS *stats);
+
+/**
+ * @brief Get runtime state of iwkv storage.
+ * @details Includes statistics of all databases and state of the underlying file.
+ *
+ * @param iwkv Storage handler
+ * @param [out] state State placeholder
+ */
+IW_EXPORT iwrc iwkv_state(IWKV iwkv, IWKV_STATE *state);
+
 /**
  * @brief Destroy(drop) existing database and cleanup all of its data.
+ * @details Database data blocks are released in background, see `IWKV_DISPOSE_OPTS`.
+ *          `iwkv_close()` waits for completion of background disposal.
  *
  * @param dbp Pointer to database opened.
  */
@@ -217,6 +452,21 @@ IW_EXPORT iwrc iwkv_db_destroy(IWDB *dbp);
  */
 IW_EXPORT iwrc iwkv_sync(IWKV iwkv, iwfs_sync_flags flags);
 
+/**
+ * @brief Create backup of open storage in a new file at `target` path.
+ * @details Only storage header and allocated blocks are copied, free space
+ *          is left as holes of sparse target file, so backup takes time and space
+ *          proportional to live data. Storage operations are blocked until
+ *          allocated blocks are copied, background disposal of destroyed databases
+ *          is finished before copy is started. Target is a consistent storage
+ *          file which can be opened by `iwkv_open()`, WAL is not required for it.
+ *          Files of `IWKV_OPTS::tspaces` are copied to `<target>.1`, `<target>.2`, ...
+ *
+ * @param iwkv Storage handler.
+ * @param target Path of backup file, file must not exist.
+ */
+IW_EXPORT iwrc iwkv_online_backup(IWKV iwkv, const char *target);
+
 /**
  * @brief Close iwkv storage.
  * @details Upon successfull call of iwkv_close()
@@ -244,6 +494,128 @@ IW_EXPORT iwrc iwkv_close(IWKV *iwkvp);
  */
 IW_EXPORT iwrc iwkv_put(IWDB db, const IWKV_val *key, const IWKV_val *val, iwkv_opflags opflags);
 
+/**
+ * @brief Store a batch of records in database.
+ * @details Records are sorted by key before insertion and stored under
+ *          a single database write lock. Search path of the previous key
+ *          is reused for the next one when possible,
+ *          so batches of clustered keys are stored much faster than
+ *          the same number of `iwkv_put()` calls.
+ *
+ * @note Batch is applied in key order and stops at the first error,
+ *       records stored before an error remain in database.
+ * @note If batch contains the same key several times, the last given value wins
+ *       (or all values are added for `IWDB_DUP_UINT32_VALS`|`IWDB_DUP_UINT64_VALS` databases).
+ * @note If `IWKV_SYNC` is set changes are flushed once for the whole batch.
+ *
+ * @param db Database handler
+ * @param keys Array of `n` keys
+ * @param vals Array of `n` values, `vals[i]` is stored for `keys[i]`
+ * @param n Number of records in batch
+ * @param opflags Put options, same as for `iwkv_put()`
+ */
+IW_EXPORT iwrc iwkv_put_batch(IWDB db, const IWKV_val *keys, const IWKV_val *vals, size_t n, iwkv_opflags opflags);
+
+/**
+ * @brief Create write batch of put/delete operations over databases of `iwkv` storage.
+ * @details Operations are buffered in batch and applied by `iwkv_batch_commit()`.
+ *          Batch object must be used by one thread at a time and destroyed by `iwkv_batch_destroy()`.
+ *
+ * @param iwkv Storage handler
+ * @param [out] bp Batch handler
+ */
+IW_EXPORT WUR iwrc iwkv_batch_create(IWKV iwkv, IWKV_batch *bp);
+
+/**
+ * @brief Add put operation to batch, key and value are copied into batch.
+ *
+ * @param b Batch handler
+ * @param db Database of `b` storage
+ * @param key Key data container
+ * @param val Value data container
+ * @param opflags Put options except `IWKV_SYNC`, see `iwkv_put()`
+ */
+IW_EXPORT WUR iwrc iwkv_batch_put(IWKV_batch b, IWDB db, const IWKV_val *key, const IWKV_val *val,
+                                  iwkv_opflags opflags);
+
+/**
+ * @brief Add delete operation to batch. Deletion of missing key is not an error.
+ *
+ * @param b Batch handler
+ * @param db Database of `b` storage
+ * @param key Key data container
+ */
+IW_EXPORT WUR iwrc iwkv_batch_del(IWKV_batch b, IWDB db, const IWKV_val *key);
+
+/**
+ * @brief Apply batch operations in order they were added.
+ * @details All databases of batch are write locked at once in order of their identifiers,
+ *          so readers see either none or all batch changes.
+ *          If WAL is enabled batch is logged by a single record and replayed as a whole.
+ *          If `IWKV_SYNC` is set changes are flushed once for the whole batch.
+ *          Batch is empty after commit and can be reused.
+ *
+ * @note `IWKV_NO_OVERWRITE` puts and sizes of records are checked before any change is made,
+ *       so batch failed by `IWKV_ERROR_KEY_EXISTS` or `IWKV_ERROR_MAXKVSZ` leaves databases intact.
+ *       Removal of missing duplicated value by `IWKV_DUP_REMOVE` is not an error.
+ *       If batch is failed by storage error (eg: I/O, no space) changes made before the failure
+ *       remain in databases, batch is never logged partially.
+ *
+ * @param b Batch handler
+ * @param opflags Only `IWKV_SYNC` is used
+ */
+IW_EXPORT WUR iwrc iwkv_batch_commit(IWKV_batch b, iwkv_opflags opflags);
+
+/**
+ * @brief Destroy batch, pending operations are discarded.
+ */
+IW_EXPORT void iwkv_batch_destroy(IWKV_batch *bp);
+
+/**
+ * @brief Bulk load of pre-sorted records stream into empty database.
+ * @details Database skiplist is built bottom-up in a single pass:
+ *          records are packed into fully filled blocks laid out sequentially
+ *          in storage file and database header is written once at the end,
+ *          so load time is bounded by sequential write speed.
+ *          Records are pulled by `next` function until it returns `IWKV_ERROR_NOTFOUND`.
+ *
+ * @note Records must be given in order of `IWKV_CURSOR_NEXT` traversal
+ *       (descending keys order) without duplicates, otherwise `IWKV_ERROR_KEY_ORDER` is returned.
+ * @note Database must be empty, `IW_ERROR_INVALID_STATE` is returned otherwise.
+ *       Bulk load of `IWDB_DUP_UINT32_VALS`|`IWDB_DUP_UINT64_VALS` databases is not supported.
+ * @note Load is done under database write lock, `next` function must not access this database.
+ *       If load is failed database remains empty.
+ * @note Loaded records are not written into WAL, storage checkpoint is done after load instead.
+ *
+ * @param db Database handler
+ * @param next Records source: fills `key` and `val` of the next record,
+ *             data should remain valid until the next call
+ * @param opaq Opaque data passed to `next` function
+ * @param opflags Only `IWKV_SYNC` is used
+ */
+IW_EXPORT iwrc iwkv_bulk_load(IWDB db,
+                              iwrc(*next)(IWKV_val *key, IWKV_val *val, void *opaq),
+                              void *opaq,
+                              iwkv_opflags opflags);
+
+/**
+ * @brief Incremental compaction of storage file.
+ * @details Database blocks located near the end of file are moved into free areas
+ *          with lower addresses and free space at the end of file is truncated.
+ *          Every database is compacted under its write lock, so calls with a small
+ *          `budget` keep other operations running. Databases having open cursors
+ *          or value views are skipped. Out of line values of `IWDB_OVERFLOW_VALS`
+ *          databases are relocated along with their key/value blocks.
+ *
+ * @note Every call traverses all records of compacted databases.
+ * @note Relocations are not written into WAL, storage checkpoint is done instead.
+ *
+ * @param iwkv Storage handler
+ * @param budget Max number of bytes relocated by this call, `0` if unlimited
+ * @param [out] odone Optional, set to `true` if there was nothing to relocate
+ *                    and no database was skipped
+ */
+IW_EXPORT iwrc iwkv_compact(IWKV iwkv, uint64_t budget, bool *odone);
 
 /**
  * @brief Get value for given `key`.
@@ -257,6 +629,69 @@ IW_EXPORT iwrc iwkv_put(IWDB db, const IWKV_val *key, const IWKV_val *val, iwkv_
  */
 IW_EXPORT iwrc iwkv_get(IWDB db, const IWKV_val *key, IWKV_val *oval);
 
+/**
+ * @brief Get value for given `key` allocating its data from `pool`.
+ *
+ * Same as `iwkv_get()` but returned value is owned by `pool`
+ * and must not be freed by `iwkv_val_dispose()`. Value is released
+ * by `iwpool_reset()` or `iwpool_destroy()` of `pool`.
+ *
+ * @param db Database handler
+ * @param key Key data
+ * @param [out] oval Value associated with `key`
+ * @param pool Memory pool of value data, not null
+ */
+IW_EXPORT iwrc iwkv_get_pooled(IWDB db, const IWKV_val *key, IWKV_val *oval, IWPOOL *pool);
+
+/**
+ * @brief Get values for a set of `n` keys.
+ *
+ * Keys are sorted internally and looked up in a single forward traversal
+ * of database under one database read lock, so lookup of clustered keys
+ * is much cheaper than a sequence of `iwkv_get()` calls.
+ *
+ * @note Status of every key lookup is stored into `orcs[i]`: zero on success
+ *       or `IWKV_ERROR_NOTFOUND` if key not found.
+ * @note On success every found value must be freed with `iwkv_val_dispose()`.
+ *       If call is failed no values are returned.
+ *
+ * @param db Database handler
+ * @param keys Array of `n` keys
+ * @param n Number of keys
+ * @param [out] ovals Array of `n` values, `ovals[i]` is associated with `keys[i]`
+ * @param [out] orcs Array of `n` lookup statuses
+ */
+IW_EXPORT iwrc iwkv_get_many(IWDB db, const IWKV_val *keys, size_t n, IWKV_val *ovals, iwrc *orcs);
+
+/**
+ * @brief Get zero-copy view of value for given `key`.
+ *
+ * On success `oval->data` points directly into the memory mapped database file,
+ * no value copy is made. Database read lock and mmap read lock are held
+ * until view is released by `iwkv_view_release()`.
+ *
+ * @note If not matching record found `IWKV_ERROR_NOTFOUND` will be returned,
+ *       no locks are held in that case or on any other error.
+ * @note View data must not be modified or freed by caller.
+ * @note Views are not supported by `IWDB_COMPRESSED` databases,
+ *       `IWKV_ERROR_INCOMPATIBLE_DB_MODE` is returned.
+ * @note While view is held, writers of this database are blocked. Thread
+ *       holding a view must not modify any database of the same storage.
+ *
+ * @param db Database handler
+ * @param key Key data
+ * @param [out] oval Value view associated with `key`
+ */
+IW_EXPORT iwrc iwkv_get_view(IWDB db, const IWKV_val *key, IWKV_val *oval);
+
+/**
+ * @brief Release value view obtained by `iwkv_get_view()`.
+ *
+ * @param db Database handler used to get the view
+ * @param view Value view to be released, its content is reset
+ */
+IW_EXPORT iwrc iwkv_view_release(IWDB db, IWKV_val *view);
+
 /**
  * @brief Remove record identified by `key`.
  *
@@ -266,6 +701,29 @@ IW_EXPORT iwrc iwkv_get(IWDB db, const IWKV_val *key, IWKV_val *oval);
  */
 IW_EXPORT iwrc iwkv_del(IWDB db, const IWKV_val *key);
 
+/**
+ * @brief Remove all records with keys in range `from <= key < to`.
+ *
+ * Blocks holding only keys in range are unlinked at once and
+ * deallocated in background, no record is looked up individually.
+ * Range removal is not logged by WAL, storage checkpoint is done instead.
+ *
+ * @param db Database handler
+ * @param from The lowest key of range, `NULL` if range is not bounded below
+ * @param to Key next after range, `NULL` if range is not bounded above
+ */
+IW_EXPORT iwrc iwkv_del_range(IWDB db, const IWKV_val *from, const IWKV_val *to);
+
+/**
+ * @brief Remove all records with keys starting with `prefix`.
+ *
+ * Returns `IWKV_ERROR_INCOMPATIBLE_DB_MODE` for databases with number keys.
+ * @see iwkv_del_range()
+ * @param db Database handler
+ * @param prefix Keys prefix, all records are removed if prefix is empty
+ */
+IW_EXPORT iwrc iwkv_del_prefix(IWDB db, const IWKV_val *prefix);
+
 /**
  * @brief Destroy key/value data container.
  *
@@ -298,6 +756,81 @@ IW_EXPORT WUR iwrc iwkv_cursor_open(IWDB db,
                                     IWKV_cursor *cur,
                                     IWKV_cursor_op op,
                                     const IWKV_val *key);
+
+/**
+ * @brief Open database cursor bounded by keys range `lo <= key < hi`.
+ *
+ * Cursor moves return `IWKV_ERROR_NOTFOUND` at range boundaries,
+ * `IWKV_CURSOR_EQ` and `IWKV_CURSOR_GE` fail with `IWKV_ERROR_NOTFOUND`
+ * for records out of range.
+ *
+ * @param db Database handler
+ * @param cur Pointer to an allocated cursor structure to be initialized
+ * @param op Initial position: `IWKV_CURSOR_BEFORE_FIRST` or `IWKV_CURSOR_AFTER_LAST` of range
+ * @param lo The lowest key of range, `NULL` if range is not bounded below
+ * @param hi Key next after range, `NULL` if range is not bounded above
+ */
+IW_EXPORT WUR iwrc iwkv_cursor_open_range(IWDB db,
+                                          IWKV_cursor *cur,
+                                          IWKV_cursor_op op,
+                                          const IWKV_val *lo,
+                                          const IWKV_val *hi);
+
+/**
+ * @brief Open database cursor bounded by keys starting with `prefix`.
+ *
+ * Cursor moves return `IWKV_ERROR_NOTFOUND` once traversal leaves records with
+ * the given prefix, so there is no need to compare keys on caller side.
+ * Returns `IWKV_ERROR_INCOMPATIBLE_DB_MODE` for databases with number keys.
+ * @see iwkv_cursor_open_range()
+ *
+ * @param db Database handler
+ * @param cur Pointer to an allocated cursor structure to be initialized
+ * @param op Initial position: `IWKV_CURSOR_BEFORE_FIRST` or `IWKV_CURSOR_AFTER_LAST` of range
+ * @param prefix Keys prefix, cursor is not bounded if prefix is empty
+ */
+IW_EXPORT WUR iwrc iwkv_cursor_open_prefix(IWDB db,
+                                           IWKV_cursor *cur,
+                                           IWKV_cursor_op op,
+                                           const IWKV_val *prefix);
+
+/**
+ * @brief Open up to `num` cursors over adjacent key ranges covering the whole database.
+ *
+ * Split keys are taken from evenly spaced blocks of the upper skip list levels,
+ * so ranges hold roughly the same number of records. Every cursor is bounded
+ * by its range and placed before its first record, `curs[0]` range holds
+ * records traversed first by `IWKV_CURSOR_NEXT`. Cursors are independent
+ * and can be used by different threads. Less than `num` cursors are opened
+ * for small databases.
+ *
+ * @param db Database handler
+ * @param curs Array of at least `num` cursor pointers to be initialized
+ * @param num Maximum number of cursors
+ * @param [out] onum Number of opened cursors
+ */
+IW_EXPORT WUR iwrc iwkv_cursor_open_parts(IWDB db, IWKV_cursor *curs, uint32_t num, uint32_t *onum);
+
+/**
+ * @brief Open read only database cursor over a snapshot of database taken at cursor opening.
+ *
+ * Writers are not blocked by snapshot cursor, and cursor doesn't see records
+ * put, updated or removed after it has been opened. While snapshot is open writers keep
+ * in memory copies of database blocks they modify, so memory usage grows
+ * with amount of data changed. Space of removed blocks is reclaimed
+ * when the last snapshot of database is closed.
+ * `iwkv_cursor_set()` and cursor dup modifications return `IW_ERROR_READONLY`.
+ *
+ * @param db Database handler
+ * @param cur Pointer to an allocated cursor structure to be initialized
+ * @param op Cursor open mode/initial positions flags
+ * @param key Optional key argument, required to point cursor to the given key.
+ */
+IW_EXPORT WUR iwrc iwkv_cursor_open_snapshot(IWDB db,
+                                             IWKV_cursor *cur,
+                                             IWKV_cursor_op op,
+                                             const IWKV_val *key);
+
 /**
  * @brief Move cursor to the next position.
  *
@@ -325,6 +858,42 @@ IW_EXPORT WUR iwrc iwkv_cursor_to_key(IWKV_cursor cur, IWKV_cursor_op op, const
  */
 IW_EXPORT iwrc iwkv_cursor_get(IWKV_cursor cur, IWKV_val *okey, IWKV_val *oval);
 
+/**
+ * @brief Get key and value at current cursor position allocating their data from `pool`.
+ * @note Data stored in okey/oval containers is owned by `pool`
+ *       and must not be freed with `iwkv_val_dispose()`.
+ *
+ * @param cur Opened cursor object
+ * @param okey Key container to be initialized by key at current position. Can be null.
+ * @param oval Value container to be initialized by value at current position. Can be null.
+ * @param pool Memory pool of key/value data, not null
+ */
+IW_EXPORT iwrc iwkv_cursor_get_pooled(IWKV_cursor cur, IWKV_val *okey, IWKV_val *oval, IWPOOL *pool);
+
+/**
+ * @brief Move cursor forward over up to `n` records copying their keys and values into `buf`.
+ *
+ * Equivalent of repeated `iwkv_cursor_to(cur, IWKV_CURSOR_NEXT)` followed by `iwkv_cursor_get()`
+ * performed under a single database lock. Readahead of storage blocks following cursor
+ * is requested along the way. Upon return cursor points to the last returned record.
+ *
+ * Data of the returned keys and values is placed sequentially into `buf`,
+ * `okeys`/`ovals` containers point into `buf` and must not be disposed.
+ * Batch is stopped before the first record which does not fit into remaining `buf` space.
+ *
+ * @param cur Opened cursor object
+ * @param [out] okeys Array of at least `n` key containers. Can be null.
+ * @param [out] ovals Array of at least `n` value containers. Can be null.
+ * @param n Maximum number of records to fetch.
+ * @param buf Buffer to hold keys and values data.
+ * @param bufsz Buffer size.
+ * @param [out] onum Number of records fetched.
+ * @return `IWKV_ERROR_NOTFOUND` if there are no more records,
+ *         `IW_ERROR_OVERFLOW` if the next record does not fit into `buf`.
+ */
+IW_EXPORT iwrc iwkv_cursor_next_batch(IWKV_cursor cur, IWKV_val *okeys, IWKV_val *ovals, size_t n,
+                                      uint8_t *buf, size_t bufsz, size_t *onum);
+
 /**
  * @brief Get value at current cursor position.
  * @note Data stored in oval container must be freed with `iwkv_val_dispose()`.
@@ -432,6 +1001,74 @@ IW_EXPORT iwrc iwkv_cursor_dup_iter(const IWKV_cursor cur,
                                     void *opaq,
                                     const uint64_t *start,
                                     bool down);
+
+/**
+ * @brief Copy elements `[start, end)` of array of numbers at current cursor position.
+ * @details Elements are copied in bulk without per element callbacks.
+ *
+ * @param cur Opened cursor
+ * @param start Index of the first element to copy
+ * @param end Index after the last element to copy, clipped by array length
+ * @param [out] out Buffer of at least `end - start` elements:
+ *                  `uint32_t` for `IWDB_DUP_UINT32_VALS`, `uint64_t` for `IWDB_DUP_UINT64_VALS` database
+ * @param [out] onum Number of copied elements
+ */
+IW_EXPORT iwrc iwkv_cursor_dup_slice(const IWKV_cursor cur, uint32_t start, uint32_t end,
+                                     void *out, uint32_t *onum);
+
+/**
+ * @brief Add elements to value array at current cursor position.
+ * @details Given numbers are merged with the array in a single pass
+ *          and the array is written once.
+ * @note Usable only for `IWDB_DUP_UINT32_VALS`|`IWDB_DUP_UINT64_VALS` database modes.
+ *
+ * @param cur Opened cursor object
+ * @param dvs Numbers to be added in any order, duplicates are ignored
+ * @param num Number of elements in `dvs`
+ */
+IW_EXPORT iwrc iwkv_cursor_dup_add_many(IWKV_cursor cur, const uint64_t *dvs, uint32_t num);
+
+/**
+ * @brief Remove elements from value array at current cursor position.
+ * @details Numbers not found in the array are ignored.
+ * @note Usable only for `IWDB_DUP_UINT32_VALS`|`IWDB_DUP_UINT64_VALS` database modes.
+ *
+ * @param cur Opened cursor object
+ * @param dvs Numbers to be removed in any order
+ * @param num Number of elements in `dvs`
+ */
+IW_EXPORT iwrc iwkv_cursor_dup_rm_many(IWKV_cursor cur, const uint64_t *dvs, uint32_t num);
+
+/**
+ * @brief Intersect value arrays at positions of the given cursors.
+ * @details Arrays are read in place, elements of the shortest array
+ *          are looked up in the others by galloping search.
+ *
+ * @note All cursors must be opened on the same database.
+ *
+ * @param curs Opened cursors
+ * @param ncurs Number of cursors
+ * @param [out] out Buffer for ascending ordered result
+ * @param cap Capacity of `out` buffer, result elements beyond `cap` are not stored
+ * @param [out] onum Total number of result elements, may be greater than `cap`
+ */
+IW_EXPORT iwrc iwkv_cursor_dup_intersect(IWKV_cursor *curs, uint32_t ncurs,
+                                         uint64_t *out, uint32_t cap, uint32_t *onum);
+
+/**
+ * @brief Union value arrays at positions of the given cursors.
+ *
+ * @note All cursors must be opened on the same database.
+ *
+ * @param curs Opened cursors
+ * @param ncurs Number of cursors
+ * @param [out] out Buffer for ascending ordered result
+ * @param cap Capacity of `out` buffer, result elements beyond `cap` are not stored
+ * @param [out] onum Total number of result elements, may be greater than `cap`
+ */
+IW_EXPORT iwrc iwkv_cursor_dup_union(IWKV_cursor *curs, uint32_t ncurs,
+                                     uint64_t *out, uint32_t cap, uint32_t *onum);
+
 /**
  * @brief Close cursor object.
  * @param cur Opened cursor
@@ -0,0 +1,4670 @@
+#include "iwkv.h"
+#include "iwlog.h"
+#include "iwutils.h"
+#include "iwp.h"
+#include "iwcfg.h"
+#include <CUnit/Basic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern int8_t iwkv_next_level;
+extern volatile int32_t iwkv_kill_on_split;
+extern volatile int32_t iwkv_kill_on_writeback;
+
+int init_suite(void) {
+  iwrc rc = iwkv_init();
+  return rc;
+}
+
+int clean_suite(void) {
+  return 0;
+}
+
+static void iwkv_test4_1(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_1.db",
+    .oflags = IWKV_TRUNC
+  };
+  const int nbatch = 10;
+  const int bsize = 10000;
+  IWKV iwkv;
+  IWDB db1;
+  IWKV_val key, val;
+  IWKV_cursor cur;
+  IWKV_val *keys = calloc(bsize, sizeof(*keys));
+  IWKV_val *vals = calloc(bsize, sizeof(*vals));
+  uint64_t *kbuf = calloc(bsize, sizeof(*kbuf));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(keys);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(vals);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(kbuf);
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT64_KEYS, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Interleaved batches of keys given in reverse order
+  for (int b = 0; b < nbatch; ++b) {
+    for (int i = 0; i < bsize; ++i) {
+      kbuf[i] = (uint64_t)(bsize - i - 1) * nbatch + b;
+      keys[i].data = &kbuf[i];
+      keys[i].size = sizeof(uint64_t);
+      vals[i].data = &kbuf[i];
+      vals[i].size = sizeof(uint64_t);
+    }
+    rc = iwkv_put_batch(db1, keys, vals, bsize, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (uint64_t v = 0; v < (uint64_t) nbatch * bsize; ++v) {
+    uint64_t llv;
+    key.data = &v;
+    key.size = sizeof(uint64_t);
+    rc = iwkv_get(db1, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    memcpy(&llv, val.data, sizeof(llv));
+    CU_ASSERT_EQUAL_FATAL(llv, v);
+    iwkv_val_dispose(&val);
+  }
+  // Check records order, keys are traversed in descending order
+  uint64_t cnt = 0;
+  rc = iwkv_cursor_open(db1, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) {
+    uint64_t llv;
+    size_t sz;
+    rc = iwkv_cursor_copy_key(cur, (void *) &llv, sizeof(llv), &sz);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(llv, (uint64_t) nbatch * bsize - cnt - 1);
+    ++cnt;
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(cnt, (uint64_t) nbatch * bsize);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Existing key in batch
+  uint64_t k1 = 1, k2 = (uint64_t) nbatch * bsize + 1;
+  keys[0].data = &k2;
+  keys[1].data = &k1;
+  vals[0].data = &k2;
+  vals[1].data = &k2;
+  rc = iwkv_put_batch(db1, keys, vals, 2, IWKV_NO_OVERWRITE);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_KEY_EXISTS);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(keys);
+  free(vals);
+  free(kbuf);
+}
+
+static void iwkv_test4_2(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_2.db",
+    .oflags = IWKV_TRUNC
+  };
+  const int bsize = 2000;
+  char kbuf[64];
+  char vbuf[64];
+  IWKV iwkv;
+  IWDB db1;
+  IWKV_val key, val;
+  IWKV_val *keys = calloc(bsize, sizeof(*keys));
+  IWKV_val *vals = calloc(bsize, sizeof(*vals));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(keys);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(vals);
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  for (int i = 0; i < bsize; ++i) {
+    // Every key is given twice, the last value wins
+    snprintf(kbuf, sizeof(kbuf), "key%d", (i * 7) % (bsize / 2));
+    snprintf(vbuf, sizeof(vbuf), "val%d", i);
+    keys[i].data = strdup(kbuf);
+    keys[i].size = strlen(kbuf);
+    vals[i].data = strdup(vbuf);
+    vals[i].size = strlen(vbuf);
+  }
+  rc = iwkv_put_batch(db1, keys, vals, bsize, IWKV_SYNC);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  for (int i = bsize / 2; i < bsize; ++i) {
+    rc = iwkv_get(db1, &keys[i], &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(val.size, vals[i].size);
+    CU_ASSERT_NSTRING_EQUAL(val.data, vals[i].data, val.size);
+    iwkv_val_dispose(&val);
+  }
+  key.data = "key";
+  key.size = 3;
+  rc = iwkv_get(db1, &key, &val);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < bsize; ++i) {
+    free(keys[i].data);
+    free(vals[i].data);
+  }
+  free(keys);
+  free(vals);
+}
+
+static void iwkv_test4_3(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_3.db",
+    .oflags = IWKV_TRUNC
+  };
+  char kbuf[64];
+  char vbuf[64];
+  IWKV iwkv;
+  IWDB db1;
+  IWKV_val key, val, view;
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < 1000; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "key%d", i);
+    snprintf(vbuf, sizeof(vbuf), "val%d", i);
+    key.data = kbuf;
+    key.size = strlen(kbuf);
+    val.data = vbuf;
+    val.size = strlen(vbuf);
+    rc = iwkv_put(db1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (int i = 0; i < 1000; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "key%d", i);
+    snprintf(vbuf, sizeof(vbuf), "val%d", i);
+    key.data = kbuf;
+    key.size = strlen(kbuf);
+    rc = iwkv_get_view(db1, &key, &view);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(view.size, strlen(vbuf));
+    CU_ASSERT_NSTRING_EQUAL(view.data, vbuf, view.size);
+    // Other readers are not blocked by view
+    rc = iwkv_get(db1, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_NSTRING_EQUAL(val.data, view.data, val.size);
+    iwkv_val_dispose(&val);
+    rc = iwkv_view_release(db1, &view);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_PTR_NULL(view.data);
+  }
+  key.data = "nokey";
+  key.size = 5;
+  rc = iwkv_get_view(db1, &key, &view);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+
+  // Writes are allowed once views are released
+  val.data = "updated";
+  val.size = 7;
+  rc = iwkv_put(db1, &key, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_get_view(db1, &key, &view);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(view.size, 7);
+  CU_ASSERT_NSTRING_EQUAL(view.data, "updated", view.size);
+  rc = iwkv_view_release(db1, &view);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+typedef struct WALTCTX {
+  IWDB db;
+  int tid;
+  int num;
+} WALTCTX;
+
+static void *iwkv_test4_4_worker(void *op) {
+  WALTCTX *ctx = op;
+  for (int i = 0; i < ctx->num; ++i) {
+    uint64_t llv = (uint64_t) ctx->tid * ctx->num + i;
+    IWKV_val key = {.data = &llv, .size = sizeof(llv)};
+    IWKV_val val = {.data = &llv, .size = sizeof(llv)};
+    iwrc rc = iwkv_put(ctx->db, &key, &val, IWKV_SYNC);
+    if (rc) {
+      return (void *)(intptr_t) rc;
+    }
+  }
+  return 0;
+}
+
+static void iwkv_test4_copy_file(const char *src, const char *dst) {
+  char buf[8192];
+  size_t sz;
+  FILE *in = fopen(src, "rb");
+  CU_ASSERT_PTR_NOT_NULL_FATAL(in);
+  FILE *out = fopen(dst, "wb");
+  CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+  while ((sz = fread(buf, 1, sizeof(buf), in)) > 0) {
+    CU_ASSERT_EQUAL_FATAL(fwrite(buf, 1, sz, out), sz);
+  }
+  fclose(in);
+  fclose(out);
+}
+
+static bool iwkv_test4_same_files(const char *path1, const char *path2) {
+  char buf1[8192], buf2[8192];
+  size_t sz1, sz2;
+  bool ret = true;
+  FILE *f1 = fopen(path1, "rb");
+  CU_ASSERT_PTR_NOT_NULL_FATAL(f1);
+  FILE *f2 = fopen(path2, "rb");
+  CU_ASSERT_PTR_NOT_NULL_FATAL(f2);
+  do {
+    sz1 = fread(buf1, 1, sizeof(buf1), f1);
+    sz2 = fread(buf2, 1, sizeof(buf2), f2);
+    if (sz1 != sz2 || memcmp(buf1, buf2, sz1)) {
+      ret = false;
+      break;
+    }
+  } while (sz1 > 0);
+  fclose(f1);
+  fclose(f2);
+  return ret;
+}
+
+static void iwkv_test4_4(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_4.db",
+    .oflags = IWKV_TRUNC,
+    .wal = {
+      .enabled = true
+    }
+  };
+  const int nthreads = 4;
+  const int num = 500;
+  pthread_t threads[nthreads];
+  WALTCTX ctx[nthreads];
+  IWP_FILE_STAT fstat;
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_val key, val;
+
+  // Empty storage used to replay log
+  IWKV_OPTS opts2 = {
+    .path = "iwkv_test4_4_2.db",
+    .oflags = IWKV_TRUNC
+  };
+  iwrc rc = iwkv_open(&opts2, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT64_KEYS, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, 0, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < nthreads; ++i) {
+    ctx[i].db = db1;
+    ctx[i].tid = i;
+    ctx[i].num = num;
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&threads[i], 0, iwkv_test4_4_worker, &ctx[i]), 0);
+  }
+  for (int i = 0; i < nthreads; ++i) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    CU_ASSERT_PTR_NULL(ret);
+  }
+  for (uint64_t v = 0; v < num; v += 2) {
+    key.data = &v;
+    key.size = sizeof(v);
+    rc = iwkv_del(db1, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  key.data = "foo";
+  key.size = 3;
+  val.data = "bar";
+  val.size = 3;
+  rc = iwkv_put(db2, &key, &val, IWKV_SYNC);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Simulate crash: take log with synced records before close
+  iwkv_test4_copy_file("iwkv_test4_4.db-wal", "iwkv_test4_4_2.db-wal");
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwp_fstat("iwkv_test4_4.db-wal", &fstat);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(fstat.size, 0);
+
+  // Replay log on top of empty storage
+  opts2.oflags = 0;
+  opts2.wal.enabled = true;
+  rc = iwkv_open(&opts2, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT64_KEYS, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint64_t v = 0; v < (uint64_t) nthreads * num; ++v) {
+    key.data = &v;
+    key.size = sizeof(v);
+    rc = iwkv_get(db1, &key, &val);
+    if (v < num && !(v & 1)) {
+      CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+    } else {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL_FATAL(val.size, sizeof(v));
+      CU_ASSERT_EQUAL_FATAL(*(uint64_t *) val.data, v);
+      iwkv_val_dispose(&val);
+    }
+  }
+  rc = iwkv_db(iwkv, 2, 0, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  key.data = "foo";
+  key.size = 3;
+  rc = iwkv_get(db2, &key, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_NSTRING_EQUAL(val.data, "bar", val.size);
+  iwkv_val_dispose(&val);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+typedef struct OGETTCTX {
+  IWDB db;
+  int num;
+  volatile bool stop;
+} OGETTCTX;
+
+static void *iwkv_test4_5_reader(void *op) {
+  OGETTCTX *ctx = op;
+  uint64_t vbuf[2];
+  IWKV_val key, val;
+  while (!ctx->stop) {
+    for (uint64_t k = 0; k < ctx->num; ++k) {
+      key.data = &k;
+      key.size = sizeof(k);
+      iwrc rc = iwkv_get(ctx->db, &key, &val);
+      if (rc == IWKV_ERROR_NOTFOUND) {
+        continue;
+      }
+      if (rc) {
+        return (void *)(intptr_t) rc;
+      }
+      if (val.size != sizeof(vbuf)) {
+        iwkv_val_dispose(&val);
+        return (void *)(intptr_t) IW_ERROR_FAIL;
+      }
+      memcpy(vbuf, val.data, sizeof(vbuf));
+      iwkv_val_dispose(&val);
+      if (vbuf[0] != k) {
+        return (void *)(intptr_t) IW_ERROR_FAIL;
+      }
+    }
+  }
+  return 0;
+}
+
+static void iwkv_test4_5(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_5.db",
+    .oflags = IWKV_TRUNC
+  };
+  const int nthreads = 4;
+  const int num = 2000;
+  pthread_t threads[nthreads];
+  OGETTCTX ctx = {
+    .num = num
+  };
+  IWKV iwkv;
+  IWKV_val key, val;
+  uint64_t vbuf[2];
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT64_KEYS, &ctx.db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint64_t k = 0; k < num; k += 2) {
+    vbuf[0] = k;
+    vbuf[1] = 0;
+    key.data = &k;
+    key.size = sizeof(k);
+    val.data = vbuf;
+    val.size = sizeof(vbuf);
+    rc = iwkv_put(ctx.db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (int i = 0; i < nthreads; ++i) {
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&threads[i], 0, iwkv_test4_5_reader, &ctx), 0);
+  }
+  // Concurrent modifications: inserts, deletes and cursor updates
+  for (uint64_t r = 1; r < 6; ++r) {
+    for (uint64_t k = 0; k < num; ++k) {
+      vbuf[0] = k;
+      vbuf[1] = r;
+      key.data = &k;
+      key.size = sizeof(k);
+      val.data = vbuf;
+      val.size = sizeof(vbuf);
+      if ((k + r) % 3) {
+        rc = iwkv_put(ctx.db, &key, &val, 0);
+      } else {
+        rc = iwkv_del(ctx.db, &key);
+        if (rc == IWKV_ERROR_NOTFOUND) {
+          rc = 0;
+        }
+      }
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+    IWKV_cursor cur;
+    rc = iwkv_cursor_open(ctx.db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) {
+      rc = iwkv_cursor_get(cur, &key, 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      memcpy(&vbuf[0], key.data, sizeof(vbuf[0]));
+      vbuf[1] = r;
+      iwkv_val_dispose(&key);
+      val.data = vbuf;
+      val.size = sizeof(vbuf);
+      rc = iwkv_cursor_set(cur, &val, 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+    CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+    rc = iwkv_cursor_close(&cur);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  ctx.stop = true;
+  for (int i = 0; i < nthreads; ++i) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    CU_ASSERT_PTR_NULL(ret);
+  }
+  for (uint64_t k = 0; k < num; ++k) {
+    key.data = &k;
+    key.size = sizeof(k);
+    rc = iwkv_get(ctx.db, &key, &val);
+    if ((k + 5) % 3) {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL_FATAL(val.size, sizeof(vbuf));
+      memcpy(vbuf, val.data, sizeof(vbuf));
+      CU_ASSERT_EQUAL(vbuf[0], k);
+      CU_ASSERT_EQUAL(vbuf[1], 5);
+      iwkv_val_dispose(&val);
+    } else {
+      CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+    }
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_6_db(IWKV iwkv, uint32_t dbid, iwdb_flags_t dbflg) {
+  IWDB db;
+  IWKV_val key, val;
+  IWKV_cursor cur;
+  const uint64_t num = 50000;
+  uint32_t ksz = (dbflg & IWDB_UINT64_KEYS) ? sizeof(uint64_t) : sizeof(uint32_t);
+  iwrc rc = iwkv_db(iwkv, dbid, dbflg, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint64_t i = 0; i < num; ++i) {
+    uint64_t k = (i * 2654435761ULL) % 4294967291ULL;
+    uint32_t lk = k;
+    key.data = (ksz == sizeof(k)) ? (void *) &k : (void *) &lk;
+    key.size = ksz;
+    val.data = &i;
+    val.size = sizeof(i);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (uint64_t i = 0; i < num; i += 3) {
+    uint64_t k = (i * 2654435761ULL) % 4294967291ULL;
+    uint32_t lk = k;
+    key.data = (ksz == sizeof(k)) ? (void *) &k : (void *) &lk;
+    key.size = ksz;
+    rc = iwkv_del(db, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (uint64_t i = 0; i < num; ++i) {
+    uint64_t k = (i * 2654435761ULL) % 4294967291ULL;
+    uint32_t lk = k;
+    key.data = (ksz == sizeof(k)) ? (void *) &k : (void *) &lk;
+    key.size = ksz;
+    rc = iwkv_get(db, &key, &val);
+    if (i % 3) {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL_FATAL(val.size, sizeof(i));
+      CU_ASSERT_EQUAL(*(uint64_t *) val.data, i);
+      iwkv_val_dispose(&val);
+    } else {
+      CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+    }
+    if (i % 97) {
+      continue;
+    }
+    rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_EQ, &key);
+    if (i % 3) {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      rc = iwkv_cursor_val(cur, &val);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL(*(uint64_t *) val.data, i);
+      iwkv_val_dispose(&val);
+    } else {
+      CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+    }
+    rc = iwkv_cursor_close(&cur);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+}
+
+// Integer keys lookups through dbcache and SBLK
+static void iwkv_test4_6(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_6.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_6_db(iwkv, 1, IWDB_UINT64_KEYS);
+  iwkv_test4_6_db(iwkv, 2, IWDB_UINT32_KEYS);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_7_lookup(IWDB db, uint64_t num) {
+  IWKV_val key, val;
+  IWKV_cursor cur;
+  for (uint64_t i = 0; i < num; ++i) {
+    uint64_t k = (i * 2654435761ULL) % 4294967291ULL;
+    key.data = &k;
+    key.size = sizeof(k);
+    iwrc rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_EQ, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_cursor_val(cur, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL(*(uint64_t *) val.data, i);
+    iwkv_val_dispose(&val);
+    rc = iwkv_cursor_close(&cur);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+}
+
+// Adaptive and configured database caches
+static void iwkv_test4_7(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_7.db",
+    .oflags = IWKV_TRUNC,
+    .dbcache = {
+      .adaptive = true
+    },
+    .cache_budget = 64 * 1024
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_val key, val;
+  const uint64_t num = 100000;
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT64_KEYS, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_UINT64_KEYS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWDB_CACHE_OPTS copts = {
+    .levels = 2,
+    .min_level = 3
+  };
+  rc = iwkv_db_cache_configure(db2, &copts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db_cache_configure(db2, 0);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_INVALID_ARGS);
+
+  for (uint64_t i = 0; i < num; ++i) {
+    uint64_t k = (i * 2654435761ULL) % 4294967291ULL;
+    key.data = &k;
+    key.size = sizeof(k);
+    val.data = &i;
+    val.size = sizeof(i);
+    rc = iwkv_put(db1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_put(db2, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  iwkv_test4_7_lookup(db1, num);
+  iwkv_test4_7_lookup(db2, num);
+
+  // Switch caches at runtime
+  copts.levels = 0;
+  copts.min_level = 0;
+  copts.adaptive = true;
+  rc = iwkv_db_cache_configure(db2, &copts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  copts.adaptive = false;
+  rc = iwkv_db_cache_configure(db1, &copts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_7_lookup(db1, num);
+  iwkv_test4_7_lookup(db2, num);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_8_check(IWDB db, const uint8_t *live, uint32_t num) {
+  IWKV_val key, val;
+  IWKV_cursor cur;
+  for (uint32_t i = 0; i < num; ++i) {
+    uint32_t k = i * 7;
+    key.data = &k;
+    key.size = sizeof(k);
+    iwrc rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_EQ, &key);
+    if (live[i]) {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      rc = iwkv_cursor_val(cur, &val);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL(*(uint32_t *) val.data, i);
+      iwkv_val_dispose(&val);
+    } else {
+      CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+    }
+    rc = iwkv_cursor_close(&cur);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+}
+
+// Incremental maintenance of database cache
+static void iwkv_test4_8(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_8.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db;
+  IWKV_val key, val;
+  const uint32_t num = 50000;
+  uint8_t *live = calloc(num, 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(live);
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT32_KEYS, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWDB_CACHE_OPTS copts = {
+    .levels = 2,
+    .min_level = 1
+  };
+  rc = iwkv_db_cache_configure(db, &copts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Cache starts from the first node of cached level and
+  // shifts up as database grows, including forced top levels
+  srandom(48);
+  for (uint32_t i = 0; i < num; ++i) {
+    uint32_t k = ((i * 2654435761ULL) % num) * 7;
+    if (i % 5000 == 4999) {
+      iwkv_next_level = 6 + i / 5000;
+    } else if (iwkv_next_level == -1) {
+      iwkv_next_level = -2;
+    }
+    key.data = &k;
+    key.size = sizeof(k);
+    uint32_t v = k / 7;
+    val.data = &v;
+    val.size = sizeof(v);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    live[v] = 1;
+  }
+  iwkv_next_level = -1;
+  iwkv_test4_8_check(db, live, num);
+
+  // Remove cached nodes and reduce database level
+  for (uint32_t i = 0; i < num; ++i) {
+    if (random() % 3) {
+      uint32_t k = i * 7;
+      key.data = &k;
+      key.size = sizeof(k);
+      rc = iwkv_del(db, &key);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      live[i] = 0;
+    }
+  }
+  iwkv_test4_8_check(db, live, num);
+
+  // Grow again over kept cache level
+  for (uint32_t i = 0; i < num; i += 2) {
+    uint32_t k = i * 7;
+    key.data = &k;
+    key.size = sizeof(k);
+    val.data = &i;
+    val.size = sizeof(i);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    live[i] = 1;
+  }
+  iwkv_test4_8_check(db, live, num);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT32_KEYS, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_8_check(db, live, num);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(live);
+}
+
+static void iwkv_test4_9_check(IWDB db, IWKV_val *keys, size_t n) {
+  IWKV_val *vals = calloc(n, sizeof(*vals));
+  iwrc *rcs = calloc(n, sizeof(*rcs));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(vals);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(rcs);
+  iwrc rc = iwkv_get_many(db, keys, n, vals, rcs);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (size_t i = 0; i < n; ++i) {
+    IWKV_val val;
+    rc = iwkv_get(db, &keys[i], &val);
+    CU_ASSERT_EQUAL(rcs[i], rc);
+    if (!rc) {
+      CU_ASSERT_EQUAL(vals[i].size, val.size);
+      CU_ASSERT_FALSE(memcmp(vals[i].data, val.data, val.size));
+      iwkv_val_dispose(&val);
+    }
+    iwkv_val_dispose(&vals[i]);
+  }
+  free(vals);
+  free(rcs);
+}
+
+// Multi-get
+static void iwkv_test4_9(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_9.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_val key, val;
+  const int num = 20000, n = 500;
+  char kbuf[n][32];
+  uint64_t ikeys[n];
+  IWKV_val keys[n];
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_UINT64_KEYS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Empty databases
+  for (int i = 0; i < n; ++i) {
+    ikeys[i] = i;
+    keys[i].data = &ikeys[i];
+    keys[i].size = sizeof(ikeys[i]);
+  }
+  iwkv_test4_9_check(db1, keys, n);
+  iwkv_test4_9_check(db2, keys, n);
+  rc = iwkv_get_many(db2, keys, 0, 0, 0);
+  CU_ASSERT_EQUAL(rc, 0);
+  keys[0].size = 4;
+  iwrc vrc;
+  rc = iwkv_get_many(db2, keys, 1, &val, &vrc);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_KEY_NUM_VALUE_SIZE);
+
+  for (int i = 0; i < num; ++i) {
+    char buf[64];
+    uint64_t k = 3ULL * i;
+    snprintf(buf, sizeof(buf), "%012" PRIu64 "_key", k);
+    key.data = buf;
+    key.size = strlen(buf);
+    val.data = buf;
+    val.size = (i % 7) ? strlen(buf) : 0;
+    rc = iwkv_put(db1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    key.data = &k;
+    key.size = sizeof(k);
+    rc = iwkv_put(db2, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+
+  // Clustered, random and duplicated keys in any order
+  for (int r = 0; r < 3; ++r) {
+    for (int i = 0; i < n; ++i) {
+      uint64_t k;
+      if (r == 0) {
+        k = 3ULL * num / 2 + (n - i);
+      } else if (r == 1) {
+        k = (uint64_t) random() % (3ULL * num + 10);
+      } else {
+        k = (i % 5) ? ikeys[i - 1] : 3ULL * (random() % num);
+      }
+      ikeys[i] = k;
+      snprintf(kbuf[i], sizeof(kbuf[i]), "%012" PRIu64 "_key", k);
+    }
+    for (int i = 0; i < n; ++i) {
+      keys[i].data = kbuf[i];
+      keys[i].size = strlen(kbuf[i]);
+    }
+    iwkv_test4_9_check(db1, keys, n);
+    for (int i = 0; i < n; ++i) {
+      keys[i].data = &ikeys[i];
+      keys[i].size = sizeof(ikeys[i]);
+    }
+    iwkv_test4_9_check(db2, keys, n);
+  }
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+typedef struct LEAFWTCTX {
+  IWDB db;
+  int num;
+  int nthreads;
+  int idx;
+  volatile bool *stop;
+} LEAFWTCTX;
+
+static void *iwkv_test4_10_writer(void *op) {
+  LEAFWTCTX *ctx = op;
+  uint64_t vbuf[2];
+  IWKV_val key, val;
+  for (uint64_t r = 1; r < 6; ++r) {
+    for (uint64_t k = ctx->idx; k < ctx->num; k += ctx->nthreads) {
+      iwrc rc;
+      vbuf[0] = k;
+      vbuf[1] = r;
+      key.data = &k;
+      key.size = sizeof(k);
+      val.data = vbuf;
+      val.size = sizeof(vbuf);
+      if ((k + r) % 4) {
+        rc = iwkv_put(ctx->db, &key, &val, 0);
+      } else {
+        rc = iwkv_del(ctx->db, &key);
+        if (rc == IWKV_ERROR_NOTFOUND) {
+          rc = 0;
+        }
+      }
+      if (rc) {
+        return (void *)(intptr_t) rc;
+      }
+    }
+  }
+  return 0;
+}
+
+static void *iwkv_test4_10_reader(void *op) {
+  LEAFWTCTX *ctx = op;
+  enum { N = 64 };
+  uint64_t ks[N];
+  IWKV_val keys[N], vals[N];
+  iwrc rcs[N];
+  while (!*ctx->stop) {
+    for (int i = 0; i < N; ++i) {
+      ks[i] = (uint64_t) random() % ctx->num;
+      keys[i].data = &ks[i];
+      keys[i].size = sizeof(ks[i]);
+    }
+    iwrc rc = iwkv_get_many(ctx->db, keys, N, vals, rcs);
+    if (rc) {
+      return (void *)(intptr_t) rc;
+    }
+    for (int i = 0; i < N; ++i) {
+      if (!rcs[i] && (vals[i].size != 2 * sizeof(uint64_t) || *(uint64_t *) vals[i].data != ks[i])) {
+        rc = IW_ERROR_FAIL;
+      }
+      iwkv_val_dispose(&vals[i]);
+    }
+    if (rc) {
+      return (void *)(intptr_t) rc;
+    }
+    for (int i = 0; i < N && !rc; ++i) {
+      IWKV_val val;
+      rc = iwkv_get(ctx->db, &keys[i], &val);
+      if (!rc) {
+        if (val.size != 2 * sizeof(uint64_t) || *(uint64_t *) val.data != ks[i]) {
+          rc = IW_ERROR_FAIL;
+        }
+        iwkv_val_dispose(&val);
+      } else if (rc == IWKV_ERROR_NOTFOUND) {
+        rc = 0;
+      }
+    }
+    if (rc) {
+      return (void *)(intptr_t) rc;
+    }
+  }
+  return 0;
+}
+
+// Concurrent writers of the same database
+static void iwkv_test4_10(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_10.db",
+    .oflags = IWKV_TRUNC
+  };
+  enum { NTHREADS = 4 };
+  const int num = 20000;
+  volatile bool stop = false;
+  pthread_t threads[NTHREADS + 1];
+  LEAFWTCTX ctx[NTHREADS + 1];
+  IWKV iwkv;
+  IWDB db;
+  IWKV_val key, val;
+  uint64_t vbuf[2];
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT64_KEYS, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint64_t k = 0; k < num; k += 3) {
+    vbuf[0] = k;
+    vbuf[1] = 0;
+    key.data = &k;
+    key.size = sizeof(k);
+    val.data = vbuf;
+    val.size = sizeof(vbuf);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (int i = 0; i <= NTHREADS; ++i) {
+    ctx[i].db = db;
+    ctx[i].num = num;
+    ctx[i].nthreads = NTHREADS;
+    ctx[i].idx = i;
+    ctx[i].stop = &stop;
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&threads[i], 0,
+                                         i < NTHREADS ? iwkv_test4_10_writer : iwkv_test4_10_reader,
+                                         &ctx[i]), 0);
+  }
+  for (int i = 0; i <= NTHREADS; ++i) {
+    void *ret;
+    if (i == NTHREADS) {
+      stop = true;
+    }
+    pthread_join(threads[i], &ret);
+    CU_ASSERT_PTR_NULL(ret);
+  }
+  for (uint64_t k = 0; k < num; ++k) {
+    key.data = &k;
+    key.size = sizeof(k);
+    rc = iwkv_get(db, &key, &val);
+    if ((k + 5) % 4) {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL_FATAL(val.size, sizeof(vbuf));
+      memcpy(vbuf, val.data, sizeof(vbuf));
+      CU_ASSERT_EQUAL(vbuf[0], k);
+      CU_ASSERT_EQUAL(vbuf[1], 5);
+      iwkv_val_dispose(&val);
+    } else {
+      CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+    }
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+typedef struct LOADCTX {
+  uint64_t num;   /**< Number of records */
+  uint64_t pos;   /**< Number of records returned */
+  uint64_t bad;   /**< Position of out of order key or zero */
+  bool ikeys;     /**< Integer keys */
+  uint64_t ik;
+  char kbuf[256];
+} LOADCTX;
+
+// Key of i-th record in descending order, every fifth string key is longer than SBLK lower key
+static void iwkv_test4_11_key(LOADCTX *ctx, uint64_t k, IWKV_val *key) {
+  if (ctx->ikeys) {
+    ctx->ik = 2 * k;
+    key->data = &ctx->ik;
+    key->size = sizeof(ctx->ik);
+  } else {
+    int len = snprintf(ctx->kbuf, sizeof(ctx->kbuf), "%012" PRIu64, k);
+    if (k % 5 == 0) {
+      memset(ctx->kbuf + len, 'x', 150);
+      len += 150;
+    }
+    key->data = ctx->kbuf;
+    key->size = len;
+  }
+}
+
+static iwrc iwkv_test4_11_next(IWKV_val *key, IWKV_val *val, void *op) {
+  LOADCTX *ctx = op;
+  if (ctx->pos >= ctx->num) {
+    return IWKV_ERROR_NOTFOUND;
+  }
+  uint64_t k = ctx->num - 1 - ctx->pos;
+  if (ctx->bad && ctx->pos == ctx->bad) {
+    k += 2;
+  }
+  ++ctx->pos;
+  iwkv_test4_11_key(ctx, k, key);
+  val->data = key->data;
+  val->size = (k % 7) ? key->size : 0;
+  return 0;
+}
+
+static void iwkv_test4_11_check(IWDB db, bool ikeys, uint64_t num) {
+  LOADCTX ctx = { .ikeys = ikeys };
+  IWKV_val key, val;
+  IWKV_cursor cur;
+  for (uint64_t k = 0; k < num; ++k) {
+    iwkv_test4_11_key(&ctx, k, &key);
+    iwrc rc = iwkv_get(db, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL(val.size, (k % 7) ? key.size : 0);
+    if (val.size) {
+      CU_ASSERT_FALSE(memcmp(val.data, key.data, val.size));
+    }
+    iwkv_val_dispose(&val);
+  }
+  // Records are traversed in load order
+  iwrc rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint64_t k = num; k > 0; --k) {
+    rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    IWKV_val ckey;
+    rc = iwkv_cursor_get(cur, &ckey, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    iwkv_test4_11_key(&ctx, k - 1, &key);
+    CU_ASSERT_EQUAL_FATAL(ckey.size, key.size);
+    CU_ASSERT_FALSE(memcmp(ckey.data, key.data, key.size));
+    iwkv_val_dispose(&ckey);
+  }
+  rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL(rc, 0);
+}
+
+// Bulk load
+static void iwkv_test4_11(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_11.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db1, db2, db3;
+  IWKV_val key, val;
+  IWKV_cursor cur;
+  const uint64_t num = 20000;
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_UINT64_KEYS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 3, 0, &db3);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  LOADCTX ctx = { .num = num };
+  rc = iwkv_bulk_load(db1, iwkv_test4_11_next, &ctx, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  ctx = (LOADCTX) { .num = num, .ikeys = true };
+  rc = iwkv_bulk_load(db2, iwkv_test4_11_next, &ctx, IWKV_SYNC);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_11_check(db1, false, num);
+  iwkv_test4_11_check(db2, true, num);
+
+  // Not empty database
+  ctx = (LOADCTX) { .num = num };
+  rc = iwkv_bulk_load(db1, iwkv_test4_11_next, &ctx, 0);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_INVALID_STATE);
+
+  // Unordered keys, database remains empty
+  ctx = (LOADCTX) { .num = num, .bad = num / 2 };
+  rc = iwkv_bulk_load(db3, iwkv_test4_11_next, &ctx, 0);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_KEY_ORDER);
+  rc = iwkv_cursor_open(db3, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL(rc, 0);
+  ctx = (LOADCTX) { .num = 100 };
+  rc = iwkv_bulk_load(db3, iwkv_test4_11_next, &ctx, 0);
+  CU_ASSERT_EQUAL(rc, 0);
+  iwkv_test4_11_check(db3, false, 100);
+
+  // Loaded database is updated as usual: odd keys are inserted between loaded ones
+  for (uint64_t k = 1; k < 2 * num; k += 2) {
+    key.data = &k;
+    key.size = sizeof(k);
+    val.data = &k;
+    val.size = sizeof(k);
+    rc = iwkv_put(db2, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (uint64_t k = 0; k < 2 * num; k += 3) {
+    key.data = &k;
+    key.size = sizeof(k);
+    rc = iwkv_del(db2, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (uint64_t k = 0; k < 2 * num; ++k) {
+    key.data = &k;
+    key.size = sizeof(k);
+    rc = iwkv_get(db2, &key, &val);
+    if (k % 3 == 0) {
+      CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+    } else {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      iwkv_val_dispose(&val);
+    }
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Reopen
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_11_check(db1, false, num);
+  rc = iwkv_db(iwkv, 4, IWDB_DUP_UINT32_VALS, &db3);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  ctx = (LOADCTX) { .num = num };
+  rc = iwkv_bulk_load(db3, iwkv_test4_11_next, &ctx, 0);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_12_check(IWDB db, const uint8_t *live, uint32_t num) {
+  IWKV_val key, val;
+  IWKV_cursor cur;
+  uint32_t cnt = 0, lk = UINT32_MAX;
+  for (uint32_t i = 0; i < num; ++i) {
+    key.data = &i;
+    key.size = sizeof(i);
+    iwrc rc = iwkv_get(db, &key, &val);
+    if (live[i]) {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL_FATAL(val.size, 64);
+      CU_ASSERT_EQUAL(*(uint32_t *) val.data, i);
+      iwkv_val_dispose(&val);
+      ++cnt;
+    } else {
+      CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+    }
+  }
+  iwrc rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) {
+    uint32_t k;
+    size_t ksz;
+    rc = iwkv_cursor_copy_key(cur, (uint8_t *) &k, sizeof(k), &ksz);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_TRUE_FATAL(k < lk);
+    CU_ASSERT_TRUE(live[k]);
+    lk = k;
+    --cnt;
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(cnt, 0);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static off_t iwkv_test4_12_fsize(const char *path) {
+  IWP_FILE_STAT fs;
+  iwrc rc = iwp_fstat(path, &fs);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  return fs.size;
+}
+
+// Online compaction
+static void iwkv_test4_12(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_12.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_val key, val;
+  IWKV_cursor cur;
+  const uint32_t num = 30000;
+  uint8_t vbuf[64] = { 0 };
+  uint8_t *live = calloc(num, 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(live);
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT32_KEYS, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_UINT32_KEYS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint32_t i = 0; i < num; ++i) {
+    uint32_t k = (i * 2654435761ULL) % num;
+    key.data = &k;
+    key.size = sizeof(k);
+    memcpy(vbuf, &k, sizeof(k));
+    val.data = vbuf;
+    val.size = sizeof(vbuf);
+    rc = iwkv_put(db1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_put(db2, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    live[k] = 1;
+  }
+  // Keep only each 10th record of the first database and drop the second one
+  for (uint32_t i = 0; i < num; ++i) {
+    key.data = &i;
+    key.size = sizeof(i);
+    if (i % 10) {
+      rc = iwkv_del(db1, &key);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      live[i] = 0;
+    }
+  }
+  rc = iwkv_db_destroy(&db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_sync(iwkv, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  off_t fsz1 = iwkv_test4_12_fsize(opts.path);
+
+  // Databases with open cursors are skipped
+  bool done = true;
+  rc = iwkv_cursor_open(db1, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_compact(iwkv, 0, &done);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_FALSE(done);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Small steps interleaved with updates
+  int steps = 0;
+  do {
+    rc = iwkv_compact(iwkv, 64 * 1024, &done);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    uint32_t k = steps * 10;
+    if (k < num) {
+      key.data = &k;
+      key.size = sizeof(k);
+      memcpy(vbuf, &k, sizeof(k));
+      val.data = vbuf;
+      val.size = sizeof(vbuf);
+      rc = iwkv_put(db1, &key, &val, 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+    CU_ASSERT_TRUE_FATAL(++steps < 1000);
+  } while (!done);
+  iwkv_test4_12_check(db1, live, num);
+  off_t fsz2 = iwkv_test4_12_fsize(opts.path);
+  CU_ASSERT_TRUE(fsz2 < fsz1 * 2 / 3);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  opts.oflags = IWKV_MMAP_RANDOM | IWKV_MMAP_HUGEPAGE | IWKV_MMAP_POPULATE;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT32_KEYS, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_12_check(db1, live, num);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(live);
+}
+
+// Compressible value of record `k`
+static void iwkv_test4_13_val(uint32_t k, uint8_t *buf, size_t *osz) {
+  size_t sz = k % 8 ? 400 + (k * 37) % 3700 : k % 100;
+  for (size_t i = 0; i < sz; ++i) {
+    buf[i] = "abcdefgh"[(i / 16 + k) % 8];
+  }
+  *osz = sz;
+}
+
+static void iwkv_test4_13_check(IWDB db, uint32_t num) {
+  IWKV_val key, val;
+  IWKV_cursor cur;
+  uint8_t ebuf[4096], cbuf[4096];
+  size_t esz, csz;
+  for (uint32_t k = 0; k < num; ++k) {
+    key.data = &k;
+    key.size = sizeof(k);
+    iwkv_test4_13_val(k, ebuf, &esz);
+    iwrc rc = iwkv_get(db, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(val.size, esz);
+    CU_ASSERT_FALSE_FATAL(esz && memcmp(val.data, ebuf, esz));
+    iwkv_val_dispose(&val);
+  }
+  iwrc rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  uint32_t cnt = 0;
+  while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) {
+    rc = iwkv_cursor_get(cur, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    uint32_t k = *(uint32_t *) key.data;
+    iwkv_test4_13_val(k, ebuf, &esz);
+    CU_ASSERT_EQUAL_FATAL(val.size, esz);
+    CU_ASSERT_FALSE_FATAL(esz && memcmp(val.data, ebuf, esz));
+    rc = iwkv_cursor_copy_val(cur, cbuf, 100, &csz);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(csz, esz);
+    CU_ASSERT_FALSE_FATAL(memcmp(cbuf, ebuf, MIN(100, esz)));
+    iwkv_kv_dispose(&key, &val);
+    ++cnt;
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(cnt, num);
+  iwkv_cursor_close(&cur);
+}
+
+// Values compression
+static void iwkv_test4_13(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_13.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV_OPTS opts2 = {
+    .path = "iwkv_test4_13_2.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv, iwkv2;
+  IWDB db, db2;
+  IWKV_val key, val;
+  const uint32_t num = 5000;
+  uint8_t vbuf[4096];
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_open(&opts2, &iwkv2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_COMPRESSED | IWDB_DUP_UINT32_VALS, &db);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT32_KEYS | IWDB_COMPRESSED, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv2, 1, IWDB_UINT32_KEYS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint32_t i = 0; i < num; ++i) {
+    uint32_t k = (i * 2654435761ULL) % num;
+    key.data = &k;
+    key.size = sizeof(k);
+    val.data = vbuf;
+    iwkv_test4_13_val(k, vbuf, &val.size);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_put(db2, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  iwkv_test4_13_check(db, num);
+
+  // Multiget and views
+  IWKV_val keys[4], ovals[4];
+  iwrc orcs[4];
+  uint32_t kk[4] = { 1, 8, 77, num + 1 };
+  for (int i = 0; i < 4; ++i) {
+    keys[i].data = &kk[i];
+    keys[i].size = sizeof(kk[i]);
+  }
+  rc = iwkv_get_many(db, keys, 4, ovals, orcs);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < 3; ++i) {
+    size_t esz;
+    CU_ASSERT_EQUAL_FATAL(orcs[i], 0);
+    iwkv_test4_13_val(kk[i], vbuf, &esz);
+    CU_ASSERT_EQUAL_FATAL(ovals[i].size, esz);
+    CU_ASSERT_FALSE(esz && memcmp(ovals[i].data, vbuf, esz));
+    iwkv_val_dispose(&ovals[i]);
+  }
+  CU_ASSERT_EQUAL(orcs[3], IWKV_ERROR_NOTFOUND);
+  rc = iwkv_get_view(db, &keys[0], &val);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+
+  rc = iwkv_sync(iwkv, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_sync(iwkv2, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_TRUE(iwkv_test4_12_fsize(opts.path) < iwkv_test4_12_fsize(opts2.path) / 2);
+  rc = iwkv_close(&iwkv2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT32_KEYS | IWDB_COMPRESSED, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_13_check(db, num);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_14_check(IWDB db, uint32_t num) {
+  IWKV_val key, val;
+  for (uint32_t i = 0; i < 2 * num; ++i) {
+    key.data = &i;
+    key.size = sizeof(i);
+    iwrc rc = iwkv_get(db, &key, &val);
+    if (i < num && (i % 3)) {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL_FATAL(val.size, sizeof(i));
+      CU_ASSERT_EQUAL_FATAL(*(uint32_t *) val.data, i);
+      iwkv_val_dispose(&val);
+    } else {
+      CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+    }
+  }
+}
+
+// Negative lookups filter
+static void iwkv_test4_14(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_14.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db;
+  IWKV_val key, val;
+  const uint32_t num = 20000;
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT32_KEYS | IWDB_BLOOM_FILTER, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  // Filter is rebuilt few times while it grows
+  for (uint32_t i = 0; i < num; ++i) {
+    uint32_t k = (i * 2654435761ULL) % num;
+    key.data = &k;
+    key.size = sizeof(k);
+    val.data = &k;
+    val.size = sizeof(k);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (uint32_t i = 0; i < num; i += 3) {
+    key.data = &i;
+    key.size = sizeof(i);
+    rc = iwkv_del(db, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_del(db, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+  }
+  iwkv_test4_14_check(db, num);
+
+  IWKV_val keys[3], ovals[3];
+  iwrc orcs[3];
+  uint32_t kk[3] = { num + 5, 1, 3 };
+  for (int i = 0; i < 3; ++i) {
+    keys[i].data = &kk[i];
+    keys[i].size = sizeof(kk[i]);
+  }
+  rc = iwkv_get_many(db, keys, 3, ovals, orcs);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(orcs[0], IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(orcs[1], 0);
+  CU_ASSERT_EQUAL(orcs[2], IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(ovals[1].size, sizeof(uint32_t));
+  iwkv_val_dispose(&ovals[1]);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Filter saved on close is loaded
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT32_KEYS, &db);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT32_KEYS | IWDB_BLOOM_FILTER, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_14_check(db, num);
+  uint32_t k = num + 1;
+  key.data = &k;
+  key.size = sizeof(k);
+  val.data = &k;
+  val.size = sizeof(k);
+  rc = iwkv_put(db, &key, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_get(db, &key, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_val_dispose(&val);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Filter consumed by the previous open is saved again, destroy database with it
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT32_KEYS | IWDB_BLOOM_FILTER, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db_destroy(&db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_15_key(uint32_t i, bool scatter, char *buf, size_t *osz) {
+  char tmp[64];
+  int len;
+  if (scatter) { // Keys of the same length without common prefixes
+    len = snprintf(tmp, sizeof(tmp), "%08x/tenant-0042/usr/profile", (uint32_t) (i * 2654435761U));
+  } else if (i % 10) {
+    len = snprintf(tmp, sizeof(tmp), "tenant-0042/user-%07u/profile", i);
+  } else {
+    len = snprintf(tmp, sizeof(tmp), "other-%u", i);
+  }
+  memcpy(buf, tmp, len);
+  *osz = len;
+}
+
+static void iwkv_test4_15_fill(IWDB db, uint32_t num, bool scatter) {
+  char kbuf[64];
+  IWKV_val key = { .data = kbuf }, val;
+  for (uint32_t i = 0; i < num; ++i) {
+    uint32_t k = (i * 2654435761ULL) % num;
+    iwkv_test4_15_key(k, scatter, kbuf, &key.size);
+    val.data = &k;
+    val.size = sizeof(k);
+    iwrc rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+}
+
+static void iwkv_test4_15_check(IWDB db, uint32_t num) {
+  iwrc rc;
+  char kbuf[64];
+  size_t ksz;
+  uint32_t cnt = 0;
+  IWKV_cursor cur;
+  IWKV_val key = { .data = kbuf }, val;
+  for (uint32_t i = 0; i < num; ++i) {
+    iwkv_test4_15_key(i, false, kbuf, &key.size);
+    rc = iwkv_get(db, &key, &val);
+    if (i % 3) {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL_FATAL(val.size, ((i & 1) ? 8 : 1) * sizeof(i));
+      CU_ASSERT_EQUAL_FATAL(*(uint32_t *) val.data, i);
+      iwkv_val_dispose(&val);
+    } else {
+      CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+    }
+  }
+  rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) {
+    uint32_t k;
+    size_t vsz;
+    char ebuf[64];
+    rc = iwkv_cursor_copy_key(cur, (uint8_t *) kbuf, sizeof(kbuf), &ksz);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_cursor_copy_val(cur, (uint8_t *) &k, sizeof(k), &vsz);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_TRUE_FATAL(vsz == sizeof(k) || vsz == 8 * sizeof(k));
+    iwkv_test4_15_key(k, false, ebuf, &key.size);
+    CU_ASSERT_EQUAL_FATAL(ksz, key.size);
+    CU_ASSERT_FATAL(!memcmp(kbuf, ebuf, ksz));
+    ++cnt;
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(cnt, num - (num + 2) / 3);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+// Keys prefix compression
+static void iwkv_test4_15(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_15.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db;
+  char kbuf[64];
+  IWKV_val key = { .data = kbuf }, val;
+  const uint32_t num = 30000;
+
+  // Reference database of keys without common prefixes
+  opts.path = "iwkv_test4_15r.db";
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_15_fill(db, num, true);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  opts.path = "iwkv_test4_15.db";
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_BLOOM_FILTER, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_15_fill(db, num, false);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_TRUE(iwkv_test4_12_fsize("iwkv_test4_15.db") < iwkv_test4_12_fsize("iwkv_test4_15r.db"));
+
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_BLOOM_FILTER, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint32_t i = 0; i < num; ++i) {
+    iwkv_test4_15_key(i, false, kbuf, &key.size);
+    if (i % 3) { // Values outgrow pairs of prefixed keys
+      uint32_t v[8] = { i };
+      val.data = v;
+      val.size = (i & 1) ? sizeof(v) : sizeof(v[0]);
+      rc = iwkv_put(db, &key, &val, 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    } else {
+      rc = iwkv_del(db, &key);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_BLOOM_FILTER, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_15_check(db, num);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+// Every third key is short enough to be kept inline in cache node
+static void iwkv_test4_16_key(uint32_t i, char *buf, size_t *osz) {
+  int len;
+  if (i % 3) {
+    len = snprintf(buf, 64, "tenant-%02u/object-%07u", i % 7, i);
+  } else {
+    len = snprintf(buf, 64, "%07u", i);
+  }
+  *osz = len;
+}
+
+static void iwkv_test4_16_check(IWDB db, const uint8_t *live, uint32_t num) {
+  char kbuf[64];
+  IWKV_val key = { .data = kbuf }, val;
+  for (uint32_t i = 0; i < num; ++i) {
+    iwkv_test4_16_key(i, kbuf, &key.size);
+    iwrc rc = iwkv_get(db, &key, &val);
+    if (live[i]) {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL(*(uint32_t *) val.data, i);
+      iwkv_val_dispose(&val);
+    } else {
+      CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+    }
+  }
+}
+
+// Database cache of string keys
+static void iwkv_test4_16(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_16.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db;
+  char kbuf[64];
+  IWKV_val key = { .data = kbuf }, val;
+  const uint32_t num = 50000;
+  uint8_t *live = calloc(num, 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(live);
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWDB_CACHE_OPTS copts = {
+    .levels = 10,
+    .min_level = 1
+  };
+  rc = iwkv_db_cache_configure(db, &copts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  for (uint32_t i = 0; i < num; ++i) {
+    uint32_t k = (i * 2654435761ULL) % num;
+    iwkv_test4_16_key(k, kbuf, &key.size);
+    val.data = &k;
+    val.size = sizeof(k);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    live[k] = 1;
+  }
+  iwkv_test4_16_check(db, live, num);
+
+  // Removed and updated nodes release cached keys,
+  // whole key ranges of all tenants but one are removed so keys arena is compacted
+  srandom(16);
+  for (uint32_t i = 0; i < num; ++i) {
+    if (random() % 3 || i % 7) {
+      iwkv_test4_16_key(i, kbuf, &key.size);
+      rc = iwkv_del(db, &key);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      live[i] = 0;
+    }
+  }
+  iwkv_test4_16_check(db, live, num);
+
+  for (uint32_t i = 0; i < num; i += 2) {
+    iwkv_test4_16_key(i, kbuf, &key.size);
+    val.data = &i;
+    val.size = sizeof(i);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    live[i] = 1;
+  }
+  iwkv_test4_16_check(db, live, num);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_16_check(db, live, num);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(live);
+}
+
+static void iwkv_test4_17_key(uint32_t g, uint32_t i, char *buf, size_t *osz) {
+  *osz = snprintf(buf, 64, "g%02u/%06u", g, i);
+}
+
+static void iwkv_test4_17_check(IWDB db, const uint8_t *live, uint32_t ng, uint32_t num) {
+  char kbuf[64];
+  uint32_t cnt = 0, lcnt = 0;
+  IWKV_cursor cur;
+  IWKV_val key = { .data = kbuf }, val;
+  for (uint32_t g = 0; g < ng; ++g) {
+    for (uint32_t i = 0; i < num; ++i) {
+      iwkv_test4_17_key(g, i, kbuf, &key.size);
+      iwrc rc = iwkv_get(db, &key, &val);
+      if (live[g * num + i]) {
+        ++lcnt;
+        CU_ASSERT_EQUAL_FATAL(rc, 0);
+        CU_ASSERT_EQUAL(*(uint32_t *) val.data, g * num + i);
+        iwkv_val_dispose(&val);
+      } else {
+        CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+      }
+    }
+  }
+  // Blocks are linked in both directions
+  iwrc rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) ++cnt;
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(cnt, lcnt);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  cnt = 0;
+  rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_AFTER_LAST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_PREV))) ++cnt;
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(cnt, lcnt);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+// Range and prefix delete
+static void iwkv_test4_17(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_17.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db, db2;
+  char kbuf[64], kbuf2[64];
+  IWKV_val key = { .data = kbuf }, key2 = { .data = kbuf2 }, val;
+  const uint32_t ng = 40, num = 2000;
+  uint8_t *live = calloc(ng * num, 1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(live);
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint32_t j = 0; j < ng * num; ++j) {
+    uint32_t k = (j * 2654435761ULL) % (ng * num);
+    iwkv_test4_17_key(k / num, k % num, kbuf, &key.size);
+    val.data = &k;
+    val.size = sizeof(k);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    live[k] = 1;
+  }
+  iwkv_test4_17_check(db, live, ng, num);
+
+  key.data = "g07/";
+  key.size = strlen(key.data);
+  rc = iwkv_del_prefix(db, &key);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(live + 7 * num, 0, num);
+  key.data = kbuf;
+  iwkv_test4_17_check(db, live, ng, num);
+
+  iwkv_test4_17_key(10, 500, kbuf, &key.size);
+  iwkv_test4_17_key(12, 1000, kbuf2, &key2.size);
+  rc = iwkv_del_range(db, &key, &key2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(live + 10 * num + 500, 0, 2 * num + 500);
+  // Empty range
+  rc = iwkv_del_range(db, &key2, &key);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_17_check(db, live, ng, num);
+
+  // Range within a single block
+  iwkv_test4_17_key(20, 100, kbuf, &key.size);
+  iwkv_test4_17_key(20, 110, kbuf2, &key2.size);
+  rc = iwkv_del_range(db, &key, &key2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(live + 20 * num + 100, 0, 10);
+
+  // Unbounded ranges
+  iwkv_test4_17_key(2, 0, kbuf2, &key2.size);
+  rc = iwkv_del_range(db, 0, &key2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(live, 0, 2 * num);
+  iwkv_test4_17_key(38, 1500, kbuf, &key.size);
+  rc = iwkv_del_range(db, &key, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(live + 38 * num + 1500, 0, num + 500);
+  iwkv_test4_17_check(db, live, ng, num);
+
+  // Removed ranges are filled again
+  for (uint32_t i = 0; i < num; i += 2) {
+    uint32_t k = 11 * num + i;
+    iwkv_test4_17_key(11, i, kbuf, &key.size);
+    val.data = &k;
+    val.size = sizeof(k);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    live[k] = 1;
+  }
+  iwkv_test4_17_check(db, live, ng, num);
+
+  rc = iwkv_db(iwkv, 2, IWDB_UINT32_KEYS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_del_prefix(db2, &key);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_del_range(db2, &key, 0);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_KEY_NUM_VALUE_SIZE);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_17_check(db, live, ng, num);
+
+  // Remove all records
+  key.size = 0;
+  rc = iwkv_del_prefix(db, &key);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(live, 0, ng * num);
+  iwkv_test4_17_check(db, live, ng, num);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(live);
+}
+
+typedef struct {
+  IWKV_cursor cur;
+  uint32_t *seen;
+  uint32_t cnt;
+  uint32_t first;
+  uint32_t last;
+  iwrc rc;
+} TEST4_18_PART;
+
+static void *iwkv_test4_18_scan(void *op) {
+  TEST4_18_PART *p = op;
+  IWKV_val key, val;
+  uint32_t prev = UINT32_MAX;
+  while (!(p->rc = iwkv_cursor_to(p->cur, IWKV_CURSOR_NEXT))) {
+    p->rc = iwkv_cursor_get(p->cur, &key, &val);
+    if (p->rc) {
+      break;
+    }
+    uint32_t v = *(uint32_t *) val.data;
+    iwkv_kv_dispose(&key, &val);
+    if (v >= prev) { // Order is preserved within partition
+      p->rc = IW_ERROR_FAIL;
+      break;
+    }
+    if (!p->cnt++) {
+      p->first = v;
+    }
+    p->last = prev = v;
+    p->seen[v]++;
+  }
+  if (p->rc == IWKV_ERROR_NOTFOUND) {
+    p->rc = 0;
+  }
+  return 0;
+}
+
+// Range bounded and partitioned cursors
+static void iwkv_test4_18(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_18.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db, db2;
+  IWKV_cursor cur, curs[8];
+  TEST4_18_PART parts[8] = { 0 };
+  pthread_t thr[8];
+  char kbuf[64], lbuf[64], hbuf[64];
+  IWKV_val key = { .data = kbuf }, lo = { .data = lbuf }, hi = { .data = hbuf }, val;
+  uint32_t onum, v;
+  const uint32_t num = 30000;
+  uint32_t *seen = calloc(num, sizeof(*seen));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(seen);
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint32_t i = 0; i < num; ++i) {
+    v = (i * 2654435761ULL) % num;
+    key.size = snprintf(kbuf, sizeof(kbuf), "k%07u", v);
+    val.data = &v;
+    val.size = sizeof(v);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+
+  rc = iwkv_cursor_open_parts(db, curs, 8, &onum);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL_FATAL(onum, 8);
+  for (uint32_t i = 0; i < onum; ++i) {
+    parts[i].cur = curs[i];
+    parts[i].seen = seen;
+  }
+  // Partitions are disjoint, so `seen` counters are not shared
+  for (uint32_t i = 0; i < onum; ++i) {
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&thr[i], 0, iwkv_test4_18_scan, &parts[i]), 0);
+  }
+  for (uint32_t i = 0; i < onum; ++i) {
+    pthread_join(thr[i], 0);
+    CU_ASSERT_EQUAL(parts[i].rc, 0);
+    CU_ASSERT_TRUE(parts[i].cnt > 0);
+    CU_ASSERT_TRUE(parts[i].cnt < num / 2);
+    if (i) {
+      CU_ASSERT_EQUAL(parts[i].first + 1, parts[i - 1].last);
+    }
+    rc = iwkv_cursor_close(&curs[i]);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  CU_ASSERT_EQUAL(parts[0].first, num - 1);
+  CU_ASSERT_EQUAL(parts[onum - 1].last, 0);
+  for (uint32_t i = 0; i < num; ++i) {
+    CU_ASSERT_EQUAL_FATAL(seen[i], 1);
+  }
+
+  // Traversal of range in both directions
+  lo.size = snprintf(lbuf, sizeof(lbuf), "k%07u", 1000);
+  hi.size = snprintf(hbuf, sizeof(hbuf), "k%07u", 2000);
+  rc = iwkv_cursor_open_range(db, &cur, IWKV_CURSOR_AFTER_LAST, &lo, &hi);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (v = 1000; !(rc = iwkv_cursor_to(cur, IWKV_CURSOR_PREV)); ++v) {
+    rc = iwkv_cursor_get(cur, 0, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL(*(uint32_t *) val.data, v);
+    iwkv_val_dispose(&val);
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(v, 2000);
+  rc = iwkv_cursor_to(cur, IWKV_CURSOR_BEFORE_FIRST);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (v = 2000; !(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT)); --v) {
+    rc = iwkv_cursor_get(cur, 0, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL(*(uint32_t *) val.data, v - 1);
+    iwkv_val_dispose(&val);
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(v, 1000);
+  key.size = snprintf(kbuf, sizeof(kbuf), "k%07u", 2000);
+  rc = iwkv_cursor_to_key(cur, IWKV_CURSOR_EQ, &key);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  key.size = snprintf(kbuf, sizeof(kbuf), "k%07u", 1000);
+  rc = iwkv_cursor_to_key(cur, IWKV_CURSOR_EQ, &key);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Ranges without records
+  lo.size = snprintf(lbuf, sizeof(lbuf), "z");
+  rc = iwkv_cursor_open_range(db, &cur, IWKV_CURSOR_AFTER_LAST, &lo, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_to(cur, IWKV_CURSOR_PREV);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  hi.size = snprintf(hbuf, sizeof(hbuf), "a");
+  rc = iwkv_cursor_open_range(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0, &hi);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Small database is not split
+  rc = iwkv_db(iwkv, 2, IWDB_UINT32_KEYS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (v = 0; v < 10; ++v) {
+    key.data = &v;
+    key.size = sizeof(v);
+    val.data = &v;
+    val.size = sizeof(v);
+    rc = iwkv_put(db2, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_cursor_open_parts(db2, curs, 8, &onum);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL_FATAL(onum, 1);
+  for (v = 0; !(rc = iwkv_cursor_to(curs[0], IWKV_CURSOR_NEXT)); ++v);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(v, 10);
+  rc = iwkv_cursor_close(&curs[0]);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(seen);
+}
+
+static void iwkv_test4_19_scan(IWDB db, size_t bufsz) {
+  IWKV_cursor cur;
+  IWKV_val keys[64], vals[64];
+  uint8_t *buf = malloc(bufsz);
+  char kbuf[64];
+  size_t onum;
+  uint32_t v = 5000;
+  CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+  iwrc rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  while (!(rc = iwkv_cursor_next_batch(cur, keys, vals, 64, buf, bufsz, &onum))) {
+    CU_ASSERT_TRUE_FATAL(onum > 0 && onum <= 64);
+    for (size_t i = 0; i < onum; ++i) {
+      --v;
+      int len = snprintf(kbuf, sizeof(kbuf), "k%07u", v);
+      CU_ASSERT_EQUAL_FATAL(keys[i].size, len);
+      CU_ASSERT_FATAL(!memcmp(keys[i].data, kbuf, len));
+      CU_ASSERT_EQUAL_FATAL(vals[i].size, 100 + v % 100);
+      CU_ASSERT_EQUAL_FATAL(((uint8_t *) vals[i].data)[0], v & 0xff);
+    }
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(onum, 0);
+  CU_ASSERT_EQUAL(v, 0);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(buf);
+}
+
+static void iwkv_test4_19(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_19.db",
+    .oflags = IWKV_TRUNC | IWKV_MMAP_RANDOM
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_cursor cur;
+  IWKV_val keys[4], vals[4];
+  uint8_t vbuf[256], buf[512];
+  char kbuf[64];
+  IWKV_val key = { .data = kbuf }, val = { .data = vbuf };
+  size_t onum;
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_COMPRESSED, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint32_t v = 0; v < 5000; ++v) {
+    key.size = snprintf(kbuf, sizeof(kbuf), "k%07u", v);
+    val.size = 100 + v % 100;
+    memset(vbuf, v & 0xff, val.size);
+    rc = iwkv_put(db1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_put(db2, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  iwkv_test4_19_scan(db1, 1024);
+  iwkv_test4_19_scan(db1, 64 * 1024);
+  iwkv_test4_19_scan(db2, 4096);
+
+  // Batch is stopped before the record does not fit buffer
+  rc = iwkv_cursor_open(db1, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_next_batch(cur, keys, vals, 4, buf, 16, &onum);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_OVERFLOW);
+  CU_ASSERT_EQUAL(onum, 0);
+  rc = iwkv_cursor_next_batch(cur, keys, 0, 4, buf, 16, &onum);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(onum, 2);
+  CU_ASSERT_FATAL(!memcmp(keys[1].data, "k0004998", 8));
+  rc = iwkv_cursor_next_batch(cur, keys, vals, 4, buf, 8 + 198 + 8 + 197, &onum);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(onum, 2);
+  CU_ASSERT_FATAL(!memcmp(keys[0].data, "k0004997", 8));
+  CU_ASSERT_FATAL(!memcmp(keys[1].data, "k0004996", 8));
+  CU_ASSERT_EQUAL(vals[1].size, 196);
+  CU_ASSERT_TRUE((uint8_t *) vals[1].data == buf + 8 + 197 + 8);
+  rc = iwkv_cursor_get(cur, &key, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_FATAL(!memcmp(key.data, "k0004996", 8));
+  iwkv_val_dispose(&key);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_20(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_20.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db;
+  IWKV_cursor cur;
+  char kbuf[64];
+  IWKV_val key = { .data = kbuf }, val = { .data = "", .size = 0 }, okey;
+  const char *pfxs[] = { "a", "ab", "b", "b\xff", "\xff\xff" };
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int p = 0; p < sizeof(pfxs) / sizeof(pfxs[0]); ++p) {
+    for (int i = 0; i < 1000; ++i) {
+      key.size = snprintf(kbuf, sizeof(kbuf), "%s%04d", pfxs[p], i);
+      rc = iwkv_put(db, &key, &val, 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+  }
+  // Every prefix except "b\xff" holds 1000 own records plus records of longer prefixes
+  const int expected[] = { 2000, 1000, 2000, 1000, 1000 };
+  for (int p = 0; p < sizeof(pfxs) / sizeof(pfxs[0]); ++p) {
+    IWKV_val prefix = { .data = (void *) pfxs[p], .size = strlen(pfxs[p]) };
+    for (int dir = 0; dir < 2; ++dir) {
+      int cnt = 0;
+      rc = iwkv_cursor_open_prefix(db, &cur, dir ? IWKV_CURSOR_AFTER_LAST : IWKV_CURSOR_BEFORE_FIRST, &prefix);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      while (!(rc = iwkv_cursor_to(cur, dir ? IWKV_CURSOR_PREV : IWKV_CURSOR_NEXT))) {
+        rc = iwkv_cursor_get(cur, &okey, 0);
+        CU_ASSERT_EQUAL_FATAL(rc, 0);
+        CU_ASSERT_FATAL(okey.size >= prefix.size && !memcmp(okey.data, prefix.data, prefix.size));
+        iwkv_val_dispose(&okey);
+        ++cnt;
+      }
+      CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+      CU_ASSERT_EQUAL(cnt, expected[p]);
+      rc = iwkv_cursor_close(&cur);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+  }
+  IWKV_val prefix = { .data = "c", .size = 1 };
+  rc = iwkv_cursor_open_prefix(db, &cur, IWKV_CURSOR_BEFORE_FIRST, &prefix);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+// Presence and value size of record `v` at stage of test: 0 - initial, 1 - after writer, 2 - after prefix removal
+static bool iwkv_test4_21_rec(int stage, uint32_t v, uint32_t *vsz, uint8_t *vb) {
+  if (!stage) {
+    *vsz = 20 + v % 50;
+    *vb = v & 0xff;
+    return v < 4000;
+  }
+  if ((v < 4000 && !(v % 3)) || (v >= 1000 && v < 2000) || v >= 6000) {
+    return false;
+  }
+  if (stage > 1 && v >= 3500 && v < 3600) {
+    return false;
+  }
+  if (v < 4000 && v % 5 == 1) {
+    *vsz = 300;
+    *vb = 0xee;
+  } else {
+    *vsz = 20 + v % 50;
+    *vb = v & 0xff;
+  }
+  return true;
+}
+
+// Check up to `num` next records of cursor, `*pv` is the next expected record
+static void iwkv_test4_21_check(IWKV_cursor cur, int stage, uint32_t *pv, int num) {
+  iwrc rc = 0;
+  char kbuf[64];
+  uint32_t vsz;
+  uint8_t vb;
+  IWKV_val key, val;
+  for (int i = 0; i < num && !rc; ++i) {
+    while (*pv > 0 && !iwkv_test4_21_rec(stage, *pv - 1, &vsz, &vb)) {
+      --*pv;
+    }
+    rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT);
+    if (!*pv) {
+      CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+      break;
+    }
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    uint32_t v = --*pv;
+    rc = iwkv_cursor_get(cur, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    int len = snprintf(kbuf, sizeof(kbuf), "k%07u", v);
+    CU_ASSERT_EQUAL_FATAL(key.size, len);
+    CU_ASSERT_FATAL(!memcmp(key.data, kbuf, len));
+    CU_ASSERT_EQUAL_FATAL(val.size, vsz);
+    CU_ASSERT_EQUAL_FATAL(((uint8_t *) val.data)[vsz - 1], vb);
+    iwkv_kv_dispose(&key, &val);
+  }
+}
+
+static void *iwkv_test4_21_writer(void *op) {
+  IWDB db = op;
+  iwrc rc = 0;
+  char kbuf[64];
+  uint8_t vbuf[300];
+  IWKV_val key = { .data = kbuf }, val = { .data = vbuf }, from, to;
+  for (uint32_t v = 4000; v < 6000 && !rc; ++v) {
+    key.size = snprintf(kbuf, sizeof(kbuf), "k%07u", v);
+    val.size = 20 + v % 50;
+    memset(vbuf, v & 0xff, val.size);
+    rc = iwkv_put(db, &key, &val, 0);
+  }
+  for (uint32_t v = 0; v < 4000 && !rc; v += 3) {
+    key.size = snprintf(kbuf, sizeof(kbuf), "k%07u", v);
+    rc = iwkv_del(db, &key);
+  }
+  memset(vbuf, 0xee, sizeof(vbuf));
+  val.size = sizeof(vbuf);
+  for (uint32_t v = 1; v < 4000 && !rc; v += 5) {
+    if (v % 3) {
+      key.size = snprintf(kbuf, sizeof(kbuf), "k%07u", v);
+      rc = iwkv_put(db, &key, &val, 0);
+    }
+  }
+  from = (IWKV_val) { .data = "k0001000", .size = 8 };
+  to = (IWKV_val) { .data = "k0002000", .size = 8 };
+  if (!rc) {
+    rc = iwkv_del_range(db, &from, &to);
+  }
+  CU_ASSERT_EQUAL(rc, 0);
+  return 0;
+}
+
+static void iwkv_test4_21(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_21.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db;
+  IWKV_cursor cur1, cur2, cur;
+  pthread_t thr;
+  char kbuf[64];
+  uint8_t vbuf[128];
+  uint32_t v1 = 4000, v2 = 6000, v = 6000;
+  IWKV_val key = { .data = kbuf }, val = { .data = vbuf };
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint32_t i = 0; i < 4000; ++i) {
+    key.size = snprintf(kbuf, sizeof(kbuf), "k%07u", i);
+    val.size = 20 + i % 50;
+    memset(vbuf, i & 0xff, val.size);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_cursor_open_snapshot(db, &cur1, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_21_check(cur1, 0, &v1, 500);
+  rc = iwkv_cursor_set(cur1, &val, 0);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_READONLY);
+
+  // Writer is not blocked by snapshot
+  CU_ASSERT_EQUAL_FATAL(pthread_create(&thr, 0, iwkv_test4_21_writer, db), 0);
+  iwkv_test4_21_check(cur1, 0, &v1, 500);
+  pthread_join(thr, 0);
+  iwkv_test4_21_check(cur1, 0, &v1, 500);
+
+  rc = iwkv_cursor_open_snapshot(db, &cur2, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWKV_val prefix = { .data = "k00035", .size = 6 };
+  rc = iwkv_del_prefix(db, &prefix);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_21_check(cur1, 0, &v1, 5000);
+  CU_ASSERT_EQUAL(v1, 0);
+  rc = iwkv_cursor_close(&cur1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_21_check(cur2, 1, &v2, 10000);
+  CU_ASSERT_EQUAL(v2, 0);
+  rc = iwkv_cursor_close(&cur2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_21_check(cur, 2, &v, 10000);
+  CU_ASSERT_EQUAL(v, 0);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Deferred blocks are released and the file is consistent after reopening
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  v = 6000;
+  rc = iwkv_cursor_open_snapshot(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_21_check(cur, 2, &v, 10000);
+  CU_ASSERT_EQUAL(v, 0);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+// Number of index values or zero if index key is not found
+static uint32_t iwkv_test4_22_dup_num(IWDB db, const IWKV_val *key) {
+  IWKV_cursor cur;
+  uint32_t num = 0;
+  iwrc rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_EQ, key);
+  if (rc == IWKV_ERROR_NOTFOUND) {
+    return 0;
+  }
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_dup_num(cur, &num);
+  CU_ASSERT_EQUAL(rc, 0);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL(rc, 0);
+  return num;
+}
+
+typedef struct BATCHTCTX {
+  IWKV iwkv;
+  IWDB db1;
+  IWDB db2;
+  int tid;
+} BATCHTCTX;
+
+// Every batch puts record into primary database and its id into index,
+// threads add databases to batches in different order
+static void *iwkv_test4_22_worker(void *op) {
+  BATCHTCTX *ctx = op;
+  IWKV_batch b;
+  char kbuf[64];
+  iwrc rc = iwkv_batch_create(ctx->iwkv, &b);
+  for (uint64_t i = 0; i < 200 && !rc; ++i) {
+    uint64_t id = ctx->tid * 1000 + i;
+    IWKV_val key = { .data = kbuf }, val = { .data = &id, .size = sizeof(id) };
+    IWKV_val ikey = { .data = "idx", .size = 3 };
+    key.size = snprintf(kbuf, sizeof(kbuf), "r%08" PRIu64, id);
+    if (ctx->tid & 1) {
+      rc = iwkv_batch_put(b, ctx->db2, &ikey, &val, 0);
+      RCBREAK(rc);
+      rc = iwkv_batch_put(b, ctx->db1, &key, &val, 0);
+    } else {
+      rc = iwkv_batch_put(b, ctx->db1, &key, &val, 0);
+      RCBREAK(rc);
+      rc = iwkv_batch_put(b, ctx->db2, &ikey, &val, 0);
+    }
+    RCBREAK(rc);
+    rc = iwkv_batch_commit(b, (i % 50) ? 0 : IWKV_SYNC);
+  }
+  iwkv_batch_destroy(&b);
+  return (void *)(intptr_t) rc;
+}
+
+static void iwkv_test4_22(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_22.db",
+    .oflags = IWKV_TRUNC,
+    .wal = {
+      .enabled = true
+    }
+  };
+  IWKV_OPTS opts2 = {
+    .path = "iwkv_test4_22_2.db",
+    .oflags = IWKV_TRUNC
+  };
+  const int nthreads = 4;
+  pthread_t threads[nthreads];
+  BATCHTCTX ctx[nthreads];
+  IWKV iwkv;
+  IWDB db1, db2, db3;
+  IWKV_cursor cur;
+  IWKV_batch b;
+  uint32_t onum;
+  uint64_t id = 7;
+  bool found;
+  IWKV_val key = { .data = "r00000000", .size = 9 }, val = { .data = &id, .size = sizeof(id) }, oval;
+  IWKV_val ikey = { .data = "idx", .size = 3 };
+
+  iwrc rc = iwkv_open(&opts2, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_DUP_UINT64_VALS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 3, IWDB_UINT32_KEYS, &db3);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_create(iwkv, &b);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_put(b, db2, &ikey, &key, 0);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_DUP_VALUE_SIZE);
+  rc = iwkv_batch_put(b, db3, &key, &val, 0);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_KEY_NUM_VALUE_SIZE);
+
+  // Changes are not visible before commit
+  rc = iwkv_batch_put(b, db1, &key, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_put(b, db2, &ikey, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_del(b, db1, &ikey);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_get(db1, &key, &oval);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_batch_commit(b, IWKV_SYNC);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_get(db1, &key, &oval);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(oval.size, sizeof(id));
+  iwkv_val_dispose(&oval);
+
+  // Batch is reusable, operations are applied in order
+  rc = iwkv_batch_del(b, db1, &key);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_put(b, db2, &ikey, &val, IWKV_DUP_REMOVE);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_commit(b, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_get(db1, &key, &oval);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(iwkv_test4_22_dup_num(db2, &ikey), 0);
+
+  // Batch failed by existing key makes no changes
+  IWKV_val key2 = { .data = "r00000002", .size = 9 };
+  rc = iwkv_put(db1, &ikey, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_put(b, db1, &key, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_put(b, db2, &ikey, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_put(b, db1, &ikey, &val, IWKV_NO_OVERWRITE);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_commit(b, 0);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_KEY_EXISTS);
+  rc = iwkv_get(db1, &key, &oval);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(iwkv_test4_22_dup_num(db2, &ikey), 0);
+
+  // Key put earlier by the same batch exists
+  rc = iwkv_batch_put(b, db1, &key2, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_put(b, db1, &key2, &val, IWKV_NO_OVERWRITE);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_commit(b, 0);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_KEY_EXISTS);
+  rc = iwkv_get(db1, &key2, &oval);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+
+  // Keys are matched by database comparator: string keys are compared up to zero byte
+  rc = iwkv_batch_put(b, db1, &(IWKV_val) { .data = "r\0a", .size = 3 }, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_put(b, db1, &(IWKV_val) { .data = "r\0b", .size = 3 }, &val, IWKV_NO_OVERWRITE);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_commit(b, 0);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_KEY_EXISTS);
+
+  // Key deleted earlier by the same batch is absent, removal of missing dup value is not an error
+  rc = iwkv_batch_del(b, db1, &ikey);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_put(b, db1, &ikey, &val, IWKV_NO_OVERWRITE);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_put(b, db2, &ikey, &val, IWKV_DUP_REMOVE);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_commit(b, 0);
+  CU_ASSERT_EQUAL(rc, 0);
+  rc = iwkv_del(db1, &ikey);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_batch_destroy(&b);
+  CU_ASSERT_PTR_NULL(b);
+
+  for (int i = 0; i < nthreads; ++i) {
+    ctx[i] = (BATCHTCTX) { .iwkv = iwkv, .db1 = db1, .db2 = db2, .tid = i };
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&threads[i], 0, iwkv_test4_22_worker, &ctx[i]), 0);
+  }
+  for (int i = 0; i < nthreads; ++i) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    CU_ASSERT_PTR_NULL(ret);
+  }
+  rc = iwkv_batch_create(iwkv, &b);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  id = 42;
+  onum = 0;
+  rc = iwkv_batch_put(b, db3, &(IWKV_val) { .data = &onum, .size = 4 }, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_batch_commit(b, IWKV_SYNC);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_batch_destroy(&b);
+
+  // Simulate crash: take log with synced records before close
+  iwkv_test4_copy_file("iwkv_test4_22.db-wal", "iwkv_test4_22_2.db-wal");
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Replay log on top of empty storage
+  opts2.oflags = 0;
+  opts2.wal.enabled = true;
+  rc = iwkv_open(&opts2, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_DUP_UINT64_VALS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 3, IWDB_UINT32_KEYS, &db3);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(iwkv_test4_22_dup_num(db2, &ikey), nthreads * 200);
+  rc = iwkv_cursor_open(db2, &cur, IWKV_CURSOR_EQ, &ikey);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int t = 0; t < nthreads; ++t) {
+    for (uint64_t i = 0; i < 200; ++i) {
+      char kbuf[64];
+      id = t * 1000 + i;
+      key.data = kbuf;
+      key.size = snprintf(kbuf, sizeof(kbuf), "r%08" PRIu64, id);
+      rc = iwkv_get(db1, &key, &oval);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL_FATAL(*(uint64_t *) oval.data, id);
+      iwkv_val_dispose(&oval);
+      rc = iwkv_cursor_dup_contains(cur, id, &found);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_TRUE_FATAL(found);
+    }
+  }
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  onum = 0;
+  rc = iwkv_get(db3, &(IWKV_val) { .data = &onum, .size = 4 }, &oval);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(*(uint64_t *) oval.data, 42);
+  iwkv_val_dispose(&oval);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+typedef struct PDUPITCTX {
+  uint64_t *vals;
+  int num;
+  int pos;
+  bool down;
+  bool ok;
+} PDUPITCTX;
+
+static bool iwkv_test4_23_visitor(uint64_t dv, void *op) {
+  PDUPITCTX *ctx = op;
+  if (ctx->pos < 0 || ctx->pos >= ctx->num || ctx->vals[ctx->pos] != dv) {
+    ctx->ok = false;
+    return true;
+  }
+  ctx->pos += ctx->down ? -1 : 1;
+  return false;
+}
+
+static void iwkv_test4_23_check(IWDB db, IWKV_val *key, uint64_t *vals, int num) {
+  IWKV_cursor cur;
+  uint32_t onum;
+  bool found;
+  iwrc rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_EQ, key);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_dup_num(cur, &onum);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL_FATAL(onum, num);
+  for (int i = 0; i < num; ++i) {
+    rc = iwkv_cursor_dup_contains(cur, vals[i], &found);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_TRUE_FATAL(found);
+    rc = iwkv_cursor_dup_contains(cur, vals[i] + 1, &found);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(found, i + 1 < num && vals[i + 1] == vals[i] + 1);
+  }
+  for (int d = 0; d < 2; ++d) {
+    PDUPITCTX ctx = { .vals = vals, .num = num, .down = d, .ok = true };
+    ctx.pos = d ? num - 1 : 0;
+    rc = iwkv_cursor_dup_iter(cur, iwkv_test4_23_visitor, &ctx, 0, ctx.down);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_TRUE_FATAL(ctx.ok);
+    CU_ASSERT_EQUAL_FATAL(ctx.pos, d ? -1 : num);
+    if (num) {
+      ctx.pos = num / 2;
+      rc = iwkv_cursor_dup_iter(cur, iwkv_test4_23_visitor, &ctx, &vals[num / 2], ctx.down);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_TRUE_FATAL(ctx.ok);
+      CU_ASSERT_EQUAL_FATAL(ctx.pos, d ? -1 : num);
+    }
+  }
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static int iwkv_test4_23_ins(uint64_t *vals, int num, uint64_t v, bool remove) {
+  int i = 0;
+  while (i < num && vals[i] < v) ++i;
+  if (remove) {
+    if (i < num && vals[i] == v) {
+      memmove(vals + i, vals + i + 1, (num - i - 1) * sizeof(*vals));
+      return num - 1;
+    }
+  } else if (i == num || vals[i] != v) {
+    memmove(vals + i + 1, vals + i, (num - i) * sizeof(*vals));
+    vals[i] = v;
+    return num + 1;
+  }
+  return num;
+}
+
+static void iwkv_test4_23(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_23.db",
+    .oflags = IWKV_TRUNC
+  };
+  const int maxnum = 20000;
+  uint64_t *vals[2];
+  int num[2] = { 0 };
+  IWKV iwkv;
+  IWDB db[2];
+  IWKV_val key = { .data = "plist", .size = 5 };
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_DUP_PACKED, &db[0]);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_db(iwkv, 1, IWDB_DUP_UINT64_VALS | IWDB_DUP_PACKED, &db[0]);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_DUP_UINT32_VALS | IWDB_DUP_PACKED, &db[1]);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  vals[0] = malloc(maxnum * sizeof(uint64_t));
+  vals[1] = malloc(maxnum * sizeof(uint64_t));
+  CU_ASSERT_PTR_NOT_NULL_FATAL(vals[0]);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(vals[1]);
+
+  srand(23);
+  for (int i = 0; i < maxnum; ++i) {
+    for (int d = 0; d < 2; ++d) {
+      bool remove = num[d] > 0 && (rand() % 4) == 0;
+      uint64_t v;
+      if (remove) {
+        v = vals[d][rand() % num[d]];
+      } else if (d == 0) {
+        v = (rand() % 8) ? (uint64_t) (rand() % 100000) : (((uint64_t) rand() << 32) | rand());
+      } else {
+        v = (uint32_t) rand() % 200000;
+      }
+      rc = iwkv_put(db[d], &key, &(IWKV_val) {
+        .data = d ? (void *) &(uint32_t) { v } : (void *) &v, .size = d ? 4 : 8
+      }, remove ? IWKV_DUP_REMOVE : 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      num[d] = iwkv_test4_23_ins(vals[d], num[d], v, remove);
+    }
+  }
+  for (int d = 0; d < 2; ++d) {
+    iwkv_test4_23_check(db[d], &key, vals[d], num[d]);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_DUP_UINT64_VALS | IWDB_DUP_PACKED, &db[0]);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_DUP_UINT32_VALS | IWDB_DUP_PACKED, &db[1]);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int d = 0; d < 2; ++d) {
+    iwkv_test4_23_check(db[d], &key, vals[d], num[d]);
+    rc = iwkv_put(db[d], &key, &(IWKV_val) {
+      .data = &(uint64_t) { UINT32_MAX + 1ULL }, .size = d ? 4 : 8
+    }, IWKV_DUP_REMOVE);
+    CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+    while (num[d] > 0) {
+      uint64_t v = vals[d][rand() % num[d]];
+      rc = iwkv_put(db[d], &key, &(IWKV_val) {
+        .data = d ? (void *) &(uint32_t) { v } : (void *) &v, .size = d ? 4 : 8
+      }, IWKV_DUP_REMOVE);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      num[d] = iwkv_test4_23_ins(vals[d], num[d], v, true);
+      if (num[d] % 1000 == 0) {
+        iwkv_test4_23_check(db[d], &key, vals[d], num[d]);
+      }
+    }
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(vals[0]);
+  free(vals[1]);
+}
+
+#define T24_RANGE 5000
+
+static void iwkv_test4_24_check(IWDB db, char ref[][T24_RANGE], uint64_t base) {
+  static uint64_t out[T24_RANGE];
+  IWKV_cursor curs[3];
+  uint32_t onum, num;
+  iwrc rc;
+  for (int k = 0; k < 3; ++k) {
+    char kbuf[8];
+    IWKV_val key = { .data = kbuf, .size = snprintf(kbuf, sizeof(kbuf), "k%d", k) };
+    rc = iwkv_cursor_open(db, &curs[k], IWKV_CURSOR_EQ, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    num = 0;
+    for (int i = 0; i < T24_RANGE; ++i) {
+      num += ref[k][i];
+    }
+    rc = iwkv_cursor_dup_num(curs[k], &onum);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(onum, num);
+    rc = iwkv_cursor_dup_union(&curs[k], 1, out, T24_RANGE, &onum);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(onum, num);
+    for (uint32_t i = 0, j = 0; i < T24_RANGE; ++i) {
+      if (ref[k][i]) {
+        CU_ASSERT_EQUAL_FATAL(out[j++], base + i);
+      }
+    }
+    // Slices are equal to the whole array parts
+    for (uint32_t start = 0; start < num + 10; start += 97) {
+      static uint64_t slice[T24_RANGE];
+      uint32_t end = start + 1 + start % 300;
+      rc = iwkv_cursor_dup_slice(curs[k], start, end, slice, &onum);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL_FATAL(onum, start < num ? MIN(end, num) - start : 0);
+      for (uint32_t i = 0; i < onum; ++i) {
+        uint64_t v = base ? slice[i] : ((uint32_t *) slice)[i];
+        CU_ASSERT_EQUAL_FATAL(v, out[start + i]);
+      }
+    }
+  }
+  for (int op = 0; op < 2; ++op) {
+    num = 0;
+    for (int i = 0; i < T24_RANGE; ++i) {
+      num += op ? (ref[0][i] | ref[1][i] | ref[2][i]) : (ref[0][i] & ref[1][i] & ref[2][i]);
+    }
+    rc = op ? iwkv_cursor_dup_union(curs, 3, out, T24_RANGE, &onum)
+         : iwkv_cursor_dup_intersect(curs, 3, out, T24_RANGE, &onum);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(onum, num);
+    for (uint32_t i = 0, j = 0; i < T24_RANGE; ++i) {
+      if (op ? (ref[0][i] | ref[1][i] | ref[2][i]) : (ref[0][i] & ref[1][i] & ref[2][i])) {
+        CU_ASSERT_EQUAL_FATAL(out[j++], base + i);
+      }
+    }
+    // Result is truncated by buffer capacity
+    rc = op ? iwkv_cursor_dup_union(curs, 3, out, 1, &onum)
+         : iwkv_cursor_dup_intersect(curs, 3, 0, 0, &onum);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(onum, num);
+  }
+  for (int k = 0; k < 3; ++k) {
+    rc = iwkv_cursor_close(&curs[k]);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+}
+
+static void iwkv_test4_24(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_24.db",
+    .oflags = IWKV_TRUNC,
+    .wal = {
+      .enabled = true
+    }
+  };
+  IWKV_OPTS opts2 = {
+    .path = "iwkv_test4_24_2.db",
+    .oflags = IWKV_TRUNC
+  };
+  static char ref[2][3][T24_RANGE];
+  const uint64_t base[2] = { 0, 1ULL << 40 };
+  uint64_t dvs[1000];
+  uint32_t onum;
+  IWKV iwkv;
+  IWDB db[2];
+  IWKV_cursor cur, cur2;
+
+  memset(ref, 0, sizeof(ref));
+  iwrc rc = iwkv_open(&opts2, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_DUP_UINT32_VALS, &db[0]);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_DUP_UINT64_VALS | IWDB_DUP_PACKED, &db[1]);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  srand(24);
+  for (int d = 0; d < 2; ++d) {
+    for (int k = 0; k < 3; ++k) {
+      char kbuf[8];
+      IWKV_val key = { .data = kbuf, .size = snprintf(kbuf, sizeof(kbuf), "k%d", k) };
+      uint64_t v = base[d] + k;
+      rc = iwkv_put(db[d], &key, &(IWKV_val) {
+        .data = d ? (void *) &v : (void *) &(uint32_t) { v }, .size = d ? 8 : 4
+      }, 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      ref[d][k][k] = 1;
+      rc = iwkv_cursor_open(db[d], &cur, IWKV_CURSOR_EQ, &key);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      for (int r = 0; r < 5; ++r) {
+        for (int i = 0; i < 1000; ++i) {
+          int e = rand() % T24_RANGE;
+          dvs[i] = base[d] + e;
+          ref[d][k][e] = 1;
+        }
+        rc = iwkv_cursor_dup_add_many(cur, dvs, 1000);
+        CU_ASSERT_EQUAL_FATAL(rc, 0);
+        for (int i = 0; i < 300; ++i) {
+          int e = rand() % T24_RANGE;
+          dvs[i] = base[d] + e;
+          ref[d][k][e] = 0;
+        }
+        rc = iwkv_cursor_dup_rm_many(cur, dvs, 300);
+        CU_ASSERT_EQUAL_FATAL(rc, 0);
+      }
+      rc = iwkv_cursor_close(&cur);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+    iwkv_test4_24_check(db[d], ref[d], base[d]);
+  }
+
+  // Cursors of different databases
+  rc = iwkv_cursor_open(db[0], &cur, IWKV_CURSOR_EQ, &(IWKV_val) { .data = "k0", .size = 2 });
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_open(db[1], &cur2, IWKV_CURSOR_EQ, &(IWKV_val) { .data = "k0", .size = 2 });
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_dup_intersect((IWKV_cursor[]) { cur, cur2 }, 2, dvs, 1000, &onum);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_INVALID_ARGS);
+  rc = iwkv_cursor_close(&cur2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  // Flush log with the synced update of a new record
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_put(db[0], &(IWKV_val) { .data = "sync", .size = 4 }, &(IWKV_val) {
+    .data = &(uint32_t) { 1 }, .size = 4
+  }, IWKV_SYNC);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Simulate crash: take log with synced records before close
+  iwkv_test4_copy_file("iwkv_test4_24.db-wal", "iwkv_test4_24_2.db-wal");
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Replay log on top of empty storage
+  opts2.oflags = 0;
+  opts2.wal.enabled = true;
+  rc = iwkv_open(&opts2, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_DUP_UINT32_VALS, &db[0]);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_DUP_UINT64_VALS | IWDB_DUP_PACKED, &db[1]);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int d = 0; d < 2; ++d) {
+    iwkv_test4_24_check(db[d], ref[d], base[d]);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void *iwkv_test4_25_worker(void *op) {
+  IWDB db = op;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    uint32_t k = i % 500;
+    IWKV_val key = { .data = &k, .size = sizeof(k) };
+    IWKV_val val = { .data = &i, .size = sizeof(i) };
+    iwrc rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL(rc, 0);
+  }
+  return 0;
+}
+
+static void iwkv_test4_25(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_25.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_DB_STATS st;
+  IWKV_STATE state;
+  IWKV_cursor cur;
+  pthread_t threads[4];
+  char kbuf[32];
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_UINT32_KEYS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_db_stats(db1, &st);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(st.puts, 0);
+  CU_ASSERT_EQUAL(st.lookups, 0);
+
+  for (int i = 0; i < 5000; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    IWKV_val val = { .data = kbuf, .size = strlen(kbuf) };
+    rc = iwkv_put(db1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (int i = 0; i < 1000; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "%08d", i * 5);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    IWKV_val val;
+    rc = iwkv_get(db1, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    iwkv_val_dispose(&val);
+  }
+  for (int i = 0; i < 100; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    rc = iwkv_del(db1, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_cursor_open(db1, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  int steps = 0;
+  while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) {
+    ++steps;
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(steps, 4900);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_db_stats(db1, &st);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(st.puts, 5000);
+  CU_ASSERT_EQUAL(st.gets, 1000);
+  CU_ASSERT_EQUAL(st.dels, 100);
+  CU_ASSERT_TRUE(st.cursor_steps >= 4901);
+  CU_ASSERT_TRUE(st.lookups >= 6100);
+  CU_ASSERT_TRUE(st.lookup_hops > st.lookups);
+  CU_ASSERT_TRUE(st.lookup_max_hops > 0);
+  CU_ASSERT_TRUE(st.lookup_max_hops * st.lookups >= st.lookup_hops);
+  CU_ASSERT_TRUE(st.cache_rebuilds > 0);
+  CU_ASSERT_TRUE(st.cache_hits > 0);
+  CU_ASSERT_TRUE(st.splits > 0);
+
+  // Concurrent writers are accounted by all stripes
+  for (int i = 0; i < 4; ++i) {
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&threads[i], 0, iwkv_test4_25_worker, db2), 0);
+  }
+  for (int i = 0; i < 4; ++i) {
+    pthread_join(threads[i], 0);
+  }
+  rc = iwkv_db_stats(db2, &st);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(st.puts, 8000);
+  CU_ASSERT_EQUAL(st.gets, 0);
+  CU_ASSERT_TRUE(st.lock_wait_ns >= st.lock_waits);
+
+  rc = iwkv_state(iwkv, &state);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(state.dbnum, 2);
+  CU_ASSERT_EQUAL(state.dbs.puts, 13000);
+  CU_ASSERT_EQUAL(state.dbs.gets, 1000);
+  CU_ASSERT_EQUAL(state.dbs.dels, 100);
+  CU_ASSERT_TRUE(state.fsm.alloc_num > 0);
+  CU_ASSERT_TRUE(state.fsm.alloc_num >= state.fsm.dealloc_num);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_26_event(const IWTRACE_EVENT *ev, void *ctx) {
+  uint32_t *cnt = ctx;
+  CU_ASSERT_TRUE(ev->end_ns >= ev->begin_ns);
+  CU_ASSERT_TRUE(ev->begin_ns > 0);
+  if (ev->type >= IWTRACE_EXFILE_RESIZE && ev->type <= IWTRACE_DB_LOCK_WAIT) {
+    ++cnt[ev->type];
+  }
+  if (ev->type == IWTRACE_EXFILE_RESIZE) {
+    CU_ASSERT_TRUE(ev->size > 0);
+  } else if (ev->type == IWTRACE_DBCACHE_FILL) {
+    CU_ASSERT_EQUAL(ev->dbid, 1);
+  }
+}
+
+static void iwkv_test4_26(void) {
+#ifdef IW_TRACE
+  uint32_t cnt[IWTRACE_DB_LOCK_WAIT + 1] = { 0 };
+  IWTRACE trace = {
+    .event = iwkv_test4_26_event,
+    .ctx = cnt
+  };
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_26.db",
+    .oflags = IWKV_TRUNC,
+    .trace = &trace
+  };
+  IWKV iwkv;
+  IWDB db;
+  char buf[256];
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(buf, 'v', sizeof(buf));
+  for (int i = 0; i < 20000; ++i) {
+    int len = snprintf(buf, sizeof(buf), "%08d", i);
+    IWKV_val key = { .data = buf, .size = len };
+    IWKV_val val = { .data = buf, .size = sizeof(buf) };
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  CU_ASSERT_TRUE(cnt[IWTRACE_EXFILE_RESIZE] > 0);
+  CU_ASSERT_TRUE(cnt[IWTRACE_DBCACHE_FILL] > 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+#endif
+}
+
+static void iwkv_test4_27(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_27.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_cursor cur;
+  char kbuf[32];
+
+  IWPOOL *pool = iwpool_create(128);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_COMPRESSED, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < 10000; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    IWKV_val val = { .data = kbuf, .size = strlen(kbuf) };
+    rc = iwkv_put(db1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_put(db2, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (int i = 0; i < 10000; i += 7) {
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    IWKV_val val1, val2;
+    rc = iwkv_get_pooled(db1, &key, &val1, pool);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_get_pooled(db2, &key, &val2, pool);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(val1.size, key.size);
+    CU_ASSERT_EQUAL_FATAL(val2.size, key.size);
+    CU_ASSERT_FALSE(memcmp(val1.data, kbuf, key.size));
+    CU_ASSERT_FALSE(memcmp(val2.data, kbuf, key.size));
+    if (i % 70 == 0) {
+      iwpool_reset(pool);
+    }
+  }
+  snprintf(kbuf, sizeof(kbuf), "%s", "absent");
+  IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+  IWKV_val val;
+  rc = iwkv_get_pooled(db1, &key, &val, pool);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_get_pooled(db1, &key, &val, 0);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_INVALID_ARGS);
+
+  rc = iwkv_cursor_open(db2, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  int i = 10000;
+  while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) {
+    IWKV_val okey, oval;
+    iwpool_reset(pool);
+    rc = iwkv_cursor_get_pooled(cur, &okey, &oval, pool);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    snprintf(kbuf, sizeof(kbuf), "%08d", --i);
+    CU_ASSERT_EQUAL_FATAL(okey.size, strlen(kbuf));
+    CU_ASSERT_FALSE(memcmp(okey.data, kbuf, okey.size));
+    CU_ASSERT_EQUAL_FATAL(oval.size, strlen(kbuf));
+    CU_ASSERT_FALSE(memcmp(oval.data, kbuf, oval.size));
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  CU_ASSERT_EQUAL(i, 0);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwpool_destroy(pool);
+}
+
+static void iwkv_test4_28(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_28.db",
+    .oflags = IWKV_TRUNC | IWKV_MMAP_NUMA,
+    .numa_node = 0
+  };
+  IWKV iwkv;
+  IWDB db1;
+  uint16_t node;
+  char kbuf[32];
+
+  uint16_t nnodes = iwp_num_numa_nodes();
+  CU_ASSERT_TRUE_FATAL(nnodes > 0);
+  iwrc rc = iwp_numa_cpu_node(0, &node);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_TRUE(node < nnodes);
+
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db_numa_bind(db1, nnodes);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_INVALID_ARGS);
+  rc = iwkv_db_numa_bind(db1, node);
+  CU_ASSERT_TRUE(rc == 0 || rc == IW_ERROR_NOT_IMPLEMENTED);
+  for (int i = 0; i < 10000; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    rc = iwkv_put(db1, &key, &key, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_db_cache_release(db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < 10000; i += 3) {
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    IWKV_val val;
+    rc = iwkv_get(db1, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(val.size, key.size);
+    iwkv_val_dispose(&val);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+typedef struct TEST29_PROGRESS {
+  atomic_uint_fast64_t calls;
+  atomic_uint_fast64_t blocks;
+  atomic_int done;
+  uint32_t dbid;
+} TEST29_PROGRESS;
+
+static void iwkv_test4_29_progress(uint32_t dbid, uint64_t blocks, bool done, void *ctx) {
+  TEST29_PROGRESS *p = ctx;
+  CU_ASSERT_EQUAL(dbid, p->dbid);
+  atomic_fetch_add(&p->calls, 1);
+  if (done) {
+    atomic_store(&p->blocks, blocks);
+    atomic_fetch_add(&p->done, 1);
+  }
+}
+
+static void iwkv_test4_29(void) {
+  TEST29_PROGRESS progress = { 0 };
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_29.db",
+    .oflags = IWKV_TRUNC,
+    .dispose = {
+      .threads = 4,
+      .progress = iwkv_test4_29_progress,
+      .progress_ctx = &progress
+    }
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_STATE state;
+  uint64_t ts, te;
+  char kbuf[32];
+
+  for (int r = 0; r < 2; ++r) {
+    if (r) {
+      // Rate limited disposal
+      opts.dispose.rate = 2000;
+    }
+    memset(&progress, 0, sizeof(progress));
+    progress.dbid = 1;
+    iwrc rc = iwkv_open(&opts, &iwkv);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_db(iwkv, 1, 0, &db1);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_db(iwkv, 2, 0, &db2);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    for (int i = 0; i < 50000; ++i) {
+      snprintf(kbuf, sizeof(kbuf), "%08d", i);
+      IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+      rc = iwkv_put(db1, &key, &key, 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      if (i % 10 == 0) {
+        rc = iwkv_put(db2, &key, &key, 0);
+        CU_ASSERT_EQUAL_FATAL(rc, 0);
+      }
+    }
+    rc = iwkv_state(iwkv, &state);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    uint64_t dealloc_num = state.fsm.dealloc_num;
+    iwp_monotonic_time_ns(&ts);
+    rc = iwkv_db_destroy(&db1);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    while (!atomic_load(&progress.done)) {
+      iwp_sleep(10);
+    }
+    iwp_monotonic_time_ns(&te);
+    uint64_t blocks = atomic_load(&progress.blocks);
+    CU_ASSERT_TRUE(blocks > 0);
+    CU_ASSERT_TRUE(atomic_load(&progress.calls) > 1);
+    if (r) {
+      CU_ASSERT_TRUE(te - ts >= blocks * 1000000000ULL / opts.dispose.rate);
+    }
+    rc = iwkv_state(iwkv, &state);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    // Every `SBLK` is released with its `KVBLK`
+    CU_ASSERT_TRUE(state.fsm.dealloc_num - dealloc_num >= 2 * blocks);
+    // Other database is not affected
+    for (int i = 0; i < 50000; i += 10) {
+      snprintf(kbuf, sizeof(kbuf), "%08d", i);
+      IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+      IWKV_val val;
+      rc = iwkv_get(db2, &key, &val);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      iwkv_val_dispose(&val);
+    }
+    rc = iwkv_close(&iwkv);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL(atomic_load(&progress.done), 1);
+  }
+}
+
+static void iwkv_test4_30_fill(char *buf, int i, size_t sz) {
+  for (size_t j = 0; j < sz; ++j) {
+    buf[j] = (char) ('a' + (i + j) % 26);
+  }
+}
+
+static void iwkv_test4_30_check(IWDB db, int n, int pass, char *vbuf) {
+  char kbuf[32];
+  for (int i = 0; i < n; ++i) {
+    IWKV_val val;
+    size_t vsz = (i % 2) ? 16 : 20000 + 37 * i + pass;
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    iwrc rc = iwkv_get(db, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(val.size, vsz);
+    iwkv_test4_30_fill(vbuf, i + pass, vsz);
+    CU_ASSERT_FALSE_FATAL(memcmp(val.data, vbuf, vsz));
+    iwkv_val_dispose(&val);
+  }
+}
+
+static void iwkv_test4_30(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_30.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_STATE state;
+  IWKV_cursor cur;
+  char kbuf[32];
+  const int n = 200;
+  char *vbuf = malloc(20000 + 37 * n + 8);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(vbuf);
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_OVERFLOW_VALS | IWDB_COMPRESSED, &db2);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_db(iwkv, 1, IWDB_OVERFLOW_VALS, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db_overflow_threshold(db1, IWDB_OVERFLOW_THRESHOLD_MIN - 1);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_INVALID_ARGS);
+  rc = iwkv_db_overflow_threshold(db1, 1024);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Rewrite of large values reuses released extents
+  off_t fsize = 0;
+  for (int pass = 0; pass < 4; ++pass) {
+    for (int i = 0; i < n; ++i) {
+      size_t vsz = (i % 2) ? 16 : 20000 + 37 * i + pass;
+      snprintf(kbuf, sizeof(kbuf), "%08d", i);
+      iwkv_test4_30_fill(vbuf, i + pass, vsz);
+      IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+      IWKV_val val = { .data = vbuf, .size = vsz };
+      rc = iwkv_put(db1, &key, &val, 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+    iwkv_test4_30_check(db1, n, pass, vbuf);
+    rc = iwkv_state(iwkv, &state);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    if (pass == 1) {
+      fsize = state.fsm.exfile.fsize;
+    } else if (pass > 1) {
+      CU_ASSERT_TRUE(state.fsm.exfile.fsize <= fsize);
+    }
+  }
+
+  rc = iwkv_cursor_open(db1, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = n - 1; i >= 0; --i) {
+    IWKV_val key, val;
+    size_t vsz = (i % 2) ? 16 : 20000 + 37 * i + 3, sz;
+    rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_cursor_get(cur, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    CU_ASSERT_EQUAL_FATAL(key.size, strlen(kbuf));
+    CU_ASSERT_FALSE(memcmp(key.data, kbuf, key.size));
+    CU_ASSERT_EQUAL_FATAL(val.size, vsz);
+    iwkv_test4_30_fill(vbuf, i + 3, vsz);
+    CU_ASSERT_FALSE(memcmp(val.data, vbuf, vsz));
+    rc = iwkv_cursor_copy_val(cur, (uint8_t *) kbuf, sizeof(kbuf), &sz);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL(sz, vsz);
+    CU_ASSERT_FALSE(memcmp(kbuf, vbuf, MIN(sz, sizeof(kbuf))));
+    iwkv_kv_dispose(&key, &val);
+  }
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Delete half of records, others are checked after reopen
+  for (int i = 0; i < n; i += 4) {
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    rc = iwkv_del(db1, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_OVERFLOW_VALS, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < n; ++i) {
+    IWKV_val val;
+    size_t vsz = (i % 2) ? 16 : 20000 + 37 * i + 3;
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    rc = iwkv_get(db1, &key, &val);
+    if (i % 4 == 0) {
+      CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+      continue;
+    }
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(val.size, vsz);
+    iwkv_test4_30_fill(vbuf, i + 3, vsz);
+    CU_ASSERT_FALSE_FATAL(memcmp(val.data, vbuf, vsz));
+    iwkv_val_dispose(&val);
+  }
+  rc = iwkv_db_destroy(&db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(vbuf);
+}
+
+static void iwkv_test4_31(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_31.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db1, db2, db3;
+  IWKV_cursor cur;
+  IWKV_DB_STATS st2, st3;
+  char kbuf[128], vbuf[32];
+  const int n = 5000;
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_WIDE_NODES, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_WIDE_NODES | IWDB_UINT64_KEYS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 3, IWDB_UINT64_KEYS, &db3);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int j = 0; j < n; ++j) {
+    int i = (j * 7919) % n;
+    uint64_t ik = 3ULL * i;
+    // Keys are longer than lower key of wide node
+    snprintf(kbuf, sizeof(kbuf), "%0100d", i);
+    snprintf(vbuf, sizeof(vbuf), "v%d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    IWKV_val val = { .data = vbuf, .size = strlen(vbuf) };
+    rc = iwkv_put(db1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    key.data = &ik;
+    key.size = sizeof(ik);
+    rc = iwkv_put(db2, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_put(db3, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  // Wide nodes are split less often
+  rc = iwkv_db_stats(db2, &st2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db_stats(db3, &st3);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_TRUE(st2.splits > 0 && 3 * st2.splits < 2 * st3.splits);
+  for (int i = 0; i < n; i += 3) {
+    uint64_t ik = 3ULL * i;
+    snprintf(kbuf, sizeof(kbuf), "%0100d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    rc = iwkv_del(db1, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    key.data = &ik;
+    key.size = sizeof(ik);
+    rc = iwkv_del(db2, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Node fan-out is restored from database header
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_db(iwkv, 1, IWDB_WIDE_NODES, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_WIDE_NODES | IWDB_UINT64_KEYS, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < n; ++i) {
+    IWKV_val val;
+    uint64_t ik = 3ULL * i;
+    snprintf(kbuf, sizeof(kbuf), "%0100d", i);
+    snprintf(vbuf, sizeof(vbuf), "v%d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    for (int k = 0; k < 2; ++k) {
+      rc = iwkv_get(k ? db2 : db1, &key, &val);
+      if (i % 3 == 0) {
+        CU_ASSERT_EQUAL_FATAL(rc, IWKV_ERROR_NOTFOUND);
+      } else {
+        CU_ASSERT_EQUAL_FATAL(rc, 0);
+        CU_ASSERT_EQUAL_FATAL(val.size, strlen(vbuf));
+        CU_ASSERT_FALSE_FATAL(memcmp(val.data, vbuf, val.size));
+        iwkv_val_dispose(&val);
+      }
+      key.data = &ik;
+      key.size = sizeof(ik);
+    }
+  }
+  for (int k = 0; k < 2; ++k) {
+    int i = n - 1, c = 0;
+    rc = iwkv_cursor_open(k ? db2 : db1, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) {
+      IWKV_val key;
+      if (i % 3 == 0) {
+        --i;
+      }
+      rc = iwkv_cursor_key(cur, &key);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      if (k) {
+        uint64_t ik;
+        CU_ASSERT_EQUAL_FATAL(key.size, sizeof(ik));
+        memcpy(&ik, key.data, sizeof(ik));
+        CU_ASSERT_EQUAL_FATAL(ik, 3ULL * i);
+      } else {
+        snprintf(kbuf, sizeof(kbuf), "%0100d", i);
+        CU_ASSERT_EQUAL_FATAL(key.size, strlen(kbuf));
+        CU_ASSERT_FALSE_FATAL(memcmp(key.data, kbuf, key.size));
+      }
+      iwkv_val_dispose(&key);
+      --i;
+      ++c;
+    }
+    CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+    CU_ASSERT_EQUAL(c, n - (n + 2) / 3);
+    rc = iwkv_cursor_close(&cur);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_db_destroy(&db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_32(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_32.db",
+    .oflags = IWKV_TRUNC,
+    .rcache_size = 64 * 1024
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_cursor cur;
+  IWKV_DB_STATS st;
+  IWKV_STATE state;
+  IWKV_val val;
+  char kbuf[32], vbuf[64];
+  const int n = 3000;
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_COMPRESSED, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < n; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "%05d", i);
+    snprintf(vbuf, sizeof(vbuf), "%050d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    IWKV_val v = { .data = vbuf, .size = strlen(vbuf) };
+    rc = iwkv_put(db1, &key, &v, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    rc = iwkv_put(db2, &key, &v, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  // Hot keys are served from cache, all keys together do not fit into it
+  for (int r = 0; r < 3; ++r) {
+    for (int i = 0; i < n; ++i) {
+      int j = (i % 10) ? i % 100 : i;
+      snprintf(kbuf, sizeof(kbuf), "%05d", j);
+      snprintf(vbuf, sizeof(vbuf), "%050d", j);
+      IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+      rc = iwkv_get(i & 1 ? db2 : db1, &key, &val);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL_FATAL(val.size, strlen(vbuf));
+      CU_ASSERT_FATAL(!strncmp(val.data, vbuf, val.size));
+      iwkv_val_dispose(&val);
+    }
+  }
+  rc = iwkv_db_stats(db1, &st);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_TRUE(st.rcache_hits > st.rcache_misses);
+  rc = iwkv_state(iwkv, &state);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_TRUE(state.rcache_msize > 0);
+  CU_ASSERT_TRUE(state.rcache_msize <= opts.rcache_size);
+
+  // Modifications of cached records
+  IWKV_val key = { .data = kbuf, .size = 5 };
+  IWKV_val nval = { .data = "updated", .size = 7 };
+  memcpy(kbuf, "00001", 5);
+  rc = iwkv_put(db1, &key, &nval, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_get(db1, &key, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(val.size, 7);
+  CU_ASSERT_FALSE(strncmp(val.data, "updated", 7));
+  iwkv_val_dispose(&val);
+
+  memcpy(kbuf, "00002", 5);
+  rc = iwkv_del(db1, &key);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_get(db1, &key, &val);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+
+  memcpy(kbuf, "00003", 5);
+  rc = iwkv_cursor_open(db2, &cur, IWKV_CURSOR_EQ, &key);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_set(cur, &nval, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  // Cursor is still open, updated value must be visible
+  rc = iwkv_get(db2, &key, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(val.size, 7);
+  CU_ASSERT_FALSE(strncmp(val.data, "updated", 7));
+  iwkv_val_dispose(&val);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  IWKV_val from = { .data = "00010", .size = 5 };
+  IWKV_val to = { .data = "00020", .size = 5 };
+  rc = iwkv_del_range(db2, &from, &to);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memcpy(kbuf, "00015", 5);
+  rc = iwkv_get(db2, &key, &val);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  memcpy(kbuf, "00025", 5);
+  rc = iwkv_get(db2, &key, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_val_dispose(&val);
+
+  // Records of destroyed database are not served to a new database with the same id
+  memcpy(kbuf, "00004", 5);
+  rc = iwkv_db_destroy(&db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_get(db1, &key, &val);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_33(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_33.db",
+    .oflags = IWKV_TRUNC,
+    .wal = {
+      .enabled = true
+    }
+  };
+  IWKV_OPTS bopts = {
+    .path = "iwkv_test4_33_bk.db",
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  IWKV_val val;
+  struct stat st, bst;
+  char kbuf[32], vbuf[512];
+  const int n = 10000;
+
+  unlink(bopts.path);
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, 0, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(vbuf, 'v', sizeof(vbuf));
+  for (int i = 0; i < n; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "%06d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    IWKV_val v = { .data = vbuf, .size = (i & 1) ? 16 : sizeof(vbuf) };
+    rc = iwkv_put(i & 1 ? db1 : db2, &key, &v, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  // Space of destroyed database is free and not copied
+  rc = iwkv_db_destroy(&db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_online_backup(iwkv, bopts.path);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_online_backup(iwkv, bopts.path);
+  CU_ASSERT_TRUE(rc != 0);
+  // Backup does not affect storage
+  snprintf(kbuf, sizeof(kbuf), "%06d", n + 1);
+  IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+  IWKV_val v = { .data = vbuf, .size = 16 };
+  rc = iwkv_put(db1, &key, &v, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL_FATAL(stat(opts.path, &st), 0);
+  CU_ASSERT_EQUAL_FATAL(stat(bopts.path, &bst), 0);
+  CU_ASSERT_EQUAL(bst.st_size, st.st_size);
+  CU_ASSERT_TRUE(bst.st_blocks < st.st_blocks / 2);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  rc = iwkv_open(&bopts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 1; i < n; i += 2) {
+    snprintf(kbuf, sizeof(kbuf), "%06d", i);
+    key.size = strlen(kbuf);
+    rc = iwkv_get(db1, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL(val.size, 16);
+    iwkv_val_dispose(&val);
+  }
+  snprintf(kbuf, sizeof(kbuf), "%06d", n + 1);
+  key.size = strlen(kbuf);
+  rc = iwkv_get(db1, &key, &val);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  // Backup is writable storage
+  rc = iwkv_put(db1, &key, &v, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, 0, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_get(db2, &key, &val);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_34(void) {
+  const char *tspaces[] = { "iwkv_test4_34_1.db", "iwkv_test4_34_2.db" };
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_34.db",
+    .oflags = IWKV_TRUNC,
+    .tspaces = tspaces,
+    .tspaces_num = 2
+  };
+  IWKV iwkv;
+  IWDB db1, db2, db3;
+  IWKV_val val;
+  struct stat st, st1, st2;
+  char kbuf[32], vbuf[512];
+  const int n = 5000;
+
+  unlink("iwkv_test4_34_bk.db");
+  unlink("iwkv_test4_34_bk.db.1");
+  unlink("iwkv_test4_34_bk.db.2");
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  // Databases 1 and 2 are placed in tablespaces, database 3 in main file
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, 0, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 3, 0, &db3);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(vbuf, 'v', sizeof(vbuf));
+  for (int i = 0; i < n; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "%06d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    IWKV_val v = { .data = vbuf, .size = sizeof(vbuf) };
+    rc = iwkv_put(i & 1 ? db1 : db2, &key, &v, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  snprintf(kbuf, sizeof(kbuf), "main");
+  IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+  IWKV_val v = { .data = vbuf, .size = 16 };
+  rc = iwkv_put(db3, &key, &v, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_sync(iwkv, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL_FATAL(stat(opts.path, &st), 0);
+  CU_ASSERT_EQUAL_FATAL(stat(tspaces[0], &st1), 0);
+  CU_ASSERT_EQUAL_FATAL(stat(tspaces[1], &st2), 0);
+  CU_ASSERT_TRUE(st1.st_size > st.st_size);
+  CU_ASSERT_TRUE(st2.st_size > st.st_size);
+  rc = iwkv_online_backup(iwkv, "iwkv_test4_34_bk.db");
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(stat("iwkv_test4_34_bk.db.1", &st1), 0);
+  CU_ASSERT_EQUAL(stat("iwkv_test4_34_bk.db.2", &st2), 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  IWKV_STATE state;
+  rc = iwkv_state(iwkv, &state);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(state.dbnum, 3);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, 0, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 3, 0, &db3);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < n; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "%06d", i);
+    key.size = strlen(kbuf);
+    rc = iwkv_get(i & 1 ? db1 : db2, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL(val.size, sizeof(vbuf));
+    iwkv_val_dispose(&val);
+  }
+  snprintf(kbuf, sizeof(kbuf), "main");
+  key.size = strlen(kbuf);
+  rc = iwkv_get(db3, &key, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(val.size, 16);
+  iwkv_val_dispose(&val);
+  // Database of tablespace is destroyed and created again
+  rc = iwkv_db_destroy(&db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  snprintf(kbuf, sizeof(kbuf), "%06d", 1);
+  key.size = strlen(kbuf);
+  rc = iwkv_get(db1, &key, &val);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_put(db1, &key, &v, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Backup is opened with its own tablespaces
+  const char *btspaces[] = { "iwkv_test4_34_bk.db.1", "iwkv_test4_34_bk.db.2" };
+  IWKV_OPTS bopts = {
+    .path = "iwkv_test4_34_bk.db",
+    .tspaces = btspaces,
+    .tspaces_num = 2
+  };
+  rc = iwkv_open(&bopts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  snprintf(kbuf, sizeof(kbuf), "%06d", n - 1);
+  key.size = strlen(kbuf);
+  rc = iwkv_get(db1, &key, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(val.size, sizeof(vbuf));
+  iwkv_val_dispose(&val);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+typedef struct SHMTCTX {
+  IWDB db;
+  int num;
+  atomic_bool stop;
+  atomic_int errors;
+} SHMTCTX;
+
+static void *iwkv_test4_35_reader(void *op) {
+  SHMTCTX *ctx = op;
+  IWKV_val key, val;
+  uint64_t k = 0;
+  while (!atomic_load(&ctx->stop)) {
+    k = (k + 7) % ctx->num;
+    key.data = &k;
+    key.size = sizeof(k);
+    iwrc rc = iwkv_get(ctx->db, &key, &val);
+    if (rc == IWKV_ERROR_NOTFOUND) {
+      continue;
+    }
+    if (rc || val.size < 2 * sizeof(uint64_t) || memcmp(val.data, &k, sizeof(k))) {
+      atomic_fetch_add(&ctx->errors, 1);
+    }
+    iwkv_val_dispose(&val);
+  }
+  return 0;
+}
+
+static void iwkv_test4_35(void) {
+  IWKV_OPTS wopts = {
+    .path = "iwkv_test4_35.db",
+    .oflags = IWKV_TRUNC | IWKV_SHARED
+  };
+  IWKV_OPTS ropts = {
+    .path = "iwkv_test4_35.db",
+    .oflags = IWKV_RDONLY | IWKV_SHARED
+  };
+  const int num = 20000;
+  SHMTCTX ctx = {
+    .num = num
+  };
+  pthread_t thr;
+  IWKV wkv, rkv;
+  IWDB wdb1, wdb2, rdb2;
+  IWKV_val key, val;
+  IWKV_cursor cur;
+  uint64_t vbuf[32];
+
+  iwrc rc = iwkv_open(&wopts, &wkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(wkv, 1, IWDB_UINT64_KEYS, &wdb1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(vbuf, 0, sizeof(vbuf));
+  for (uint64_t k = 0; k < 100; ++k) {
+    vbuf[0] = k;
+    key.data = &k;
+    key.size = sizeof(k);
+    val.data = vbuf;
+    val.size = 2 * sizeof(uint64_t);
+    rc = iwkv_put(wdb1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+
+  rc = iwkv_open(&ropts, &rkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(rkv, 1, IWDB_UINT64_KEYS, &ctx.db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_open(ctx.db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_NOT_IMPLEMENTED);
+  uint64_t k = 99;
+  key.data = &k;
+  key.size = sizeof(k);
+  rc = iwkv_get(ctx.db, &key, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(val.size, 2 * sizeof(uint64_t));
+  iwkv_val_dispose(&val);
+
+  // Reader sees concurrent updates of writer growing storage file
+  CU_ASSERT_EQUAL_FATAL(pthread_create(&thr, 0, iwkv_test4_35_reader, &ctx), 0);
+  for (uint64_t r = 1; r < 3; ++r) {
+    for (k = 0; k < num; ++k) {
+      vbuf[0] = k;
+      vbuf[1] = r;
+      key.data = &k;
+      key.size = sizeof(k);
+      val.data = vbuf;
+      val.size = (2 + (k + r) % 30) * sizeof(uint64_t);
+      if ((k + r) % 5) {
+        rc = iwkv_put(wdb1, &key, &val, 0);
+      } else {
+        rc = iwkv_del(wdb1, &key);
+        if (rc == IWKV_ERROR_NOTFOUND) {
+          rc = 0;
+        }
+      }
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+  }
+  atomic_store(&ctx.stop, true);
+  pthread_join(thr, 0);
+  CU_ASSERT_EQUAL(atomic_load(&ctx.errors), 0);
+  k = num - 1;
+  rc = iwkv_get(ctx.db, &key, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(val.size, (2 + (k + 2) % 30) * sizeof(uint64_t));
+  CU_ASSERT_EQUAL(((uint64_t*) val.data)[1], 2);
+  iwkv_val_dispose(&val);
+
+  // Databases created and destroyed by writer
+  rc = iwkv_db(rkv, 2, 0, &rdb2);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_READONLY);
+  rc = iwkv_db(wkv, 2, 0, &wdb2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  key.data = "foo";
+  key.size = 3;
+  val.data = "bar";
+  val.size = 3;
+  rc = iwkv_put(wdb2, &key, &val, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(rkv, 2, 0, &rdb2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_get(rdb2, &key, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(val.size, 3);
+  iwkv_val_dispose(&val);
+  rc = iwkv_db_destroy(&wdb1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  k = 1;
+  key.data = &k;
+  key.size = sizeof(k);
+  rc = iwkv_get(ctx.db, &key, &val);
+  CU_ASSERT_EQUAL(rc, IW_ERROR_INVALID_STATE);
+  IWKV_STATE state;
+  rc = iwkv_state(rkv, &state);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(state.dbnum, 1);
+
+  rc = iwkv_close(&rkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_close(&wkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static int test36_op;
+
+// Keys `<decimal number>[:payload]` ordered by number then by payload
+static int test36_cmp(const void *k1, uint32_t k1len, const void *k2, uint32_t k2len, void *op) {
+  const char *s1 = k1, *s2 = k2;
+  uint64_t n1 = 0, n2 = 0;
+  uint32_t i1 = 0, i2 = 0;
+  CU_ASSERT_TRUE(op == &test36_op);
+  for ( ; i1 < k1len && s1[i1] >= '0' && s1[i1] <= '9'; ++i1) n1 = n1 * 10 + (s1[i1] - '0');
+  for ( ; i2 < k2len && s2[i2] >= '0' && s2[i2] <= '9'; ++i2) n2 = n2 * 10 + (s2[i2] - '0');
+  if (n1 != n2) {
+    return n1 < n2 ? -1 : 1;
+  }
+  int rv = memcmp(s1 + i1, s2 + i2, MIN(k1len - i1, k2len - i2));
+  return rv ? rv : (int) (k1len - i1) - (int) (k2len - i2);
+}
+
+static int test36_key(char *buf, size_t bufsz, int i) {
+  // Every third key is longer than lower key stored in skip list node
+  return snprintf(buf, bufsz, "%d%s%.*s", i, (i % 3) ? "" : ":", (i % 3) ? 0 : 200,
+                  "pppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppp"
+                  "pppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppppp");
+}
+
+static void test36_check_order(IWDB db, int n, int step) {
+  IWKV_cursor cur;
+  IWKV_val key, pkey = { 0 };
+  int cnt = 0;
+  iwrc rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) {
+    rc = iwkv_cursor_key(cur, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    if (pkey.data) {
+      // Traversal goes from the greatest key
+      CU_ASSERT_TRUE(test36_cmp(pkey.data, pkey.size, key.data, key.size, &test36_op) > 0);
+      iwkv_val_dispose(&pkey);
+    }
+    pkey = key;
+    ++cnt;
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  iwkv_val_dispose(&pkey);
+  CU_ASSERT_EQUAL(cnt, n / step);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL(rc, 0);
+}
+
+static void iwkv_test4_36(void) {
+  IWKV_KEY_CMP cmps[] = {
+    { .dbid = 1, .cmp = test36_cmp, .op = &test36_op }
+  };
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_36.db",
+    .oflags = IWKV_TRUNC,
+    .key_cmps = cmps,
+    .key_cmps_num = 1
+  };
+  IWKV iwkv;
+  IWDB db, db2;
+  IWKV_val val;
+  char kbuf[256];
+  const int n = 20000;
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, IWDB_CUSTOM_KEYS, &db2);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_db(iwkv, 1, IWDB_CUSTOM_KEYS | IWDB_UINT32_KEYS, &db);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_db(iwkv, 1, IWDB_CUSTOM_KEYS, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < n; ++i) {
+    int k = (int) ((i * 7919ULL) % n) + 1;
+    IWKV_val key = { .data = kbuf, .size = test36_key(kbuf, sizeof(kbuf), k) };
+    IWKV_val v = { .data = &k, .size = sizeof(k) };
+    rc = iwkv_put(db, &key, &v, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  test36_check_order(db, n, 1);
+  for (int k = 1; k <= n; ++k) {
+    IWKV_val key = { .data = kbuf, .size = test36_key(kbuf, sizeof(kbuf), k) };
+    rc = iwkv_get(db, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(val.size, sizeof(k));
+    CU_ASSERT_EQUAL(memcmp(val.data, &k, sizeof(k)), 0);
+    iwkv_val_dispose(&val);
+  }
+  // Key with the same number and another payload
+  IWKV_val key = { .data = "3:q", .size = 3 };
+  rc = iwkv_get(db, &key, &val);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+
+  // Remove odd keys
+  for (int k = 1; k <= n; k += 2) {
+    key.data = kbuf;
+    key.size = test36_key(kbuf, sizeof(kbuf), k);
+    rc = iwkv_del(db, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  test36_check_order(db, n, 2);
+
+  IWKV_cursor cur;
+  key.data = "101";
+  key.size = 3;
+  rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_GE, &key);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_cursor_val(cur, &val);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(*(int *) val.data, 102);
+  iwkv_val_dispose(&val);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL(rc, 0);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Database is not accessible without comparator
+  opts.oflags = 0;
+  opts.key_cmps_num = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_CUSTOM_KEYS, &db);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_INCOMPATIBLE_DB_MODE);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  opts.key_cmps_num = 1;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_CUSTOM_KEYS, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  test36_check_order(db, n, 2);
+  for (int k = 2; k <= n; k += 2) {
+    key.data = kbuf;
+    key.size = test36_key(kbuf, sizeof(kbuf), k);
+    rc = iwkv_get(db, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL(*(int *) val.data, k);
+    iwkv_val_dispose(&val);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_37_fill(const char *path, int32_t seed) {
+  IWKV_OPTS opts = {
+    .path = (char *) path,
+    .random_seed = seed,
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db;
+  char kbuf[32];
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < 5000; ++i) {
+    IWKV_val key = { .data = kbuf, .size = snprintf(kbuf, sizeof(kbuf), "%08d", (i * 7919) % 5000) };
+    IWKV_val val = { .data = kbuf, .size = key.size };
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_37(void) {
+  // Skip list levels generated with the same random seed give the same storage layout
+  iwkv_test4_37_fill("iwkv_test4_37.db", 37);
+  iwkv_test4_37_fill("iwkv_test4_37_2.db", 37);
+  iwkv_test4_37_fill("iwkv_test4_37_3.db", 38);
+  CU_ASSERT_TRUE(iwkv_test4_same_files("iwkv_test4_37.db", "iwkv_test4_37_2.db"));
+  CU_ASSERT_FALSE(iwkv_test4_same_files("iwkv_test4_37.db", "iwkv_test4_37_3.db"));
+}
+
+#define IWKV_TEST4_38_NUM 20000
+
+static int iwkv_test4_38_kv(int i, char *kbuf, char *vbuf, IWKV_val *key, IWKV_val *val) {
+  key->data = kbuf;
+  key->size = snprintf(kbuf, 32, "%08d", (i * 7919) % IWKV_TEST4_38_NUM);
+  memset(vbuf, 'x', 100);
+  memcpy(vbuf, kbuf, key->size);
+  val->data = vbuf;
+  val->size = 100;
+  return 0;
+}
+
+// Child process puts records starting from `base` and reports every acknowledged one into `fd`
+// until it is killed by `iwkv_kill_on_split` or by `iwkv_kill_on_writeback` set at `iwkv_sync()`
+static void iwkv_test4_38_child(int fd, int base, bool ckpt) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_38.db",
+    .wal = {
+      .enabled = true
+    }
+  };
+  IWKV iwkv;
+  IWDB db;
+  char kbuf[32], vbuf[100];
+  IWKV_val key, val;
+  if (iwkv_open(&opts, &iwkv) || iwkv_db(iwkv, 1, 0, &db)) {
+    _exit(2);
+  }
+  if (!ckpt) {
+    iwkv_kill_on_split = 50;
+  }
+  for (int i = base; i < IWKV_TEST4_38_NUM; ++i) {
+    iwkv_test4_38_kv(i, kbuf, vbuf, &key, &val);
+    if (iwkv_put(db, &key, &val, ckpt ? 0 : IWKV_SYNC)) {
+      _exit(3);
+    }
+    int n = i + 1;
+    if (write(fd, &n, sizeof(n)) != sizeof(n)) {
+      _exit(4);
+    }
+    if (ckpt && n == base + 1000) {
+      // Records are not synced, they are recovered only from page images of checkpoint
+      iwkv_kill_on_writeback = 1;
+      iwkv_sync(iwkv, 0);
+    }
+  }
+  _exit(5);
+}
+
+// Crashes child process writing into the storage, returns number of acknowledged records
+static int iwkv_test4_38_crash(int base, bool ckpt) {
+  int pfd[2], n = base, status = 0;
+  CU_ASSERT_EQUAL_FATAL(pipe(pfd), 0);
+  fflush(0);
+  pid_t pid = fork();
+  CU_ASSERT_TRUE_FATAL(pid >= 0);
+  if (!pid) {
+    close(pfd[0]);
+    iwkv_test4_38_child(pfd[1], base, ckpt);
+  }
+  close(pfd[1]);
+  for (int v; read(pfd[0], &v, sizeof(v)) == sizeof(v); n = v);
+  close(pfd[0]);
+  CU_ASSERT_EQUAL_FATAL(waitpid(pid, &status, 0), pid);
+  CU_ASSERT_TRUE_FATAL(WIFSIGNALED(status));
+  CU_ASSERT_EQUAL_FATAL(WTERMSIG(status), SIGKILL);
+  CU_ASSERT_TRUE_FATAL(n > base);
+  return n;
+}
+
+// Reopens crashed storage, all acknowledged records must be in place. Record in progress may be applied.
+static int iwkv_test4_38_check(int num) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_38.db",
+    .wal = {
+      .enabled = true
+    }
+  };
+  IWKV iwkv;
+  IWDB db;
+  IWKV_cursor cur;
+  IWKV_val key, val, ckey, cval;
+  char kbuf[32], vbuf[100], pkbuf[8];
+  int cnt = 0;
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < num; ++i) {
+    iwkv_test4_38_kv(i, kbuf, vbuf, &key, &val);
+    rc = iwkv_get(db, &key, &cval);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(cval.size, val.size);
+    CU_ASSERT_FALSE(memcmp(cval.data, val.data, val.size));
+    iwkv_val_dispose(&cval);
+  }
+  rc = iwkv_cursor_open(db, &cur, IWKV_CURSOR_BEFORE_FIRST, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  while (!(rc = iwkv_cursor_to(cur, IWKV_CURSOR_NEXT))) {
+    rc = iwkv_cursor_get(cur, &ckey, &cval);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(ckey.size, 8);
+    CU_ASSERT_TRUE(!cnt || memcmp(pkbuf, ckey.data, 8) > 0);
+    CU_ASSERT_FALSE(memcmp(ckey.data, cval.data, 8));
+    memcpy(pkbuf, ckey.data, 8);
+    iwkv_kv_dispose(&ckey, &cval);
+    ++cnt;
+  }
+  CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+  rc = iwkv_cursor_close(&cur);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_TRUE(cnt == num || cnt == num + 1);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  return cnt;
+}
+
+static void iwkv_test4_38(void) {
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_38.db",
+    .oflags = IWKV_TRUNC,
+    .wal = {
+      .enabled = true
+    }
+  };
+  IWKV iwkv;
+  IWDB db;
+  IWKV_val key, val;
+  char kbuf[32], vbuf[100];
+  int num = 2000;
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < num; ++i) {
+    iwkv_test4_38_kv(i, kbuf, vbuf, &key, &val);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  // Killed in the middle of SBLK split, the same file is recovered
+  num = iwkv_test4_38_crash(num, false);
+  num = iwkv_test4_38_check(num);
+  num = iwkv_test4_38_crash(num, false);
+  num = iwkv_test4_38_check(num);
+
+  // Killed during checkpoint after page images are logged
+  num = iwkv_test4_38_crash(num, true);
+  num = iwkv_test4_38_check(num);
+}
+
+static void iwkv_test4_39(void) {
+  // Storage written with size-class magazines is readable without them
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_39.db",
+    .oflags = IWKV_TRUNC | IWKV_FSM_MAGAZINES
+  };
+  IWKV iwkv;
+  IWDB db;
+  IWKV_val key, val;
+  char kbuf[32], vbuf[512];
+  const int num = 10000;
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  memset(vbuf, 'v', sizeof(vbuf));
+  for (int i = 0; i < num; ++i) {
+    key.data = kbuf;
+    key.size = snprintf(kbuf, sizeof(kbuf), "%08d", (i * 7919) % num);
+    val.data = vbuf;
+    val.size = 1 + (i * 31) % sizeof(vbuf);
+    rc = iwkv_put(db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (int i = 0; i < num; i += 2) {
+    key.data = kbuf;
+    key.size = snprintf(kbuf, sizeof(kbuf), "%08d", (i * 7919) % num);
+    rc = iwkv_del(db, &key);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, 0, &db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (int i = 0; i < num; ++i) {
+    key.data = kbuf;
+    key.size = snprintf(kbuf, sizeof(kbuf), "%08d", (i * 7919) % num);
+    rc = iwkv_get(db, &key, &val);
+    if (i & 1) {
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+      CU_ASSERT_EQUAL(val.size, 1 + (i * 31) % sizeof(vbuf));
+      iwkv_val_dispose(&val);
+    } else {
+      CU_ASSERT_EQUAL(rc, IWKV_ERROR_NOTFOUND);
+    }
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+}
+
+static void iwkv_test4_40_check(IWDB db, int n, char *vbuf) {
+  char kbuf[32];
+  for (int i = 0; i < n; ++i) {
+    IWKV_val val;
+    size_t vsz = (i % 3) ? 5000 + 3 * i : 16;
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    iwrc rc = iwkv_get(db, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(val.size, vsz);
+    iwkv_test4_30_fill(vbuf, i, vsz);
+    CU_ASSERT_FALSE_FATAL(memcmp(val.data, vbuf, vsz));
+    iwkv_val_dispose(&val);
+  }
+}
+
+static void iwkv_test4_40(void) {
+  // Compaction relocates out of line values of `IWDB_OVERFLOW_VALS` database
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_40.db",
+    .oflags = IWKV_TRUNC
+  };
+  IWKV iwkv;
+  IWDB db1, db2;
+  char kbuf[32];
+  const int n = 2000;
+  char *vbuf = malloc(16 * 1024);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(vbuf);
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_OVERFLOW_VALS, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 2, 0, &db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  // Extents are placed above records of database dropped later
+  memset(vbuf, 'x', 12000);
+  for (int i = 0; i < n; ++i) {
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    IWKV_val val = { .data = vbuf, .size = 12000 };
+    rc = iwkv_put(db2, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (int i = 0; i < n; ++i) {
+    size_t vsz = (i % 3) ? 5000 + 3 * i : 16;
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    iwkv_test4_30_fill(vbuf, i, vsz);
+    IWKV_val val = { .data = vbuf, .size = vsz };
+    rc = iwkv_put(db1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_db_destroy(&db2);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_sync(iwkv, 0);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  off_t fsz1 = iwkv_test4_12_fsize(opts.path);
+
+  bool done = false;
+  int steps = 0;
+  do {
+    rc = iwkv_compact(iwkv, 1024 * 1024, &done);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_TRUE_FATAL(++steps < 1000);
+  } while (!done);
+  iwkv_test4_40_check(db1, n, vbuf);
+  off_t fsz2 = iwkv_test4_12_fsize(opts.path);
+  CU_ASSERT_TRUE(fsz2 < fsz1 / 2);
+
+  // Relocated extents are released on update
+  for (int i = 0; i < n; i += 3) {
+    size_t vsz = 16;
+    snprintf(kbuf, sizeof(kbuf), "%08d", i);
+    IWKV_val key = { .data = kbuf, .size = strlen(kbuf) };
+    iwkv_test4_30_fill(vbuf, i, vsz);
+    IWKV_val val = { .data = vbuf, .size = vsz };
+    rc = iwkv_put(db1, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+
+  opts.oflags = 0;
+  rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_OVERFLOW_VALS, &db1);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  iwkv_test4_40_check(db1, n, vbuf);
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(vbuf);
+}
+
+static void iwkv_test4_41_impl(bool wal) {
+  // Optimistic readers run while file is grown, databases are destroyed and file is compacted
+  IWKV_OPTS opts = {
+    .path = "iwkv_test4_41.db",
+    .oflags = IWKV_TRUNC,
+    .wal = {
+      .enabled = wal
+    }
+  };
+  const int nthreads = 4;
+  const int num = 2000;
+  pthread_t threads[nthreads];
+  OGETTCTX ctx = {
+    .num = num
+  };
+  IWKV iwkv;
+  IWDB db2;
+  IWKV_val key, val;
+  uint64_t vbuf[2];
+  char *bbuf = calloc(1, 16 * 1024);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(bbuf);
+
+  iwrc rc = iwkv_open(&opts, &iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  rc = iwkv_db(iwkv, 1, IWDB_UINT64_KEYS, &ctx.db);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  for (uint64_t k = 0; k < num; ++k) {
+    vbuf[0] = k;
+    vbuf[1] = 0;
+    key.data = &k;
+    key.size = sizeof(k);
+    val.data = vbuf;
+    val.size = sizeof(vbuf);
+    rc = iwkv_put(ctx.db, &key, &val, 0);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+  }
+  for (int i = 0; i < nthreads; ++i) {
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&threads[i], 0, iwkv_test4_5_reader, &ctx), 0);
+  }
+  for (int r = 0; r < 5; ++r) {
+    rc = iwkv_db(iwkv, 2, IWDB_UINT32_KEYS, &db2);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    for (uint32_t k = 0; k < 1000; ++k) {
+      key.data = &k;
+      key.size = sizeof(k);
+      val.data = bbuf;
+      val.size = 16 * 1024;
+      rc = iwkv_put(db2, &key, &val, 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+    // Records of the first database are placed above records of the second one
+    for (uint64_t k = 0; k < num; ++k) {
+      vbuf[0] = k;
+      vbuf[1] = r + 1;
+      key.data = &k;
+      key.size = sizeof(k);
+      val.data = vbuf;
+      val.size = sizeof(vbuf);
+      rc = iwkv_put(ctx.db, &key, &val, 0);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+    rc = iwkv_db_destroy(&db2);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    bool done = false;
+    for (int i = 0; i < 1000 && !done; ++i) {
+      rc = iwkv_compact(iwkv, 0, &done);
+      CU_ASSERT_EQUAL_FATAL(rc, 0);
+    }
+  }
+  ctx.stop = true;
+  for (int i = 0; i < nthreads; ++i) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    CU_ASSERT_PTR_NULL(ret);
+  }
+  for (uint64_t k = 0; k < num; ++k) {
+    key.data = &k;
+    key.size = sizeof(k);
+    rc = iwkv_get(ctx.db, &key, &val);
+    CU_ASSERT_EQUAL_FATAL(rc, 0);
+    CU_ASSERT_EQUAL_FATAL(val.size, sizeof(vbuf));
+    memcpy(vbuf, val.data, sizeof(vbuf));
+    CU_ASSERT_EQUAL(vbuf[0], k);
+    CU_ASSERT_EQUAL(vbuf[1], 5);
+    iwkv_val_dispose(&val);
+  }
+  rc = iwkv_close(&iwkv);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  free(bbuf);
+}
+
+static void iwkv_test4_41(void) {
+  iwkv_test4_41_impl(false);
+  iwkv_test4_41_impl(true);
+}
+
+int main() {
+  CU_pSuite pSuite = NULL;
+
+  /* Initialize the CUnit test registry */
+  if (CUE_SUCCESS != CU_initialize_registry()) return CU_get_error();
+
+  /* Add a suite to the registry */
+  pSuite = CU_add_suite("iwkv_test4", init_suite, clean_suite);
+
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  /* Add the tests to the suite */
+  if (
+    (NULL == CU_add_test(pSuite, "iwkv_test4_1", iwkv_test4_1)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_2", iwkv_test4_2)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_3", iwkv_test4_3)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_4", iwkv_test4_4)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_5", iwkv_test4_5)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_6", iwkv_test4_6)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_7", iwkv_test4_7)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_8", iwkv_test4_8)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_9", iwkv_test4_9)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_10", iwkv_test4_10)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_11", iwkv_test4_11)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_12", iwkv_test4_12)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_13", iwkv_test4_13)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_14", iwkv_test4_14)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_15", iwkv_test4_15)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_16", iwkv_test4_16)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_17", iwkv_test4_17)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_18", iwkv_test4_18)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_19", iwkv_test4_19)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_20", iwkv_test4_20)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_21", iwkv_test4_21)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_22", iwkv_test4_22)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_23", iwkv_test4_23)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_24", iwkv_test4_24)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_25", iwkv_test4_25)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_26", iwkv_test4_26)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_27", iwkv_test4_27)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_28", iwkv_test4_28)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_29", iwkv_test4_29)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_30", iwkv_test4_30)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_31", iwkv_test4_31)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_32", iwkv_test4_32)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_33", iwkv_test4_33)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_34", iwkv_test4_34)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_35", iwkv_test4_35)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_36", iwkv_test4_36)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_37", iwkv_test4_37)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_38", iwkv_test4_38)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_39", iwkv_test4_39)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_40", iwkv_test4_40)) ||
+    (NULL == CU_add_test(pSuite, "iwkv_test4_41", iwkv_test4_41)))  {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  /* Run all tests using the CUnit Basic interface */
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  int ret = CU_get_error() || CU_get_number_of_failures();
+  CU_cleanup_registry();
+  return ret;
+}
@@ -36,6 +36,8 @@
 #include <inttypes.h>
 #include <math.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <time.h>
 #include <limits.h>
@@ -53,10 +55,9 @@ static iwrc _default_logfn(locale_t locale, iwlog_lvl lvl, iwrc ecode, int errno
 static const char *_ecode_explained(locale_t locale, uint32_t ecode);
 static const char *_default_ecodefn(locale_t locale, uint32_t ecode);
 
-static IWLOG_FN _current_logfn;
 static pthread_mutex_t _mtx = PTHREAD_MUTEX_INITIALIZER;
-static IWLOG_FN _current_logfn = _default_logfn;
-static void *_current_logfn_options = 0;
+static _Atomic(IWLOG_FN) _current_logfn = _default_logfn;
+static _Atomic(void *) _current_logfn_options = 0;
 #define _IWLOG_MAX_ECODE_FUN 256
 static IWLOG_ECODE_FN _ecode_functions[_IWLOG_MAX_ECODE_FUN] = {0};
 
@@ -92,10 +93,8 @@ iwrc iwlog_va(iwlog_lvl lvl, iwrc ecode, const char *file, int line, const char
   if (iwp_current_time_ms(&ts)) {
     return -1;
   }
-  pthread_mutex_lock(&_mtx);
-  IWLOG_FN logfn = _current_logfn;
-  void *opts = _current_logfn_options;
-  pthread_mutex_unlock(&_mtx);
+  IWLOG_FN logfn = atomic_load_explicit(&_current_logfn, memory_order_acquire);
+  void *opts = atomic_load_explicit(&_current_logfn_options, memory_order_acquire);
 
   rc = logfn(locale, lvl, ecode, errno_code, werror_code, file, line, ts, opts, fmt, argp);
   if (rc) {
@@ -157,29 +156,15 @@ void iwrc_strip_code(iwrc *rc) {
 }
 
 void iwlog_set_logfn(IWLOG_FN fp) {
-  pthread_mutex_lock(&_mtx);
-
-  if (!fp) {
-    _current_logfn = _default_logfn;
-  } else {
-    _current_logfn = fp;
-  }
-
-  pthread_mutex_unlock(&_mtx);
+  atomic_store_explicit(&_current_logfn, fp ? fp : _default_logfn, memory_order_release);
 }
 
 IWLOG_FN iwlog_get_logfn(void) {
-  IWLOG_FN res;
-  pthread_mutex_lock(&_mtx);
-  res = _current_logfn;
-  pthread_mutex_unlock(&_mtx);
-  return res;
+  return atomic_load_explicit(&_current_logfn, memory_order_acquire);
 }
 
 void iwlog_set_logfn_opts(void *opts) {
-  pthread_mutex_lock(&_mtx);
-  _current_logfn_options = opts;
-  pthread_mutex_unlock(&_mtx);
+  atomic_store_explicit(&_current_logfn_options, opts, memory_order_release);
 }
 
 const char *iwlog_ecode_explained(iwrc ecode) {
@@ -431,3 +416,222 @@ finish:
 #undef EBUF_SZ
   return rc;
 }
+
+static iwrc _default_logfn2(locale_t locale, iwlog_lvl lvl, iwrc ecode, int errno_code, int werror_code,
+                            const char *file, int line, uint64_t ts, void *opts, const char *fmt, ...) {
+  va_list argp;
+  va_start(argp, fmt);
+  iwrc rc = _default_logfn(locale, lvl, ecode, errno_code, werror_code, file, line, ts, opts, fmt, argp);
+  va_end(argp);
+  return rc;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                Asynchronous logging backend                                    //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define _IWLOG_ASYNC_MSG_SZ 216
+
+/** Log record buffered by asynchronous backend */
+typedef struct ALREC {
+  uint64_t ts;                    /**< Record time-stamp */
+  iwrc ecode;                     /**< Error code */
+  locale_t locale;                /**< Locale of logging thread */
+  const char *file;               /**< Static source file name */
+  int line;                       /**< Source line */
+  int errno_code;                 /**< Errno code */
+  int werror_code;                /**< Windows error code */
+  iwlog_lvl lvl;                  /**< Log level */
+  char msg[_IWLOG_ASYNC_MSG_SZ];  /**< Formatted message, truncated if it is too long */
+} ALREC;
+
+/** Ring buffer of records written by a single thread and read by drain thread */
+typedef struct ALRING {
+  atomic_uint_fast64_t head;      /**< Next record to write, changed by owner thread */
+  atomic_uint_fast64_t tail;      /**< Next record to drain, changed by drain thread */
+  atomic_bool owned;              /**< Ring is used by a live thread */
+  struct ALRING *next;            /**< Next ring in `_async.rings` list */
+  uint32_t mask;                  /**< Number of records minus one */
+  ALREC recs[];
+} ALRING;
+
+static struct {
+  _Atomic(ALRING *) rings;        /**< Rings of all logging threads, reused after thread exit */
+  atomic_bool running;            /**< Drain thread is running */
+  atomic_uint_fast64_t dropped;   /**< Number of records dropped because of full rings */
+  bool stop;                      /**< Drain thread should exit, guarded by `mtx` */
+  bool key_created;               /**< `key` is created */
+  uint32_t ring_size;             /**< Number of records in new rings */
+  uint32_t flush_interval_ms;     /**< Drain thread wakeup interval */
+  IWLOG_DEFAULT_OPTS out;         /**< Output options of `_default_logfn` */
+  pthread_t thr;                  /**< Drain thread */
+  pthread_key_t key;              /**< Releases ring on thread exit */
+  pthread_mutex_t mtx;
+  pthread_cond_t cond;
+} _async = {
+  .mtx  = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER
+};
+
+static _Thread_local ALRING *_async_ring;
+
+static void _async_ring_release(void *op) {
+  ALRING *r = op;
+  atomic_store(&r->owned, false);
+}
+
+static ALRING *_async_ring_acquire(void) {
+  ALRING *r = _async_ring;
+  if (r) {
+    return r;
+  }
+  // Reuse ring of exited thread
+  for (r = atomic_load(&_async.rings); r; r = r->next) {
+    bool owned = false;
+    if (atomic_compare_exchange_strong(&r->owned, &owned, true)) {
+      break;
+    }
+  }
+  if (!r) {
+    r = calloc(1, sizeof(*r) + _async.ring_size * sizeof(r->recs[0]));
+    if (!r) {
+      return 0;
+    }
+    r->mask = _async.ring_size - 1;
+    atomic_store(&r->owned, true);
+    ALRING *head = atomic_load(&_async.rings);
+    do {
+      r->next = head;
+    } while (!atomic_compare_exchange_weak(&_async.rings, &head, r));
+  }
+  pthread_setspecific(_async.key, r);
+  _async_ring = r;
+  return r;
+}
+
+// Assumed:
+//   1. Only one thread drains rings.
+static void _async_drain(void) {
+  for (ALRING *r = atomic_load(&_async.rings); r; r = r->next) {
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    for (; tail < head; ++tail) {
+      ALREC *rec = &r->recs[tail & r->mask];
+      _default_logfn2(rec->locale, rec->lvl, rec->ecode, rec->errno_code, rec->werror_code,
+                      rec->file, rec->line, rec->ts, &_async.out, "%s", rec->msg);
+    }
+    atomic_store_explicit(&r->tail, tail, memory_order_release);
+  }
+}
+
+static void *_async_worker(void *op) {
+  struct timespec tp;
+  pthread_mutex_lock(&_async.mtx);
+  while (!_async.stop) {
+    clock_gettime(CLOCK_REALTIME, &tp);
+    uint64_t ns = tp.tv_nsec + (uint64_t) _async.flush_interval_ms * 1000000ULL;
+    tp.tv_sec += ns / 1000000000ULL;
+    tp.tv_nsec = ns % 1000000000ULL;
+    pthread_cond_timedwait(&_async.cond, &_async.mtx, &tp);
+    pthread_mutex_unlock(&_async.mtx);
+    _async_drain();
+    pthread_mutex_lock(&_async.mtx);
+  }
+  pthread_mutex_unlock(&_async.mtx);
+  _async_drain();
+  return 0;
+}
+
+iwrc iwlog_async_start(const IWLOG_ASYNC_OPTS *opts) {
+  int rci;
+  if (atomic_load(&_async.running)) {
+    return IW_ERROR_INVALID_STATE;
+  }
+  uint32_t rsz = (opts && opts->ring_size) ? opts->ring_size : 256;
+  if (rsz > (1U << 20)) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  _async.ring_size = 1;
+  while (_async.ring_size < rsz) {
+    _async.ring_size <<= 1;
+  }
+  _async.flush_interval_ms = (opts && opts->flush_interval_ms) ? opts->flush_interval_ms : 100;
+  _async.out.out = opts ? opts->out : 0;
+  if (!_async.key_created) {
+    rci = pthread_key_create(&_async.key, _async_ring_release);
+    if (rci) {
+      return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+    }
+    _async.key_created = true;
+  }
+  _async.stop = false;
+  rci = pthread_create(&_async.thr, 0, _async_worker, 0);
+  if (rci) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci);
+  }
+  atomic_store(&_async.running, true);
+  return 0;
+}
+
+iwrc iwlog_async_stop(void) {
+  if (!atomic_load(&_async.running)) {
+    return 0;
+  }
+  atomic_store(&_async.running, false);
+  pthread_mutex_lock(&_async.mtx);
+  _async.stop = true;
+  pthread_cond_signal(&_async.cond);
+  pthread_mutex_unlock(&_async.mtx);
+  int rci = pthread_join(_async.thr, 0);
+  // Pick up records of threads raced with stop
+  _async_drain();
+  return rci ? iwrc_set_errno(IW_ERROR_THREADING_ERRNO, rci) : 0;
+}
+
+uint64_t iwlog_async_dropped(void) {
+  return atomic_load(&_async.dropped);
+}
+
+iwrc iwlog_async_logfn(locale_t locale,
+                       iwlog_lvl lvl,
+                       iwrc ecode,
+                       int errno_code,
+                       int werror_code,
+                       const char *file,
+                       int line,
+                       uint64_t ts,
+                       void *opts,
+                       const char *fmt,
+                       va_list argp) {
+  ALRING *r = atomic_load_explicit(&_async.running, memory_order_acquire) ? _async_ring_acquire() : 0;
+  if (!r) {
+    return _default_logfn(locale, lvl, ecode, errno_code, werror_code, file, line, ts,
+                          _async.out.out ? &_async.out : opts, fmt, argp);
+  }
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  if (head - tail > r->mask) {
+    atomic_fetch_add_explicit(&_async.dropped, 1, memory_order_relaxed);
+    return 0;
+  }
+  ALREC *rec = &r->recs[head & r->mask];
+  rec->ts = ts;
+  rec->ecode = ecode;
+  rec->locale = locale;
+  rec->file = file;
+  rec->line = line;
+  rec->errno_code = errno_code;
+  rec->werror_code = werror_code;
+  rec->lvl = lvl;
+  if (fmt) {
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, argp);
+  } else {
+    rec->msg[0] = '\0';
+  }
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  if (head + 1 - tail > (r->mask >> 1)) {
+    // Wake up drain thread if ring is half full
+    pthread_cond_signal(&_async.cond);
+  }
+  return 0;
+}
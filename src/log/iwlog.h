@@ -117,6 +117,17 @@ typedef struct {
   FILE *out; /**< Output file stream. Default: `stderr`  */
 } IWLOG_DEFAULT_OPTS;
 
+/**
+ * @brief Options of asynchronous logging backend.
+ * @see iwlog_async_start(const IWLOG_ASYNC_OPTS*)
+ */
+typedef struct {
+  FILE *out;                  /**< Output file stream. Default: `stderr` */
+  uint32_t ring_size;         /**< Number of records buffered per logging thread,
+                                   rounded up to power of 2. Default: `256` */
+  uint32_t flush_interval_ms; /**< Max time records are kept in buffers. Default: `100` */
+} IWLOG_ASYNC_OPTS;
+
 /**
  * @brief Logging function pointer.
  *
@@ -212,6 +223,44 @@ IW_EXPORT IWLOG_FN iwlog_get_logfn(void);
  */
 IW_EXPORT void iwlog_set_logfn_opts(void *opts);
 
+/**
+ * @brief Start background thread of asynchronous logging backend.
+ * @details Asynchronous backend is activated by `iwlog_set_logfn(iwlog_async_logfn)`.
+ *          Every logging thread appends records into its own lock-free ring buffer
+ *          and never waits for output: records are dropped if buffer is full.
+ *          Timestamps, error explanations and output are handled by the background thread.
+ * @warning Not thread safe.
+ *
+ * @param opts Backend options, can be `NULL`
+ * @return `0` on success or error code.
+ */
+IW_EXPORT iwrc iwlog_async_start(const IWLOG_ASYNC_OPTS *opts);
+
+/**
+ * @brief Flush buffered records and stop background thread of asynchronous backend.
+ * @details `iwlog_async_logfn` writes records synchronously when backend is stopped.
+ * @warning Not thread safe.
+ */
+IW_EXPORT iwrc iwlog_async_stop(void);
+
+/**
+ * @brief Logging function of asynchronous backend.
+ * @note Message is formatted into record buffer by calling thread,
+ *       so arguments are not used after return.
+ *       `file` must be a static string such as `__FILE__`.
+ * @see iwlog_async_start(const IWLOG_ASYNC_OPTS*)
+ * @see IWLOG_FN
+ */
+IW_EXPORT iwrc iwlog_async_logfn(locale_t locale, iwlog_lvl lvl, iwrc ecode,
+                                 int errno_code, int werror_code, const char *file,
+                                 int line, uint64_t ts, void *opts, const char *fmt,
+                                 va_list argp);
+
+/**
+ * @brief Number of records dropped by asynchronous backend because of full buffers.
+ */
+IW_EXPORT uint64_t iwlog_async_dropped(void);
+
 /**
  * @brief Returns string representation of a given error code.
  * @param ecode Error code
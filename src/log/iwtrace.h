@@ -0,0 +1,120 @@
+#pragma once
+#ifndef IWTRACE_H
+#define IWTRACE_H
+
+/**************************************************************************************************
+ * IOWOW library
+ *
+ * MIT License
+ *
+ * Copyright (c) 2012-2018 Softmotions Ltd <info@softmotions.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *************************************************************************************************/
+
+/**
+ * @file
+ * @brief Tracing hooks of long running internal operations.
+ *
+ * Hooks are registered by `IWKV_OPTS::trace` or `IWFS_EXT_OPTS::trace`
+ * and receive events with begin/end timestamps of operations
+ * which may cause latency spikes. Tracing points are compiled only
+ * if library is built with `ENABLE_TRACE` cmake option (`IW_TRACE` macro),
+ * otherwise registered hooks are ignored.
+ */
+
+#include "basedefs.h"
+#include "iwp.h"
+#include <stdint.h>
+
+IW_EXTERN_C_START
+
+/** Traced operation */
+typedef enum {
+  IWTRACE_EXFILE_RESIZE = 1,  /**< File is resized and remapped, `size`: new file size */
+  IWTRACE_FSM_BITMAP_RESIZE,  /**< Free-space bitmap is relocated, `size`: new bitmap length */
+  IWTRACE_DBCACHE_FILL,       /**< Database cache is rebuilt, `size`: number of cached nodes */
+  IWTRACE_DB_LOCK_WAIT,       /**< Database lock acquisition is blocked by other threads,
+                                   `size`: `1` for write lock, `0` for read lock */
+} iwtrace_event_t;
+
+/** Trace event */
+typedef struct IWTRACE_EVENT {
+  iwtrace_event_t type;       /**< Traced operation */
+  uint32_t dbid;              /**< Database id for database events, `0` otherwise */
+  uint64_t begin_ns;          /**< Operation start time, see `iwp_monotonic_time_ns()` */
+  uint64_t end_ns;            /**< Operation end time, see `iwp_monotonic_time_ns()` */
+  uint64_t size;              /**< Operation specific size */
+} IWTRACE_EVENT;
+
+/**
+ * @brief Tracing hooks.
+ * @note Hooks are called synchronously from the traced thread
+ *       often with internal locks held so they must be fast
+ *       and must not call any API of traced objects.
+ */
+typedef struct IWTRACE {
+  void (*event)(const IWTRACE_EVENT *ev, void *ctx); /**< Event hook */
+  void *ctx;                                         /**< Opaque data passed to hooks */
+} IWTRACE;
+
+#ifdef IW_TRACE
+
+// Start traced operation `ev_` of `type_` if hooks `tr_` are set
+#define IWTRACE_BEGIN(tr_, ev_, type_)          \
+  IWTRACE_EVENT ev_ = { .type = (type_) };      \
+  if ((tr_) && (tr_)->event) iwp_monotonic_time_ns(&(ev_).begin_ns)
+
+// Finish operation `ev_` started by `IWTRACE_BEGIN` and report it to hooks `tr_`
+#define IWTRACE_END(tr_, ev_, size_, dbid_)     \
+  do {                                          \
+    if ((ev_).begin_ns) {                       \
+      (ev_).size = (size_);                     \
+      (ev_).dbid = (dbid_);                     \
+      iwp_monotonic_time_ns(&(ev_).end_ns);     \
+      (tr_)->event(&(ev_), (tr_)->ctx);         \
+    }                                           \
+  } while (0)
+
+// Report already measured operation to hooks `tr_`
+#define IWTRACE_EMIT(tr_, type_, begin_, end_, size_, dbid_)  \
+  do {                                                        \
+    if ((tr_) && (tr_)->event) {                              \
+      IWTRACE_EVENT ev_ = {                                   \
+        .type = (type_),                                      \
+        .dbid = (dbid_),                                      \
+        .begin_ns = (begin_),                                 \
+        .end_ns = (end_),                                     \
+        .size = (size_)                                       \
+      };                                                      \
+      (tr_)->event(&ev_, (tr_)->ctx);                         \
+    }                                                         \
+  } while (0)
+
+#else
+
+#define IWTRACE_BEGIN(tr_, ev_, type_)
+#define IWTRACE_END(tr_, ev_, size_, dbid_)
+#define IWTRACE_EMIT(tr_, type_, begin_, end_, size_, dbid_)
+
+#endif
+
+IW_EXTERN_C_END
+
+#endif
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <CUnit/Basic.h>
 
 #include "iwlog.h"
@@ -102,6 +103,70 @@ void iwlog_test2() {
   unlink(fname);
 }
 
+static void *iwlog_test3_worker(void *op) {
+  int id = (int) (intptr_t) op;
+  for (int i = 0; i < 200; ++i) {
+    iwlog_ecode_warn(IW_ERROR_READONLY, "async-%d-%d", id, i);
+  }
+  return 0;
+}
+
+void iwlog_test3() {
+  size_t sz;
+  char fname[] = "iwlog_test3_XXXXXX";
+  int fd = mkstemp(fname);
+  CU_ASSERT_TRUE_FATAL(fd != -1);
+  FILE *out = fdopen(fd, "w");
+  CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+
+  IWLOG_ASYNC_OPTS opts = {
+    .out = out,
+    .ring_size = 1000,
+    .flush_interval_ms = 10
+  };
+  iwrc rc = iwlog_async_start(&opts);
+  CU_ASSERT_EQUAL_FATAL(rc, 0);
+  CU_ASSERT_EQUAL(iwlog_async_start(&opts), IW_ERROR_INVALID_STATE);
+  iwlog_set_logfn(iwlog_async_logfn);
+
+  pthread_t threads[4];
+  for (int i = 0; i < 4; ++i) {
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&threads[i], 0, iwlog_test3_worker, (void *) (intptr_t) i), 0);
+  }
+  for (int i = 0; i < 4; ++i) {
+    pthread_join(threads[i], 0);
+  }
+  // Rings of exited threads are reused
+  CU_ASSERT_EQUAL_FATAL(pthread_create(&threads[0], 0, iwlog_test3_worker, (void *) (intptr_t) 4), 0);
+  pthread_join(threads[0], 0);
+
+  rc = iwlog_async_stop();
+  CU_ASSERT_EQUAL(rc, 0);
+  CU_ASSERT_EQUAL(iwlog_async_dropped(), 0);
+  // Stopped backend writes synchronously
+  iwlog_info2("async-sync");
+  iwlog_set_logfn(0);
+  fclose(out);
+
+  out = fopen(fname, "r");
+  CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+  static char buf[1024 * 1024];
+  sz = fread(buf, 1, sizeof(buf) - 1, out);
+  buf[sz] = '\0';
+  fclose(out);
+  unlink(fname);
+
+  int lines = 0;
+  for (char *p = buf; (p = strstr(p, "async-")); ++p) {
+    ++lines;
+  }
+  CU_ASSERT_EQUAL(lines, 5 * 200 + 1);
+  CU_ASSERT_PTR_NOT_NULL(strstr(buf, "async-3-199" IW_LINE_SEP));
+  CU_ASSERT_PTR_NOT_NULL(strstr(buf, "async-4-0" IW_LINE_SEP));
+  CU_ASSERT_PTR_NOT_NULL(strstr(buf, "70004|0|0|Resource is readonly. (IW_ERROR_READONLY)|"));
+  CU_ASSERT_PTR_NOT_NULL(strstr(buf, "async-sync"));
+}
+
 int main() {
   CU_pSuite pSuite = NULL;
 
@@ -119,7 +184,8 @@ int main() {
 
   /* Add the tests to the suite */
   if ((NULL == CU_add_test(pSuite, "iwlog_test1", iwlog_test1)) ||
-      (NULL == CU_add_test(pSuite, "iwlog_test2", iwlog_test2))) {
+      (NULL == CU_add_test(pSuite, "iwlog_test2", iwlog_test2)) ||
+      (NULL == CU_add_test(pSuite, "iwlog_test3", iwlog_test3))) {
     CU_cleanup_registry();
     return CU_get_error();
   }
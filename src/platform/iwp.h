@@ -85,6 +85,15 @@ typedef enum {
  */
 IW_EXPORT iwrc iwp_current_time_ms(uint64_t *time);
 
+/**
+ * @brief Get monotonic clock time in nanoseconds.
+ * @details Suitable only for measuring time intervals.
+ *
+ * @param [out] time Time returned
+ * @return `0` for success, or error code
+ */
+IW_EXPORT iwrc iwp_monotonic_time_ns(uint64_t *time);
+
 /**
  * @enum iwp_file_type
  * @brief File type.
@@ -116,6 +125,15 @@ typedef struct IWP_FILE_STAT {
  */
 IW_EXPORT iwrc iwp_fstat(const char *path, IWP_FILE_STAT *stat);
 
+/**
+ * @brief Stat the file specified by opened file handle @a fh.
+ *
+ * @param fh File handle
+ * @param [out] stat File stat info placeholder.
+ * @return `0` on sucess or error code.
+ */
+IW_EXPORT iwrc iwp_fstath(HANDLE fh, IWP_FILE_STAT *stat);
+
 /**
  * @brief Lock the file.
  *
@@ -168,6 +186,37 @@ IW_EXPORT iwrc iwp_write(HANDLE fh, off_t off,
                          const void *buf, size_t siz,
                          size_t *sp);
 
+/**
+ * @brief Positioned I/O request of batch processed by `iwp_readv()`/`iwp_writev()`.
+ */
+typedef struct IWP_IOREQ {
+  off_t off;   /**< File offset */
+  void *buf;   /**< Data buffer */
+  size_t len;  /**< Number of bytes to transfer */
+  size_t sp;   /**< [out] Number of bytes actually transferred */
+} IWP_IOREQ;
+
+/**
+ * @brief Read batch of @a num requests from file @a fh.
+ * @details Runs of requests with adjacent file ranges are served
+ *          by a single vectored system call. Requests are processed
+ *          in the given order, processing is stopped on the first error.
+ *          Interrupted and short transfers are continued, so read request
+ *          is served partially (`sp < len`) only at the end of file.
+ *
+ * @param fh File handle
+ * @param reqs Array of requests, `IWP_IOREQ::sp` is set for every processed request
+ * @param num Number of requests
+ * @return `0` on sucess or error code.
+ */
+IW_EXPORT iwrc iwp_readv(HANDLE fh, IWP_IOREQ *reqs, int num);
+
+/**
+ * @brief Write batch of @a num requests into file @a fh.
+ * @see iwp_readv()
+ */
+IW_EXPORT iwrc iwp_writev(HANDLE fh, IWP_IOREQ *reqs, int num);
+
 /**
   * @brief Copy data within a file
   * @param off Data offset
@@ -178,6 +227,21 @@ IW_EXPORT iwrc iwp_copy_bytes(HANDLE fh,
                               off_t off, size_t siz,
                               off_t noff);
 
+/**
+ * @brief Copy @a siz bytes at offset @a off of file @a fh
+ *        into file @a dfh at offset @a doff.
+ * @details Data is copied by kernel without transfer to user space
+ *          if supported by platform and file systems.
+ * @param fh Source file handle
+ * @param off Source data offset
+ * @param siz Data size
+ * @param dfh Target file handle, must refer to other file than @a fh
+ * @param doff Target data offset
+ * @return `0` on sucess or error code.
+ */
+IW_EXPORT iwrc iwp_copy_file_range(HANDLE fh, off_t off, size_t siz,
+                                   HANDLE dfh, off_t doff);
+
 /**
  * @brief Get system page size.
  */
@@ -191,6 +255,18 @@ IW_EXPORT size_t iwp_page_size(void);
  */
 IW_EXPORT iwrc iwp_ftruncate(HANDLE fh, off_t len);
 
+/**
+ * @brief Allocate disk space for the file range `[off, off + len)`.
+ * @details File size is extended if range ends beyond the end of file.
+ *          Returns `IW_ERROR_NOT_IMPLEMENTED` if preallocation
+ *          is not supported by platform or file system.
+ * @param fh File handle
+ * @param off Range offset
+ * @param len Range length
+ * @return `0` on sucess or error code.
+ */
+IW_EXPORT iwrc iwp_fallocate(HANDLE fh, off_t off, off_t len);
+
 /**
  * @brief Pause execution of current thread
  *        to the specified @a ms time in milliseconds.
@@ -218,6 +294,40 @@ IW_EXPORT iwrc iwp_exec_path(char *opath);
  */
 IW_EXPORT uint16_t iwp_num_cpu_cores();
 
+/**
+ * @brief Return number of NUMA nodes, `1` if system is not NUMA
+ *        or topology is not available.
+ */
+IW_EXPORT uint16_t iwp_num_numa_nodes(void);
+
+/**
+ * @brief Get NUMA node of CPU core @a cpu.
+ * @param cpu CPU core number
+ * @param [out] onode NUMA node of CPU core
+ */
+IW_EXPORT iwrc iwp_numa_cpu_node(uint16_t cpu, uint16_t *onode);
+
+/**
+ * @brief Prefer NUMA @a node for physical pages of memory range.
+ * @details Range is shrunk to the whole pages it contains.
+ *          Already resident pages mapped only by this process are migrated to @a node.
+ *          Page cache pages of file mappings allocated later follow
+ *          memory policy of faulting thread, see `iwp_numa_pin_thread()`.
+ *          Returns `IW_ERROR_NOT_IMPLEMENTED` if NUMA policies are not supported by platform.
+ * @param addr Range start address
+ * @param len Range length
+ * @param node NUMA node
+ */
+IW_EXPORT iwrc iwp_numa_bind(void *addr, size_t len, uint16_t node);
+
+/**
+ * @brief Pin current thread to CPU cores of NUMA @a node
+ *        and prefer @a node for memory allocated by this thread.
+ * @details Returns `IW_ERROR_NOT_IMPLEMENTED` if NUMA policies are not supported by platform.
+ * @param node NUMA node
+ */
+IW_EXPORT iwrc iwp_numa_pin_thread(uint16_t node);
+
 
 /**
  * @brief Init iwp module.
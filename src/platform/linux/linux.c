@@ -36,9 +36,17 @@
 #include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <ftw.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
 
 #ifdef __APPLE__
 #define st_atim st_atimespec
@@ -58,31 +66,54 @@ iwrc iwp_current_time_ms(uint64_t *time) {
   return 0;
 }
 
-IW_EXPORT iwrc iwp_fstat(const char *path, IWP_FILE_STAT *fstat) {
-  assert(path && fstat);
-  iwrc rc = 0;
-  struct stat st = {0};
+iwrc iwp_monotonic_time_ns(uint64_t *time) {
+  struct timespec spec;
+  if (clock_gettime(CLOCK_MONOTONIC, &spec) < 0) {
+    *time = 0;
+    return IW_ERROR_ERRNO;
+  }
+  *time = (uint64_t) spec.tv_sec * 1000000000ULL + spec.tv_nsec;
+  return 0;
+}
+
+static void _iwp_stat_fill(const struct stat *st, IWP_FILE_STAT *fs) {
+  memset(fs, 0, sizeof(*fs));
+  fs->atime = _IW_TIMESPEC2MS(st->st_atim);
+  fs->mtime = _IW_TIMESPEC2MS(st->st_mtim);
+  fs->ctime = _IW_TIMESPEC2MS(st->st_ctim);
+  fs->size = st->st_size;
+
+  if (S_ISREG(st->st_mode)) {
+    fs->ftype = IWP_TYPE_FILE;
+  } else if (S_ISDIR(st->st_mode)) {
+    fs->ftype = IWP_TYPE_DIR;
+  } else if (S_ISLNK(st->st_mode)) {
+    fs->ftype = IWP_LINK;
+  } else {
+    fs->ftype = IWP_OTHER;
+  }
+}
 
-  memset(fstat, 0, sizeof(*fstat));
+IW_EXPORT iwrc iwp_fstat(const char *path, IWP_FILE_STAT *fs) {
+  assert(path && fs);
+  struct stat st = {0};
   if (stat(path, &st)) {
+    memset(fs, 0, sizeof(*fs));
     return (errno == ENOENT) ? IW_ERROR_NOT_EXISTS : IW_ERROR_IO_ERRNO;
   }
+  _iwp_stat_fill(&st, fs);
+  return 0;
+}
 
-  fstat->atime = _IW_TIMESPEC2MS(st.st_atim);
-  fstat->mtime = _IW_TIMESPEC2MS(st.st_mtim);
-  fstat->ctime = _IW_TIMESPEC2MS(st.st_ctim);
-  fstat->size = st.st_size;
-
-  if (S_ISREG(st.st_mode)) {
-    fstat->ftype = IWP_TYPE_FILE;
-  } else if (S_ISDIR(st.st_mode)) {
-    fstat->ftype = IWP_TYPE_DIR;
-  } else if (S_ISLNK(st.st_mode)) {
-    fstat->ftype = IWP_LINK;
-  } else {
-    fstat->ftype = IWP_OTHER;
+IW_EXPORT iwrc iwp_fstath(HANDLE fh, IWP_FILE_STAT *fs) {
+  assert(fs);
+  struct stat st = {0};
+  if (fstat(fh, &st)) {
+    memset(fs, 0, sizeof(*fs));
+    return iwrc_set_errno(IW_ERROR_IO_ERRNO, errno);
   }
-  return rc;
+  _iwp_stat_fill(&st, fs);
+  return 0;
 }
 
 iwrc iwp_flock(HANDLE fd, iwp_lockmode lmode) {
@@ -144,6 +175,71 @@ iwrc iwp_write(HANDLE fh, off_t off, const void *buf, size_t siz, size_t *sp) {
   }
 }
 
+// Max number of buffers passed to single `preadv`/`pwritev` call
+#define IWP_IOV_BATCH 64
+
+static iwrc _iwp_iov(HANDLE fh, IWP_IOREQ *reqs, int num, bool write) {
+  struct iovec iov[IWP_IOV_BATCH];
+  int i = 0;
+  while (i < num) {
+    // Collect run of requests with adjacent ranges
+    int n = 0;
+    size_t total = 0;
+    off_t off = reqs[i].off;
+    while (i + n < num && n < IWP_IOV_BATCH && reqs[i + n].off == off + total) {
+      reqs[i + n].sp = 0;
+      iov[n].iov_base = reqs[i + n].buf;
+      iov[n].iov_len = reqs[i + n].len;
+      total += reqs[i + n].len;
+      ++n;
+    }
+    int j = 0; // First request of run not transferred completely
+    while (j < n) {
+      if (!iov[j].iov_len) {
+        ++j;
+        continue;
+      }
+      ssize_t rs = write ? pwritev(fh, iov + j, n - j, off) : preadv(fh, iov + j, n - j, off);
+      if (rs == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return iwrc_set_errno(IW_ERROR_IO_ERRNO, errno);
+      }
+      if (rs == 0) {
+        if (write) {
+          return iwrc_set_errno(IW_ERROR_IO_ERRNO, EIO);
+        }
+        break; // End of file, the rest of run is not read
+      }
+      off += rs;
+      // Short transfer is continued from the first incomplete request
+      while (rs > 0) {
+        size_t len = MIN(iov[j].iov_len, (size_t) rs);
+        reqs[i + j].sp += len;
+        iov[j].iov_base = (uint8_t *) iov[j].iov_base + len;
+        iov[j].iov_len -= len;
+        rs -= len;
+        if (!iov[j].iov_len) {
+          ++j;
+        }
+      }
+    }
+    i += n;
+  }
+  return 0;
+}
+
+iwrc iwp_readv(HANDLE fh, IWP_IOREQ *reqs, int num) {
+  assert(reqs || !num);
+  return _iwp_iov(fh, reqs, num, false);
+}
+
+iwrc iwp_writev(HANDLE fh, IWP_IOREQ *reqs, int num) {
+  assert(reqs || !num);
+  return _iwp_iov(fh, reqs, num, true);
+}
+
 iwrc iwp_copy_bytes(HANDLE fh, off_t off, size_t siz, off_t noff) {
   int overlap = IW_RANGES_OVERLAP(off, off + siz, noff, noff + siz);
   size_t sp, sp2;
@@ -183,6 +279,46 @@ iwrc iwp_copy_bytes(HANDLE fh, off_t off, size_t siz, off_t noff) {
   return rc;
 }
 
+iwrc iwp_copy_file_range(HANDLE fh, off_t off, size_t siz, HANDLE dfh, off_t doff) {
+  iwrc rc = 0;
+  size_t sp, sp2;
+  uint8_t buf[16384];
+#ifdef __linux__
+  while (siz) {
+    ssize_t n = copy_file_range(fh, &off, dfh, &doff, siz, 0);
+    if (n > 0) {
+      siz -= n;
+    } else if (!n) {
+      return IW_ERROR_OUT_OF_BOUNDS; // Unexpected end of source file
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) {
+      break; // Copy by user space buffer
+    } else {
+      return iwrc_set_errno(IW_ERROR_IO_ERRNO, errno);
+    }
+  }
+#endif
+  while (siz) {
+    rc = iwp_read(fh, off, buf, MIN(sizeof(buf), siz), &sp);
+    RCBREAK(rc);
+    if (!sp) {
+      rc = IW_ERROR_OUT_OF_BOUNDS;
+      break;
+    }
+    rc = iwp_write(dfh, doff, buf, sp, &sp2);
+    RCBREAK(rc);
+    if (sp != sp2) {
+      rc = IW_ERROR_INVALID_STATE;
+      break;
+    }
+    off += sp;
+    doff += sp;
+    siz -= sp;
+  }
+  return rc;
+}
+
 size_t iwp_page_size(void) {
   static off_t _iwp_pagesize = 0;
   if (!_iwp_pagesize) {
@@ -196,6 +332,23 @@ iwrc iwp_ftruncate(HANDLE fh, off_t len) {
   return !rv ? 0 : iwrc_set_errno(IW_ERROR_IO_ERRNO, errno);
 }
 
+iwrc iwp_fallocate(HANDLE fh, off_t off, off_t len) {
+#ifdef __linux__
+  // Plain `fallocate` is used since `posix_fallocate` falls back to
+  // writing of every block if file system does not support preallocation
+  int rv = fallocate(fh, 0, off, len);
+  if (!rv) {
+    return 0;
+  }
+  if (errno == EOPNOTSUPP || errno == ENOSYS) {
+    return IW_ERROR_NOT_IMPLEMENTED;
+  }
+  return iwrc_set_errno(IW_ERROR_IO_ERRNO, errno);
+#else
+  return IW_ERROR_NOT_IMPLEMENTED;
+#endif
+}
+
 iwrc iwp_sleep(uint64_t ms) {
   iwrc rc = 0;
   struct timespec req;
@@ -243,3 +396,121 @@ uint16_t iwp_num_cpu_cores() {
   long res = sysconf(_SC_NPROCESSORS_ONLN);
   return res > 0 ? res : 1;
 }
+
+// Parse the highest number of sysfs cpu/node list like `0-7,16-23`, `-1` on error
+static int _sysfs_list_max(const char *path) {
+  int ret = -1;
+  char buf[4096];
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return -1;
+  }
+  if (fgets(buf, sizeof(buf), f)) {
+    for (char *p = buf; *p;) {
+      char *ep;
+      long v = strtol(p, &ep, 10);
+      if (ep == p) {
+        ++p;
+        continue;
+      }
+      if (v > ret) {
+        ret = v;
+      }
+      p = ep;
+    }
+  }
+  fclose(f);
+  return ret;
+}
+
+uint16_t iwp_num_numa_nodes(void) {
+  int max = _sysfs_list_max("/sys/devices/system/node/possible");
+  return max > 0 ? max + 1 : 1;
+}
+
+iwrc iwp_numa_cpu_node(uint16_t cpu, uint16_t *onode) {
+  char path[64];
+  *onode = 0;
+  for (uint16_t i = 0, num = iwp_num_numa_nodes(); i < num; ++i) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpu%u", i, cpu);
+    if (!access(path, F_OK)) {
+      *onode = i;
+      return 0;
+    }
+  }
+  return cpu < iwp_num_cpu_cores() ? 0 : IW_ERROR_INVALID_ARGS;
+}
+
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_set_mempolicy)
+
+#define _IWP_MPOL_PREFERRED 1
+#define _IWP_MPOL_MF_MOVE   (1 << 1)
+#define _IWP_NODEMASK_BITS  1024
+
+typedef struct {
+  unsigned long bits[_IWP_NODEMASK_BITS / (8 * sizeof(unsigned long))];
+} _IWP_NODEMASK;
+
+static iwrc _numa_nodemask(uint16_t node, _IWP_NODEMASK *mask) {
+  if (node >= _IWP_NODEMASK_BITS || node >= iwp_num_numa_nodes()) {
+    return IW_ERROR_INVALID_ARGS;
+  }
+  memset(mask, 0, sizeof(*mask));
+  mask->bits[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+  return 0;
+}
+
+static iwrc _numa_rc(int err) {
+  return err == ENOSYS ? IW_ERROR_NOT_IMPLEMENTED : iwrc_set_errno(IW_ERROR_ERRNO, err);
+}
+
+iwrc iwp_numa_bind(void *addr, size_t len, uint16_t node) {
+  _IWP_NODEMASK mask;
+  iwrc rc = _numa_nodemask(node, &mask);
+  RCRET(rc);
+  size_t psize = iwp_page_size();
+  uintptr_t start = IW_ROUNDUP((uintptr_t) addr, psize);
+  uintptr_t end = ((uintptr_t) addr + len) & ~(psize - 1);
+  if (end <= start) {
+    return 0;
+  }
+  if (syscall(SYS_mbind, start, end - start, _IWP_MPOL_PREFERRED,
+              mask.bits, _IWP_NODEMASK_BITS, _IWP_MPOL_MF_MOVE)) {
+    return _numa_rc(errno);
+  }
+  return 0;
+}
+
+iwrc iwp_numa_pin_thread(uint16_t node) {
+  char path[64];
+  _IWP_NODEMASK mask;
+  iwrc rc = _numa_nodemask(node, &mask);
+  RCRET(rc);
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (uint16_t i = 0, num = iwp_num_cpu_cores(); i < num && i < CPU_SETSIZE; ++i) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpu%u", node, i);
+    if (!access(path, F_OK)) {
+      CPU_SET(i, &cpus);
+    }
+  }
+  if (CPU_COUNT(&cpus) && sched_setaffinity(0, sizeof(cpus), &cpus)) {
+    return iwrc_set_errno(IW_ERROR_THREADING_ERRNO, errno);
+  }
+  if (syscall(SYS_set_mempolicy, _IWP_MPOL_PREFERRED, mask.bits, _IWP_NODEMASK_BITS)) {
+    return _numa_rc(errno);
+  }
+  return 0;
+}
+
+#else
+
+iwrc iwp_numa_bind(void *addr, size_t len, uint16_t node) {
+  return IW_ERROR_NOT_IMPLEMENTED;
+}
+
+iwrc iwp_numa_pin_thread(uint16_t node) {
+  return IW_ERROR_NOT_IMPLEMENTED;
+}
+
+#endif
@@ -107,6 +107,16 @@ IW_INLINE int iwbits_find_last_sbit64(uint64_t x) {
   return num;
 }
 
+/**
+ * @brief Number of set bits in @a x
+ */
+IW_INLINE int iwbits_count64(uint64_t x) {
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (int) ((x * 0x0101010101010101ULL) >> 56);
+}
+
 /**
  * @brief Reverese bits in a given @a x
  * Thanks to: http://www.hackersdelight.org/hdcodetxt/reverse.c.txt
@@ -0,0 +1,152 @@
+#include "iwlz4.h"
+#include "iwlog.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of hash table entries as power of 2
+#define LZ4_HASHLOG 12
+// Min match length
+#define LZ4_MINMATCH 4
+// Last bytes of input are always stored as literals
+#define LZ4_LASTLITERALS 5
+// Last match must start before this number of bytes from the end of input
+#define LZ4_MFLIMIT 12
+// Max offset of match
+#define LZ4_MAXOFF 65535
+
+IW_INLINE uint32_t _lz4_hash(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return (v * 2654435761U) >> (32 - LZ4_HASHLOG);
+}
+
+IW_INLINE uint8_t *_lz4_putlen(uint8_t *op, size_t len) {
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (uint8_t) len;
+  return op;
+}
+
+// Emit sequence of literals followed by optional match (if `off` is not zero)
+static uint8_t *_lz4_emit(uint8_t *op, const uint8_t *oend,
+                          const uint8_t *lit, size_t litlen, size_t off, size_t mlen) {
+  size_t need = 1 + litlen + litlen / 255 + 1 + (off ? 2 + mlen / 255 + 1 : 0);
+  if (need > oend - op) {
+    return 0;
+  }
+  uint8_t *token = op++;
+  *token = (uint8_t) (MIN(litlen, 15) << 4);
+  if (litlen >= 15) {
+    op = _lz4_putlen(op, litlen - 15);
+  }
+  memcpy(op, lit, litlen);
+  op += litlen;
+  if (off) {
+    *op++ = (uint8_t) off;
+    *op++ = (uint8_t) (off >> 8);
+    *token |= (uint8_t) MIN(mlen, 15);
+    if (mlen >= 15) {
+      op = _lz4_putlen(op, mlen - 15);
+    }
+  }
+  return op;
+}
+
+size_t iwlz4_compress(const void *src, size_t slen, void *dst, size_t dcap) {
+  const uint8_t *base = src;
+  const uint8_t *ip = base, *anchor = base;
+  const uint8_t *iend = base + slen;
+  uint8_t *op = dst;
+  const uint8_t *oend = op + dcap;
+  uint32_t htab[1 << LZ4_HASHLOG] = { 0 };
+
+  if (slen > LZ4_MFLIMIT) {
+    const uint8_t *mflimit = iend - LZ4_MFLIMIT;
+    const uint8_t *mlimit = iend - LZ4_LASTLITERALS;
+    while (ip < mflimit) {
+      uint32_t h = _lz4_hash(ip);
+      const uint8_t *ref = base + htab[h];
+      htab[h] = (uint32_t) (ip - base);
+      if (ref >= ip || ip - ref > LZ4_MAXOFF || memcmp(ref, ip, LZ4_MINMATCH)) {
+        ++ip;
+        continue;
+      }
+      const uint8_t *mp = ip + LZ4_MINMATCH, *rp = ref + LZ4_MINMATCH;
+      while (mp < mlimit && *mp == *rp) {
+        ++mp;
+        ++rp;
+      }
+      op = _lz4_emit(op, oend, anchor, ip - anchor, ip - ref, mp - ip - LZ4_MINMATCH);
+      if (!op) {
+        return 0;
+      }
+      ip = anchor = mp;
+    }
+  }
+  op = _lz4_emit(op, oend, anchor, iend - anchor, 0, 0);
+  return op ? op - (uint8_t *) dst : 0;
+}
+
+IW_INLINE bool _lz4_getlen(const uint8_t **ipp, const uint8_t *iend, size_t *len) {
+  const uint8_t *ip = *ipp;
+  uint8_t b;
+  do {
+    if (ip >= iend) {
+      return false;
+    }
+    b = *ip++;
+    *len += b;
+  } while (b == 255);
+  *ipp = ip;
+  return true;
+}
+
+iwrc iwlz4_decompress(const void *src, size_t slen, void *dst, size_t dlen) {
+  const uint8_t *ip = src;
+  const uint8_t *iend = ip + slen;
+  uint8_t *op = dst;
+  uint8_t *oend = op + dlen;
+  while (ip < iend) {
+    uint8_t token = *ip++;
+    size_t litlen = token >> 4;
+    if (litlen == 15 && !_lz4_getlen(&ip, iend, &litlen)) {
+      return IW_ERROR_INVALID_ARGS;
+    }
+    if (litlen > iend - ip || litlen > oend - op) {
+      return IW_ERROR_INVALID_ARGS;
+    }
+    memcpy(op, ip, litlen);
+    ip += litlen;
+    op += litlen;
+    if (ip >= iend) { // Last sequence
+      break;
+    }
+    if (iend - ip < 2) {
+      return IW_ERROR_INVALID_ARGS;
+    }
+    size_t off = ip[0] | ((size_t) ip[1] << 8);
+    ip += 2;
+    size_t mlen = token & 15;
+    if (mlen == 15 && !_lz4_getlen(&ip, iend, &mlen)) {
+      return IW_ERROR_INVALID_ARGS;
+    }
+    mlen += LZ4_MINMATCH;
+    if (!off || off > op - (uint8_t *) dst || mlen > oend - op) {
+      return IW_ERROR_INVALID_ARGS;
+    }
+    const uint8_t *rp = op - off;
+    if (off >= mlen) {
+      memcpy(op, rp, mlen);
+      op += mlen;
+    } else {
+      while (mlen--) { // Overlapped copy
+        *op++ = *rp++;
+      }
+    }
+  }
+  return op == oend ? 0 : IW_ERROR_INVALID_ARGS;
+}
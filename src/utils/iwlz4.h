@@ -0,0 +1,46 @@
+#pragma once
+#ifndef IWLZ4_H
+#define IWLZ4_H
+
+#include "basedefs.h"
+IW_EXTERN_C_START
+
+#include <stddef.h>
+
+/** @file
+ *  @brief Fast LZ77 compression of small buffers using LZ4 block format.
+ *
+ *  Compressed data is a raw LZ4 block without frame header and checksums,
+ *  the size of uncompressed data must be stored by caller.
+ */
+
+/**
+ * @brief Max size of compressed data for @a len bytes of input.
+ */
+#define IWLZ4_BOUND(len_) ((len_) + (len_) / 255 + 16)
+
+/**
+ * @brief Compress @a slen bytes of @a src into @a dst.
+ *
+ * @param src Source data
+ * @param slen Source data length
+ * @param dst Destination buffer
+ * @param dcap Capacity of destination buffer
+ * @return Size of compressed data or `0` if it doesn't fit into `dcap` bytes.
+ */
+IW_EXPORT size_t iwlz4_compress(const void *src, size_t slen, void *dst, size_t dcap);
+
+/**
+ * @brief Decompress @a slen bytes of @a src into @a dst.
+ *
+ * @param src Compressed data
+ * @param slen Compressed data length
+ * @param dst Destination buffer
+ * @param dlen Size of uncompressed data
+ * @return `0` on success or `IW_ERROR_INVALID_ARGS` if data is malformed
+ *         or its uncompressed size is not equal to `dlen`.
+ */
+IW_EXPORT iwrc iwlz4_decompress(const void *src, size_t slen, void *dst, size_t dlen);
+
+IW_EXTERN_C_END
+#endif
@@ -1,6 +1,8 @@
 #include "iwpool.h"
 #include "iwutils.h"
 #include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
 
 #define _IWPOOL_FREE(p)                     \
   do {                                      \
@@ -12,95 +14,128 @@
 
 /** Atomic heap unit */
 typedef struct IWPOOL_UNIT {
-  void               *heap;
-  struct IWPOOL_UNIT *next;
+  struct IWPOOL_UNIT *next;   /**< Next heap unit */
+  size_t              size;   /**< Heap size */
+  char                heap[]; /**< Heap memory */
 } IWPOOL_UNIT;
 
 /** Memory pool */
 struct IWPOOL {
   IWPOOL_UNIT *head;   /**< First heap unit */
-  char        *heap;   /**< Heap of current heap unit */
-  size_t       usiz;   /**< Used size */
-  size_t       asiz;   /**< Allocated size */
+  char        *heap;   /**< Next free byte of current heap unit */
+  size_t       usiz;   /**< Used size of current heap unit */
+  size_t       asiz;   /**< Allocated size of current heap unit */
   IWPOOL_UNIT *unit;   /**< Current heap unit */
 };
 
+IW_INLINE IWPOOL_UNIT *_iwpool_unit_create(size_t siz) {
+  IWPOOL_UNIT *unit = malloc(sizeof(*unit) + siz);
+  if (!unit) {
+    return 0;
+  }
+  unit->next = 0;
+  unit->size = siz;
+  return unit;
+}
+
+IW_INLINE void _iwpool_unit_use(IWPOOL *pool, IWPOOL_UNIT *unit) {
+  pool->unit = unit;
+  pool->heap = unit->heap;
+  pool->usiz = 0;
+  pool->asiz = unit->size;
+}
+
 IWPOOL *iwpool_create(size_t siz) {
   IWPOOL *pool;
   siz = siz < 1 ? IWPOOL_POOL_SIZ : siz;
   siz = IW_ROUNDUP(siz, IWPOOL_ALIGN_SIZE);
   pool = malloc(sizeof(*pool));
   if (!pool) {
-    goto error;
-  }
-  pool->unit = malloc(sizeof(*pool->unit));
-  if (!pool->unit) {
-    goto error;
+    return 0;
   }
-  pool->unit->heap = malloc(siz);
-  if (!pool->unit->heap) {
-    goto error;
+  pool->head = _iwpool_unit_create(siz);
+  if (!pool->head) {
+    _IWPOOL_FREE(pool);
+    return 0;
   }
-  pool->unit->next = 0;
-  pool->heap = pool->unit->heap;
-  pool->head = pool->unit;
-  pool->usiz = 0;
-  pool->asiz = siz;
+  _iwpool_unit_use(pool, pool->head);
   return pool;
-error:
-  if (pool && pool->unit) {
-    _IWPOOL_FREE(pool->unit->heap);
-    _IWPOOL_FREE(pool->unit);
-  }
-  _IWPOOL_FREE(pool);
-  return 0;
 }
 
-IW_INLINE int iwpool_extend(IWPOOL *pool, IWPOOL_UNIT *unit, size_t siz) {
-  IWPOOL_UNIT *nunit =  malloc(sizeof(*nunit));
-  if (!nunit) {
-    return 0;
+// Switch to the next unit able to hold `siz` bytes aligned by `align`.
+// Units kept by `iwpool_reset()` are reused, too small of them are skipped.
+static int _iwpool_extend(IWPOOL *pool, size_t siz, size_t align) {
+  size_t need = siz + align - 1;
+  IWPOOL_UNIT *unit = pool->unit;
+  while (unit->next) {
+    unit = unit->next;
+    if (unit->size >= need) {
+      _iwpool_unit_use(pool, unit);
+      return 1;
+    }
   }
-  nunit->heap = calloc(1, siz);
-  if (!nunit->heap) {
-    _IWPOOL_FREE(nunit);
+  // Geometric growth of units
+  size_t nsiz = pool->unit->size << 1;
+  if (nsiz < need) {
+    nsiz = IW_ROUNDUP(need, IWPOOL_ALIGN_SIZE);
+  }
+  IWPOOL_UNIT *nunit = _iwpool_unit_create(nsiz);
+  if (!nunit) {
     return 0;
   }
-  nunit->next = 0;
   unit->next = nunit;
-  pool->heap = unit->heap;
+  _iwpool_unit_use(pool, nunit);
   return 1;
 }
 
+void *iwpool_alloc_aligned(size_t siz, size_t align, IWPOOL *pool) {
+  assert(align && !(align & (align - 1)));
+  uintptr_t p = IW_ROUNDUP((uintptr_t) pool->heap, align);
+  size_t usiz = pool->usiz + (p - (uintptr_t) pool->heap) + siz;
+  if (usiz > pool->asiz) {
+    if (!_iwpool_extend(pool, siz, align)) {
+      return 0;
+    }
+    p = IW_ROUNDUP((uintptr_t) pool->heap, align);
+    usiz = pool->usiz + (p - (uintptr_t) pool->heap) + siz;
+  }
+  pool->heap += usiz - pool->usiz;
+  pool->usiz = usiz;
+  return (void *) p;
+}
+
 void *iwpool_alloc(size_t siz, IWPOOL *pool) {
   siz = IW_ROUNDUP(siz, IWPOOL_ALIGN_SIZE);
-  IWPOOL_UNIT  *unit = pool->unit;
-  size_t usiz = pool->usiz + siz;
-  size_t asiz = pool->asiz;
-  void *d = pool->heap;
-  if (usiz > asiz) {
-    size_t nsiz = usiz << 1;
-    if (!iwpool_extend(pool, unit, nsiz)) {
+  if (pool->usiz + siz > pool->asiz) {
+    if (!_iwpool_extend(pool, siz, 1)) {
       return 0;
     }
-    pool->usiz = 0;
-    pool->asiz = nsiz;
-    pool->unit = unit->next;
-    d = pool->heap;
-  } else {
-    pool->usiz = usiz;
   }
+  void *d = pool->heap;
+  pool->usiz += siz;
   pool->heap += siz;
   return d;
 }
 
+void iwpool_reset(IWPOOL *pool) {
+  _iwpool_unit_use(pool, pool->head);
+}
+
+size_t iwpool_allocated_size(IWPOOL *pool) {
+  size_t ret = 0;
+  for (IWPOOL_UNIT *u = pool->head; u; u = u->next) {
+    ret += u->size;
+  }
+  return ret;
+}
+
 void iwpool_destroy(IWPOOL *pool) {
   if (!pool) {
     return;
   }
   for (IWPOOL_UNIT *cur = pool->head, *next; cur; cur = next) {
     next = cur->next;
-    _IWPOOL_FREE(cur->heap);
-    _IWPOOL_FREE(cur);
+    free(cur);
   }
+  free(pool);
 }
@@ -43,10 +43,47 @@ IW_EXTERN_C_START
 struct IWPOOL;
 typedef struct IWPOOL IWPOOL;
 
+/**
+ * @brief Create memory pool.
+ * @details Pool allocates memory by bumping pointer in heap units.
+ *          Every next unit is at least twice larger than the previous one.
+ *
+ * @param siz Size of the first heap unit. `IWPOOL_POOL_SIZ` if zero.
+ * @return Pool or zero if memory allocation failed.
+ */
 IW_EXPORT IWPOOL *iwpool_create(size_t siz);
 
+/**
+ * @brief Allocate `siz` bytes aligned by `IWPOOL_ALIGN_SIZE`.
+ * @return Pointer to allocated memory or zero if memory allocation failed.
+ */
 IW_EXPORT void *iwpool_alloc(size_t siz, IWPOOL *pool);
 
+/**
+ * @brief Allocate `siz` bytes aligned by `align`.
+ *
+ * @param siz Size of memory block
+ * @param align Alignment, must be a power of 2
+ * @param pool Memory pool
+ * @return Pointer to allocated memory or zero if memory allocation failed.
+ */
+IW_EXPORT void *iwpool_alloc_aligned(size_t siz, size_t align, IWPOOL *pool);
+
+/**
+ * @brief Release all memory allocated from pool at once.
+ * @details Heap units are kept and reused by later allocations,
+ *          so pool which has grown to its working size makes no further `malloc` calls.
+ */
+IW_EXPORT void iwpool_reset(IWPOOL *pool);
+
+/**
+ * @brief Total size of heap units of pool.
+ */
+IW_EXPORT size_t iwpool_allocated_size(IWPOOL *pool);
+
+/**
+ * @brief Destroy pool and free all its memory.
+ */
 IW_EXPORT void iwpool_destroy(IWPOOL *pool);
 
 IW_EXTERN_C_END
@@ -330,6 +330,14 @@ IW_EXPORT int iwlog2_32(uint32_t val);
 
 IW_EXPORT int iwlog2_64(uint64_t val);
 
+/**
+ * @brief Compute CRC32 (IEEE 802.3) checksum of the given buffer.
+ * @param buf Data buffer
+ * @param len Buffer length
+ * @param init Checksum of preceding data, `0` for the first chunk
+ */
+IW_EXPORT uint32_t iwu_crc32(const uint8_t *buf, int len, uint32_t init);
+
 IW_EXTERN_C_END
 
 #endif
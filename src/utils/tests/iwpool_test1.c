@@ -0,0 +1,82 @@
+#include "iowow.h"
+#include "iwcfg.h"
+#include <CUnit/Basic.h>
+#include "iwpool.h"
+
+
+int init_suite(void) {
+  return iw_init();
+}
+
+int clean_suite(void) {
+  return 0;
+}
+
+void test_iwpool1(void) {
+  IWPOOL *pool = iwpool_create(64);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+  char *p1 = iwpool_alloc(10, pool);
+  char *p2 = iwpool_alloc(10, pool);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(p1);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(p2);
+  CU_ASSERT_TRUE(p2 >= p1 + 10);
+  memset(p1, 'a', 10);
+  memset(p2, 'b', 10);
+  CU_ASSERT_EQUAL(p1[9], 'a');
+  // Larger than first unit
+  char *p3 = iwpool_alloc(1000, pool);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(p3);
+  memset(p3, 'c', 1000);
+  CU_ASSERT_EQUAL(p2[9], 'b');
+  for (size_t align = 1; align <= 4096; align <<= 1) {
+    void *p = iwpool_alloc_aligned(3, align, pool);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(p);
+    CU_ASSERT_EQUAL((uintptr_t) p % align, 0);
+  }
+  CU_ASSERT_TRUE(iwpool_allocated_size(pool) >= 1020);
+  // Units are reused after reset
+  size_t asz = 0;
+  for (int i = 0; i < 100; ++i) {
+    if (i == 1) {
+      asz = iwpool_allocated_size(pool);
+    }
+    iwpool_reset(pool);
+    p3 = iwpool_alloc(1000, pool);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(p3);
+    memset(p3, 'd', 1000);
+    for (size_t align = 1; align <= 4096; align <<= 1) {
+      CU_ASSERT_PTR_NOT_NULL_FATAL(iwpool_alloc_aligned(3, align, pool));
+    }
+  }
+  CU_ASSERT_EQUAL(iwpool_allocated_size(pool), asz);
+  iwpool_destroy(pool);
+}
+
+int main() {
+  CU_pSuite pSuite = NULL;
+
+  /* Initialize the CUnit test registry */
+  if (CUE_SUCCESS != CU_initialize_registry())
+    return CU_get_error();
+
+  /* Add a suite to the registry */
+  pSuite = CU_add_suite("iwpool_test1", init_suite, clean_suite);
+
+  if (NULL == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  /* Add the tests to the suite */
+  if ((NULL == CU_add_test(pSuite, "test_iwpool1", test_iwpool1))) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  /* Run all tests using the CUnit Basic interface */
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  int ret = CU_get_error() || CU_get_number_of_failures();
+  CU_cleanup_registry();
+  return ret;
+}